@@ -0,0 +1,765 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+/*
+ * Microbenchmarks of the marshalling and I/O hot paths of the addon.
+ * The addon is loaded into the host emulator, so the numbers include the cost of
+ * the addon_apis calls of the emulator but not those of the V8 bindings of UXP.
+ *     uxp-bench                     run all benchmarks
+ *     uxp-bench --filter <text>     run the benchmarks whose name contains text
+ *     uxp-bench --min-time <ms>     measure each benchmark for at least ms (default 500)
+ *     uxp-bench --quick             small sizes and short runs, to check that it works
+ *     uxp-bench --out <file>        write the report to a file instead of stdout
+ * metrics/call_scope is the cost that UXP_ADDON_METRICS adds to every export call.
+ * The report is JSON: { "context": {...}, "benchmarks": [ { "name", "iterations",
+ * "bytes_per_op", "mean_ns", "median_ns", "p99_ns", "min_ns", "mb_per_s" }, ... ] }
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "UxpHostEmulator.h"
+#include "utilities/UxpAddon.h"
+#include "utilities/UxpAtlas.h"
+#include "utilities/UxpCompositing.h"
+#include "utilities/UxpDifference.h"
+#include "utilities/UxpFiles.h"
+#include "utilities/UxpIoEngine.h"
+#include "utilities/UxpMetrics.h"
+#include "utilities/UxpPack.h"
+#include "utilities/UxpPixelKernels.h"
+#include "utilities/UxpPixels.h"
+#include "utilities/UxpPlaceholder.h"
+#include "utilities/UxpRecords.h"
+#include "utilities/UxpSimilarity.h"
+#include "utilities/UxpTask.h"
+#include "utilities/UxpValue.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string filter;
+    std::chrono::milliseconds minTime{500};
+    bool quick{false};
+    std::string output;
+};
+
+struct Result {
+    std::string name;
+    size_t iterations{0};
+    size_t bytesPerOp{0};
+    double meanNs{0};
+    double medianNs{0};
+    double p99Ns{0};
+    double minNs{0};
+};
+
+class Runner {
+ public:
+    Runner(HostEmulator& host, const Options& options) : mHost(host), mOptions(options) {}
+
+    // Measure body until the minimum time elapsed (and at least 3 iterations ran).
+    // Every iteration runs in its own handle scope so that the values it creates are released.
+    void Run(const std::string& name, size_t bytesPerOp, const std::function<void()>& body) {
+        if (!mOptions.filter.empty() && name.find(mOptions.filter) == std::string::npos)
+            return;
+
+        {
+            HostEmulator::Scope scope(mHost);
+            body();  // warm up
+        }
+
+        std::vector<double> samples;
+        const auto deadline = Clock::now() + mOptions.minTime;
+        while (samples.size() < 3 || Clock::now() < deadline) {
+            HostEmulator::Scope scope(mHost);
+            const auto start = Clock::now();
+            body();
+            samples.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+        }
+
+        std::sort(samples.begin(), samples.end());
+        Result result;
+        result.name = name;
+        result.iterations = samples.size();
+        result.bytesPerOp = bytesPerOp;
+        double total = 0;
+        for (double sample : samples)
+            total += sample;
+        result.meanNs = total / samples.size();
+        result.medianNs = samples[samples.size() / 2];
+        result.p99Ns = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+        result.minNs = samples.front();
+        mResults.push_back(result);
+
+        std::fprintf(stderr, "%-48s %10zu it %14.0f ns/op\n", name.c_str(), result.iterations, result.medianNs);
+    }
+
+    const std::vector<Result>& GetResults() const { return mResults; }
+
+ private:
+    HostEmulator& mHost;
+    const Options& mOptions;
+    std::vector<Result> mResults;
+};
+
+std::string SizeLabel(size_t size) {
+    if (size >= 1024 * 1024)
+        return std::to_string(size / (1024 * 1024)) + "MB";
+    return std::to_string(size / 1024) + "KB";
+}
+
+std::string RandomText(size_t size) {
+    static const char kAlphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 .,-_";
+    std::mt19937 random(42);
+    std::uniform_int_distribution<size_t> pick(0, sizeof(kAlphabet) - 2);
+    std::string result(size, ' ');
+    for (char& c : result)
+        c = kAlphabet[pick(random)];
+    return result;
+}
+
+std::string Base64Encode(const std::string& data) {
+    static const char kChars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string result;
+    result.reserve((data.size() + 2) / 3 * 4);
+    size_t index = 0;
+    for (; index + 2 < data.size(); index += 3) {
+        const uint32_t triple = (uint8_t(data[index]) << 16) | (uint8_t(data[index + 1]) << 8) | uint8_t(data[index + 2]);
+        result += kChars[(triple >> 18) & 63];
+        result += kChars[(triple >> 12) & 63];
+        result += kChars[(triple >> 6) & 63];
+        result += kChars[triple & 63];
+    }
+    if (index < data.size()) {
+        uint32_t triple = uint8_t(data[index]) << 16;
+        if (index + 1 < data.size())
+            triple |= uint8_t(data[index + 1]) << 8;
+        result += kChars[(triple >> 18) & 63];
+        result += kChars[(triple >> 12) & 63];
+        result += index + 1 < data.size() ? kChars[(triple >> 6) & 63] : '=';
+        result += '=';
+    }
+    return result;
+}
+
+// A list nested depth times, with a number at the bottom
+Value DeepTree(size_t depth) {
+    Value root(Value::Kind::list);
+    Value* current = &root;
+    for (size_t level = 1; level < depth; ++level) {
+        current->GetList().emplace_back(Value::Kind::list);
+        current = &current->GetList().back();
+    }
+    current->GetList().emplace_back(double(depth));
+    return root;
+}
+
+// A map of width entries, each a small { name, size, tags } record
+Value WideTree(size_t width) {
+    Value root(Value::Kind::map);
+    for (size_t index = 0; index < width; ++index) {
+        Value entry(Value::Kind::map);
+        entry.GetMap().emplace("name", Value(std::string("clip-") + std::to_string(index)));
+        entry.GetMap().emplace("size", Value(double(index)));
+        Value tags(Value::Kind::list);
+        tags.GetList().emplace_back(true);
+        tags.GetList().emplace_back(std::string("tag"));
+        entry.GetMap().emplace("tags", std::move(tags));
+        root.GetMap().emplace("entry" + std::to_string(index), std::move(entry));
+    }
+    return root;
+}
+
+void Await(HostEmulator& host, addon_value promise) {
+    addon_value result = nullptr;
+    bool rejected = false;
+    if (!host.IsPromise(promise) || !host.Await(promise, &result, &rejected) || rejected) {
+        std::fprintf(stderr, "promise failed: %s\n", host.Describe(result).c_str());
+        std::exit(1);
+    }
+}
+
+void StringBenchmarks(Runner& runner, HostEmulator& host, const Options& options) {
+    std::vector<size_t> sizes = {1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024, 100 * 1024 * 1024};
+    if (options.quick)
+        sizes = {1024, 64 * 1024};
+
+    const addon_env env = host.GetEnv();
+    for (size_t size : sizes) {
+        const std::string text = RandomText(size);
+        addon_value string = host.String(text);
+        const std::string label = SizeLabel(size);
+
+        runner.Run("string/get_string_argument/" + label, size, [&]() {
+            if (GetStringArgument(env, string).size() != size)
+                std::exit(1);
+        });
+        runner.Run("string/value_from_js/" + label, size, [&]() { Value value(env, string); });
+        runner.Run("string/value_to_js/" + label, size, [&]() { Value(text).Convert(env); });
+    }
+}
+
+void TreeBenchmarks(Runner& runner, HostEmulator& host, const Options& options) {
+    const addon_env env = host.GetEnv();
+    const size_t depth = options.quick ? 16 : 512;
+    const size_t width = options.quick ? 64 : 10000;
+
+    const Value deep = DeepTree(depth);
+    addon_value deepValue = deep.Convert(env);
+    runner.Run("value/convert_deep_to_js/" + std::to_string(depth), 0, [&]() { deep.Convert(env); });
+    runner.Run("value/convert_deep_from_js/" + std::to_string(depth), 0, [&]() { Value value(env, deepValue); });
+
+    const Value wide = WideTree(width);
+    addon_value wideValue = wide.Convert(env);
+    runner.Run("value/convert_wide_to_js/" + std::to_string(width), 0, [&]() { wide.Convert(env); });
+    runner.Run("value/convert_wide_from_js/" + std::to_string(width), 0, [&]() { Value value(env, wideValue); });
+}
+
+void Base64Benchmarks(Runner& runner, const Options& options) {
+    std::vector<size_t> sizes = {1024, 1024 * 1024, 16 * 1024 * 1024};
+    if (options.quick)
+        sizes = {1024, 64 * 1024};
+
+    for (size_t size : sizes) {
+        const std::string encoded = Base64Encode(RandomText(size));
+        runner.Run("base64/decode/" + SizeLabel(size), encoded.size(), [&]() {
+            if (Base64Decode(encoded).size() != size)
+                std::exit(1);
+        });
+    }
+}
+
+void WriteFileBenchmarks(Runner& runner, HostEmulator& host, addon_value exports, const Options& options) {
+    std::vector<size_t> sizes = {4 * 1024, 1024 * 1024, 16 * 1024 * 1024};
+    if (options.quick)
+        sizes = {4 * 1024};
+
+    const auto directory = std::filesystem::temp_directory_path() / "uxp-bench";
+    std::filesystem::create_directories(directory);
+    addon_value path = host.String((directory / "payload.bin").string());
+
+    for (size_t size : sizes) {
+        const std::string text = RandomText(size);
+        addon_value plain = host.String(text);
+        addon_value encoded = host.String(Base64Encode(text));
+        addon_value yes = host.Boolean(true);
+
+        runner.Run("write_file/plain/" + SizeLabel(size), size, [&]() {
+            if (!host.GetBoolean(host.Call(exports, "writeFile", {path, plain})))
+                std::exit(1);
+        });
+        runner.Run("write_file/base64/" + SizeLabel(size), size, [&]() {
+            if (!host.GetBoolean(host.Call(exports, "writeFile", {path, encoded, yes})))
+                std::exit(1);
+        });
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(directory, ec);
+}
+
+// Imports of a clip: copyFiles against the round trip of its contents through writeFile
+void CopyFileBenchmarks(Runner& runner, HostEmulator& host, addon_value exports, const Options& options) {
+    std::vector<size_t> sizes = {1024 * 1024, 64 * 1024 * 1024};
+    if (options.quick)
+        sizes = {64 * 1024};
+
+    const auto directory = std::filesystem::temp_directory_path() / "uxp-bench-copy";
+    std::filesystem::create_directories(directory);
+    const auto source = directory / "clip.mp4";
+    addon_value destination = host.String((directory / "imported.mp4").string());
+
+    for (size_t size : sizes) {
+        const std::string contents = RandomText(size);
+        std::ofstream(source, std::ios::binary).write(contents.data(), static_cast<std::streamsize>(size));
+
+        addon_value entry = host.Object();
+        host.SetProperty(entry, "src", host.String(source.string()));
+        host.SetProperty(entry, "dst", destination);
+        addon_value entries = host.Array({entry});
+        runner.Run("copy_file/copy_files/" + SizeLabel(size), size, [&]() { Await(host, host.Call(exports, "copyFiles", {entries})); });
+
+        addon_value payload = host.String(contents);
+        runner.Run("copy_file/write_file/" + SizeLabel(size), size, [&]() {
+            if (!host.GetBoolean(host.Call(exports, "writeFile", {destination, payload})))
+                std::exit(1);
+        });
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(directory, ec);
+}
+
+// Batches of thumbnails written and read back through the I/O engine. The backend is
+// chosen once per process: run again with UXP_ADDON_IO_BACKEND=threads to compare.
+void BatchIoBenchmarks(Runner& runner, HostEmulator& host, addon_value exports, const Options& options) {
+    const size_t count = options.quick ? 16 : 256;
+    const size_t size = 64 * 1024;
+    const auto directory = std::filesystem::temp_directory_path() / "uxp-bench-batch";
+    std::filesystem::create_directories(directory);
+
+    const std::string contents = RandomText(size);
+    std::vector<addon_value> entries;
+    std::vector<addon_value> paths;
+    for (size_t index = 0; index < count; ++index) {
+        addon_value path = host.String((directory / (std::to_string(index) + "_thumbnail.jpg")).string());
+        addon_value entry = host.Object();
+        host.SetProperty(entry, "path", path);
+        host.SetProperty(entry, "data", host.String(contents));
+        entries.push_back(entry);
+        paths.push_back(path);
+    }
+    addon_value list = host.Array(entries);
+    addon_value durable = host.Object();
+    host.SetProperty(durable, "durable", host.Boolean(true));
+
+    const std::string prefix = std::string("batch_io/") + IoEngine::Instance().GetBackend() + "/";
+    runner.Run(prefix + "write_files", count * size, [&]() { Await(host, host.Call(exports, "writeFiles", {list})); });
+    runner.Run(prefix + "write_files_durable", count * size,
+               [&]() { Await(host, host.Call(exports, "writeFiles", {list, durable})); });
+    addon_value pathList = host.Array(paths);
+    runner.Run(prefix + "read_files", count * size, [&]() { Await(host, host.Call(exports, "readFiles", {pathList})); });
+
+    std::error_code ec;
+    std::filesystem::remove_all(directory, ec);
+}
+
+// Saves of a sidecar into a dated folder, by full path or through a storage session
+void StorageSessionBenchmarks(Runner& runner, HostEmulator& host, addon_value exports) {
+    const auto directory = std::filesystem::temp_directory_path() / "uxp-bench-session";
+    std::filesystem::create_directories(directory);
+    addon_value payload = host.String(RandomText(512));
+
+    addon_value path = host.String((directory / "2024-05-01" / "image.png.json").string());
+    runner.Run("storage_session/write_file", 512, [&]() {
+        if (!host.GetBoolean(host.Call(exports, "writeFile", {path, payload})))
+            std::exit(1);
+    });
+
+    addon_value session = host.Call(exports, "openStorage", {host.String(directory.string())});
+    addon_value relative = host.String("2024-05-01/image.png.json");
+    runner.Run("storage_session/session_write", 512, [&]() {
+        if (!host.GetBoolean(host.Call(session, "writeFile", {relative, payload})))
+            std::exit(1);
+    });
+    host.Call(session, "close", {});
+
+    std::error_code ec;
+    std::filesystem::remove_all(directory, ec);
+}
+
+// Sidecars written as files of a directory or into its pack, then read back as a scan would
+void PackBenchmarks(Runner& runner, HostEmulator& host, addon_value exports, const Options& options) {
+    const size_t count = options.quick ? 100 : 5000;
+    const auto directory = std::filesystem::temp_directory_path() / "uxp-bench-pack";
+    std::error_code ec;
+    std::filesystem::remove_all(directory, ec);
+    const auto loose = directory / "loose";
+    const auto packed = directory / "packed";
+    std::filesystem::create_directories(loose);
+    std::filesystem::create_directories(packed);
+
+    const std::string sidecar = RandomText(1024);
+    addon_value data = host.String(sidecar);
+    addon_value packOptions = host.Object();
+    host.SetProperty(packOptions, "pack", host.Boolean(true));
+    for (size_t index = 0; index < count; ++index) {
+        const std::string name = std::to_string(index) + ".json";
+        if (!host.GetBoolean(host.Call(exports, "writeFile", {host.String((loose / name).string()), data})) ||
+            !host.GetBoolean(host.Call(exports, "writeFile", {host.String((packed / name).string()), data, packOptions})))
+            std::exit(1);
+    }
+
+    const std::string label = std::to_string(count);
+    runner.Run("pack/scan_files/" + label, count * sidecar.size(), [&]() {
+        size_t bytes = 0;
+        for (const auto& entry : std::filesystem::directory_iterator(loose)) {
+            std::ifstream input(entry.path(), std::ios::binary);
+            std::string contents((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+            bytes += contents.size();
+        }
+        if (bytes != count * sidecar.size())
+            std::exit(1);
+    });
+    runner.Run("pack/scan_pack/" + label, count * sidecar.size(), [&]() {
+        size_t bytes = 0;
+        std::string contents;
+        for (const auto& name : PackStore::Instance().List(packed.string())) {
+            PackStore::Instance().Read(packed.string(), name, contents);
+            bytes += contents.size();
+        }
+        if (bytes != count * sidecar.size())
+            std::exit(1);
+    });
+
+    // Replacing a sidecar, which appends to the pack until it is compacted
+    addon_value loosePath = host.String((loose / "0.json").string());
+    addon_value packedPath = host.String((packed / "0.json").string());
+    runner.Run("pack/write_file/" + SizeLabel(sidecar.size()), sidecar.size(), [&]() {
+        if (!host.GetBoolean(host.Call(exports, "writeFile", {loosePath, data})))
+            std::exit(1);
+    });
+    runner.Run("pack/write_pack/" + SizeLabel(sidecar.size()), sidecar.size(), [&]() {
+        if (!host.GetBoolean(host.Call(exports, "writeFile", {packedPath, data, packOptions})))
+            std::exit(1);
+    });
+
+    PackStore::Instance().Close();
+    std::filesystem::remove_all(directory, ec);
+}
+
+void TaskBenchmarks(Runner& runner, HostEmulator& host, addon_value exports) {
+    const addon_env env = host.GetEnv();
+
+    // JavaScript -> worker -> JavaScript
+    runner.Run("task/round_trip_worker", 0, [&]() {
+        auto task = Task::Create();
+        task->Then(Task::Lane::worker, [](Task& task) { task.SetResult(Value(1.0), false); });
+        Await(host, task->Start(env));
+    });
+
+    // JavaScript -> main -> JavaScript
+    runner.Run("task/round_trip_main", 0, [&]() {
+        auto task = Task::Create();
+        Await(host, task->ScheduleOnMainThread(env, [](Task& task) { task.SetResult(Value(1.0), false); }));
+    });
+
+    // The same hop through the coroutine front-end of my_echo_async
+    addon_value input = host.String("echo");
+    runner.Run("task/round_trip_coroutine", 0, [&]() { Await(host, host.Call(exports, "my_echo_async", {input})); });
+}
+
+void ChannelBenchmarks(Runner& runner, HostEmulator& host, const Options& options) {
+    // Small records from a worker thread to a JavaScript callback, through the ring
+    const size_t count = options.quick ? 10000 : 100000;
+    size_t calls = 0;
+    addon_value onRecords = host.Function([&host, &calls](addon_env, const std::vector<addon_value>&) {
+        ++calls;
+        return host.Undefined();
+    });
+    runner.Run("channel/push_records/" + std::to_string(count), count * 12, [&]() {
+        calls = 0;
+        auto channel = RecordChannel::Create(host.GetEnv(), onRecords);
+        std::atomic<bool> done{false};
+        std::thread producer([&]() {
+            for (uint32_t index = 0; index < count; ++index) {
+                const uint32_t record[2] = {index, index * 2};
+                channel->Push(1, record, sizeof(record));
+            }
+            done = true;
+        });
+        while (!done)
+            host.PumpScriptQueue(std::chrono::milliseconds(1));
+        producer.join();
+        channel->Close();
+    });
+    std::fprintf(stderr, "%-48s %10zu calls per run\n", "", calls);
+}
+
+void SimilarityBenchmarks(Runner& runner, const Options& options) {
+    Bitmap bitmap;
+    bitmap.width = bitmap.height = options.quick ? 256 : 1024;
+    bitmap.pixels.resize(size_t(bitmap.width) * bitmap.height * 4);
+    std::mt19937 random(42);
+    for (auto& component : bitmap.pixels)
+        component = static_cast<uint8_t>(random());
+    runner.Run("image/perceptual_hash/" + std::to_string(bitmap.width), bitmap.pixels.size(), [&]() {
+        ComputePerceptualHash(bitmap);
+    });
+    runner.Run("image/placeholder/" + std::to_string(bitmap.width), bitmap.pixels.size(), [&]() { ComputePlaceholder(bitmap); });
+    // As placeholders computes it from a JPEG, decoded at 1/8. Gradients rather than noise,
+    // which would make the JPEG several times larger than a photograph.
+    Bitmap smooth = bitmap;
+    for (uint32_t y = 0; y < smooth.height; ++y) {
+        for (uint32_t x = 0; x < smooth.width; ++x) {
+            uint8_t* pixel = &smooth.pixels[(size_t(y) * smooth.width + x) * 4];
+            pixel[0] = static_cast<uint8_t>(x * 255 / smooth.width);
+            pixel[1] = static_cast<uint8_t>(y * 255 / smooth.height);
+            pixel[2] = static_cast<uint8_t>((x + y) * 127 / smooth.width + pixel[2] % 8);
+            pixel[3] = 255;
+        }
+    }
+    const std::string jpeg = EncodeJpeg(smooth.pixels.data(), smooth.width, smooth.height, 85);
+    runner.Run("image/placeholder_jpeg/" + std::to_string(bitmap.width), jpeg.size(), [&]() {
+        Bitmap decoded;
+        if (!DecodeImage(reinterpret_cast<const uint8_t*>(jpeg.data()), jpeg.size(), decoded, kPlaceholderSize))
+            std::exit(1);
+        ComputePlaceholder(decoded);
+    });
+
+    // A library where one image in ten is a near-duplicate (a few bits off) of another
+    const size_t count = options.quick ? 2000 : 20000;
+    std::vector<uint64_t> hashes;
+    std::mt19937_64 random64(42);
+    for (size_t index = 0; index < count; ++index) {
+        if (index % 10 == 9)
+            hashes.push_back(hashes[random64() % index] ^ (uint64_t(1) << (random64() % 64)) ^ (uint64_t(1) << (random64() % 64)));
+        else
+            hashes.push_back(random64());
+    }
+    runner.Run("image/group_hashes/" + std::to_string(count), 0, [&]() {
+        if (GroupHashes(hashes, 8).empty())
+            std::exit(1);
+    });
+}
+
+// A 4K mask (1024x512 with --quick): a disc over a noisy background
+Mask BenchMask(const Options& options) {
+    Mask mask;
+    mask.width = options.quick ? 1024 : 3840;
+    mask.height = options.quick ? 512 : 2160;
+    mask.values.resize(size_t(mask.width) * mask.height);
+    std::mt19937 random(42);
+    const int64_t radius = mask.height / 2 - 20;
+    for (uint32_t y = 0; y < mask.height; ++y) {
+        for (uint32_t x = 0; x < mask.width; ++x) {
+            const int64_t dx = int64_t(x) - mask.width / 2;
+            const int64_t dy = int64_t(y) - mask.height / 2;
+            mask.values[size_t(y) * mask.width + x] = dx * dx + dy * dy < radius * radius ? 230 : static_cast<uint8_t>(random() % 64);
+        }
+    }
+    return mask;
+}
+
+void CompositingBenchmarks(Runner& runner, const Options& options) {
+    const Mask source = BenchMask(options);
+    const std::string size = std::to_string(source.width) + "x" + std::to_string(source.height);
+    Mask mask = source;
+    runner.Run("mask/threshold/" + size, mask.values.size(), [&]() { ThresholdMask(mask, 128); });
+    runner.Run("mask/dilate_8/" + size, mask.values.size(), [&]() { DilateMask(mask, 8); });
+    runner.Run("mask/feather_4/" + size, mask.values.size(), [&]() { FeatherMask(mask, 4); });
+
+    Bitmap bitmap;
+    bitmap.width = source.width;
+    bitmap.height = source.height;
+    bitmap.pixels.resize(size_t(bitmap.width) * bitmap.height * 4);
+    std::mt19937 random(42);
+    for (auto& component : bitmap.pixels)
+        component = static_cast<uint8_t>(random());
+    Bitmap background = bitmap;
+    std::reverse(background.pixels.begin(), background.pixels.end());
+    PremultiplyBitmap(background);
+    runner.Run("image/composite/" + size, bitmap.pixels.size(), [&]() {
+        Bitmap pixels = bitmap;
+        ApplyMask(pixels, source);
+        PremultiplyBitmap(pixels);
+        CompositeOver(pixels, background);
+        UnpremultiplyBitmap(pixels);
+    });
+    // A corrected version where one tile row in 8 changed
+    Bitmap corrected = bitmap;
+    for (size_t y = 0; y < corrected.height; y += 256) {
+        for (size_t index = y * corrected.width * 4; index < std::min<size_t>(y + 32, corrected.height) * corrected.width * 4; index += 7)
+            corrected.pixels[index] ^= 0x40;
+    }
+    runner.Run("image/diff/" + size, bitmap.pixels.size(), [&]() {
+        if (DiffBitmaps(bitmap, corrected, 8, 32, false).regions.empty())
+            std::exit(1);
+    });
+    runner.Run("image/encode_png_mask/" + size, source.values.size(), [&]() {
+        EncodePng(source.values.data(), source.width, source.height, 1);
+    });
+    // The mask as a gray image, which compresses like a photograph rather than like noise
+    Bitmap gray = bitmap;
+    for (size_t index = 0; index < source.values.size(); ++index) {
+        std::fill_n(&gray.pixels[index * 4], 3, source.values[index]);
+        gray.pixels[index * 4 + 3] = 255;
+    }
+    runner.Run("image/encode_jpeg/" + size, gray.pixels.size(), [&]() { EncodeJpeg(gray.pixels.data(), gray.width, gray.height, 85); });
+    const AtlasOptions atlas;
+    Bitmap sheet = CreateSheet(atlas.tileWidth, atlas.tileHeight, atlas);
+    runner.Run("atlas/draw_tile/" + size, gray.pixels.size(), [&]() { DrawTile(sheet, 0, 0, gray, atlas); });
+
+    // Each set of kernels the CPU can run, on a row of 64 KB
+    constexpr size_t kCount = 65536;
+    std::vector<uint8_t> values(kCount), other(kCount), out(kCount);
+    std::vector<uint8_t> pixels(kCount);
+    for (size_t index = 0; index < kCount; ++index) {
+        values[index] = static_cast<uint8_t>(random());
+        other[index] = static_cast<uint8_t>(random());
+        pixels[index] = static_cast<uint8_t>(random());
+    }
+    for (const char* name : {"portable", "sse2", "avx2", "neon"}) {
+        const PixelKernels* kernels = FindPixelKernels(name);
+        if (kernels == nullptr)
+            continue;
+        const std::string prefix = std::string("pixels/") + name + "/";
+        runner.Run(prefix + "premultiply", kCount, [&]() { kernels->premultiply(pixels.data(), kCount / 4); });
+        runner.Run(prefix + "unpremultiply", kCount, [&]() { kernels->unpremultiply(pixels.data(), kCount / 4); });
+        runner.Run(prefix + "over", kCount, [&]() { kernels->over(pixels.data(), other.data(), kCount / 4); });
+        runner.Run(prefix + "difference", kCount, [&]() { kernels->difference(out.data(), pixels.data(), other.data(), kCount / 4); });
+        runner.Run(prefix + "maximum", kCount, [&]() { kernels->maximum(out.data(), values.data(), other.data(), kCount); });
+        runner.Run(prefix + "paeth", kCount, [&]() {
+            kernels->paeth(out.data(), values.data() + 4, values.data(), other.data() + 4, other.data(), kCount - 4);
+        });
+        runner.Run(prefix + "sum_magnitudes", kCount, [&]() {
+            if (kernels->sumMagnitudes(values.data(), kCount) == 0)
+                std::exit(1);
+        });
+    }
+}
+
+void MetricsBenchmarks(Runner& runner) {
+    // Batches of 1000 so that the clock reads of the runner don't dominate; ns/op is per 1000 calls
+    runner.Run("metrics/call_scope_x1000", 0, []() {
+        for (int index = 0; index < 1000; ++index) {
+            UXP_ADDON_METRICS_SCOPE(metrics, operations, "bench");
+            metrics.AddBytesIn(1);
+        }
+    });
+}
+
+std::string Escape(const std::string& text) {
+    std::string result;
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        result += c;
+    }
+    return result;
+}
+
+std::string Report(const std::vector<Result>& results, const Options& options) {
+    std::string json = "{\n  \"context\": {";
+#ifdef __VERSION__
+    json += "\"compiler\": \"" + Escape(__VERSION__) + "\", ";
+#endif
+#ifdef NDEBUG
+    json += "\"assertions\": false, ";
+#else
+    json += "\"assertions\": true, ";
+#endif
+    json += "\"quick\": " + std::string(options.quick ? "true" : "false");
+    json += ", \"min_time_ms\": " + std::to_string(options.minTime.count()) + "},\n  \"benchmarks\": [";
+
+    char buffer[512];
+    for (size_t index = 0; index < results.size(); ++index) {
+        const Result& result = results[index];
+        const double mbPerSecond = result.bytesPerOp > 0 ? result.bytesPerOp / result.medianNs * 1e9 / (1024 * 1024) : 0;
+        std::snprintf(buffer,
+                      sizeof(buffer),
+                      "%s\n    {\"name\": \"%s\", \"iterations\": %zu, \"bytes_per_op\": %zu, \"mean_ns\": %.1f, "
+                      "\"median_ns\": %.1f, \"p99_ns\": %.1f, \"min_ns\": %.1f, \"mb_per_s\": %.2f}",
+                      index > 0 ? "," : "",
+                      Escape(result.name).c_str(),
+                      result.iterations,
+                      result.bytesPerOp,
+                      result.meanNs,
+                      result.medianNs,
+                      result.p99Ns,
+                      result.minNs,
+                      mbPerSecond);
+        json += buffer;
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int index = 1; index < argc; ++index) {
+        const bool hasValue = index + 1 < argc;
+        if (std::strcmp(argv[index], "--quick") == 0) {
+            options.quick = true;
+            options.minTime = std::chrono::milliseconds(10);
+        } else if (std::strcmp(argv[index], "--filter") == 0 && hasValue) {
+            options.filter = argv[++index];
+        } else if (std::strcmp(argv[index], "--min-time") == 0 && hasValue) {
+            options.minTime = std::chrono::milliseconds(std::atoi(argv[++index]));
+        } else if (std::strcmp(argv[index], "--out") == 0 && hasValue) {
+            options.output = argv[++index];
+        } else {
+            std::fprintf(stderr, "usage: %s [--quick] [--filter text] [--min-time ms] [--out file]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    HostEmulator host;
+    addon_value exports = host.LoadAddon();
+    if (exports == nullptr) {
+        std::fprintf(stderr, "addon failed to initialize\n");
+        return 1;
+    }
+
+    Runner runner(host, options);
+    {
+        HostEmulator::Scope scope(host);
+        StringBenchmarks(runner, host, options);
+    }
+    {
+        HostEmulator::Scope scope(host);
+        TreeBenchmarks(runner, host, options);
+    }
+    Base64Benchmarks(runner, options);
+    {
+        HostEmulator::Scope scope(host);
+        WriteFileBenchmarks(runner, host, exports, options);
+    }
+    {
+        HostEmulator::Scope scope(host);
+        CopyFileBenchmarks(runner, host, exports, options);
+    }
+    {
+        HostEmulator::Scope scope(host);
+        BatchIoBenchmarks(runner, host, exports, options);
+    }
+    {
+        HostEmulator::Scope scope(host);
+        StorageSessionBenchmarks(runner, host, exports);
+    }
+    {
+        HostEmulator::Scope scope(host);
+        PackBenchmarks(runner, host, exports, options);
+    }
+    {
+        HostEmulator::Scope scope(host);
+        TaskBenchmarks(runner, host, exports);
+    }
+    {
+        HostEmulator::Scope scope(host);
+        ChannelBenchmarks(runner, host, options);
+    }
+    SimilarityBenchmarks(runner, options);
+    CompositingBenchmarks(runner, options);
+    MetricsBenchmarks(runner);
+
+    host.UnloadAddon();
+
+    const std::string report = Report(runner.GetResults(), options);
+    if (options.output.empty()) {
+        std::fputs(report.c_str(), stdout);
+    } else {
+        FILE* file = std::fopen(options.output.c_str(), "w");
+        if (file == nullptr) {
+            std::fprintf(stderr, "can't write %s\n", options.output.c_str());
+            return 1;
+        }
+        std::fputs(report.c_str(), file);
+        std::fclose(file);
+    }
+    return 0;
+}
@@ -0,0 +1,1407 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpHostEmulator.h"
+
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <sstream>
+
+// The opaque handle types of UxpAddonTypes.h are defined here, the addon only ever sees pointers.
+
+struct addon_value__ : public std::enable_shared_from_this<addon_value__> {
+    using Ref = std::shared_ptr<addon_value__>;
+
+    addon_valuetype type{addon_undefined};
+    addon_env env{nullptr};
+
+    bool boolean{false};
+    double number{0.0};
+    std::string string;
+
+    // objects and arrays
+    std::vector<std::pair<std::string, Ref>> properties;
+    std::map<std::string, size_t> propertyIndex;
+    bool isArray{false};
+    std::vector<Ref> elements;
+    bool isError{false};
+
+    // promises
+    bool isPromise{false};
+    int promiseState{0};  // 0: pending, 1: resolved, 2: rejected
+    Ref settledValue;
+
+    // array buffers and typed arrays
+    bool isArrayBuffer{false};
+    std::vector<uint8_t> bytes;
+    void* externalBytes{nullptr};
+    size_t externalLength{0};
+    bool isTypedArray{false};
+    addon_typedarray_type typedArrayType{addon_uint8_array};
+    size_t byteOffset{0};
+    size_t length{0};
+    Ref buffer;
+
+    // functions
+    addon_callback callback{nullptr};
+    void* callbackData{nullptr};
+    HostEmulator::NativeFunction native;
+
+    // externals, wrapped objects and finalizers
+    void* external{nullptr};
+    struct Finalizer {
+        addon_finalize callback;
+        void* data;
+        void* hint;
+    };
+    std::vector<Finalizer> finalizers;
+    void* wrapped{nullptr};
+
+    ~addon_value__() {
+        for (const auto& finalizer : finalizers) {
+            if (finalizer.callback != nullptr)
+                finalizer.callback(env, finalizer.data, finalizer.hint);
+        }
+    }
+
+    uint8_t* Data() { return externalBytes != nullptr ? static_cast<uint8_t*>(externalBytes) : bytes.data(); }
+    size_t ByteLength() const { return externalBytes != nullptr ? externalLength : bytes.size(); }
+
+    Ref Get(const std::string& key) const {
+        const auto iter = propertyIndex.find(key);
+        return iter == propertyIndex.end() ? nullptr : properties[iter->second].second;
+    }
+
+    void Set(const std::string& key, Ref value) {
+        const auto iter = propertyIndex.find(key);
+        if (iter != propertyIndex.end()) {
+            properties[iter->second].second = std::move(value);
+        } else {
+            propertyIndex.emplace(key, properties.size());
+            properties.emplace_back(key, std::move(value));
+        }
+    }
+};
+
+struct addon_env__ {
+    HostEmulator* host{nullptr};
+    std::vector<addon_value__::Ref> handles;
+    std::vector<size_t> scopes;
+    addon_value__::Ref pendingException;
+    addon_extended_error_info lastError{};
+};
+
+struct addon_deferred__ {
+    addon_value__::Ref promise;
+};
+
+struct addon_ref__ {
+    addon_value__::Ref strong;
+    std::weak_ptr<addon_value__> weak;
+    uint32_t count{0};
+};
+
+struct addon_callback_info__ {
+    std::vector<addon_value> args;
+    addon_value thisArg{nullptr};
+    addon_value newTarget{nullptr};
+    void* data{nullptr};
+};
+
+struct HostEmulatorApi {
+    using Ref = addon_value__::Ref;
+
+    static addon_status Status(addon_env env, addon_status status) {
+        if (env != nullptr)
+            env->lastError.error_code = status;
+        return status;
+    }
+
+    static void RequireScriptThread(addon_env env) {
+        if (env != nullptr && env->host != nullptr && !env->host->IsScriptThread())
+            ++env->host->mThreadViolations;
+    }
+
+    static addon_value Track(addon_env env, Ref value) {
+        value->env = env;
+        env->handles.push_back(value);
+        return value.get();
+    }
+
+    static addon_value Make(addon_env env, addon_valuetype type) {
+        auto value = std::make_shared<addon_value__>();
+        value->type = type;
+        return Track(env, value);
+    }
+
+    static Ref Hold(addon_value value) { return value != nullptr ? value->shared_from_this() : nullptr; }
+
+    // @{ Primitives
+    static addon_status CreateInt32(addon_env env, int32_t value, addon_value* result) {
+        return CreateDouble(env, static_cast<double>(value), result);
+    }
+    static addon_status CreateUint32(addon_env env, uint32_t value, addon_value* result) {
+        return CreateDouble(env, static_cast<double>(value), result);
+    }
+    static addon_status CreateInt64(addon_env env, int64_t value, addon_value* result) {
+        return CreateDouble(env, static_cast<double>(value), result);
+    }
+    static addon_status CreateDouble(addon_env env, double value, addon_value* result) {
+        RequireScriptThread(env);
+        *result = Make(env, addon_number);
+        (*result)->number = value;
+        return Status(env, addon_ok);
+    }
+    static addon_status GetUndefined(addon_env env, addon_value* result) {
+        RequireScriptThread(env);
+        *result = Make(env, addon_undefined);
+        return Status(env, addon_ok);
+    }
+    static addon_status GetNull(addon_env env, addon_value* result) {
+        RequireScriptThread(env);
+        *result = Make(env, addon_null);
+        return Status(env, addon_ok);
+    }
+    static addon_status GetGlobal(addon_env env, addon_value* result) { return CreateObject(env, result); }
+    static addon_status GetBoolean(addon_env env, bool value, addon_value* result) {
+        RequireScriptThread(env);
+        *result = Make(env, addon_boolean);
+        (*result)->boolean = value;
+        return Status(env, addon_ok);
+    }
+    static addon_status CreateStringUtf8(addon_env env, const char* str, size_t length, addon_value* result) {
+        RequireScriptThread(env);
+        if (str == nullptr && length > 0)
+            return Status(env, addon_invalid_arg);
+        *result = Make(env, addon_string);
+        if (length == static_cast<size_t>(-1))
+            length = std::strlen(str);
+        (*result)->string.assign(str != nullptr ? str : "", length);
+        return Status(env, addon_ok);
+    }
+    static addon_status CreateStringUtf16(addon_env env, const char16_t* str, size_t length, addon_value* result) {
+        // Only the ASCII range is needed by the addon
+        std::string narrow;
+        for (size_t index = 0; str != nullptr && index < length; ++index)
+            narrow.push_back(static_cast<char>(str[index] < 0x80 ? str[index] : '?'));
+        return CreateStringUtf8(env, narrow.data(), narrow.size(), result);
+    }
+    static addon_status CreateSymbol(addon_env env, addon_value description, addon_value* result) {
+        RequireScriptThread(env);
+        *result = Make(env, addon_symbol);
+        if (description != nullptr)
+            (*result)->string = description->string;
+        return Status(env, addon_ok);
+    }
+    static addon_status CreateError(addon_env env, addon_value code, addon_value msg, addon_value* result) {
+        RequireScriptThread(env);
+        *result = Make(env, addon_object);
+        (*result)->isError = true;
+        if (code != nullptr)
+            (*result)->Set("code", Hold(code));
+        if (msg != nullptr)
+            (*result)->Set("message", Hold(msg));
+        return Status(env, addon_ok);
+    }
+    // @}
+
+    // @{ Accessors
+    static addon_status TypeOf(addon_env env, addon_value value, addon_valuetype* result) {
+        RequireScriptThread(env);
+        if (value == nullptr)
+            return Status(env, addon_invalid_arg);
+        *result = value->type;
+        return Status(env, addon_ok);
+    }
+    static addon_status GetValueDouble(addon_env env, addon_value value, double* result) {
+        if (value == nullptr || value->type != addon_number)
+            return Status(env, addon_number_expected);
+        *result = value->number;
+        return Status(env, addon_ok);
+    }
+    static addon_status GetValueInt32(addon_env env, addon_value value, int32_t* result) {
+        if (value == nullptr || value->type != addon_number)
+            return Status(env, addon_number_expected);
+        *result = std::isfinite(value->number) ? static_cast<int32_t>(value->number) : 0;
+        return Status(env, addon_ok);
+    }
+    static addon_status GetValueUint32(addon_env env, addon_value value, uint32_t* result) {
+        if (value == nullptr || value->type != addon_number)
+            return Status(env, addon_number_expected);
+        *result = std::isfinite(value->number) ? static_cast<uint32_t>(static_cast<int64_t>(value->number)) : 0;
+        return Status(env, addon_ok);
+    }
+    static addon_status GetValueInt64(addon_env env, addon_value value, int64_t* result) {
+        if (value == nullptr || value->type != addon_number)
+            return Status(env, addon_number_expected);
+        *result = std::isfinite(value->number) ? static_cast<int64_t>(value->number) : 0;
+        return Status(env, addon_ok);
+    }
+    static addon_status GetValueBool(addon_env env, addon_value value, bool* result) {
+        if (value == nullptr || value->type != addon_boolean)
+            return Status(env, addon_boolean_expected);
+        *result = value->boolean;
+        return Status(env, addon_ok);
+    }
+    static addon_status GetValueStringUtf8(addon_env env, addon_value value, char* buf, size_t bufsize, size_t* result) {
+        RequireScriptThread(env);
+        if (value == nullptr || value->type != addon_string)
+            return Status(env, addon_string_expected);
+        const std::string& str = value->string;
+        if (buf == nullptr) {
+            if (result != nullptr)
+                *result = str.size();
+            return Status(env, addon_ok);
+        }
+        if (bufsize == 0) {
+            if (result != nullptr)
+                *result = 0;
+            return Status(env, addon_ok);
+        }
+        const size_t copied = std::min(str.size(), bufsize - 1);
+        std::memcpy(buf, str.data(), copied);
+        buf[copied] = '\0';
+        if (result != nullptr)
+            *result = copied;
+        return Status(env, addon_ok);
+    }
+    static addon_status GetValueStringUtf16(
+        addon_env env, addon_value value, char16_t* buf, size_t bufsize, size_t* result) {
+        if (value == nullptr || value->type != addon_string)
+            return Status(env, addon_string_expected);
+        const std::string& str = value->string;
+        if (buf == nullptr) {
+            *result = str.size();
+            return Status(env, addon_ok);
+        }
+        const size_t copied = bufsize > 0 ? std::min(str.size(), bufsize - 1) : 0;
+        for (size_t index = 0; index < copied; ++index)
+            buf[index] = static_cast<unsigned char>(str[index]);
+        if (bufsize > 0)
+            buf[copied] = 0;
+        if (result != nullptr)
+            *result = copied;
+        return Status(env, addon_ok);
+    }
+    // @}
+
+    // @{ Coercion
+    static addon_status CoerceToBool(addon_env env, addon_value value, addon_value* result) {
+        bool truthy = false;
+        switch (value->type) {
+        case addon_boolean: truthy = value->boolean; break;
+        case addon_number: truthy = value->number != 0.0 && !std::isnan(value->number); break;
+        case addon_string: truthy = !value->string.empty(); break;
+        case addon_undefined:
+        case addon_null: truthy = false; break;
+        default: truthy = true; break;
+        }
+        return GetBoolean(env, truthy, result);
+    }
+    static addon_status CoerceToNumber(addon_env env, addon_value value, addon_value* result) {
+        double number = std::nan("");
+        switch (value->type) {
+        case addon_boolean: number = value->boolean ? 1.0 : 0.0; break;
+        case addon_number: number = value->number; break;
+        case addon_null: number = 0.0; break;
+        case addon_string: {
+            char* end = nullptr;
+            number = std::strtod(value->string.c_str(), &end);
+            if (end == nullptr || *end != '\0')
+                number = value->string.empty() ? 0.0 : std::nan("");
+        } break;
+        default: break;
+        }
+        return CreateDouble(env, number, result);
+    }
+    static addon_status CoerceToObject(addon_env env, addon_value value, addon_value* result) {
+        if (value->type == addon_object || value->type == addon_function) {
+            *result = value;
+            return Status(env, addon_ok);
+        }
+        return CreateObject(env, result);
+    }
+    static addon_status CoerceToString(addon_env env, addon_value value, addon_value* result) {
+        std::string text;
+        switch (value->type) {
+        case addon_string: text = value->string; break;
+        case addon_boolean: text = value->boolean ? "true" : "false"; break;
+        case addon_number: {
+            std::ostringstream stream;
+            stream << value->number;
+            text = stream.str();
+        } break;
+        case addon_null: text = "null"; break;
+        case addon_undefined: text = "undefined"; break;
+        default: text = "[object Object]"; break;
+        }
+        return CreateStringUtf8(env, text.data(), text.size(), result);
+    }
+    // @}
+
+    // @{ Objects
+    static addon_status CreateObject(addon_env env, addon_value* result) {
+        RequireScriptThread(env);
+        *result = Make(env, addon_object);
+        return Status(env, addon_ok);
+    }
+    static addon_status CreateArray(addon_env env, addon_value* result) {
+        RequireScriptThread(env);
+        *result = Make(env, addon_object);
+        (*result)->isArray = true;
+        return Status(env, addon_ok);
+    }
+    static addon_status CreateArrayWithLength(addon_env env, size_t length, addon_value* result) {
+        CreateArray(env, result);
+        (*result)->elements.reserve(length);
+        for (size_t index = 0; index < length; ++index) {
+            auto element = std::make_shared<addon_value__>();
+            element->env = env;
+            (*result)->elements.push_back(element);
+        }
+        return Status(env, addon_ok);
+    }
+    static bool KeyOf(addon_value key, std::string& name) {
+        if (key == nullptr)
+            return false;
+        if (key->type == addon_string || key->type == addon_symbol) {
+            name = key->string;
+            return true;
+        }
+        if (key->type == addon_number) {
+            std::ostringstream stream;
+            stream << key->number;
+            name = stream.str();
+            return true;
+        }
+        return false;
+    }
+    static bool IsObjectLike(addon_value value) {
+        return value != nullptr && (value->type == addon_object || value->type == addon_function);
+    }
+    static addon_status GetPrototype(addon_env env, addon_value object, addon_value* result) {
+        return CreateObject(env, result);
+    }
+    static addon_status GetPropertyNames(addon_env env, addon_value object, addon_value* result) {
+        RequireScriptThread(env);
+        if (!IsObjectLike(object))
+            return Status(env, addon_object_expected);
+        CreateArray(env, result);
+        if (object->isArray) {
+            for (size_t index = 0; index < object->elements.size(); ++index) {
+                auto key = std::make_shared<addon_value__>();
+                key->type = addon_string;
+                key->env = env;
+                key->string = std::to_string(index);
+                (*result)->elements.push_back(key);
+            }
+        }
+        for (const auto& property : object->properties) {
+            auto key = std::make_shared<addon_value__>();
+            key->type = addon_string;
+            key->env = env;
+            key->string = property.first;
+            (*result)->elements.push_back(key);
+        }
+        return Status(env, addon_ok);
+    }
+    static addon_status SetProperty(addon_env env, addon_value object, addon_value key, addon_value value) {
+        std::string name;
+        if (!KeyOf(key, name))
+            return Status(env, addon_name_expected);
+        return SetNamedProperty(env, object, name.c_str(), value);
+    }
+    static addon_status HasProperty(addon_env env, addon_value object, addon_value key, bool* result) {
+        std::string name;
+        if (!KeyOf(key, name))
+            return Status(env, addon_name_expected);
+        return HasNamedProperty(env, object, name.c_str(), result);
+    }
+    static addon_status GetProperty(addon_env env, addon_value object, addon_value key, addon_value* result) {
+        std::string name;
+        if (!KeyOf(key, name))
+            return Status(env, addon_name_expected);
+        return GetNamedProperty(env, object, name.c_str(), result);
+    }
+    static addon_status DeleteProperty(addon_env env, addon_value object, addon_value key, bool* result) {
+        std::string name;
+        if (!KeyOf(key, name) || !IsObjectLike(object))
+            return Status(env, addon_object_expected);
+        const auto iter = object->propertyIndex.find(name);
+        const bool found = iter != object->propertyIndex.end();
+        if (found) {
+            object->properties.erase(object->properties.begin() + static_cast<std::ptrdiff_t>(iter->second));
+            object->propertyIndex.clear();
+            for (size_t index = 0; index < object->properties.size(); ++index)
+                object->propertyIndex.emplace(object->properties[index].first, index);
+        }
+        if (result != nullptr)
+            *result = found;
+        return Status(env, addon_ok);
+    }
+    static addon_status HasNamedProperty(addon_env env, addon_value object, const char* utf8name, bool* result) {
+        RequireScriptThread(env);
+        if (!IsObjectLike(object))
+            return Status(env, addon_object_expected);
+        *result = object->Get(utf8name) != nullptr;
+        return Status(env, addon_ok);
+    }
+    static addon_status SetNamedProperty(addon_env env, addon_value object, const char* utf8name, addon_value value) {
+        RequireScriptThread(env);
+        if (!IsObjectLike(object) || value == nullptr)
+            return Status(env, addon_object_expected);
+        if (object->isArray) {
+            char* end = nullptr;
+            const unsigned long index = std::strtoul(utf8name, &end, 10);
+            if (end != utf8name && *end == '\0')
+                return SetElement(env, object, static_cast<uint32_t>(index), value);
+        }
+        object->Set(utf8name, Hold(value));
+        return Status(env, addon_ok);
+    }
+    static addon_status GetNamedProperty(addon_env env, addon_value object, const char* utf8name, addon_value* result) {
+        RequireScriptThread(env);
+        if (!IsObjectLike(object))
+            return Status(env, addon_object_expected);
+        if (object->isArray) {
+            if (std::strcmp(utf8name, "length") == 0)
+                return CreateDouble(env, static_cast<double>(object->elements.size()), result);
+            char* end = nullptr;
+            const unsigned long index = std::strtoul(utf8name, &end, 10);
+            if (end != utf8name && *end == '\0')
+                return GetElement(env, object, static_cast<uint32_t>(index), result);
+        }
+        auto value = object->Get(utf8name);
+        if (value == nullptr)
+            return GetUndefined(env, result);
+        *result = Track(env, value);
+        return Status(env, addon_ok);
+    }
+    static addon_status SetElement(addon_env env, addon_value object, uint32_t index, addon_value value) {
+        RequireScriptThread(env);
+        if (!IsObjectLike(object) || value == nullptr)
+            return Status(env, addon_object_expected);
+        if (!object->isArray) {
+            object->Set(std::to_string(index), Hold(value));
+            return Status(env, addon_ok);
+        }
+        while (object->elements.size() <= index) {
+            auto hole = std::make_shared<addon_value__>();
+            hole->env = env;
+            object->elements.push_back(hole);
+        }
+        object->elements[index] = Hold(value);
+        return Status(env, addon_ok);
+    }
+    static addon_status HasElement(addon_env env, addon_value object, uint32_t index, bool* result) {
+        if (!IsObjectLike(object))
+            return Status(env, addon_object_expected);
+        *result = object->isArray ? index < object->elements.size() : object->Get(std::to_string(index)) != nullptr;
+        return Status(env, addon_ok);
+    }
+    static addon_status GetElement(addon_env env, addon_value object, uint32_t index, addon_value* result) {
+        RequireScriptThread(env);
+        if (!IsObjectLike(object))
+            return Status(env, addon_object_expected);
+        if (!object->isArray)
+            return GetNamedProperty(env, object, std::to_string(index).c_str(), result);
+        if (index >= object->elements.size())
+            return GetUndefined(env, result);
+        *result = Track(env, object->elements[index]);
+        return Status(env, addon_ok);
+    }
+    static addon_status DeleteElement(addon_env env, addon_value object, uint32_t index, bool* result) {
+        if (!IsObjectLike(object) || !object->isArray)
+            return Status(env, addon_object_expected);
+        const bool found = index < object->elements.size();
+        if (found) {
+            auto hole = std::make_shared<addon_value__>();
+            hole->env = env;
+            object->elements[index] = hole;
+        }
+        if (result != nullptr)
+            *result = found;
+        return Status(env, addon_ok);
+    }
+    static addon_status DefineProperties(
+        addon_env env, addon_value object, size_t property_count, const addon_property_descriptor* properties) {
+        for (size_t index = 0; index < property_count; ++index) {
+            const auto& descriptor = properties[index];
+            std::string name;
+            if (descriptor.utf8name != nullptr)
+                name = descriptor.utf8name;
+            else if (!KeyOf(descriptor.name, name))
+                return Status(env, addon_name_expected);
+
+            addon_value value = descriptor.value;
+            if (descriptor.method != nullptr)
+                CreateFunction(env, name.c_str(), name.size(), descriptor.method, descriptor.data, &value);
+            if (value != nullptr)
+                SetNamedProperty(env, object, name.c_str(), value);
+        }
+        return Status(env, addon_ok);
+    }
+    static addon_status IsArray(addon_env env, addon_value value, bool* result) {
+        *result = value != nullptr && value->isArray;
+        return Status(env, addon_ok);
+    }
+    static addon_status GetArrayLength(addon_env env, addon_value value, uint32_t* result) {
+        if (value == nullptr || !value->isArray)
+            return Status(env, addon_array_expected);
+        *result = static_cast<uint32_t>(value->elements.size());
+        return Status(env, addon_ok);
+    }
+    static addon_status StrictEquals(addon_env env, addon_value lhs, addon_value rhs, bool* result) {
+        if (lhs->type != rhs->type) {
+            *result = false;
+        } else {
+            switch (lhs->type) {
+            case addon_undefined:
+            case addon_null: *result = true; break;
+            case addon_boolean: *result = lhs->boolean == rhs->boolean; break;
+            case addon_number: *result = lhs->number == rhs->number; break;
+            case addon_string: *result = lhs->string == rhs->string; break;
+            default: *result = lhs == rhs; break;
+            }
+        }
+        return Status(env, addon_ok);
+    }
+    // @}
+
+    // @{ Functions
+    static addon_status CreateFunction(
+        addon_env env, const char* utf8name, size_t length, addon_callback cb, void* data, addon_value* result) {
+        RequireScriptThread(env);
+        if (cb == nullptr)
+            return Status(env, addon_invalid_arg);
+        *result = Make(env, addon_function);
+        (*result)->callback = cb;
+        (*result)->callbackData = data;
+        if (utf8name != nullptr)
+            (*result)->string.assign(utf8name, length == static_cast<size_t>(-1) ? std::strlen(utf8name) : length);
+        return Status(env, addon_ok);
+    }
+    static addon_status GetCbInfo(
+        addon_env env, addon_callback_info cbinfo, size_t* argc, addon_value* argv, addon_value* this_arg, void** data) {
+        RequireScriptThread(env);
+        if (cbinfo == nullptr)
+            return Status(env, addon_invalid_arg);
+        if (argc != nullptr) {
+            const size_t capacity = *argc;
+            for (size_t index = 0; argv != nullptr && index < capacity; ++index) {
+                if (index < cbinfo->args.size())
+                    argv[index] = cbinfo->args[index];
+                else
+                    GetUndefined(env, &argv[index]);
+            }
+            *argc = cbinfo->args.size();
+        }
+        if (this_arg != nullptr)
+            *this_arg = cbinfo->thisArg;
+        if (data != nullptr)
+            *data = cbinfo->data;
+        return Status(env, addon_ok);
+    }
+    static addon_status CallFunction(
+        addon_env env, addon_value recv, addon_value func, size_t argc, const addon_value* argv, addon_value* result) {
+        RequireScriptThread(env);
+        if (func == nullptr || func->type != addon_function)
+            return Status(env, addon_function_expected);
+        if (env->pendingException != nullptr)
+            return Status(env, addon_pending_exception);
+
+        addon_callback_info__ info;
+        info.args.assign(argv, argv + argc);
+        info.thisArg = recv;
+        info.data = func->callbackData;
+
+        addon_value returned = nullptr;
+        if (func->native)
+            returned = func->native(env, info.args);
+        else
+            returned = func->callback(env, &info);
+
+        if (result != nullptr) {
+            if (returned == nullptr)
+                GetUndefined(env, &returned);
+            *result = returned;
+        }
+        return Status(env, env->pendingException != nullptr ? addon_pending_exception : addon_ok);
+    }
+    static addon_status NewInstance(
+        addon_env env, addon_value constructor, size_t argc, const addon_value* argv, addon_value* result) {
+        return Status(env, addon_generic_failure);
+    }
+    static addon_status InstanceOf(addon_env env, addon_value object, addon_value constructor, bool* result) {
+        *result = false;
+        return Status(env, addon_ok);
+    }
+    static addon_status GetNewTarget(addon_env env, addon_callback_info cbinfo, addon_value* result) {
+        *result = cbinfo != nullptr ? cbinfo->newTarget : nullptr;
+        return Status(env, addon_ok);
+    }
+    // @}
+
+    // @{ Externals and wrapping
+    static addon_status Wrap(addon_env env,
+                             addon_value js_object,
+                             void* native_object,
+                             addon_finalize finalize_cb,
+                             void* finalize_hint,
+                             addon_ref* result) {
+        if (!IsObjectLike(js_object) || js_object->wrapped != nullptr)
+            return Status(env, addon_invalid_arg);
+        js_object->wrapped = native_object;
+        js_object->finalizers.push_back({finalize_cb, native_object, finalize_hint});
+        if (result != nullptr)
+            CreateReference(env, js_object, 0, result);
+        return Status(env, addon_ok);
+    }
+    static addon_status Unwrap(addon_env env, addon_value js_object, void** result) {
+        if (!IsObjectLike(js_object) || js_object->wrapped == nullptr)
+            return Status(env, addon_invalid_arg);
+        *result = js_object->wrapped;
+        return Status(env, addon_ok);
+    }
+    static addon_status RemoveWrap(addon_env env, addon_value js_object, void** result) {
+        if (!IsObjectLike(js_object) || js_object->wrapped == nullptr)
+            return Status(env, addon_invalid_arg);
+        if (result != nullptr)
+            *result = js_object->wrapped;
+        auto& finalizers = js_object->finalizers;
+        for (auto iter = finalizers.begin(); iter != finalizers.end(); ++iter) {
+            if (iter->data == js_object->wrapped) {
+                finalizers.erase(iter);
+                break;
+            }
+        }
+        js_object->wrapped = nullptr;
+        return Status(env, addon_ok);
+    }
+    static addon_status CreateExternal(
+        addon_env env, void* data, addon_finalize finalize_cb, void* finalize_hint, addon_value* result) {
+        RequireScriptThread(env);
+        *result = Make(env, addon_external);
+        (*result)->external = data;
+        (*result)->finalizers.push_back({finalize_cb, data, finalize_hint});
+        return Status(env, addon_ok);
+    }
+    static addon_status GetValueExternal(addon_env env, addon_value value, void** result) {
+        if (value == nullptr || value->type != addon_external)
+            return Status(env, addon_invalid_arg);
+        *result = value->external;
+        return Status(env, addon_ok);
+    }
+    static addon_status AddFinalizer(addon_env env,
+                                     addon_value js_object,
+                                     void* native_object,
+                                     addon_finalize finalize_cb,
+                                     void* finalize_hint,
+                                     addon_ref* result) {
+        if (!IsObjectLike(js_object))
+            return Status(env, addon_object_expected);
+        js_object->finalizers.push_back({finalize_cb, native_object, finalize_hint});
+        if (result != nullptr)
+            CreateReference(env, js_object, 0, result);
+        return Status(env, addon_ok);
+    }
+    // @}
+
+    // @{ References
+    static addon_status CreateReference(addon_env env, addon_value value, uint32_t initial_refcount, addon_ref* result) {
+        if (value == nullptr)
+            return Status(env, addon_invalid_arg);
+        auto ref = new addon_ref__;
+        ref->weak = Hold(value);
+        ref->count = initial_refcount;
+        if (initial_refcount > 0)
+            ref->strong = Hold(value);
+        *result = ref;
+        return Status(env, addon_ok);
+    }
+    static addon_status DeleteReference(addon_env env, addon_ref ref) {
+        delete ref;
+        return Status(env, addon_ok);
+    }
+    static addon_status ReferenceRef(addon_env env, addon_ref ref, uint32_t* result) {
+        if (ref->count == 0) {
+            ref->strong = ref->weak.lock();
+            if (ref->strong == nullptr)
+                return Status(env, addon_generic_failure);
+        }
+        ++ref->count;
+        if (result != nullptr)
+            *result = ref->count;
+        return Status(env, addon_ok);
+    }
+    static addon_status ReferenceUnref(addon_env env, addon_ref ref, uint32_t* result) {
+        if (ref->count == 0)
+            return Status(env, addon_generic_failure);
+        if (--ref->count == 0)
+            ref->strong.reset();
+        if (result != nullptr)
+            *result = ref->count;
+        return Status(env, addon_ok);
+    }
+    static addon_status GetReferenceValue(addon_env env, addon_ref ref, addon_value* result) {
+        RequireScriptThread(env);
+        auto value = ref->weak.lock();
+        *result = value != nullptr ? Track(env, value) : nullptr;
+        return Status(env, addon_ok);
+    }
+    // @}
+
+    // @{ Handle scopes
+    static addon_status OpenHandleScope(addon_env env, addon_handle_scope* result) {
+        RequireScriptThread(env);
+        env->scopes.push_back(env->handles.size());
+        *result = reinterpret_cast<addon_handle_scope>(env->scopes.size());
+        return Status(env, addon_ok);
+    }
+    static addon_status CloseHandleScope(addon_env env, addon_handle_scope scope) {
+        RequireScriptThread(env);
+        const size_t depth = reinterpret_cast<size_t>(scope);
+        if (depth == 0 || depth != env->scopes.size())
+            return Status(env, addon_handle_scope_mismatch);
+        env->handles.resize(env->scopes.back());
+        env->scopes.pop_back();
+        return Status(env, addon_ok);
+    }
+    static addon_status OpenEscapableHandleScope(addon_env env, addon_escapable_handle_scope* result) {
+        addon_handle_scope scope = nullptr;
+        const addon_status status = OpenHandleScope(env, &scope);
+        *result = reinterpret_cast<addon_escapable_handle_scope>(scope);
+        return status;
+    }
+    static addon_status CloseEscapableHandleScope(addon_env env, addon_escapable_handle_scope scope) {
+        return CloseHandleScope(env, reinterpret_cast<addon_handle_scope>(scope));
+    }
+    static addon_status EscapeHandle(
+        addon_env env, addon_escapable_handle_scope scope, addon_value escapee, addon_value* result) {
+        // Keep the escaped value alive in the enclosing scope
+        const size_t depth = reinterpret_cast<size_t>(scope);
+        if (depth == 0 || depth > env->scopes.size())
+            return Status(env, addon_handle_scope_mismatch);
+        const size_t slot = env->scopes[depth - 1];
+        env->handles.insert(env->handles.begin() + static_cast<std::ptrdiff_t>(slot), Hold(escapee));
+        for (size_t index = depth - 1; index < env->scopes.size(); ++index)
+            ++env->scopes[index];
+        *result = escapee;
+        return Status(env, addon_ok);
+    }
+    // @}
+
+    // @{ Errors
+    static addon_status Throw(addon_env env, addon_value error) {
+        env->pendingException = Hold(error);
+        return Status(env, addon_ok);
+    }
+    static addon_status ThrowError(addon_env env, const char* code, const char* msg) {
+        addon_value codeValue = nullptr;
+        if (code != nullptr)
+            CreateStringUtf8(env, code, std::strlen(code), &codeValue);
+        addon_value msgValue = nullptr;
+        CreateStringUtf8(env, msg != nullptr ? msg : "", msg != nullptr ? std::strlen(msg) : 0, &msgValue);
+        addon_value error = nullptr;
+        CreateError(env, codeValue, msgValue, &error);
+        return Throw(env, error);
+    }
+    static addon_status IsError(addon_env env, addon_value value, bool* result) {
+        *result = value != nullptr && value->isError;
+        return Status(env, addon_ok);
+    }
+    static addon_status IsExceptionPending(addon_env env, bool* result) {
+        *result = env->pendingException != nullptr;
+        return Status(env, addon_ok);
+    }
+    static addon_status GetAndClearLastException(addon_env env, addon_value* result) {
+        if (env->pendingException == nullptr)
+            return GetUndefined(env, result);
+        *result = Track(env, env->pendingException);
+        env->pendingException.reset();
+        return Status(env, addon_ok);
+    }
+    static addon_status GetLastErrorInfo(addon_env env, const addon_extended_error_info** result) {
+        *result = &env->lastError;
+        return addon_ok;
+    }
+    // @}
+
+    // @{ Array buffers
+    static addon_status IsArrayBuffer(addon_env env, addon_value value, bool* result) {
+        *result = value != nullptr && value->isArrayBuffer;
+        return Status(env, addon_ok);
+    }
+    static addon_status CreateArrayBuffer(addon_env env, size_t byte_length, void** data, addon_value* result) {
+        RequireScriptThread(env);
+        *result = Make(env, addon_object);
+        (*result)->isArrayBuffer = true;
+        (*result)->bytes.resize(byte_length);
+        if (data != nullptr)
+            *data = (*result)->bytes.data();
+        return Status(env, addon_ok);
+    }
+    static addon_status CreateExternalArrayBuffer(addon_env env,
+                                                  void* external_data,
+                                                  size_t byte_length,
+                                                  addon_finalize finalize_cb,
+                                                  void* finalize_hint,
+                                                  addon_value* result) {
+        RequireScriptThread(env);
+        *result = Make(env, addon_object);
+        (*result)->isArrayBuffer = true;
+        (*result)->externalBytes = external_data;
+        (*result)->externalLength = byte_length;
+        (*result)->finalizers.push_back({finalize_cb, external_data, finalize_hint});
+        return Status(env, addon_ok);
+    }
+    static addon_status GetArrayBufferInfo(addon_env env, addon_value arraybuffer, void** data, size_t* byte_length) {
+        if (arraybuffer == nullptr || !arraybuffer->isArrayBuffer)
+            return Status(env, addon_arraybuffer_expected);
+        if (data != nullptr)
+            *data = arraybuffer->Data();
+        if (byte_length != nullptr)
+            *byte_length = arraybuffer->ByteLength();
+        return Status(env, addon_ok);
+    }
+    static addon_status IsTypedArray(addon_env env, addon_value value, bool* result) {
+        *result = value != nullptr && value->isTypedArray;
+        return Status(env, addon_ok);
+    }
+    static size_t ElementSize(addon_typedarray_type type) {
+        switch (type) {
+        case addon_int8_array:
+        case addon_uint8_array:
+        case addon_uint8_clamped_array: return 1;
+        case addon_int16_array:
+        case addon_uint16_array: return 2;
+        case addon_int32_array:
+        case addon_uint32_array:
+        case addon_float32_array: return 4;
+        default: return 8;
+        }
+    }
+    static addon_status CreateTypedArray(addon_env env,
+                                         addon_typedarray_type type,
+                                         size_t length,
+                                         addon_value arraybuffer,
+                                         size_t byte_offset,
+                                         addon_value* result) {
+        if (arraybuffer == nullptr || !arraybuffer->isArrayBuffer)
+            return Status(env, addon_arraybuffer_expected);
+        if (byte_offset + length * ElementSize(type) > arraybuffer->ByteLength())
+            return Status(env, addon_invalid_arg);
+        *result = Make(env, addon_object);
+        (*result)->isTypedArray = true;
+        (*result)->typedArrayType = type;
+        (*result)->length = length;
+        (*result)->byteOffset = byte_offset;
+        (*result)->buffer = Hold(arraybuffer);
+        return Status(env, addon_ok);
+    }
+    static addon_status CreateDataView(
+        addon_env env, size_t length, addon_value arraybuffer, size_t byte_offset, addon_value* result) {
+        return Status(env, addon_generic_failure);
+    }
+    static addon_status IsDataView(addon_env env, addon_value value, bool* result) {
+        *result = false;
+        return Status(env, addon_ok);
+    }
+    static addon_status GetDataViewInfo(addon_env env,
+                                        addon_value dataview,
+                                        size_t* bytelength,
+                                        void** data,
+                                        addon_value* arraybuffer,
+                                        size_t* byte_offset) {
+        return Status(env, addon_invalid_arg);
+    }
+    // @}
+
+    // @{ Promises
+    static addon_status CreatePromise(addon_env env, addon_deferred* deferred, addon_value* promise) {
+        RequireScriptThread(env);
+        *promise = Make(env, addon_object);
+        (*promise)->isPromise = true;
+        auto handle = new addon_deferred__;
+        handle->promise = Hold(*promise);
+        *deferred = handle;
+        return Status(env, addon_ok);
+    }
+    static addon_status Settle(addon_env env, addon_deferred deferred, addon_value value, int state) {
+        RequireScriptThread(env);
+        if (deferred == nullptr || value == nullptr)
+            return Status(env, addon_invalid_arg);
+        deferred->promise->promiseState = state;
+        deferred->promise->settledValue = Hold(value);
+        delete deferred;
+        return Status(env, addon_ok);
+    }
+    static addon_status ResolveDeferred(addon_env env, addon_deferred deferred, addon_value resolution) {
+        return Settle(env, deferred, resolution, 1);
+    }
+    static addon_status RejectDeferred(addon_env env, addon_deferred deferred, addon_value rejection) {
+        return Settle(env, deferred, rejection, 2);
+    }
+    static addon_status IsPromise(addon_env env, addon_value promise, bool* is_promise) {
+        *is_promise = promise != nullptr && promise->isPromise;
+        return Status(env, addon_ok);
+    }
+    // @}
+
+    // @{ Queues
+    static void ScheduleOnJavascriptQueue(
+        addon_env env, addon_task task, addon_task_data data, addon_task_destructor deleter) {
+        HostEmulator* host = env->host;
+        {
+            std::lock_guard<std::mutex> lock(host->mScriptMutex);
+            host->mScriptQueue.push_back({task, data, deleter});
+        }
+        host->mScriptWakeup.notify_all();
+    }
+    static void ScheduleOnMainQueue(addon_env env, addon_task task, addon_task_data data, addon_task_destructor deleter) {
+        HostEmulator* host = env->host;
+        {
+            std::lock_guard<std::mutex> lock(host->mMainMutex);
+            host->mMainQueue.push_back({task, data, deleter});
+        }
+        host->mMainWakeup.notify_all();
+    }
+    // @}
+
+    // @{ Dates
+    static addon_status CreateDate(addon_env env, double time, addon_value* result) {
+        CreateObject(env, result);
+        (*result)->number = time;
+        (*result)->string = "Date";
+        return Status(env, addon_ok);
+    }
+    static addon_status IsDate(addon_env env, addon_value value, bool* is_date) {
+        *is_date = value != nullptr && value->type == addon_object && value->string == "Date";
+        return Status(env, addon_ok);
+    }
+    static addon_status GetDateValue(addon_env env, addon_value value, double* result) {
+        bool isDate = false;
+        IsDate(env, value, &isDate);
+        if (!isDate)
+            return Status(env, addon_date_expected);
+        *result = value->number;
+        return Status(env, addon_ok);
+    }
+    // @}
+
+    static addon_apis Build() {
+        addon_apis apis{};
+        apis.uxp_addon_create_int32 = CreateInt32;
+        apis.uxp_addon_get_cb_info = GetCbInfo;
+        apis.uxp_addon_throw_error = ThrowError;
+        apis.uxp_addon_get_value_int32 = GetValueInt32;
+        apis.uxp_addon_create_function = CreateFunction;
+        apis.uxp_addon_set_named_property = SetNamedProperty;
+        apis.uxp_addon_get_last_error_info = GetLastErrorInfo;
+        apis.uxp_addon_get_undefined = GetUndefined;
+        apis.uxp_addon_get_null = GetNull;
+        apis.uxp_addon_get_global = GetGlobal;
+        apis.uxp_addon_get_boolean = GetBoolean;
+        apis.uxp_addon_create_object = CreateObject;
+        apis.uxp_addon_create_array = CreateArray;
+        apis.uxp_addon_create_array_with_length = CreateArrayWithLength;
+        apis.uxp_addon_create_double = CreateDouble;
+        apis.uxp_addon_create_uint32 = CreateUint32;
+        apis.uxp_addon_create_int64 = CreateInt64;
+        apis.uxp_addon_create_string_latin1 = CreateStringUtf8;
+        apis.uxp_addon_create_string_utf8 = CreateStringUtf8;
+        apis.uxp_addon_create_string_utf16 = CreateStringUtf16;
+        apis.uxp_addon_create_symbol = CreateSymbol;
+        apis.uxp_addon_create_error = CreateError;
+        apis.uxp_addon_create_type_error = CreateError;
+        apis.uxp_addon_create_range_error = CreateError;
+        apis.uxp_addon_typeof = TypeOf;
+        apis.uxp_addon_get_value_double = GetValueDouble;
+        apis.uxp_addon_get_value_uint32 = GetValueUint32;
+        apis.uxp_addon_get_value_int64 = GetValueInt64;
+        apis.uxp_addon_get_value_bool = GetValueBool;
+        apis.uxp_addon_get_value_string_latin1 = GetValueStringUtf8;
+        apis.uxp_addon_get_value_string_utf8 = GetValueStringUtf8;
+        apis.uxp_addon_get_value_string_utf16 = GetValueStringUtf16;
+        apis.uxp_addon_coerce_to_bool = CoerceToBool;
+        apis.uxp_addon_coerce_to_number = CoerceToNumber;
+        apis.uxp_addon_coerce_to_object = CoerceToObject;
+        apis.uxp_addon_coerce_to_string = CoerceToString;
+        apis.uxp_addon_get_prototype = GetPrototype;
+        apis.uxp_addon_get_property_names = GetPropertyNames;
+        apis.uxp_addon_set_property = SetProperty;
+        apis.uxp_addon_has_property = HasProperty;
+        apis.uxp_addon_get_property = GetProperty;
+        apis.uxp_addon_delete_property = DeleteProperty;
+        apis.uxp_addon_has_own_property = HasProperty;
+        apis.uxp_addon_has_named_property = HasNamedProperty;
+        apis.uxp_addon_get_named_property = GetNamedProperty;
+        apis.uxp_addon_set_element = SetElement;
+        apis.uxp_addon_has_element = HasElement;
+        apis.uxp_addon_get_element = GetElement;
+        apis.uxp_addon_delete_element = DeleteElement;
+        apis.uxp_addon_define_properties = DefineProperties;
+        apis.uxp_addon_is_array = IsArray;
+        apis.uxp_addon_get_array_length = GetArrayLength;
+        apis.uxp_addon_strict_equals = StrictEquals;
+        apis.uxp_addon_call_function = CallFunction;
+        apis.uxp_addon_new_instance = NewInstance;
+        apis.uxp_addon_instanceof = InstanceOf;
+        apis.uxp_addon_get_new_target = GetNewTarget;
+        apis.uxp_addon_wrap = Wrap;
+        apis.uxp_addon_unwrap = Unwrap;
+        apis.uxp_addon_remove_wrap = RemoveWrap;
+        apis.uxp_addon_create_external = CreateExternal;
+        apis.uxp_addon_get_value_external = GetValueExternal;
+        apis.uxp_addon_create_reference = CreateReference;
+        apis.uxp_addon_delete_reference = DeleteReference;
+        apis.uxp_addon_reference_ref = ReferenceRef;
+        apis.uxp_addon_reference_unref = ReferenceUnref;
+        apis.uxp_addon_get_reference_value = GetReferenceValue;
+        apis.uxp_addon_open_handle_scope = OpenHandleScope;
+        apis.uxp_addon_close_handle_scope = CloseHandleScope;
+        apis.uxp_addon_open_escapable_handle_scope = OpenEscapableHandleScope;
+        apis.uxp_addon_close_escapable_handle_scope = CloseEscapableHandleScope;
+        apis.uxp_addon_escape_handle = EscapeHandle;
+        apis.uxp_addon_throw = Throw;
+        apis.uxp_addon_throw_type_error = ThrowError;
+        apis.uxp_addon_throw_range_error = ThrowError;
+        apis.uxp_addon_is_error = IsError;
+        apis.uxp_addon_is_exception_pending = IsExceptionPending;
+        apis.uxp_addon_get_and_clear_last_exception = GetAndClearLastException;
+        apis.uxp_addon_is_arraybuffer = IsArrayBuffer;
+        apis.uxp_addon_create_arraybuffer = CreateArrayBuffer;
+        apis.uxp_addon_create_external_arraybuffer = CreateExternalArrayBuffer;
+        apis.uxp_addon_get_arraybuffer_info = GetArrayBufferInfo;
+        apis.uxp_addon_is_typedarray = IsTypedArray;
+        apis.uxp_addon_create_typedarray = CreateTypedArray;
+        apis.uxp_addon_create_dataview = CreateDataView;
+        apis.uxp_addon_is_dataview = IsDataView;
+        apis.uxp_addon_get_dataview_info = GetDataViewInfo;
+        apis.uxp_addon_create_promise = CreatePromise;
+        apis.uxp_addon_resolve_deferred = ResolveDeferred;
+        apis.uxp_addon_reject_deferred = RejectDeferred;
+        apis.uxp_addon_is_promise = IsPromise;
+        apis.uxp_addon_schedule_on_javascript_queue = ScheduleOnJavascriptQueue;
+        apis.uxp_addon_schedule_on_main_queue = ScheduleOnMainQueue;
+        apis.uxp_addon_create_date = CreateDate;
+        apis.uxp_addon_is_date = IsDate;
+        apis.uxp_addon_get_date_value = GetDateValue;
+        apis.uxp_addon_add_finalizer = AddFinalizer;
+        return apis;
+    }
+};
+
+const addon_apis& HostEmulator::GetApis() {
+    static const addon_apis apis = HostEmulatorApi::Build();
+    return apis;
+}
+
+HostEmulator::HostEmulator() : mScriptThread(std::this_thread::get_id()) {
+    mEnv = new addon_env__;
+    mEnv->host = this;
+    HostEmulatorApi::OpenHandleScope(mEnv, &mRootScope);
+    mMainThread = std::thread([this]() { RunMainQueue(); });
+}
+
+HostEmulator::~HostEmulator() {
+    {
+        std::lock_guard<std::mutex> lock(mMainMutex);
+        mStopping = true;
+    }
+    mMainWakeup.notify_all();
+    mMainThread.join();
+
+    // Release the queued tasks that never ran
+    for (auto& queued : mMainQueue) {
+        if (queued.deleter != nullptr)
+            queued.deleter(queued.data);
+    }
+    std::deque<QueuedTask> script;
+    {
+        std::lock_guard<std::mutex> lock(mScriptMutex);
+        std::swap(script, mScriptQueue);
+    }
+    for (auto& queued : script) {
+        if (queued.deleter != nullptr)
+            queued.deleter(queued.data);
+    }
+
+    mEnv->pendingException.reset();
+    mEnv->handles.clear();
+    delete mEnv;
+}
+
+addon_value HostEmulator::LoadAddon() {
+    addon_value exports = Object();
+    addon_apis apis = GetApis();
+    return uxp_addon_init(mEnv, exports, std::move(apis));
+}
+
+void HostEmulator::UnloadAddon() {
+    uxp_addon_terminate(mEnv);
+}
+
+addon_value HostEmulator::Call(addon_value object, const std::string& name, const std::vector<addon_value>& args) {
+    return CallFunction(GetProperty(object, name), args);
+}
+
+addon_value HostEmulator::CallFunction(addon_value function, const std::vector<addon_value>& args) {
+    addon_value result = nullptr;
+    const addon_status status =
+        HostEmulatorApi::CallFunction(mEnv, Undefined(), function, args.size(), args.data(), &result);
+    return status == addon_ok ? result : nullptr;
+}
+
+addon_value HostEmulator::Undefined() {
+    addon_value result = nullptr;
+    HostEmulatorApi::GetUndefined(mEnv, &result);
+    return result;
+}
+
+addon_value HostEmulator::Boolean(bool value) {
+    addon_value result = nullptr;
+    HostEmulatorApi::GetBoolean(mEnv, value, &result);
+    return result;
+}
+
+addon_value HostEmulator::Number(double value) {
+    addon_value result = nullptr;
+    HostEmulatorApi::CreateDouble(mEnv, value, &result);
+    return result;
+}
+
+addon_value HostEmulator::String(const std::string& value) {
+    addon_value result = nullptr;
+    HostEmulatorApi::CreateStringUtf8(mEnv, value.data(), value.size(), &result);
+    return result;
+}
+
+addon_value HostEmulator::Object() {
+    addon_value result = nullptr;
+    HostEmulatorApi::CreateObject(mEnv, &result);
+    return result;
+}
+
+addon_value HostEmulator::Array(const std::vector<addon_value>& elements) {
+    addon_value result = nullptr;
+    HostEmulatorApi::CreateArray(mEnv, &result);
+    for (size_t index = 0; index < elements.size(); ++index)
+        HostEmulatorApi::SetElement(mEnv, result, static_cast<uint32_t>(index), elements[index]);
+    return result;
+}
+
+addon_value HostEmulator::ArrayBuffer(const void* data, size_t length) {
+    addon_value result = nullptr;
+    void* bytes = nullptr;
+    HostEmulatorApi::CreateArrayBuffer(mEnv, length, &bytes, &result);
+    if (length > 0)
+        std::memcpy(bytes, data, length);
+    return result;
+}
+
+addon_value HostEmulator::Function(NativeFunction function) {
+    addon_value result = HostEmulatorApi::Make(mEnv, addon_function);
+    result->native = std::move(function);
+    return result;
+}
+
+void HostEmulator::SetProperty(addon_value object, const std::string& name, addon_value value) {
+    HostEmulatorApi::SetNamedProperty(mEnv, object, name.c_str(), value);
+}
+
+addon_value HostEmulator::GetProperty(addon_value object, const std::string& name) {
+    addon_value result = nullptr;
+    if (HostEmulatorApi::GetNamedProperty(mEnv, object, name.c_str(), &result) != addon_ok)
+        return Undefined();
+    return result;
+}
+
+addon_valuetype HostEmulator::TypeOf(addon_value value) {
+    return value != nullptr ? value->type : addon_undefined;
+}
+
+bool HostEmulator::IsArray(addon_value value) {
+    return value != nullptr && value->isArray;
+}
+
+bool HostEmulator::IsError(addon_value value) {
+    return value != nullptr && value->isError;
+}
+
+bool HostEmulator::IsPromise(addon_value value) {
+    return value != nullptr && value->isPromise;
+}
+
+bool HostEmulator::GetBoolean(addon_value value) {
+    return value != nullptr && value->type == addon_boolean && value->boolean;
+}
+
+double HostEmulator::GetNumber(addon_value value) {
+    return value != nullptr && value->type == addon_number ? value->number : std::nan("");
+}
+
+std::string HostEmulator::GetString(addon_value value) {
+    return value != nullptr && value->type == addon_string ? value->string : std::string();
+}
+
+uint32_t HostEmulator::GetLength(addon_value value) {
+    return value != nullptr && value->isArray ? static_cast<uint32_t>(value->elements.size()) : 0;
+}
+
+addon_value HostEmulator::GetElement(addon_value array, uint32_t index) {
+    addon_value result = nullptr;
+    if (HostEmulatorApi::GetElement(mEnv, array, index, &result) != addon_ok)
+        return Undefined();
+    return result;
+}
+
+std::vector<uint8_t> HostEmulator::GetBytes(addon_value arrayBuffer) {
+    if (arrayBuffer == nullptr)
+        return {};
+    if (arrayBuffer->isTypedArray) {
+        const uint8_t* data = arrayBuffer->buffer->Data() + arrayBuffer->byteOffset;
+        return std::vector<uint8_t>(
+            data, data + arrayBuffer->length * HostEmulatorApi::ElementSize(arrayBuffer->typedArrayType));
+    }
+    if (!arrayBuffer->isArrayBuffer)
+        return {};
+    return std::vector<uint8_t>(arrayBuffer->Data(), arrayBuffer->Data() + arrayBuffer->ByteLength());
+}
+
+std::string HostEmulator::Describe(addon_value value) {
+    if (value == nullptr)
+        return "<null handle>";
+
+    std::ostringstream stream;
+    switch (value->type) {
+    case addon_undefined: stream << "undefined"; break;
+    case addon_null: stream << "null"; break;
+    case addon_boolean: stream << (value->boolean ? "true" : "false"); break;
+    case addon_number: stream << value->number; break;
+    case addon_string: stream << '"' << value->string.substr(0, 200) << (value->string.size() > 200 ? "..." : "") << '"'; break;
+    case addon_function: stream << "function " << value->string; break;
+    case addon_external: stream << "[external]"; break;
+    case addon_object:
+        if (value->isError) {
+            stream << "Error(" << Describe(value->Get("code").get()) << ", " << Describe(value->Get("message").get())
+                   << ")";
+        } else if (value->isPromise) {
+            stream << "Promise<" << (value->promiseState == 0 ? "pending" : value->promiseState == 1 ? "resolved" : "rejected")
+                   << ">";
+        } else if (value->isArrayBuffer) {
+            stream << "ArrayBuffer(" << value->ByteLength() << ")";
+        } else if (value->isTypedArray) {
+            stream << "TypedArray(" << value->length << ")";
+        } else if (value->isArray) {
+            stream << '[';
+            for (size_t index = 0; index < value->elements.size(); ++index)
+                stream << (index > 0 ? ", " : "") << Describe(value->elements[index].get());
+            stream << ']';
+        } else {
+            stream << '{';
+            for (size_t index = 0; index < value->properties.size(); ++index)
+                stream << (index > 0 ? ", " : "") << value->properties[index].first << ": "
+                       << Describe(value->properties[index].second.get());
+            stream << '}';
+        }
+        break;
+    default: stream << "<value>"; break;
+    }
+    return stream.str();
+}
+
+bool HostEmulator::IsExceptionPending() {
+    return mEnv->pendingException != nullptr;
+}
+
+addon_value HostEmulator::TakeException() {
+    addon_value result = nullptr;
+    HostEmulatorApi::GetAndClearLastException(mEnv, &result);
+    return result;
+}
+
+size_t HostEmulator::PumpScriptQueue(std::chrono::milliseconds timeout) {
+    size_t count = 0;
+    std::unique_lock<std::mutex> lock(mScriptMutex);
+    if (mScriptQueue.empty() && timeout.count() > 0)
+        mScriptWakeup.wait_for(lock, timeout, [this]() { return !mScriptQueue.empty(); });
+
+    while (!mScriptQueue.empty()) {
+        QueuedTask queued = mScriptQueue.front();
+        mScriptQueue.pop_front();
+        lock.unlock();
+
+        queued.task(queued.data);
+        if (queued.deleter != nullptr)
+            queued.deleter(queued.data);
+        ++count;
+
+        lock.lock();
+    }
+    return count;
+}
+
+bool HostEmulator::Await(addon_value promise, addon_value* result, bool* rejected, std::chrono::milliseconds timeout) {
+    if (promise == nullptr || !promise->isPromise)
+        return false;
+
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (promise->promiseState == 0) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= deadline)
+            return false;
+        PumpScriptQueue(std::min(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now),
+                                 std::chrono::milliseconds(10)));
+    }
+
+    if (result != nullptr)
+        *result = HostEmulatorApi::Track(mEnv, promise->settledValue);
+    if (rejected != nullptr)
+        *rejected = promise->promiseState == 2;
+    return true;
+}
+
+void HostEmulator::DrainMainQueue() {
+    std::unique_lock<std::mutex> lock(mMainMutex);
+    mMainIdle.wait(lock, [this]() { return mMainQueue.empty() && !mMainBusy; });
+}
+
+void HostEmulator::RunMainQueue() {
+    std::unique_lock<std::mutex> lock(mMainMutex);
+    for (;;) {
+        mMainWakeup.wait(lock, [this]() { return mStopping || !mMainQueue.empty(); });
+        if (mStopping)
+            return;
+
+        QueuedTask queued = mMainQueue.front();
+        mMainQueue.pop_front();
+        mMainBusy = true;
+        lock.unlock();
+
+        queued.task(queued.data);
+        if (queued.deleter != nullptr)
+            queued.deleter(queued.data);
+
+        lock.lock();
+        mMainBusy = false;
+        if (mMainQueue.empty())
+            mMainIdle.notify_all();
+    }
+}
+
+HostEmulator::Scope::Scope(HostEmulator& host) : mHost(host) {
+    HostEmulatorApi::OpenHandleScope(mHost.mEnv, &mScope);
+}
+
+HostEmulator::Scope::~Scope() {
+    HostEmulatorApi::CloseHandleScope(mHost.mEnv, mScope);
+}
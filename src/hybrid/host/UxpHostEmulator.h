@@ -0,0 +1,160 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/api/UxpAddonShared.h"
+
+/** The HostEmulator is a small in-process implementation of the addon_apis table.
+ It stands in for the UXP host so that the addon exports can be exercised, fuzzed
+ and benchmarked without Premiere Pro (e.g. on the Linux build machines).
+
+ The thread that creates the emulator plays the role of the JavaScript thread: values
+ may only be created and inspected there, and tasks scheduled on the JavaScript queue
+ run when that thread pumps the queue (PumpScriptQueue/Await). The main queue is
+ served by a separate "host main" thread, as in the real host.
+
+ Values live until the handle scope they were created in is closed. The emulator
+ opens a root scope, so values that are created outside of any explicit scope stay
+ alive for the lifetime of the emulator.
+*/
+
+class HostEmulator {
+ public:
+    using NativeFunction = std::function<addon_value(addon_env env, const std::vector<addon_value>& args)>;
+
+    HostEmulator();
+    ~HostEmulator();
+
+    HostEmulator(const HostEmulator&) = delete;
+    HostEmulator& operator=(const HostEmulator&) = delete;
+
+    addon_env GetEnv() const { return mEnv; }
+    static const addon_apis& GetApis();
+
+    // @{ Addon lifecycle
+    // Invoke uxp_addon_init with a fresh exports object and return the populated exports
+    addon_value LoadAddon();
+    // Invoke uxp_addon_terminate
+    void UnloadAddon();
+    // @}
+
+    // Invoke a function property of an object. Returns nullptr and sets error if the call threw.
+    addon_value Call(addon_value object, const std::string& name, const std::vector<addon_value>& args);
+    addon_value CallFunction(addon_value function, const std::vector<addon_value>& args);
+
+    // @{ Value helpers
+    addon_value Undefined();
+    addon_value Boolean(bool value);
+    addon_value Number(double value);
+    addon_value String(const std::string& value);
+    addon_value Object();
+    addon_value Array(const std::vector<addon_value>& elements = {});
+    addon_value ArrayBuffer(const void* data, size_t length);
+    addon_value Function(NativeFunction function);
+    void SetProperty(addon_value object, const std::string& name, addon_value value);
+    addon_value GetProperty(addon_value object, const std::string& name);
+
+    addon_valuetype TypeOf(addon_value value);
+    bool IsArray(addon_value value);
+    bool IsError(addon_value value);
+    bool IsPromise(addon_value value);
+    bool GetBoolean(addon_value value);
+    double GetNumber(addon_value value);
+    std::string GetString(addon_value value);
+    uint32_t GetLength(addon_value value);
+    addon_value GetElement(addon_value array, uint32_t index);
+    std::vector<uint8_t> GetBytes(addon_value arrayBuffer);
+
+    // Render a value as JSON-like text, for diagnostics
+    std::string Describe(addon_value value);
+    // @}
+
+    // @{ Exceptions
+    bool IsExceptionPending();
+    addon_value TakeException();
+    // @}
+
+    // @{ Queues
+    // Run the tasks that are queued on the JavaScript queue. Waits up to timeout for the first task.
+    // Returns the number of tasks that were run.
+    size_t PumpScriptQueue(std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+    // Pump the JavaScript queue until the promise is settled or the timeout expired.
+    // Returns false on timeout.
+    bool Await(addon_value promise,
+               addon_value* result,
+               bool* rejected,
+               std::chrono::milliseconds timeout = std::chrono::milliseconds(10000));
+
+    // Wait until the main queue is drained
+    void DrainMainQueue();
+
+    bool IsScriptThread() const { return std::this_thread::get_id() == mScriptThread; }
+    // @}
+
+    // @{ Handle scopes
+    class Scope {
+     public:
+        explicit Scope(HostEmulator& host);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+     private:
+        HostEmulator& mHost;
+        addon_handle_scope mScope{nullptr};
+    };
+    // @}
+
+    // Number of API calls that were made on a thread other than the JavaScript thread
+    // although they require the JavaScript thread
+    size_t GetThreadViolations() const { return mThreadViolations; }
+
+ private:
+    friend struct HostEmulatorApi;
+
+    struct QueuedTask {
+        addon_task task;
+        addon_task_data data;
+        addon_task_destructor deleter;
+    };
+
+    void RunMainQueue();
+
+    addon_env mEnv{nullptr};
+    addon_handle_scope mRootScope{nullptr};
+    std::thread::id mScriptThread;
+    std::atomic<size_t> mThreadViolations{0};
+
+    std::mutex mScriptMutex;
+    std::condition_variable mScriptWakeup;
+    std::deque<QueuedTask> mScriptQueue;
+
+    std::mutex mMainMutex;
+    std::condition_variable mMainWakeup;
+    std::condition_variable mMainIdle;
+    std::deque<QueuedTask> mMainQueue;
+    bool mMainBusy{false};
+    bool mStopping{false};
+    std::thread mMainThread;
+};
@@ -0,0 +1,1953 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+/*
+ * Headless runner for the addon exports.
+ * Loads the addon into the host emulator and runs the registered cases:
+ *     uxp-host-runner                 run all cases
+ *     uxp-host-runner <filter>        run the cases whose name contains filter
+ *     uxp-host-runner --fuzz <count>  call every export with random arguments
+ *     uxp-host-runner --fuzz-images <count> [files]
+ *                                     decode mutations of generated images and of files
+ * Exit code is the number of failed cases.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include "UxpHostEmulator.h"
+#include "utilities/UxpImages.h"
+#include "utilities/UxpPixels.h"
+#include "utilities/UxpCoroutine.h"
+#include "utilities/UxpTask.h"
+#include "utilities/UxpWorkerPool.h"
+
+namespace {
+
+struct Case {
+    const char* name;
+    std::function<void(HostEmulator& host, addon_value exports)> run;
+};
+
+struct Failure {
+    std::string message;
+};
+
+void Expect(bool condition, const std::string& message) {
+    if (!condition)
+        throw Failure{message};
+}
+
+// Await a promise returned by an export and return its resolution
+addon_value Resolved(HostEmulator& host, addon_value promise) {
+    Expect(host.IsPromise(promise), "expected a promise, got " + host.Describe(promise));
+    addon_value result = nullptr;
+    bool rejected = false;
+    Expect(host.Await(promise, &result, &rejected), "promise did not settle");
+    Expect(!rejected, "promise was rejected with " + host.Describe(result));
+    return result;
+}
+
+// Await a promise returned by an export and return the code of the error it was rejected with
+std::string RejectedCode(HostEmulator& host, addon_value promise) {
+    Expect(host.IsPromise(promise), "expected a promise, got " + host.Describe(promise));
+    addon_value result = nullptr;
+    bool rejected = false;
+    Expect(host.Await(promise, &result, &rejected), "promise did not settle");
+    Expect(rejected, "promise was resolved with " + host.Describe(result));
+    return host.GetString(host.GetProperty(result, "code"));
+}
+
+// A coroutine that continues on a worker thread
+Promise<Value> OnWorkerThread() {
+    co_await OnWorker();
+    co_return Value(true);
+}
+
+std::filesystem::path ScratchDirectory(const char* name) {
+    auto path = std::filesystem::temp_directory_path() / "uxp-host-runner" / name;
+    std::filesystem::remove_all(path);
+    std::filesystem::create_directories(path);
+    return path;
+}
+
+std::string ReadAll(const std::filesystem::path& path) {
+    std::ifstream input(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+}
+
+// @{ Minimal ISO base media files for the probeMedia cases
+std::string BigEndian(uint64_t value, int bytes) {
+    std::string text(bytes, '\0');
+    for (int index = bytes - 1; index >= 0; --index, value >>= 8)
+        text[index] = static_cast<char>(value & 0xff);
+    return text;
+}
+
+std::string Mp4Box(const char* type, const std::string& payload) {
+    return BigEndian(payload.size() + 8, 4) + type + payload;
+}
+
+// Version 0 full box
+std::string Mp4FullBox(const char* type, const std::string& payload) {
+    return Mp4Box(type, BigEndian(0, 4) + payload);
+}
+
+// A 640x360 H.264 track of 60 frames at 29.97 fps in two chunks of 30 samples with
+// keyframes 1 and 31, and an AAC-LC stereo track. Sample n is 100 + n bytes long.
+std::string Mp4Movie(uint64_t mediaDataOffset) {
+    const std::string tkhdTail = BigEndian(0, 8) + BigEndian(0, 8) + std::string(36, '\0');
+    const std::string videoHeader = Mp4FullBox(
+        "tkhd", BigEndian(0, 8) + BigEndian(1, 4) + BigEndian(0, 8) + tkhdTail + BigEndian(640 << 16, 4) +
+                    BigEndian(360 << 16, 4));
+
+    const std::string avc1 = Mp4Box(
+        "avc1", std::string(6, '\0') + BigEndian(1, 2) + std::string(16, '\0') + BigEndian(640, 2) +
+                    BigEndian(360, 2) + std::string(50, '\0') +
+                    Mp4Box("avcC", std::string("\x01\x64\x00\x1f\xff\xe0", 6)));
+    std::string sizes;
+    uint64_t secondChunk = mediaDataOffset;
+    for (int sample = 0; sample < 60; ++sample) {
+        sizes += BigEndian(100 + sample, 4);
+        if (sample < 30)
+            secondChunk += 100 + sample;
+    }
+    const std::string videoTables = Mp4FullBox("stsd", BigEndian(1, 4) + avc1) +
+                                    Mp4FullBox("stts", BigEndian(1, 4) + BigEndian(60, 4) + BigEndian(1001, 4)) +
+                                    Mp4FullBox("stss", BigEndian(2, 4) + BigEndian(1, 4) + BigEndian(31, 4)) +
+                                    Mp4FullBox("stsc", BigEndian(1, 4) + BigEndian(1, 4) + BigEndian(30, 4) + BigEndian(1, 4)) +
+                                    Mp4FullBox("stsz", BigEndian(0, 4) + BigEndian(60, 4) + sizes) +
+                                    Mp4FullBox("stco", BigEndian(2, 4) + BigEndian(mediaDataOffset, 4) + BigEndian(secondChunk, 4));
+    const std::string video = Mp4Box(
+        "trak", videoHeader +
+                    Mp4Box("mdia", Mp4FullBox("mdhd", BigEndian(0, 8) + BigEndian(30000, 4) + BigEndian(60060, 4) + BigEndian(0, 4)) +
+                                       Mp4FullBox("hdlr", BigEndian(0, 4) + "vide" + std::string(13, '\0')) +
+                                       Mp4Box("minf", Mp4Box("stbl", videoTables))));
+
+    const std::string esds = Mp4FullBox(
+        "esds", std::string("\x03\x19\x00\x02\x00"
+                            "\x04\x11\x40\x15\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+                            "\x05\x02\x12\x10",
+                            25));
+    const std::string mp4a = Mp4Box("mp4a", std::string(6, '\0') + BigEndian(1, 2) + BigEndian(0, 8) + BigEndian(2, 2) +
+                                                BigEndian(16, 2) + BigEndian(0, 4) + BigEndian(48000u << 16, 4) + esds);
+    const std::string audio = Mp4Box(
+        "trak", Mp4FullBox("tkhd", BigEndian(0, 8) + BigEndian(2, 4) + BigEndian(0, 8) + tkhdTail + BigEndian(0, 8)) +
+                    Mp4Box("mdia", Mp4FullBox("mdhd", BigEndian(0, 8) + BigEndian(48000, 4) + BigEndian(96000, 4) + BigEndian(0, 4)) +
+                                       Mp4FullBox("hdlr", BigEndian(0, 4) + "soun" + std::string(13, '\0')) +
+                                       Mp4Box("minf", Mp4Box("stbl", Mp4FullBox("stsd", BigEndian(1, 4) + mp4a)))));
+
+    const std::string header =
+        Mp4FullBox("mvhd", BigEndian(0, 8) + BigEndian(1000, 4) + BigEndian(2002, 4) + std::string(80, '\0'));
+    return Mp4Box("moov", header + video + audio);
+}
+
+std::string Mp4File(bool faststart) {
+    const std::string fileType = Mp4Box("ftyp", std::string("isom") + BigEndian(512, 4) + "isomavc1");
+    uint64_t mediaDataSize = 0;
+    for (int sample = 0; sample < 60; ++sample)
+        mediaDataSize += 100 + sample;
+    std::string samples(mediaDataSize, '\0');
+    for (size_t index = 0; index < samples.size(); ++index)
+        samples[index] = static_cast<char>(index * 7 + 1);
+    const std::string mediaData = Mp4Box("mdat", samples);
+
+    if (!faststart)
+        return fileType + mediaData + Mp4Movie(fileType.size() + 8);
+    const size_t movieSize = Mp4Movie(0).size();
+    return fileType + Mp4Movie(fileType.size() + movieSize + 8) + mediaData;
+}
+
+void WriteAll(const std::filesystem::path& path, const std::string& content) {
+    std::ofstream output(path, std::ios::binary);
+    output.write(content.data(), static_cast<std::streamsize>(content.size()));
+}
+// @}
+
+// @{ Minimal PNG files for the image cases: 8-bit RGBA, stored (uncompressed) zlib blocks
+uint32_t Crc32(const std::string& data) {
+    uint32_t crc = 0xffffffff;
+    for (const char c : data) {
+        crc ^= static_cast<uint8_t>(c);
+        for (int bit = 0; bit < 8; ++bit)
+            crc = crc & 1 ? 0xedb88320 ^ (crc >> 1) : crc >> 1;
+    }
+    return ~crc;
+}
+
+std::string PngChunk(const char* type, const std::string& payload) {
+    const std::string body = type + payload;
+    return BigEndian(payload.size(), 4) + body + BigEndian(Crc32(body), 4);
+}
+
+// pixel(x, y) returns the RGBA components of a pixel as 0xRRGGBBAA
+std::string PngFile(uint32_t width, uint32_t height, const std::function<uint32_t(uint32_t, uint32_t)>& pixel) {
+    std::string raw;
+    for (uint32_t y = 0; y < height; ++y) {
+        raw += '\0';
+        for (uint32_t x = 0; x < width; ++x)
+            raw += BigEndian(pixel(x, y), 4);
+    }
+
+    std::string zlib("\x78\x01", 2);
+    for (size_t offset = 0; offset == 0 || offset < raw.size(); offset += 65535) {
+        const size_t length = std::min<size_t>(65535, raw.size() - offset);
+        zlib += static_cast<char>(offset + length == raw.size() ? 1 : 0);
+        zlib += static_cast<char>(length & 0xff);
+        zlib += static_cast<char>(length >> 8);
+        zlib += static_cast<char>(~length & 0xff);
+        zlib += static_cast<char>((~length >> 8) & 0xff);
+        zlib += raw.substr(offset, length);
+    }
+    uint32_t a = 1, b = 0;
+    for (const char c : raw) {
+        a = (a + static_cast<uint8_t>(c)) % 65521;
+        b = (b + a) % 65521;
+    }
+    zlib += BigEndian(uint64_t(b) << 16 | a, 4);
+
+    return std::string("\x89PNG\r\n\x1a\n", 8) +
+           PngChunk("IHDR", BigEndian(width, 4) + BigEndian(height, 4) + std::string("\x08\x06\0\0\0", 5)) +
+           PngChunk("IDAT", zlib) + PngChunk("IEND", std::string());
+}
+// @}
+
+#ifndef _WIN32
+// Send raw HTTP requests to 127.0.0.1:port and return everything received until the
+// server closes the connection
+std::string HttpExchange(uint16_t port, const std::string& requests) {
+    const int client = socket(AF_INET, SOCK_STREAM, 0);
+    Expect(client >= 0, "socket failed");
+    timeval timeout{5, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(client);
+        return std::string();
+    }
+    send(client, requests.data(), requests.size(), 0);
+
+    std::string response;
+    char buffer[65536];
+    for (ssize_t received; (received = recv(client, buffer, sizeof(buffer), 0)) > 0;)
+        response.append(buffer, static_cast<size_t>(received));
+    close(client);
+    return response;
+}
+
+std::string HttpGet(uint16_t port, const std::string& target, const std::string& headers = std::string()) {
+    return HttpExchange(port, "GET " + target + " HTTP/1.1\r\nHost: 127.0.0.1\r\n" + headers + "Connection: close\r\n\r\n");
+}
+
+std::string HttpBody(const std::string& response) {
+    const size_t end = response.find("\r\n\r\n");
+    return end == std::string::npos ? std::string() : response.substr(end + 4);
+}
+#endif
+
+const std::vector<Case>& Cases() {
+    static const std::vector<Case> cases = {
+        {"my_function",
+         [](HostEmulator& host, addon_value exports) {
+             addon_value result = host.Call(exports, "my_function", {});
+             Expect(host.GetString(result) == "hello world", "unexpected " + host.Describe(result));
+         }},
+        {"my_echo",
+         [](HostEmulator& host, addon_value exports) {
+             addon_value input = host.Object();
+             host.SetProperty(input, "name", host.String("clip"));
+             host.SetProperty(input, "sizes", host.Array({host.Number(1), host.Number(2)}));
+             addon_value result = host.Call(exports, "my_echo", {input});
+             Expect(host.Describe(result) == host.Describe(input), "echo mismatch " + host.Describe(result));
+         }},
+        {"my_echo_async",
+         [](HostEmulator& host, addon_value exports) {
+             addon_value result = Resolved(host, host.Call(exports, "my_echo_async", {host.String("async")}));
+             Expect(host.GetString(result) == "async", "unexpected " + host.Describe(result));
+         }},
+        {"Task::WhenAny",
+         [](HostEmulator& host, addon_value) {
+             // The first sub-task to complete cancels the others, not the join
+             auto loserStarted = std::make_shared<std::atomic<bool>>(false);
+             auto loserCancelled = std::make_shared<std::atomic<bool>>(false);
+             auto winner = Task::Create();
+             winner->Then(Task::Lane::worker, [loserStarted](Task& task) {
+                 while (!*loserStarted)
+                     std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                 task.SetResult(Value(1.0), false);
+             });
+             auto loser = Task::Create();
+             loser->Then(Task::Lane::worker, [loserStarted, loserCancelled](Task& task) {
+                 *loserStarted = true;
+                 const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+                 while (!task.IsCancelled() && std::chrono::steady_clock::now() < deadline)
+                     std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                 *loserCancelled = task.IsCancelled();
+             });
+             auto join = Task::WhenAny({winner, loser});
+             join->SetCancellationToken(CancellationToken::Create());
+             join->Then(Task::Lane::worker, [](Task& task) { task.ThrowIfCancelled(); });
+             addon_value result = Resolved(host, join->Start(host.GetEnv()));
+             Expect(host.Describe(result) == "{index: 0, value: 1}", "unexpected " + host.Describe(result));
+             const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+             while (!*loserCancelled && std::chrono::steady_clock::now() < deadline)
+                 std::this_thread::sleep_for(std::chrono::milliseconds(1));
+             Expect(*loserCancelled, "the losing sub-task was not cancelled");
+         }},
+        {"Task::WhenAll",
+         [](HostEmulator& host, addon_value) {
+             // The first sub-task to fail rejects the join without waiting for the others,
+             // which are cancelled
+             auto slowStarted = std::make_shared<std::atomic<bool>>(false);
+             auto slowCancelled = std::make_shared<std::atomic<bool>>(false);
+             auto failing = Task::Create();
+             failing->Then(Task::Lane::worker, [slowStarted](Task&) {
+                 while (!*slowStarted)
+                     std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                 throw AddonError("TEST_ERR", "failed");
+             });
+             auto slow = Task::Create();
+             slow->Then(Task::Lane::worker, [slowStarted, slowCancelled](Task& task) {
+                 *slowStarted = true;
+                 const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+                 while (!task.IsCancelled() && std::chrono::steady_clock::now() < deadline)
+                     std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                 *slowCancelled = task.IsCancelled();
+             });
+             const auto start = std::chrono::steady_clock::now();
+             Expect(RejectedCode(host, Task::WhenAll({failing, slow})->Start(host.GetEnv())) == "TEST_ERR", "not rejected");
+             Expect(std::chrono::steady_clock::now() - start < std::chrono::seconds(5), "the join waited for the slow sub-task");
+             const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+             while (!*slowCancelled && std::chrono::steady_clock::now() < deadline)
+                 std::this_thread::sleep_for(std::chrono::milliseconds(1));
+             Expect(*slowCancelled, "the slow sub-task was not cancelled");
+         }},
+        {"writeFile",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("writeFile");
+             const auto path = (directory / "nested" / "a.txt").string();
+             addon_value plain = host.Call(exports, "writeFile", {host.String(path), host.String("hello")});
+             Expect(host.GetBoolean(plain), "plain write failed " + host.Describe(plain));
+             Expect(ReadAll(path) == "hello", "plain content mismatch");
+
+             addon_value base64 =
+                 host.Call(exports, "writeFile", {host.String(path), host.String("aGVsbG8gd29ybGQ="), host.Boolean(true)});
+             Expect(host.GetBoolean(base64), "base64 write failed");
+             Expect(ReadAll(path) == "hello world", "base64 content mismatch");
+         }},
+        {"writeFiles",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("writeFiles");
+             std::vector<addon_value> entries;
+             for (int index = 0; index < 8; ++index) {
+                 addon_value entry = host.Object();
+                 host.SetProperty(entry, "path", host.String((directory / (std::to_string(index) + ".txt")).string()));
+                 host.SetProperty(entry, "data", host.String("file " + std::to_string(index)));
+                 entries.push_back(entry);
+             }
+             addon_value result = Resolved(host, host.Call(exports, "writeFiles", {host.Array(entries)}));
+             Expect(host.GetLength(result) == entries.size(), "unexpected " + host.Describe(result));
+             for (uint32_t index = 0; index < entries.size(); ++index) {
+                 Expect(host.GetBoolean(host.GetElement(result, index)), "write failed");
+                 Expect(ReadAll(directory / (std::to_string(index) + ".txt")) == "file " + std::to_string(index),
+                        "content mismatch");
+             }
+         }},
+        {"writeFiles progress",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("writeFilesProgress");
+             std::vector<addon_value> entries;
+             for (int index = 0; index < 64; ++index) {
+                 addon_value entry = host.Object();
+                 host.SetProperty(entry, "path", host.String((directory / (std::to_string(index) + ".txt")).string()));
+                 host.SetProperty(entry, "data", host.String(std::string(4096, 'x')));
+                 entries.push_back(entry);
+             }
+
+             // Updates are coalesced and end with the final count
+             auto calls = std::make_shared<std::vector<std::pair<double, double>>>();
+             addon_value options = host.Object();
+             host.SetProperty(options, "onProgress",
+                              host.Function([&host, calls](addon_env, const std::vector<addon_value>& args) {
+                                  calls->emplace_back(host.GetNumber(args.at(0)), host.GetNumber(args.at(1)));
+                                  return host.Undefined();
+                              }));
+             Resolved(host, host.Call(exports, "writeFiles", {host.Array(entries), options}));
+             Expect(!calls->empty() && calls->size() <= entries.size(),
+                    "unexpected callback count " + std::to_string(calls->size()));
+             Expect(calls->back() == std::make_pair(64.0, 64.0), "last update was not the final count");
+             for (size_t index = 1; index < calls->size(); ++index)
+                 Expect((*calls)[index].first >= (*calls)[index - 1].first, "progress went backwards");
+
+             // An option read after onProgress fails: the callback is released with the channel
+             host.SetProperty(options, "durable", host.String("yes"));
+             Expect(host.IsError(host.Call(exports, "writeFiles", {host.Array(entries), options})), "durable");
+             host.PumpScriptQueue();
+         }},
+        {"readFiles/writeFiles durable",
+         [](HostEmulator& host, addon_value exports) {
+             // More files than a window of the I/O engine, in nested folders, of several sizes
+             const auto directory = ScratchDirectory("readFiles");
+             const auto path = [&directory](int index) {
+                 return (directory / std::to_string(index % 3) / (std::to_string(index) + ".bin")).string();
+             };
+             const auto contents = [](int index) {
+                 return index == 0 ? std::string() : std::string(index == 1 ? (3 << 20) : index * 97, static_cast<char>('a' + index % 26));
+             };
+             std::filesystem::create_directories(directory / "1");
+             WriteAll(path(1), "previous contents");
+
+             std::vector<addon_value> entries;
+             for (int index = 0; index < 150; ++index) {
+                 addon_value entry = host.Object();
+                 host.SetProperty(entry, "path", host.String(path(index)));
+                 host.SetProperty(entry, "data", host.String(contents(index)));
+                 entries.push_back(entry);
+             }
+             addon_value options = host.Object();
+             host.SetProperty(options, "durable", host.Boolean(true));
+             addon_value written = Resolved(host, host.Call(exports, "writeFiles", {host.Array(entries), options}));
+             for (uint32_t index = 0; index < entries.size(); ++index)
+                 Expect(host.GetBoolean(host.GetElement(written, index)), "durable write failed");
+             for (const auto& file : std::filesystem::recursive_directory_iterator(directory))
+                 Expect(file.path().extension() != ".writing", "partial file left: " + file.path().string());
+
+             std::vector<addon_value> paths;
+             for (int index = 0; index < 150; ++index)
+                 paths.push_back(host.String(path(index)));
+             paths.push_back(host.String((directory / "missing.bin").string()));
+             paths.push_back(host.String(directory.string()));
+             addon_value read = Resolved(host, host.Call(exports, "readFiles", {host.Array(paths)}));
+             Expect(host.GetLength(read) == paths.size(), "unexpected " + host.Describe(read));
+             for (int index = 0; index < 150; ++index) {
+                 const auto bytes = host.GetBytes(host.GetElement(read, static_cast<uint32_t>(index)));
+                 Expect(std::string(bytes.begin(), bytes.end()) == contents(index), "content mismatch " + path(index));
+             }
+             Expect(host.Describe(host.GetElement(read, 150)) == "undefined", "missing file was read");
+             Expect(host.Describe(host.GetElement(read, 151)) == "undefined", "folder was read");
+         }},
+        {"copyFiles",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("copyFiles");
+             std::string large(3 << 20, '\0');
+             for (size_t index = 0; index < large.size(); ++index)
+                 large[index] = static_cast<char>(index * 7 + index / 4096);
+             WriteAll((directory / "large.bin").string(), large);
+             WriteAll((directory / "small.txt").string(), "small");
+             // An existing destination is replaced
+             WriteAll((directory / "copy.txt").string(), "previous contents");
+
+             const auto entry = [&host](const std::filesystem::path& source, const std::filesystem::path& destination) {
+                 addon_value value = host.Object();
+                 host.SetProperty(value, "src", host.String(source.string()));
+                 host.SetProperty(value, "dst", host.String(destination.string()));
+                 return value;
+             };
+             auto calls = std::make_shared<std::vector<std::pair<double, double>>>();
+             addon_value options = host.Object();
+             host.SetProperty(options, "concurrency", host.Number(2));
+             host.SetProperty(options, "onProgress",
+                              host.Function([&host, calls](addon_env, const std::vector<addon_value>& args) {
+                                  calls->emplace_back(host.GetNumber(args.at(0)), host.GetNumber(args.at(1)));
+                                  return host.Undefined();
+                              }));
+             addon_value result = Resolved(
+                 host, host.Call(exports, "copyFiles",
+                                 {host.Array({entry(directory / "large.bin", directory / "nested" / "day" / "large.bin"),
+                                              entry(directory / "small.txt", directory / "copy.txt"),
+                                              entry(directory / "missing.bin", directory / "missing copy.bin")}),
+                                  options}));
+             Expect(host.GetLength(result) == 3, "unexpected " + host.Describe(result));
+
+             addon_value copy = host.GetElement(result, 0);
+             const std::string method = host.GetString(host.GetProperty(copy, "method"));
+             Expect(method == "clone" || method == "kernel" || method == "buffered", "method " + host.Describe(copy));
+             Expect(host.GetNumber(host.GetProperty(copy, "bytes")) == large.size(), "bytes " + host.Describe(copy));
+             Expect(ReadAll(directory / "nested" / "day" / "large.bin") == large, "large content mismatch");
+             Expect(host.GetNumber(host.GetProperty(host.GetElement(result, 1), "bytes")) == 5, host.Describe(result));
+             Expect(ReadAll(directory / "copy.txt") == "small", "small content mismatch");
+
+             addon_value error = host.GetProperty(host.GetElement(result, 2), "error");
+             Expect(host.GetString(host.GetProperty(error, "code")) == "IO_ERR", "missing source " + host.Describe(result));
+             Expect(!std::filesystem::exists(directory / "missing copy.bin") &&
+                        !std::filesystem::exists(directory / "missing copy.bin.copying"),
+                    "a failed copy left a file");
+
+             const double total = static_cast<double>(large.size() + 5);
+             Expect(!calls->empty() && calls->back() == std::make_pair(total, total), "last update was not the total");
+             for (size_t index = 1; index < calls->size(); ++index)
+                 Expect((*calls)[index].first >= (*calls)[index - 1].first, "progress went backwards");
+
+             for (const double concurrency : {0.0, -3.0, HUGE_VAL, std::nan("")}) {
+                 host.SetProperty(options, "concurrency", host.Number(concurrency));
+                 Expect(host.IsError(host.Call(exports, "copyFiles", {host.Array({}), options})),
+                        "concurrency " + std::to_string(concurrency));
+             }
+             host.SetProperty(options, "concurrency", host.Number(1e300));
+             Expect(host.GetLength(Resolved(host, host.Call(exports, "copyFiles", {host.Array({}), options}))) == 0,
+                    "large concurrency");
+         }},
+        {"openStorage",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("openStorage") / "Generations";
+             addon_value session = host.Call(exports, "openStorage", {host.String(directory.string() + "/")});
+             Expect(host.GetString(host.GetProperty(session, "root")) == directory.string(),
+                    "root " + host.Describe(host.GetProperty(session, "root")));
+             const auto read = [&host, &session](const std::string& path) {
+                 const auto bytes = host.GetBytes(host.Call(session, "readFile", {host.String(path)}));
+                 return std::string(bytes.begin(), bytes.end());
+             };
+
+             Expect(host.GetBoolean(host.Call(session, "writeFile", {host.String("2024-05-01/a.png"), host.String("AAEC/w=="),
+                                                                     host.Boolean(true)})),
+                    "base64 write failed");
+             Expect(ReadAll(directory / "2024-05-01" / "a.png") == std::string("\x00\x01\x02\xff", 4), "a.png content");
+             Expect(host.GetBoolean(host.Call(session, "writeFile", {host.String("2024-05-01//./a.png.json"), host.String("{}")})),
+                    "write failed");
+             Expect(read("2024-05-01/a.png.json") == "{}", "a.png.json " + read("2024-05-01/a.png.json"));
+             Expect(host.Describe(host.Call(session, "readFile", {host.String("2024-05-01/missing.png")})) == "undefined",
+                    "missing file");
+             Expect(host.Describe(host.Call(session, "readFile", {host.String("2024-05-02/missing.png")})) == "undefined",
+                    "missing folder");
+             Expect(host.GetBoolean(host.Call(session, "ensureDirectory", {host.String("2024-05-02/clips")})) &&
+                        std::filesystem::is_directory(directory / "2024-05-02" / "clips"),
+                    "ensureDirectory");
+
+             // A dated folder deleted by another application is created again
+             std::filesystem::remove_all(directory / "2024-05-01");
+             Expect(host.GetBoolean(host.Call(session, "writeFile", {host.String("2024-05-01/b.png"), host.String("b")})),
+                    "write after the folder was deleted");
+             Expect(ReadAll(directory / "2024-05-01" / "b.png") == "b", "b.png content");
+             std::filesystem::remove_all(directory / "2024-05-01");
+             std::filesystem::create_directories(directory / "2024-05-01");
+             WriteAll(directory / "2024-05-01" / "c.png", "c");
+             Expect(read("2024-05-01/c.png") == "c", "read after the folder was replaced");
+
+             for (const char* outside : {"../a.png", "2024-05-01/../../a.png", "/a.png", ""}) {
+                 addon_value error = host.Call(session, "writeFile", {host.String(outside), host.String("x")});
+                 Expect(host.IsError(error), std::string("wrote ") + outside);
+             }
+
+             host.Call(session, "close", {});
+             Expect(host.IsError(host.Call(session, "writeFile", {host.String("a.png"), host.String("x")})),
+                    "write after close");
+         }},
+#ifndef _WIN32
+        {"pack",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("pack");
+             auto path = [&directory](const std::string& name) { return (directory / name).string(); };
+             auto read = [&](const std::string& name) {
+                 const auto bytes = host.GetBytes(host.Call(exports, "readPackedFile", {host.String(path(name))}));
+                 return std::string(bytes.begin(), bytes.end());
+             };
+             addon_value options = host.Object();
+             host.SetProperty(options, "pack", host.Boolean(true));
+
+             Expect(host.GetBoolean(host.Call(exports, "writeFile", {host.String(path("a.json")), host.String("{\"a\":1}"), options})),
+                    "write failed");
+             addon_value binary = host.Object();
+             host.SetProperty(binary, "pack", host.Boolean(true));
+             host.SetProperty(binary, "base64", host.Boolean(true));
+             Expect(host.GetBoolean(host.Call(exports, "writeFile", {host.String(path("b_thumbnail.jpg")), host.String("AAEC/w=="), binary})),
+                    "base64 write failed");
+             std::vector<addon_value> entries;
+             for (int index = 0; index < 100; ++index) {
+                 addon_value entry = host.Object();
+                 host.SetProperty(entry, "path", host.String(path("c" + std::to_string(index) + ".json")));
+                 host.SetProperty(entry, "data", host.String("entry " + std::to_string(index)));
+                 host.SetProperty(entry, "pack", host.Boolean(true));
+                 entries.push_back(entry);
+             }
+             addon_value result = Resolved(host, host.Call(exports, "writeFiles", {host.Array(entries)}));
+             for (uint32_t index = 0; index < entries.size(); ++index)
+                 Expect(host.GetBoolean(host.GetElement(result, index)), "writeFiles " + host.Describe(result));
+             // A later write replaces the entry
+             Expect(host.GetBoolean(host.Call(exports, "writeFile", {host.String(path("a.json")), host.String("{\"a\":2}"), options})),
+                    "rewrite failed");
+
+             Expect(read("a.json") == "{\"a\":2}", "a.json " + read("a.json"));
+             Expect(read("b_thumbnail.jpg") == std::string("\x00\x01\x02\xff", 4), "b_thumbnail.jpg");
+             Expect(read("c42.json") == "entry 42", "c42.json " + read("c42.json"));
+             Expect(host.Describe(host.Call(exports, "readPackedFile", {host.String(path("missing.json"))})) == "undefined",
+                    "missing entry");
+             size_t files = 0;
+             for (const auto& file : std::filesystem::directory_iterator(directory))
+                 files += file.path().filename() == "files.uxppack" ? 1 : 100;
+             Expect(files == 1, "the pack is not the only file");
+             addon_value names = host.Call(exports, "listPackedFiles", {host.String(directory.string())});
+             Expect(host.GetLength(names) == 102 && host.GetString(host.GetElement(names, 0)) == "a.json" &&
+                        host.GetString(host.GetElement(names, 1)) == "b_thumbnail.jpg",
+                    "names " + host.Describe(names));
+
+             result = Resolved(host, host.Call(exports, "compactPack", {host.String(directory.string())}));
+             Expect(host.GetNumber(host.GetProperty(result, "entries")) == 102, "entries " + host.Describe(result));
+             Expect(host.GetNumber(host.GetProperty(result, "reclaimedBytes")) > 0, "reclaimed " + host.Describe(result));
+             Expect(read("a.json") == "{\"a\":2}" && read("c99.json") == "entry 99", "compacted entries");
+
+             // A pack whose index wasn't written is rebuilt from its records
+             const auto packPath = directory / "files.uxppack";
+             const std::string pack = ReadAll(packPath);
+             uint64_t indexOffset = 0;
+             for (size_t index = 8; index-- > 0;)
+                 indexOffset = (indexOffset << 8) | static_cast<uint8_t>(pack[pack.size() - 24 + index]);
+             WriteAll(packPath.string(), pack.substr(0, indexOffset) + "UXPR\xff");
+             Resolved(host, host.Call(exports, "compactPack", {host.String(directory.string())}));
+             Expect(read("a.json") == "{\"a\":2}" && read("c0.json") == "entry 0", "recovered entries");
+             Expect(ReadAll(packPath).size() == pack.size(), "recovered pack differs");
+         }},
+        {"execSync",
+         [](HostEmulator& host, addon_value exports) {
+             addon_value result = host.Call(exports, "execSync", {host.String("echo hello; echo ignored >&2")});
+             Expect(host.GetString(result) == "hello\n", "unexpected " + host.Describe(result));
+         }},
+        {"spawn",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("spawn");
+             auto output = std::make_shared<std::string>();
+             auto errors = std::make_shared<std::string>();
+             addon_value env = host.Object();
+             host.SetProperty(env, "UXP_SPAWN_TEST", host.String("from env"));
+             addon_value options = host.Object();
+             host.SetProperty(options, "cwd", host.String(directory.string()));
+             host.SetProperty(options, "env", env);
+             host.SetProperty(options, "onStdout",
+                              host.Function([&host, output](addon_env, const std::vector<addon_value>& args) {
+                                  *output += host.GetString(args.at(0));
+                                  return host.Undefined();
+                              }));
+             host.SetProperty(options, "onStderr",
+                              host.Function([&host, errors](addon_env, const std::vector<addon_value>& args) {
+                                  *errors += host.GetString(args.at(0));
+                                  return host.Undefined();
+                              }));
+             addon_value args = host.Array({host.String("sh"), host.String("-c"),
+                                            host.String("pwd; echo $UXP_SPAWN_TEST; echo oops >&2; exit 3")});
+             addon_value result = Resolved(host, host.Call(exports, "spawn", {args, options}));
+             Expect(host.GetNumber(result) == 3, "unexpected exit code " + host.Describe(result));
+             const auto expected = std::filesystem::canonical(directory).string() + "\nfrom env\n";
+             Expect(*output == expected, "unexpected stdout " + *output);
+             Expect(*errors == "oops\n", "unexpected stderr " + *errors);
+         }},
+        {"spawn timeout and kill",
+         [](HostEmulator& host, addon_value exports) {
+             addon_value args = host.Array({host.String("sleep"), host.String("10")});
+             addon_value options = host.Object();
+             host.SetProperty(options, "timeout", host.Number(100));
+             const auto start = std::chrono::steady_clock::now();
+             Expect(RejectedCode(host, host.Call(exports, "spawn", {args, options})) == "TIMEOUT_ERR", "no timeout");
+
+             addon_value promise = host.Call(exports, "spawn", {args});
+             host.Call(promise, "kill", {});
+             Expect(RejectedCode(host, promise) == "ABORT_ERR", "not killed");
+             Expect(std::chrono::steady_clock::now() - start < std::chrono::seconds(5), "the process kept running");
+
+             addon_value missing = host.Array({host.String("uxp-host-runner-no-such-program")});
+             Expect(RejectedCode(host, host.Call(exports, "spawn", {missing})) == "SPAWN_ERR", "missing program");
+         }},
+        {"timeout option",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("timeoutOption");
+             auto writeFiles = [&](double timeout) {
+                 addon_value entry = host.Object();
+                 host.SetProperty(entry, "path", host.String((directory / "a.txt").string()));
+                 host.SetProperty(entry, "data", host.String("a"));
+                 addon_value options = host.Object();
+                 host.SetProperty(options, "timeout", host.Number(timeout));
+                 return host.Call(exports, "writeFiles", {host.Array({entry}), options});
+             };
+             // No deadline rather than one that overflows the clock
+             for (const double timeout : {HUGE_VAL, 9007199254740991.0, 1e300, 60000.0}) {
+                 addon_value result = Resolved(host, writeFiles(timeout));
+                 Expect(host.Describe(result) == "[true]", "timeout " + std::to_string(timeout) + ": " + host.Describe(result));
+             }
+             Expect(host.IsError(writeFiles(-1)), "negative timeout");
+             Expect(host.IsError(writeFiles(std::nan(""))), "NaN timeout");
+
+             addon_value args = host.Array({host.String("true")});
+             addon_value options = host.Object();
+             host.SetProperty(options, "timeout", host.Number(HUGE_VAL));
+             Expect(host.GetNumber(Resolved(host, host.Call(exports, "spawn", {args, options}))) == 0, "spawn without timeout");
+         }},
+        {"execBatch",
+         [](HostEmulator& host, addon_value exports) {
+             addon_value commands = host.Array({host.String("echo one"),
+                                                host.Array({host.String("sh"), host.String("-c"), host.String("exit 4")}),
+                                                host.Array({host.String("uxp-host-runner-no-such-program")}),
+                                                host.String("echo two >&2")});
+             auto calls = std::make_shared<std::vector<std::pair<double, double>>>();
+             addon_value options = host.Object();
+             host.SetProperty(options, "concurrency", host.Number(2));
+             host.SetProperty(options, "onProgress",
+                              host.Function([&host, calls](addon_env, const std::vector<addon_value>& args) {
+                                  calls->emplace_back(host.GetNumber(args.at(0)), host.GetNumber(args.at(1)));
+                                  return host.Undefined();
+                              }));
+             addon_value results = Resolved(host, host.Call(exports, "execBatch", {commands, options}));
+             Expect(!calls->empty() && calls->back() == std::make_pair(4.0, 4.0), "last update was not the total");
+             Expect(host.GetLength(results) == 4, "unexpected " + host.Describe(results));
+             Expect(host.GetString(host.GetProperty(host.GetElement(results, 0), "stdout")) == "one\n", "stdout");
+             Expect(host.GetNumber(host.GetProperty(host.GetElement(results, 1), "exitCode")) == 4, "exit code");
+             Expect(host.GetString(host.GetProperty(host.GetProperty(host.GetElement(results, 2), "error"), "code")) ==
+                        "SPAWN_ERR",
+                    "spawn error " + host.Describe(host.GetElement(results, 2)));
+             Expect(host.GetString(host.GetProperty(host.GetElement(results, 3), "stderr")) == "two\n", "stderr");
+
+             host.SetProperty(options, "concurrency", host.Number(HUGE_VAL));
+             Expect(host.IsError(host.Call(exports, "execBatch", {commands, options})), "infinite concurrency");
+         }},
+        {"execBatch workers",
+         [](HostEmulator& host, addon_value exports) {
+             // The worker answers each line with its pid: the same pid means the process was reused
+             addon_value worker = host.Object();
+             host.SetProperty(worker, "args", host.Array({host.String("sh"), host.String("-c"),
+                                                          host.String("while read line; do echo $$; echo {ready}; done")}));
+             host.SetProperty(worker, "delimiter", host.String("{ready}"));
+             addon_value options = host.Object();
+             host.SetProperty(options, "concurrency", host.Number(1));
+             host.SetProperty(options, "worker", worker);
+
+             std::string pid;
+             for (int batch = 0; batch < 2; ++batch) {
+                 addon_value requests = host.Array({host.String("a\n"), host.String("b\n"), host.String("c\n")});
+                 addon_value results = Resolved(host, host.Call(exports, "execBatch", {requests, options}));
+                 Expect(host.GetLength(results) == 3, "unexpected " + host.Describe(results));
+                 for (uint32_t index = 0; index < 3; ++index) {
+                     const auto response = host.GetString(host.GetProperty(host.GetElement(results, index), "stdout"));
+                     if (pid.empty())
+                         pid = response;
+                     Expect(!response.empty() && response == pid, "worker was not reused: " + response);
+                 }
+             }
+
+             // A worker that doesn't read its input doesn't hold the lane past the timeout
+             addon_value stuck = host.Object();
+             host.SetProperty(stuck, "args", host.Array({host.String("sleep"), host.String("30")}));
+             host.SetProperty(stuck, "delimiter", host.String("{ready}"));
+             host.SetProperty(options, "worker", stuck);
+             host.SetProperty(options, "timeout", host.Number(200));
+             addon_value large = host.Array({host.String(std::string(1 << 20, 'x'))});
+             Expect(RejectedCode(host, host.Call(exports, "execBatch", {large, options})) == "TIMEOUT_ERR", "write not cancelled");
+
+             // Nor does one that never prints the delimiter fill the memory
+             addon_value endless = host.Object();
+             host.SetProperty(endless, "args", host.Array({host.String("yes"), host.String(std::string(1000, 'y'))}));
+             host.SetProperty(endless, "delimiter", host.String("{ready}"));
+             host.SetProperty(options, "worker", endless);
+             host.SetProperty(options, "timeout", host.Number(60000));
+             addon_value results = Resolved(host, host.Call(exports, "execBatch", {host.Array({host.String("a\n")}), options}));
+             Expect(host.GetString(host.GetProperty(host.GetProperty(host.GetElement(results, 0), "error"), "message"))
+                            .find("exceeds") != std::string::npos,
+                    "unexpected " + host.Describe(results));
+         }},
+#endif
+        {"ensureDirectory",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("ensureDirectory") / "a" / "b";
+             addon_value result = host.Call(exports, "ensureDirectory", {host.String(directory.string())});
+             Expect(host.GetBoolean(result), "unexpected " + host.Describe(result));
+             Expect(std::filesystem::is_directory(directory), "directory missing");
+         }},
+        {"getDefaultStoragePath",
+         [](HostEmulator& host, addon_value exports) {
+             addon_value result = host.Call(exports, "getDefaultStoragePath", {});
+             Expect(host.GetString(result).find("Generations") != std::string::npos,
+                    "unexpected " + host.Describe(result));
+         }},
+        {"probeMedia",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("probeMedia");
+             const std::string file = Mp4File(true);
+             WriteAll(directory / "a.mp4", file);
+             WriteAll(directory / "b.mov", Mp4File(false));
+             WriteAll(directory / "c.mp4", "not a movie");
+             WriteAll(directory / "notes.txt", "ignored");
+
+             addon_value info = Resolved(host, host.Call(exports, "probeMedia", {host.String((directory / "a.mp4").string())}));
+             Expect(host.GetString(host.GetProperty(info, "format")) == "isom", "format " + host.Describe(info));
+             Expect(host.GetNumber(host.GetProperty(info, "duration")) == 2.002, "duration " + host.Describe(info));
+             Expect(host.GetBoolean(host.GetProperty(info, "faststart")), "faststart " + host.Describe(info));
+             Expect(host.GetNumber(host.GetProperty(info, "size")) == file.size(), "size " + host.Describe(info));
+             Expect(host.GetNumber(host.GetProperty(info, "width")) == 640, "width " + host.Describe(info));
+             Expect(host.GetNumber(host.GetProperty(info, "height")) == 360, "height " + host.Describe(info));
+             const double frameRate = host.GetNumber(host.GetProperty(info, "frameRate"));
+             Expect(frameRate > 29.97 && frameRate < 29.98, "frameRate " + host.Describe(info));
+             Expect(host.GetString(host.GetProperty(info, "videoCodec")) == "avc1.64001f", "videoCodec " + host.Describe(info));
+             Expect(host.GetString(host.GetProperty(info, "audioCodec")) == "mp4a.40.2", "audioCodec " + host.Describe(info));
+
+             addon_value tracks = host.GetProperty(info, "tracks");
+             Expect(host.GetLength(tracks) == 2, "tracks " + host.Describe(tracks));
+             addon_value video = host.GetElement(tracks, 0);
+             Expect(host.GetNumber(host.GetProperty(video, "sampleCount")) == 60, "sampleCount " + host.Describe(video));
+             addon_value keyframes = host.GetProperty(video, "keyframeOffsets");
+             const size_t mediaData = file.find("mdat") + 4;
+             Expect(host.GetLength(keyframes) == 2, "keyframes " + host.Describe(keyframes));
+             Expect(host.GetNumber(host.GetElement(keyframes, 0)) == mediaData, "keyframe 0 " + host.Describe(keyframes));
+             Expect(host.GetNumber(host.GetElement(keyframes, 1)) == mediaData + 30 * 100 + 29 * 30 / 2,
+                    "keyframe 1 " + host.Describe(keyframes));
+             addon_value audio = host.GetElement(tracks, 1);
+             Expect(host.GetString(host.GetProperty(audio, "kind")) == "audio", "audio " + host.Describe(audio));
+             Expect(host.GetNumber(host.GetProperty(audio, "sampleRate")) == 48000, "sampleRate " + host.Describe(audio));
+             Expect(host.GetNumber(host.GetProperty(audio, "channels")) == 2, "channels " + host.Describe(audio));
+
+             Expect(RejectedCode(host, host.Call(exports, "probeMedia", {host.String((directory / "c.mp4").string())})) ==
+                        "MEDIA_ERR",
+                    "not a movie");
+             Expect(RejectedCode(host, host.Call(exports, "probeMedia", {host.String((directory / "d.mp4").string())})) ==
+                        "IO_ERR",
+                    "missing file");
+
+             // A directory probes its media files in name order
+             addon_value list = Resolved(host, host.Call(exports, "probeMedia", {host.String(directory.string())}));
+             Expect(host.GetLength(list) == 3, "list " + host.Describe(list));
+             Expect(!host.GetBoolean(host.GetProperty(host.GetElement(list, 1), "faststart")), "b.mov " + host.Describe(list));
+             addon_value error = host.GetProperty(host.GetElement(list, 2), "error");
+             Expect(host.GetString(host.GetProperty(error, "code")) == "MEDIA_ERR", "c.mp4 " + host.Describe(list));
+
+             // Progress counts the probed files once the directory is listed
+             auto calls = std::make_shared<std::vector<std::pair<double, double>>>();
+             addon_value options = host.Object();
+             host.SetProperty(options, "onProgress",
+                              host.Function([&host, calls](addon_env, const std::vector<addon_value>& args) {
+                                  calls->emplace_back(host.GetNumber(args.at(0)), host.GetNumber(args.at(1)));
+                                  return host.Undefined();
+                              }));
+             list = Resolved(host, host.Call(exports, "probeMedia", {host.String(directory.string()), options}));
+             Expect(host.GetLength(list) == 3, "list " + host.Describe(list));
+             Expect(!calls->empty() && calls->back() == std::make_pair(3.0, 3.0), "last update was not the final count");
+             host.SetProperty(options, "timeout", host.Number(-1));
+             Expect(host.IsError(host.Call(exports, "probeMedia", {host.String(directory.string()), options})),
+                    "negative timeout");
+             Expect(RejectedCode(host, host.Call(exports, "probeMedia", {host.String((directory / "nothing").string())})) ==
+                        "IO_ERR",
+                    "missing directory");
+         }},
+        {"faststart",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("faststart");
+             const std::string original = Mp4File(false);
+             const auto path = (directory / "a.mp4").string();
+             WriteAll(path, original);
+
+             auto keyframes = [&](const std::string& file, bool faststart) {
+                 addon_value info = Resolved(host, host.Call(exports, "probeMedia", {host.String(file)}));
+                 addon_value offsets = host.GetProperty(host.GetElement(host.GetProperty(info, "tracks"), 0), "keyframeOffsets");
+                 std::vector<size_t> result;
+                 for (uint32_t index = 0; index < host.GetLength(offsets); ++index)
+                     result.push_back(static_cast<size_t>(host.GetNumber(host.GetElement(offsets, index))));
+                 Expect(host.GetBoolean(host.GetProperty(info, "faststart")) == faststart, "faststart " + host.Describe(info));
+                 return result;
+             };
+             const auto before = keyframes(path, false);
+
+             // Into another file, then in place
+             const auto copy = (directory / "b.mp4").string();
+             addon_value result = Resolved(host, host.Call(exports, "faststart", {host.String(path), host.String(copy)}));
+             Expect(host.GetBoolean(host.GetProperty(result, "relocated")), "not relocated " + host.Describe(result));
+             Expect(ReadAll(path) == original, "input modified");
+             result = Resolved(host, host.Call(exports, "faststart", {host.String(path)}));
+             Expect(host.GetBoolean(host.GetProperty(result, "relocated")), "not relocated " + host.Describe(result));
+             const std::string relocated = ReadAll(path);
+             Expect(relocated == ReadAll(copy), "in place and copy differ");
+             Expect(relocated.size() == original.size(), "size changed");
+             Expect(relocated.find("moov") < relocated.find("mdat"), "moov not moved");
+
+             const auto after = keyframes(path, true);
+             Expect(after.size() == before.size() && after != before, "keyframes not patched");
+             for (size_t index = 0; index < after.size(); ++index)
+                 Expect(relocated.compare(after[index], 100, original, before[index], 100) == 0, "keyframe data moved");
+
+             result = Resolved(host, host.Call(exports, "faststart", {host.String(path)}));
+             Expect(!host.GetBoolean(host.GetProperty(result, "relocated")), "relocated twice " + host.Describe(result));
+             Expect(ReadAll(path) == relocated, "rewritten twice");
+
+             // As an option of writeFile; other payloads are written as they are
+             addon_value options = host.Object();
+             host.SetProperty(options, "faststart", host.Boolean(true));
+             const auto written = (directory / "c.mp4").string();
+             Expect(host.GetBoolean(host.Call(exports, "writeFile", {host.String(written), host.String(original), options})),
+                    "writeFile failed");
+             Expect(ReadAll(written) == relocated, "writeFile did not relocate");
+             host.Call(exports, "writeFile", {host.String(written), host.String("plain text"), options});
+             Expect(ReadAll(written) == "plain text", "plain text altered");
+
+             WriteAll(directory / "d.mp4", "not a movie");
+             Expect(RejectedCode(host, host.Call(exports, "faststart", {host.String((directory / "d.mp4").string())})) ==
+                        "MEDIA_ERR",
+                    "not a movie");
+         }},
+#ifndef _WIN32
+        {"media server",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("mediaServer");
+             std::filesystem::create_directories(directory / "clips");
+             std::string content(300000, '\0');
+             for (size_t index = 0; index < content.size(); ++index)
+                 content[index] = static_cast<char>(index * 13 + index / 256);
+             WriteAll(directory / "clips" / "a b.mp4", content);
+             WriteAll(directory.parent_path() / "secret.txt", "secret");
+
+             addon_value options = host.Object();
+             host.SetProperty(options, "root", host.String(directory.string()));
+             addon_value server = host.Call(exports, "startMediaServer", {options});
+             const auto port = static_cast<uint16_t>(host.GetNumber(host.GetProperty(server, "port")));
+             const std::string url = host.GetString(host.GetProperty(server, "url"));
+             Expect(port != 0 && url.rfind("http://127.0.0.1:", 0) == 0, "unexpected " + host.Describe(server));
+             addon_value again = host.Call(exports, "startMediaServer", {options});
+             Expect(host.GetString(host.GetProperty(again, "url")) == url, "restarted " + host.Describe(again));
+
+             const std::string fileUrl =
+                 host.GetString(host.Call(exports, "getMediaUrl", {host.String((directory / "clips" / "a b.mp4").string())}));
+             Expect(fileUrl == url + "clips/a%20b.mp4", "url " + fileUrl);
+             const std::string target = fileUrl.substr(fileUrl.find('/', 7));
+             const std::string token = target.substr(0, target.find('/', 1));
+
+             std::string response = HttpGet(port, target);
+             Expect(response.rfind("HTTP/1.1 200 OK\r\n", 0) == 0, "full " + response.substr(0, 200));
+             Expect(response.find("Content-Type: video/mp4\r\n") != std::string::npos, "content type");
+             Expect(HttpBody(response) == content, "full body mismatch");
+             const size_t etagStart = response.find("ETag: ") + 6;
+             const std::string etag = response.substr(etagStart, response.find("\r\n", etagStart) - etagStart);
+
+             response = HttpGet(port, target, "Range: bytes=1000-1999\r\n");
+             Expect(response.rfind("HTTP/1.1 206 ", 0) == 0, "range " + response.substr(0, 200));
+             Expect(response.find("Content-Range: bytes 1000-1999/300000\r\n") != std::string::npos, "content range");
+             Expect(HttpBody(response) == content.substr(1000, 1000), "range body mismatch");
+             Expect(HttpBody(HttpGet(port, target, "Range: bytes=-10\r\n")) == content.substr(content.size() - 10),
+                    "suffix range");
+             Expect(HttpGet(port, target, "Range: bytes=300000-\r\n").rfind("HTTP/1.1 416 ", 0) == 0, "unsatisfiable");
+             Expect(HttpGet(port, target, "If-None-Match: " + etag + "\r\n").rfind("HTTP/1.1 304 ", 0) == 0, "etag");
+             Expect(HttpGet(port, target, "Range: bytes=0-9\r\nIf-Range: \"stale\"\r\n").rfind("HTTP/1.1 200 ", 0) == 0,
+                    "if-range");
+
+             // Keep-alive with pipelined requests
+             response = HttpExchange(port, "HEAD " + target + " HTTP/1.1\r\n\r\nGET " + target +
+                                               " HTTP/1.1\r\nRange: bytes=0-4\r\nConnection: close\r\n\r\n");
+             Expect(response.rfind("HTTP/1.1 200 ", 0) == 0 && response.find("HTTP/1.1 206 ") != std::string::npos &&
+                        response.substr(response.size() - 5) == content.substr(0, 5),
+                    "pipelined " + response);
+
+             for (const std::string& denied : {"/" + std::string("0000") + "/clips/a%20b.mp4", token + "/../secret.txt",
+                                               token + "/%2e%2e/secret.txt", token + "/clips", token + "/missing.mp4"}) {
+                 Expect(HttpGet(port, denied).rfind("HTTP/1.1 404 ", 0) == 0, "served " + denied);
+             }
+             addon_value outside =
+                 host.Call(exports, "getMediaUrl", {host.String((directory.parent_path() / "secret.txt").string())});
+             Expect(host.IsError(outside) && host.GetString(host.GetProperty(outside, "code")) == "SERVER_ERR",
+                    "url outside of the root " + host.Describe(outside));
+
+             host.Call(exports, "stopMediaServer", {});
+             Expect(HttpGet(port, target).empty(), "still serving");
+         }},
+#endif
+        {"probeImages",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("probeImages");
+             auto littleEndian = [](uint32_t value, int bytes) {
+                 std::string text;
+                 for (int index = 0; index < bytes; ++index, value >>= 8)
+                     text += static_cast<char>(value & 0xff);
+                 return text;
+             };
+             auto webp = [&](const char* chunk, const std::string& payload) {
+                 return "RIFF" + littleEndian(static_cast<uint32_t>(payload.size() + 12), 4) + "WEBP" + chunk +
+                        littleEndian(static_cast<uint32_t>(payload.size()), 4) + payload;
+             };
+
+             WriteAll(directory / "a.png", std::string("\x89PNG\r\n\x1a\n", 8) + BigEndian(13, 4) + "IHDR" +
+                                               BigEndian(640, 4) + BigEndian(480, 4) + std::string(9, '\0'));
+             WriteAll(directory / "b.gif", "GIF89a" + littleEndian(320, 2) + littleEndian(200, 2) + std::string(4, '\0'));
+             WriteAll(directory / "c.webp", webp("VP8 ", std::string("\0\0\0\x9d\x01\x2a", 6) + littleEndian(1024, 2) +
+                                                             littleEndian(768, 2)));
+             WriteAll(directory / "d.webp", webp("VP8L", "\x2f" + littleEndian(99 | (49 << 14), 4)));
+             WriteAll(directory / "e.webp", webp("VP8X", std::string(4, '\0') + littleEndian(1999, 3) + littleEndian(999, 3)));
+             // The frame header follows an EXIF segment larger than the first block read
+             WriteAll(directory / "f.jpg", std::string("\xff\xd8\xff\xe1", 4) + BigEndian(6002, 2) + std::string(6000, 'x') +
+                                               std::string("\xff\xdb", 2) + BigEndian(67, 2) + std::string(65, '\0') +
+                                               std::string("\xff\xc0", 2) + BigEndian(17, 2) + "\x08" + BigEndian(1080, 2) +
+                                               BigEndian(1920, 2) + std::string(10, '\0') + std::string("\xff\xda", 2));
+             WriteAll(directory / "g.txt", "not an image");
+             WriteAll(directory / "h.jpg", std::string("\xff\xd8\xff\xda", 4));
+
+             std::vector<addon_value> paths;
+             for (const char* name : {"a.png", "b.gif", "c.webp", "d.webp", "e.webp", "f.jpg", "g.txt", "h.jpg", "missing.png"})
+                 paths.push_back(host.String((directory / name).string()));
+             addon_value result = Resolved(host, host.Call(exports, "probeImages", {host.Array(paths)}));
+             Expect(host.Describe(result) ==
+                        "[[640, 480, \"png\"], [320, 200, \"gif\"], [1024, 768, \"webp\"], [100, 50, \"webp\"], "
+                        "[2000, 1000, \"webp\"], [1920, 1080, \"jpeg\"], undefined, undefined, undefined]",
+                    "unexpected " + host.Describe(result));
+
+             // Progress counts the probed files, readable or not
+             auto calls = std::make_shared<std::vector<std::pair<double, double>>>();
+             addon_value options = host.Object();
+             host.SetProperty(options, "onProgress",
+                              host.Function([&host, calls](addon_env, const std::vector<addon_value>& args) {
+                                  calls->emplace_back(host.GetNumber(args.at(0)), host.GetNumber(args.at(1)));
+                                  return host.Undefined();
+                              }));
+             Resolved(host, host.Call(exports, "probeImages", {host.Array(paths), options}));
+             Expect(!calls->empty() && calls->back() == std::make_pair(9.0, 9.0), "last update was not the final count");
+             host.SetProperty(options, "timeout", host.Number(-1));
+             Expect(host.IsError(host.Call(exports, "probeImages", {host.Array(paths), options})), "negative timeout");
+
+             result = Resolved(host, host.Call(exports, "probeImages", {host.Array({})}));
+             Expect(host.GetLength(result) == 0, "unexpected " + host.Describe(result));
+         }},
+        {"probeImages channel",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("probeChannel");
+             WriteAll(directory / "a.png", PngFile(30, 20, [](uint32_t, uint32_t) { return 0xffffffffu; }));
+             // Records of 20 bytes, 5 times as many as the smallest ring holds: it wraps around
+             // and the lanes wait for JavaScript to drain it
+             constexpr uint32_t kCount = 1000;
+             std::vector<addon_value> paths;
+             for (uint32_t index = 0; index < kCount; ++index)
+                 paths.push_back(host.String((directory / (index % 100 == 7 ? "missing.png" : "a.png")).string()));
+
+             struct Received {
+                 std::vector<int> seen = std::vector<int>(kCount, 0);
+                 size_t calls{0};
+                 double dropped{0};
+                 std::string error;
+             };
+             auto received = std::make_shared<Received>();
+             auto channel = std::make_shared<addon_value>(nullptr);
+             addon_value onRecords = host.Function([&host, received, channel](addon_env, const std::vector<addon_value>& args) {
+                 ++received->calls;
+                 received->dropped += host.GetNumber(args.at(2));
+                 const std::vector<uint8_t> ring = host.GetBytes(host.GetProperty(*channel, "buffer"));
+                 const auto read = [&](size_t at) { return uint32_t(ring[at]) | uint32_t(ring[at + 1]) << 8 | uint32_t(ring[at + 2]) << 16 | uint32_t(ring[at + 3]) << 24; };
+                 const auto offset = static_cast<size_t>(host.GetNumber(args.at(0)));
+                 const auto length = static_cast<size_t>(host.GetNumber(args.at(1)));
+                 for (size_t at = offset; at < offset + length;) {
+                     const uint32_t size = read(at) & 0xffffff;
+                     if (read(at) >> 24 != 1 || size != 15 || read(at + 4) >= kCount || read(at + 8) != 30 || read(at + 12) != 20 ||
+                         std::string(reinterpret_cast<const char*>(&ring[at + 16]), 3) != "png")
+                         received->error = "unexpected record at " + std::to_string(at);
+                     else
+                         ++received->seen[read(at + 4)];
+                     at += 4 + ((size + 3) & ~3u);
+                 }
+                 return host.Undefined();
+             });
+             addon_value options = host.Object();
+             host.SetProperty(options, "capacity", host.Number(100));
+             *channel = host.Call(exports, "openChannel", {onRecords, options});
+             Expect(host.GetNumber(host.GetProperty(*channel, "capacity")) == 4096, "unexpected " + host.Describe(*channel));
+             Expect(host.GetBytes(host.GetProperty(*channel, "buffer")).size() == 4096, "unexpected buffer size");
+
+             addon_value probeOptions = host.Object();
+             host.SetProperty(probeOptions, "channel", *channel);
+             addon_value result = Resolved(host, host.Call(exports, "probeImages", {host.Array(paths), probeOptions}));
+             Expect(host.GetNumber(result) == kCount - kCount / 100, "unexpected " + host.Describe(result));
+             host.Call(*channel, "close", {});
+             Expect(received->error.empty(), received->error);
+             for (uint32_t index = 0; index < kCount; ++index)
+                 Expect(received->seen[index] == (index % 100 == 7 ? 0 : 1), "record " + std::to_string(index));
+             Expect(received->dropped == 0, "dropped records");
+             // Many records per call: at least 4096 / 20 when the lanes keep the ring full
+             Expect(received->calls < kCount / 10, "one call per " + std::to_string(kCount / received->calls) + " records");
+
+             Expect(host.IsError(host.Call(exports, "probeImages", {host.Array(paths), probeOptions})), "closed channel");
+             host.SetProperty(probeOptions, "channel", host.Object());
+             Expect(host.IsError(host.Call(exports, "probeImages", {host.Array(paths), probeOptions})), "not a channel");
+             Expect(host.IsError(host.Call(exports, "openChannel", {host.Number(1)})), "not a callback");
+         }},
+        {"perceptualHash/findNearDuplicates",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("perceptualHash");
+             // A smooth pattern sampled at u, v in [0, 1), and an unrelated one
+             auto gray = [](double value) {
+                 const auto level = static_cast<uint32_t>(std::clamp(value, 0.0, 255.0));
+                 return level << 24 | level << 16 | level << 8 | 0xff;
+             };
+             auto pattern = [](double u, double v) {
+                 return 128 + 90 * std::sin(u * 9) * std::cos(v * 5) + (u > 0.6 && v < 0.4 ? 40 : 0);
+             };
+             auto other = [](double u, double v) { return 128 + 100 * std::cos((u + v) * 14) * (1 - v); };
+             auto sampled = [&](uint32_t width, uint32_t height, double shift, const auto& function) {
+                 return PngFile(width, height, [=](uint32_t x, uint32_t y) {
+                     return gray(function((x + 0.5) / width, (y + 0.5) / height) + shift);
+                 });
+             };
+             WriteAll(directory / "a.png", sampled(96, 64, 0, pattern));
+             WriteAll(directory / "a_brighter.png", sampled(96, 64, 20, pattern));
+             WriteAll(directory / "a_large.png", sampled(300, 200, 0, pattern));
+             WriteAll(directory / "b.png", sampled(96, 64, 0, other));
+             WriteAll(directory / "c.txt", "not an image");
+
+             auto paths = [&]() {
+                 std::vector<addon_value> paths;
+                 for (const char* name : {"a.png", "a_brighter.png", "a_large.png", "b.png", "c.txt", "missing.png"})
+                     paths.push_back(host.String((directory / name).string()));
+                 return host.Array(paths);
+             };
+             addon_value hashes = Resolved(host, host.Call(exports, "perceptualHash", {paths()}));
+             Expect(host.GetLength(hashes) == 6, "unexpected " + host.Describe(hashes));
+             for (uint32_t index = 0; index < 4; ++index) {
+                 addon_value hash = host.GetElement(hashes, index);
+                 for (const char* name : {"dhash", "phash"}) {
+                     const std::string digits = host.GetString(host.GetProperty(hash, name));
+                     Expect(digits.size() == 16 && digits.find_first_not_of("0123456789abcdef") == std::string::npos,
+                            "unexpected " + host.Describe(hash));
+                 }
+             }
+             Expect(host.Describe(host.GetElement(hashes, 4)) == "undefined", "unexpected " + host.Describe(hashes));
+             Expect(host.Describe(host.GetElement(hashes, 5)) == "undefined", "unexpected " + host.Describe(hashes));
+             // Shifting the brightness keeps the order of neighbors
+             Expect(host.GetString(host.GetProperty(host.GetElement(hashes, 0), "dhash")) ==
+                        host.GetString(host.GetProperty(host.GetElement(hashes, 1), "dhash")),
+                    "dhash changed with brightness " + host.Describe(hashes));
+
+             const std::string expected = "[[\"" + (directory / "a.png").string() + "\", \"" +
+                                          (directory / "a_brighter.png").string() + "\", \"" +
+                                          (directory / "a_large.png").string() + "\"]]";
+             addon_value options = host.Object();
+             host.SetProperty(options, "paths", paths());
+             addon_value groups = Resolved(host, host.Call(exports, "findNearDuplicates", {host.Number(8), options}));
+             Expect(host.Describe(groups) == expected, "unexpected " + host.Describe(groups));
+
+             // Without paths, the files hashed so far that still exist
+             std::filesystem::remove(directory / "a_large.png");
+             groups = Resolved(host, host.Call(exports, "findNearDuplicates", {host.Number(8)}));
+             const std::string remaining = host.Describe(groups);
+             Expect(remaining.find("a_brighter.png") != std::string::npos && remaining.find("a_large.png") == std::string::npos &&
+                        remaining.find("b.png") == std::string::npos,
+                    "unexpected " + remaining);
+
+             addon_value error = host.Call(exports, "findNearDuplicates", {host.Number(65)});
+             Expect(host.IsError(error), "threshold out of range " + host.Describe(error));
+         }},
+        {"prepareMask",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("prepareMask");
+             // Opaque, white on the left 8 columns of 16; half transparent on the right of the other
+             const std::string opaque = PngFile(16, 4, [](uint32_t x, uint32_t) { return x < 8 ? 0xffffffffu : 0x000000ffu; });
+             const std::string cutout = PngFile(16, 4, [](uint32_t x, uint32_t) { return x < 8 ? 0x336699ffu : 0x33669980u; });
+             WriteAll(directory / "opaque.png", opaque);
+
+             auto mask = [&](addon_value source, const std::function<void(addon_value)>& configure) {
+                 addon_value options = host.Object();
+                 host.SetProperty(options, "format", host.String("gray"));
+                 configure(options);
+                 addon_value result = Resolved(host, host.Call(exports, "prepareMask", {source, options}));
+                 Expect(host.GetNumber(host.GetProperty(result, "width")) == 16 && host.GetNumber(host.GetProperty(result, "height")) == 4,
+                        "unexpected " + host.Describe(result));
+                 return host.GetBytes(host.GetProperty(result, "data"));
+             };
+             auto row = [](const std::vector<uint8_t>& values, uint32_t y) {
+                 return std::vector<uint8_t>(values.begin() + y * 16, values.begin() + (y + 1) * 16);
+             };
+             auto columns = [](uint32_t count, uint8_t inside, uint8_t outside) {
+                 std::vector<uint8_t> values(16, outside);
+                 std::fill(values.begin(), values.begin() + count, inside);
+                 return values;
+             };
+             auto path = [&]() { return host.String((directory / "opaque.png").string()); };
+
+             // Luma of an opaque image, alpha of a transparent one
+             auto values = mask(path(), [](addon_value) {});
+             Expect(row(values, 3) == columns(8, 255, 0), "luma mask");
+             values = mask(host.ArrayBuffer(cutout.data(), cutout.size()), [](addon_value) {});
+             Expect(row(values, 0) == columns(8, 255, 0x80), "alpha mask");
+             values = mask(host.ArrayBuffer(cutout.data(), cutout.size()), [&](addon_value options) {
+                 host.SetProperty(options, "threshold", host.Number(200));
+             });
+             Expect(row(values, 1) == columns(8, 255, 0), "threshold");
+
+             values = mask(path(), [&](addon_value options) { host.SetProperty(options, "dilate", host.Number(3)); });
+             Expect(row(values, 2) == columns(11, 255, 0), "dilate");
+             values = mask(path(), [&](addon_value options) { host.SetProperty(options, "dilate", host.Number(-2)); });
+             Expect(row(values, 2) == columns(6, 255, 0), "erode");
+             values = mask(path(), [&](addon_value options) { host.SetProperty(options, "invert", host.Boolean(true)); });
+             Expect(row(values, 0) == columns(8, 0, 255), "invert");
+
+             // Feathering ramps across the edge, symmetrically, and leaves the far columns
+             values = mask(path(), [&](addon_value options) { host.SetProperty(options, "feather", host.Number(1.5)); });
+             const auto feathered = row(values, 1);
+             Expect(feathered.front() == 255 && feathered.back() == 0, "feather ends");
+             for (size_t x = 1; x < 16; ++x)
+                 Expect(feathered[x] <= feathered[x - 1], "feather ramp");
+             Expect(feathered[7] > 128 && feathered[7] < 255 && feathered[8] < 128 && feathered[8] > 0, "feather edge");
+             Expect(std::abs(int(feathered[7]) + int(feathered[8]) - 255) <= 4, "feather symmetry");
+             Expect(row(values, 0) == feathered && row(values, 3) == feathered, "feather rows");
+
+             // A PNG file, read back through compositeImage
+             addon_value options = host.Object();
+             host.SetProperty(options, "dilate", host.Number(1));
+             host.SetProperty(options, "output", host.String((directory / "mask.png").string()));
+             addon_value written = Resolved(host, host.Call(exports, "prepareMask", {path(), options}));
+             Expect(host.GetString(host.GetProperty(written, "path")) == (directory / "mask.png").string(), "unexpected " + host.Describe(written));
+             options = host.Object();
+             host.SetProperty(options, "format", host.String("rgba"));
+             addon_value decoded = Resolved(host, host.Call(exports, "compositeImage", {host.String((directory / "mask.png").string()), options}));
+             const auto pixels = host.GetBytes(host.GetProperty(decoded, "data"));
+             Expect(pixels.size() == 16 * 4 * 4, "unexpected " + host.Describe(decoded));
+             for (size_t x = 0; x < 16; ++x) {
+                 const uint8_t expected = x < 9 ? 255 : 0;
+                 Expect(pixels[x * 4] == expected && pixels[x * 4 + 1] == expected && pixels[x * 4 + 3] == 255, "mask file");
+             }
+
+             options = host.Object();
+             host.SetProperty(options, "threshold", host.Number(300));
+             Expect(host.IsError(host.Call(exports, "prepareMask", {path(), options})), "threshold out of range");
+             options = host.Object();
+             host.SetProperty(options, "channel", host.String("red"));
+             Expect(host.IsError(host.Call(exports, "prepareMask", {path(), options})), "unknown channel");
+             const std::string text = "not an image";
+             RejectedCode(host, host.Call(exports, "prepareMask", {host.ArrayBuffer(text.data(), text.size())}));
+             RejectedCode(host, host.Call(exports, "prepareMask", {host.String((directory / "missing.png").string())}));
+         }},
+        {"compositeImage",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("compositeImage");
+             WriteAll(directory / "red.png", PngFile(8, 4, [](uint32_t, uint32_t) { return 0xff0000ffu; }));
+             // Kept on the left half, half kept on the right
+             WriteAll(directory / "mask.png", PngFile(8, 4, [](uint32_t x, uint32_t) { return x < 4 ? 0xffffffffu : 0x808080ffu; }));
+             const std::string green = PngFile(4, 2, [](uint32_t, uint32_t) { return 0x00ff00ffu; });
+
+             auto composite = [&](const std::function<void(addon_value)>& configure) {
+                 addon_value options = host.Object();
+                 host.SetProperty(options, "mask", host.String((directory / "mask.png").string()));
+                 host.SetProperty(options, "format", host.String("rgba"));
+                 configure(options);
+                 addon_value result = Resolved(host, host.Call(exports, "compositeImage", {host.String((directory / "red.png").string()), options}));
+                 const auto pixels = host.GetBytes(host.GetProperty(result, "data"));
+                 Expect(pixels.size() == 8 * 4 * 4, "unexpected " + host.Describe(result));
+                 return pixels;
+             };
+             auto pixel = [](const std::vector<uint8_t>& pixels, size_t x, size_t y) {
+                 const uint8_t* p = &pixels[(y * 8 + x) * 4];
+                 return std::vector<int>{p[0], p[1], p[2], p[3]};
+             };
+
+             auto pixels = composite([](addon_value) {});
+             Expect(pixel(pixels, 0, 0) == std::vector<int>{255, 0, 0, 255}, "masked");
+             Expect(pixel(pixels, 7, 3) == std::vector<int>{255, 0, 0, 128}, "half masked");
+             pixels = composite([&](addon_value options) { host.SetProperty(options, "premultiplied", host.Boolean(true)); });
+             Expect(pixel(pixels, 7, 3) == std::vector<int>{128, 0, 0, 128}, "premultiplied");
+             pixels = composite([&](addon_value options) { host.SetProperty(options, "background", host.String("#0000FF")); });
+             Expect(pixel(pixels, 1, 2) == std::vector<int>{255, 0, 0, 255}, "over color");
+             Expect(pixel(pixels, 6, 1) == std::vector<int>{128, 0, 127, 255}, "half over color");
+             // The background image is resized to the source
+             pixels = composite([&](addon_value options) {
+                 host.SetProperty(options, "background", host.ArrayBuffer(green.data(), green.size()));
+             });
+             Expect(pixel(pixels, 5, 0) == std::vector<int>{128, 127, 0, 255}, "half over image");
+             pixels = composite([&](addon_value options) { host.SetProperty(options, "background", host.String("#00000000")); });
+             Expect(pixel(pixels, 5, 0) == std::vector<int>{255, 0, 0, 128}, "over transparent");
+
+             // Opaque results are written as RGB PNG files
+             addon_value options = host.Object();
+             host.SetProperty(options, "mask", host.String((directory / "mask.png").string()));
+             host.SetProperty(options, "background", host.String("#0000ff"));
+             host.SetProperty(options, "output", host.String((directory / "out.png").string()));
+             addon_value written = Resolved(host, host.Call(exports, "compositeImage", {host.String((directory / "red.png").string()), options}));
+             Expect(host.GetNumber(host.GetProperty(written, "width")) == 8, "unexpected " + host.Describe(written));
+             const std::string file = ReadAll(directory / "out.png");
+             Expect(file.size() > 26 && file.compare(0, 8, "\x89PNG\r\n\x1a\n") == 0 && file[25] == 2, "RGB PNG");
+             options = host.Object();
+             host.SetProperty(options, "format", host.String("rgba"));
+             addon_value decoded = Resolved(host, host.Call(exports, "compositeImage", {host.ArrayBuffer(file.data(), file.size()), options}));
+             pixels = host.GetBytes(host.GetProperty(decoded, "data"));
+             Expect(pixel(pixels, 0, 0) == std::vector<int>{255, 0, 0, 255} && pixel(pixels, 6, 1) == std::vector<int>{128, 0, 127, 255},
+                    "PNG round trip");
+
+             options = host.Object();
+             host.SetProperty(options, "background", host.String("#12345"));
+             Expect(host.IsError(host.Call(exports, "compositeImage", {host.String((directory / "red.png").string()), options})), "bad color");
+             options = host.Object();
+             host.SetProperty(options, "format", host.String("webp"));
+             Expect(host.IsError(host.Call(exports, "compositeImage", {host.String((directory / "red.png").string()), options})), "bad format");
+             options = host.Object();
+             host.SetProperty(options, "mask", host.String((directory / "missing.png").string()));
+             RejectedCode(host, host.Call(exports, "compositeImage", {host.String((directory / "red.png").string()), options}));
+         }},
+        {"diffImages",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("diffImages");
+             // A block brighter by 10 and a pixel brighter by 3
+             const std::string original = PngFile(100, 60, [](uint32_t, uint32_t) { return 0x808080ffu; });
+             WriteAll(directory / "corrected.png", PngFile(100, 60, [](uint32_t x, uint32_t y) {
+                          if (x >= 10 && x < 20 && y >= 5 && y < 10)
+                              return 0x8a8a8affu;
+                          return x == 90 && y == 50 ? 0x808083ffu : 0x808080ffu;
+                      }));
+             const std::string smaller = PngFile(50, 30, [](uint32_t, uint32_t) { return 0x808080ffu; });
+
+             auto diff = [&](const std::string& other, const std::function<void(addon_value)>& configure) {
+                 addon_value options = host.Object();
+                 host.SetProperty(options, "tileSize", host.Number(16));
+                 configure(options);
+                 addon_value second = other.empty() ? host.String((directory / "corrected.png").string()) : host.ArrayBuffer(other.data(), other.size());
+                 return Resolved(host, host.Call(exports, "diffImages", {host.ArrayBuffer(original.data(), original.size()), second, options}));
+             };
+             auto regions = [&](addon_value result) {
+                 std::string text;
+                 addon_value list = host.GetProperty(result, "regions");
+                 for (uint32_t index = 0; index < host.GetLength(list); ++index) {
+                     addon_value region = host.GetElement(list, index);
+                     for (const char* name : {"x", "y", "width", "height", "pixels"})
+                         text += std::to_string(static_cast<int>(host.GetNumber(host.GetProperty(region, name)))) + (name[0] == 'p' ? ";" : ",");
+                 }
+                 return text;
+             };
+
+             addon_value result = diff("", [](addon_value) {});
+             Expect(host.GetNumber(host.GetProperty(result, "changedPixels")) == 51, "unexpected " + host.Describe(result));
+             // Tiles are clipped to the image
+             Expect(regions(result) == "0,0,32,16,50;80,48,16,12,1;", "unexpected " + host.Describe(result));
+             Expect(host.Describe(host.GetProperty(result, "mask")) == "undefined", "unexpected " + host.Describe(result));
+             result = diff("", [&](addon_value options) { host.SetProperty(options, "tolerance", host.Number(5)); });
+             Expect(regions(result) == "0,0,32,16,50;", "unexpected " + host.Describe(result));
+             result = diff("", [&](addon_value options) { host.SetProperty(options, "tolerance", host.Number(10)); });
+             Expect(regions(result).empty() && host.GetNumber(host.GetProperty(result, "changedPixels")) == 0, "unexpected " + host.Describe(result));
+             // Resized to the first image
+             result = diff(smaller, [](addon_value) {});
+             Expect(regions(result).empty() && host.GetNumber(host.GetProperty(result, "width")) == 100, "unexpected " + host.Describe(result));
+
+             // The mask, read back through compositeImage
+             result = diff("", [&](addon_value options) { host.SetProperty(options, "mask", host.Boolean(true)); });
+             const auto png = host.GetBytes(host.GetProperty(result, "mask"));
+             addon_value options = host.Object();
+             host.SetProperty(options, "format", host.String("rgba"));
+             addon_value decoded = Resolved(host, host.Call(exports, "compositeImage", {host.ArrayBuffer(png.data(), png.size()), options}));
+             const auto pixels = host.GetBytes(host.GetProperty(decoded, "data"));
+             Expect(pixels.size() == 100 * 60 * 4, "unexpected " + host.Describe(decoded));
+             auto value = [&](size_t x, size_t y) { return pixels[(y * 100 + x) * 4]; };
+             Expect(value(10, 5) == 255 && value(19, 9) == 255 && value(9, 5) == 0 && value(20, 9) == 0 && value(90, 50) == 255 && value(0, 0) == 0,
+                    "mask pixels");
+             result = diff("", [&](addon_value options) { host.SetProperty(options, "output", host.String((directory / "mask.png").string())); });
+             Expect(host.GetString(host.GetProperty(result, "maskPath")) == (directory / "mask.png").string() &&
+                        ReadAll(directory / "mask.png") == std::string(png.begin(), png.end()),
+                    "unexpected " + host.Describe(result));
+
+             options = host.Object();
+             host.SetProperty(options, "tileSize", host.Number(4));
+             Expect(host.IsError(host.Call(exports, "diffImages", {host.String((directory / "corrected.png").string()),
+                                                                   host.String((directory / "corrected.png").string()), options})),
+                    "tileSize out of range");
+             RejectedCode(host, host.Call(exports, "diffImages", {host.String((directory / "corrected.png").string()),
+                                                                  host.String((directory / "missing.png").string())}));
+         }},
+        {"buildAtlas",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("buildAtlas") / "2026-01-01";
+             std::filesystem::create_directories(directory);
+             // Red on the left half of a wide image, blue on a tall one
+             WriteAll(directory / "wide.png", PngFile(40, 20, [](uint32_t x, uint32_t) { return x < 20 ? 0xff0000ffu : 0x00ff00ffu; }));
+             WriteAll(directory / "tall.png", PngFile(20, 40, [](uint32_t, uint32_t) { return 0x0000ffffu; }));
+             WriteAll(directory / "broken.png", "not an image");
+             auto paths = [&]() {
+                 std::vector<addon_value> list;
+                 for (const char* name : {"wide.png", "missing.png", "tall.png", "broken.png"})
+                     list.push_back(host.String((directory / name).string()));
+                 return host.Array(list);
+             };
+             auto build = [&](const std::function<void(addon_value)>& configure) {
+                 addon_value options = host.Object();
+                 host.SetProperty(options, "tileWidth", host.Number(16));
+                 host.SetProperty(options, "tileHeight", host.Number(16));
+                 host.SetProperty(options, "background", host.String("#ffffff"));
+                 configure(options);
+                 return Resolved(host, host.Call(exports, "buildAtlas", {paths(), options}));
+             };
+             // The pixels of the first sheet, read back through compositeImage
+             auto sheet = [&](addon_value result) {
+                 const auto jpeg = host.GetBytes(host.GetProperty(host.GetElement(host.GetProperty(result, "sheets"), 0), "data"));
+                 addon_value options = host.Object();
+                 host.SetProperty(options, "format", host.String("rgba"));
+                 addon_value decoded = Resolved(host, host.Call(exports, "compositeImage", {host.ArrayBuffer(jpeg.data(), jpeg.size()), options}));
+                 return host.GetBytes(host.GetProperty(decoded, "data"));
+             };
+             // Within the loss of the JPEG compression
+             auto near = [](const std::vector<uint8_t>& pixels, size_t x, size_t y, uint32_t rgb) {
+                 const uint8_t* p = &pixels[(y * 64 + x) * 4];
+                 for (int channel = 0; channel < 3; ++channel) {
+                     if (std::abs(int(p[channel]) - int((rgb >> (16 - 8 * channel)) & 0xff)) > 16)
+                         return false;
+                 }
+                 return true;
+             };
+
+             addon_value result = build([](addon_value) {});
+             Expect(!host.GetBoolean(host.GetProperty(result, "cached")), "unexpected " + host.Describe(result));
+             addon_value sheets = host.GetProperty(result, "sheets");
+             Expect(host.GetLength(sheets) == 1 && host.GetNumber(host.GetProperty(host.GetElement(sheets, 0), "width")) == 64 &&
+                        host.GetNumber(host.GetProperty(host.GetElement(sheets, 0), "height")) == 16,
+                    "unexpected " + host.Describe(result));
+             // Tiles keep their place when their image can't be read
+             addon_value tiles = host.GetProperty(result, "tiles");
+             Expect(host.GetLength(tiles) == 4 && host.Describe(host.GetElement(tiles, 1)) == "undefined" &&
+                        host.Describe(host.GetElement(tiles, 3)) == "undefined" &&
+                        host.GetNumber(host.GetProperty(host.GetElement(tiles, 2), "x")) == 32 &&
+                        host.GetNumber(host.GetProperty(host.GetElement(tiles, 2), "y")) == 0 &&
+                        host.GetNumber(host.GetProperty(host.GetElement(tiles, 2), "sheet")) == 0,
+                    "unexpected " + host.Describe(tiles));
+             auto pixels = sheet(result);
+             Expect(pixels.size() == 64 * 16 * 4, "sheet size");
+             // Cropped to the middle of the wide image
+             Expect(near(pixels, 2, 8, 0xff0000) && near(pixels, 13, 8, 0x00ff00) && near(pixels, 24, 8, 0xffffff) &&
+                        near(pixels, 40, 1, 0x0000ff) && near(pixels, 56, 8, 0xffffff),
+                    "cover tiles");
+
+             // The second time, from the pack of the directory
+             const std::string first = [&] {
+                 const auto data = host.GetBytes(host.GetProperty(host.GetElement(sheets, 0), "data"));
+                 return std::string(data.begin(), data.end());
+             }();
+             result = build([](addon_value) {});
+             Expect(host.GetBoolean(host.GetProperty(result, "cached")), "unexpected " + host.Describe(result));
+             const auto cached = host.GetBytes(host.GetProperty(host.GetElement(host.GetProperty(result, "sheets"), 0), "data"));
+             Expect(std::string(cached.begin(), cached.end()) == first, "cached sheet");
+             addon_value names = host.Call(exports, "listPackedFiles", {host.String(directory.string())});
+             Expect(host.GetLength(names) == 2, "names " + host.Describe(names));
+
+             // Built again when an image changes, or without the cache
+             WriteAll(directory / "tall.png", PngFile(20, 40, [](uint32_t, uint32_t) { return 0x00ff00ffu; }));
+             result = build([](addon_value) {});
+             Expect(!host.GetBoolean(host.GetProperty(result, "cached")) && near(sheet(result), 40, 1, 0x00ff00), "changed image");
+             result = build([&](addon_value options) { host.SetProperty(options, "cache", host.Boolean(false)); });
+             Expect(!host.GetBoolean(host.GetProperty(result, "cached")), "unexpected " + host.Describe(result));
+
+             // Contained within the tile, over the background
+             result = build([&](addon_value options) {
+                 host.SetProperty(options, "fit", host.String("contain"));
+                 host.SetProperty(options, "background", host.String("#000000"));
+             });
+             pixels = sheet(result);
+             Expect(near(pixels, 2, 1, 0x000000) && near(pixels, 2, 8, 0xff0000) && near(pixels, 13, 8, 0x00ff00) && near(pixels, 33, 8, 0x000000) &&
+                        near(pixels, 40, 8, 0x00ff00),
+                    "contain tiles");
+
+             // Another atlas of the directory replaces the previous one
+             const auto packSize = [&] { return std::filesystem::file_size(directory / "files.uxppack"); };
+             const auto before = packSize();
+             for (const int size : {24, 16, 20, 32}) {
+                 result = build([&](addon_value options) {
+                     host.SetProperty(options, "tileWidth", host.Number(size));
+                     host.SetProperty(options, "tileHeight", host.Number(size));
+                 });
+                 Expect(!host.GetBoolean(host.GetProperty(result, "cached")), "unexpected " + host.Describe(result));
+             }
+             names = host.Call(exports, "listPackedFiles", {host.String(directory.string())});
+             Expect(host.GetLength(names) == 2, "names " + host.Describe(names));
+             Expect(packSize() <= before * 2, "the pack grew to " + std::to_string(packSize()) + " bytes");
+             result = build([&](addon_value options) {
+                 host.SetProperty(options, "tileWidth", host.Number(32));
+                 host.SetProperty(options, "tileHeight", host.Number(32));
+             });
+             Expect(host.GetBoolean(host.GetProperty(result, "cached")), "unexpected " + host.Describe(result));
+
+             addon_value empty = Resolved(host, host.Call(exports, "buildAtlas", {host.Array()}));
+             Expect(host.GetLength(host.GetProperty(empty, "sheets")) == 0 && host.GetLength(host.GetProperty(empty, "tiles")) == 0,
+                    "unexpected " + host.Describe(empty));
+             addon_value options = host.Object();
+             host.SetProperty(options, "tileWidth", host.Number(8));
+             Expect(host.IsError(host.Call(exports, "buildAtlas", {paths(), options})), "tileWidth out of range");
+             options = host.Object();
+             host.SetProperty(options, "fit", host.String("stretch"));
+             Expect(host.IsError(host.Call(exports, "buildAtlas", {paths(), options})), "unknown fit");
+             options = host.Object();
+             host.SetProperty(options, "background", host.String("#ffffff80"));
+             Expect(host.IsError(host.Call(exports, "buildAtlas", {paths(), options})), "background with alpha");
+         }},
+        {"placeholders",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("placeholders");
+             WriteAll(directory / "red.png", PngFile(80, 40, [](uint32_t, uint32_t) { return 0xff0000ffu; }));
+             // The hashes are those of the reference implementation
+             WriteAll(directory / "gradient.png", PngFile(37, 23, [](uint32_t x, uint32_t y) {
+                          return uint32_t(uint8_t(x * 7)) << 24 | uint32_t(x * y % 256) << 16 | uint32_t(uint8_t(255 - y * 11)) << 8 | 0xffu;
+                      }));
+             // Mostly blue, the mean being purple
+             WriteAll(directory / "tall.png", PngFile(20, 40, [](uint32_t, uint32_t y) { return y < 10 ? 0xff0000ffu : 0x0000ffffu; }));
+             auto placeholders = [&](const std::function<void(addon_value)>& configure) {
+                 std::vector<addon_value> paths;
+                 for (const char* name : {"red.png", "gradient.png", "tall.png", "missing.png"})
+                     paths.push_back(host.String((directory / name).string()));
+                 addon_value options = host.Object();
+                 configure(options);
+                 return Resolved(host, host.Call(exports, "placeholders", {host.Array(paths), options}));
+             };
+             auto field = [&](addon_value list, uint32_t index, const char* name) {
+                 return host.GetString(host.GetProperty(host.GetElement(list, index), name));
+             };
+
+             addon_value list = placeholders([](addon_value) {});
+             Expect(host.GetLength(list) == 4 && host.Describe(host.GetElement(list, 3)) == "undefined", "unexpected " + host.Describe(list));
+             // Reduced to 64x32 first. The basis of BlurHash isn't centered on the pixels, so
+             // a uniform image has AC components too.
+             Expect(field(list, 0, "blurhash") == "L9TI:j,YfQ,Y|cjtfQjtfQfQfQfQ" && field(list, 0, "color") == "#ff0000",
+                    "unexpected " + host.Describe(list));
+             Expect(field(list, 1, "blurhash") == "L;HUIz5qv+V{nHWEkAf*ecf*g0fk", "unexpected " + host.Describe(list));
+             // 3 components across a portrait image and 4 down it
+             Expect(field(list, 2, "blurhash").size() == 28 && field(list, 2, "blurhash")[0] == 'T' && field(list, 2, "color") == "#0000ff",
+                    "unexpected " + host.Describe(list));
+
+             list = placeholders([&](addon_value options) {
+                 host.SetProperty(options, "componentsX", host.Number(1));
+                 host.SetProperty(options, "componentsY", host.Number(1));
+             });
+             Expect(field(list, 0, "blurhash") == "00TI:j", "unexpected " + host.Describe(list));
+
+             addon_value options = host.Object();
+             host.SetProperty(options, "componentsX", host.Number(10));
+             host.SetProperty(options, "componentsY", host.Number(3));
+             Expect(host.IsError(host.Call(exports, "placeholders", {host.Array(), options})), "components out of range");
+             options = host.Object();
+             host.SetProperty(options, "componentsX", host.Number(3));
+             Expect(host.IsError(host.Call(exports, "placeholders", {host.Array(), options})), "componentsY missing");
+         }},
+        {"storage",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("storage");
+             const auto day = directory / "2026-01-01";
+             std::filesystem::create_directories(day);
+             const auto now = std::filesystem::file_time_type::clock::now();
+             auto write = [&](const std::string& name, size_t size, std::chrono::hours age) {
+                 WriteAll((day / name).string(), std::string(size, 'x'));
+                 std::filesystem::last_write_time(day / name, now - age);
+             };
+             write("old.mp4", 1000, std::chrono::hours(3));
+             write("old_thumbnail.jpg", 100, std::chrono::hours(3));
+             WriteAll((day / "old.mp4.json").string(), "{\n  \"prompt\": \"a\"\n}");
+             write("keep.png", 1000, std::chrono::hours(4));
+             write("packed.png", 1000, std::chrono::hours(2));
+             addon_value packOptions = host.Object();
+             host.SetProperty(packOptions, "pack", host.Boolean(true));
+             host.Call(exports, "writeFile", {host.String((day / "packed.png.json").string()), host.String("{}"), packOptions});
+
+             auto usage = [&]() { return host.Call(exports, "getStorageUsage", {}); };
+             auto settled = [&](const std::function<bool(addon_value)>& done) {
+                 for (int attempt = 0; attempt < 500; ++attempt) {
+                     addon_value current = usage();
+                     if (!host.GetBoolean(host.GetProperty(current, "scanning")) && done(current))
+                         return current;
+                     std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                 }
+                 throw Failure{"storage didn't settle " + host.Describe(usage())};
+             };
+             uint64_t expected = 0;
+             for (const auto& file : std::filesystem::recursive_directory_iterator(directory))
+                 expected += file.is_regular_file() ? file.file_size() : 0;
+
+             addon_value options = host.Object();
+             host.SetProperty(options, "root", host.String(directory.string()));
+             host.SetProperty(options, "policy", host.String("age"));
+             host.Call(exports, "configureStorage", {options});
+             addon_value current = settled([](addon_value) { return true; });
+             Expect(host.GetNumber(host.GetProperty(current, "usedBytes")) == expected, "scan " + host.Describe(current));
+             Expect(host.GetNumber(host.GetProperty(current, "files")) == 6, "files " + host.Describe(current));
+
+             // Writes update the totals right away
+             Expect(host.GetBoolean(host.Call(exports, "writeFile", {host.String((day / "new.bin").string()), host.String(std::string(500, 'y'))})),
+                    "write failed");
+             host.Call(exports, "writeFile", {host.String((directory / "elsewhere" / ".." / ".." / "outside.bin").string()), host.String("z")});
+             std::filesystem::remove(directory.parent_path() / "outside.bin");
+             expected += 500;
+             current = usage();
+             Expect(host.GetNumber(host.GetProperty(current, "usedBytes")) == expected, "write " + host.Describe(current));
+
+             addon_value pinned = host.Call(exports, "pinStorage", {host.Array({host.String((day / "keep.png").string())})});
+             Expect(host.GetNumber(pinned) == 1, "pinned " + host.Describe(pinned));
+             Expect(std::filesystem::exists(directory / ".uxpstorage-pins"), "pins not saved");
+
+             // Oldest first, down to 90% of the quota: old.mp4 and its thumbnail, then packed.png
+             const double used = host.GetNumber(host.GetProperty(usage(), "usedBytes"));
+             const double quota = (std::floor((used - 1600) / 9) + 1) * 10;
+             host.SetProperty(options, "quotaBytes", host.Number(quota));
+             host.Call(exports, "configureStorage", {options});
+             current = settled([&](addon_value value) { return host.GetNumber(host.GetProperty(value, "evictedFiles")) >= 2; });
+             Expect(host.GetNumber(host.GetProperty(current, "evictedFiles")) == 2, "evicted " + host.Describe(current));
+             Expect(host.GetNumber(host.GetProperty(current, "evictedBytes")) == 2100, "evicted " + host.Describe(current));
+             Expect(host.GetNumber(host.GetProperty(current, "usedBytes")) <= quota / 10 * 9, "over " + host.Describe(current));
+             Expect(!std::filesystem::exists(day / "old.mp4") && !std::filesystem::exists(day / "old_thumbnail.jpg") &&
+                        !std::filesystem::exists(day / "packed.png"),
+                    "files not evicted");
+             Expect(std::filesystem::exists(day / "keep.png") && std::filesystem::exists(day / "new.bin"), "kept files evicted");
+             Expect(ReadAll(day / "old.mp4.json").find("\"prompt\": \"a\",\"evicted\":true,\"evictedAt\":") != std::string::npos,
+                    "sidecar " + ReadAll(day / "old.mp4.json"));
+             const auto packed = host.GetBytes(host.Call(exports, "readPackedFile", {host.String((day / "packed.png.json").string())}));
+             Expect(std::string(packed.begin(), packed.end()).rfind("{\"evicted\":true,\"evictedAt\":", 0) == 0, "packed sidecar");
+
+             // Without a limit past 2^53 bytes
+             for (const double quotaBytes : {HUGE_VAL, 1e300}) {
+                 host.SetProperty(options, "quotaBytes", host.Number(quotaBytes));
+                 current = host.Call(exports, "configureStorage", {options});
+                 Expect(host.GetNumber(host.GetProperty(current, "quotaBytes")) == 0, "quota " + host.Describe(current));
+             }
+             for (const double quotaBytes : {-1.0, std::nan("")}) {
+                 host.SetProperty(options, "quotaBytes", host.Number(quotaBytes));
+                 Expect(host.IsError(host.Call(exports, "configureStorage", {options})), "quota " + std::to_string(quotaBytes));
+             }
+         }},
+        {"getStats",
+         [](HostEmulator& host, addon_value exports) {
+             addon_value resetOptions = host.Object();
+             host.SetProperty(resetOptions, "reset", host.Boolean(true));
+             host.Call(exports, "getStats", {resetOptions});
+
+             const auto path = (ScratchDirectory("getStats") / "a.txt").string();
+             host.Call(exports, "writeFile", {host.String(path), host.String("hello")});
+             host.Call(exports, "writeFile", {host.String(path), host.String("aGVsbG8gd29ybGQ="), host.Boolean(true)});
+             host.Call(exports, "writeFile", {});
+             Resolved(host, host.Call(exports, "my_echo_async", {host.String("hop")}));
+
+             addon_value stats = host.Call(exports, "getStats", {});
+             if (!host.GetBoolean(host.GetProperty(stats, "enabled")))
+                 return;  // built with UXP_ADDON_METRICS=0
+
+             addon_value writeFile = host.GetProperty(host.GetProperty(stats, "exports"), "writeFile");
+             Expect(host.GetNumber(host.GetProperty(writeFile, "calls")) == 3, "calls " + host.Describe(writeFile));
+             Expect(host.GetNumber(host.GetProperty(writeFile, "errors")) == 1, "errors " + host.Describe(writeFile));
+             Expect(host.GetNumber(host.GetProperty(writeFile, "bytesIn")) == 5 + 16, "bytesIn " + host.Describe(writeFile));
+             addon_value latency = host.GetProperty(writeFile, "latency");
+             Expect(host.GetNumber(host.GetProperty(latency, "p50")) > 0, "latency " + host.Describe(latency));
+             Expect(host.GetNumber(host.GetProperty(latency, "max")) >= host.GetNumber(host.GetProperty(latency, "p50")),
+                    "latency " + host.Describe(latency));
+
+             addon_value operations = host.GetProperty(stats, "operations");
+             addon_value decode = host.GetProperty(operations, "base64Decode");
+             Expect(host.GetNumber(host.GetProperty(decode, "calls")) == 1, "base64Decode " + host.Describe(decode));
+             Expect(host.GetNumber(host.GetProperty(decode, "bytesOut")) == 11, "base64Decode " + host.Describe(decode));
+             addon_value fileWrite = host.GetProperty(operations, "fileWrite");
+             Expect(host.GetNumber(host.GetProperty(fileWrite, "bytesOut")) == 5 + 11, "fileWrite " + host.Describe(fileWrite));
+
+             addon_value mainQueue = host.GetProperty(host.GetProperty(stats, "queues"), "main");
+             Expect(host.GetNumber(host.GetProperty(mainQueue, "count")) >= 1, "main queue " + host.Describe(mainQueue));
+
+             host.Call(exports, "getStats", {resetOptions});
+             stats = host.Call(exports, "getStats", {});
+             writeFile = host.GetProperty(host.GetProperty(stats, "exports"), "writeFile");
+             Expect(host.GetNumber(host.GetProperty(writeFile, "calls")) == 0, "not reset " + host.Describe(writeFile));
+         }},
+        {"startTrace/stopTrace",
+         [](HostEmulator& host, addon_value exports) {
+             const auto directory = ScratchDirectory("trace");
+             host.Call(exports, "startTrace", {});
+
+             host.Call(exports, "writeFile", {host.String((directory / "a.txt").string()), host.String("a")});
+             addon_value entry = host.Object();
+             host.SetProperty(entry, "path", host.String((directory / "b.txt").string()));
+             host.SetProperty(entry, "data", host.String("b"));
+             Resolved(host, host.Call(exports, "writeFiles", {host.Array({entry})}));
+             Resolved(host, host.Call(exports, "my_echo_async", {host.String("hop")}));
+
+             // Spans end when their handler returns, which may be after the promise settled
+             host.DrainMainQueue();
+             std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+             const auto path = (directory / "trace.json").string();
+             addon_value summary = host.Call(exports, "stopTrace", {host.String(path)});
+             Expect(host.GetNumber(host.GetProperty(summary, "events")) > 0, "no events " + host.Describe(summary));
+
+             const std::string json = ReadAll(path);
+             for (const char* expected : {"\"traceEvents\"",
+                                          "\"name\":\"writeFile\",\"cat\":\"export\"",
+                                          "\"name\":\"worker stage\"",
+                                          "\"name\":\"resume on main\"",
+                                          "\"ph\":\"s\"",
+                                          "\"ph\":\"f\"",
+                                          "\"name\":\"javascript\"",
+                                          "\"name\":\"worker\"",
+                                          "\"name\":\"host main\""}) {
+                 Expect(json.find(expected) != std::string::npos, std::string("trace lacks ") + expected);
+             }
+
+             // Nothing is recorded once the trace is stopped
+             host.Call(exports, "writeFile", {host.String((directory / "c.txt").string()), host.String("c")});
+             host.Call(exports, "startTrace", {});
+             summary = host.Call(exports, "stopTrace", {host.String(path)});
+             Expect(host.GetNumber(host.GetProperty(summary, "events")) == 0, "stale events " + host.Describe(summary));
+
+             // The buffers are bounded
+             for (const double bufferSize : {-1.0, double(1 << 20) + 1, HUGE_VAL, std::nan("")}) {
+                 addon_value options = host.Object();
+                 host.SetProperty(options, "bufferSize", host.Number(bufferSize));
+                 Expect(host.IsError(host.Call(exports, "startTrace", {options})), "bufferSize " + std::to_string(bufferSize));
+             }
+         }},
+        {"unload with pending work",
+         [](HostEmulator& host, addon_value exports) {
+             // The children are killed rather than waited for, and start again once reloaded
+             addon_value sleep = host.Array({host.String("sleep"), host.String("30")});
+             addon_value spawned = host.Call(exports, "spawn", {sleep});
+             std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+             // Stages still queued when the worker threads are joined reject with ABORT_ERR:
+             // every worker thread is busy until then
+             auto started = std::make_shared<std::atomic<size_t>>(0);
+             const size_t threads = WorkerPool::Instance().GetThreadCount();
+             for (size_t index = 0; index < threads; ++index) {
+                 auto busy = Task::Create();
+                 busy->Then(Task::Lane::worker, [started](Task&) {
+                     ++*started;
+                     std::this_thread::sleep_for(std::chrono::milliseconds(500));
+                 });
+                 busy->Start(host.GetEnv());
+             }
+             while (*started < threads)
+                 std::this_thread::sleep_for(std::chrono::milliseconds(1));
+             auto queued = Task::Create();
+             queued->Then(Task::Lane::worker, [](Task&) {});
+             addon_value dropped = queued->Start(host.GetEnv());
+             addon_value hop = OnWorkerThread().Start(host.GetEnv());
+             addon_value batch = host.Call(exports, "execBatch", {host.Array({sleep})});
+
+             const auto start = std::chrono::steady_clock::now();
+             host.UnloadAddon();
+             Expect(std::chrono::steady_clock::now() - start < std::chrono::seconds(10), "the unload waited for the child");
+             Expect(RejectedCode(host, spawned) == "ABORT_ERR", "spawn not aborted");
+             Expect(RejectedCode(host, dropped) == "ABORT_ERR", "queued stage not aborted");
+             Expect(RejectedCode(host, hop) == "ABORT_ERR", "queued coroutine not aborted");
+             Expect(RejectedCode(host, batch) == "ABORT_ERR", "queued batch not aborted");
+
+             addon_value reloaded = host.LoadAddon();
+             addon_value args = host.Array({host.String("true")});
+             Expect(host.GetNumber(Resolved(host, host.Call(reloaded, "spawn", {args}))) == 0, "spawn after a reload");
+         }},
+    };
+    return cases;
+}
+
+addon_value RandomValue(HostEmulator& host, std::mt19937& random, int depth) {
+    switch (random() % (depth > 2 ? 5 : 7)) {
+    case 0: return host.Undefined();
+    case 1: return host.Boolean(random() % 2 == 0);
+    case 2: return host.Number(static_cast<double>(static_cast<int32_t>(random())));
+    case 3: {
+        std::string text(random() % 64, ' ');
+        for (auto& c : text)
+            c = static_cast<char>(32 + random() % 95);
+        return host.String(text);
+    }
+    case 4: {
+        const char bytes[4] = {1, 2, 3, 4};
+        return host.ArrayBuffer(bytes, random() % 5);
+    }
+    case 5: {
+        std::vector<addon_value> elements;
+        for (size_t index = random() % 4; index > 0; --index)
+            elements.push_back(RandomValue(host, random, depth + 1));
+        return host.Array(elements);
+    }
+    default: {
+        addon_value object = host.Object();
+        static const char* keys[] = {"path", "data", "base64", "cwd", "timeout", "concurrency", "root"};
+        for (size_t index = random() % 4; index > 0; --index)
+            host.SetProperty(object, keys[random() % 7], RandomValue(host, random, depth + 1));
+        return object;
+    }
+    }
+}
+
+// Exports that must not be invoked with random arguments (side effects outside of the sandbox)
+// Processes, and listening sockets whose default root is outside the sandbox
+bool SkipWhenFuzzing(const std::string& name) {
+    return name == "execSync" || name == "spawn" || name == "execBatch" || name == "startMediaServer" ||
+           name == "configureStorage";
+}
+
+int Fuzz(HostEmulator& host, addon_value exports, int iterations) {
+    std::mt19937 random(1234);
+
+    addon_value names = nullptr;
+    HostEmulator::GetApis().uxp_addon_get_property_names(host.GetEnv(), exports, &names);
+    std::vector<std::string> exportNames;
+    for (uint32_t index = 0; index < host.GetLength(names); ++index) {
+        const auto name = host.GetString(host.GetElement(names, index));
+        if (!SkipWhenFuzzing(name))
+            exportNames.push_back(name);
+    }
+
+    // Random arguments must never crash the addon, throw, or leave a pending exception
+    // Relative paths among the random strings resolve inside the sandbox too
+    const auto sandbox = ScratchDirectory("fuzz");
+    const auto workingDirectory = std::filesystem::current_path();
+    std::filesystem::current_path(sandbox);
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        HostEmulator::Scope scope(host);
+        const auto& name = exportNames[random() % exportNames.size()];
+        std::vector<addon_value> args;
+        for (size_t index = random() % 4; index > 0; --index) {
+            // keep file system exports inside the sandbox
+            args.push_back(random() % 3 == 0 ? host.String((sandbox / std::to_string(random() % 16)).string())
+                                             : RandomValue(host, random, 0));
+        }
+        addon_value result = host.Call(exports, name, args);
+        if (host.IsExceptionPending())
+            host.TakeException();
+        if (host.IsPromise(result))
+            host.Await(result, nullptr, nullptr);
+    }
+    std::filesystem::current_path(workingDirectory);
+    host.DrainMainQueue();
+    host.PumpScriptQueue();
+    std::printf("fuzz: %d calls across %zu exports\n", iterations, exportNames.size());
+    return 0;
+}
+
+// Mutate data in place like a byte-level fuzzer: bit flips, boundary values, and removed,
+// repeated or truncated ranges, which shift the chunks and segments that follow
+void Mutate(std::string& data, std::mt19937& random) {
+    static const uint8_t kInteresting[] = {0x00, 0x01, 0x07, 0x08, 0x0f, 0x10, 0x7f, 0x80, 0xfe, 0xff};
+    for (size_t count = 1 + random() % 4; count > 0 && !data.empty(); --count) {
+        const size_t at = random() % data.size();
+        const size_t span = std::min<size_t>(1 + random() % 64, data.size() - at);
+        switch (random() % 7) {
+        case 0: data[at] = static_cast<char>(data[at] ^ (1 << (random() % 8))); break;
+        case 1: data[at] = static_cast<char>(kInteresting[random() % sizeof(kInteresting)]); break;
+        case 2: data[at] = static_cast<char>(random()); break;
+        case 3:
+            // A length or dimension field
+            for (size_t index = at; index < std::min(at + 2, data.size()); ++index)
+                data[index] = static_cast<char>(random() % 2 == 0 ? 0xff : 0x00);
+            break;
+        case 4: data.erase(at, span); break;
+        case 5: data.insert(at, data.substr(random() % data.size(), span)); break;
+        default: data.resize(at); break;
+        }
+    }
+}
+
+// The images that the mutations start from: every kind that the encoders of the addon and
+// PngFile write, plus the given files
+std::vector<std::string> ImageSeeds(const std::vector<std::string>& files) {
+    std::vector<std::string> seeds;
+    for (const auto& file : files)
+        seeds.push_back(ReadAll(file));
+
+    std::mt19937 random(99);
+    for (const auto& size : {std::pair<uint32_t, uint32_t>{1, 1}, {23, 17}, {40, 24}}) {
+        std::vector<uint8_t> pixels(size_t(size.first) * size.second * 4);
+        for (size_t index = 0; index < pixels.size(); ++index)
+            pixels[index] = static_cast<uint8_t>(index % 4 == 3 ? 255 - index % 7 : (index * 5 + random() % 16) & 0xff);
+        for (unsigned channels = 1; channels <= 4; ++channels)
+            seeds.push_back(EncodePng(pixels.data(), size.first, size.second, channels));
+        for (const unsigned quality : {10u, 75u, 100u})
+            seeds.push_back(EncodeJpeg(pixels.data(), size.first, size.second, quality));
+    }
+    seeds.push_back(PngFile(9, 5, [](uint32_t x, uint32_t y) { return x * 0x1f2f3f00u + y * 0x44u + 0x80u; }));
+    return seeds;
+}
+
+int FuzzImages(int iterations, const std::vector<std::string>& files) {
+    std::mt19937 random(4321);
+    const auto seeds = ImageSeeds(files);
+    size_t decoded = 0;
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        std::string data = seeds[random() % seeds.size()];
+        Mutate(data, random);
+        const auto* bytes = reinterpret_cast<const uint8_t*>(data.data());
+
+        HeaderReader reader(bytes, data.size());
+        ImageInfo info;
+        // A mutated header may declare up to the decoders' limit of pixels: don't allocate
+        // gigabytes for a few bytes of data, the same code paths are taken at smaller sizes
+        if (ProbeImage(reader, info) && uint64_t(info.width) * info.height > (uint64_t(1) << 22))
+            continue;
+
+        // Corrupt images must be rejected, never crash or return an inconsistent bitmap
+        Bitmap bitmap;
+        static const uint32_t kMinSizes[] = {0, 2, 64};
+        if (DecodeImage(bytes, data.size(), bitmap, kMinSizes[random() % 3])) {
+            ++decoded;
+            if (bitmap.width == 0 || bitmap.height == 0 || bitmap.pixels.size() != size_t(bitmap.width) * bitmap.height * 4) {
+                std::printf("[FAIL] fuzz-images: %ux%u bitmap of %zu bytes at iteration %d\n", bitmap.width, bitmap.height,
+                            bitmap.pixels.size(), iteration);
+                return 1;
+            }
+        }
+    }
+    std::printf("fuzz-images: %d inputs from %zu seeds, %zu decoded\n", iterations, seeds.size(), decoded);
+    return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    // The decoders alone, without the addon
+    if (argc >= 2 && std::strcmp(argv[1], "--fuzz-images") == 0) {
+        const int iterations = argc >= 3 ? std::atoi(argv[2]) : 10000;
+        return FuzzImages(iterations, std::vector<std::string>(argv + std::min(argc, 3), argv + argc));
+    }
+
+    HostEmulator host;
+    addon_value exports = host.LoadAddon();
+    if (exports == nullptr) {
+        std::fprintf(stderr, "addon failed to initialize\n");
+        return 1;
+    }
+
+    if (argc >= 2 && std::strcmp(argv[1], "--fuzz") == 0) {
+        const int iterations = argc >= 3 ? std::atoi(argv[2]) : 1000;
+        const int result = Fuzz(host, exports, iterations);
+        host.UnloadAddon();
+        return result;
+    }
+
+    const char* filter = argc >= 2 ? argv[1] : nullptr;
+    int failed = 0;
+    int ran = 0;
+    for (const auto& testCase : Cases()) {
+        if (filter != nullptr && std::strstr(testCase.name, filter) == nullptr)
+            continue;
+
+        ++ran;
+        HostEmulator::Scope scope(host);
+        try {
+            testCase.run(host, exports);
+            if (host.IsExceptionPending())
+                throw Failure{"pending exception " + host.Describe(host.TakeException())};
+            std::printf("[ ok ] %s\n", testCase.name);
+        } catch (const Failure& failure) {
+            ++failed;
+            std::printf("[FAIL] %s: %s\n", testCase.name, failure.message.c_str());
+        }
+    }
+
+    host.DrainMainQueue();
+    host.PumpScriptQueue();
+    host.UnloadAddon();
+
+    if (host.GetThreadViolations() > 0) {
+        std::printf("[FAIL] %zu API calls were made outside of the JavaScript thread\n", host.GetThreadViolations());
+        ++failed;
+    }
+
+    std::printf("%d of %d cases passed\n", ran - failed, ran);
+    return failed;
+}
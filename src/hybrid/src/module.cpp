@@ -1,578 +1,3087 @@
-/************************************************************************
- * Copyright 2022 Adobe
- * All Rights Reserved.
- *
- * NOTICE: Adobe permits you to use, modify, and distribute this file in
- * accordance with the terms of the Adobe license agreement accompanying
- * it.
- *************************************************************************
- */
-
-#include <exception>
-#include <stdexcept>
-#include <string>
-
-#include <cstdio>
-#include <iostream>
-#include <vector>
-#include <filesystem>
-#include <fstream>
-#include <sstream>
-#include <algorithm>
-#include <cctype>
-#include <cstdlib>
-
-#ifdef _WIN32
-#include <windows.h>
-#endif
-
-#include "../src/utilities/UxpAddon.h"
-#include "../src/utilities/UxpTask.h"
-#include "../src/utilities/UxpValue.h"
-
-namespace {
-
-    std::string execWin(const char* cmd) {
-        #ifdef _WIN32
-            std::string result;
-            HANDLE hPipeRead, hPipeWrite;
-
-            SECURITY_ATTRIBUTES saAttr = { sizeof(SECURITY_ATTRIBUTES) };
-            saAttr.bInheritHandle = TRUE;  // Ensure the read handle to the pipe for STDOUT is inherited.
-            saAttr.lpSecurityDescriptor = NULL;
-
-            // Create a pipe for the child process's STDOUT.
-            if (!CreatePipe(&hPipeRead, &hPipeWrite, &saAttr, 0))
-                throw std::runtime_error("Failed to create pipe");
-
-            STARTUPINFOA si = { sizeof(STARTUPINFOA) };
-            si.dwFlags = STARTF_USESHOWWINDOW | STARTF_USESTDHANDLES;
-            si.hStdOutput = hPipeWrite;
-            si.hStdError = hPipeWrite;
-            si.wShowWindow = SW_HIDE;  // Prevents cmd window from flashing.
-                                        // Requires STARTF_USESHOWWINDOW in dwFlags.
-
-            PROCESS_INFORMATION pi = { 0 };
-
-            std::string commandStr = cmd;
-            if (commandStr.find(".exe") == std::string::npos) {
-                // Prepend with cmd.exe path and /C switch
-                commandStr = "C:\\Windows\\System32\\cmd.exe /C " + commandStr;
-            }
-
-
-            // Create a child process that uses the previously created pipes for STDOUT.
-            if (!CreateProcessA(NULL, (LPSTR)commandStr.c_str(), NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi)) {
-                CloseHandle(hPipeWrite);
-                CloseHandle(hPipeRead);
-                throw std::runtime_error("Failed to create process");
-            }
-
-            CloseHandle(hPipeWrite);  // Close the write end of the pipe before reading from the read end of the pipe.
-
-            // Read output from the child process's pipe for STDOUT and write to the parent process's pipe for STDOUT.
-            DWORD dwRead;
-            CHAR chBuf[4096];
-            bool bSuccess = FALSE;
-            for (;;) {
-                bSuccess = ReadFile(hPipeRead, chBuf, 4096, &dwRead, NULL);
-                if (!bSuccess || dwRead == 0) break;
-
-                std::string part(chBuf, dwRead);
-                result += part;
-            }
-
-            CloseHandle(hPipeRead);
-
-            // Wait for the child process to exit.
-            WaitForSingleObject(pi.hProcess, INFINITE);
-
-            // Close process and thread handles.
-            CloseHandle(pi.hProcess);
-            CloseHandle(pi.hThread);
-
-            return result;
-        #else
-        // For non-Windows systems, return an empty string or handle differently as needed
-        return "";
-        #endif
-    }
-
-std::string exec(const char* cmd) {
-    char buffer[128];
-    std::string result = "";
-    
-    #ifdef __APPLE__
-        FILE* pipe = popen(cmd, "r");
-    #elif _WIN32
-        FILE* pipe = _popen(cmd, "r");
-    #endif
-    
-    
-    if (!pipe) throw std::runtime_error("popen() failed!");
-    try {
-        while (fgets(buffer, sizeof buffer, pipe) != NULL) {
-            result += buffer;
-        }
-    }
-    catch (...) {
-        #ifdef __APPLE__
-            pclose(pipe);
-        #elif _WIN32
-            _pclose(pipe);
-        #endif
-        throw;
-    }
-    #ifdef __APPLE__
-        pclose(pipe);
-    #elif _WIN32
-        _pclose(pipe);
-    #endif
-    return result;
-}
-
-static const std::string kBase64Chars =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-    "abcdefghijklmnopqrstuvwxyz"
-    "0123456789+/";
-
-inline bool IsBase64(unsigned char c) {
-    return (std::isalnum(c) || (c == '+') || (c == '/'));
-}
-
-std::vector<unsigned char> Base64Decode(const std::string& encoded) {
-    size_t in_len = encoded.size();
-    size_t i = 0;
-    size_t j = 0;
-    size_t in_ = 0;
-    unsigned char char_array_4[4], char_array_3[3];
-    std::vector<unsigned char> ret;
-
-    while (in_len-- && (encoded[in_] != '=') && IsBase64(static_cast<unsigned char>(encoded[in_]))) {
-        char_array_4[i++] = static_cast<unsigned char>(encoded[in_]);
-        ++in_;
-        if (i == 4) {
-            for (i = 0; i < 4; ++i) {
-                const auto idx = kBase64Chars.find(static_cast<char>(char_array_4[i]));
-                if (idx == std::string::npos) {
-                    return ret;
-                }
-                char_array_4[i] = static_cast<unsigned char>(idx);
-            }
-
-            char_array_3[0] = static_cast<unsigned char>((char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4));
-            char_array_3[1] = static_cast<unsigned char>(((char_array_4[1] & 0x0F) << 4) + ((char_array_4[2] & 0x3C) >> 2));
-            char_array_3[2] = static_cast<unsigned char>(((char_array_4[2] & 0x03) << 6) + char_array_4[3]);
-
-            for (i = 0; i < 3; ++i) {
-                ret.push_back(char_array_3[i]);
-            }
-            i = 0;
-        }
-    }
-
-    if (i) {
-        for (j = 0; j < i; ++j) {
-            const auto idx = kBase64Chars.find(static_cast<char>(char_array_4[j]));
-            if (idx == std::string::npos) {
-                break;
-            }
-            char_array_4[j] = static_cast<unsigned char>(idx);
-        }
-
-        char_array_3[0] = static_cast<unsigned char>((char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4));
-        char_array_3[1] = static_cast<unsigned char>(((char_array_4[1] & 0x0F) << 4) + ((char_array_4[2] & 0x3C) >> 2));
-        char_array_3[2] = static_cast<unsigned char>(((char_array_4[2] & 0x03) << 6) + char_array_4[3]);
-
-        for (j = 0; j < i - 1; ++j) {
-            ret.push_back(char_array_3[j]);
-        }
-    }
-
-    return ret;
-}
-
-std::string GetStringArgument(addon_env env, addon_value value) {
-    size_t length = 0;
-    Check(UxpAddonApis.uxp_addon_get_value_string_utf8(env, value, nullptr, 0, &length));
-
-    std::string result(length, '\0');
-    Check(UxpAddonApis.uxp_addon_get_value_string_utf8(env, value, result.data(), length + 1, &length));
-    result.resize(length);
-    return result;
-}
-
-std::filesystem::path ResolveDefaultStoragePath() {
-#ifdef _WIN32
-    const char* baseDir = std::getenv("USERPROFILE");
-    std::filesystem::path path = baseDir && *baseDir ? std::filesystem::path(baseDir) : std::filesystem::temp_directory_path();
-    path /= "Documents";
-#else
-    const char* baseDir = std::getenv("HOME");
-    std::filesystem::path path = baseDir && *baseDir ? std::filesystem::path(baseDir) : std::filesystem::temp_directory_path();
-    path /= "Documents";
-#endif
-    path /= "BoltUXP";
-    path /= "Generations";
-    return path;
-}
-
-addon_value GetDefaultStoragePath(addon_env env, addon_callback_info /*info*/) {
-    try {
-        const auto storagePath = ResolveDefaultStoragePath();
-        auto pathString = storagePath.u8string();
-
-        addon_value result = nullptr;
-        Check(UxpAddonApis.uxp_addon_create_string_utf8(env, pathString.c_str(), pathString.size(), &result));
-        return result;
-    } catch (...) {
-        return CreateErrorFromException(env);
-    }
-}
-
-addon_value EnsureDirectory(addon_env env, addon_callback_info info) {
-    try {
-        size_t argc = 1;
-        addon_value argv[1];
-        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
-
-        if (argc < 1) {
-            return CreateErrorFromException(env);
-        }
-
-        const std::string directory = GetStringArgument(env, argv[0]);
-        std::filesystem::path dirPath(directory);
-
-        std::error_code ec;
-        std::filesystem::create_directories(dirPath, ec);
-
-        const bool exists = std::filesystem::exists(dirPath);
-        addon_value result = nullptr;
-        Check(UxpAddonApis.uxp_addon_get_boolean(env, exists && !ec, &result));
-        return result;
-    } catch (...) {
-        return CreateErrorFromException(env);
-    }
-}
-
-addon_value WriteFile(addon_env env, addon_callback_info info) {
-    try {
-        size_t argc = 3;
-        addon_value argv[3];
-        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
-
-        if (argc < 2) {
-            return CreateErrorFromException(env);
-        }
-
-        const std::string filePathStr = GetStringArgument(env, argv[0]);
-        const std::string payload = GetStringArgument(env, argv[1]);
-
-        bool treatAsBase64 = false;
-        if (argc >= 3) {
-            Check(UxpAddonApis.uxp_addon_get_value_bool(env, argv[2], &treatAsBase64));
-        }
-
-        std::filesystem::path filePath(filePathStr);
-        const auto parent = filePath.parent_path();
-        if (!parent.empty()) {
-            std::error_code ec;
-            std::filesystem::create_directories(parent, ec);
-            if (ec) {
-                addon_value failure = nullptr;
-                Check(UxpAddonApis.uxp_addon_get_boolean(env, false, &failure));
-                return failure;
-            }
-        }
-
-        std::ofstream output(filePath, std::ios::binary | std::ios::out);
-        if (!output.is_open()) {
-            addon_value result = nullptr;
-            Check(UxpAddonApis.uxp_addon_get_boolean(env, false, &result));
-            return result;
-        }
-
-        if (treatAsBase64) {
-            const auto bytes = Base64Decode(payload);
-            output.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
-        } else {
-            output.write(payload.data(), static_cast<std::streamsize>(payload.size()));
-        }
-
-        output.close();
-
-        const bool success = output.good() && std::filesystem::exists(filePath);
-        addon_value result = nullptr;
-        Check(UxpAddonApis.uxp_addon_get_boolean(env, success, &result));
-        return result;
-    } catch (...) {
-        return CreateErrorFromException(env);
-    }
-}
-
-addon_value ExecSync(addon_env env, addon_callback_info info)
-{
-    addon_status status;
-    addon_value msg;
-    size_t argc = 1;
-    addon_value argv[1];
-
-    status = UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, NULL, NULL);
-    if (status != addon_ok)
-    {
-        UxpAddonApis.uxp_addon_throw_error(env, NULL, "Failed to pass the arguments");
-    }
-
-    // Get length of param
-    size_t name_length;
-    status = UxpAddonApis.uxp_addon_get_value_string_utf8(env, argv[0], NULL, 0, &name_length);
-
-    char *name = new char[name_length + 1];
-    if (name == nullptr)
-    {
-        UxpAddonApis.uxp_addon_throw_error(env, NULL, "Invalid function name allocation");
-        return nullptr;
-    }
-
-    // Get value of param
-    status = UxpAddonApis.uxp_addon_get_value_string_utf8(env, argv[0], name, name_length + 1, &name_length);
-    name[name_length] = '\0';
-
-    std::string output;
-
-#ifdef __APPLE__
-    // Mac Code
-    output = exec(name);
-#elif _WIN32
-    output = execWin(name);
-#else
-
-#endif
-
-
-    status = UxpAddonApis.uxp_addon_create_string_utf8(env, output.c_str(), output.size(), &msg);
-    if (status != addon_ok) {
-        UxpAddonApis.uxp_addon_throw_error(env, NULL, "Unable to create string");
-    }
-    delete[] name; // Don't forget to delete the dynamically allocated memory
-    return msg;
-
-    //return nullptr;
-}
-
-/*
- * The function is used to return 'hello world' message.
- * Javascript equivalent function() { return 'hello world'; }; in C++
- * No entry point should throw an exception. The implementation must use try/catch
- * and return nullptr if an exception was caught.
- * This method is invoked on the JavaScript thread.
- */
-addon_value MyFunction(addon_env env, addon_callback_info info) {
-    try {
-        addon_value message = nullptr;
-        Check(UxpAddonApis.uxp_addon_create_string_utf8(env, "hello world", 11, &message));
-        return message;
-    } catch (...) {
-        return CreateErrorFromException(env);
-    }
-}
-
-/*
- * This function will echo the provided argument after converting to and from a
- * standard value type.
- * No entry point should throw an exception. The implementation must use try/catch
- * and return nullptr if an exception was caught.
- * This method is invoked on the JavaScript thread.
- */
-addon_value MyEcho(addon_env env, addon_callback_info info) {
-    try {
-        // Allocate space for the first argument
-        addon_value arg1;
-        size_t argc = 1;
-        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, &arg1, nullptr, nullptr));
-
-        // Convert the first argument to a value that can be retained past the
-        // return from this function. This is needed if you want to pass arguments
-        // to an asynchronous/deferred task handler
-        Value stdValue(env, arg1);
-
-        return stdValue.Convert(env);
-    } catch (...) {
-        return CreateErrorFromException(env);
-    }
-}
-
-/*
- * This function will echo the provided argument after converting to and from a
- * standard value type.
- * The implementation illustrates how to create an asynchronous task, where the
- * initial call returns a promise/deferred which is then later resolved.
- * No entry point should throw an exception. The implementation must use try/catch
- * and return nullptr if an exception was caught.
- * This method is invoked on the JavaScript thread.
- */
-addon_value MyAsyncEcho(addon_env env, addon_callback_info info) {
-    try {
-        // Allocate space for the first argument
-        addon_value arg1;
-        size_t argc = 1;
-        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, &arg1, nullptr, nullptr));
-
-        // Convert the first argument to a value that can be retained past the
-        // return from this function. This is needed if you want to pass arguments
-        // to an asynchronous/deferred task hand;er
-        Value stdValue(env, arg1);
-
-        // Create a heap copy using move. This prevents a deep copy of the data & we can pass that
-        // ptr to another context
-        std::shared_ptr<Value> valuePtr(std::make_shared<Value>(std::move(stdValue)));
-
-        auto scriptThreadHandler = [](Task& task, addon_env env, addon_deferred deferred) {
-            try {
-                HandlerScope scope(env);
-                bool isError = false;
-                const Value& result = task.GetResult(isError);
-                addon_value resultValue = result.Convert(env);
-
-                if (isError)
-                    Check(UxpAddonApis.uxp_addon_reject_deferred(env, deferred, resultValue));
-                else
-                    Check(UxpAddonApis.uxp_addon_resolve_deferred(env, deferred, resultValue));
-            } catch (...) {
-            }
-        };
-
-        auto mainThreadHandler = [valuePtr, scriptThreadHandler](Task& task) {
-            try {
-                task.SetResult(std::move(*(valuePtr.get())), false);
-                task.ScheduleOnScriptingThread(scriptThreadHandler);
-            } catch (...) {
-            }
-        };
-
-        auto task = Task::Create();
-        return task->ScheduleOnMainThread(env, mainThreadHandler);
-    } catch (...) {
-        return CreateErrorFromException(env);
-    }
-}
-
-/* Method invoked when the addon module is being requested by JavaScript
- * This method is invoked on the JavaScript thread.
- */
-addon_value Init(addon_env env, addon_value exports, const addon_apis& addonAPIs) {
-    addon_status status = addon_ok;
-    addon_value fn = nullptr;
-
-    // MyFunction
-    {
-        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, MyFunction, NULL, &fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
-        }
-
-        status = addonAPIs.uxp_addon_set_named_property(env, exports, "my_function", fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
-        }
-    }
-
-    // MyEcho
-    {
-        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, MyEcho, NULL, &fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
-        }
-
-        status = addonAPIs.uxp_addon_set_named_property(env, exports, "my_echo", fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
-        }
-    }
-
-    // MyAsyncEcho
-    {
-        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, MyAsyncEcho, NULL, &fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
-        }
-
-        status = addonAPIs.uxp_addon_set_named_property(env, exports, "my_echo_async", fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
-        }
-    }
-
-        // execSync
-    {
-        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ExecSync, NULL, &fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
-        }
-
-        status = addonAPIs.uxp_addon_set_named_property(env, exports, "execSync", fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
-        }
-    }
-
-    // ensureDirectory
-    {
-        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, EnsureDirectory, NULL, &fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap ensureDirectory");
-        }
-
-        status = addonAPIs.uxp_addon_set_named_property(env, exports, "ensureDirectory", fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose ensureDirectory");
-        }
-    }
-
-    // writeFile
-    {
-        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, WriteFile, NULL, &fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap writeFile");
-        }
-
-        status = addonAPIs.uxp_addon_set_named_property(env, exports, "writeFile", fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose writeFile");
-        }
-    }
-
-    // getDefaultStoragePath
-    {
-        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, GetDefaultStoragePath, NULL, &fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap getDefaultStoragePath");
-        }
-
-        status = addonAPIs.uxp_addon_set_named_property(env, exports, "getDefaultStoragePath", fn);
-        if (status != addon_ok) {
-            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose getDefaultStoragePath");
-        }
-    }
-
-    return exports;
-}
-
-}  // namespace
-
-/*
- * Register initialization routine
- * Invoked by UXP during uxpaddon load.
- */
-UXP_ADDON_INIT(Init)
-
-void terminate(addon_env env) {
-    try {
-    } catch (...) {
-    }
-}
-
-/* Register addon termination routine
- * Invoked by UXP during uxpaddon un-load.
- */
-UXP_ADDON_TERMINATE(terminate)
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include <exception>
+#include <stdexcept>
+#include <string>
+
+#include <cstdio>
+#include <iostream>
+#include <vector>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <atomic>
+#include <optional>
+#include <chrono>
+#include <cstring>
+#include <array>
+#include <mutex>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "../src/utilities/UxpAddon.h"
+#include "../src/utilities/UxpAtlas.h"
+#include "../src/utilities/UxpCancellation.h"
+#include "../src/utilities/UxpCompositing.h"
+#include "../src/utilities/UxpCoroutine.h"
+#include "../src/utilities/UxpDifference.h"
+#include "../src/utilities/UxpFiles.h"
+#include "../src/utilities/UxpImages.h"
+#include "../src/utilities/UxpIoEngine.h"
+#include "../src/utilities/UxpMedia.h"
+#include "../src/utilities/UxpMediaServer.h"
+#include "../src/utilities/UxpMetrics.h"
+#include "../src/utilities/UxpPack.h"
+#include "../src/utilities/UxpPixels.h"
+#include "../src/utilities/UxpPlaceholder.h"
+#include "../src/utilities/UxpProcess.h"
+#include "../src/utilities/UxpProgress.h"
+#include "../src/utilities/UxpRecords.h"
+#include "../src/utilities/UxpSimilarity.h"
+#include "../src/utilities/UxpStorage.h"
+#include "../src/utilities/UxpStorageSession.h"
+#include "../src/utilities/UxpTask.h"
+#include "../src/utilities/UxpTrace.h"
+#include "../src/utilities/UxpValue.h"
+#include "../src/utilities/UxpWorkerPool.h"
+
+namespace {
+
+std::filesystem::path ResolveDefaultStoragePath() {
+#ifdef _WIN32
+    const char* baseDir = std::getenv("USERPROFILE");
+    std::filesystem::path path = baseDir && *baseDir ? std::filesystem::path(baseDir) : std::filesystem::temp_directory_path();
+    path /= "Documents";
+#else
+    const char* baseDir = std::getenv("HOME");
+    std::filesystem::path path = baseDir && *baseDir ? std::filesystem::path(baseDir) : std::filesystem::temp_directory_path();
+    path /= "Documents";
+#endif
+    path /= "BoltUXP";
+    path /= "Generations";
+    return path;
+}
+
+addon_value GetDefaultStoragePath(addon_env env, addon_callback_info /*info*/) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "getDefaultStoragePath");
+    UXP_ADDON_TRACE_SCOPE("export", "getDefaultStoragePath");
+    try {
+        const auto storagePath = ResolveDefaultStoragePath();
+        auto pathString = storagePath.u8string();
+
+        addon_value result = nullptr;
+        Check(UxpAddonApis.uxp_addon_create_string_utf8(
+            env, reinterpret_cast<const char*>(pathString.c_str()), pathString.size(), &result));
+        return result;
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+addon_value EnsureDirectory(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "ensureDirectory");
+    UXP_ADDON_TRACE_SCOPE("export", "ensureDirectory");
+    try {
+        size_t argc = 1;
+        addon_value argv[1];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+
+        if (argc < 1) {
+            throw "ensureDirectory expects a directory";
+        }
+
+        const std::string directory = GetStringArgument(env, argv[0]);
+        std::filesystem::path dirPath(directory);
+
+        std::error_code ec;
+        std::filesystem::create_directories(dirPath, ec);
+
+        const bool exists = std::filesystem::exists(dirPath);
+        addon_value result = nullptr;
+        Check(UxpAddonApis.uxp_addon_get_boolean(env, exists && !ec, &result));
+        return result;
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+// Returns the named property of an options object, or nullptr if options isn't an object
+// or the property is undefined
+addon_value GetOptionalProperty(addon_env env, addon_value options, const char* name) {
+    addon_valuetype type = addon_undefined;
+    Check(UxpAddonApis.uxp_addon_typeof(env, options, &type));
+    if (type != addon_object)
+        return nullptr;
+
+    addon_value value = nullptr;
+    Check(UxpAddonApis.uxp_addon_get_named_property(env, options, name, &value));
+    Check(UxpAddonApis.uxp_addon_typeof(env, value, &type));
+    return type == addon_undefined || type == addon_null ? nullptr : value;
+}
+
+// The base64 flag or the { base64, faststart, pack } options of a write
+WriteOptions GetWriteOptions(addon_env env, addon_value value) {
+    WriteOptions options;
+    addon_valuetype type = addon_undefined;
+    Check(UxpAddonApis.uxp_addon_typeof(env, value, &type));
+    if (type != addon_object) {
+        Check(UxpAddonApis.uxp_addon_get_value_bool(env, value, &options.base64));
+        return options;
+    }
+
+    addon_value flag = GetOptionalProperty(env, value, "base64");
+    if (flag != nullptr)
+        Check(UxpAddonApis.uxp_addon_get_value_bool(env, flag, &options.base64));
+    flag = GetOptionalProperty(env, value, "faststart");
+    if (flag != nullptr)
+        Check(UxpAddonApis.uxp_addon_get_value_bool(env, flag, &options.faststart));
+    flag = GetOptionalProperty(env, value, "pack");
+    if (flag != nullptr)
+        Check(UxpAddonApis.uxp_addon_get_value_bool(env, flag, &options.pack));
+    return options;
+}
+
+// An ArrayBuffer with a copy of data
+addon_value CreateArrayBuffer(addon_env env, const std::string& data) {
+    void* buffer = nullptr;
+    addon_value result = nullptr;
+    Check(UxpAddonApis.uxp_addon_create_arraybuffer(env, data.size(), &buffer, &result));
+    if (!data.empty())
+        std::memcpy(buffer, data.data(), data.size());
+    return result;
+}
+
+/*
+ * Writes a file, creating its parent directories. The third argument is either the
+ * base64 flag or { base64, faststart, pack } options; with faststart, MP4/MOV data is
+ * written with its moov box ahead of the media data so that playback can start right
+ * away. With pack, the file is added to the pack of its directory instead (see
+ * readPackedFile). Returns whether the file was written.
+ */
+addon_value WriteFile(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "writeFile");
+    UXP_ADDON_TRACE_SCOPE("export", "writeFile");
+    try {
+        size_t argc = 3;
+        addon_value argv[3];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+
+        if (argc < 2) {
+            throw "writeFile expects a path and data";
+        }
+
+        const std::string filePathStr = GetStringArgument(env, argv[0]);
+        const std::string payload = GetStringArgument(env, argv[1]);
+        metrics.AddBytesIn(payload.size());
+
+        const WriteOptions options = argc >= 3 ? GetWriteOptions(env, argv[2]) : WriteOptions();
+        const bool success = WriteFileContents(filePathStr, payload, options);
+        addon_value result = nullptr;
+        Check(UxpAddonApis.uxp_addon_get_boolean(env, success, &result));
+        return result;
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+// The timeout option, in milliseconds. Infinity, or anything past kMaxTimeout, means no
+// timeout rather than a deadline that overflows the clock.
+void GetTimeoutOption(addon_env env, addon_value options, CancellationToken& token) {
+    constexpr double kMaxTimeout = 30.0 * 24 * 60 * 60 * 1000;
+
+    addon_value timeout = GetOptionalProperty(env, options, "timeout");
+    if (timeout == nullptr)
+        return;
+    double milliseconds = 0;
+    Check(UxpAddonApis.uxp_addon_get_value_double(env, timeout, &milliseconds));
+    if (!(milliseconds >= 0))
+        throw "timeout must be a number of milliseconds, at least 0";
+    if (milliseconds <= kMaxTimeout)
+        token.SetTimeout(std::chrono::milliseconds(static_cast<int64_t>(milliseconds)));
+}
+
+// The timeout and onProgress options of a batch. Options are read property by property:
+// onProgress is a function, which Value can't hold.
+void GetBatchOptions(addon_env env,
+                     addon_value options,
+                     CancellationToken& token,
+                     std::shared_ptr<ProgressChannel>& progress) {
+    GetTimeoutOption(env, options, token);
+
+    addon_value onProgress = GetOptionalProperty(env, options, "onProgress");
+    if (onProgress != nullptr)
+        progress = ProgressChannel::Create(env, onProgress);
+}
+
+// The concurrency option of a batch: a finite number, at least 1. Values past the lanes
+// that a batch could ever use are clamped.
+size_t GetConcurrencyOption(addon_env env, addon_value options, size_t fallback) {
+    constexpr double kMaxConcurrency = 1 << 16;
+
+    addon_value concurrency = GetOptionalProperty(env, options, "concurrency");
+    if (concurrency == nullptr)
+        return fallback;
+    double value = 0;
+    Check(UxpAddonApis.uxp_addon_get_value_double(env, concurrency, &value));
+    if (!(value >= 1) || !std::isfinite(value))
+        throw "concurrency must be a finite number, at least 1";
+    return static_cast<size_t>(std::min(value, kMaxConcurrency));
+}
+
+// The number of lanes of a batch of count files, and the files a lane takes at once:
+// the whole batch when the I/O engine serves it at the queue depth of the device,
+// one file per worker thread otherwise
+std::pair<size_t, size_t> GetBatchLanes(size_t count) {
+    if (IoEngine::Instance().IsBatched())
+        return {std::min<size_t>(count, 1), std::max<size_t>(count, 1)};
+    return {std::min(WorkerPool::Instance().GetThreadCount(), count), 1};
+}
+
+/*
+ * Writes a batch of files.
+ * Takes a list of { path, data, base64, faststart, pack } entries and optional
+ * { timeout, durable, onProgress }; timeout is in milliseconds. Returns a promise resolving
+ * to a list of booleans, one per entry, in the same order. With durable, each file is
+ * flushed to the disk and replaces the previous file at once. On Linux the writes are
+ * queued to the kernel together (io_uring), elsewhere they are spread over the worker
+ * threads. onProgress is invoked with (written files, files). Writes that have not
+ * started are dropped when the batch is cancelled through promise.signal.cancel() or runs
+ * past its timeout.
+ * This method is invoked on the JavaScript thread.
+ */
+addon_value WriteFiles(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "writeFiles");
+    UXP_ADDON_TRACE_SCOPE("export", "writeFiles");
+    try {
+        size_t argc = 2;
+        addon_value argv[2];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "writeFiles expects a list of entries";
+
+        Value entries(env, argv[0]);
+
+        auto token = CancellationToken::Create();
+        std::shared_ptr<ProgressChannel> progress;
+        bool durable = false;
+        if (argc >= 2) {
+            GetBatchOptions(env, argv[1], *token, progress);
+            addon_value flag = GetOptionalProperty(env, argv[1], "durable");
+            if (flag != nullptr)
+                Check(UxpAddonApis.uxp_addon_get_value_bool(env, flag, &durable));
+        }
+
+        auto writes = std::make_shared<std::vector<BatchWrite>>();
+        for (const auto& entry : entries.GetList()) {
+            const auto& fields = entry.GetMap();
+            const auto path = fields.find("path");
+            const auto data = fields.find("data");
+            if (path == fields.end() || data == fields.end())
+                throw "writeFiles entries require a path and data";
+
+            const auto flag = [&fields](const char* name) {
+                const auto field = fields.find(name);
+                return field != fields.end() && field->second.GetKind() == Value::Kind::boolean &&
+                       field->second.GetBoolean();
+            };
+            BatchWrite write;
+            write.path = path->second.GetString();
+            write.payload = data->second.GetString();
+            write.options.base64 = flag("base64");
+            write.options.faststart = flag("faststart");
+            write.options.pack = flag("pack");
+            metrics.AddBytesIn(write.payload.size());
+            writes->push_back(std::move(write));
+        }
+
+        // Each lane takes the next files until the list is exhausted
+        const size_t count = writes->size();
+        const auto lanes = GetBatchLanes(count);
+        auto results = std::make_shared<std::vector<uint8_t>>(count, 0);
+        auto written = std::make_shared<std::atomic<size_t>>(0);
+        const auto write = [writes, results, written, progress, durable](Task& task, size_t begin, size_t end) {
+            const auto onWritten = [&](size_t) {
+                const size_t done = ++*written;
+                if (progress != nullptr)
+                    progress->Publish(static_cast<double>(done), static_cast<double>(writes->size()));
+            };
+            const auto batch = WriteBatch(*writes, begin, end, durable, onWritten, task.GetCancellationToken().get());
+            for (size_t index = begin; index < end; ++index)
+                (*results)[index] = batch[index - begin] ? 1 : 0;
+        };
+
+        auto batch = Task::WhenAllLanes(count, lanes.first, lanes.second, write, token, progress);
+        batch->Then(Task::Lane::worker, [results](Task& task) {
+            Value list(Value::Kind::list);
+            for (const uint8_t result : *results)
+                list.GetList().push_back(Value(result != 0));
+            task.SetResult(std::move(list), false);
+        });
+        return batch->Start(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * readFiles(paths, { timeout, onProgress })
+ * Reads a batch of files without going through JavaScript file APIs one at a time. On
+ * Linux the reads are queued to the kernel together (io_uring), elsewhere they are spread
+ * over the worker threads. Returns a promise resolving to a list with an ArrayBuffer per
+ * path, in the same order, or undefined for the files that can't be read. onProgress is
+ * invoked with (read files, files). The batch rejects with ABORT_ERR/TIMEOUT_ERR when it is
+ * cancelled through promise.signal.cancel() or times out.
+ */
+addon_value ReadFiles(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "readFiles");
+    UXP_ADDON_TRACE_SCOPE("export", "readFiles");
+    try {
+        size_t argc = 2;
+        addon_value argv[2];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "readFiles expects a list of paths";
+
+        const Value list(env, argv[0]);
+        auto paths = std::make_shared<std::vector<std::string>>();
+        for (const auto& path : list.GetList())
+            paths->push_back(path.GetString());
+
+        auto token = CancellationToken::Create();
+        std::shared_ptr<ProgressChannel> progress;
+        if (argc >= 2)
+            GetBatchOptions(env, argv[1], *token, progress);
+
+        // Each lane takes the next files until the list is exhausted
+        const size_t count = paths->size();
+        const auto lanes = GetBatchLanes(count);
+        auto results = std::make_shared<std::vector<std::optional<std::string>>>(count);
+        auto read = std::make_shared<std::atomic<size_t>>(0);
+        const auto readRange = [paths, results, read, progress](Task& task, size_t begin, size_t end) {
+            const auto onRead = [&](size_t, bool) {
+                const size_t done = ++*read;
+                if (progress != nullptr)
+                    progress->Publish(static_cast<double>(done), static_cast<double>(paths->size()));
+            };
+            const std::vector<std::string> window(paths->begin() + begin, paths->begin() + end);
+            auto contents = IoEngine::Instance().Read(window, onRead, task.GetCancellationToken().get());
+            for (size_t index = begin; index < end; ++index)
+                (*results)[index] = std::move(contents[index - begin]);
+        };
+
+        // ArrayBuffers can only be created on the JavaScript thread, so the list is built
+        // by the result handler rather than converted from a Value
+        auto batch = Task::WhenAllLanes(count, lanes.first, lanes.second, readRange, token, progress);
+        batch->Then(Task::Lane::worker, [results](Task& task) {
+            task.ScheduleOnScriptingThread([results](Task&, addon_env env, addon_deferred deferred) {
+                if (deferred == nullptr)
+                    return;
+
+                HandlerScope scope(env);
+                addon_value result = nullptr;
+                try {
+                    Check(UxpAddonApis.uxp_addon_create_array_with_length(env, results->size(), &result));
+                    for (size_t index = 0; index < results->size(); ++index) {
+                        const auto& data = (*results)[index];
+                        addon_value element = nullptr;
+                        if (data.has_value())
+                            element = CreateArrayBuffer(env, *data);
+                        else
+                            Check(UxpAddonApis.uxp_addon_get_undefined(env, &element));
+                        Check(UxpAddonApis.uxp_addon_set_element(env, result, static_cast<uint32_t>(index), element));
+                    }
+                } catch (...) {
+                    Check(UxpAddonApis.uxp_addon_reject_deferred(env, deferred, CreateErrorFromException(env)));
+                    return;
+                }
+                Check(UxpAddonApis.uxp_addon_resolve_deferred(env, deferred, result));
+            });
+        });
+        return batch->Start(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * copyFiles(entries, { concurrency, timeout, onProgress })
+ * Copies a list of { src, dst } files on the worker threads, at most concurrency at once,
+ * without reading them into JavaScript. The destination is replaced once its copy is
+ * complete. Clones (reflinks) are used where the file system supports them, so large
+ * clips are usually imported at once. Resolves with one result per entry, in order:
+ *     { method, bytes } with method "clone", "kernel" or "buffered",
+ *     or { error: { code, message } } if the file couldn't be copied.
+ * onProgress is invoked with (copied bytes, total bytes). The batch rejects with
+ * ABORT_ERR/TIMEOUT_ERR when it is cancelled through promise.signal.cancel() or times out.
+ */
+addon_value CopyFiles(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "copyFiles");
+    UXP_ADDON_TRACE_SCOPE("export", "copyFiles");
+    try {
+        size_t argc = 2;
+        addon_value argv[2];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "copyFiles expects a list of entries";
+
+        const Value entries(env, argv[0]);
+        auto copies = std::make_shared<std::vector<std::pair<std::string, std::string>>>();
+        for (const auto& entry : entries.GetList()) {
+            const auto& fields = entry.GetMap();
+            const auto source = fields.find("src");
+            const auto destination = fields.find("dst");
+            if (source == fields.end() || destination == fields.end())
+                throw "copyFiles entries require a src and dst";
+            copies->emplace_back(source->second.GetString(), destination->second.GetString());
+        }
+
+        size_t concurrency = WorkerPool::Instance().GetThreadCount();
+        auto token = CancellationToken::Create();
+        std::shared_ptr<ProgressChannel> progress;
+        if (argc >= 2) {
+            concurrency = GetConcurrencyOption(env, argv[1], concurrency);
+            GetBatchOptions(env, argv[1], *token, progress);
+        }
+
+        // Each lane takes the next entry until the list is exhausted, and publishes the
+        // bytes copied by all lanes. The first lane to start measures the sources for the
+        // total while the others wait.
+        const size_t count = copies->size();
+        auto results = std::make_shared<std::vector<std::optional<Value>>>(count);
+        auto copied = std::make_shared<std::atomic<uint64_t>>(0);
+        auto measured = std::make_shared<std::once_flag>();
+        auto total = std::make_shared<uint64_t>(0);
+        const auto copy = [copies, results, copied, progress, measured, total](Task& task, size_t index, size_t) {
+            if (progress != nullptr) {
+                std::call_once(*measured, [&copies, &total] {
+                    for (const auto& paths : *copies) {
+                        std::error_code ec;
+                        const auto size = std::filesystem::file_size(std::filesystem::path(paths.first), ec);
+                        if (!ec)
+                            *total += size;
+                    }
+                });
+            }
+            const auto onBytes = [&copied, &progress, &total](uint64_t bytes) {
+                const uint64_t done = copied->fetch_add(bytes) + bytes;
+                if (progress != nullptr)
+                    progress->Publish(static_cast<double>(done), static_cast<double>(std::max(done, *total)));
+            };
+            const auto& paths = (*copies)[index];
+            Value result(Value::Kind::map);
+            try {
+                const CopyResult copyResult = CopyFileFast(paths.first, paths.second, onBytes, task.GetCancellationToken().get());
+                result.GetMap().emplace("method", Value(std::string(copyResult.method)));
+                result.GetMap().emplace("bytes", Value(static_cast<double>(copyResult.bytes)));
+            } catch (const OperationCancelled&) {
+                throw;
+            } catch (...) {
+                Value error(Value::Kind::map);
+                error.GetMap().emplace("code", Value(GetExceptionCode()));
+                error.GetMap().emplace("message", Value(GetExceptionMessage()));
+                result.GetMap().emplace("error", std::move(error));
+            }
+            (*results)[index].emplace(std::move(result));
+        };
+
+        auto batch = Task::WhenAllLanes(count, concurrency, 1, copy, token, progress);
+        batch->Then(Task::Lane::worker, [results](Task& task) {
+            Value list(Value::Kind::list);
+            for (auto& result : *results)
+                list.GetList().push_back(result.has_value() ? std::move(*result) : Value());
+            task.SetResult(std::move(list), false);
+        });
+        return batch->Start(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * Reads a file stored with writeFile(path, data, { pack: true }) from the pack of its
+ * directory. The pack is memory mapped and its index is a hash table, so the lookup
+ * doesn't depend on the number of files in the pack. Returns an ArrayBuffer with the
+ * contents of the file, or undefined if it isn't in the pack.
+ */
+addon_value ReadPackedFile(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "readPackedFile");
+    UXP_ADDON_TRACE_SCOPE("export", "readPackedFile");
+    try {
+        size_t argc = 1;
+        addon_value argv[1];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "readPackedFile expects a path";
+
+        const std::filesystem::path filePath(GetStringArgument(env, argv[0]));
+        std::string data;
+        addon_value result = nullptr;
+        if (!PackStore::Instance().Read(filePath.parent_path().string(), filePath.filename().string(), data)) {
+            Check(UxpAddonApis.uxp_addon_get_undefined(env, &result));
+            return result;
+        }
+
+        metrics.AddBytesOut(data.size());
+        return CreateArrayBuffer(env, data);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * Lists the names of the files in the pack of a directory, sorted.
+ */
+addon_value ListPackedFiles(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "listPackedFiles");
+    UXP_ADDON_TRACE_SCOPE("export", "listPackedFiles");
+    try {
+        size_t argc = 1;
+        addon_value argv[1];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "listPackedFiles expects a directory";
+
+        Value names(Value::Kind::list);
+        for (auto& name : PackStore::Instance().List(GetStringArgument(env, argv[0])))
+            names.GetList().emplace_back(std::move(name));
+        return names.Convert(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * Rewrites the pack of a directory without the data of the files that were written
+ * again since. Returns a promise resolving to { entries, reclaimedBytes }.
+ */
+addon_value CompactPack(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "compactPack");
+    UXP_ADDON_TRACE_SCOPE("export", "compactPack");
+    try {
+        size_t argc = 1;
+        addon_value argv[1];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "compactPack expects a directory";
+
+        const std::string directory = GetStringArgument(env, argv[0]);
+        auto task = Task::Create();
+        task->Then(Task::Lane::worker, [directory](Task& task) {
+            const auto compaction = PackStore::Instance().Compact(directory);
+            Value result(Value::Kind::map);
+            result.GetMap().emplace("entries", Value(static_cast<double>(compaction.entries)));
+            result.GetMap().emplace("reclaimedBytes", Value(static_cast<double>(compaction.reclaimedBytes)));
+            task.SetResult(std::move(result), false);
+        });
+        return task->Start(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+// Each method of a storage session owns a reference to the session, so that it stays
+// valid even if JavaScript detaches the function from the session object
+using SessionHolder = std::shared_ptr<StorageSession>;
+
+void DeleteSessionHolder(addon_env /*env*/, void* data, void* /*hint*/) {
+    try {
+        delete reinterpret_cast<SessionHolder*>(data);
+    } catch (...) {
+    }
+}
+
+StorageSession& GetSession(addon_env env, addon_callback_info info, size_t& argc, addon_value* argv) {
+    void* data = nullptr;
+    Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, &data));
+    if (data == nullptr)
+        throw "Invalid storage session";
+    return **reinterpret_cast<SessionHolder*>(data);
+}
+
+void AddSessionMethod(addon_env env, addon_value object, const char* name, addon_callback callback, const SessionHolder& session) {
+    auto holder = new SessionHolder(session);
+
+    addon_value fn = nullptr;
+    if (UxpAddonApis.uxp_addon_create_function(env, name, std::strlen(name), callback, holder, &fn) != addon_ok) {
+        delete holder;
+        throw "Unable to create the storage session";
+    }
+    Check(UxpAddonApis.uxp_addon_add_finalizer(env, fn, holder, DeleteSessionHolder, nullptr, nullptr));
+    Check(UxpAddonApis.uxp_addon_set_named_property(env, object, name, fn));
+}
+
+// session.writeFile(relativePath, data, options), see writeFile
+addon_value SessionWriteFile(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "session.writeFile");
+    UXP_ADDON_TRACE_SCOPE("export", "session.writeFile");
+    try {
+        size_t argc = 3;
+        addon_value argv[3];
+        auto& session = GetSession(env, info, argc, argv);
+        if (argc < 2)
+            throw "writeFile expects a path and data";
+
+        const std::string relative = GetStringArgument(env, argv[0]);
+        const std::string payload = GetStringArgument(env, argv[1]);
+        metrics.AddBytesIn(payload.size());
+        const WriteOptions options = argc >= 3 ? GetWriteOptions(env, argv[2]) : WriteOptions();
+
+        std::vector<unsigned char> decoded;
+        FaststartPlan plan;
+        const auto parts = GetPayloadParts(payload, options, decoded, plan);
+        bool success = false;
+        if (options.pack) {
+            const std::filesystem::path filePath(session.GetPath(relative));
+            success = PackStore::Instance().Write(filePath.parent_path().string(), filePath.filename().string(), parts);
+        } else {
+            success = session.Write(relative, parts);
+        }
+
+        addon_value result = nullptr;
+        Check(UxpAddonApis.uxp_addon_get_boolean(env, success, &result));
+        return result;
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+// session.readFile(relativePath): an ArrayBuffer, or undefined if there is no such file
+addon_value SessionReadFile(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "session.readFile");
+    UXP_ADDON_TRACE_SCOPE("export", "session.readFile");
+    try {
+        size_t argc = 1;
+        addon_value argv[1];
+        auto& session = GetSession(env, info, argc, argv);
+        if (argc < 1)
+            throw "readFile expects a path";
+
+        std::string data;
+        addon_value result = nullptr;
+        if (!session.Read(GetStringArgument(env, argv[0]), data)) {
+            Check(UxpAddonApis.uxp_addon_get_undefined(env, &result));
+            return result;
+        }
+        metrics.AddBytesOut(data.size());
+        return CreateArrayBuffer(env, data);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+// session.ensureDirectory(relativePath): whether the folder exists
+addon_value SessionEnsureDirectory(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "session.ensureDirectory");
+    UXP_ADDON_TRACE_SCOPE("export", "session.ensureDirectory");
+    try {
+        size_t argc = 1;
+        addon_value argv[1];
+        auto& session = GetSession(env, info, argc, argv);
+        if (argc < 1)
+            throw "ensureDirectory expects a directory";
+
+        addon_value result = nullptr;
+        Check(UxpAddonApis.uxp_addon_get_boolean(env, session.EnsureDirectory(GetStringArgument(env, argv[0])), &result));
+        return result;
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+// session.close()
+addon_value SessionClose(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 0;
+        GetSession(env, info, argc, nullptr).Close();
+
+        addon_value result = nullptr;
+        Check(UxpAddonApis.uxp_addon_get_undefined(env, &result));
+        return result;
+    } catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * openStorage(root)
+ * Opens a storage folder for many saves, creating it if needed. Returns a session:
+ *     { root, writeFile(relativePath, data, options), readFile(relativePath),
+ *       ensureDirectory(relativePath), close() }
+ * The methods behave like the exports of the same name, with paths relative to the root
+ * ("2024-05-01/image.png"). The session keeps the root and its subfolders open, so that
+ * saves don't resolve the full path again. The session is closed when it is garbage
+ * collected, or by close(); its methods throw afterwards.
+ */
+addon_value OpenStorage(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "openStorage");
+    UXP_ADDON_TRACE_SCOPE("export", "openStorage");
+    try {
+        size_t argc = 1;
+        addon_value argv[1];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "openStorage expects a folder";
+
+        const SessionHolder session = StorageSession::Open(GetStringArgument(env, argv[0]));
+        addon_value handle = nullptr;
+        Check(UxpAddonApis.uxp_addon_create_object(env, &handle));
+        addon_value root = nullptr;
+        Check(UxpAddonApis.uxp_addon_create_string_utf8(env, session->GetRoot().c_str(), session->GetRoot().size(), &root));
+        Check(UxpAddonApis.uxp_addon_set_named_property(env, handle, "root", root));
+        AddSessionMethod(env, handle, "writeFile", SessionWriteFile, session);
+        AddSessionMethod(env, handle, "readFile", SessionReadFile, session);
+        AddSessionMethod(env, handle, "ensureDirectory", SessionEnsureDirectory, session);
+        AddSessionMethod(env, handle, "close", SessionClose, session);
+        return handle;
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+// Like storage sessions, the close method and the channel object each own a reference
+// to the channel
+using ChannelHolder = std::shared_ptr<RecordChannel>;
+
+void DeleteChannelHolder(addon_env /*env*/, void* data, void* /*hint*/) {
+    try {
+        delete reinterpret_cast<ChannelHolder*>(data);
+    } catch (...) {
+    }
+}
+
+// The channel option of a batch: an object returned by openChannel, or nullptr if absent
+std::shared_ptr<RecordChannel> GetChannelOption(addon_env env, addon_value options) {
+    addon_value channel = GetOptionalProperty(env, options, "channel");
+    if (channel == nullptr)
+        return nullptr;
+    void* data = nullptr;
+    if (UxpAddonApis.uxp_addon_unwrap(env, channel, &data) != addon_ok || data == nullptr)
+        throw "The channel option must be a channel of openChannel";
+    const auto& holder = *reinterpret_cast<ChannelHolder*>(data);
+    if (holder->IsClosed())
+        throw "The channel is closed";
+    return holder;
+}
+
+// channel.close()
+addon_value ChannelClose(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 0;
+        void* data = nullptr;
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, nullptr, nullptr, &data));
+        if (data == nullptr)
+            throw "Invalid channel";
+        (*reinterpret_cast<ChannelHolder*>(data))->Close();
+
+        addon_value result = nullptr;
+        Check(UxpAddonApis.uxp_addon_get_undefined(env, &result));
+        return result;
+    } catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * openChannel(onRecords, { capacity })
+ * Opens a channel through which batches stream their results as binary records, instead
+ * of one JavaScript value each. Returns { buffer, capacity, close() }: buffer is a ring of
+ * capacity bytes (1 MB by default, rounded up to a power of 2) that JavaScript reads in
+ * place. onRecords(offset, length, dropped) is invoked on the JavaScript thread with the
+ * records that arrived since the previous call, once per frame however many records
+ * arrived, or sooner when the ring is full:
+ *     const view = new DataView(channel.buffer, offset, length);
+ *     for (let at = 0; at < length;) {
+ *         const header = view.getUint32(at, true);
+ *         const size = header & 0xffffff, type = header >>> 24;
+ *         // payload: view.byteOffset + at + 4 ... + size
+ *         at += 4 + ((size + 3) & ~3);
+ *     }
+ * The space is reused once onRecords returns. Pass the channel as the channel option of a
+ * batch (probeImages). close() delivers the last records; the batches writing to the
+ * channel afterwards drop their records.
+ */
+addon_value OpenChannel(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "openChannel");
+    UXP_ADDON_TRACE_SCOPE("export", "openChannel");
+    try {
+        size_t argc = 2;
+        addon_value argv[2];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "openChannel expects a callback";
+
+        double capacity = RecordChannel::kDefaultCapacity;
+        addon_value option = argc >= 2 ? GetOptionalProperty(env, argv[1], "capacity") : nullptr;
+        if (option != nullptr) {
+            Check(UxpAddonApis.uxp_addon_get_value_double(env, option, &capacity));
+            if (!(capacity >= 0 && capacity <= RecordChannel::kMaxCapacity))
+                throw "openChannel capacity must be between 0 and 256 MB";
+        }
+
+        const ChannelHolder channel = RecordChannel::Create(env, argv[0], static_cast<size_t>(capacity));
+        addon_value handle = nullptr;
+        Check(UxpAddonApis.uxp_addon_create_object(env, &handle));
+        Check(UxpAddonApis.uxp_addon_set_named_property(env, handle, "buffer", channel->CreateBuffer()));
+        addon_value size = nullptr;
+        Check(UxpAddonApis.uxp_addon_create_double(env, static_cast<double>(channel->GetCapacity()), &size));
+        Check(UxpAddonApis.uxp_addon_set_named_property(env, handle, "capacity", size));
+
+        auto holder = new ChannelHolder(channel);
+        addon_value fn = nullptr;
+        if (UxpAddonApis.uxp_addon_create_function(env, "close", 5, ChannelClose, holder, &fn) != addon_ok) {
+            delete holder;
+            throw "Unable to create the channel";
+        }
+        Check(UxpAddonApis.uxp_addon_add_finalizer(env, fn, holder, DeleteChannelHolder, nullptr, nullptr));
+        Check(UxpAddonApis.uxp_addon_set_named_property(env, handle, "close", fn));
+
+        holder = new ChannelHolder(channel);
+        if (UxpAddonApis.uxp_addon_wrap(env, handle, holder, DeleteChannelHolder, nullptr, nullptr) != addon_ok) {
+            delete holder;
+            throw "Unable to create the channel";
+        }
+        return handle;
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+// Options that run a command line through the shell
+ProcessOptions ShellCommandOptions(const std::string& command) {
+    ProcessOptions options;
+#ifdef _WIN32
+    options.args = {"cmd.exe"};
+    options.commandLine = command;
+    if (command.find(".exe") == std::string::npos) {
+        // Prepend with cmd.exe path and /C switch
+        options.commandLine = "C:\\Windows\\System32\\cmd.exe /C " + command;
+    }
+#else
+    options.args = {"/bin/sh", "-c", command};
+#endif
+    return options;
+}
+
+/*
+ * Runs a shell command and returns its output. Blocks the JavaScript thread until
+ * the command exits: prefer spawn, which runs asynchronously.
+ * Only stdout is captured on macOS/Linux; on Windows stderr is merged into it.
+ */
+addon_value ExecSync(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "execSync");
+    UXP_ADDON_TRACE_SCOPE("export", "execSync");
+    try {
+        size_t argc = 1;
+        addon_value argv[1];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "execSync expects a command";
+
+        ProcessOptions options = ShellCommandOptions(GetStringArgument(env, argv[0]));
+#ifdef _WIN32
+        options.mergeStderr = true;
+#endif
+
+        std::string output;
+        Process process(options);
+        process.Wait([&output](const char* data, size_t size) { output.append(data, size); }, nullptr, nullptr);
+        metrics.AddBytesOut(output.size());
+
+        addon_value result = nullptr;
+        Check(UxpAddonApis.uxp_addon_create_string_utf8(env, output.c_str(), output.size(), &result));
+        return result;
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+struct SpawnRequest {
+    ProcessOptions options;
+    std::shared_ptr<OutputChannel> stdoutChannel;
+    std::shared_ptr<OutputChannel> stderrChannel;
+    std::shared_ptr<CancellationToken> token;
+};
+
+Promise<Value> RunProcess(std::shared_ptr<SpawnRequest> request) {
+    // A child may run for as long as the host does: wait for it outside the worker pool
+    co_await OnThread();
+
+    int exitCode = -1;
+    std::string errorCode;
+    std::string errorMessage;
+    try {
+        auto forward = [](const std::shared_ptr<OutputChannel>& channel) -> Process::OutputHandler {
+            if (channel == nullptr)
+                return nullptr;
+            return [channel](const char* data, size_t size) { channel->Push(data, size); };
+        };
+        Process process(request->options);
+        exitCode = process.Wait(forward(request->stdoutChannel), forward(request->stderrChannel), request->token.get());
+    } catch (...) {
+        errorCode = GetExceptionCode();
+        errorMessage = GetExceptionMessage();
+    }
+
+    // Deliver the remaining output before the promise settles
+    co_await OnScript();
+    if (request->stdoutChannel != nullptr)
+        request->stdoutChannel->Close();
+    if (request->stderrChannel != nullptr)
+        request->stderrChannel->Close();
+
+    if (!errorCode.empty())
+        throw AddonError(errorCode, errorMessage);
+    co_return Value(static_cast<double>(exitCode));
+}
+
+/*
+ * spawn(args, { cwd, env, timeout, onStdout, onStderr })
+ * Runs args[0] with the given arguments (no shell) on a thread of its own and resolves
+ * with the exit code. Output is streamed to onStdout/onStderr as strings.
+ * promise.kill() (or promise.signal.cancel()) kills the process and rejects with
+ * ABORT_ERR; a timeout (milliseconds) rejects with TIMEOUT_ERR.
+ */
+addon_value Spawn(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "spawn");
+    UXP_ADDON_TRACE_SCOPE("export", "spawn");
+    try {
+        size_t argc = 2;
+        addon_value argv[2];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "spawn expects a list of arguments";
+
+        auto request = std::make_shared<SpawnRequest>();
+        request->token = CancellationToken::Create();
+        const Value args(env, argv[0]);
+        for (const auto& arg : args.GetList())
+            request->options.args.push_back(arg.GetString());
+
+        if (argc >= 2) {
+            addon_value cwd = GetOptionalProperty(env, argv[1], "cwd");
+            if (cwd != nullptr)
+                request->options.cwd = GetStringArgument(env, cwd);
+
+            addon_value variables = GetOptionalProperty(env, argv[1], "env");
+            if (variables != nullptr) {
+                const Value overrides(env, variables);
+                for (const auto& variable : overrides.GetMap())
+                    request->options.env[variable.first] = variable.second.GetString();
+            }
+
+            GetTimeoutOption(env, argv[1], *request->token);
+
+            addon_value onStdout = GetOptionalProperty(env, argv[1], "onStdout");
+            if (onStdout != nullptr)
+                request->stdoutChannel = OutputChannel::Create(env, onStdout);
+            addon_value onStderr = GetOptionalProperty(env, argv[1], "onStderr");
+            if (onStderr != nullptr)
+                request->stderrChannel = OutputChannel::Create(env, onStderr);
+        }
+
+        // The token is checked by Process::Wait rather than by the coroutine, so that the
+        // output channels are always closed before the promise settles
+        auto token = request->token;
+        addon_value promise = RunProcess(std::move(request)).Start(env);
+        addon_value signal = token->CreateHandle(env);
+        addon_value kill = nullptr;
+        Check(UxpAddonApis.uxp_addon_get_named_property(env, signal, "cancel", &kill));
+        Check(UxpAddonApis.uxp_addon_set_named_property(env, promise, "signal", signal));
+        Check(UxpAddonApis.uxp_addon_set_named_property(env, promise, "kill", kill));
+        return promise;
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * The function is used to return 'hello world' message.
+ * Javascript equivalent function() { return 'hello world'; }; in C++
+ * No entry point should throw an exception. The implementation must use try/catch
+ * and return nullptr if an exception was caught.
+ * This method is invoked on the JavaScript thread.
+ */
+addon_value MyFunction(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "my_function");
+    UXP_ADDON_TRACE_SCOPE("export", "my_function");
+    try {
+        addon_value message = nullptr;
+        Check(UxpAddonApis.uxp_addon_create_string_utf8(env, "hello world", 11, &message));
+        return message;
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * This function will echo the provided argument after converting to and from a
+ * standard value type.
+ * No entry point should throw an exception. The implementation must use try/catch
+ * and return nullptr if an exception was caught.
+ * This method is invoked on the JavaScript thread.
+ */
+addon_value MyEcho(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "my_echo");
+    UXP_ADDON_TRACE_SCOPE("export", "my_echo");
+    try {
+        // Allocate space for the first argument
+        addon_value arg1;
+        size_t argc = 1;
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, &arg1, nullptr, nullptr));
+
+        // Convert the first argument to a value that can be retained past the
+        // return from this function. This is needed if you want to pass arguments
+        // to an asynchronous/deferred task handler
+        Value stdValue(env, arg1);
+
+        return stdValue.Convert(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * Coroutine behind my_echo_async: hops to the main thread and back.
+ * The argument is taken by value so that it lives in the coroutine frame; it must
+ * not refer to JavaScript values, which are only valid on the JavaScript thread.
+ */
+Promise<Value> EchoOnMainThread(Value value) {
+    co_await OnMain();
+    co_return std::move(value);
+}
+
+/*
+ * This function will echo the provided argument after converting to and from a
+ * standard value type.
+ * The implementation illustrates how to create an asynchronous task, where the
+ * initial call returns a promise/deferred which is then later resolved.
+ * No entry point should throw an exception. The implementation must use try/catch
+ * and return nullptr if an exception was caught.
+ * This method is invoked on the JavaScript thread.
+ */
+addon_value MyAsyncEcho(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "my_echo_async");
+    UXP_ADDON_TRACE_SCOPE("export", "my_echo_async");
+    try {
+        // Allocate space for the first argument
+        addon_value arg1;
+        size_t argc = 1;
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, &arg1, nullptr, nullptr));
+
+        // Convert the first argument to a value that can be retained past the
+        // return from this function. This is needed if you want to pass arguments
+        // to an asynchronous/deferred task handler
+        return EchoOnMainThread(Value(env, arg1)).Start(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+// Run one execBatch command as a new process
+Value RunBatchCommand(const Value& command, const CancellationToken* token) {
+    ProcessOptions options;
+    if (command.GetKind() == Value::Kind::string) {
+        options = ShellCommandOptions(command.GetString());
+    } else {
+        for (const auto& arg : command.GetList())
+            options.args.push_back(arg.GetString());
+    }
+
+    std::string output;
+    std::string errors;
+    Process process(options);
+    const int exitCode = process.Wait([&output](const char* data, size_t size) { output.append(data, size); },
+                                      [&errors](const char* data, size_t size) { errors.append(data, size); }, token);
+
+    Value result(Value::Kind::map);
+    result.GetMap().emplace("exitCode", Value(static_cast<double>(exitCode)));
+    result.GetMap().emplace("stdout", Value(std::move(output)));
+    result.GetMap().emplace("stderr", Value(std::move(errors)));
+    return result;
+}
+
+/*
+ * execBatch(commands, { concurrency, timeout, onProgress, worker })
+ * Runs a list of commands with at most concurrency of them at once (bounded by the
+ * worker threads) and resolves with one result per command, in order:
+ *     { exitCode, stdout, stderr }, or { error: { code, message } } if it couldn't run.
+ * A command is a shell command line or a list of arguments.
+ * With worker: { args, delimiter, cwd, env }, the commands are instead requests sent to
+ * the stdin of long-lived worker processes, which are reused across calls; each result is
+ * { stdout } with the response up to the delimiter line.
+ * onProgress is invoked with (completed commands, commands). The batch rejects with
+ * ABORT_ERR/TIMEOUT_ERR when it is cancelled or times out.
+ */
+addon_value ExecBatch(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "execBatch");
+    UXP_ADDON_TRACE_SCOPE("export", "execBatch");
+    try {
+        size_t argc = 2;
+        addon_value argv[2];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "execBatch expects a list of commands";
+
+        auto commands = std::make_shared<Value>(env, argv[0]);
+        const size_t count = commands->GetList().size();
+        size_t concurrency = WorkerPool::Instance().GetThreadCount();
+        auto token = CancellationToken::Create();
+
+        // Worker process mode
+        std::shared_ptr<ProcessOptions> workerOptions;
+        std::string delimiter;
+
+        std::shared_ptr<ProgressChannel> progress;
+        if (argc >= 2) {
+            concurrency = GetConcurrencyOption(env, argv[1], concurrency);
+            GetBatchOptions(env, argv[1], *token, progress);
+
+            addon_value option = GetOptionalProperty(env, argv[1], "worker");
+            if (option != nullptr) {
+                const Value worker(env, option);
+                const auto& fields = worker.GetMap();
+                workerOptions = std::make_shared<ProcessOptions>();
+                auto field = fields.find("args");
+                if (field == fields.end())
+                    throw "execBatch workers require args";
+                for (const auto& arg : field->second.GetList())
+                    workerOptions->args.push_back(arg.GetString());
+                field = fields.find("delimiter");
+                if (field == fields.end())
+                    throw "execBatch workers require a response delimiter";
+                delimiter = field->second.GetString();
+                field = fields.find("cwd");
+                if (field != fields.end())
+                    workerOptions->cwd = field->second.GetString();
+                field = fields.find("env");
+                if (field != fields.end()) {
+                    for (const auto& variable : field->second.GetMap())
+                        workerOptions->env[variable.first] = variable.second.GetString();
+                }
+            }
+        }
+
+        // Each lane takes the next command until the list is exhausted
+        auto results = std::make_shared<std::vector<std::optional<Value>>>(count);
+        auto done = std::make_shared<std::atomic<size_t>>(0);
+        const auto run = [commands, results, done, progress, workerOptions, delimiter](Task& task, size_t index, size_t) {
+            const auto& list = commands->GetList();
+            const CancellationToken* token = task.GetCancellationToken().get();
+            try {
+                if (workerOptions == nullptr) {
+                    (*results)[index].emplace(RunBatchCommand(list[index], token));
+                } else {
+                    Value result(Value::Kind::map);
+                    result.GetMap().emplace(
+                        "stdout", Value(ProcessPool::Instance().Request(*workerOptions, delimiter, list[index].GetString(), token)));
+                    (*results)[index].emplace(std::move(result));
+                }
+            } catch (const OperationCancelled&) {
+                throw;
+            } catch (...) {
+                Value error(Value::Kind::map);
+                error.GetMap().emplace("code", Value(GetExceptionCode()));
+                error.GetMap().emplace("message", Value(GetExceptionMessage()));
+                Value result(Value::Kind::map);
+                result.GetMap().emplace("error", std::move(error));
+                (*results)[index].emplace(std::move(result));
+            }
+            if (progress != nullptr)
+                progress->Publish(static_cast<double>(++*done), static_cast<double>(list.size()));
+        };
+
+        auto batch = Task::WhenAllLanes(count, concurrency, 1, run, token, progress);
+        batch->Then(Task::Lane::worker, [results](Task& task) {
+            Value list(Value::Kind::list);
+            for (auto& result : *results)
+                list.GetList().push_back(result.has_value() ? std::move(*result) : Value());
+            task.SetResult(std::move(list), false);
+        });
+        return batch->Start(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+Value MediaInfoValue(const std::string& path, const MediaInfo& info) {
+    Value result(Value::Kind::map);
+    auto& fields = result.GetMap();
+    fields.emplace("path", Value(path));
+    fields.emplace("format", Value(info.brand));
+    fields.emplace("duration", Value(info.duration));
+    fields.emplace("faststart", Value(info.faststart));
+    fields.emplace("size", Value(static_cast<double>(info.size)));
+
+    Value tracks(Value::Kind::list);
+    const MediaTrack* video = nullptr;
+    const MediaTrack* audio = nullptr;
+    for (const MediaTrack& track : info.tracks) {
+        if (track.kind == "video" && video == nullptr)
+            video = &track;
+        if (track.kind == "audio" && audio == nullptr)
+            audio = &track;
+
+        Value entry(Value::Kind::map);
+        auto& trackFields = entry.GetMap();
+        trackFields.emplace("id", Value(static_cast<double>(track.id)));
+        trackFields.emplace("kind", Value(track.kind));
+        trackFields.emplace("codec", Value(track.codec));
+        trackFields.emplace("duration", Value(track.duration));
+        trackFields.emplace("sampleCount", Value(static_cast<double>(track.sampleCount)));
+        if (track.kind == "video") {
+            trackFields.emplace("width", Value(static_cast<double>(track.width)));
+            trackFields.emplace("height", Value(static_cast<double>(track.height)));
+            trackFields.emplace("frameRate", Value(track.frameRate));
+            Value keyframes(Value::Kind::list);
+            for (uint64_t offset : track.keyframeOffsets)
+                keyframes.GetList().emplace_back(static_cast<double>(offset));
+            trackFields.emplace("keyframeOffsets", std::move(keyframes));
+        } else if (track.kind == "audio") {
+            trackFields.emplace("sampleRate", Value(static_cast<double>(track.sampleRate)));
+            trackFields.emplace("channels", Value(static_cast<double>(track.channels)));
+        }
+        tracks.GetList().push_back(std::move(entry));
+    }
+
+    // Summary of the first video and audio tracks
+    fields.emplace("width", Value(video != nullptr ? static_cast<double>(video->width) : 0.0));
+    fields.emplace("height", Value(video != nullptr ? static_cast<double>(video->height) : 0.0));
+    fields.emplace("frameRate", Value(video != nullptr ? video->frameRate : 0.0));
+    fields.emplace("videoCodec", video != nullptr ? Value(video->codec) : Value());
+    fields.emplace("audioCodec", audio != nullptr ? Value(audio->codec) : Value());
+    fields.emplace("tracks", std::move(tracks));
+    return result;
+}
+
+/*
+ * Reads the metadata of MP4/MOV files from their box headers, without decoding:
+ *   { path, format, duration, faststart, size, width, height, frameRate, videoCodec,
+ *     audioCodec, tracks: [{ id, kind, codec, duration, sampleCount, ... }] }
+ * Video tracks add width, height, frameRate and keyframeOffsets, the file offsets of
+ * their sync samples; audio tracks add sampleRate and channels. Durations are in seconds.
+ * Takes a path and returns a promise resolving to its metadata, or a list of paths or
+ * a directory and returns a promise resolving to a list with the metadata of each file
+ * (the .mp4, .mov, .m4v, .m4a and .3gp files of a directory, sorted by name). Files of a
+ * list that can't be probed yield { path, error: { code, message } }. The directory is
+ * listed on a worker thread. Takes optional { timeout, onProgress }; onProgress is
+ * invoked with (probed files, files), and the batch rejects with ABORT_ERR/TIMEOUT_ERR
+ * when it is cancelled through promise.signal.cancel() or times out.
+ */
+addon_value ProbeMediaFiles(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "probeMedia");
+    UXP_ADDON_TRACE_SCOPE("export", "probeMedia");
+    try {
+        size_t argc = 2;
+        addon_value argv[2];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "probeMedia expects a path or a list of paths";
+
+        const Value target(env, argv[0]);
+        auto paths = std::make_shared<std::vector<std::string>>();
+        std::string path;
+        if (target.GetKind() == Value::Kind::list) {
+            for (const auto& entry : target.GetList())
+                paths->push_back(entry.GetString());
+        } else {
+            path = target.GetString();
+        }
+
+        auto token = CancellationToken::Create();
+        std::shared_ptr<ProgressChannel> progress;
+        if (argc >= 2)
+            GetBatchOptions(env, argv[1], *token, progress);
+
+        // The first lane lists the directory; a single file resolves to its metadata and
+        // rejects if it can't be probed
+        auto single = std::make_shared<bool>(false);
+        auto results = std::make_shared<std::vector<std::optional<Value>>>();
+        const auto prepare = [paths, path, single, results](Task& task) {
+            // A list of paths is probed as given
+            std::error_code error;
+            if (!path.empty() && !std::filesystem::is_directory(std::filesystem::path(path), error)) {
+                *single = true;
+                paths->push_back(path);
+            } else if (!path.empty()) {
+                for (const auto& entry : std::filesystem::directory_iterator(std::filesystem::path(path))) {
+                    task.ThrowIfCancelled();
+                    if (entry.is_regular_file() && IsMediaFileName(entry.path().string()))
+                        paths->push_back(entry.path().string());
+                }
+                std::sort(paths->begin(), paths->end());
+            }
+            results->resize(paths->size());
+            return paths->size();
+        };
+
+        auto probed = std::make_shared<std::atomic<size_t>>(0);
+        const auto probe = [paths, single, results, probed, progress](Task&, size_t index, size_t) {
+            const std::string& path = (*paths)[index];
+            try {
+                (*results)[index].emplace(MediaInfoValue(path, ProbeMediaFile(path)));
+            } catch (...) {
+                if (*single)
+                    throw;
+                Value error(Value::Kind::map);
+                error.GetMap().emplace("code", Value(GetExceptionCode()));
+                error.GetMap().emplace("message", Value(GetExceptionMessage()));
+                Value result(Value::Kind::map);
+                result.GetMap().emplace("path", Value(path));
+                result.GetMap().emplace("error", std::move(error));
+                (*results)[index].emplace(std::move(result));
+            }
+            if (progress != nullptr)
+                progress->Publish(static_cast<double>(++*probed), static_cast<double>(paths->size()));
+        };
+
+        auto batch = Task::WhenAllLanes(prepare, WorkerPool::Instance().GetThreadCount(), 1, probe, token, progress);
+        batch->Then(Task::Lane::worker, [results, single](Task& task) {
+            if (*single) {
+                task.SetResult(std::move(*results->front()), false);
+                return;
+            }
+            Value list(Value::Kind::list);
+            for (auto& result : *results)
+                list.GetList().push_back(result.has_value() ? std::move(*result) : Value());
+            task.SetResult(std::move(list), false);
+        });
+        return batch->Start(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * Moves the moov box of an MP4/MOV file ahead of its media data, patching the chunk
+ * offsets, so that players can start without reading the whole file. The file is
+ * streamed once, without re-encoding. Takes the path of the file and an optional output
+ * path (the file is replaced by default). Returns a promise resolving to
+ * { path, relocated } where relocated is false if the file was already laid out so.
+ */
+addon_value Faststart(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "faststart");
+    UXP_ADDON_TRACE_SCOPE("export", "faststart");
+    try {
+        size_t argc = 2;
+        addon_value argv[2];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "faststart expects a path";
+
+        const std::string input = GetStringArgument(env, argv[0]);
+        std::string output = input;
+        if (argc >= 2) {
+            addon_valuetype type = addon_undefined;
+            Check(UxpAddonApis.uxp_addon_typeof(env, argv[1], &type));
+            if (type != addon_undefined && type != addon_null)
+                output = GetStringArgument(env, argv[1]);
+        }
+
+        auto task = Task::Create();
+        task->Then(Task::Lane::worker, [input, output](Task& task) {
+            const bool relocated = FaststartFile(input, output);
+            Value result(Value::Kind::map);
+            result.GetMap().emplace("path", Value(output));
+            result.GetMap().emplace("relocated", Value(relocated));
+            task.SetResult(std::move(result), false);
+        });
+        return task->Start(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * Reads the dimensions and format of images from their headers, without decoding.
+ * Takes a list of paths and returns a promise resolving to a list in the same order:
+ * [width, height, format] for each image (format is "png", "jpeg", "webp" or "gif"),
+ * or undefined for files that can't be read or are not a supported image.
+ * The files are read in parallel on the worker threads. Takes optional { timeout,
+ * onProgress, channel }; onProgress is invoked with (probed files, files), and the batch
+ * rejects with ABORT_ERR/TIMEOUT_ERR when it is cancelled or times out.
+ * With channel (see openChannel), each image is streamed instead as a record of type 1
+ * as soon as it is read: index, width and height as 32-bit little-endian integers, then the
+ * format. Unreadable files have no record. The promise then resolves to the number of
+ * records.
+ */
+addon_value ProbeImages(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "probeImages");
+    UXP_ADDON_TRACE_SCOPE("export", "probeImages");
+    try {
+        size_t argc = 2;
+        addon_value argv[2];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "probeImages expects a list of paths";
+
+        const Value list(env, argv[0]);
+        auto paths = std::make_shared<std::vector<std::string>>();
+        for (const auto& path : list.GetList())
+            paths->push_back(path.GetString());
+        auto token = CancellationToken::Create();
+        std::shared_ptr<ProgressChannel> progress;
+        std::shared_ptr<RecordChannel> channel;
+        if (argc >= 2) {
+            GetBatchOptions(env, argv[1], *token, progress);
+            channel = GetChannelOption(env, argv[1]);
+        }
+
+        // Each lane takes the next file until the list is exhausted
+        auto results = std::make_shared<std::vector<ImageInfo>>(paths->size());
+        auto probed = std::make_shared<std::atomic<size_t>>(0);
+        auto streamed = std::make_shared<std::atomic<size_t>>(0);
+        const auto probe = [paths, results, probed, streamed, progress, channel](Task&, size_t index, size_t) {
+            ImageInfo& image = (*results)[index];
+            if (!ProbeImageFile((*paths)[index], image)) {
+                image = ImageInfo();
+            } else if (channel != nullptr) {
+                uint8_t record[12 + 8] = {};
+                const uint32_t fields[3] = {static_cast<uint32_t>(index), image.width, image.height};
+                for (size_t field = 0; field < 3; ++field) {
+                    for (size_t byte = 0; byte < 4; ++byte)
+                        record[field * 4 + byte] = static_cast<uint8_t>(fields[field] >> (byte * 8));
+                }
+                const size_t length = std::min<size_t>(std::strlen(image.format), 8);
+                std::memcpy(record + 12, image.format, length);
+                if (channel->Push(1, record, 12 + length))
+                    ++*streamed;
+            }
+            if (progress != nullptr)
+                progress->Publish(static_cast<double>(++*probed), static_cast<double>(paths->size()));
+        };
+
+        auto batch =
+            Task::WhenAllLanes(paths->size(), WorkerPool::Instance().GetThreadCount(), 1, probe, token, progress);
+        batch->Then(Task::Lane::worker, [results, channel, streamed](Task& task) {
+            if (channel != nullptr) {
+                task.SetResult(Value(static_cast<double>(streamed->load())), false);
+                return;
+            }
+            Value list(Value::Kind::list);
+            for (const ImageInfo& image : *results) {
+                if (image.format == nullptr) {
+                    list.GetList().emplace_back();
+                    continue;
+                }
+                Value entry(Value::Kind::list);
+                entry.GetList().emplace_back(static_cast<double>(image.width));
+                entry.GetList().emplace_back(static_cast<double>(image.height));
+                entry.GetList().emplace_back(std::string(image.format));
+                list.GetList().push_back(std::move(entry));
+            }
+            task.SetResult(std::move(list), false);
+        });
+        return batch->Start(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+// A 64-bit hash as 16 hexadecimal digits
+std::string HashString(uint64_t hash) {
+    char digits[17];
+    std::snprintf(digits, sizeof(digits), "%016llx", static_cast<unsigned long long>(hash));
+    return digits;
+}
+
+// Hashes the images of paths on the worker threads into results, in lanes that each take
+// the next file until the list is exhausted. Returns the join of the lanes, not started.
+std::shared_ptr<Task> HashImages(std::shared_ptr<std::vector<std::string>> paths,
+                                 std::shared_ptr<std::vector<std::optional<PerceptualHash>>> results,
+                                 std::shared_ptr<CancellationToken> token,
+                                 std::shared_ptr<ProgressChannel> progress) {
+    auto hashed = std::make_shared<std::atomic<size_t>>(0);
+    const auto hash = [paths, results, hashed, progress](Task&, size_t index, size_t) {
+        PerceptualHash value;
+        if (HashIndex::Instance().Get((*paths)[index], value))
+            (*results)[index] = value;
+        const size_t done = ++*hashed;
+        if (progress != nullptr)
+            progress->Publish(static_cast<double>(done), static_cast<double>(paths->size()));
+    };
+    return Task::WhenAllLanes(paths->size(), WorkerPool::Instance().GetThreadCount(), 1, hash, std::move(token),
+                              std::move(progress));
+}
+
+/*
+ * perceptualHash(paths, { timeout, onProgress })
+ * Computes the perceptual hashes of images (PNG or JPEG) on the worker threads. Returns a
+ * promise resolving to a list in the same order: { dhash, phash } for each image, as 16
+ * hexadecimal digits, or undefined for files that can't be read or decoded. Images that
+ * look alike have hashes that differ by few bits. The hashes are kept by path for
+ * findNearDuplicates, and an image is decoded again only when its file changed.
+ * onProgress is invoked with (hashed files, files).
+ */
+addon_value PerceptualHashes(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "perceptualHash");
+    UXP_ADDON_TRACE_SCOPE("export", "perceptualHash");
+    try {
+        size_t argc = 2;
+        addon_value argv[2];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "perceptualHash expects a list of paths";
+
+        const Value list(env, argv[0]);
+        auto paths = std::make_shared<std::vector<std::string>>();
+        for (const auto& path : list.GetList())
+            paths->push_back(path.GetString());
+
+        auto token = CancellationToken::Create();
+        std::shared_ptr<ProgressChannel> progress;
+        if (argc >= 2)
+            GetBatchOptions(env, argv[1], *token, progress);
+
+        auto results = std::make_shared<std::vector<std::optional<PerceptualHash>>>(paths->size());
+        auto batch = HashImages(paths, results, token, progress);
+        batch->Then(Task::Lane::worker, [results](Task& task) {
+            Value list(Value::Kind::list);
+            for (const auto& hash : *results) {
+                if (!hash.has_value()) {
+                    list.GetList().emplace_back();
+                    continue;
+                }
+                Value entry(Value::Kind::map);
+                entry.GetMap().emplace("dhash", Value(HashString(hash->dhash)));
+                entry.GetMap().emplace("phash", Value(HashString(hash->phash)));
+                list.GetList().push_back(std::move(entry));
+            }
+            task.SetResult(std::move(list), false);
+        });
+        return batch->Start(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * findNearDuplicates(threshold, { paths, timeout, onProgress })
+ * Groups images whose pHash differ by at most threshold bits (about 8 finds resized and
+ * recompressed copies; unrelated images differ by about 32). With paths, the images are
+ * hashed first as by perceptualHash; without, all the images hashed so far are grouped.
+ * Returns a promise resolving to a list of groups, each a sorted list of at least 2 paths.
+ * An image is grouped with any image within threshold of one of the group, so groups
+ * don't overlap.
+ */
+addon_value FindNearDuplicates(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "findNearDuplicates");
+    UXP_ADDON_TRACE_SCOPE("export", "findNearDuplicates");
+    try {
+        size_t argc = 2;
+        addon_value argv[2];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "findNearDuplicates expects a threshold";
+
+        double threshold = 0;
+        Check(UxpAddonApis.uxp_addon_get_value_double(env, argv[0], &threshold));
+        if (!(threshold >= 0 && threshold <= 64))
+            throw "findNearDuplicates threshold must be between 0 and 64";
+
+        auto paths = std::make_shared<std::vector<std::string>>();
+        auto token = CancellationToken::Create();
+        std::shared_ptr<ProgressChannel> progress;
+        if (argc >= 2) {
+            GetBatchOptions(env, argv[1], *token, progress);
+            addon_value list = GetOptionalProperty(env, argv[1], "paths");
+            if (list != nullptr) {
+                const Value entries(env, list);
+                for (const auto& path : entries.GetList())
+                    paths->push_back(path.GetString());
+            }
+        }
+
+        auto results = std::make_shared<std::vector<std::optional<PerceptualHash>>>(paths->size());
+        auto batch = HashImages(paths, results, token, progress);
+        batch->Then(Task::Lane::worker, [paths, bits = static_cast<unsigned>(threshold)](Task& task) {
+            Value list(Value::Kind::list);
+            for (const auto& group : HashIndex::Instance().FindNearDuplicates(bits, *paths)) {
+                Value entry(Value::Kind::list);
+                for (const auto& path : group)
+                    entry.GetList().push_back(Value(path));
+                list.GetList().push_back(std::move(entry));
+            }
+            task.SetResult(std::move(list), false);
+        });
+        return batch->Start(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+// An image argument: a path, or the bytes of an ArrayBuffer or DataView, copied so that
+// they can be decoded on a worker thread
+struct ImageSource {
+    std::string path;
+    std::optional<std::string> data;
+};
+
+ImageSource GetImageSource(addon_env env, addon_value value) {
+    ImageSource source;
+    void* data = nullptr;
+    size_t length = 0;
+    bool isBuffer = false;
+    Check(UxpAddonApis.uxp_addon_is_arraybuffer(env, value, &isBuffer));
+    bool isView = false;
+    if (!isBuffer)
+        Check(UxpAddonApis.uxp_addon_is_dataview(env, value, &isView));
+    if (isBuffer)
+        Check(UxpAddonApis.uxp_addon_get_arraybuffer_info(env, value, &data, &length));
+    else if (isView)
+        Check(UxpAddonApis.uxp_addon_get_dataview_info(env, value, &length, &data, nullptr, nullptr));
+    else
+        source.path = GetStringArgument(env, value);
+    if (isBuffer || isView)
+        source.data = std::string(static_cast<const char*>(data), length);
+    return source;
+}
+
+Bitmap DecodeImageSource(const ImageSource& source) {
+    Bitmap bitmap;
+    const bool decoded = source.data.has_value()
+                             ? DecodeImage(reinterpret_cast<const uint8_t*>(source.data->data()), source.data->size(), bitmap)
+                             : DecodeImageFile(source.path, bitmap);
+    if (!decoded)
+        throw "The image can't be read or isn't a supported PNG or JPEG";
+    return bitmap;
+}
+
+// A number option, or fallback when it is missing. Throws message if it isn't within
+// minimum and maximum.
+double GetNumberOption(addon_env env, addon_value options, const char* name, double fallback, double minimum, double maximum, const char* message) {
+    addon_value value = GetOptionalProperty(env, options, name);
+    if (value == nullptr)
+        return fallback;
+    double number = 0;
+    Check(UxpAddonApis.uxp_addon_get_value_double(env, value, &number));
+    if (!(number >= minimum && number <= maximum))
+        throw message;
+    return number;
+}
+
+std::string GetStringOption(addon_env env, addon_value options, const char* name, const std::string& fallback) {
+    addon_value value = GetOptionalProperty(env, options, name);
+    return value == nullptr ? fallback : GetStringArgument(env, value);
+}
+
+bool GetBooleanOption(addon_env env, addon_value options, const char* name) {
+    addon_value value = GetOptionalProperty(env, options, name);
+    bool flag = false;
+    if (value != nullptr)
+        Check(UxpAddonApis.uxp_addon_get_value_bool(env, value, &flag));
+    return flag;
+}
+
+// Resolves the task with result and an ArrayBuffer of data as its name property.
+// ArrayBuffers can only be created on the JavaScript thread, so the result is converted by
+// the result handler.
+void SetResultWithBuffer(Task& task, Value&& result, const char* name, std::string data) {
+    auto shared = std::make_shared<Value>(std::move(result));
+    auto contents = std::make_shared<std::string>(std::move(data));
+    task.ScheduleOnScriptingThread([shared, name, contents](Task&, addon_env env, addon_deferred deferred) {
+        if (deferred == nullptr)
+            return;
+
+        HandlerScope scope(env);
+        addon_value result = nullptr;
+        try {
+            result = shared->Convert(env);
+            Check(UxpAddonApis.uxp_addon_set_named_property(env, result, name, CreateArrayBuffer(env, *contents)));
+        } catch (...) {
+            Check(UxpAddonApis.uxp_addon_reject_deferred(env, deferred, CreateErrorFromException(env)));
+            return;
+        }
+        Check(UxpAddonApis.uxp_addon_resolve_deferred(env, deferred, result));
+    });
+}
+
+// Resolves the task with result and an ArrayBuffer of each of data as the name property
+// of the elements of its list property, as by SetResultWithBuffer
+void SetResultWithBuffers(Task& task, Value&& result, const char* list, const char* name, std::vector<std::string> data) {
+    auto shared = std::make_shared<Value>(std::move(result));
+    auto contents = std::make_shared<std::vector<std::string>>(std::move(data));
+    task.ScheduleOnScriptingThread([shared, list, name, contents](Task&, addon_env env, addon_deferred deferred) {
+        if (deferred == nullptr)
+            return;
+
+        HandlerScope scope(env);
+        addon_value result = nullptr;
+        try {
+            result = shared->Convert(env);
+            addon_value elements = nullptr;
+            Check(UxpAddonApis.uxp_addon_get_named_property(env, result, list, &elements));
+            for (size_t index = 0; index < contents->size(); ++index) {
+                addon_value element = nullptr;
+                Check(UxpAddonApis.uxp_addon_get_element(env, elements, static_cast<uint32_t>(index), &element));
+                Check(UxpAddonApis.uxp_addon_set_named_property(env, element, name, CreateArrayBuffer(env, (*contents)[index])));
+            }
+        } catch (...) {
+            Check(UxpAddonApis.uxp_addon_reject_deferred(env, deferred, CreateErrorFromException(env)));
+            return;
+        }
+        Check(UxpAddonApis.uxp_addon_resolve_deferred(env, deferred, result));
+    });
+}
+
+// Resolves the task with { width, height, path } once data is written to output, or with
+// { width, height, data } where data is an ArrayBuffer when there is no output
+void SetImageResult(Task& task, uint32_t width, uint32_t height, std::string data, const std::string& output) {
+    Value result(Value::Kind::map);
+    result.GetMap().emplace("width", Value(static_cast<double>(width)));
+    result.GetMap().emplace("height", Value(static_cast<double>(height)));
+    if (output.empty()) {
+        SetResultWithBuffer(task, std::move(result), "data", std::move(data));
+        return;
+    }
+    if (!WriteFileContents(output, data, WriteOptions()))
+        throw "Unable to write the image";
+    result.GetMap().emplace("path", Value(output));
+    task.SetResult(std::move(result), false);
+}
+
+/*
+ * prepareMask(source, { channel, threshold, dilate, feather, invert, format, output })
+ * Prepares a mask from an image (a path, or PNG/JPEG bytes in an ArrayBuffer or DataView)
+ * on a worker thread, in this order:
+ *     channel: "alpha", "luma" or "auto" (the default: alpha if the image has transparent
+ *         pixels, luma otherwise),
+ *     threshold: 0 to 255, values at least threshold become 255 and the others 0,
+ *     dilate: pixels to grow the mask by (-1000 to 1000, negative values shrink it),
+ *     feather: the sigma of the blur of its edges, in pixels (0 to 100),
+ *     invert: whether to keep what the mask removes.
+ * Resolves with { width, height, path } once written to output, or with
+ * { width, height, data } where data is an ArrayBuffer. format is "png" (grayscale, the
+ * default) or "gray" for one byte per pixel.
+ */
+addon_value PrepareMask(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "prepareMask");
+    UXP_ADDON_TRACE_SCOPE("export", "prepareMask");
+    try {
+        size_t argc = 2;
+        addon_value argv[2];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "prepareMask expects an image";
+
+        auto source = std::make_shared<ImageSource>(GetImageSource(env, argv[0]));
+        addon_value options = argc >= 2 ? argv[1] : nullptr;
+        const std::string channelName = options != nullptr ? GetStringOption(env, options, "channel", "auto") : "auto";
+        MaskChannel channel = MaskChannel::automatic;
+        if (channelName == "alpha")
+            channel = MaskChannel::alpha;
+        else if (channelName == "luma")
+            channel = MaskChannel::luma;
+        else if (channelName != "auto")
+            throw "prepareMask channel must be \"auto\", \"alpha\" or \"luma\"";
+        double threshold = -1, dilate = 0, feather = 0;
+        bool invert = false;
+        std::string format = "png", output;
+        if (options != nullptr) {
+            threshold = GetNumberOption(env, options, "threshold", -1, 0, 255, "prepareMask threshold must be between 0 and 255");
+            dilate = GetNumberOption(env, options, "dilate", 0, -1000, 1000, "prepareMask dilate must be between -1000 and 1000");
+            feather = GetNumberOption(env, options, "feather", 0, 0, 100, "prepareMask feather must be between 0 and 100");
+            invert = GetBooleanOption(env, options, "invert");
+            format = GetStringOption(env, options, "format", format);
+            output = GetStringOption(env, options, "output", output);
+        }
+        if (format != "png" && format != "gray")
+            throw "prepareMask format must be \"png\" or \"gray\"";
+
+        auto task = Task::Create();
+        task->Then(Task::Lane::worker, [=](Task& task) {
+            Mask mask = ExtractMask(DecodeImageSource(*source), channel);
+            if (threshold >= 0)
+                ThresholdMask(mask, static_cast<uint8_t>(threshold));
+            DilateMask(mask, static_cast<int>(dilate));
+            FeatherMask(mask, feather);
+            if (invert)
+                InvertMask(mask);
+            std::string data = format == "png" ? EncodePng(mask.values.data(), mask.width, mask.height, 1)
+                                               : std::string(mask.values.begin(), mask.values.end());
+            SetImageResult(task, mask.width, mask.height, std::move(data), output);
+        });
+        return task->Start(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+// "#rrggbb" or "#rrggbbaa"
+bool ParseColor(const std::string& text, uint8_t color[4]) {
+    if ((text.size() != 7 && text.size() != 9) || text[0] != '#')
+        return false;
+    color[3] = 255;
+    for (size_t index = 1; index < text.size(); index += 2) {
+        unsigned value = 0;
+        for (size_t digit = index; digit < index + 2; ++digit) {
+            const char c = static_cast<char>(std::tolower(static_cast<unsigned char>(text[digit])));
+            if (!std::isxdigit(static_cast<unsigned char>(c)))
+                return false;
+            value = value * 16 + (c <= '9' ? c - '0' : c - 'a' + 10);
+        }
+        color[index / 2] = static_cast<uint8_t>(value);
+    }
+    return true;
+}
+
+/*
+ * compositeImage(source, { mask, background, premultiplied, format, output })
+ * Cuts out and composites an image (a path, or PNG/JPEG bytes in an ArrayBuffer or
+ * DataView) on a worker thread: its alpha is multiplied by the mask, an image whose alpha
+ * or luma is used as by prepareMask and which is resized to the source when it differs,
+ * then it is composited over the background, a "#rrggbb" or "#rrggbbaa" color or an image
+ * resized to the source. Both are optional.
+ * Resolves with { width, height, path } once written to output, or with
+ * { width, height, data } where data is an ArrayBuffer. format is "png" (the default,
+ * RGB when every pixel is opaque) or "rgba" for 4 bytes per pixel, premultiplied by alpha
+ * with premultiplied.
+ */
+addon_value CompositeImage(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "compositeImage");
+    UXP_ADDON_TRACE_SCOPE("export", "compositeImage");
+    try {
+        size_t argc = 2;
+        addon_value argv[2];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "compositeImage expects an image";
+
+        auto source = std::make_shared<ImageSource>(GetImageSource(env, argv[0]));
+        std::shared_ptr<ImageSource> mask, background;
+        std::optional<std::array<uint8_t, 4>> color;
+        bool premultiplied = false;
+        std::string format = "png", output;
+        if (argc >= 2) {
+            addon_value value = GetOptionalProperty(env, argv[1], "mask");
+            if (value != nullptr)
+                mask = std::make_shared<ImageSource>(GetImageSource(env, value));
+            value = GetOptionalProperty(env, argv[1], "background");
+            if (value != nullptr) {
+                addon_valuetype type = addon_undefined;
+                Check(UxpAddonApis.uxp_addon_typeof(env, value, &type));
+                const std::string text = type == addon_string ? GetStringArgument(env, value) : std::string();
+                if (!text.empty() && text[0] == '#') {
+                    color.emplace();
+                    if (!ParseColor(text, color->data()))
+                        throw "compositeImage background colors are \"#rrggbb\" or \"#rrggbbaa\"";
+                } else {
+                    background = std::make_shared<ImageSource>(GetImageSource(env, value));
+                }
+            }
+            premultiplied = GetBooleanOption(env, argv[1], "premultiplied");
+            format = GetStringOption(env, argv[1], "format", format);
+            output = GetStringOption(env, argv[1], "output", output);
+        }
+        if (format != "png" && format != "rgba")
+            throw "compositeImage format must be \"png\" or \"rgba\"";
+
+        auto task = Task::Create();
+        task->Then(Task::Lane::worker, [=](Task& task) {
+            Bitmap bitmap = DecodeImageSource(*source);
+            if (mask != nullptr)
+                ApplyMask(bitmap, ExtractMask(DecodeImageSource(*mask), MaskChannel::automatic));
+            PremultiplyBitmap(bitmap);
+            if (color.has_value()) {
+                CompositeOverColor(bitmap, color->data());
+            } else if (background != nullptr) {
+                Bitmap behind = DecodeImageSource(*background);
+                if (behind.width != bitmap.width || behind.height != bitmap.height)
+                    behind = ResizeBitmap(behind, bitmap.width, bitmap.height);
+                PremultiplyBitmap(behind);
+                CompositeOver(bitmap, behind);
+            }
+            if (format == "rgba") {
+                if (!premultiplied)
+                    UnpremultiplyBitmap(bitmap);
+                SetImageResult(task, bitmap.width, bitmap.height, std::string(bitmap.pixels.begin(), bitmap.pixels.end()), output);
+                return;
+            }
+
+            UnpremultiplyBitmap(bitmap);
+            if (IsOpaque(bitmap)) {
+                // RGB, a quarter smaller before compression
+                const size_t count = size_t(bitmap.width) * bitmap.height;
+                for (size_t index = 0; index < count; ++index)
+                    std::memmove(&bitmap.pixels[index * 3], &bitmap.pixels[index * 4], 3);
+                SetImageResult(task, bitmap.width, bitmap.height, EncodePng(bitmap.pixels.data(), bitmap.width, bitmap.height, 3), output);
+                return;
+            }
+            SetImageResult(task, bitmap.width, bitmap.height, EncodePng(bitmap.pixels.data(), bitmap.width, bitmap.height, 4), output);
+        });
+        return task->Start(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * diffImages(a, b, { tolerance, tileSize, mask, output })
+ * Finds what changed between two versions of an image (paths, or PNG/JPEG bytes in
+ * ArrayBuffers or DataViews), decoded in parallel on the worker threads; b is resized to
+ * a when their sizes differ. A pixel changed when one of its components differs by more
+ * than tolerance (0 to 255, 0 by default). Resolves with
+ *     { width, height, tileSize, changedPixels, regions: [{ x, y, width, height, pixels }] }
+ * where the regions are the bounds of touching changed tiles of tileSize pixels (8 to
+ * 1024, 32 by default), so that only their tiles need to be stored. With mask, the result
+ * also has mask, an ArrayBuffer with a grayscale PNG that is white where pixels changed;
+ * with output, that PNG is written there instead and the result has maskPath.
+ */
+addon_value DiffImages(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "diffImages");
+    UXP_ADDON_TRACE_SCOPE("export", "diffImages");
+    try {
+        size_t argc = 3;
+        addon_value argv[3];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 2)
+            throw "diffImages expects two images";
+
+        const std::shared_ptr<ImageSource> sources[2] = {std::make_shared<ImageSource>(GetImageSource(env, argv[0])),
+                                                         std::make_shared<ImageSource>(GetImageSource(env, argv[1]))};
+        double tolerance = 0, tileSize = 32;
+        bool mask = false;
+        std::string output;
+        if (argc >= 3) {
+            tolerance = GetNumberOption(env, argv[2], "tolerance", tolerance, 0, 255, "diffImages tolerance must be between 0 and 255");
+            tileSize = GetNumberOption(env, argv[2], "tileSize", tileSize, 8, 1024, "diffImages tileSize must be between 8 and 1024");
+            mask = GetBooleanOption(env, argv[2], "mask");
+            output = GetStringOption(env, argv[2], "output", output);
+        }
+
+        auto bitmaps = std::make_shared<std::array<Bitmap, 2>>();
+        std::vector<std::shared_ptr<Task>> decodes;
+        for (size_t index = 0; index < 2; ++index) {
+            auto task = Task::Create();
+            task->Then(Task::Lane::worker, [bitmaps, source = sources[index], index](Task&) {
+                (*bitmaps)[index] = DecodeImageSource(*source);
+            });
+            decodes.push_back(task);
+        }
+
+        auto batch = Task::WhenAll(std::move(decodes));
+        batch->Then(Task::Lane::worker, [=](Task& task) {
+            const Bitmap& original = (*bitmaps)[0];
+            Bitmap& corrected = (*bitmaps)[1];
+            if (corrected.width != original.width || corrected.height != original.height)
+                corrected = ResizeBitmap(corrected, original.width, original.height);
+            const bool keepMask = mask || !output.empty();
+            const auto tile = static_cast<uint32_t>(tileSize);
+            const ImageDifference difference = DiffBitmaps(original, corrected, static_cast<uint8_t>(tolerance), tile, keepMask);
+
+            Value result(Value::Kind::map);
+            result.GetMap().emplace("width", Value(static_cast<double>(original.width)));
+            result.GetMap().emplace("height", Value(static_cast<double>(original.height)));
+            result.GetMap().emplace("tileSize", Value(static_cast<double>(tile)));
+            result.GetMap().emplace("changedPixels", Value(static_cast<double>(difference.changedPixels)));
+            Value regions(Value::Kind::list);
+            for (const DifferenceRegion& region : difference.regions) {
+                Value entry(Value::Kind::map);
+                entry.GetMap().emplace("x", Value(static_cast<double>(region.x)));
+                entry.GetMap().emplace("y", Value(static_cast<double>(region.y)));
+                entry.GetMap().emplace("width", Value(static_cast<double>(region.width)));
+                entry.GetMap().emplace("height", Value(static_cast<double>(region.height)));
+                entry.GetMap().emplace("pixels", Value(static_cast<double>(region.pixels)));
+                regions.GetList().push_back(std::move(entry));
+            }
+            result.GetMap().emplace("regions", std::move(regions));
+            if (!keepMask) {
+                task.SetResult(std::move(result), false);
+                return;
+            }
+
+            std::string png = EncodePng(difference.mask.values.data(), difference.mask.width, difference.mask.height, 1);
+            if (!output.empty()) {
+                if (!WriteFileContents(output, png, WriteOptions()))
+                    throw "Unable to write the mask";
+                result.GetMap().emplace("maskPath", Value(output));
+                task.SetResult(std::move(result), false);
+                return;
+            }
+            SetResultWithBuffer(task, std::move(result), "mask", std::move(png));
+        });
+        return batch->Start(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+// The state of the lanes building an atlas
+struct AtlasBuild {
+    AtlasBuild(std::vector<std::string> paths, const AtlasOptions& options)
+        : paths(std::move(paths)),
+          options(options),
+          layout(this->paths.size(), options.tileWidth, options.tileHeight),
+          sheets(layout.GetSheetCount()),
+          allocated(new std::once_flag[sheets.size()]),
+          remaining(new std::atomic<size_t>[sheets.size()]) {
+        atlas.sheets.resize(sheets.size());
+        atlas.drawn.resize(this->paths.size(), 0);
+        for (size_t sheet = 0; sheet < sheets.size(); ++sheet)
+            remaining[sheet] = layout.GetTileCount(sheet);
+    }
+
+    const std::vector<std::string> paths;
+    const AtlasOptions options;
+    const AtlasLayout layout;
+    // Where the atlas is cached, if the images are in the same directory
+    std::string directory;
+    std::string name;
+    uint64_t stamp{0};
+    std::once_flag loaded;
+    bool cached{false};
+    Atlas atlas;
+    // Each sheet is allocated with its first tile, then encoded and released by the lane
+    // that draws its last tile
+    std::vector<Bitmap> sheets;
+    std::unique_ptr<std::once_flag[]> allocated;
+    std::unique_ptr<std::atomic<size_t>[]> remaining;
+    std::atomic<size_t> done{0};
+};
+
+/*
+ * buildAtlas(paths, { tileWidth, tileHeight, fit, background, quality, cache, timeout, onProgress })
+ * Draws thumbnails of images (PNG or JPEG) into JPEG sprite sheets, so that a gallery page
+ * is drawn from one or a few images. The images are decoded and resized in parallel on the
+ * worker threads, each in a tile of tileWidth x tileHeight pixels (16 to 1024, 256 by
+ * default): fit "cover" (the default) crops the image to the tile, "contain" fits it
+ * within. background is the "#rrggbb" color behind transparent pixels and empty tiles
+ * (black by default), quality that of the JPEG sheets (1 to 100, 85 by default). Resolves
+ * with
+ *     { tileWidth, tileHeight, cached, sheets: [{ width, height, data }], tiles: [{ sheet, x, y }] }
+ * where data is an ArrayBuffer with a JPEG file and tiles has an entry per path, in the
+ * same order, undefined for files that can't be read or decoded. Sheets are at most 4096
+ * pixels wide and high.
+ * When the images are all in the same directory, their atlas is kept in its pack file
+ * and reused until one of the images changes (cached is then true), unless cache is false.
+ * The pack keeps one atlas per directory: building another replaces it.
+ * onProgress is invoked with (drawn tiles, tiles).
+ */
+addon_value BuildAtlas(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "buildAtlas");
+    UXP_ADDON_TRACE_SCOPE("export", "buildAtlas");
+    try {
+        size_t argc = 2;
+        addon_value argv[2];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "buildAtlas expects a list of paths";
+
+        const Value list(env, argv[0]);
+        std::vector<std::string> paths;
+        for (const auto& path : list.GetList())
+            paths.push_back(path.GetString());
+
+        AtlasOptions options;
+        bool cache = true;
+        auto token = CancellationToken::Create();
+        std::shared_ptr<ProgressChannel> progress;
+        if (argc >= 2) {
+            options.tileWidth = static_cast<uint32_t>(
+                GetNumberOption(env, argv[1], "tileWidth", options.tileWidth, 16, 1024, "buildAtlas tileWidth must be between 16 and 1024"));
+            options.tileHeight = static_cast<uint32_t>(
+                GetNumberOption(env, argv[1], "tileHeight", options.tileHeight, 16, 1024, "buildAtlas tileHeight must be between 16 and 1024"));
+            const std::string fit = GetStringOption(env, argv[1], "fit", "cover");
+            if (fit == "contain")
+                options.fit = AtlasFit::contain;
+            else if (fit != "cover")
+                throw "buildAtlas fit must be \"cover\" or \"contain\"";
+            const std::string background = GetStringOption(env, argv[1], "background", "#000000");
+            uint8_t color[4];
+            if (background.size() != 7 || !ParseColor(background, color))
+                throw "buildAtlas background must be a \"#rrggbb\" color";
+            std::copy(color, color + 3, options.background);
+            options.quality = static_cast<unsigned>(
+                GetNumberOption(env, argv[1], "quality", options.quality, 1, 100, "buildAtlas quality must be between 1 and 100"));
+            addon_value value = GetOptionalProperty(env, argv[1], "cache");
+            if (value != nullptr)
+                Check(UxpAddonApis.uxp_addon_get_value_bool(env, value, &cache));
+            GetBatchOptions(env, argv[1], *token, progress);
+        }
+
+        auto build = std::make_shared<AtlasBuild>(std::move(paths), options);
+        if (cache) {
+            build->directory = GetAtlasDirectory(build->paths);
+            build->name = GetAtlasName(build->paths, options);
+        }
+
+        // Each lane takes the next tile until the list is exhausted. The first lane to
+        // start looks for the atlas in the cache while the others wait.
+        const auto draw = [build, progress](Task&, size_t index, size_t) {
+            std::call_once(build->loaded, [&build] {
+                if (build->directory.empty())
+                    return;
+                build->stamp = GetAtlasStamp(build->paths);
+                build->cached = LoadAtlas(build->directory, build->name, build->stamp, build->layout, build->atlas);
+            });
+            if (build->cached)
+                return;
+
+            const uint32_t minSize = std::max(build->options.tileWidth, build->options.tileHeight);
+            const AtlasLayout::Place place = build->layout.Locate(index);
+            Bitmap& sheet = build->sheets[place.sheet];
+            std::call_once(build->allocated[place.sheet], [&] {
+                sheet = CreateSheet(build->layout.GetSheetWidth(place.sheet), build->layout.GetSheetHeight(place.sheet), build->options);
+            });
+            Bitmap image;
+            if (DecodeImageFile(build->paths[index], image, minSize)) {
+                DrawTile(sheet, place.x, place.y, image, build->options);
+                build->atlas.drawn[index] = 1;
+            }
+            if (--build->remaining[place.sheet] == 0) {
+                build->atlas.sheets[place.sheet] = EncodeJpeg(sheet.pixels.data(), sheet.width, sheet.height, build->options.quality);
+                sheet = Bitmap();
+            }
+            const size_t done = ++build->done;
+            if (progress != nullptr)
+                progress->Publish(static_cast<double>(done), static_cast<double>(build->paths.size()));
+        };
+
+        auto batch = Task::WhenAllLanes(build->paths.size(), WorkerPool::Instance().GetThreadCount(), 1, draw, token, progress);
+        batch->Then(Task::Lane::worker, [build](Task& task) {
+            if (!build->cached && !build->directory.empty())
+                StoreAtlas(build->directory, build->name, build->stamp, build->atlas);
+
+            Value result(Value::Kind::map);
+            result.GetMap().emplace("tileWidth", Value(static_cast<double>(build->options.tileWidth)));
+            result.GetMap().emplace("tileHeight", Value(static_cast<double>(build->options.tileHeight)));
+            result.GetMap().emplace("cached", Value(build->cached));
+            Value sheets(Value::Kind::list);
+            for (size_t sheet = 0; sheet < build->atlas.sheets.size(); ++sheet) {
+                Value entry(Value::Kind::map);
+                entry.GetMap().emplace("width", Value(static_cast<double>(build->layout.GetSheetWidth(sheet))));
+                entry.GetMap().emplace("height", Value(static_cast<double>(build->layout.GetSheetHeight(sheet))));
+                sheets.GetList().push_back(std::move(entry));
+            }
+            result.GetMap().emplace("sheets", std::move(sheets));
+            Value tiles(Value::Kind::list);
+            for (size_t index = 0; index < build->paths.size(); ++index) {
+                if (!build->atlas.drawn[index]) {
+                    tiles.GetList().emplace_back();
+                    continue;
+                }
+                const AtlasLayout::Place place = build->layout.Locate(index);
+                Value entry(Value::Kind::map);
+                entry.GetMap().emplace("sheet", Value(static_cast<double>(place.sheet)));
+                entry.GetMap().emplace("x", Value(static_cast<double>(place.x)));
+                entry.GetMap().emplace("y", Value(static_cast<double>(place.y)));
+                tiles.GetList().push_back(std::move(entry));
+            }
+            result.GetMap().emplace("tiles", std::move(tiles));
+            SetResultWithBuffers(task, std::move(result), "sheets", "data", std::move(build->atlas.sheets));
+        });
+        return batch->Start(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * placeholders(paths, { componentsX, componentsY, timeout, onProgress })
+ * Computes what a gallery paints while images (PNG or JPEG) load, on the worker threads,
+ * from a reduction of each image (JPEGs are decoded at 1/8). Returns a promise resolving
+ * to a list in the same order: { blurhash, color } for each image, where blurhash is a
+ * BlurHash string and color the "#rrggbb" dominant color of the image, or undefined for
+ * files that can't be read or decoded. componentsX and componentsY (1 to 9) are the
+ * BlurHash components along the width and height; by default 4 along the longer side and
+ * 3 along the other. Both are small enough to be stored in a sidecar or a catalog.
+ * onProgress is invoked with (computed files, files).
+ */
+addon_value Placeholders(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "placeholders");
+    UXP_ADDON_TRACE_SCOPE("export", "placeholders");
+    try {
+        size_t argc = 2;
+        addon_value argv[2];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "placeholders expects a list of paths";
+
+        const Value list(env, argv[0]);
+        auto paths = std::make_shared<std::vector<std::string>>();
+        for (const auto& path : list.GetList())
+            paths->push_back(path.GetString());
+
+        double componentsX = 0, componentsY = 0;
+        auto token = CancellationToken::Create();
+        std::shared_ptr<ProgressChannel> progress;
+        if (argc >= 2) {
+            componentsX = GetNumberOption(env, argv[1], "componentsX", 0, 1, 9, "placeholders componentsX must be between 1 and 9");
+            componentsY = GetNumberOption(env, argv[1], "componentsY", 0, 1, 9, "placeholders componentsY must be between 1 and 9");
+            if ((componentsX == 0) != (componentsY == 0))
+                throw "placeholders expects both componentsX and componentsY";
+            GetBatchOptions(env, argv[1], *token, progress);
+        }
+
+        // Each lane takes the next file until the list is exhausted
+        auto results = std::make_shared<std::vector<std::optional<Placeholder>>>(paths->size());
+        auto computed = std::make_shared<std::atomic<size_t>>(0);
+        const auto compute = [=](Task&, size_t index, size_t) {
+            Bitmap bitmap;
+            if (DecodeImageFile((*paths)[index], bitmap, kPlaceholderSize))
+                (*results)[index] = ComputePlaceholder(bitmap, static_cast<unsigned>(componentsX), static_cast<unsigned>(componentsY));
+            const size_t done = ++*computed;
+            if (progress != nullptr)
+                progress->Publish(static_cast<double>(done), static_cast<double>(paths->size()));
+        };
+
+        auto batch = Task::WhenAllLanes(paths->size(), WorkerPool::Instance().GetThreadCount(), 1, compute, token, progress);
+        batch->Then(Task::Lane::worker, [results](Task& task) {
+            Value list(Value::Kind::list);
+            for (const auto& placeholder : *results) {
+                if (!placeholder.has_value()) {
+                    list.GetList().emplace_back();
+                    continue;
+                }
+                char color[8];
+                std::snprintf(color, sizeof(color), "#%02x%02x%02x", placeholder->color[0], placeholder->color[1], placeholder->color[2]);
+                Value entry(Value::Kind::map);
+                entry.GetMap().emplace("blurhash", Value(placeholder->blurHash));
+                entry.GetMap().emplace("color", Value(std::string(color)));
+                list.GetList().push_back(std::move(entry));
+            }
+            task.SetResult(std::move(list), false);
+        });
+        return batch->Start(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+Value MediaServerValue(const MediaServer::Info& server) {
+    Value result(Value::Kind::map);
+    result.GetMap().emplace("url", Value(server.url));
+    result.GetMap().emplace("root", Value(server.root));
+    result.GetMap().emplace("port", Value(static_cast<double>(server.port)));
+    return result;
+}
+
+/*
+ * Starts serving the files under the storage root (or { root }) over HTTP on
+ * 127.0.0.1, on { port } or a free port. Returns { url, root, port } where url is the
+ * base URL of the files, including a random token; see getMediaUrl. Calling it again
+ * returns the running server unless the root or port differ.
+ */
+addon_value StartMediaServer(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "startMediaServer");
+    UXP_ADDON_TRACE_SCOPE("export", "startMediaServer");
+    try {
+        size_t argc = 1;
+        addon_value argv[1];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+
+        std::string root;
+        double port = 0;
+        if (argc >= 1) {
+            addon_value rootValue = GetOptionalProperty(env, argv[0], "root");
+            if (rootValue != nullptr)
+                root = GetStringArgument(env, rootValue);
+            addon_value portValue = GetOptionalProperty(env, argv[0], "port");
+            if (portValue != nullptr)
+                Check(UxpAddonApis.uxp_addon_get_value_double(env, portValue, &port));
+        }
+        if (!(port >= 0 && port <= 65535))
+            throw "startMediaServer port is out of range";
+        if (root.empty()) {
+            const auto storagePath = ResolveDefaultStoragePath();
+            std::error_code ec;
+            std::filesystem::create_directories(storagePath, ec);
+            root = storagePath.string();
+        }
+
+        const MediaServer::Info server = MediaServer::Instance().Start(root, static_cast<uint16_t>(port));
+        return MediaServerValue(server).Convert(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * Stops the media server; its URLs stop working.
+ */
+addon_value StopMediaServer(addon_env env, addon_callback_info /*info*/) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "stopMediaServer");
+    UXP_ADDON_TRACE_SCOPE("export", "stopMediaServer");
+    try {
+        MediaServer::Instance().Stop();
+        addon_value result = nullptr;
+        Check(UxpAddonApis.uxp_addon_get_undefined(env, &result));
+        return result;
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * Returns the media server URL of a file under its root, to be used as the src of a
+ * video or image element. Byte ranges are supported, so players can seek in large files.
+ */
+addon_value GetMediaUrl(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "getMediaUrl");
+    UXP_ADDON_TRACE_SCOPE("export", "getMediaUrl");
+    try {
+        size_t argc = 1;
+        addon_value argv[1];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "getMediaUrl expects a path";
+
+        return Value(MediaServer::Instance().GetUrl(GetStringArgument(env, argv[0]))).Convert(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+Value StorageUsageValue(const StorageManager::Usage& usage) {
+    Value result(Value::Kind::map);
+    auto& fields = result.GetMap();
+    fields.emplace("root", Value(usage.root));
+    fields.emplace("usedBytes", Value(static_cast<double>(usage.usedBytes)));
+    fields.emplace("quotaBytes", Value(static_cast<double>(usage.quotaBytes)));
+    fields.emplace("files", Value(static_cast<double>(usage.files)));
+    fields.emplace("pinnedFiles", Value(static_cast<double>(usage.pinnedFiles)));
+    fields.emplace("evictedFiles", Value(static_cast<double>(usage.evictedFiles)));
+    fields.emplace("evictedBytes", Value(static_cast<double>(usage.evictedBytes)));
+    fields.emplace("scanning", Value(usage.scanning));
+    return result;
+}
+
+/*
+ * Keeps the storage folder under a quota. Takes { root, quotaBytes, policy } options:
+ * root defaults to the default storage path, quotaBytes to 0 (the usage is accounted
+ * but nothing is evicted; Infinity or more than 2^53 bytes are the same) and policy is
+ * "lru" (default) or "age". The files are counted
+ * by a scan on a background thread, then kept up to date by the writes of the addon;
+ * past the quota, media files are evicted down to 90% of it and their sidecars are
+ * marked with "evicted": true. Returns the usage, see getStorageUsage.
+ */
+addon_value ConfigureStorage(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "configureStorage");
+    UXP_ADDON_TRACE_SCOPE("export", "configureStorage");
+    try {
+        size_t argc = 1;
+        addon_value argv[1];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+
+        std::string root = ResolveDefaultStoragePath().string();
+        double quotaBytes = 0;
+        StorageManager::Policy policy = StorageManager::Policy::lru;
+        if (argc >= 1) {
+            addon_value option = GetOptionalProperty(env, argv[0], "root");
+            if (option != nullptr)
+                root = GetStringArgument(env, option);
+            option = GetOptionalProperty(env, argv[0], "quotaBytes");
+            if (option != nullptr)
+                Check(UxpAddonApis.uxp_addon_get_value_double(env, option, &quotaBytes));
+            option = GetOptionalProperty(env, argv[0], "policy");
+            if (option != nullptr) {
+                const std::string name = GetStringArgument(env, option);
+                if (name == "age")
+                    policy = StorageManager::Policy::age;
+                else if (name != "lru")
+                    throw "configureStorage policy must be \"lru\" or \"age\"";
+            }
+        }
+        constexpr double kMaxQuota = 9007199254740992.0;
+        if (!(quotaBytes >= 0))
+            throw "configureStorage quotaBytes must be a positive number";
+        if (quotaBytes > kMaxQuota)
+            quotaBytes = 0;
+
+        StorageManager::Instance().Configure(root, static_cast<uint64_t>(quotaBytes), policy);
+        return StorageUsageValue(StorageManager::Instance().GetUsage()).Convert(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * Returns the usage of the storage folder from the running totals, without reading
+ * the disk: { root, usedBytes, quotaBytes, files, pinnedFiles, evictedFiles,
+ * evictedBytes, scanning }. The totals are partial while scanning is true.
+ */
+addon_value GetStorageUsage(addon_env env, addon_callback_info /*info*/) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "getStorageUsage");
+    UXP_ADDON_TRACE_SCOPE("export", "getStorageUsage");
+    try {
+        return StorageUsageValue(StorageManager::Instance().GetUsage()).Convert(env);
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * Protects files of the storage folder from eviction. Takes a list of paths and
+ * { reason, pinned } options: reason defaults to "pinned" (use e.g. "imported" for the
+ * files imported into a project) and a file stays protected until all of its reasons
+ * are removed with pinned: false. Returns the number of paths under the storage folder.
+ */
+addon_value PinStorage(addon_env env, addon_callback_info info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, exports, "pinStorage");
+    UXP_ADDON_TRACE_SCOPE("export", "pinStorage");
+    try {
+        size_t argc = 2;
+        addon_value argv[2];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "pinStorage expects a list of paths";
+
+        Value list(env, argv[0]);
+        std::vector<std::string> paths;
+        for (const auto& path : list.GetList())
+            paths.push_back(path.GetString());
+
+        std::string reason = "pinned";
+        bool pinned = true;
+        if (argc >= 2) {
+            addon_value option = GetOptionalProperty(env, argv[1], "reason");
+            if (option != nullptr)
+                reason = GetStringArgument(env, option);
+            option = GetOptionalProperty(env, argv[1], "pinned");
+            if (option != nullptr)
+                Check(UxpAddonApis.uxp_addon_get_value_bool(env, option, &pinned));
+        }
+
+        const size_t count = StorageManager::Instance().Pin(paths, reason, pinned);
+        addon_value result = nullptr;
+        Check(UxpAddonApis.uxp_addon_create_double(env, static_cast<double>(count), &result));
+        return result;
+    } catch (...) {
+        metrics.Fail();
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * Returns the runtime metrics of the addon:
+ *   { enabled, exports: { name: { calls, errors, bytesIn, bytesOut, latency } },
+ *     operations: { ... }, queues: { main|script|worker: { count, wait } } }
+ * where latency and wait are { mean, p50, p90, p99, max } in milliseconds.
+ * With { reset: true } the metrics restart from zero after the snapshot.
+ */
+addon_value GetStats(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value argv[1];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+
+        bool reset = false;
+        addon_value resetValue = argc >= 1 ? GetOptionalProperty(env, argv[0], "reset") : nullptr;
+        if (resetValue != nullptr)
+            Check(UxpAddonApis.uxp_addon_get_value_bool(env, resetValue, &reset));
+
+        return metrics::CreateSnapshot(env, reset);
+    } catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * Starts recording a trace of the exports, task stages and lane switches on all
+ * threads. Takes an optional { bufferSize }: the number of events kept per thread
+ * (32768 by default, at most 1048576, about 48 MB per thread); older events are
+ * overwritten when a thread records more.
+ */
+addon_value StartTrace(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value argv[1];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+
+        double bufferSize = 0;
+        if (argc >= 1)
+            bufferSize = GetNumberOption(env, argv[0], "bufferSize", 0, 0, 1 << 20, "startTrace bufferSize must be between 0 and 1048576");
+
+        trace::SetThreadName("javascript");
+        trace::Start(static_cast<size_t>(bufferSize));
+
+        addon_value result = nullptr;
+        Check(UxpAddonApis.uxp_addon_get_undefined(env, &result));
+        return result;
+    } catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/*
+ * Stops the trace and writes it to the given path as Chrome trace-event JSON, to be
+ * opened in chrome://tracing or ui.perfetto.dev. Returns { path, events, dropped }
+ * where dropped counts the events lost to full buffers.
+ */
+addon_value StopTrace(addon_env env, addon_callback_info info) {
+    try {
+        size_t argc = 1;
+        addon_value argv[1];
+        Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+        if (argc < 1)
+            throw "stopTrace expects a path";
+
+        const std::string path = GetStringArgument(env, argv[0]);
+        const trace::Summary summary = trace::Stop(path);
+
+        Value result(Value::Kind::map);
+        result.GetMap().emplace("path", Value(path));
+        result.GetMap().emplace("events", Value(static_cast<double>(summary.events)));
+        result.GetMap().emplace("dropped", Value(static_cast<double>(summary.dropped)));
+        return result.Convert(env);
+    } catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+/* Method invoked when the addon module is being requested by JavaScript
+ * This method is invoked on the JavaScript thread.
+ */
+addon_value Init(addon_env env, addon_value exports, const addon_apis& addonAPIs) {
+    addon_status status = addon_ok;
+    addon_value fn = nullptr;
+
+    // MyFunction
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, MyFunction, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "my_function", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    // MyEcho
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, MyEcho, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "my_echo", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    // MyAsyncEcho
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, MyAsyncEcho, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "my_echo_async", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+        // execSync
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ExecSync, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap native function");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "execSync", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to populate exports");
+        }
+    }
+
+    // execBatch
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ExecBatch, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap execBatch");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "execBatch", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose execBatch");
+        }
+    }
+
+    // spawn
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, Spawn, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap spawn");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "spawn", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose spawn");
+        }
+    }
+
+    // ensureDirectory
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, EnsureDirectory, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap ensureDirectory");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "ensureDirectory", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose ensureDirectory");
+        }
+    }
+
+    // writeFile
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, WriteFile, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap writeFile");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "writeFile", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose writeFile");
+        }
+    }
+
+    // writeFiles
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, WriteFiles, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap writeFiles");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "writeFiles", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose writeFiles");
+        }
+    }
+
+    // readFiles
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ReadFiles, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap readFiles");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "readFiles", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose readFiles");
+        }
+    }
+
+    // readPackedFile
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ReadPackedFile, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap readPackedFile");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "readPackedFile", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose readPackedFile");
+        }
+    }
+
+    // listPackedFiles
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ListPackedFiles, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap listPackedFiles");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "listPackedFiles", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose listPackedFiles");
+        }
+    }
+
+    // compactPack
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, CompactPack, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap compactPack");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "compactPack", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose compactPack");
+        }
+    }
+
+    // copyFiles
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, CopyFiles, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap copyFiles");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "copyFiles", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose copyFiles");
+        }
+    }
+
+    // openStorage
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, OpenStorage, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap openStorage");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "openStorage", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose openStorage");
+        }
+    }
+
+    // getDefaultStoragePath
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, GetDefaultStoragePath, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap getDefaultStoragePath");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "getDefaultStoragePath", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose getDefaultStoragePath");
+        }
+    }
+
+    // probeMedia
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ProbeMediaFiles, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap probeMedia");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "probeMedia", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose probeMedia");
+        }
+    }
+
+    // faststart
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, Faststart, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap faststart");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "faststart", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose faststart");
+        }
+    }
+
+    // probeImages
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ProbeImages, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap probeImages");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "probeImages", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose probeImages");
+        }
+    }
+
+    // perceptualHash
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, PerceptualHashes, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap perceptualHash");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "perceptualHash", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose perceptualHash");
+        }
+    }
+
+    // findNearDuplicates
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, FindNearDuplicates, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap findNearDuplicates");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "findNearDuplicates", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose findNearDuplicates");
+        }
+    }
+
+    // prepareMask
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, PrepareMask, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap prepareMask");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "prepareMask", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose prepareMask");
+        }
+    }
+
+    // compositeImage
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, CompositeImage, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap compositeImage");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "compositeImage", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose compositeImage");
+        }
+    }
+
+    // diffImages
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, DiffImages, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap diffImages");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "diffImages", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose diffImages");
+        }
+    }
+
+    // buildAtlas
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, BuildAtlas, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap buildAtlas");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "buildAtlas", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose buildAtlas");
+        }
+    }
+
+    // placeholders
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, Placeholders, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap placeholders");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "placeholders", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose placeholders");
+        }
+    }
+
+    // openChannel
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, OpenChannel, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap openChannel");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "openChannel", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose openChannel");
+        }
+    }
+
+    // startMediaServer
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, StartMediaServer, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap startMediaServer");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "startMediaServer", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose startMediaServer");
+        }
+    }
+
+    // stopMediaServer
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, StopMediaServer, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap stopMediaServer");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "stopMediaServer", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose stopMediaServer");
+        }
+    }
+
+    // getMediaUrl
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, GetMediaUrl, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap getMediaUrl");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "getMediaUrl", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose getMediaUrl");
+        }
+    }
+
+    // configureStorage
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, ConfigureStorage, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap configureStorage");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "configureStorage", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose configureStorage");
+        }
+    }
+
+    // getStorageUsage
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, GetStorageUsage, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap getStorageUsage");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "getStorageUsage", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose getStorageUsage");
+        }
+    }
+
+    // pinStorage
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, PinStorage, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap pinStorage");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "pinStorage", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose pinStorage");
+        }
+    }
+
+    // getStats
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, GetStats, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap getStats");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "getStats", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose getStats");
+        }
+    }
+
+    // startTrace
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, StartTrace, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap startTrace");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "startTrace", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose startTrace");
+        }
+    }
+
+    // stopTrace
+    {
+        status = addonAPIs.uxp_addon_create_function(env, NULL, 0, StopTrace, NULL, &fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to wrap stopTrace");
+        }
+
+        status = addonAPIs.uxp_addon_set_named_property(env, exports, "stopTrace", fn);
+        if (status != addon_ok) {
+            addonAPIs.uxp_addon_throw_error(env, NULL, "Unable to expose stopTrace");
+        }
+    }
+
+    return exports;
+}
+
+}  // namespace
+
+/*
+ * Register initialization routine
+ * Invoked by UXP during uxpaddon load.
+ */
+UXP_ADDON_INIT(Init)
+
+void terminate(addon_env env) {
+    try {
+        MediaServer::Instance().Stop();
+        StorageManager::Instance().Stop();
+        // The worker threads can't be joined while they wait for children
+        Process::Shutdown();
+        ProcessPool::Instance().Shutdown();
+        WorkerPool::Instance().Shutdown();
+        Process::Restart();
+        PackStore::Instance().Close();
+        IoEngine::Instance().Shutdown();
+        ProgressChannel::Shutdown();
+        HashIndex::Instance().Clear();
+    } catch (...) {
+    }
+}
+
+/* Register addon termination routine
+ * Invoked by UXP during uxpaddon un-load.
+ */
+UXP_ADDON_TERMINATE(terminate)
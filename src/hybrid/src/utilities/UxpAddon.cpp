@@ -1,37 +1,63 @@
-/************************************************************************
- * Copyright 2022 Adobe
- * All Rights Reserved.
- *
- * NOTICE: Adobe permits you to use, modify, and distribute this file in
- * accordance with the terms of the Adobe license agreement accompanying
- * it.
- *************************************************************************
- */
-
-#include "UxpAddon.h"
-
-#include <stdexcept>
-#include <string>
-
-addon_value CreateErrorFromException(addon_env env) noexcept {
-    std::string message;
-    try {
-        throw;
-    } catch (std::exception& except) {
-        message = except.what();
-    } catch (...) {
-        message = "unknown exception";
-    }
-
-    // Don't throw from this function (ignore further errors)
-    addon_value errorCode = nullptr;
-    std::string code("-1");
-    UxpAddonApis.uxp_addon_create_string_utf8(env, code.c_str(), code.size(), &errorCode);
-
-    addon_value errorMessage = nullptr;
-    UxpAddonApis.uxp_addon_create_string_utf8(env, message.c_str(), message.size(), &errorMessage);
-
-    addon_value error = nullptr;
-    UxpAddonApis.uxp_addon_create_error(env, errorCode, errorMessage, &error);
-    return error;
-}
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpAddon.h"
+
+#include <stdexcept>
+#include <string>
+
+std::string GetExceptionMessage() noexcept {
+    try {
+        throw;
+    } catch (std::exception& except) {
+        return except.what();
+    } catch (const char* message) {
+        return message;
+    } catch (...) {
+    }
+    return "unknown exception";
+}
+
+std::string GetExceptionCode() noexcept {
+    try {
+        throw;
+    } catch (AddonError& except) {
+        return except.GetCode();
+    } catch (...) {
+    }
+    return "-1";
+}
+
+addon_value CreateError(addon_env env, const std::string& code, const std::string& message) noexcept {
+    // Don't throw from this function (ignore further errors)
+    addon_value errorCode = nullptr;
+    UxpAddonApis.uxp_addon_create_string_utf8(env, code.c_str(), code.size(), &errorCode);
+
+    addon_value errorMessage = nullptr;
+    UxpAddonApis.uxp_addon_create_string_utf8(env, message.c_str(), message.size(), &errorMessage);
+
+    addon_value error = nullptr;
+    UxpAddonApis.uxp_addon_create_error(env, errorCode, errorMessage, &error);
+    return error;
+}
+
+addon_value CreateErrorFromException(addon_env env) noexcept {
+    return CreateError(env, GetExceptionCode(), GetExceptionMessage());
+}
+
+std::string GetStringArgument(addon_env env, addon_value value) {
+    size_t length = 0;
+    Check(UxpAddonApis.uxp_addon_get_value_string_utf8(env, value, nullptr, 0, &length));
+
+    std::string result(length, '\0');
+    Check(UxpAddonApis.uxp_addon_get_value_string_utf8(env, value, result.data(), length + 1, &length));
+    result.resize(length);
+    return result;
+}
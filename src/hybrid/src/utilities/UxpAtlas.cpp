@@ -0,0 +1,250 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+
+#include "UxpAtlas.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <string_view>
+
+#include "UxpCompositing.h"
+#include "UxpPack.h"
+
+namespace {
+
+// FNV-1a, fed a piece at a time
+class Fnv {
+ public:
+    void Add(std::string_view data) {
+        for (const unsigned char c : data) {
+            mHash ^= c;
+            mHash *= 1099511628211ull;
+        }
+    }
+
+    void Add(uint64_t value) {
+        char bytes[8];
+        for (int index = 0; index < 8; ++index)
+            bytes[index] = static_cast<char>(value >> (8 * index));
+        Add(std::string_view(bytes, 8));
+    }
+
+    uint64_t Get() const { return mHash; }
+
+ private:
+    uint64_t mHash{14695981039346656037ull};
+};
+
+std::string Hexadecimal(uint64_t value) {
+    char digits[17];
+    std::snprintf(digits, sizeof(digits), "%016llx", static_cast<unsigned long long>(value));
+    return digits;
+}
+
+// The entries of the atlas of a directory in its pack, which replace the previous atlas
+constexpr const char* kAtlasTiles = "atlas.tiles";
+
+std::string GetSheetName(size_t sheet) {
+    return "atlas-" + std::to_string(sheet) + ".jpg";
+}
+
+// The bitmap of the pixels of source within the rectangle
+Bitmap Crop(const Bitmap& source, uint32_t left, uint32_t top, uint32_t width, uint32_t height) {
+    Bitmap cropped;
+    cropped.width = width;
+    cropped.height = height;
+    cropped.pixels.resize(size_t(width) * height * 4);
+    for (uint32_t y = 0; y < height; ++y) {
+        const uint8_t* row = source.pixels.data() + (size_t(top + y) * source.width + left) * 4;
+        std::copy(row, row + size_t(width) * 4, cropped.pixels.data() + size_t(y) * width * 4);
+    }
+    return cropped;
+}
+
+}  // namespace
+
+AtlasLayout::AtlasLayout(size_t tiles, uint32_t tileWidth, uint32_t tileHeight)
+    : mTiles(tiles),
+      mTileWidth(tileWidth),
+      mTileHeight(tileHeight),
+      mColumns(std::max<size_t>(1, std::min<size_t>(kMaxSheetSize / tileWidth, tiles))),
+      mTilesPerSheet(mColumns * std::max<size_t>(1, kMaxSheetSize / tileHeight)) {}
+
+size_t AtlasLayout::GetSheetCount() const {
+    return (mTiles + mTilesPerSheet - 1) / mTilesPerSheet;
+}
+
+size_t AtlasLayout::GetTileCount(size_t sheet) const {
+    return std::min(mTilesPerSheet, mTiles - sheet * mTilesPerSheet);
+}
+
+uint32_t AtlasLayout::GetSheetWidth(size_t sheet) const {
+    return static_cast<uint32_t>(std::min(mColumns, GetTileCount(sheet)) * mTileWidth);
+}
+
+uint32_t AtlasLayout::GetSheetHeight(size_t sheet) const {
+    return static_cast<uint32_t>((GetTileCount(sheet) + mColumns - 1) / mColumns * mTileHeight);
+}
+
+AtlasLayout::Place AtlasLayout::Locate(size_t tile) const {
+    Place place;
+    place.sheet = tile / mTilesPerSheet;
+    const size_t index = tile % mTilesPerSheet;
+    place.x = static_cast<uint32_t>(index % mColumns * mTileWidth);
+    place.y = static_cast<uint32_t>(index / mColumns * mTileHeight);
+    return place;
+}
+
+Bitmap CreateSheet(uint32_t width, uint32_t height, const AtlasOptions& options) {
+    Bitmap sheet;
+    sheet.width = width;
+    sheet.height = height;
+    sheet.pixels.resize(size_t(width) * height * 4);
+    for (size_t index = 0; index < sheet.pixels.size(); index += 4) {
+        std::copy(options.background, options.background + 3, &sheet.pixels[index]);
+        sheet.pixels[index + 3] = 255;
+    }
+    return sheet;
+}
+
+void DrawTile(Bitmap& sheet, uint32_t x, uint32_t y, const Bitmap& image, const AtlasOptions& options) {
+    if (image.width == 0 || image.height == 0)
+        return;
+    const double widthScale = double(options.tileWidth) / image.width;
+    const double heightScale = double(options.tileHeight) / image.height;
+    Bitmap tile;
+    if (options.fit == AtlasFit::cover) {
+        // The largest part of the image of the proportions of the tile
+        const double scale = std::max(widthScale, heightScale);
+        const auto width = std::clamp<uint32_t>(static_cast<uint32_t>(std::lround(options.tileWidth / scale)), 1, image.width);
+        const auto height = std::clamp<uint32_t>(static_cast<uint32_t>(std::lround(options.tileHeight / scale)), 1, image.height);
+        tile = ResizeBitmap(Crop(image, (image.width - width) / 2, (image.height - height) / 2, width, height), options.tileWidth,
+                            options.tileHeight);
+    } else {
+        const double scale = std::min(widthScale, heightScale);
+        const auto width = std::clamp<uint32_t>(static_cast<uint32_t>(std::lround(image.width * scale)), 1, options.tileWidth);
+        const auto height = std::clamp<uint32_t>(static_cast<uint32_t>(std::lround(image.height * scale)), 1, options.tileHeight);
+        tile = ResizeBitmap(image, width, height);
+    }
+
+    const uint8_t background[4] = {options.background[0], options.background[1], options.background[2], 255};
+    PremultiplyBitmap(tile);
+    CompositeOverColor(tile, background);
+    const uint32_t left = x + (options.tileWidth - tile.width) / 2;
+    const uint32_t top = y + (options.tileHeight - tile.height) / 2;
+    for (uint32_t row = 0; row < tile.height; ++row) {
+        const uint8_t* in = tile.pixels.data() + size_t(row) * tile.width * 4;
+        std::copy(in, in + size_t(tile.width) * 4, sheet.pixels.data() + (size_t(top + row) * sheet.width + left) * 4);
+    }
+}
+
+std::string GetAtlasDirectory(const std::vector<std::string>& paths) {
+    std::string directory;
+    for (const auto& path : paths) {
+        const std::string parent = std::filesystem::path(path).parent_path().string();
+        if (parent.empty() || (!directory.empty() && parent != directory))
+            return std::string();
+        directory = parent;
+    }
+    return directory;
+}
+
+std::string GetAtlasName(const std::vector<std::string>& paths, const AtlasOptions& options) {
+    Fnv hash;
+    hash.Add(options.tileWidth);
+    hash.Add(options.tileHeight);
+    hash.Add(static_cast<uint64_t>(options.fit));
+    hash.Add(std::string_view(reinterpret_cast<const char*>(options.background), 3));
+    hash.Add(options.quality);
+    for (const auto& path : paths) {
+        hash.Add(path);
+        // Separates the paths
+        hash.Add(std::string_view("", 1));
+    }
+    return "atlas-" + Hexadecimal(hash.Get());
+}
+
+uint64_t GetAtlasStamp(const std::vector<std::string>& paths) {
+    Fnv hash;
+    for (const auto& path : paths) {
+        std::error_code ec;
+        const uint64_t size = std::filesystem::file_size(path, ec);
+        if (ec) {
+            hash.Add(UINT64_MAX);
+            continue;
+        }
+        hash.Add(size);
+        hash.Add(static_cast<uint64_t>(std::filesystem::last_write_time(path, ec).time_since_epoch().count()));
+    }
+    return hash.Get();
+}
+
+bool LoadAtlas(const std::string& directory, const std::string& name, uint64_t stamp, const AtlasLayout& layout, Atlas& atlas) {
+    // The name, the stamp and the hash of the sheets, then a digit per tile: 1 when it was drawn
+    std::string tiles;
+    const std::string header = name + Hexadecimal(stamp);
+    if (!PackStore::Instance().Read(directory, kAtlasTiles, tiles) || tiles.compare(0, header.size(), header) != 0)
+        return false;
+    size_t count = 0;
+    for (size_t sheet = 0; sheet < layout.GetSheetCount(); ++sheet)
+        count += layout.GetTileCount(sheet);
+    if (tiles.size() != header.size() + 16 + count)
+        return false;
+    atlas.sheets.resize(layout.GetSheetCount());
+    Fnv hash;
+    for (size_t sheet = 0; sheet < atlas.sheets.size(); ++sheet) {
+        if (!PackStore::Instance().Read(directory, GetSheetName(sheet), atlas.sheets[sheet]))
+            return false;
+        hash.Add(atlas.sheets[sheet]);
+    }
+    // Another atlas of the directory may have been stored at the same time
+    if (tiles.compare(header.size(), 16, Hexadecimal(hash.Get())) != 0)
+        return false;
+    atlas.drawn.clear();
+    for (size_t index = header.size() + 16; index < tiles.size(); ++index)
+        atlas.drawn.push_back(tiles[index] == '1');
+    return true;
+}
+
+bool StoreAtlas(const std::string& directory, const std::string& name, uint64_t stamp, const Atlas& atlas) {
+    std::string previous;
+    const bool replaced = PackStore::Instance().Read(directory, kAtlasTiles, previous);
+
+    // The sheets first, so that the tiles are only found with all of them
+    Fnv hash;
+    for (size_t sheet = 0; sheet < atlas.sheets.size(); ++sheet) {
+        if (!PackStore::Instance().Write(directory, GetSheetName(sheet), {atlas.sheets[sheet]}))
+            return false;
+        hash.Add(atlas.sheets[sheet]);
+    }
+    // Empty the sheets of a larger previous atlas
+    std::string stale;
+    for (size_t sheet = atlas.sheets.size(); PackStore::Instance().Read(directory, GetSheetName(sheet), stale) && !stale.empty(); ++sheet) {
+        if (!PackStore::Instance().Write(directory, GetSheetName(sheet), {}))
+            return false;
+    }
+    std::string tiles = name + Hexadecimal(stamp) + Hexadecimal(hash.Get());
+    for (uint8_t drawn : atlas.drawn)
+        tiles += drawn ? '1' : '0';
+    if (!PackStore::Instance().Write(directory, kAtlasTiles, {tiles}))
+        return false;
+
+    // Reclaim the records of the previous atlas, which would otherwise stay in the pack
+    if (replaced) {
+        try {
+            PackStore::Instance().Compact(directory);
+        } catch (...) {
+        }
+    }
+    return true;
+}
@@ -0,0 +1,105 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "UxpPixels.h"
+
+/** Sprite sheets of thumbnails (buildAtlas), so that a gallery page draws its tiles from
+ one or a few JPEG images instead of decoding a file per tile.
+
+ Tiles are laid out row after row, as many per row and as many rows per sheet as fit in
+ kMaxSheetSize pixels; the last sheet is only as large as its tiles. A tile has its place
+ whether its image could be decoded or not, so that a page can be laid out before its
+ atlas is built.
+ The atlas last built for images of the same directory (a date folder) is kept in the
+ pack file of that directory (see UxpPack.h), with a name that depends on the images and
+ the options and the sizes and modification times of the images: it is built again only
+ when one of them changed, or for other images or options. Storing an atlas replaces the
+ previous one and compacts the pack, so that atlases don't accumulate in it.
+*/
+
+enum class AtlasFit {
+    // The image is cropped to the tile, centered
+    cover,
+    // The whole image is within the tile, centered over the background
+    contain
+};
+
+struct AtlasOptions {
+    uint32_t tileWidth{256};
+    uint32_t tileHeight{256};
+    AtlasFit fit{AtlasFit::cover};
+    // Behind transparent pixels, empty tiles and the margins of contained images (rgb)
+    uint8_t background[3]{0, 0, 0};
+    // JPEG quality, 1 to 100
+    unsigned quality{85};
+};
+
+class AtlasLayout {
+ public:
+    static constexpr uint32_t kMaxSheetSize = 4096;
+
+    struct Place {
+        size_t sheet{0};
+        uint32_t x{0};
+        uint32_t y{0};
+    };
+
+    AtlasLayout(size_t tiles, uint32_t tileWidth, uint32_t tileHeight);
+
+    size_t GetSheetCount() const;
+    size_t GetTileCount(size_t sheet) const;
+    uint32_t GetSheetWidth(size_t sheet) const;
+    uint32_t GetSheetHeight(size_t sheet) const;
+    Place Locate(size_t tile) const;
+
+ private:
+    size_t mTiles;
+    uint32_t mTileWidth;
+    uint32_t mTileHeight;
+    size_t mColumns;
+    size_t mTilesPerSheet;
+};
+
+// An opaque sheet of the background color
+Bitmap CreateSheet(uint32_t width, uint32_t height, const AtlasOptions& options);
+
+// Draw image in the tile of sheet at x, y, fitted as by options
+void DrawTile(Bitmap& sheet, uint32_t x, uint32_t y, const Bitmap& image, const AtlasOptions& options);
+
+struct Atlas {
+    // JPEG files
+    std::vector<std::string> sheets;
+    // 1 for the tiles whose image was drawn
+    std::vector<uint8_t> drawn;
+};
+
+// The directory of the images when they are all in the same one, where their atlas is
+// cached; empty otherwise
+std::string GetAtlasDirectory(const std::vector<std::string>& paths);
+
+// The name of the atlas of paths with options, and the stamp of the current version of
+// the images
+std::string GetAtlasName(const std::vector<std::string>& paths, const AtlasOptions& options);
+uint64_t GetAtlasStamp(const std::vector<std::string>& paths);
+
+// Returns false if the pack of directory has no atlas of that name and stamp with the
+// sheets of layout
+bool LoadAtlas(const std::string& directory, const std::string& name, uint64_t stamp, const AtlasLayout& layout, Atlas& atlas);
+
+// Replaces the atlas of the pack of directory. Returns false if the atlas can't be written.
+bool StoreAtlas(const std::string& directory, const std::string& name, uint64_t stamp, const Atlas& atlas);
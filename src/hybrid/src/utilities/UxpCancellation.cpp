@@ -0,0 +1,171 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpCancellation.h"
+
+#include <cstring>
+
+namespace {
+
+using TokenHolder = std::shared_ptr<CancellationToken>;
+
+void DeleteTokenHolder(addon_env /*env*/, void* data, void* /*hint*/) {
+    try {
+        delete reinterpret_cast<TokenHolder*>(data);
+    } catch (...) {
+    }
+}
+
+TokenHolder& GetTokenHolder(addon_env env, addon_callback_info info) {
+    void* data = nullptr;
+    size_t argc = 0;
+    Check(UxpAddonApis.uxp_addon_get_cb_info(env, info, &argc, nullptr, nullptr, &data));
+    if (data == nullptr)
+        throw "Invalid cancellation handle";
+    return *reinterpret_cast<TokenHolder*>(data);
+}
+
+addon_value CancelHandle(addon_env env, addon_callback_info info) {
+    try {
+        GetTokenHolder(env, info)->Cancel();
+
+        addon_value result = nullptr;
+        Check(UxpAddonApis.uxp_addon_get_undefined(env, &result));
+        return result;
+    } catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+addon_value IsCancelledHandle(addon_env env, addon_callback_info info) {
+    try {
+        const bool cancelled = GetTokenHolder(env, info)->IsCancelled();
+
+        addon_value result = nullptr;
+        Check(UxpAddonApis.uxp_addon_get_boolean(env, cancelled, &result));
+        return result;
+    } catch (...) {
+        return CreateErrorFromException(env);
+    }
+}
+
+// Each function owns its own reference to the token, so that it stays valid even
+// if JavaScript detaches the function from the handle object
+void AddMethod(addon_env env, addon_value object, const char* name, addon_callback callback, const TokenHolder& token) {
+    auto holder = new TokenHolder(token);
+
+    addon_value fn = nullptr;
+    if (UxpAddonApis.uxp_addon_create_function(env, name, std::strlen(name), callback, holder, &fn) != addon_ok) {
+        delete holder;
+        throw "Unable to create the cancellation handle";
+    }
+    Check(UxpAddonApis.uxp_addon_add_finalizer(env, fn, holder, DeleteTokenHolder, nullptr, nullptr));
+    Check(UxpAddonApis.uxp_addon_set_named_property(env, object, name, fn));
+}
+
+}  // namespace
+
+OperationCancelled::OperationCancelled(bool timedOut)
+    : AddonError(timedOut ? UXP_ADDON_TIMEOUT_ERROR : UXP_ADDON_ABORT_ERROR,
+                 timedOut ? "The operation timed out" : "The operation was cancelled") {
+}
+
+std::shared_ptr<CancellationToken> CancellationToken::Create() {
+    return std::shared_ptr<CancellationToken>(new CancellationToken);
+}
+
+std::shared_ptr<CancellationToken> CancellationToken::Create(std::shared_ptr<CancellationToken> parent) {
+    auto token = Create();
+    if (parent == nullptr)
+        return token;
+
+    token->mParent = std::move(parent);
+    std::weak_ptr<CancellationToken> weak = token;
+    token->mParentCallback = token->mParent->OnCancel([weak] {
+        if (auto child = weak.lock())
+            child->Cancel();
+    });
+    return token;
+}
+
+CancellationToken::~CancellationToken() {
+    if (mParent != nullptr && mParentCallback != 0)
+        mParent->RemoveOnCancel(mParentCallback);
+}
+
+void CancellationToken::Cancel() {
+    if (mCancelled.exchange(true))
+        return;
+
+    std::vector<std::pair<size_t, Callback>> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        std::swap(callbacks, mCallbacks);
+    }
+    for (auto& callback : callbacks) {
+        try {
+            callback.second();
+        } catch (...) {
+        }
+    }
+}
+
+void CancellationToken::SetDeadline(Clock::time_point deadline) {
+    mDeadline = deadline.time_since_epoch().count();
+}
+
+bool CancellationToken::IsExpired() const {
+    const int64_t deadline = mDeadline.load(std::memory_order_relaxed);
+    if (deadline != 0 && Clock::now().time_since_epoch().count() >= deadline)
+        return true;
+    return mParent != nullptr && mParent->IsExpired();
+}
+
+void CancellationToken::ThrowIfCancelled() const {
+    if (mParent != nullptr)
+        mParent->ThrowIfCancelled();
+    if (mCancelled.load(std::memory_order_relaxed))
+        throw OperationCancelled(false);
+    if (IsExpired())
+        throw OperationCancelled(true);
+}
+
+size_t CancellationToken::OnCancel(Callback callback) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mCancelled) {
+            const size_t id = mNextCallbackId++;
+            mCallbacks.emplace_back(id, std::move(callback));
+            return id;
+        }
+    }
+    callback();
+    return 0;
+}
+
+void CancellationToken::RemoveOnCancel(size_t id) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto iter = mCallbacks.begin(); iter != mCallbacks.end(); ++iter) {
+        if (iter->first == id) {
+            mCallbacks.erase(iter);
+            return;
+        }
+    }
+}
+
+addon_value CancellationToken::CreateHandle(addon_env env) {
+    addon_value handle = nullptr;
+    Check(UxpAddonApis.uxp_addon_create_object(env, &handle));
+
+    const TokenHolder token = shared_from_this();
+    AddMethod(env, handle, "cancel", CancelHandle, token);
+    AddMethod(env, handle, "isCancelled", IsCancelledHandle, token);
+    return handle;
+}
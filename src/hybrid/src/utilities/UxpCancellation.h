@@ -0,0 +1,89 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../api/UxpAddonTypes.h"
+#include "UxpAddon.h"
+
+/** Error codes of the errors that cancelled or timed out operations reject with */
+#define UXP_ADDON_ABORT_ERROR "ABORT_ERR"
+#define UXP_ADDON_TIMEOUT_ERROR "TIMEOUT_ERR"
+
+/** Thrown by CancellationToken::ThrowIfCancelled. Reported to JavaScript with
+ the ABORT_ERR or TIMEOUT_ERR code.
+*/
+class OperationCancelled : public AddonError {
+ public:
+    explicit OperationCancelled(bool timedOut);
+};
+
+/** A CancellationToken is shared between the scripting thread, which may cancel
+ an operation, and the threads that run it. Cancellation is cooperative: long running
+ handlers are expected to call IsCancelled/ThrowIfCancelled at convenient points.
+ A token may also carry a deadline, after which it reports itself as cancelled.
+
+ JavaScript gets an AbortSignal-like handle for a token through CreateHandle:
+     { cancel(), isCancelled() }
+*/
+
+class CancellationToken : public std::enable_shared_from_this<CancellationToken> {
+ public:
+    using Clock = std::chrono::steady_clock;
+
+    static std::shared_ptr<CancellationToken> Create();
+    // A token that is cancelled and expires with parent (if any), but can be cancelled alone
+    static std::shared_ptr<CancellationToken> Create(std::shared_ptr<CancellationToken> parent);
+
+    ~CancellationToken();
+
+    // Can be invoked on any thread. Invokes the registered callbacks once.
+    void Cancel();
+
+    void SetDeadline(Clock::time_point deadline);
+    void SetTimeout(std::chrono::milliseconds timeout) { SetDeadline(Clock::now() + timeout); }
+
+    bool IsCancelled() const {
+        return mCancelled.load(std::memory_order_relaxed) || IsExpired() || (mParent != nullptr && mParent->IsCancelled());
+    }
+    bool IsExpired() const;
+
+    // Throws OperationCancelled if the token was cancelled or the deadline passed
+    void ThrowIfCancelled() const;
+
+    // Register a callback that is invoked when Cancel is called (not when the deadline passes).
+    // The callback is invoked immediately if the token is already cancelled.
+    using Callback = std::function<void()>;
+    size_t OnCancel(Callback callback);
+    void RemoveOnCancel(size_t id);
+
+    // Create the JavaScript handle for this token.
+    // This method must be invoked on the JavaScript thread.
+    addon_value CreateHandle(addon_env env);
+
+ private:
+    CancellationToken() {}
+
+    std::atomic<bool> mCancelled{false};
+    std::atomic<int64_t> mDeadline{0};  // steady clock ticks, 0 when there is no deadline
+    std::shared_ptr<CancellationToken> mParent;
+    size_t mParentCallback{0};
+
+    std::mutex mMutex;
+    std::vector<std::pair<size_t, Callback>> mCallbacks;
+    size_t mNextCallbackId{1};
+};
@@ -0,0 +1,209 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpCompositing.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "UxpPixelKernels.h"
+
+namespace {
+
+constexpr unsigned kMaxBoxRadius = 127;
+
+using ExtremeKernel = void (*)(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t count);
+
+// Each of the first count - size + 1 elements of data takes the extreme of the size
+// elements from it. Elements are step bytes apart, the step bytes in between being as
+// many other sequences. Windows double at each pass, and the last pass combines 2
+// overlapping windows.
+void SlidingExtreme(ExtremeKernel extreme, uint8_t* data, size_t count, size_t step, size_t size) {
+    size_t length = 1;
+    for (; length * 2 <= size; length *= 2)
+        extreme(data, data, data + length * step, (count - length) * step);
+    if (length < size)
+        extreme(data, data, data + (size - length) * step, (count - size + 1) * step);
+}
+
+// out = the mean of each value of in with the radius values above and below it, edges
+// extended
+void BoxColumns(const uint8_t* in, uint8_t* out, uint32_t width, uint32_t height, unsigned radius) {
+    const PixelKernels& kernels = GetPixelKernels();
+    const size_t size = 2 * size_t(radius) + 1;
+    // Rounded up so that size * 255 gives 255
+    const auto reciprocal = static_cast<uint16_t>((65536 + size - 1) / size);
+    const std::vector<uint8_t> zeros(width, 0);
+    std::vector<uint16_t> sums(width, 0);
+    const auto row = [&](int64_t y) { return in + std::clamp<int64_t>(y, 0, height - 1) * width; };
+
+    for (int64_t y = -int64_t(radius); y <= int64_t(radius); ++y)
+        kernels.accumulate(sums.data(), row(y), zeros.data(), width);
+    for (int64_t y = 0; y < height; ++y) {
+        kernels.scale(out + y * width, sums.data(), reciprocal, width);
+        kernels.accumulate(sums.data(), row(y + radius + 1), row(y - radius), width);
+    }
+}
+
+// out (height x width) = in (width x height) transposed, in tiles that stay in the cache
+void Transpose(const uint8_t* in, uint8_t* out, uint32_t width, uint32_t height) {
+    constexpr uint32_t kTile = 32;
+    for (uint32_t top = 0; top < height; top += kTile) {
+        for (uint32_t left = 0; left < width; left += kTile) {
+            const uint32_t bottom = std::min(top + kTile, height);
+            const uint32_t right = std::min(left + kTile, width);
+            for (uint32_t y = top; y < bottom; ++y) {
+                for (uint32_t x = left; x < right; ++x)
+                    out[size_t(x) * height + y] = in[size_t(y) * width + x];
+            }
+        }
+    }
+}
+
+}  // namespace
+
+Mask ExtractMask(const Bitmap& bitmap, MaskChannel channel) {
+    Mask mask;
+    mask.width = bitmap.width;
+    mask.height = bitmap.height;
+    const size_t count = size_t(bitmap.width) * bitmap.height;
+    mask.values.resize(count);
+    const uint8_t* pixel = bitmap.pixels.data();
+    if (channel == MaskChannel::automatic)
+        channel = IsOpaque(bitmap) ? MaskChannel::luma : MaskChannel::alpha;
+    if (channel == MaskChannel::alpha) {
+        for (size_t index = 0; index < count; ++index)
+            mask.values[index] = pixel[index * 4 + 3];
+        return mask;
+    }
+    for (size_t index = 0; index < count; ++index, pixel += 4) {
+        // BT.601 weights in 8 bits, over black
+        const unsigned luma = (77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2] + 128) >> 8;
+        const unsigned value = luma * pixel[3] + 128;
+        mask.values[index] = static_cast<uint8_t>((value + (value >> 8)) >> 8);
+    }
+    return mask;
+}
+
+void ThresholdMask(Mask& mask, uint8_t level) {
+    GetPixelKernels().threshold(mask.values.data(), mask.values.size(), level);
+}
+
+void DilateMask(Mask& mask, int radius) {
+    if (radius == 0 || mask.values.empty())
+        return;
+    const PixelKernels& kernels = GetPixelKernels();
+    const ExtremeKernel extreme = radius > 0 ? kernels.maximum : kernels.minimum;
+    const uint8_t outside = radius > 0 ? 0 : 255;
+    const size_t reach = static_cast<size_t>(std::abs(radius));
+    const size_t size = 2 * reach + 1;
+    const size_t width = mask.width;
+    const size_t height = mask.height;
+
+    // Columns over the whole mask at once, with reach rows of outside above and below
+    std::vector<uint8_t> padded((height + 2 * reach) * width, outside);
+    std::copy(mask.values.begin(), mask.values.end(), padded.begin() + reach * width);
+    SlidingExtreme(extreme, padded.data(), height + 2 * reach, width, size);
+    std::copy(padded.begin(), padded.begin() + height * width, mask.values.begin());
+
+    // Then each row
+    std::vector<uint8_t> row(width + 2 * reach, outside);
+    for (size_t y = 0; y < height; ++y) {
+        uint8_t* values = mask.values.data() + y * width;
+        std::fill(row.begin(), row.end(), outside);
+        std::copy(values, values + width, row.begin() + reach);
+        SlidingExtreme(extreme, row.data(), row.size(), 1, size);
+        std::copy(row.begin(), row.begin() + width, values);
+    }
+}
+
+void FeatherMask(Mask& mask, double sigma) {
+    // 3 box filters of size n blur as much as a gaussian of variance (n^2 - 1) / 4
+    const double size = std::sqrt(4 * sigma * sigma + 1);
+    const auto radius = static_cast<unsigned>(std::min<double>(std::lround((size - 1) / 2), kMaxBoxRadius));
+    if (radius == 0 || mask.values.empty())
+        return;
+
+    // Columns, then rows as the columns of the transposed mask
+    std::vector<uint8_t> scratch(mask.values.size());
+    for (int pass = 0; pass < 3; ++pass) {
+        BoxColumns(mask.values.data(), scratch.data(), mask.width, mask.height, radius);
+        mask.values.swap(scratch);
+    }
+    Transpose(mask.values.data(), scratch.data(), mask.width, mask.height);
+    for (int pass = 0; pass < 3; ++pass) {
+        BoxColumns(scratch.data(), mask.values.data(), mask.height, mask.width, radius);
+        mask.values.swap(scratch);
+    }
+    Transpose(scratch.data(), mask.values.data(), mask.height, mask.width);
+}
+
+void InvertMask(Mask& mask) {
+    for (uint8_t& value : mask.values)
+        value = static_cast<uint8_t>(255 - value);
+}
+
+Mask ResizeMask(const Mask& mask, uint32_t width, uint32_t height) {
+    Bitmap gray;
+    gray.width = mask.width;
+    gray.height = mask.height;
+    gray.pixels.resize(mask.values.size() * 4, 255);
+    for (size_t index = 0; index < mask.values.size(); ++index)
+        gray.pixels[index * 4] = mask.values[index];
+    const Bitmap resized = ResizeBitmap(gray, width, height);
+
+    Mask result;
+    result.width = resized.width;
+    result.height = resized.height;
+    result.values.resize(size_t(resized.width) * resized.height);
+    for (size_t index = 0; index < result.values.size(); ++index)
+        result.values[index] = resized.pixels[index * 4];
+    return result;
+}
+
+void ApplyMask(Bitmap& bitmap, const Mask& mask) {
+    const size_t count = size_t(bitmap.width) * bitmap.height;
+    if (mask.width == bitmap.width && mask.height == bitmap.height) {
+        GetPixelKernels().multiplyAlpha(bitmap.pixels.data(), mask.values.data(), count);
+        return;
+    }
+    const Mask resized = ResizeMask(mask, bitmap.width, bitmap.height);
+    GetPixelKernels().multiplyAlpha(bitmap.pixels.data(), resized.values.data(), count);
+}
+
+void PremultiplyBitmap(Bitmap& bitmap) {
+    GetPixelKernels().premultiply(bitmap.pixels.data(), size_t(bitmap.width) * bitmap.height);
+}
+
+void UnpremultiplyBitmap(Bitmap& bitmap) {
+    GetPixelKernels().unpremultiply(bitmap.pixels.data(), size_t(bitmap.width) * bitmap.height);
+}
+
+void CompositeOver(Bitmap& foreground, const Bitmap& background) {
+    GetPixelKernels().over(foreground.pixels.data(), background.pixels.data(), size_t(foreground.width) * foreground.height);
+}
+
+void CompositeOverColor(Bitmap& foreground, const uint8_t color[4]) {
+    const PixelKernels& kernels = GetPixelKernels();
+    std::vector<uint8_t> row(size_t(foreground.width) * 4);
+    for (size_t index = 0; index < row.size(); ++index)
+        row[index] = color[index % 4];
+    kernels.premultiply(row.data(), foreground.width);
+    for (uint32_t y = 0; y < foreground.height; ++y)
+        kernels.over(foreground.pixels.data() + size_t(y) * row.size(), row.data(), foreground.width);
+}
+
+bool IsOpaque(const Bitmap& bitmap) {
+    for (size_t index = 3; index < bitmap.pixels.size(); index += 4) {
+        if (bitmap.pixels[index] != 255)
+            return false;
+    }
+    return true;
+}
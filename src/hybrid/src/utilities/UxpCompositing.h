@@ -0,0 +1,72 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "UxpPixels.h"
+
+/** Masks and compositing of decoded images (prepareMask, compositeImage).
+
+ A mask holds one 8-bit value per pixel, 255 where the image is kept. The operations run
+ over whole rows with the kernels of UxpPixelKernels.h, so that a 4K mask is prepared in
+ a few milliseconds: dilation and erosion take log2(size) passes of maximum or minimum
+ whatever their radius, and feathering approximates a gaussian with 3 box filters of
+ running sums, whatever its sigma.
+*/
+
+struct Mask {
+    uint32_t width{0};
+    uint32_t height{0};
+    std::vector<uint8_t> values;
+};
+
+enum class MaskChannel {
+    // alpha if the image has transparent pixels, luma otherwise
+    automatic,
+    alpha,
+    // luma of the pixels over black
+    luma
+};
+
+Mask ExtractMask(const Bitmap& bitmap, MaskChannel channel);
+
+// 255 where the mask is at least level, 0 elsewhere
+void ThresholdMask(Mask& mask, uint8_t level);
+
+// Grow the mask by radius pixels in each direction (a square), or shrink it when radius is
+// negative. The image is taken as surrounded by 0 when growing and by 255 when shrinking.
+void DilateMask(Mask& mask, int radius);
+
+// Blur the mask by about a gaussian of sigma pixels (up to 127), edges extended
+void FeatherMask(Mask& mask, double sigma);
+
+void InvertMask(Mask& mask);
+
+// Resample to width x height, averaging the values covered by each value
+Mask ResizeMask(const Mask& mask, uint32_t width, uint32_t height);
+
+// Multiply the alpha of the bitmap by the mask, resized to the bitmap when it differs
+void ApplyMask(Bitmap& bitmap, const Mask& mask);
+
+void PremultiplyBitmap(Bitmap& bitmap);
+void UnpremultiplyBitmap(Bitmap& bitmap);
+
+// foreground = foreground over background, both premultiplied and of the same size
+void CompositeOver(Bitmap& foreground, const Bitmap& background);
+
+// foreground = foreground over a color, rgba not premultiplied
+void CompositeOverColor(Bitmap& foreground, const uint8_t color[4]);
+
+// Whether every pixel is opaque
+bool IsOpaque(const Bitmap& bitmap);
@@ -0,0 +1,226 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpCoroutine.h"
+
+#include <new>
+
+#include "UxpTrace.h"
+#include "UxpWorkerPool.h"
+
+namespace coroutine_detail {
+
+namespace {
+
+// Shared with the queue metrics of Task
+const metrics::MetricId kMainQueueMetric = metrics::Register(metrics::Category::queues, "main");
+const metrics::MetricId kScriptQueueMetric = metrics::Register(metrics::Category::queues, "script");
+const metrics::MetricId kWorkerQueueMetric = metrics::Register(metrics::Category::queues, "worker");
+
+/** Per-thread free lists of coroutine frames, one per 128 byte size class.
+ Frames usually start on the JavaScript thread and are destroyed there, so the
+ lists don't need any synchronization. A frame freed on another thread simply
+ moves to that thread's list.
+*/
+class FramePool {
+ public:
+    static constexpr std::size_t kGranularity = 128;
+    static constexpr std::size_t kClasses = 16;  // frames up to 2 KB are pooled
+    static constexpr std::size_t kMaxCached = 64;  // per size class
+
+    ~FramePool() {
+        for (auto& list : mLists) {
+            while (list.head != nullptr) {
+                FreeBlock* block = list.head;
+                list.head = block->next;
+                ::operator delete(block);
+            }
+        }
+    }
+
+    void* Allocate(std::size_t size) {
+        const std::size_t index = ClassOf(size);
+        if (index >= kClasses)
+            return ::operator new(size);
+
+        auto& list = mLists[index];
+        if (list.head == nullptr)
+            return ::operator new((index + 1) * kGranularity);
+
+        FreeBlock* block = list.head;
+        list.head = block->next;
+        --list.count;
+        return block;
+    }
+
+    void Deallocate(void* frame, std::size_t size) noexcept {
+        const std::size_t index = ClassOf(size);
+        if (index >= kClasses || mLists[index].count >= kMaxCached) {
+            ::operator delete(frame);
+            return;
+        }
+
+        auto& list = mLists[index];
+        list.head = new (frame) FreeBlock{list.head};
+        ++list.count;
+    }
+
+ private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct FreeList {
+        FreeBlock* head{nullptr};
+        std::size_t count{0};
+    };
+
+    static std::size_t ClassOf(std::size_t size) { return size == 0 ? 0 : (size - 1) / kGranularity; }
+
+    FreeList mLists[kClasses];
+};
+
+FramePool& GetFramePool() {
+    thread_local FramePool pool;
+    return pool;
+}
+
+void MainThunk(addon_task_data data) {
+    auto laneSwitch = reinterpret_cast<LaneSwitch*>(data);
+    laneSwitch->queued.Record(kMainQueueMetric);
+    trace::SetThreadName("host main");
+    UXP_ADDON_TRACE_SCOPE("coroutine", "resume on main");
+    trace::FlowEnd("coroutine", "hop", laneSwitch->flow);
+    laneSwitch->handle.resume();
+}
+
+void ScriptThunk(addon_task_data data) {
+    // The lane switch is part of the frame, which may be gone once resume returns
+    const LaneSwitch laneSwitch = *reinterpret_cast<LaneSwitch*>(data);
+    try {
+        laneSwitch.queued.Record(kScriptQueueMetric);
+        trace::SetThreadName("javascript");
+        UXP_ADDON_TRACE_SCOPE("coroutine", "resume on script");
+        trace::FlowEnd("coroutine", "hop", laneSwitch.flow);
+        HandlerScope scope(laneSwitch.env);
+        laneSwitch.handle.resume();
+    } catch (...) {
+    }
+}
+
+void CompletionThunk(addon_task_data data) {
+    auto promise = reinterpret_cast<PromiseBase*>(data);
+    promise->mComplete(promise->mFrame);
+}
+
+// The queued coroutine is owned by the coroutine itself, nothing to release
+void NoDestructor(addon_task_data /*data*/) {}
+
+}  // namespace
+
+void* AllocateFrame(std::size_t size) {
+    return GetFramePool().Allocate(size);
+}
+
+void DeallocateFrame(void* frame, std::size_t size) noexcept {
+    GetFramePool().Deallocate(frame, size);
+}
+
+void ResumeOnWorker(LaneSwitch& laneSwitch) {
+    UXP_ADDON_TRACE_SCOPE("coroutine", "switch to worker");
+    laneSwitch.flow = trace::NewFlowId();
+    trace::FlowBegin("coroutine", "hop", laneSwitch.flow);
+    LaneSwitch* pending = &laneSwitch;
+    WorkerPool::Instance().Schedule(
+        [pending]() {
+            pending->queued.Record(kWorkerQueueMetric);
+            UXP_ADDON_TRACE_SCOPE("coroutine", "resume on worker");
+            trace::FlowEnd("coroutine", "hop", pending->flow);
+            pending->handle.resume();
+        },
+        [pending]() {
+            // The pool shut down first: the coroutine resumes here and rejects with ABORT_ERR
+            pending->dropped = true;
+            pending->handle.resume();
+        });
+}
+
+void ResumeOnThread(LaneSwitch& laneSwitch) {
+    UXP_ADDON_TRACE_SCOPE("coroutine", "switch to thread");
+    laneSwitch.flow = trace::NewFlowId();
+    trace::FlowBegin("coroutine", "hop", laneSwitch.flow);
+    LaneSwitch* pending = &laneSwitch;
+    WorkerPool::Instance().ScheduleDedicated([pending]() {
+        UXP_ADDON_TRACE_SCOPE("coroutine", "resume on thread");
+        trace::FlowEnd("coroutine", "hop", pending->flow);
+        pending->handle.resume();
+    });
+}
+
+void ResumeOnMain(LaneSwitch& laneSwitch) {
+    UXP_ADDON_TRACE_SCOPE("coroutine", "switch to main");
+    laneSwitch.flow = trace::NewFlowId();
+    trace::FlowBegin("coroutine", "hop", laneSwitch.flow);
+    UxpAddonApis.uxp_addon_schedule_on_main_queue(laneSwitch.env, MainThunk, &laneSwitch, NoDestructor);
+}
+
+void ResumeOnScript(LaneSwitch& laneSwitch) {
+    UXP_ADDON_TRACE_SCOPE("coroutine", "switch to script");
+    laneSwitch.flow = trace::NewFlowId();
+    trace::FlowBegin("coroutine", "hop", laneSwitch.flow);
+    UxpAddonApis.uxp_addon_schedule_on_javascript_queue(laneSwitch.env, ScriptThunk, &laneSwitch, NoDestructor);
+}
+
+void ScheduleCompletion(PromiseBase& promise, void* frame, void (*complete)(void* frame)) {
+    promise.mFrame = frame;
+    promise.mComplete = complete;
+    UxpAddonApis.uxp_addon_schedule_on_javascript_queue(promise.mEnv, CompletionThunk, &promise, NoDestructor);
+}
+
+void Complete(std::coroutine_handle<> handle, PromiseBase& promise, Value* result) noexcept {
+    const addon_env env = promise.mEnv;
+    const addon_deferred deferred = promise.mDeferred;
+    bool failed = promise.mFailed;
+    std::string code = std::move(promise.mErrorCode);
+    std::string message = std::move(promise.mErrorMessage);
+
+    try {
+        HandlerScope scope(env);
+        addon_value value = nullptr;
+        if (!failed) {
+            try {
+                if (result != nullptr)
+                    value = result->Convert(env);
+                else
+                    Check(UxpAddonApis.uxp_addon_get_undefined(env, &value));
+            } catch (...) {
+                failed = true;
+                code = GetExceptionCode();
+                message = GetExceptionMessage();
+            }
+        }
+        if (failed)
+            value = CreateError(env, code, message);
+
+        // Release the frame before handing control back to JavaScript
+        std::exchange(handle, nullptr).destroy();
+
+        if (failed)
+            Check(UxpAddonApis.uxp_addon_reject_deferred(env, deferred, value));
+        else
+            Check(UxpAddonApis.uxp_addon_resolve_deferred(env, deferred, value));
+    } catch (...) {
+    }
+
+    if (handle)
+        handle.destroy();
+}
+
+}  // namespace coroutine_detail
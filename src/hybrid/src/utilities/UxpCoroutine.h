@@ -0,0 +1,259 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "../api/UxpAddonTypes.h"
+#include "UxpAddon.h"
+#include "UxpCancellation.h"
+#include "UxpMetrics.h"
+#include "UxpValue.h"
+
+/** Coroutine front-end for asynchronous exports. An async export is written as a
+ coroutine returning Promise<T> and moves between threads with co_await:
+
+     Promise<Value> Echo(Value input) {
+         co_await OnWorker();     // run on a worker thread
+         ...
+         co_await OnMain();       // run on the host main thread
+         ...
+         co_return input;         // resolves the JavaScript promise
+     }
+
+     addon_value MyAsyncEcho(addon_env env, addon_callback_info info) {
+         ...
+         return Echo(Value(env, arg)).Start(env);
+     }
+
+ The coroutine does not run until Start is called on the JavaScript thread; it then
+ runs inline up to its first co_await. The JavaScript promise is resolved with the
+ co_returned value (converted through Value), or rejected with the code and message
+ of an exception that escapes the coroutine. Code that runs after co_await OnScript()
+ is inside a handle scope and may use the addon APIs.
+
+ Coroutine frames are allocated from a per-thread pool of size classes, so a
+ coroutine costs no heap allocation once the pool is warm. Lane switches hand the
+ suspended frame itself to the queue instead of allocating a task wrapper.
+
+ A coroutine can be given a CancellationToken; every lane switch then checks it and
+ the coroutine is rejected with ABORT_ERR/TIMEOUT_ERR once it is cancelled.
+*/
+
+namespace coroutine_detail {
+
+// Frame pool, see UxpCoroutine.cpp
+void* AllocateFrame(std::size_t size);
+void DeallocateFrame(void* frame, std::size_t size) noexcept;
+
+// A pending switch to another lane. It lives in the suspended coroutine frame and is
+// passed to the queue as the task data, so switching lanes doesn't allocate.
+struct LaneSwitch {
+    addon_env env{nullptr};
+    std::coroutine_handle<> handle;
+    QueueStamp queued;
+    uint64_t flow{0};  // trace arrow from the suspension to the resumption
+    bool dropped{false};  // resumed by the WorkerPool shutdown instead of a worker
+};
+
+// Schedule the resumption of a coroutine on the given queue
+void ResumeOnWorker(LaneSwitch& laneSwitch);
+void ResumeOnThread(LaneSwitch& laneSwitch);
+void ResumeOnMain(LaneSwitch& laneSwitch);
+void ResumeOnScript(LaneSwitch& laneSwitch);
+
+enum class Lane { script, main, worker, thread };
+
+// The part of the coroutine state that does not depend on the result type
+struct PromiseBase {
+    void* operator new(std::size_t size) { return AllocateFrame(size); }
+    void operator delete(void* frame, std::size_t size) noexcept { DeallocateFrame(frame, size); }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    void unhandled_exception() noexcept {
+        mErrorCode = GetExceptionCode();
+        mErrorMessage = GetExceptionMessage();
+        mFailed = true;
+    }
+
+    void ThrowIfCancelled() const {
+        if (mToken != nullptr)
+            mToken->ThrowIfCancelled();
+    }
+
+    addon_env mEnv{nullptr};
+    addon_deferred mDeferred{nullptr};
+    Lane mLane{Lane::script};
+    std::shared_ptr<CancellationToken> mToken;
+    bool mFailed{false};
+    std::string mErrorCode;
+    std::string mErrorMessage;
+
+    // Pending completion on the JavaScript thread
+    void* mFrame{nullptr};
+    void (*mComplete)(void* frame){nullptr};
+};
+
+// Invoke promise.mComplete(frame) on the JavaScript thread
+void ScheduleCompletion(PromiseBase& promise, void* frame, void (*complete)(void* frame));
+
+// Resolve or reject the deferred and destroy the frame.
+// Invoked on the JavaScript thread.
+void Complete(std::coroutine_handle<> handle, PromiseBase& promise, Value* result) noexcept;
+
+struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+
+    template <typename Promise>
+    void await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+        auto& promise = handle.promise();
+        if (promise.mLane == Lane::script)
+            promise.Complete(handle);
+        else
+            ScheduleCompletion(promise, handle.address(), &Promise::CompleteFrame);
+    }
+
+    void await_resume() const noexcept {}
+};
+
+// Awaitable that moves the coroutine to another lane
+template <Lane lane>
+struct LaneAwaiter : LaneSwitch {
+    bool await_ready() const noexcept { return false; }
+
+    template <typename Promise>
+    void await_suspend(std::coroutine_handle<Promise> coroutine) {
+        auto& promise = coroutine.promise();
+        mPromise = &promise;
+        env = promise.mEnv;
+        handle = coroutine;
+        queued.Reset();
+        // Must be set before scheduling: the coroutine may resume right away on another thread
+        promise.mLane = lane;
+        switch (lane) {
+        case Lane::worker: ResumeOnWorker(*this); break;
+        case Lane::thread: ResumeOnThread(*this); break;
+        case Lane::main: ResumeOnMain(*this); break;
+        case Lane::script: ResumeOnScript(*this); break;
+        }
+    }
+
+    void await_resume() const {
+        if (dropped)
+            throw OperationCancelled(false);
+        mPromise->ThrowIfCancelled();
+    }
+
+    PromiseBase* mPromise{nullptr};
+};
+
+}  // namespace coroutine_detail
+
+// co_await OnWorker(): continue on a worker thread of the WorkerPool
+inline coroutine_detail::LaneAwaiter<coroutine_detail::Lane::worker> OnWorker() {
+    return {};
+}
+
+// co_await OnThread(): continue on a thread of its own, for code that blocks for an
+// unbounded time (see WorkerPool::ScheduleDedicated)
+inline coroutine_detail::LaneAwaiter<coroutine_detail::Lane::thread> OnThread() {
+    return {};
+}
+
+// co_await OnMain(): continue on the host main thread
+inline coroutine_detail::LaneAwaiter<coroutine_detail::Lane::main> OnMain() {
+    return {};
+}
+
+// co_await OnScript(): continue on the JavaScript thread
+inline coroutine_detail::LaneAwaiter<coroutine_detail::Lane::script> OnScript() {
+    return {};
+}
+
+template <typename T = Value>
+class Promise {
+ public:
+    struct promise_type : coroutine_detail::PromiseBase {
+        Promise get_return_object() { return Promise(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        coroutine_detail::FinalAwaiter final_suspend() noexcept { return {}; }
+
+        template <typename U>
+        void return_value(U&& value) {
+            mResult.emplace(std::forward<U>(value));
+        }
+
+        void Complete(std::coroutine_handle<> handle) noexcept {
+            std::optional<Value> result;
+            try {
+                if (!mFailed && mResult.has_value())
+                    result.emplace(std::move(*mResult));
+            } catch (...) {
+                unhandled_exception();
+            }
+            coroutine_detail::Complete(handle, *this, result.has_value() ? &*result : nullptr);
+        }
+
+        static void CompleteFrame(void* frame) noexcept {
+            auto handle = std::coroutine_handle<promise_type>::from_address(frame);
+            handle.promise().Complete(handle);
+        }
+
+        std::optional<T> mResult;
+    };
+
+    Promise(Promise&& other) noexcept : mHandle(std::exchange(other.mHandle, nullptr)) {}
+    Promise& operator=(Promise&&) = delete;
+    Promise(const Promise&) = delete;
+    Promise& operator=(const Promise&) = delete;
+
+    ~Promise() {
+        // A coroutine that was never started still belongs to this object
+        if (mHandle)
+            mHandle.destroy();
+    }
+
+    // Only valid before the coroutine is started
+    Promise& SetCancellationToken(std::shared_ptr<CancellationToken> token) {
+        mHandle.promise().mToken = std::move(token);
+        return *this;
+    }
+
+    // Run the coroutine and return the JavaScript promise that completes with it.
+    // This method must be invoked on the JavaScript thread.
+    addon_value Start(addon_env env) {
+        if (!mHandle)
+            throw "Coroutines can only be started once";
+
+        auto& promise = mHandle.promise();
+        promise.mEnv = env;
+
+        addon_value result = nullptr;
+        Check(UxpAddonApis.uxp_addon_create_promise(env, &promise.mDeferred, &result));
+        if (promise.mToken != nullptr)
+            Check(UxpAddonApis.uxp_addon_set_named_property(env, result, "signal", promise.mToken->CreateHandle(env)));
+
+        // From now on the coroutine owns (and eventually destroys) its frame
+        std::exchange(mHandle, nullptr).resume();
+        return result;
+    }
+
+ private:
+    explicit Promise(std::coroutine_handle<promise_type> handle) : mHandle(handle) {}
+
+    std::coroutine_handle<promise_type> mHandle;
+};
@@ -0,0 +1,94 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpDifference.h"
+
+#include <algorithm>
+
+#include "UxpMetrics.h"
+#include "UxpPixelKernels.h"
+
+ImageDifference DiffBitmaps(const Bitmap& a, const Bitmap& b, uint8_t tolerance, uint32_t tileSize, bool keepMask) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "imageDiff");
+    metrics.AddBytesIn(a.pixels.size() + b.pixels.size());
+    const PixelKernels& kernels = GetPixelKernels();
+    const size_t width = a.width;
+    const size_t height = a.height;
+    const size_t columns = (width + tileSize - 1) / tileSize;
+    const size_t rows = (height + tileSize - 1) / tileSize;
+
+    ImageDifference difference;
+    if (keepMask) {
+        difference.mask.width = a.width;
+        difference.mask.height = a.height;
+        difference.mask.values.resize(width * height);
+    }
+
+    // Changed pixels per tile. Thresholded values are 255 (-1 as a signed byte) or 0, so
+    // the sum of their magnitudes counts the changed ones.
+    std::vector<uint64_t> counts(columns * rows, 0);
+    std::vector<uint8_t> scratch(keepMask ? 0 : width);
+    for (size_t y = 0; y < height; ++y) {
+        uint8_t* values = keepMask ? difference.mask.values.data() + y * width : scratch.data();
+        if (tolerance == 255) {
+            std::fill(values, values + width, 0);
+            continue;
+        }
+        kernels.difference(values, a.pixels.data() + y * width * 4, b.pixels.data() + y * width * 4, width);
+        kernels.threshold(values, width, static_cast<uint8_t>(tolerance + 1));
+        uint64_t* tileCounts = counts.data() + (y / tileSize) * columns;
+        for (size_t column = 0; column < columns; ++column) {
+            const size_t left = column * tileSize;
+            tileCounts[column] += kernels.sumMagnitudes(values + left, std::min<size_t>(tileSize, width - left));
+        }
+    }
+
+    // Regions of touching changed tiles
+    std::vector<bool> visited(counts.size(), false);
+    std::vector<size_t> pending;
+    for (size_t first = 0; first < counts.size(); ++first) {
+        if (counts[first] == 0 || visited[first])
+            continue;
+        size_t top = first / columns, bottom = top, left = first % columns, right = left;
+        uint64_t pixels = 0;
+        visited[first] = true;
+        pending.push_back(first);
+        while (!pending.empty()) {
+            const size_t tile = pending.back();
+            pending.pop_back();
+            const size_t row = tile / columns;
+            const size_t column = tile % columns;
+            top = std::min(top, row);
+            bottom = std::max(bottom, row);
+            left = std::min(left, column);
+            right = std::max(right, column);
+            pixels += counts[tile];
+            for (size_t near = row > 0 ? row - 1 : 0; near <= std::min(row + 1, rows - 1); ++near) {
+                for (size_t beside = column > 0 ? column - 1 : 0; beside <= std::min(column + 1, columns - 1); ++beside) {
+                    const size_t neighbor = near * columns + beside;
+                    if (counts[neighbor] != 0 && !visited[neighbor]) {
+                        visited[neighbor] = true;
+                        pending.push_back(neighbor);
+                    }
+                }
+            }
+        }
+
+        DifferenceRegion region;
+        region.x = static_cast<uint32_t>(left * tileSize);
+        region.y = static_cast<uint32_t>(top * tileSize);
+        region.width = static_cast<uint32_t>(std::min((right + 1) * tileSize, width) - region.x);
+        region.height = static_cast<uint32_t>(std::min((bottom + 1) * tileSize, height) - region.y);
+        region.pixels = pixels;
+        difference.changedPixels += pixels;
+        difference.regions.push_back(region);
+    }
+    return difference;
+}
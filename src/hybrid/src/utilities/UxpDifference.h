@@ -0,0 +1,47 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "UxpCompositing.h"
+
+/** The regions that differ between two versions of an image (diffImages).
+
+ A pixel changed when one of its components differs by more than the tolerance. The image
+ is divided into square tiles, and the changed tiles that touch, diagonals included, form
+ a region: storing the tiles of the regions is enough to rebuild the corrected version
+ from the original. The per-pixel differences are computed with the kernels of
+ UxpPixelKernels.h, so that a 4K pair is compared in a few milliseconds once decoded.
+*/
+
+struct DifferenceRegion {
+    // Bounds in pixels, aligned on the tiles and within the image
+    uint32_t x{0};
+    uint32_t y{0};
+    uint32_t width{0};
+    uint32_t height{0};
+    // Changed pixels in the region
+    uint64_t pixels{0};
+};
+
+struct ImageDifference {
+    uint64_t changedPixels{0};
+    // In the order of their top left tile, row after row
+    std::vector<DifferenceRegion> regions;
+    // 255 where a pixel changed, when requested
+    Mask mask;
+};
+
+// Compare bitmaps of the same size
+ImageDifference DiffBitmaps(const Bitmap& a, const Bitmap& b, uint8_t tolerance, uint32_t tileSize, bool keepMask);
@@ -0,0 +1,514 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpFiles.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+
+#include "UxpAddon.h"
+#include "UxpCancellation.h"
+#include "UxpIoEngine.h"
+#include "UxpMedia.h"
+#include "UxpMetrics.h"
+#include "UxpPack.h"
+#include "UxpStorage.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#endif
+
+#ifdef __APPLE__
+#include <sys/clonefile.h>
+#endif
+
+namespace {
+
+const std::string kBase64Chars =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "abcdefghijklmnopqrstuvwxyz"
+    "0123456789+/";
+
+inline bool IsBase64(unsigned char c) {
+    return (std::isalnum(c) || (c == '+') || (c == '/'));
+}
+
+std::vector<unsigned char> DecodeBase64(const std::string& encoded) {
+    size_t in_len = encoded.size();
+    size_t i = 0;
+    size_t j = 0;
+    size_t in_ = 0;
+    unsigned char char_array_4[4], char_array_3[3];
+    std::vector<unsigned char> ret;
+
+    while (in_len-- && (encoded[in_] != '=') && IsBase64(static_cast<unsigned char>(encoded[in_]))) {
+        char_array_4[i++] = static_cast<unsigned char>(encoded[in_]);
+        ++in_;
+        if (i == 4) {
+            for (i = 0; i < 4; ++i) {
+                const auto idx = kBase64Chars.find(static_cast<char>(char_array_4[i]));
+                if (idx == std::string::npos) {
+                    return ret;
+                }
+                char_array_4[i] = static_cast<unsigned char>(idx);
+            }
+
+            char_array_3[0] = static_cast<unsigned char>((char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4));
+            char_array_3[1] = static_cast<unsigned char>(((char_array_4[1] & 0x0F) << 4) + ((char_array_4[2] & 0x3C) >> 2));
+            char_array_3[2] = static_cast<unsigned char>(((char_array_4[2] & 0x03) << 6) + char_array_4[3]);
+
+            for (i = 0; i < 3; ++i) {
+                ret.push_back(char_array_3[i]);
+            }
+            i = 0;
+        }
+    }
+
+    if (i) {
+        for (j = 0; j < i; ++j) {
+            const auto idx = kBase64Chars.find(static_cast<char>(char_array_4[j]));
+            if (idx == std::string::npos) {
+                break;
+            }
+            char_array_4[j] = static_cast<unsigned char>(idx);
+        }
+
+        char_array_3[0] = static_cast<unsigned char>((char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4));
+        char_array_3[1] = static_cast<unsigned char>(((char_array_4[1] & 0x0F) << 4) + ((char_array_4[2] & 0x3C) >> 2));
+        char_array_3[2] = static_cast<unsigned char>(((char_array_4[2] & 0x03) << 6) + char_array_4[3]);
+
+        for (j = 0; j < i - 1; ++j) {
+            ret.push_back(char_array_3[j]);
+        }
+    }
+
+    return ret;
+}
+
+}  // namespace
+
+std::vector<unsigned char> Base64Decode(const std::string& encoded) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "base64Decode");
+    metrics.AddBytesIn(encoded.size());
+    auto decoded = DecodeBase64(encoded);
+    metrics.AddBytesOut(decoded.size());
+    return decoded;
+}
+
+namespace {
+
+bool WriteParts(const std::string& filePathStr, const std::vector<std::string_view>& parts) {
+    std::filesystem::path filePath(filePathStr);
+    const auto parent = filePath.parent_path();
+    if (!parent.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(parent, ec);
+        if (ec) {
+            return false;
+        }
+    }
+
+    std::ofstream output(filePath, std::ios::binary | std::ios::out);
+    if (!output.is_open()) {
+        return false;
+    }
+
+    for (const auto& part : parts)
+        output.write(part.data(), static_cast<std::streamsize>(part.size()));
+    output.close();
+
+    return output.good() && std::filesystem::exists(filePath);
+}
+
+}  // namespace
+
+// The file system part of a write, measured separately from the decoding
+bool WriteFileParts(const std::string& filePathStr, const std::vector<std::string_view>& parts) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "fileWrite");
+    uint64_t size = 0;
+    for (const auto& part : parts)
+        size += part.size();
+    metrics.AddBytesOut(size);
+    const bool success = WriteParts(filePathStr, parts);
+    if (!success)
+        metrics.Fail();
+    else
+        StorageManager::Instance().RecordWrite(filePathStr, size);
+    return success;
+}
+
+std::vector<std::string_view> GetPayloadParts(const std::string& payload,
+                                              const WriteOptions& options,
+                                              std::vector<unsigned char>& decoded,
+                                              FaststartPlan& plan) {
+    if (options.base64)
+        decoded = Base64Decode(payload);
+    const auto* data = options.base64 ? decoded.data() : reinterpret_cast<const uint8_t*>(payload.data());
+    const size_t size = options.base64 ? decoded.size() : payload.size();
+
+    // Payloads that aren't movies are written as they are
+    bool relocate = false;
+    if (options.faststart) {
+        try {
+            relocate = PlanFaststart(data, size, plan);
+        } catch (const AddonError&) {
+        }
+    }
+    return relocate ? FaststartParts(data, size, plan)
+                    : std::vector<std::string_view>{std::string_view(reinterpret_cast<const char*>(data), size)};
+}
+
+bool WriteFileContents(const std::string& filePathStr, const std::string& payload, const WriteOptions& options) {
+    std::vector<unsigned char> decoded;
+    FaststartPlan plan;
+    const auto parts = GetPayloadParts(payload, options, decoded, plan);
+    if (options.pack) {
+        const std::filesystem::path filePath(filePathStr);
+        return PackStore::Instance().Write(filePath.parent_path().string(), filePath.filename().string(), parts);
+    }
+    return WriteFileParts(filePathStr, parts);
+}
+
+std::vector<bool> WriteBatch(const std::vector<BatchWrite>& writes,
+                             size_t begin,
+                             size_t end,
+                             bool durable,
+                             const std::function<void(size_t)>& onWritten,
+                             const CancellationToken* token) {
+    std::vector<bool> results(end - begin, false);
+    std::vector<std::vector<unsigned char>> decoded(end - begin);
+    std::vector<FaststartPlan> plans(end - begin);
+    std::vector<IoEngine::WriteRequest> requests;
+    std::vector<size_t> indexes;
+    for (size_t index = begin; index < end; ++index) {
+        const auto& write = writes[index];
+        const auto parts = GetPayloadParts(write.payload, write.options, decoded[index - begin], plans[index - begin]);
+        if (write.options.pack) {
+            const std::filesystem::path filePath(write.path);
+            results[index - begin] =
+                PackStore::Instance().Write(filePath.parent_path().string(), filePath.filename().string(), parts);
+            if (onWritten != nullptr)
+                onWritten(index);
+            continue;
+        }
+        requests.push_back({write.path, parts});
+        indexes.push_back(index);
+    }
+
+    IoEngine::Instance().Write(requests, durable, [&](size_t request, bool success) {
+        results[indexes[request] - begin] = success;
+        if (onWritten != nullptr)
+            onWritten(indexes[request]);
+    }, token);
+    return results;
+}
+
+namespace {
+
+// Kernel copies are split so that progress and cancellation are noticed
+constexpr uint64_t kCopyChunkSize = 8 << 20;
+constexpr size_t kCopyBufferSize = 1 << 20;
+
+// Removes the partial copy unless it was renamed over the destination
+struct PartialCopy {
+    std::filesystem::path path;
+    bool committed{false};
+
+    ~PartialCopy() {
+        if (!committed) {
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+        }
+    }
+};
+
+#ifdef _WIN32
+
+struct CopyProgress {
+    const std::function<void(uint64_t)>* onBytes;
+    const CancellationToken* token;
+    uint64_t reported{0};
+};
+
+DWORD CALLBACK OnCopyProgress(LARGE_INTEGER, LARGE_INTEGER transferred, LARGE_INTEGER, LARGE_INTEGER,
+                              DWORD, DWORD, HANDLE, HANDLE, LPVOID data) {
+    auto* progress = static_cast<CopyProgress*>(data);
+    const auto bytes = static_cast<uint64_t>(transferred.QuadPart);
+    if (bytes > progress->reported) {
+        (*progress->onBytes)(bytes - progress->reported);
+        progress->reported = bytes;
+    }
+    return progress->token != nullptr && progress->token->IsCancelled() ? PROGRESS_CANCEL : PROGRESS_CONTINUE;
+}
+
+const char* CopyContents(const std::string& source, const std::filesystem::path& target,
+                         const std::function<void(uint64_t)>& onBytes, const CancellationToken* token, uint64_t& bytes) {
+    CopyProgress progress{&onBytes, token};
+    if (!CopyFileExW(std::filesystem::path(source).c_str(), target.c_str(), OnCopyProgress, &progress, nullptr, 0)) {
+        if (token != nullptr)
+            token->ThrowIfCancelled();
+        throw AddonError(UXP_ADDON_IO_ERROR, "Unable to copy " + source);
+    }
+    bytes = progress.reported;
+    return "kernel";
+}
+
+#else
+
+struct Descriptor {
+    int fd{-1};
+
+    ~Descriptor() {
+        if (fd >= 0)
+            close(fd);
+    }
+};
+
+const char* CopyContents(const std::string& source, const std::filesystem::path& target,
+                         const std::function<void(uint64_t)>& onBytes, const CancellationToken* token, uint64_t& bytes) {
+    Descriptor input;
+    input.fd = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (input.fd < 0 || fstat(input.fd, &status) != 0)
+        throw AddonError(UXP_ADDON_IO_ERROR, "Unable to open " + source);
+    if (!S_ISREG(status.st_mode))
+        throw AddonError(UXP_ADDON_IO_ERROR, source + " is not a regular file");
+    const auto size = static_cast<uint64_t>(status.st_size);
+
+#ifdef __APPLE__
+    // clonefile creates the target itself
+    std::error_code ec;
+    std::filesystem::remove(target, ec);
+    if (clonefile(source.c_str(), target.c_str(), 0) == 0) {
+        bytes = size;
+        onBytes(size);
+        return "clone";
+    }
+#endif
+
+    Descriptor output;
+    output.fd = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, status.st_mode & 0777);
+    if (output.fd < 0)
+        throw AddonError(UXP_ADDON_IO_ERROR, "Unable to create " + target.string());
+
+    const char* method = "buffered";
+    uint64_t copied = 0;
+    const auto advance = [&](ssize_t count) {
+        copied += static_cast<uint64_t>(count);
+        onBytes(static_cast<uint64_t>(count));
+    };
+
+#ifdef __linux__
+    if (ioctl(output.fd, FICLONE, input.fd) == 0) {
+        bytes = size;
+        onBytes(size);
+        return "clone";
+    }
+
+    // Each method continues where the previous one stopped, at explicit offsets.
+    // A short copy falls through to the next method, which finds the end of the file.
+    while (copied < size) {
+        if (token != nullptr)
+            token->ThrowIfCancelled();
+        loff_t inputOffset = static_cast<loff_t>(copied);
+        loff_t outputOffset = static_cast<loff_t>(copied);
+        const ssize_t count = copy_file_range(input.fd, &inputOffset, output.fd, &outputOffset,
+                                              static_cast<size_t>(std::min(kCopyChunkSize, size - copied)), 0);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            break;
+        method = "kernel";
+        advance(count);
+    }
+
+    if (copied < size && lseek(output.fd, static_cast<off_t>(copied), SEEK_SET) >= 0) {
+        while (copied < size) {
+            if (token != nullptr)
+                token->ThrowIfCancelled();
+            off_t offset = static_cast<off_t>(copied);
+            const ssize_t count = sendfile(output.fd, input.fd, &offset, static_cast<size_t>(std::min(kCopyChunkSize, size - copied)));
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                break;
+            method = "kernel";
+            advance(count);
+        }
+    }
+#endif
+
+    // Last resort, also used past the size the file had when it was opened
+    std::vector<char> buffer;
+    for (;;) {
+        if (token != nullptr)
+            token->ThrowIfCancelled();
+        if (buffer.empty())
+            buffer.resize(kCopyBufferSize);
+        const ssize_t count = pread(input.fd, buffer.data(), buffer.size(), static_cast<off_t>(copied));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+            throw AddonError(UXP_ADDON_IO_ERROR, "Unable to read " + source);
+        if (count == 0)
+            break;
+        for (ssize_t written = 0; written < count;) {
+            const ssize_t result = pwrite(output.fd, buffer.data() + written, static_cast<size_t>(count - written),
+                                          static_cast<off_t>(copied + static_cast<uint64_t>(written)));
+            if (result < 0 && errno == EINTR)
+                continue;
+            if (result <= 0)
+                throw AddonError(UXP_ADDON_IO_ERROR, "Unable to write " + target.string());
+            written += result;
+        }
+        if (copied < size)
+            method = "buffered";
+        advance(count);
+    }
+
+    if (close(output.fd) != 0) {
+        output.fd = -1;
+        throw AddonError(UXP_ADDON_IO_ERROR, "Unable to write " + target.string());
+    }
+    output.fd = -1;
+    bytes = copied;
+    return method;
+}
+
+#endif
+
+}  // namespace
+
+CopyResult CopyFileFast(const std::string& source,
+                        const std::string& destination,
+                        const std::function<void(uint64_t)>& onBytes,
+                        const CancellationToken* token) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "fileCopy");
+    try {
+        const std::filesystem::path target(destination);
+        const auto parent = target.parent_path();
+        if (!parent.empty()) {
+            std::error_code ec;
+            std::filesystem::create_directories(parent, ec);
+            if (ec)
+                throw AddonError(UXP_ADDON_IO_ERROR, "Unable to create " + parent.string());
+        }
+
+        PartialCopy partial{std::filesystem::path(destination + ".copying")};
+        CopyResult result;
+        result.method = CopyContents(source, partial.path, onBytes, token, result.bytes);
+
+        std::error_code ec;
+        std::filesystem::rename(partial.path, target, ec);
+        if (ec)
+            throw AddonError(UXP_ADDON_IO_ERROR, "Unable to replace " + destination);
+        partial.committed = true;
+
+        metrics.AddBytesOut(result.bytes);
+        StorageManager::Instance().RecordWrite(destination, result.bytes);
+        return result;
+    } catch (...) {
+        metrics.Fail();
+        throw;
+    }
+}
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) {
+    mFile = CreateFileW(std::filesystem::path(path).c_str(),
+                        GENERIC_READ,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        nullptr,
+                        OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL,
+                        nullptr);
+    if (mFile == INVALID_HANDLE_VALUE) {
+        mFile = nullptr;
+        throw AddonError(UXP_ADDON_IO_ERROR, "Unable to open " + path);
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mFile, &size)) {
+        CloseHandle(mFile);
+        throw AddonError(UXP_ADDON_IO_ERROR, "Unable to read the size of " + path);
+    }
+    mSize = static_cast<size_t>(size.QuadPart);
+    if (mSize == 0)
+        return;
+
+    mMapping = CreateFileMappingW(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mMapping != nullptr)
+        mData = static_cast<const uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+    if (mData == nullptr) {
+        if (mMapping != nullptr)
+            CloseHandle(mMapping);
+        CloseHandle(mFile);
+        throw AddonError(UXP_ADDON_IO_ERROR, "Unable to map " + path);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (mData != nullptr)
+        UnmapViewOfFile(mData);
+    if (mMapping != nullptr)
+        CloseHandle(mMapping);
+    if (mFile != nullptr)
+        CloseHandle(mFile);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) {
+    const int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0)
+        throw AddonError(UXP_ADDON_IO_ERROR, "Unable to open " + path);
+
+    struct stat status;
+    if (fstat(file, &status) != 0 || !S_ISREG(status.st_mode)) {
+        close(file);
+        throw AddonError(UXP_ADDON_IO_ERROR, path + " is not a regular file");
+    }
+    mSize = static_cast<size_t>(status.st_size);
+    if (mSize == 0) {
+        close(file);
+        return;
+    }
+
+    void* data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, file, 0);
+    // The mapping keeps its own reference to the file
+    close(file);
+    if (data == MAP_FAILED) {
+        mSize = 0;
+        throw AddonError(UXP_ADDON_IO_ERROR, "Unable to map " + path);
+    }
+    mData = static_cast<const uint8_t*>(data);
+}
+
+MappedFile::~MappedFile() {
+    if (mData != nullptr)
+        munmap(const_cast<uint8_t*>(mData), mSize);
+}
+
+#endif
@@ -0,0 +1,117 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/** Error code of the errors thrown when a file can't be opened or read */
+#define UXP_ADDON_IO_ERROR "IO_ERR"
+
+// Decode a base64 payload. Decoding stops at the first character that is not part
+// of the base64 alphabet (e.g. the '=' padding).
+std::vector<unsigned char> Base64Decode(const std::string& encoded);
+
+struct WriteOptions {
+    // The payload is decoded first
+    bool base64{false};
+    // MP4/MOV payloads are written with their moov box ahead of the media data (see PlanFaststart)
+    bool faststart{false};
+    // The file is stored in the pack of its directory (see PackStore)
+    bool pack{false};
+};
+
+struct FaststartPlan;
+
+// The parts of the file written for a payload, after decoding (into decoded) and moving
+// the moov box ahead (see PlanFaststart). The parts point into payload, decoded and plan.
+std::vector<std::string_view> GetPayloadParts(const std::string& payload,
+                                              const WriteOptions& options,
+                                              std::vector<unsigned char>& decoded,
+                                              FaststartPlan& plan);
+
+// Write a payload to disk, creating the parent directories when needed
+bool WriteFileContents(const std::string& filePathStr, const std::string& payload, const WriteOptions& options);
+
+// Write the concatenation of parts to disk, creating the parent directories when needed
+bool WriteFileParts(const std::string& filePathStr, const std::vector<std::string_view>& parts);
+
+class CancellationToken;
+
+struct BatchWrite {
+    std::string path;
+    std::string payload;
+    WriteOptions options;
+};
+
+/** Write the entries [begin, end) of a batch (writeFiles). Packed files go to their pack,
+ the others through the I/O engine (see IoEngine), flushed to the disk and renamed over
+ their path with durable. onWritten is invoked with the index of each entry once it is
+ written or failed. Returns whether each entry was written.
+ Throws OperationCancelled between windows of files when the token is cancelled.
+*/
+std::vector<bool> WriteBatch(const std::vector<BatchWrite>& writes,
+                             size_t begin,
+                             size_t end,
+                             bool durable,
+                             const std::function<void(size_t)>& onWritten,
+                             const CancellationToken* token);
+
+struct CopyResult {
+    // "clone" when the copy shares the blocks of the source (reflink), "kernel" when the
+    // data was copied by the system without going through the addon, "buffered" otherwise
+    const char* method{"buffered"};
+    uint64_t bytes{0};
+};
+
+/** Copy a file, replacing the destination and creating its parent directories.
+ The copy is made in <destination>.copying and renamed over the destination when it is
+ complete, so readers never see a partial file. The cheapest method that works is used:
+ a clone of the blocks (FICLONE on Btrfs/XFS, clonefile on APFS), then a copy in the
+ kernel (copy_file_range, sendfile; CopyFileExW on Windows, which clones on ReFS), then
+ a buffered copy. onBytes is invoked with the number of bytes copied since the last call.
+ Throws an AddonError with the IO_ERR code if the copy fails, or OperationCancelled.
+*/
+CopyResult CopyFileFast(const std::string& source,
+                        const std::string& destination,
+                        const std::function<void(uint64_t)>& onBytes,
+                        const CancellationToken* token);
+
+/** Read-only memory mapping of a whole file. Pages are only read from disk when they
+ are touched, so parsers that look at a few headers of a large file stay cheap.
+ Throws an AddonError with the IO_ERR code if the file can't be opened or mapped.
+*/
+
+class MappedFile {
+ public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    // nullptr for an empty file
+    const uint8_t* GetData() const { return mData; }
+    size_t GetSize() const { return mSize; }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+ private:
+    const uint8_t* mData{nullptr};
+    size_t mSize{0};
+#ifdef _WIN32
+    // HANDLEs
+    void* mFile{nullptr};
+    void* mMapping{nullptr};
+#endif
+};
@@ -0,0 +1,184 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpImages.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#include "UxpMetrics.h"
+
+namespace {
+
+uint32_t BigEndian16(const uint8_t* p) {
+    return (uint32_t(p[0]) << 8) | p[1];
+}
+
+uint32_t BigEndian32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+uint32_t LittleEndian16(const uint8_t* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8);
+}
+
+uint32_t LittleEndian24(const uint8_t* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16);
+}
+
+bool ProbePng(const uint8_t* header, ImageInfo& info) {
+    // Signature, then the IHDR chunk: length, type, width, height
+    if (std::memcmp(header + 12, "IHDR", 4) != 0)
+        return false;
+    info.width = BigEndian32(header + 16);
+    info.height = BigEndian32(header + 20);
+    info.format = "png";
+    return true;
+}
+
+bool ProbeGif(const uint8_t* header, ImageInfo& info) {
+    info.width = LittleEndian16(header + 6);
+    info.height = LittleEndian16(header + 8);
+    info.format = "gif";
+    return true;
+}
+
+bool ProbeWebp(HeaderReader& reader, ImageInfo& info) {
+    // RIFF header, then the first chunk
+    uint8_t chunk[4];
+    uint8_t payload[10];
+    if (!reader.Read(12, chunk, sizeof(chunk)))
+        return false;
+    if (std::memcmp(chunk, "VP8 ", 4) == 0) {
+        // Lossy: frame tag, start code, 14-bit width and height
+        if (!reader.Read(20, payload, 10) || payload[3] != 0x9d || payload[4] != 0x01 || payload[5] != 0x2a)
+            return false;
+        info.width = LittleEndian16(payload + 6) & 0x3fff;
+        info.height = LittleEndian16(payload + 8) & 0x3fff;
+    } else if (std::memcmp(chunk, "VP8L", 4) == 0) {
+        // Lossless: signature, then width - 1 and height - 1 on 14 bits each
+        if (!reader.Read(20, payload, 5) || payload[0] != 0x2f)
+            return false;
+        const uint32_t bits = uint32_t(payload[1]) | (uint32_t(payload[2]) << 8) | (uint32_t(payload[3]) << 16) |
+                              (uint32_t(payload[4]) << 24);
+        info.width = (bits & 0x3fff) + 1;
+        info.height = ((bits >> 14) & 0x3fff) + 1;
+    } else if (std::memcmp(chunk, "VP8X", 4) == 0) {
+        // Extended: flags, reserved, canvas width - 1 and height - 1 on 24 bits each
+        if (!reader.Read(20, payload, 10))
+            return false;
+        info.width = LittleEndian24(payload + 4) + 1;
+        info.height = LittleEndian24(payload + 7) + 1;
+    } else {
+        return false;
+    }
+    info.format = "webp";
+    return true;
+}
+
+bool IsStartOfFrame(uint8_t marker) {
+    // SOF0-SOF15 except DHT (C4), JPG (C8) and DAC (CC)
+    return marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc;
+}
+
+bool ProbeJpeg(HeaderReader& reader, ImageInfo& info) {
+    uint64_t offset = 2;
+    for (int segment = 0; segment < 4096; ++segment) {
+        uint8_t marker[2];
+        if (!reader.Read(offset, marker, 2) || marker[0] != 0xff)
+            return false;
+        // Fill bytes
+        if (marker[1] == 0xff) {
+            ++offset;
+            continue;
+        }
+        // Markers without a segment
+        if (marker[1] == 0x01 || (marker[1] >= 0xd0 && marker[1] <= 0xd8)) {
+            offset += 2;
+            continue;
+        }
+        // The image data started without a frame header
+        if (marker[1] == 0xd9 || marker[1] == 0xda)
+            return false;
+
+        uint8_t segmentHeader[7];
+        if (!reader.Read(offset + 2, segmentHeader, IsStartOfFrame(marker[1]) ? 7 : 2))
+            return false;
+        if (IsStartOfFrame(marker[1])) {
+            // Length, precision, height, width
+            info.height = BigEndian16(segmentHeader + 3);
+            info.width = BigEndian16(segmentHeader + 5);
+            info.format = "jpeg";
+            return true;
+        }
+        const uint32_t length = BigEndian16(segmentHeader);
+        if (length < 2)
+            return false;
+        offset += 2 + length;
+    }
+    return false;
+}
+
+}  // namespace
+
+HeaderReader::HeaderReader(const std::string& path) : mStream(std::filesystem::path(path), std::ios::binary | std::ios::in) {}
+
+HeaderReader::HeaderReader(const uint8_t* data, size_t size) : mData(data), mSize(size) {}
+
+bool HeaderReader::Read(uint64_t offset, void* out, size_t size) {
+    if (mData != nullptr) {
+        if (offset > mSize || size > mSize - offset)
+            return false;
+        std::memcpy(out, mData + offset, size);
+        return true;
+    }
+    if (!mStream.is_open() || size > kBlockSize)
+        return false;
+
+    if (offset < mBlockOffset || offset + size > mBlockOffset + mBlock.size()) {
+        mBlock.resize(kBlockSize);
+        mStream.clear();
+        mStream.seekg(static_cast<std::streamoff>(offset));
+        mStream.read(reinterpret_cast<char*>(mBlock.data()), static_cast<std::streamsize>(kBlockSize));
+        mBlock.resize(static_cast<size_t>(std::max<std::streamsize>(0, mStream.gcount())));
+        mBlockOffset = offset;
+        if (size > mBlock.size())
+            return false;
+    }
+    std::memcpy(out, mBlock.data() + (offset - mBlockOffset), size);
+    return true;
+}
+
+bool ProbeImage(HeaderReader& reader, ImageInfo& info) {
+    uint8_t header[24];
+    if (!reader.Read(0, header, 12))
+        return false;
+
+    if (header[0] == 0xff && header[1] == 0xd8)
+        return ProbeJpeg(reader, info);
+    if (std::memcmp(header, "\x89PNG\r\n\x1a\n", 8) == 0)
+        return reader.Read(0, header, 24) && ProbePng(header, info);
+    if (std::memcmp(header, "GIF87a", 6) == 0 || std::memcmp(header, "GIF89a", 6) == 0)
+        return ProbeGif(header, info);
+    if (std::memcmp(header, "RIFF", 4) == 0 && std::memcmp(header + 8, "WEBP", 4) == 0)
+        return ProbeWebp(reader, info);
+    return false;
+}
+
+bool ProbeImageFile(const std::string& path, ImageInfo& info) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "imageProbe");
+    HeaderReader reader(path);
+    if (!reader.IsOpen() || !ProbeImage(reader, info)) {
+        metrics.Fail();
+        return false;
+    }
+    return true;
+}
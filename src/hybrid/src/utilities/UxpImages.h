@@ -0,0 +1,59 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/** Reads the headers of PNG, JPEG, WebP and GIF files.
+ The dimensions are found in the first bytes of PNG, WebP and GIF files. In a JPEG the
+ SOF segment may follow large metadata segments (EXIF thumbnails, ICC profiles), which
+ are skipped over without being read.
+*/
+
+struct ImageInfo {
+    uint32_t width{0};
+    uint32_t height{0};
+    const char* format{nullptr};  // "png", "jpeg", "webp" or "gif"
+};
+
+/** Random access to the start of a file or a memory range, reading it by blocks */
+class HeaderReader {
+ public:
+    explicit HeaderReader(const std::string& path);
+    HeaderReader(const uint8_t* data, size_t size);
+
+    bool IsOpen() const { return mData != nullptr || mStream.is_open(); }
+
+    // Copy size bytes at offset to out; false past the end of the file
+    bool Read(uint64_t offset, void* out, size_t size);
+
+    HeaderReader(const HeaderReader&) = delete;
+    HeaderReader& operator=(const HeaderReader&) = delete;
+
+ private:
+    static constexpr size_t kBlockSize = 4096;
+
+    const uint8_t* mData{nullptr};
+    size_t mSize{0};
+    std::ifstream mStream;
+    std::vector<uint8_t> mBlock;
+    uint64_t mBlockOffset{0};
+};
+
+// Returns false if the data is not a supported image or its header is invalid
+bool ProbeImage(HeaderReader& reader, ImageInfo& info);
+
+// Returns false if the file can't be read or is not a supported image
+bool ProbeImageFile(const std::string& path, ImageInfo& info);
@@ -0,0 +1,719 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpIoEngine.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <set>
+
+#include "UxpAddon.h"
+#include "UxpCancellation.h"
+#include "UxpFiles.h"
+#include "UxpMetrics.h"
+#include "UxpStorage.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace {
+
+// Files opened at once by a batch; their buffers are registered together
+constexpr size_t kWindowFiles = 64;
+
+// Suffix of the files of durable writes until they are renamed
+constexpr const char* kPartialSuffix = ".writing";
+
+uint64_t GetSize(const std::vector<std::string_view>& parts) {
+    uint64_t size = 0;
+    for (const auto& part : parts)
+        size += part.size();
+    return size;
+}
+
+// Create the parent directory of path, unless the batch already did
+bool CreateParent(const std::string& path, std::set<std::string>& created) {
+    const auto parent = std::filesystem::path(path).parent_path();
+    if (parent.empty() || created.count(parent.string()) != 0)
+        return true;
+
+    std::error_code ec;
+    std::filesystem::create_directories(parent, ec);
+    if (ec)
+        return false;
+    created.insert(parent.string());
+    return true;
+}
+
+#ifdef _WIN32
+
+bool WriteOne(const IoEngine::WriteRequest& request, bool durable) {
+    const std::filesystem::path target(request.path);
+    const std::filesystem::path path = durable ? std::filesystem::path(request.path + kPartialSuffix) : target;
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    bool success = true;
+    for (const auto& part : request.parts) {
+        for (size_t written = 0; success && written < part.size();) {
+            DWORD count = 0;
+            const DWORD chunk = static_cast<DWORD>(std::min<size_t>(part.size() - written, 1 << 30));
+            success = WriteFile(file, part.data() + written, chunk, &count, nullptr) && count > 0;
+            written += count;
+        }
+    }
+    if (success && durable)
+        success = FlushFileBuffers(file) != 0;
+    success = CloseHandle(file) && success;
+    if (success && durable)
+        success = MoveFileExW(path.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+    return success;
+}
+
+#else
+
+bool WriteAll(int fd, const std::vector<std::string_view>& parts) {
+    for (const auto& part : parts) {
+        for (size_t written = 0; written < part.size();) {
+            const ssize_t count = write(fd, part.data() + written, part.size() - written);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                return false;
+            written += static_cast<size_t>(count);
+        }
+    }
+    return true;
+}
+
+bool WriteOne(const IoEngine::WriteRequest& request, bool durable) {
+    const std::string path = durable ? request.path + kPartialSuffix : request.path;
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0)
+        return false;
+
+    bool success = WriteAll(fd, request.parts);
+    if (success && durable)
+        success = fsync(fd) == 0;
+    success = close(fd) == 0 && success;
+    if (success && durable)
+        success = rename(path.c_str(), request.path.c_str()) == 0;
+    return success;
+}
+
+#endif
+
+std::optional<std::string> ReadOne(const std::string& path) {
+    // Folders open as streams on some platforms, and fail when they are read
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(std::filesystem::path(path), ec))
+        return std::nullopt;
+    std::ifstream input(std::filesystem::path(path), std::ios::binary | std::ios::ate);
+    if (!input.is_open())
+        return std::nullopt;
+    std::string data(static_cast<size_t>(input.tellg()), '\0');
+    input.seekg(0);
+    if (!input.read(data.data(), static_cast<std::streamsize>(data.size())))
+        return std::nullopt;
+    return data;
+}
+
+}  // namespace
+
+#ifdef __linux__
+
+/** A submission and a completion queue shared with the kernel (see io_uring(7)).
+ liburing isn't available everywhere the addon is built, so the rings are set up with
+ the system calls directly.
+*/
+
+class IoEngine::Ring {
+ public:
+    static constexpr unsigned kEntries = 256;
+
+    static std::unique_ptr<Ring> Create() {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        const int fd = static_cast<int>(syscall(__NR_io_uring_setup, kEntries, &params));
+        if (fd < 0)
+            return nullptr;
+
+        std::unique_ptr<Ring> ring(new Ring(fd));
+        if (!ring->Map(params) || !ring->Probe())
+            return nullptr;
+        return ring;
+    }
+
+    ~Ring() {
+        if (mSqes != nullptr)
+            munmap(mSqes, mSqesSize);
+        if (mCqRing != nullptr && mCqRing != mSqRing)
+            munmap(mCqRing, mCqRingSize);
+        if (mSqRing != nullptr)
+            munmap(mSqRing, mSqRingSize);
+        close(mFd);
+    }
+
+    unsigned GetCapacity() const { return mEntries; }
+    bool SupportsRename() const { return mRename; }
+
+    // The next submission entry, cleared; nullptr when the queue is full
+    io_uring_sqe* Next() {
+        const unsigned head = __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE);
+        if (mTail - head >= mEntries)
+            return nullptr;
+
+        const unsigned index = mTail & mSqMask;
+        io_uring_sqe* sqe = &mSqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        mSqArray[index] = index;
+        ++mTail;
+        return sqe;
+    }
+
+    // Submit the queued entries and wait until at least one request completed
+    bool SubmitAndWait() {
+        __atomic_store_n(mSqTail, mTail, __ATOMIC_RELEASE);
+        for (;;) {
+            const unsigned pending = mTail - mSubmitted;
+            const long result = syscall(__NR_io_uring_enter, mFd, pending, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (result >= 0) {
+                mSubmitted += static_cast<unsigned>(result);
+                if (mSubmitted == mTail)
+                    return true;
+                continue;
+            }
+            // The kernel is short of memory or completions: try again after reaping
+            if (errno == EAGAIN || errno == EBUSY)
+                return true;
+            if (errno != EINTR)
+                return false;
+        }
+    }
+
+    // Invoke handler(user data, result) for the completed requests
+    template <typename Handler>
+    void Reap(Handler&& handler) {
+        unsigned head = *mCqHead;
+        const unsigned tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = mCqes[head & mCqMask];
+            handler(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+    }
+
+    // Pin buffers for the *_FIXED requests. Fails with memory locked by the process limits
+    // or for buffers mapped from files, whose requests then use the plain opcodes.
+    bool RegisterBuffers(const std::vector<iovec>& buffers) {
+        return syscall(__NR_io_uring_register, mFd, IORING_REGISTER_BUFFERS, buffers.data(),
+                       static_cast<unsigned>(buffers.size())) == 0;
+    }
+
+    void UnregisterBuffers() { syscall(__NR_io_uring_register, mFd, IORING_UNREGISTER_BUFFERS, nullptr, 0); }
+
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+ private:
+    explicit Ring(int fd) : mFd(fd) {}
+
+    bool Map(const io_uring_params& params) {
+        mEntries = params.sq_entries;
+        mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        mCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+            mSqRingSize = mCqRingSize = std::max(mSqRingSize, mCqRingSize);
+
+        void* sqRing = mmap(nullptr, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED)
+            return false;
+        mSqRing = sqRing;
+        if (single) {
+            mCqRing = mSqRing;
+        } else {
+            void* cqRing = mmap(nullptr, mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_CQ_RING);
+            if (cqRing == MAP_FAILED)
+                return false;
+            mCqRing = cqRing;
+        }
+        mSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+        mSqes = static_cast<io_uring_sqe*>(sqes);
+
+        auto* sq = static_cast<uint8_t*>(mSqRing);
+        mSqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        mSqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        mSqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        mSqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        auto* cq = static_cast<uint8_t*>(mCqRing);
+        mCqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        mCqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        mCqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        mCqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        mTail = mSubmitted = *mSqTail;
+        return true;
+    }
+
+    // The plain reads and writes are required (5.6); renames (5.11) are done by the
+    // batch otherwise
+    bool Probe() {
+        constexpr unsigned kOps = 256;
+        std::vector<uint8_t> buffer(sizeof(io_uring_probe) + kOps * sizeof(io_uring_probe_op), 0);
+        auto* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+        if (syscall(__NR_io_uring_register, mFd, IORING_REGISTER_PROBE, probe, kOps) != 0)
+            return false;
+
+        const auto supported = [probe](unsigned op) {
+            return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+        };
+        mRename = supported(IORING_OP_RENAMEAT);
+        return supported(IORING_OP_READ) && supported(IORING_OP_WRITE) && supported(IORING_OP_READ_FIXED) &&
+               supported(IORING_OP_WRITE_FIXED) && supported(IORING_OP_FSYNC);
+    }
+
+    const int mFd;
+    unsigned mEntries{0};
+    void* mSqRing{nullptr};
+    size_t mSqRingSize{0};
+    void* mCqRing{nullptr};
+    size_t mCqRingSize{0};
+    io_uring_sqe* mSqes{nullptr};
+    size_t mSqesSize{0};
+
+    unsigned* mSqHead{nullptr};
+    unsigned* mSqTail{nullptr};
+    unsigned mSqMask{0};
+    unsigned* mSqArray{nullptr};
+    unsigned* mCqHead{nullptr};
+    unsigned* mCqTail{nullptr};
+    unsigned mCqMask{0};
+    io_uring_cqe* mCqes{nullptr};
+
+    // Entries queued, and submitted to the kernel
+    unsigned mTail{0};
+    unsigned mSubmitted{0};
+    bool mRename{false};
+};
+
+namespace {
+
+// Reads and writes larger than this are split (the kernel caps them just under 2 GB)
+constexpr uint64_t kMaxRequestSize = 1 << 30;
+
+struct WriteState {
+    size_t index{0};
+    int fd{-1};
+    std::string partial;  // of durable writes
+    unsigned pending{0};
+    bool failed{false};
+};
+
+struct WriteOp {
+    size_t file{0};
+    int64_t expected{0};  // the result of a complete request
+};
+
+struct ReadState {
+    size_t index{0};
+    int fd{-1};
+    std::string data;
+    uint64_t filled{0};
+    int buffer{-1};  // registered buffer index, -1 without
+    bool failed{false};
+};
+
+}  // namespace
+
+#else
+
+// Only a name for the other platforms, where Acquire returns nullptr
+class IoEngine::Ring {};
+
+#endif
+
+IoEngine& IoEngine::Instance() {
+    static IoEngine instance;
+    return instance;
+}
+
+IoEngine::IoEngine() {
+    const char* backend = std::getenv("UXP_ADDON_IO_BACKEND");
+    if (backend != nullptr && std::strcmp(backend, "threads") == 0)
+        return;
+
+    auto ring = Acquire();
+    mBatched = ring != nullptr;
+    if (ring != nullptr)
+        Release(std::move(ring));
+}
+
+IoEngine::~IoEngine() {}
+
+std::unique_ptr<IoEngine::Ring> IoEngine::Acquire() {
+#ifdef __linux__
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mRings.empty()) {
+            auto ring = std::move(mRings.back());
+            mRings.pop_back();
+            return ring;
+        }
+    }
+    return Ring::Create();
+#else
+    return nullptr;
+#endif
+}
+
+void IoEngine::Release(std::unique_ptr<Ring> ring) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mRings.push_back(std::move(ring));
+}
+
+void IoEngine::Shutdown() {
+    std::vector<std::unique_ptr<Ring>> rings;
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::swap(rings, mRings);
+}
+
+std::vector<bool> IoEngine::Write(const std::vector<WriteRequest>& requests,
+                                  bool durable,
+                                  const Completion& onComplete,
+                                  const CancellationToken* token) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "ioWrite");
+    std::vector<bool> results(requests.size(), false);
+    std::set<std::string> parents;
+
+    const auto complete = [&](size_t index, bool success) {
+        results[index] = success;
+        if (success) {
+            const uint64_t size = GetSize(requests[index].parts);
+            metrics.AddBytesOut(size);
+            StorageManager::Instance().RecordWrite(requests[index].path, size);
+        } else {
+            metrics.Fail();
+        }
+        if (onComplete != nullptr)
+            onComplete(index, success);
+    };
+
+    std::unique_ptr<Ring> ring = mBatched ? Acquire() : nullptr;
+    if (ring == nullptr) {
+        for (size_t index = 0; index < requests.size(); ++index) {
+            if (token != nullptr)
+                token->ThrowIfCancelled();
+            complete(index, CreateParent(requests[index].path, parents) && WriteOne(requests[index], durable));
+        }
+        return results;
+    }
+
+#ifdef __linux__
+    // A ring that failed is dropped rather than reused
+    struct Releaser {
+        IoEngine& engine;
+        std::unique_ptr<Ring>& ring;
+        ~Releaser() {
+            if (ring != nullptr)
+                engine.Release(std::move(ring));
+        }
+    } releaser{*this, ring};
+
+    size_t next = 0;
+    while (next < requests.size()) {
+        if (token != nullptr)
+            token->ThrowIfCancelled();
+
+        // Open the files of the window; each file is a chain of writes (then fsync and rename)
+        std::vector<WriteState> window;
+        std::vector<iovec> buffers;
+        unsigned entries = 0;
+        while (next < requests.size() && window.size() < kWindowFiles) {
+            const auto& request = requests[next];
+            unsigned chain = durable ? (ring->SupportsRename() ? 2 : 1) : 0;
+            for (const auto& part : request.parts)
+                chain += part.empty() ? 0 : static_cast<unsigned>((part.size() + kMaxRequestSize - 1) / kMaxRequestSize);
+            if (chain > ring->GetCapacity()) {
+                complete(next, CreateParent(request.path, parents) && WriteOne(request, durable));
+                ++next;
+                continue;
+            }
+            if (entries + chain > ring->GetCapacity())
+                break;
+
+            WriteState file;
+            file.index = next++;
+            if (durable)
+                file.partial = request.path + kPartialSuffix;
+            const std::string& path = durable ? file.partial : request.path;
+            if (CreateParent(request.path, parents))
+                file.fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            if (file.fd < 0) {
+                complete(file.index, false);
+                continue;
+            }
+            for (const auto& part : request.parts) {
+                if (!part.empty())
+                    buffers.push_back({const_cast<char*>(part.data()), part.size()});
+            }
+            entries += chain;
+            window.push_back(std::move(file));
+        }
+
+        const bool fixed = !buffers.empty() && buffers.size() <= 1024 && ring->RegisterBuffers(buffers);
+        std::vector<WriteOp> ops;
+        uint16_t buffer = 0;
+        for (size_t position = 0; position < window.size(); ++position) {
+            auto& file = window[position];
+            std::vector<io_uring_sqe*> chain;
+            uint64_t offset = 0;
+            for (const auto& part : requests[file.index].parts) {
+                if (part.empty())
+                    continue;
+                for (uint64_t start = 0; start < part.size(); start += kMaxRequestSize) {
+                    io_uring_sqe* sqe = ring->Next();
+                    const uint64_t length = std::min<uint64_t>(part.size() - start, kMaxRequestSize);
+                    sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+                    sqe->fd = file.fd;
+                    sqe->addr = reinterpret_cast<uint64_t>(part.data() + start);
+                    sqe->len = static_cast<uint32_t>(length);
+                    sqe->off = offset;
+                    if (fixed)
+                        sqe->buf_index = buffer;
+                    offset += length;
+                    ops.push_back({position, static_cast<int64_t>(length)});
+                    chain.push_back(sqe);
+                }
+                ++buffer;
+            }
+            if (durable) {
+                io_uring_sqe* sqe = ring->Next();
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->fd = file.fd;
+                ops.push_back({position, 0});
+                chain.push_back(sqe);
+            }
+            if (durable && ring->SupportsRename()) {
+                io_uring_sqe* sqe = ring->Next();
+                sqe->opcode = IORING_OP_RENAMEAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = reinterpret_cast<uint64_t>(file.partial.c_str());
+                sqe->len = static_cast<uint32_t>(AT_FDCWD);
+                sqe->addr2 = reinterpret_cast<uint64_t>(requests[file.index].path.c_str());
+                ops.push_back({position, 0});
+                chain.push_back(sqe);
+            }
+            // A failed or short request cancels the rest of its chain
+            for (size_t link = 0; link + 1 < chain.size(); ++link)
+                chain[link]->flags |= IOSQE_IO_LINK;
+            for (size_t link = 0; link < chain.size(); ++link)
+                chain[link]->user_data = ops.size() - chain.size() + link;
+            file.pending = static_cast<unsigned>(chain.size());
+        }
+
+        // Files end with their last request, or are finished on this thread if one failed
+        const auto finish = [&](WriteState& file) {
+            bool success = close(file.fd) == 0 && !file.failed;
+            file.fd = -1;
+            const auto& request = requests[file.index];
+            if (success && durable && !ring->SupportsRename())
+                success = rename(file.partial.c_str(), request.path.c_str()) == 0;
+            if (!success)
+                success = WriteOne(request, durable);
+            complete(file.index, success);
+        };
+        size_t remaining = window.size();
+        for (auto& file : window) {
+            if (file.pending == 0) {
+                finish(file);
+                --remaining;
+            }
+        }
+        bool failed = false;
+        while (remaining > 0 && !failed) {
+            failed = !ring->SubmitAndWait();
+            ring->Reap([&](uint64_t data, int32_t result) {
+                const auto& op = ops[data];
+                auto& file = window[op.file];
+                if (result != op.expected)
+                    file.failed = true;
+                if (--file.pending == 0) {
+                    finish(file);
+                    --remaining;
+                }
+            });
+        }
+        if (failed) {
+            for (auto& file : window) {
+                if (file.fd >= 0)
+                    close(file.fd);
+            }
+            ring.reset();
+            throw AddonError(UXP_ADDON_IO_ERROR, "The I/O ring failed");
+        }
+        if (fixed)
+            ring->UnregisterBuffers();
+    }
+#endif
+    return results;
+}
+
+std::vector<std::optional<std::string>> IoEngine::Read(const std::vector<std::string>& paths,
+                                                       const Completion& onComplete,
+                                                       const CancellationToken* token) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "ioRead");
+    std::vector<std::optional<std::string>> results(paths.size());
+
+    const auto complete = [&](size_t index, std::optional<std::string> data) {
+        if (data.has_value())
+            metrics.AddBytesIn(data->size());
+        results[index] = std::move(data);
+        if (onComplete != nullptr)
+            onComplete(index, results[index].has_value());
+    };
+
+    std::unique_ptr<Ring> ring = mBatched ? Acquire() : nullptr;
+    if (ring == nullptr) {
+        for (size_t index = 0; index < paths.size(); ++index) {
+            if (token != nullptr)
+                token->ThrowIfCancelled();
+            complete(index, ReadOne(paths[index]));
+        }
+        return results;
+    }
+
+#ifdef __linux__
+    // A ring that failed is dropped rather than reused
+    struct Releaser {
+        IoEngine& engine;
+        std::unique_ptr<Ring>& ring;
+        ~Releaser() {
+            if (ring != nullptr)
+                engine.Release(std::move(ring));
+        }
+    } releaser{*this, ring};
+
+    size_t next = 0;
+    while (next < paths.size()) {
+        if (token != nullptr)
+            token->ThrowIfCancelled();
+
+        // Open the files of the window and size their buffers
+        std::vector<ReadState> window;
+        std::vector<iovec> buffers;
+        while (next < paths.size() && window.size() < kWindowFiles) {
+            ReadState file;
+            file.index = next++;
+            file.fd = open(paths[file.index].c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat status;
+            if (file.fd >= 0 && (fstat(file.fd, &status) != 0 || !S_ISREG(status.st_mode))) {
+                close(file.fd);
+                file.fd = -1;
+            }
+            if (file.fd < 0) {
+                complete(file.index, std::nullopt);
+                continue;
+            }
+            file.data.resize(static_cast<size_t>(status.st_size));
+            window.push_back(std::move(file));
+        }
+        // Once the window is complete, as moves change the address of small strings
+        for (auto& file : window) {
+            if (!file.data.empty()) {
+                file.buffer = static_cast<int>(buffers.size());
+                buffers.push_back({file.data.data(), file.data.size()});
+            }
+        }
+
+        const bool fixed = !buffers.empty() && buffers.size() <= 1024 && ring->RegisterBuffers(buffers);
+        // Queue the next chunk of a read
+        const auto queue = [&](ReadState& file, size_t position) {
+            io_uring_sqe* sqe = ring->Next();
+            if (sqe == nullptr)
+                return false;
+            sqe->opcode = file.buffer >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            sqe->fd = file.fd;
+            sqe->addr = reinterpret_cast<uint64_t>(file.data.data() + file.filled);
+            sqe->len = static_cast<uint32_t>(std::min<uint64_t>(file.data.size() - file.filled, kMaxRequestSize));
+            sqe->off = file.filled;
+            if (file.buffer >= 0)
+                sqe->buf_index = static_cast<uint16_t>(file.buffer);
+            sqe->user_data = position;
+            return true;
+        };
+        const auto finish = [&](ReadState& file) {
+            close(file.fd);
+            file.fd = -1;
+            file.data.resize(file.filled);
+            complete(file.index, file.failed ? ReadOne(paths[file.index]) : std::optional<std::string>(std::move(file.data)));
+        };
+
+        // Empty files are complete; the others are read until they fill their buffer, or
+        // until their end if they were truncated since
+        size_t remaining = window.size();
+        for (size_t position = 0; position < window.size(); ++position) {
+            auto& file = window[position];
+            if (!fixed)
+                file.buffer = -1;
+            if (file.data.empty()) {
+                finish(file);
+                --remaining;
+            } else {
+                queue(file, position);
+            }
+        }
+        bool failed = false;
+        while (remaining > 0 && !failed) {
+            failed = !ring->SubmitAndWait();
+            ring->Reap([&](uint64_t position, int32_t result) {
+                auto& file = window[position];
+                if (result > 0)
+                    file.filled += static_cast<uint64_t>(result);
+                if (result > 0 && file.filled < file.data.size() && queue(file, position))
+                    return;
+                file.failed = result < 0;
+                finish(file);
+                --remaining;
+            });
+        }
+        if (failed) {
+            for (auto& file : window) {
+                if (file.fd >= 0)
+                    close(file.fd);
+            }
+            ring.reset();
+            throw AddonError(UXP_ADDON_IO_ERROR, "The I/O ring failed");
+        }
+        if (fixed)
+            ring->UnregisterBuffers();
+    }
+#endif
+    return results;
+}
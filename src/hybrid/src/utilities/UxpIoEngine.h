@@ -0,0 +1,90 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class CancellationToken;
+
+/** Reads and writes batches of files (writeFiles, readFiles).
+
+ On Linux the batches go through io_uring: the files of a window are opened, then all
+ their reads, or their chains of writes (then fsync and rename when durable), are queued
+ in one submission with the buffers registered with the kernel, and the thread only
+ waits for the completions. Throughput then follows the queue depth of the device
+ rather than the number of threads.
+ Elsewhere, or when the kernel doesn't allow io_uring, the files are read and written
+ one after the other on the calling thread; callers spread such batches over the
+ worker threads (see IsBatched). Setting UXP_ADDON_IO_BACKEND=threads in the environment
+ forces this path.
+*/
+
+class IoEngine {
+ public:
+    struct WriteRequest {
+        std::string path;
+        // Concatenated into the file
+        std::vector<std::string_view> parts;
+    };
+
+    // Invoked on the calling thread as the files complete
+    using Completion = std::function<void(size_t index, bool success)>;
+
+    static IoEngine& Instance();
+
+    // "io_uring" or "threads"
+    const char* GetBackend() const { return mBatched ? "io_uring" : "threads"; }
+
+    // Whether a batch is served at the queue depth of the device: callers should then
+    // submit whole batches from one thread rather than spread them over several
+    bool IsBatched() const { return mBatched; }
+
+    // Write files, creating their parent directories. With durable, each file is written
+    // to <path>.writing, flushed to the disk and renamed over path, so that a crash leaves
+    // the previous or the new file, never a partial one.
+    // Throws OperationCancelled between windows of files when the token is cancelled.
+    std::vector<bool> Write(const std::vector<WriteRequest>& requests,
+                            bool durable,
+                            const Completion& onComplete,
+                            const CancellationToken* token);
+
+    // Contents of files, nullopt for the files that can't be read
+    std::vector<std::optional<std::string>> Read(const std::vector<std::string>& paths,
+                                                 const Completion& onComplete,
+                                                 const CancellationToken* token);
+
+    // Release the rings. Invoked when the addon is terminated.
+    void Shutdown();
+
+    IoEngine(const IoEngine&) = delete;
+    IoEngine& operator=(const IoEngine&) = delete;
+
+ private:
+    class Ring;
+
+    IoEngine();
+    ~IoEngine();
+
+    // A ring for one batch, nullptr if io_uring can't be used
+    std::unique_ptr<Ring> Acquire();
+    void Release(std::unique_ptr<Ring> ring);
+
+    bool mBatched{false};
+    std::mutex mMutex;
+    // Idle rings, reused by the next batches
+    std::vector<std::unique_ptr<Ring>> mRings;
+};
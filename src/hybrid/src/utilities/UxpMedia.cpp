@@ -0,0 +1,647 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpMedia.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "UxpAddon.h"
+#include "UxpFiles.h"
+#include "UxpMetrics.h"
+#include "UxpStorage.h"
+
+namespace {
+
+using bmff::FourCC;
+
+uint16_t Read16(const uint8_t* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+uint32_t Read32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+uint64_t Read64(const uint8_t* p) {
+    return (uint64_t(Read32(p)) << 32) | Read32(p + 4);
+}
+
+[[noreturn]] void Invalid(const std::string& message) {
+    throw AddonError(UXP_ADDON_MEDIA_ERROR, message);
+}
+
+// Bounds-checked view of a box payload
+struct Span {
+    const uint8_t* data{nullptr};
+    size_t size{0};
+
+    bool IsEmpty() const { return data == nullptr; }
+
+    const uint8_t* At(size_t offset, size_t length) const {
+        if (offset > size || length > size - offset)
+            Invalid("Truncated box");
+        return data + offset;
+    }
+
+    uint8_t U8(size_t offset) const { return *At(offset, 1); }
+    uint16_t U16(size_t offset) const { return Read16(At(offset, 2)); }
+    uint32_t U32(size_t offset) const { return Read32(At(offset, 4)); }
+    uint64_t U64(size_t offset) const { return Read64(At(offset, 8)); }
+
+    Span Sub(size_t offset, size_t length) const { return {At(offset, length), length}; }
+    Span From(size_t offset) const { return Sub(offset, offset <= size ? size - offset : 0); }
+};
+
+// Invoke handler(type, payload) for each child box of a payload
+template <typename Handler>
+void ForEachChild(const Span& payload, Handler&& handler) {
+    uint64_t offset = 0;
+    bmff::Box box;
+    while (bmff::ReadBox(payload.data, payload.size, payload.size, offset, box)) {
+        handler(box.type, payload.Sub(static_cast<size_t>(box.PayloadOffset()), static_cast<size_t>(box.PayloadSize())));
+        offset = box.End();
+    }
+}
+
+Span FindChild(const Span& payload, uint32_t type) {
+    Span found;
+    ForEachChild(payload, [&](uint32_t childType, const Span& child) {
+        if (childType == type && found.IsEmpty())
+            found = child;
+    });
+    return found;
+}
+
+// Tables of the sample table box that locate the samples
+struct SampleTables {
+    Span stsd, stts, stss, stsc, stsz, stco, co64;
+};
+
+std::string Hex2(unsigned value) {
+    char text[3];
+    std::snprintf(text, sizeof(text), "%02x", value & 0xff);
+    return text;
+}
+
+// Length field of an MPEG-4 descriptor: up to 4 bytes of 7 bits
+size_t ReadDescriptorLength(const Span& span, size_t& offset) {
+    size_t length = 0;
+    for (int index = 0; index < 4; ++index) {
+        const uint8_t byte = span.U8(offset++);
+        length = (length << 7) | (byte & 0x7f);
+        if ((byte & 0x80) == 0)
+            break;
+    }
+    return length;
+}
+
+// mp4a.<object type>.<audio object type> from the esds box
+std::string AudioCodecFromEsds(const Span& esds) {
+    size_t offset = 4;  // version and flags
+    if (esds.U8(offset++) != 0x03)
+        return "mp4a";
+    ReadDescriptorLength(esds, offset);
+    offset += 2;  // ES_ID
+    const uint8_t flags = esds.U8(offset++);
+    if (flags & 0x80)
+        offset += 2;
+    if (flags & 0x40)
+        offset += 1 + esds.U8(offset);
+    if (flags & 0x20)
+        offset += 2;
+
+    if (esds.U8(offset++) != 0x04)
+        return "mp4a";
+    ReadDescriptorLength(esds, offset);
+    const uint8_t objectType = esds.U8(offset);
+    std::string codec = "mp4a." + Hex2(objectType);
+    offset += 13;
+
+    if (offset < esds.size && esds.U8(offset++) == 0x05) {
+        ReadDescriptorLength(esds, offset);
+        const unsigned audioObjectType = esds.U8(offset) >> 3;
+        if (audioObjectType != 0)
+            codec += "." + std::to_string(audioObjectType);
+    }
+    return codec;
+}
+
+void ParseSampleEntry(const Span& stsd, MediaTrack& track) {
+    if (stsd.U32(4) == 0)
+        return;
+
+    // First entry only: tracks with several sample descriptions are rare
+    bmff::Box entry;
+    const Span entries = stsd.From(8);
+    if (!bmff::ReadBox(entries.data, entries.size, entries.size, 0, entry))
+        return;
+    const Span payload = entries.Sub(static_cast<size_t>(entry.PayloadOffset()), static_cast<size_t>(entry.PayloadSize()));
+    track.codec = bmff::FourCCToString(entry.type);
+
+    if (track.kind == "video") {
+        // VisualSampleEntry: 6 reserved, data reference index, 16 predefined, width, height, ...
+        if (track.width == 0 || track.height == 0) {
+            track.width = payload.U16(24);
+            track.height = payload.U16(26);
+        }
+        if (payload.size <= 78)
+            return;
+        const Span avcC = FindChild(payload.From(78), FourCC("avcC"));
+        if (!avcC.IsEmpty() && avcC.size >= 4)
+            track.codec += "." + Hex2(avcC.U8(1)) + Hex2(avcC.U8(2)) + Hex2(avcC.U8(3));
+        return;
+    }
+
+    if (track.kind == "audio") {
+        // AudioSampleEntry: 6 reserved, data reference index, version, 6 reserved, channels,
+        // sample size, 4 predefined, sample rate (16.16)
+        const uint16_t version = payload.U16(8);
+        track.channels = payload.U16(16);
+        track.sampleRate = payload.U32(24) >> 16;
+        // QuickTime sound descriptions version 1 and 2 have extra fields
+        size_t children = 28;
+        if (version == 1) {
+            children += 16;
+        } else if (version == 2) {
+            children += 36;
+            const uint64_t rate = payload.U64(32);
+            double sampleRate = 0;
+            static_assert(sizeof(double) == sizeof(uint64_t));
+            std::memcpy(&sampleRate, &rate, sizeof(sampleRate));
+            track.sampleRate = sampleRate > 0 && sampleRate < 1e9 ? static_cast<uint32_t>(sampleRate) : 0;
+            track.channels = payload.U32(40);
+        }
+        if (entry.type != FourCC("mp4a") || payload.size <= children)
+            return;
+
+        Span esds = FindChild(payload.From(children), FourCC("esds"));
+        if (esds.IsEmpty()) {
+            const Span wave = FindChild(payload.From(children), FourCC("wave"));
+            if (!wave.IsEmpty())
+                esds = FindChild(wave, FourCC("esds"));
+        }
+        if (!esds.IsEmpty())
+            track.codec = AudioCodecFromEsds(esds);
+    }
+}
+
+double FrameRate(const Span& stts, uint32_t timescale, uint64_t sampleCount) {
+    if (stts.IsEmpty() || timescale == 0)
+        return 0;
+
+    const uint32_t entries = stts.U32(4);
+    uint64_t samples = 0;
+    uint64_t ticks = 0;
+    for (uint32_t index = 0; index < entries; ++index) {
+        const uint64_t count = stts.U32(8 + index * 8);
+        const uint64_t delta = stts.U32(12 + index * 8);
+        samples += count;
+        ticks += count * delta;
+    }
+    if (entries == 1 && stts.U32(12) != 0)
+        return double(timescale) / stts.U32(12);
+    if (ticks == 0)
+        return 0;
+    return double(sampleCount > 0 ? sampleCount : samples) * timescale / ticks;
+}
+
+// Walk the chunks and their samples to find the file offset of every sync sample
+std::vector<uint64_t> KeyframeOffsets(const SampleTables& tables, uint64_t sampleCount, uint64_t fileSize) {
+    std::vector<uint64_t> offsets;
+    if (tables.stsc.IsEmpty() || tables.stsz.IsEmpty() || (tables.stco.IsEmpty() && tables.co64.IsEmpty()))
+        return offsets;
+
+    const bool wide = tables.stco.IsEmpty();
+    const Span& chunkTable = wide ? tables.co64 : tables.stco;
+    const uint32_t chunkCount = chunkTable.U32(4);
+    auto chunkOffset = [&](uint32_t chunk) -> uint64_t {
+        return wide ? chunkTable.U64(8 + size_t(chunk) * 8) : chunkTable.U32(8 + size_t(chunk) * 4);
+    };
+
+    const uint32_t uniformSize = tables.stsz.U32(4);
+    auto sampleSize = [&](uint64_t sample) -> uint64_t {
+        return uniformSize != 0 ? uniformSize : tables.stsz.U32(12 + static_cast<size_t>(sample) * 4);
+    };
+
+    // stss lists the 1-based numbers of the sync samples; without it every sample is one
+    const uint32_t syncCount = tables.stss.IsEmpty() ? 0 : tables.stss.U32(4);
+    uint32_t nextSync = 0;
+
+    const uint32_t stscCount = tables.stsc.U32(4);
+    uint64_t sample = 0;
+    for (uint32_t entry = 0; entry < stscCount && sample < sampleCount; ++entry) {
+        const uint32_t firstChunk = tables.stsc.U32(8 + size_t(entry) * 12);
+        const uint32_t samplesPerChunk = tables.stsc.U32(12 + size_t(entry) * 12);
+        const uint32_t lastChunk =
+            entry + 1 < stscCount ? tables.stsc.U32(8 + size_t(entry + 1) * 12) - 1 : chunkCount;
+        if (firstChunk == 0 || lastChunk > chunkCount)
+            Invalid("Invalid sample to chunk table");
+
+        for (uint32_t chunk = firstChunk; chunk <= lastChunk && sample < sampleCount; ++chunk) {
+            uint64_t offset = chunkOffset(chunk - 1);
+            for (uint32_t index = 0; index < samplesPerChunk && sample < sampleCount; ++index, ++sample) {
+                bool sync = tables.stss.IsEmpty();
+                while (!sync && nextSync < syncCount && tables.stss.U32(8 + size_t(nextSync) * 4) <= sample + 1) {
+                    sync = tables.stss.U32(8 + size_t(nextSync) * 4) == sample + 1;
+                    ++nextSync;
+                }
+                if (sync)
+                    offsets.push_back(offset);
+                offset += sampleSize(sample);
+                if (offset > fileSize)
+                    Invalid("Sample table points past the end of the file");
+            }
+        }
+    }
+    return offsets;
+}
+
+MediaTrack ParseTrack(const Span& trak, uint64_t fileSize) {
+    MediaTrack track;
+
+    const Span tkhd = FindChild(trak, FourCC("tkhd"));
+    if (!tkhd.IsEmpty()) {
+        const bool version1 = tkhd.U8(0) == 1;
+        track.id = tkhd.U32(version1 ? 20 : 12);
+        // Width and height are 16.16 fixed point after the matrix
+        const size_t sizeOffset = version1 ? 88 : 76;
+        track.width = tkhd.U32(sizeOffset) >> 16;
+        track.height = tkhd.U32(sizeOffset + 4) >> 16;
+    }
+
+    const Span mdia = FindChild(trak, FourCC("mdia"));
+    if (mdia.IsEmpty())
+        Invalid("Track without media box");
+
+    const Span mdhd = FindChild(mdia, FourCC("mdhd"));
+    uint64_t mediaDuration = 0;
+    if (!mdhd.IsEmpty()) {
+        const bool version1 = mdhd.U8(0) == 1;
+        track.timescale = mdhd.U32(version1 ? 20 : 12);
+        mediaDuration = version1 ? mdhd.U64(24) : mdhd.U32(16);
+        if (track.timescale != 0)
+            track.duration = double(mediaDuration) / track.timescale;
+    }
+
+    const Span hdlr = FindChild(mdia, FourCC("hdlr"));
+    const uint32_t handler = hdlr.IsEmpty() ? 0 : hdlr.U32(8);
+    if (handler == FourCC("vide"))
+        track.kind = "video";
+    else if (handler == FourCC("soun"))
+        track.kind = "audio";
+    else
+        track.kind = bmff::FourCCToString(handler);
+    if (track.kind != "video") {
+        track.width = 0;
+        track.height = 0;
+    }
+
+    const Span minf = FindChild(mdia, FourCC("minf"));
+    const Span stbl = minf.IsEmpty() ? Span() : FindChild(minf, FourCC("stbl"));
+    if (stbl.IsEmpty())
+        return track;
+
+    SampleTables tables;
+    ForEachChild(stbl, [&](uint32_t type, const Span& child) {
+        switch (type) {
+        case FourCC("stsd"): tables.stsd = child; break;
+        case FourCC("stts"): tables.stts = child; break;
+        case FourCC("stss"): tables.stss = child; break;
+        case FourCC("stsc"): tables.stsc = child; break;
+        case FourCC("stsz"): tables.stsz = child; break;
+        case FourCC("stco"): tables.stco = child; break;
+        case FourCC("co64"): tables.co64 = child; break;
+        default: break;
+        }
+    });
+
+    if (!tables.stsz.IsEmpty())
+        track.sampleCount = tables.stsz.U32(8);
+    if (!tables.stsd.IsEmpty())
+        ParseSampleEntry(tables.stsd, track);
+
+    if (track.kind == "video") {
+        track.frameRate = FrameRate(tables.stts, track.timescale, track.sampleCount);
+        track.keyframeOffsets = KeyframeOffsets(tables, track.sampleCount, fileSize);
+    }
+    return track;
+}
+
+bool IsTopLevelBox(uint32_t type) {
+    switch (type) {
+    case FourCC("ftyp"):
+    case FourCC("moov"):
+    case FourCC("mdat"):
+    case FourCC("free"):
+    case FourCC("skip"):
+    case FourCC("wide"):
+    case FourCC("pnot"):
+    case FourCC("uuid"):
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::string BoxHeader(uint32_t type, uint64_t payloadSize) {
+    std::string header;
+    auto append = [&header](uint64_t value, int bytes) {
+        for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8)
+            header += static_cast<char>((value >> shift) & 0xff);
+    };
+    if (payloadSize + 8 <= UINT32_MAX) {
+        append(payloadSize + 8, 4);
+        append(type, 4);
+    } else {
+        append(1, 4);
+        append(type, 4);
+        append(payloadSize + 16, 8);
+    }
+    return header;
+}
+
+// Rebuilds the moov box with the chunk offsets it would have once moved to insertAt.
+// Only the boxes on the path to the chunk offset tables are rebuilt, the others are
+// copied as they are.
+struct MovieRewriter {
+    uint64_t insertAt{0};
+    uint64_t movieOffset{0};
+    uint64_t movieEnd{0};
+    uint64_t newMovieSize{0};
+    bool widen{false};     // write every chunk offset table as co64
+    bool overflow{false};  // an stco offset no longer fits in 32 bits
+
+    uint64_t Relocate(uint64_t offset) const {
+        if (offset < insertAt)
+            return offset;
+        if (offset < movieOffset)
+            return offset + newMovieSize;
+        if (offset < movieEnd)
+            Invalid("Chunk offset inside the moov box");
+        return offset + newMovieSize - (movieEnd - movieOffset);
+    }
+
+    std::string ChunkOffsets(const Span& table, bool wide) {
+        const uint32_t count = table.U32(4);
+        const size_t entrySize = wide ? 8 : 4;
+        table.At(8, size_t(count) * entrySize);
+
+        const bool writeWide = wide || widen;
+        std::string payload(table.data, table.data + 8);
+        payload.reserve(8 + size_t(count) * (writeWide ? 8 : 4));
+        for (uint32_t index = 0; index < count; ++index) {
+            const uint64_t offset = Relocate(wide ? table.U64(8 + size_t(index) * 8) : table.U32(8 + size_t(index) * 4));
+            if (!writeWide && offset > UINT32_MAX)
+                overflow = true;
+            for (int shift = writeWide ? 56 : 24; shift >= 0; shift -= 8)
+                payload += static_cast<char>((offset >> shift) & 0xff);
+        }
+        return BoxHeader(writeWide ? FourCC("co64") : FourCC("stco"), payload.size()) + payload;
+    }
+
+    std::string Children(const Span& payload) {
+        std::string children;
+        ForEachChild(payload, [&](uint32_t type, const Span& child) {
+            switch (type) {
+            case FourCC("trak"):
+            case FourCC("mdia"):
+            case FourCC("minf"):
+            case FourCC("stbl"): {
+                const std::string rebuilt = Children(child);
+                children += BoxHeader(type, rebuilt.size()) + rebuilt;
+                break;
+            }
+            case FourCC("stco"):
+                children += ChunkOffsets(child, false);
+                break;
+            case FourCC("co64"):
+                children += ChunkOffsets(child, true);
+                break;
+            default:
+                children += BoxHeader(type, child.size);
+                children.append(reinterpret_cast<const char*>(child.data), child.size);
+                break;
+            }
+        });
+        return children;
+    }
+
+    std::string Movie(const Span& payload) {
+        const std::string children = Children(payload);
+        return BoxHeader(FourCC("moov"), children.size()) + children;
+    }
+};
+
+}  // namespace
+
+namespace bmff {
+
+std::string FourCCToString(uint32_t type) {
+    std::string text(4, ' ');
+    for (int index = 0; index < 4; ++index) {
+        const char c = static_cast<char>((type >> (24 - index * 8)) & 0xff);
+        text[index] = std::isprint(static_cast<unsigned char>(c)) ? c : '?';
+    }
+    return text;
+}
+
+bool ReadBox(const uint8_t* data, uint64_t available, uint64_t rangeSize, uint64_t offset, Box& box) {
+    if (offset >= rangeSize)
+        return false;
+    if (rangeSize - offset < 8 || available < offset + 8)
+        Invalid("Truncated box header");
+
+    box.offset = offset;
+    box.type = Read32(data + offset + 4);
+    box.headerSize = 8;
+    box.size = Read32(data + offset);
+    if (box.size == 1) {
+        if (rangeSize - offset < 16 || available < offset + 16)
+            Invalid("Truncated box header");
+        box.size = Read64(data + offset + 8);
+        box.headerSize = 16;
+    } else if (box.size == 0) {
+        box.size = rangeSize - offset;
+    }
+
+    if (box.size < box.headerSize || box.size > rangeSize - offset)
+        Invalid("Invalid size of the " + FourCCToString(box.type) + " box");
+    return true;
+}
+
+}  // namespace bmff
+
+MediaInfo ProbeMedia(const uint8_t* data, size_t size) {
+    MediaInfo info;
+    info.size = size;
+
+    bmff::Box box;
+    uint64_t offset = 0;
+    uint64_t mediaDataOffset = UINT64_MAX;
+    uint64_t movieOffset = UINT64_MAX;
+    Span moov;
+    while (bmff::ReadBox(data, size, size, offset, box)) {
+        if (offset == 0 && !IsTopLevelBox(box.type))
+            Invalid("Not an MP4 or MOV file");
+
+        const Span payload{data + box.PayloadOffset(), static_cast<size_t>(box.PayloadSize())};
+        if (box.type == FourCC("ftyp") && payload.size >= 4) {
+            info.brand = bmff::FourCCToString(payload.U32(0));
+        } else if (box.type == FourCC("moov") && moov.IsEmpty()) {
+            moov = payload;
+            movieOffset = box.offset;
+        } else if (box.type == FourCC("mdat")) {
+            mediaDataOffset = std::min(mediaDataOffset, box.offset);
+        }
+        offset = box.End();
+    }
+    if (moov.IsEmpty())
+        Invalid("The file has no moov box");
+    if (!FindChild(moov, FourCC("cmov")).IsEmpty())
+        Invalid("Compressed movie headers are not supported");
+
+    info.faststart = movieOffset < mediaDataOffset;
+
+    const Span mvhd = FindChild(moov, FourCC("mvhd"));
+    if (!mvhd.IsEmpty()) {
+        const bool version1 = mvhd.U8(0) == 1;
+        const uint32_t timescale = mvhd.U32(version1 ? 20 : 12);
+        const uint64_t duration = version1 ? mvhd.U64(24) : mvhd.U32(16);
+        if (timescale != 0)
+            info.duration = double(duration) / timescale;
+    }
+
+    ForEachChild(moov, [&](uint32_t type, const Span& child) {
+        if (type == FourCC("trak"))
+            info.tracks.push_back(ParseTrack(child, size));
+    });
+    return info;
+}
+
+MediaInfo ProbeMediaFile(const std::string& path) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "probeMedia");
+    try {
+        MappedFile file(path);
+        metrics.AddBytesIn(file.GetSize());
+        return ProbeMedia(file.GetData(), file.GetSize());
+    } catch (...) {
+        metrics.Fail();
+        throw;
+    }
+}
+
+bool IsMediaFileName(const std::string& path) {
+    std::string extension = std::filesystem::path(path).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+    return extension == ".mp4" || extension == ".mov" || extension == ".m4v" || extension == ".m4a" ||
+           extension == ".3gp";
+}
+
+bool PlanFaststart(const uint8_t* data, size_t size, FaststartPlan& plan) {
+    bmff::Box box;
+    bmff::Box movie;
+    uint64_t offset = 0;
+    uint64_t mediaDataOffset = UINT64_MAX;
+    bool hasMovie = false;
+    while (bmff::ReadBox(data, size, size, offset, box)) {
+        if (offset == 0 && !IsTopLevelBox(box.type))
+            Invalid("Not an MP4 or MOV file");
+        if (box.type == FourCC("moov") && !hasMovie) {
+            movie = box;
+            hasMovie = true;
+        } else if (box.type == FourCC("mdat")) {
+            mediaDataOffset = std::min(mediaDataOffset, box.offset);
+        }
+        offset = box.End();
+    }
+    if (!hasMovie)
+        Invalid("The file has no moov box");
+    if (movie.offset < mediaDataOffset)
+        return false;
+
+    const Span payload{data + movie.PayloadOffset(), static_cast<size_t>(movie.PayloadSize())};
+    if (!FindChild(payload, FourCC("cmov")).IsEmpty())
+        Invalid("Compressed movie headers are not supported");
+
+    // The size of the rebuilt box doesn't depend on the offsets, only on whether the
+    // tables must be widened; which in turn depends on the size
+    MovieRewriter rewriter;
+    rewriter.insertAt = mediaDataOffset;
+    rewriter.movieOffset = movie.offset;
+    rewriter.movieEnd = movie.End();
+    rewriter.newMovieSize = rewriter.Movie(payload).size();
+    std::string rebuilt = rewriter.Movie(payload);
+    if (rewriter.overflow) {
+        rewriter.widen = true;
+        rewriter.newMovieSize = rewriter.Movie(payload).size();
+        rebuilt = rewriter.Movie(payload);
+    }
+
+    plan.insertAt = mediaDataOffset;
+    plan.movieOffset = movie.offset;
+    plan.movieSize = movie.size;
+    plan.movie = std::move(rebuilt);
+    return true;
+}
+
+std::vector<std::string_view> FaststartParts(const uint8_t* data, size_t size, const FaststartPlan& plan) {
+    const char* bytes = reinterpret_cast<const char*>(data);
+    const uint64_t movieEnd = plan.movieOffset + plan.movieSize;
+    return {std::string_view(bytes, static_cast<size_t>(plan.insertAt)),
+            std::string_view(plan.movie),
+            std::string_view(bytes + plan.insertAt, static_cast<size_t>(plan.movieOffset - plan.insertAt)),
+            std::string_view(bytes + movieEnd, static_cast<size_t>(size - movieEnd))};
+}
+
+bool FaststartFile(const std::string& input, const std::string& output) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "faststart");
+    try {
+        const bool inPlace = std::filesystem::path(input) == std::filesystem::path(output);
+        const std::string target = inPlace ? output + ".faststart" : output;
+        bool moved = false;
+        {
+            MappedFile file(input);
+            metrics.AddBytesIn(file.GetSize());
+
+            FaststartPlan plan;
+            moved = PlanFaststart(file.GetData(), file.GetSize(), plan);
+            if (!moved && inPlace)
+                return false;
+
+            const auto parts =
+                moved ? FaststartParts(file.GetData(), file.GetSize(), plan)
+                      : std::vector<std::string_view>{{reinterpret_cast<const char*>(file.GetData()), file.GetSize()}};
+            if (!WriteFileParts(target, parts))
+                throw AddonError(UXP_ADDON_IO_ERROR, "Unable to write " + target);
+            metrics.AddBytesOut(file.GetSize() - plan.movieSize + plan.movie.size());
+        }
+
+        // The mapping of the input is closed before it is replaced
+        if (inPlace) {
+            std::error_code error;
+            std::filesystem::rename(target, output, error);
+            if (error) {
+                std::filesystem::remove(target, error);
+                throw AddonError(UXP_ADDON_IO_ERROR, "Unable to replace " + output);
+            }
+            StorageManager::Instance().RecordRename(target, output);
+        }
+        return moved;
+    } catch (...) {
+        metrics.Fail();
+        throw;
+    }
+}
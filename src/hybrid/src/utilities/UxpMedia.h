@@ -0,0 +1,117 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/** Error code of the errors thrown for files that are not valid MP4/MOV files */
+#define UXP_ADDON_MEDIA_ERROR "MEDIA_ERR"
+
+/** Reading of ISO base media files (MP4, MOV, M4V, M4A, 3GP).
+ These files are a tree of boxes; the moov box holds the description of the tracks
+ and the tables locating their samples in the mdat box. Only the box headers and the
+ moov box are read, never the media data.
+*/
+
+namespace bmff {
+
+constexpr uint32_t FourCC(const char (&code)[5]) {
+    return (uint32_t(uint8_t(code[0])) << 24) | (uint32_t(uint8_t(code[1])) << 16) |
+           (uint32_t(uint8_t(code[2])) << 8) | uint32_t(uint8_t(code[3]));
+}
+
+std::string FourCCToString(uint32_t type);
+
+struct Box {
+    uint32_t type{0};
+    uint64_t offset{0};      // of the header, relative to the parsed range
+    uint64_t headerSize{0};  // 8, or 16 for 64-bit sizes
+    uint64_t size{0};        // including the header
+
+    uint64_t PayloadOffset() const { return offset + headerSize; }
+    uint64_t PayloadSize() const { return size - headerSize; }
+    uint64_t End() const { return offset + size; }
+};
+
+// Read the header of the box at offset within a range of the given size. Boxes with a
+// size of 0 extend to the end of the range. Returns false at the end of the range and
+// throws a MEDIA_ERR AddonError if the header is invalid.
+// Only the header bytes need to be available in data.
+bool ReadBox(const uint8_t* data, uint64_t available, uint64_t rangeSize, uint64_t offset, Box& box);
+
+}  // namespace bmff
+
+struct MediaTrack {
+    uint32_t id{0};
+    std::string kind;     // "video", "audio", or the handler type of other tracks
+    std::string codec;    // RFC 6381 codec string when known (avc1.64001f, mp4a.40.2), else the sample entry type
+    double duration{0};   // seconds
+    uint32_t timescale{0};
+    uint64_t sampleCount{0};
+
+    // @{ Video tracks
+    uint32_t width{0};
+    uint32_t height{0};
+    double frameRate{0};
+    std::vector<uint64_t> keyframeOffsets;  // file offsets of the sync samples
+    // @}
+
+    // @{ Audio tracks
+    uint32_t sampleRate{0};
+    uint32_t channels{0};
+    // @}
+};
+
+struct MediaInfo {
+    std::string brand;     // major brand of the ftyp box, e.g. "isom" or "qt  "
+    double duration{0};    // seconds
+    bool faststart{false}; // moov precedes the media data
+    uint64_t size{0};      // file size in bytes
+    std::vector<MediaTrack> tracks;
+};
+
+// Probe a memory range holding a whole file.
+// Throws an AddonError with the MEDIA_ERR code if it is not a valid MP4/MOV file.
+MediaInfo ProbeMedia(const uint8_t* data, size_t size);
+
+// Probe a file through a memory mapping. Also throws IO_ERR errors.
+MediaInfo ProbeMediaFile(const std::string& path);
+
+// Whether the extension of the path is one of an ISO base media file
+bool IsMediaFileName(const std::string& path);
+
+/** Faststart layout: the moov box is moved in front of the media data, so that players
+ can start before the whole file is read. The chunk offset tables (stco/co64) of the
+ moved moov box are patched; stco tables are widened to co64 when an offset would no
+ longer fit in 32 bits. The media data is copied as is.
+*/
+struct FaststartPlan {
+    uint64_t insertAt{0};     // offset of the first mdat box, where the moov box goes
+    uint64_t movieOffset{0};  // of the original moov box
+    uint64_t movieSize{0};
+    std::string movie;        // patched moov box
+};
+
+// Returns false if the moov box already precedes the media data. Throws MEDIA_ERR
+// AddonErrors like ProbeMedia.
+bool PlanFaststart(const uint8_t* data, size_t size, FaststartPlan& plan);
+
+// The parts of the remuxed file: data before insertAt, the patched moov box, then the
+// rest of data without the original moov box. They reference data and plan.
+std::vector<std::string_view> FaststartParts(const uint8_t* data, size_t size, const FaststartPlan& plan);
+
+// Remux a file in a single pass; output may be the input path, which is then replaced
+// once the remuxed file is complete. Returns whether the moov box was moved.
+bool FaststartFile(const std::string& input, const std::string& output);
@@ -0,0 +1,866 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpMediaServer.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <sys/uio.h>
+#else
+#include <sys/sendfile.h>
+#endif
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#include "UxpAddon.h"
+#include "UxpMetrics.h"
+#include "UxpStorage.h"
+#include "UxpTrace.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kMaxConnections = 64;
+constexpr size_t kMaxRequestSize = 16384;
+constexpr auto kIdleTimeout = std::chrono::seconds(30);
+constexpr int kPollInterval = 100;  // ms, bounds the time Stop waits for the thread
+
+#ifdef _WIN32
+using SocketHandle = SOCKET;
+const SocketHandle kInvalidSocket = INVALID_SOCKET;
+
+void CloseSocket(SocketHandle socket) {
+    closesocket(socket);
+}
+
+int PollSockets(pollfd* sockets, size_t count, int timeout) {
+    return WSAPoll(sockets, static_cast<ULONG>(count), timeout);
+}
+
+bool WouldBlock() {
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
+bool SetNonBlocking(SocketHandle socket) {
+    u_long mode = 1;
+    return ioctlsocket(socket, FIONBIO, &mode) == 0;
+}
+
+constexpr int kSendFlags = 0;
+#else
+using SocketHandle = int;
+constexpr SocketHandle kInvalidSocket = -1;
+
+void CloseSocket(SocketHandle socket) {
+    close(socket);
+}
+
+int PollSockets(pollfd* sockets, size_t count, int timeout) {
+    return poll(sockets, static_cast<nfds_t>(count), timeout);
+}
+
+bool WouldBlock() {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+bool SetNonBlocking(SocketHandle socket) {
+    const int flags = fcntl(socket, F_GETFL, 0);
+    return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0 && fcntl(socket, F_SETFD, FD_CLOEXEC) == 0;
+}
+
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+#endif
+
+[[noreturn]] void Fail(const std::string& message) {
+    throw AddonError(UXP_ADDON_SERVER_ERROR, message);
+}
+
+/** An open file served by a connection */
+class ServedFile {
+ public:
+    ServedFile() {}
+    ~ServedFile() { Close(); }
+
+    // Open a regular file and read its size and modification time
+    bool Open(const std::filesystem::path& path) {
+        Close();
+#ifdef _WIN32
+        std::error_code error;
+        if (!std::filesystem::is_regular_file(path, error))
+            return false;
+        mSize = std::filesystem::file_size(path, error);
+        if (error)
+            return false;
+        const auto modified = std::filesystem::last_write_time(path, error);
+        if (error)
+            return false;
+        mVersion = static_cast<uint64_t>(modified.time_since_epoch().count());
+        mStream.open(path, std::ios::binary | std::ios::in);
+        return mStream.is_open();
+#else
+        mFile = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (mFile < 0)
+            return false;
+        struct stat status;
+        if (fstat(mFile, &status) != 0 || !S_ISREG(status.st_mode)) {
+            Close();
+            return false;
+        }
+        mSize = static_cast<uint64_t>(status.st_size);
+#if defined(__APPLE__)
+        mVersion = uint64_t(status.st_mtimespec.tv_sec) * 1000000000 + uint64_t(status.st_mtimespec.tv_nsec);
+#else
+        mVersion = uint64_t(status.st_mtim.tv_sec) * 1000000000 + uint64_t(status.st_mtim.tv_nsec);
+#endif
+        return true;
+#endif
+    }
+
+    void Close() {
+#ifdef _WIN32
+        if (mStream.is_open())
+            mStream.close();
+        mBufferStart = 0;
+        mBufferEnd = 0;
+#else
+        if (mFile >= 0)
+            close(mFile);
+        mFile = -1;
+#endif
+    }
+
+    uint64_t GetSize() const { return mSize; }
+    uint64_t GetVersion() const { return mVersion; }
+
+    // Send up to length bytes from offset. Returns the number of bytes sent, 0 if the
+    // socket isn't writable, or -1 on error.
+    int64_t Send(SocketHandle socket, uint64_t offset, uint64_t length) {
+        const size_t chunk = static_cast<size_t>(std::min<uint64_t>(length, 1 << 20));
+#ifdef _WIN32
+        // mBuffer[mBufferStart, mBufferEnd) holds the data at offset that wasn't sent yet
+        if (mBufferStart == mBufferEnd) {
+            mBuffer.resize(65536);
+            mStream.clear();
+            mStream.seekg(static_cast<std::streamoff>(offset));
+            mStream.read(mBuffer.data(), static_cast<std::streamsize>(std::min(chunk, mBuffer.size())));
+            mBufferStart = 0;
+            mBufferEnd = static_cast<size_t>(mStream.gcount());
+            if (mBufferEnd == 0)
+                return -1;
+        }
+        const int sent = send(socket, mBuffer.data() + mBufferStart, static_cast<int>(mBufferEnd - mBufferStart), kSendFlags);
+        if (sent < 0)
+            return WouldBlock() ? 0 : -1;
+        mBufferStart += static_cast<size_t>(sent);
+        return sent;
+#elif defined(__APPLE__)
+        off_t sent = static_cast<off_t>(chunk);
+        const int result = sendfile(mFile, socket, static_cast<off_t>(offset), &sent, nullptr, 0);
+        if (result < 0 && sent == 0)
+            return WouldBlock() ? 0 : -1;
+        return sent;
+#else
+        off_t position = static_cast<off_t>(offset);
+        const ssize_t sent = sendfile(socket, mFile, &position, chunk);
+        if (sent < 0)
+            return WouldBlock() ? 0 : -1;
+        // The file shrank while it was served
+        if (sent == 0)
+            return -1;
+        return sent;
+#endif
+    }
+
+    ServedFile(const ServedFile&) = delete;
+    ServedFile& operator=(const ServedFile&) = delete;
+
+ private:
+    uint64_t mSize{0};
+    uint64_t mVersion{0};
+#ifdef _WIN32
+    std::ifstream mStream;
+    std::vector<char> mBuffer;
+    size_t mBufferStart{0};
+    size_t mBufferEnd{0};
+#else
+    int mFile{-1};
+#endif
+};
+
+struct Connection {
+    SocketHandle socket{kInvalidSocket};
+    Clock::time_point lastActivity;
+    std::string input;  // received data not parsed yet
+
+    // @{ Response being sent
+    bool responding{false};
+    std::string header;
+    size_t headerSent{0};
+    ServedFile file;
+    uint64_t bodyOffset{0};
+    uint64_t bodyRemaining{0};
+    bool closeAfterResponse{false};
+    std::unique_ptr<CallMetrics> metrics;
+    // @}
+
+    bool closed{false};
+};
+
+struct Request {
+    std::string method;
+    std::string target;
+    std::string version;
+    std::string range;
+    std::string ifNoneMatch;
+    std::string ifRange;
+    std::string connection;
+};
+
+std::string Lowercase(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+    return text;
+}
+
+std::string Trim(const std::string& text) {
+    const size_t begin = text.find_first_not_of(" \t");
+    if (begin == std::string::npos)
+        return std::string();
+    const size_t end = text.find_last_not_of(" \t");
+    return text.substr(begin, end - begin + 1);
+}
+
+bool ParseRequest(const std::string& text, Request& request) {
+    size_t lineEnd = text.find("\r\n");
+    const std::string requestLine = text.substr(0, lineEnd);
+    const size_t methodEnd = requestLine.find(' ');
+    const size_t targetEnd = requestLine.rfind(' ');
+    if (methodEnd == std::string::npos || targetEnd == methodEnd)
+        return false;
+    request.method = requestLine.substr(0, methodEnd);
+    request.target = requestLine.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+    request.version = requestLine.substr(targetEnd + 1);
+    if (request.version.compare(0, 5, "HTTP/") != 0)
+        return false;
+
+    while (lineEnd != std::string::npos && lineEnd + 2 < text.size()) {
+        const size_t start = lineEnd + 2;
+        lineEnd = text.find("\r\n", start);
+        const std::string line = text.substr(start, lineEnd == std::string::npos ? std::string::npos : lineEnd - start);
+        const size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+        const std::string name = Lowercase(Trim(line.substr(0, colon)));
+        const std::string value = Trim(line.substr(colon + 1));
+        if (name == "range")
+            request.range = value;
+        else if (name == "if-none-match")
+            request.ifNoneMatch = value;
+        else if (name == "if-range")
+            request.ifRange = value;
+        else if (name == "connection")
+            request.connection = Lowercase(value);
+    }
+    return true;
+}
+
+int HexDigit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+bool PercentDecode(const std::string& text, std::string& decoded) {
+    decoded.clear();
+    for (size_t index = 0; index < text.size(); ++index) {
+        if (text[index] != '%') {
+            decoded += text[index];
+            continue;
+        }
+        if (index + 2 >= text.size())
+            return false;
+        const int high = HexDigit(text[index + 1]);
+        const int low = HexDigit(text[index + 2]);
+        if (high < 0 || low < 0)
+            return false;
+        decoded += static_cast<char>(high * 16 + low);
+        index += 2;
+    }
+    return true;
+}
+
+std::string PercentEncode(const std::string& segment) {
+    static const char* kHex = "0123456789ABCDEF";
+    std::string encoded;
+    for (unsigned char c : segment) {
+        if (std::isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~') {
+            encoded += static_cast<char>(c);
+        } else {
+            encoded += '%';
+            encoded += kHex[c >> 4];
+            encoded += kHex[c & 15];
+        }
+    }
+    return encoded;
+}
+
+// Parse a "bytes=first-last" header of a file of the given size. Returns 1 for a valid
+// range, 0 for a header to ignore (multiple ranges, other units) and -1 if unsatisfiable.
+int ParseRange(const std::string& header, uint64_t size, uint64_t& first, uint64_t& last) {
+    if (header.compare(0, 6, "bytes=") != 0 || header.find(',') != std::string::npos)
+        return 0;
+    const std::string spec = Trim(header.substr(6));
+    const size_t dash = spec.find('-');
+    if (dash == std::string::npos)
+        return 0;
+    const std::string start = spec.substr(0, dash);
+    const std::string end = spec.substr(dash + 1);
+    auto isNumber = [](const std::string& text) {
+        return !text.empty() && text.size() <= 19 &&
+               std::all_of(text.begin(), text.end(), [](unsigned char c) { return std::isdigit(c); });
+    };
+
+    if (start.empty()) {
+        // Suffix range: the last n bytes
+        if (!isNumber(end))
+            return 0;
+        const uint64_t length = std::stoull(end);
+        if (length == 0 || size == 0)
+            return -1;
+        first = size - std::min(length, size);
+        last = size - 1;
+        return 1;
+    }
+    if (!isNumber(start) || (!end.empty() && !isNumber(end)))
+        return 0;
+    first = std::stoull(start);
+    last = end.empty() ? UINT64_MAX : std::stoull(end);
+    if (last < first)
+        return 0;
+    if (first >= size)
+        return -1;
+    last = std::min(last, size - 1);
+    return 1;
+}
+
+const char* ContentType(const std::filesystem::path& path) {
+    static const std::pair<const char*, const char*> kTypes[] = {
+        {".mp4", "video/mp4"},  {".m4v", "video/x-m4v"},  {".mov", "video/quicktime"}, {".webm", "video/webm"},
+        {".m4a", "audio/mp4"},  {".mp3", "audio/mpeg"},   {".wav", "audio/wav"},       {".png", "image/png"},
+        {".jpg", "image/jpeg"}, {".jpeg", "image/jpeg"},  {".webp", "image/webp"},     {".gif", "image/gif"},
+        {".json", "application/json"},
+    };
+    const std::string extension = Lowercase(path.extension().string());
+    for (const auto& type : kTypes) {
+        if (extension == type.first)
+            return type.second;
+    }
+    return "application/octet-stream";
+}
+
+const char* StatusText(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 206: return "Partial Content";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 416: return "Range Not Satisfiable";
+    case 431: return "Request Header Fields Too Large";
+    default: return "Internal Server Error";
+    }
+}
+
+bool IsWithin(const std::filesystem::path& path, const std::filesystem::path& root) {
+    const auto relative = path.lexically_relative(root);
+    return !relative.empty() && *relative.begin() != "..";
+}
+
+std::string RandomToken() {
+    std::random_device device;
+    static const char* kHex = "0123456789abcdef";
+    std::string token;
+    for (int index = 0; index < 8; ++index) {
+        const unsigned value = device();
+        for (int nibble = 0; nibble < 4; ++nibble)
+            token += kHex[(value >> (nibble * 4)) & 15];
+    }
+    return token;
+}
+
+}  // namespace
+
+struct MediaServer::Session {
+    Info info;
+    std::filesystem::path root;  // canonical
+    SocketHandle listener{kInvalidSocket};
+    std::atomic<bool> stopping{false};
+    std::vector<std::unique_ptr<Connection>> connections;
+
+    void Run();
+    void Accept();
+    void Receive(Connection& connection);
+    void Transmit(Connection& connection);
+    void HandleRequest(Connection& connection, const std::string& text);
+    void Respond(Connection& connection, int status, const std::string& headers, const std::string& body);
+    void Finish(Connection& connection);
+    void Close(Connection& connection);
+};
+
+void MediaServer::Session::Run() {
+    trace::SetThreadName("media server");
+#ifndef _WIN32
+    // A peer closing its end makes sendfile raise SIGPIPE, which must not reach the host.
+    // Blocked, the signal stays pending on this thread and is discarded below.
+    sigset_t brokenPipe;
+    sigemptyset(&brokenPipe);
+    sigaddset(&brokenPipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &brokenPipe, nullptr);
+#endif
+
+    std::vector<pollfd> sockets;
+    while (!stopping.load(std::memory_order_acquire)) {
+        sockets.clear();
+        pollfd listening{};
+        listening.fd = listener;
+        listening.events = connections.size() < kMaxConnections ? POLLIN : 0;
+        sockets.push_back(listening);
+        for (const auto& connection : connections) {
+            pollfd entry{};
+            entry.fd = connection->socket;
+            entry.events = connection->responding ? POLLOUT : POLLIN;
+            sockets.push_back(entry);
+        }
+
+        if (PollSockets(sockets.data(), sockets.size(), kPollInterval) < 0)
+            continue;
+
+        if (sockets[0].revents & POLLIN)
+            Accept();
+
+        const auto now = Clock::now();
+        for (size_t index = 1; index < sockets.size(); ++index) {
+            Connection& connection = *connections[index - 1];
+            const short events = sockets[index].revents;
+            if (events & (POLLERR | POLLNVAL)) {
+                Close(connection);
+            } else if (connection.responding && (events & (POLLOUT | POLLHUP))) {
+                Transmit(connection);
+            } else if (!connection.responding && (events & (POLLIN | POLLHUP))) {
+                Receive(connection);
+            } else if (now - connection.lastActivity > kIdleTimeout) {
+                Close(connection);
+            }
+        }
+
+        connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                         [](const std::unique_ptr<Connection>& connection) { return connection->closed; }),
+                          connections.end());
+
+#ifndef _WIN32
+        const struct timespec immediately = {0, 0};
+        while (sigtimedwait(&brokenPipe, nullptr, &immediately) > 0) {
+        }
+#endif
+    }
+
+    for (auto& connection : connections)
+        Close(*connection);
+    connections.clear();
+}
+
+void MediaServer::Session::Accept() {
+    while (connections.size() < kMaxConnections) {
+        const SocketHandle socket = accept(listener, nullptr, nullptr);
+        if (socket == kInvalidSocket)
+            return;
+        if (!SetNonBlocking(socket)) {
+            CloseSocket(socket);
+            continue;
+        }
+        const int enable = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enable), sizeof(enable));
+#ifdef SO_NOSIGPIPE
+        setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+
+        auto connection = std::make_unique<Connection>();
+        connection->socket = socket;
+        connection->lastActivity = Clock::now();
+        connections.push_back(std::move(connection));
+    }
+}
+
+void MediaServer::Session::Receive(Connection& connection) {
+    char buffer[4096];
+    for (;;) {
+        const auto received = recv(connection.socket, buffer, sizeof(buffer), 0);
+        if (received == 0) {
+            Close(connection);
+            return;
+        }
+        if (received < 0) {
+            if (!WouldBlock())
+                Close(connection);
+            break;
+        }
+        connection.input.append(buffer, static_cast<size_t>(received));
+        connection.lastActivity = Clock::now();
+        if (connection.input.size() > kMaxRequestSize)
+            break;
+    }
+
+    const size_t end = connection.input.find("\r\n\r\n");
+    if (end == std::string::npos) {
+        if (connection.input.size() > kMaxRequestSize) {
+            connection.closeAfterResponse = true;
+            Respond(connection, 431, std::string(), std::string());
+            Transmit(connection);
+        }
+        return;
+    }
+
+    const std::string text = connection.input.substr(0, end + 2);
+    connection.input.erase(0, end + 4);
+    HandleRequest(connection, text);
+    Transmit(connection);
+}
+
+void MediaServer::Session::HandleRequest(Connection& connection, const std::string& text) {
+    static const metrics::MetricId requestMetric = metrics::Register(metrics::Category::operations, "mediaServerRequest");
+    connection.metrics = std::make_unique<CallMetrics>(requestMetric);
+
+    Request request;
+    if (!ParseRequest(text, request)) {
+        connection.closeAfterResponse = true;
+        Respond(connection, 400, std::string(), std::string());
+        return;
+    }
+    connection.closeAfterResponse = request.connection == "close" || request.version == "HTTP/1.0";
+
+    if (request.method != "GET" && request.method != "HEAD") {
+        Respond(connection, 405, "Allow: GET, HEAD\r\n", std::string());
+        return;
+    }
+
+    // /<token>/<path>, the query string is ignored
+    std::string target = request.target.substr(0, request.target.find('?'));
+    const std::string prefix = "/" + info.token + "/";
+    std::string relative;
+    if (target.compare(0, prefix.size(), prefix) != 0 || !PercentDecode(target.substr(prefix.size()), relative)) {
+        Respond(connection, 404, std::string(), std::string());
+        return;
+    }
+
+    std::filesystem::path path = root;
+    size_t start = 0;
+    while (start <= relative.size()) {
+        size_t end = relative.find('/', start);
+        if (end == std::string::npos)
+            end = relative.size();
+        const std::string segment = relative.substr(start, end - start);
+        if (segment == "." || segment == ".." || segment.find_first_of(std::string("\\:\0", 3)) != std::string::npos) {
+            Respond(connection, 404, std::string(), std::string());
+            return;
+        }
+        if (!segment.empty())
+            path /= std::filesystem::path(segment);
+        start = end + 1;
+    }
+
+    // Symbolic links must not lead out of the root
+    std::error_code error;
+    const auto resolved = std::filesystem::canonical(path, error);
+    if (error || !IsWithin(resolved, root) || !connection.file.Open(resolved)) {
+        Respond(connection, 404, std::string(), std::string());
+        return;
+    }
+    StorageManager::Instance().RecordAccess(resolved.string());
+
+    const uint64_t size = connection.file.GetSize();
+    char tag[64];
+    std::snprintf(tag, sizeof(tag), "\"%llx-%llx\"", static_cast<unsigned long long>(connection.file.GetVersion()),
+                  static_cast<unsigned long long>(size));
+    const std::string etag = tag;
+    std::string headers = std::string("Content-Type: ") + ContentType(resolved) +
+                          "\r\nAccept-Ranges: bytes\r\nETag: " + etag + "\r\nCache-Control: no-cache\r\n";
+
+    if (!request.ifNoneMatch.empty() && (request.ifNoneMatch == etag || request.ifNoneMatch == "*")) {
+        connection.file.Close();
+        Respond(connection, 304, headers, std::string());
+        return;
+    }
+
+    uint64_t first = 0;
+    uint64_t last = size > 0 ? size - 1 : 0;
+    int status = 200;
+    if (!request.range.empty() && (request.ifRange.empty() || request.ifRange == etag)) {
+        const int range = ParseRange(request.range, size, first, last);
+        if (range < 0) {
+            connection.file.Close();
+            Respond(connection, 416, "Content-Range: bytes */" + std::to_string(size) + "\r\n", std::string());
+            return;
+        }
+        if (range > 0) {
+            status = 206;
+            headers += "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" +
+                       std::to_string(size) + "\r\n";
+        }
+    }
+
+    const uint64_t length = size > 0 ? last - first + 1 : 0;
+    Respond(connection, status, headers + "Content-Length: " + std::to_string(length) + "\r\n", std::string());
+    if (request.method == "GET") {
+        connection.bodyOffset = first;
+        connection.bodyRemaining = length;
+    } else {
+        connection.file.Close();
+    }
+}
+
+void MediaServer::Session::Respond(Connection& connection, int status, const std::string& headers, const std::string& body) {
+    if (status >= 400 && connection.metrics != nullptr)
+        connection.metrics->Fail();
+
+    std::string response = "HTTP/1.1 " + std::to_string(status) + " " + StatusText(status) + "\r\n" + headers;
+    if (status >= 400) {
+        const std::string text = body.empty() ? std::string(StatusText(status)) + "\n" : body;
+        response += "Content-Type: text/plain\r\nContent-Length: " + std::to_string(text.size()) + "\r\n";
+        response += "Access-Control-Allow-Origin: *\r\n";
+        response += connection.closeAfterResponse ? "Connection: close\r\n\r\n" : "Connection: keep-alive\r\n\r\n";
+        response += text;
+    } else {
+        response += "Access-Control-Allow-Origin: *\r\n";
+        response += connection.closeAfterResponse ? "Connection: close\r\n\r\n" : "Connection: keep-alive\r\n\r\n";
+    }
+
+    connection.responding = true;
+    connection.header = std::move(response);
+    connection.headerSent = 0;
+    connection.bodyOffset = 0;
+    connection.bodyRemaining = 0;
+}
+
+void MediaServer::Session::Transmit(Connection& connection) {
+    while (!connection.closed && connection.responding) {
+        if (connection.headerSent < connection.header.size()) {
+            const auto sent = send(connection.socket, connection.header.data() + connection.headerSent,
+                                   static_cast<int>(connection.header.size() - connection.headerSent), kSendFlags);
+            if (sent < 0) {
+                if (!WouldBlock())
+                    Close(connection);
+                return;
+            }
+            connection.headerSent += static_cast<size_t>(sent);
+            connection.lastActivity = Clock::now();
+            continue;
+        }
+
+        if (connection.bodyRemaining > 0) {
+            const int64_t sent = connection.file.Send(connection.socket, connection.bodyOffset, connection.bodyRemaining);
+            if (sent < 0) {
+                Close(connection);
+                return;
+            }
+            if (sent == 0)
+                return;
+            connection.bodyOffset += static_cast<uint64_t>(sent);
+            connection.bodyRemaining -= static_cast<uint64_t>(sent);
+            if (connection.metrics != nullptr)
+                connection.metrics->AddBytesOut(static_cast<size_t>(sent));
+            connection.lastActivity = Clock::now();
+            continue;
+        }
+
+        Finish(connection);
+    }
+}
+
+void MediaServer::Session::Finish(Connection& connection) {
+    connection.responding = false;
+    connection.header.clear();
+    connection.file.Close();
+    connection.metrics.reset();
+    if (connection.closeAfterResponse) {
+        Close(connection);
+        return;
+    }
+
+    // Pipelined request
+    const size_t end = connection.input.find("\r\n\r\n");
+    if (end != std::string::npos) {
+        const std::string text = connection.input.substr(0, end + 2);
+        connection.input.erase(0, end + 4);
+        HandleRequest(connection, text);
+    }
+}
+
+void MediaServer::Session::Close(Connection& connection) {
+    if (connection.closed)
+        return;
+    // A response cut short counts as failed
+    if (connection.metrics != nullptr) {
+        connection.metrics->Fail();
+        connection.metrics.reset();
+    }
+    connection.file.Close();
+    CloseSocket(connection.socket);
+    connection.closed = true;
+    connection.responding = false;
+}
+
+MediaServer& MediaServer::Instance() {
+    static MediaServer instance;
+    return instance;
+}
+
+MediaServer::MediaServer() {}
+
+MediaServer::~MediaServer() {
+    try {
+        Stop();
+    } catch (...) {
+    }
+}
+
+MediaServer::Info MediaServer::Start(const std::string& root, uint16_t port) {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    std::error_code error;
+    const auto canonicalRoot = std::filesystem::canonical(std::filesystem::path(root), error);
+    if (error || !std::filesystem::is_directory(canonicalRoot, error))
+        Fail("The media server root " + root + " is not a directory");
+
+    if (mSession != nullptr) {
+        if (mSession->root == canonicalRoot && (port == 0 || port == mSession->info.port))
+            return mSession->info;
+        StopLocked();
+    }
+
+#ifdef _WIN32
+    static const bool started = []() {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    if (!started)
+        Fail("Unable to initialize Winsock");
+#endif
+
+    auto session = std::make_unique<Session>();
+    session->root = canonicalRoot;
+    session->listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (session->listener == kInvalidSocket)
+        Fail("Unable to create the media server socket");
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    socklen_t addressSize = sizeof(address);
+    if (bind(session->listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(session->listener, SOMAXCONN) != 0 || !SetNonBlocking(session->listener) ||
+        getsockname(session->listener, reinterpret_cast<sockaddr*>(&address), &addressSize) != 0) {
+        CloseSocket(session->listener);
+        Fail("Unable to listen on port " + std::to_string(port));
+    }
+
+    session->info.port = ntohs(address.sin_port);
+    session->info.token = RandomToken();
+    session->info.root = canonicalRoot.string();
+    session->info.url = "http://127.0.0.1:" + std::to_string(session->info.port) + "/" + session->info.token + "/";
+
+    Session* running = session.get();
+    mSession = std::move(session);
+    mThread = std::thread([running]() { running->Run(); });
+    return mSession->info;
+}
+
+void MediaServer::Stop() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    StopLocked();
+}
+
+void MediaServer::StopLocked() {
+    if (mSession == nullptr)
+        return;
+    mSession->stopping.store(true, std::memory_order_release);
+    if (mThread.joinable())
+        mThread.join();
+    CloseSocket(mSession->listener);
+    mSession.reset();
+}
+
+bool MediaServer::GetInfo(Info& info) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mSession == nullptr)
+        return false;
+    info = mSession->info;
+    return true;
+}
+
+std::string MediaServer::GetUrl(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mSession == nullptr)
+        Fail("The media server is not running");
+
+    std::error_code error;
+    auto absolute = std::filesystem::weakly_canonical(std::filesystem::path(path), error);
+    if (error || !IsWithin(absolute, mSession->root))
+        Fail(path + " is not under the media server root");
+
+    std::string url = mSession->info.url;
+    bool first = true;
+    for (const auto& segment : absolute.lexically_relative(mSession->root)) {
+        if (!first)
+            url += '/';
+        url += PercentEncode(segment.string());
+        first = false;
+    }
+    return url;
+}
@@ -0,0 +1,76 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/** Error code of the errors thrown when the media server can't be started or used */
+#define UXP_ADDON_SERVER_ERROR "SERVER_ERR"
+
+/** Serves the files under a root directory over HTTP on the loopback interface, so
+ that web views can stream and seek in large media files without a copy in memory.
+
+ URLs have the form http://127.0.0.1:<port>/<token>/<path relative to the root>. The
+ token is random for each start of the server: other local processes and pages can't
+ read the files unless they are handed a URL.
+ GET and HEAD requests are supported with single byte ranges, ETags derived from the
+ modification time and size, If-None-Match and If-Range. File data is sent with
+ sendfile on macOS and Linux (through a small buffer on Windows), so memory use
+ doesn't depend on the size of the files.
+
+ All connections are served by one addon owned thread with non-blocking sockets.
+*/
+
+class MediaServer {
+ public:
+    struct Info {
+        std::string url;  // base URL, ending with a slash
+        std::string root;
+        std::string token;
+        uint16_t port{0};
+    };
+
+    static MediaServer& Instance();
+
+    // Start serving the files under root on the given port, 0 picking a free one. A
+    // running server is restarted if the root or port differ.
+    // Throws an AddonError with the SERVER_ERR code on failure.
+    Info Start(const std::string& root, uint16_t port);
+
+    // Stop the server and close its connections. Also invoked when the addon is terminated.
+    void Stop();
+
+    // Returns false if the server isn't running
+    bool GetInfo(Info& info);
+
+    // URL of a file under the root. Throws SERVER_ERR if the server isn't running or the
+    // file is outside of the root.
+    std::string GetUrl(const std::string& path);
+
+    MediaServer(const MediaServer&) = delete;
+    MediaServer& operator=(const MediaServer&) = delete;
+
+ private:
+    struct Session;
+
+    MediaServer();
+    ~MediaServer();
+
+    void StopLocked();
+
+    std::mutex mMutex;
+    std::unique_ptr<Session> mSession;
+    std::thread mThread;
+};
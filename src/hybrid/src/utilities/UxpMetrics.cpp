@@ -0,0 +1,294 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpMetrics.h"
+
+#include "UxpAddon.h"
+#include "UxpValue.h"
+
+#if UXP_ADDON_METRICS
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace metrics {
+
+namespace {
+
+constexpr size_t kMaxMetrics = 64;
+
+// Log-linear histogram of nanoseconds: values below 16 have a bucket each, then every
+// power of two from 2^4 to 2^43 (~2.4 hours) is split into 16 sub-buckets.
+constexpr unsigned kSubBucketBits = 4;
+constexpr uint64_t kSubBuckets = 1 << kSubBucketBits;
+constexpr unsigned kMaxExponent = 43;
+constexpr size_t kBuckets = kSubBuckets + (kMaxExponent - kSubBucketBits + 1) * kSubBuckets;
+
+size_t BucketOf(uint64_t value) {
+    if (value < kSubBuckets)
+        return static_cast<size_t>(value);
+
+    const unsigned exponent = static_cast<unsigned>(std::bit_width(value)) - 1;
+    if (exponent > kMaxExponent)
+        return kBuckets - 1;
+
+    const uint64_t subBucket = (value >> (exponent - kSubBucketBits)) - kSubBuckets;
+    return static_cast<size_t>(kSubBuckets + (exponent - kSubBucketBits) * kSubBuckets + subBucket);
+}
+
+// Smallest value and width of a bucket
+void BucketRange(size_t bucket, uint64_t& lower, uint64_t& width) {
+    if (bucket < kSubBuckets) {
+        lower = bucket;
+        width = 1;
+        return;
+    }
+    const size_t offset = bucket - kSubBuckets;
+    const unsigned shift = static_cast<unsigned>(offset / kSubBuckets);
+    lower = (kSubBuckets + offset % kSubBuckets) << shift;
+    width = uint64_t(1) << shift;
+}
+
+// The counters of one metric on one thread. Only the owning thread writes them, so
+// increments are a relaxed load and store; snapshots read them from any thread.
+struct Counters {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> bytesOut{0};
+    std::atomic<uint64_t> totalNanoseconds{0};
+    std::array<std::atomic<uint64_t>, kBuckets> buckets{};
+};
+
+inline void Add(std::atomic<uint64_t>& counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+// The counters of one thread, allocated on first use of each metric
+struct Shard {
+    std::array<std::atomic<Counters*>, kMaxMetrics> counters{};
+};
+
+// Plain copy of the counters, summed over all threads
+struct Totals {
+    uint64_t calls{0};
+    uint64_t errors{0};
+    uint64_t bytesIn{0};
+    uint64_t bytesOut{0};
+    uint64_t totalNanoseconds{0};
+    std::vector<uint64_t> buckets = std::vector<uint64_t>(kBuckets, 0);
+
+    void Add(const Counters& counters) {
+        calls += counters.calls.load(std::memory_order_relaxed);
+        errors += counters.errors.load(std::memory_order_relaxed);
+        bytesIn += counters.bytesIn.load(std::memory_order_relaxed);
+        bytesOut += counters.bytesOut.load(std::memory_order_relaxed);
+        totalNanoseconds += counters.totalNanoseconds.load(std::memory_order_relaxed);
+        for (size_t bucket = 0; bucket < kBuckets; ++bucket)
+            buckets[bucket] += counters.buckets[bucket].load(std::memory_order_relaxed);
+    }
+
+    void Subtract(const Totals& baseline) {
+        calls -= baseline.calls;
+        errors -= baseline.errors;
+        bytesIn -= baseline.bytesIn;
+        bytesOut -= baseline.bytesOut;
+        totalNanoseconds -= baseline.totalNanoseconds;
+        for (size_t bucket = 0; bucket < kBuckets; ++bucket)
+            buckets[bucket] -= baseline.buckets[bucket];
+    }
+
+    // Value below which the given fraction of the samples fall, in nanoseconds
+    double Percentile(double fraction) const {
+        const uint64_t count = std::accumulate(buckets.begin(), buckets.end(), uint64_t(0));
+        if (count == 0)
+            return 0;
+
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * count + 0.5));
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < kBuckets; ++bucket) {
+            seen += buckets[bucket];
+            if (seen >= rank) {
+                uint64_t lower = 0;
+                uint64_t width = 0;
+                BucketRange(bucket, lower, width);
+                return lower + (width - 1) / 2.0;
+            }
+        }
+        return 0;
+    }
+
+    // Upper bound of the highest non-empty bucket, in nanoseconds
+    double Max() const {
+        for (size_t bucket = kBuckets; bucket-- > 0;) {
+            if (buckets[bucket] != 0) {
+                uint64_t lower = 0;
+                uint64_t width = 0;
+                BucketRange(bucket, lower, width);
+                return static_cast<double>(lower + width - 1);
+            }
+        }
+        return 0;
+    }
+};
+
+struct Metric {
+    Category category;
+    std::string name;
+};
+
+// Shards and metric names are never released: worker threads may record until the
+// very end of the process.
+struct Registry {
+    std::mutex mutex;
+    std::vector<Metric> metrics;
+    std::vector<Shard*> shards;
+    std::vector<Totals> baselines;
+};
+
+Registry& GetRegistry() {
+    static Registry* registry = new Registry;
+    return *registry;
+}
+
+Shard& GetShard() {
+    thread_local Shard* shard = []() {
+        Shard* created = new Shard;
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.shards.push_back(created);
+        return created;
+    }();
+    return *shard;
+}
+
+Counters& GetCounters(Shard& shard, MetricId id) {
+    Counters* counters = shard.counters[id].load(std::memory_order_relaxed);
+    if (counters == nullptr) {
+        counters = new Counters;
+        shard.counters[id].store(counters, std::memory_order_release);
+    }
+    return *counters;
+}
+
+double Milliseconds(double nanoseconds) {
+    return nanoseconds / 1e6;
+}
+
+Value LatencyValue(const Totals& totals) {
+    Value latency(Value::Kind::map);
+    auto& map = latency.GetMap();
+    map.emplace("mean", Value(totals.calls > 0 ? Milliseconds(double(totals.totalNanoseconds) / totals.calls) : 0.0));
+    map.emplace("p50", Value(Milliseconds(totals.Percentile(0.5))));
+    map.emplace("p90", Value(Milliseconds(totals.Percentile(0.9))));
+    map.emplace("p99", Value(Milliseconds(totals.Percentile(0.99))));
+    map.emplace("max", Value(Milliseconds(totals.Max())));
+    return latency;
+}
+
+}  // namespace
+
+MetricId Register(Category category, const char* name) {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (size_t index = 0; index < registry.metrics.size(); ++index) {
+        if (registry.metrics[index].category == category && registry.metrics[index].name == name)
+            return static_cast<MetricId>(index);
+    }
+    if (registry.metrics.size() >= kMaxMetrics)
+        return kInvalidMetric;
+
+    registry.metrics.push_back({category, name});
+    registry.baselines.emplace_back();
+    return static_cast<MetricId>(registry.metrics.size() - 1);
+}
+
+void Record(MetricId id, Clock::duration latency, bool failed, uint64_t bytesIn, uint64_t bytesOut) {
+    if (id >= kMaxMetrics)
+        return;
+
+    Counters& counters = GetCounters(GetShard(), id);
+    const auto nanoseconds = static_cast<uint64_t>(std::max<int64_t>(
+        0, std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count()));
+    Add(counters.calls, 1);
+    if (failed)
+        Add(counters.errors, 1);
+    Add(counters.bytesIn, bytesIn);
+    Add(counters.bytesOut, bytesOut);
+    Add(counters.totalNanoseconds, nanoseconds);
+    Add(counters.buckets[BucketOf(nanoseconds)], 1);
+}
+
+addon_value CreateSnapshot(addon_env env, bool reset) {
+    Value stats(Value::Kind::map);
+    auto& statsMap = stats.GetMap();
+    statsMap.emplace("enabled", Value(true));
+    Value exports(Value::Kind::map);
+    Value operations(Value::Kind::map);
+    Value queues(Value::Kind::map);
+
+    Registry& registry = GetRegistry();
+    {
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (size_t index = 0; index < registry.metrics.size(); ++index) {
+            Totals totals;
+            for (Shard* shard : registry.shards) {
+                const Counters* counters = shard->counters[index].load(std::memory_order_acquire);
+                if (counters != nullptr)
+                    totals.Add(*counters);
+            }
+            Totals current = totals;
+            totals.Subtract(registry.baselines[index]);
+            if (reset)
+                registry.baselines[index] = std::move(current);
+
+            const Metric& metric = registry.metrics[index];
+            Value entry(Value::Kind::map);
+            auto& entryMap = entry.GetMap();
+            if (metric.category == Category::queues) {
+                entryMap.emplace("count", Value(double(totals.calls)));
+                entryMap.emplace("wait", LatencyValue(totals));
+                queues.GetMap().emplace(metric.name, std::move(entry));
+                continue;
+            }
+
+            entryMap.emplace("calls", Value(double(totals.calls)));
+            entryMap.emplace("errors", Value(double(totals.errors)));
+            entryMap.emplace("bytesIn", Value(double(totals.bytesIn)));
+            entryMap.emplace("bytesOut", Value(double(totals.bytesOut)));
+            entryMap.emplace("latency", LatencyValue(totals));
+            Value& group = metric.category == Category::exports ? exports : operations;
+            group.GetMap().emplace(metric.name, std::move(entry));
+        }
+    }
+
+    statsMap.emplace("exports", std::move(exports));
+    statsMap.emplace("operations", std::move(operations));
+    statsMap.emplace("queues", std::move(queues));
+    return stats.Convert(env);
+}
+
+}  // namespace metrics
+
+#else
+
+addon_value metrics::CreateSnapshot(addon_env env, bool /*reset*/) {
+    Value stats(Value::Kind::map);
+    stats.GetMap().emplace("enabled", Value(false));
+    return stats.Convert(env);
+}
+
+#endif
@@ -0,0 +1,132 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "../api/UxpAddonTypes.h"
+
+/** Runtime metrics of the addon, read from JavaScript with getStats().
+
+ Every metric counts calls, errors, bytes in and out, and keeps a latency histogram.
+ Metrics are registered once per call site and recorded into per-thread counters
+ that only their own thread writes, so recording takes no lock and no atomic
+ read-modify-write. A snapshot sums the counters of all threads; reset works by
+ remembering the current totals and subtracting them from later snapshots.
+
+ The histograms are log-linear (HDR style): 16 sub-buckets per power of two, so a
+ percentile is accurate within ~6% from 1 ns up to a few hours.
+
+     addon_value WriteFile(addon_env env, addon_callback_info info) {
+         UXP_ADDON_METRICS_SCOPE(metrics, exports, "writeFile");
+         try {
+             ...
+             metrics.AddBytesIn(payload.size());
+             ...
+         } catch (...) {
+             metrics.Fail();
+             return CreateErrorFromException(env);
+         }
+     }
+
+ Building with UXP_ADDON_METRICS=0 compiles the instrumentation out: CallMetrics and
+ QueueStamp become empty, and getStats reports { enabled: false }.
+*/
+
+#ifndef UXP_ADDON_METRICS
+#define UXP_ADDON_METRICS 1
+#endif
+
+namespace metrics {
+
+using Clock = std::chrono::steady_clock;
+
+enum class Category {
+    exports,     // JavaScript calls into the addon, measured until the export returns
+    operations,  // internal steps such as base64 decoding or file writes
+    queues       // time between scheduling a task on a queue and running it
+};
+
+using MetricId = uint32_t;
+constexpr MetricId kInvalidMetric = UINT32_MAX;
+
+#if UXP_ADDON_METRICS
+// Return the id of the metric of that category and name, registering it on first use.
+// Returns kInvalidMetric once the table is full; recording it is then a no-op.
+MetricId Register(Category category, const char* name);
+
+// Can be invoked on any thread
+void Record(MetricId id, Clock::duration latency, bool failed, uint64_t bytesIn, uint64_t bytesOut);
+#else
+inline MetricId Register(Category /*category*/, const char* /*name*/) {
+    return kInvalidMetric;
+}
+#endif
+
+// Return the getStats object and optionally reset the metrics afterwards.
+// This method must be invoked on the JavaScript thread.
+addon_value CreateSnapshot(addon_env env, bool reset);
+
+}  // namespace metrics
+
+/** Measures one call of an export or operation; recorded when it goes out of scope */
+class CallMetrics {
+ public:
+#if UXP_ADDON_METRICS
+    explicit CallMetrics(metrics::MetricId id) : mId(id), mStart(metrics::Clock::now()) {}
+    ~CallMetrics() { metrics::Record(mId, metrics::Clock::now() - mStart, mFailed, mBytesIn, mBytesOut); }
+
+    void AddBytesIn(size_t bytes) { mBytesIn += bytes; }
+    void AddBytesOut(size_t bytes) { mBytesOut += bytes; }
+    void Fail() { mFailed = true; }
+
+ private:
+    const metrics::MetricId mId;
+    const metrics::Clock::time_point mStart;
+    uint64_t mBytesIn{0};
+    uint64_t mBytesOut{0};
+    bool mFailed{false};
+#else
+    explicit CallMetrics(metrics::MetricId /*id*/) {}
+
+    void AddBytesIn(size_t /*bytes*/) {}
+    void AddBytesOut(size_t /*bytes*/) {}
+    void Fail() {}
+#endif
+
+ public:
+    CallMetrics(const CallMetrics&) = delete;
+    CallMetrics& operator=(const CallMetrics&) = delete;
+};
+
+/** Time at which a task was queued; Record adds the wait to a queue metric */
+class QueueStamp {
+ public:
+#if UXP_ADDON_METRICS
+    QueueStamp() : mQueued(metrics::Clock::now()) {}
+    void Reset() { mQueued = metrics::Clock::now(); }
+    void Record(metrics::MetricId id) const { metrics::Record(id, metrics::Clock::now() - mQueued, false, 0, 0); }
+
+ private:
+    metrics::Clock::time_point mQueued;
+#else
+    void Reset() {}
+    void Record(metrics::MetricId /*id*/) const {}
+#endif
+};
+
+// Declare a CallMetrics variable for the metric of that category and name.
+// The metric is registered the first time the statement runs.
+#define UXP_ADDON_METRICS_SCOPE(variable, category, name)                                               \
+    static const metrics::MetricId variable##Id = metrics::Register(metrics::Category::category, name); \
+    CallMetrics variable(variable##Id)
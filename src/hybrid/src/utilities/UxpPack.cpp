@@ -0,0 +1,609 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpPack.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+
+#include "UxpAddon.h"
+#include "UxpFiles.h"
+#include "UxpMetrics.h"
+#include "UxpStorage.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+const char kHeaderMagic[] = "UXPPACK1";
+const char kRecordMagic[] = "UXPR";
+const char kFooterMagic[] = "UXPINDEX";
+
+constexpr uint64_t kHeaderSize = 8;
+constexpr uint64_t kRecordHeaderSize = 16;
+constexpr uint64_t kSlotSize = 16;
+constexpr uint64_t kFooterSize = 24;
+constexpr size_t kMinSlots = 16;
+
+uint64_t ReadLittleEndian(const uint8_t* p, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = bytes; i-- > 0;)
+        value = (value << 8) | p[i];
+    return value;
+}
+
+void AppendLittleEndian(std::string& out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i)
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+// FNV-1a
+uint64_t HashName(std::string_view name) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const unsigned char c : name) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+struct Slot {
+    uint64_t hash{0};
+    uint64_t offset{0};  // 0 for an empty slot, records follow the header
+};
+
+// Insert into an open addressing table, replacing the slot of the same name. Returns
+// whether a new entry was added.
+bool InsertSlot(std::vector<Slot>& slots, uint64_t hash, uint64_t offset, const std::function<bool(uint64_t)>& isSameName) {
+    const size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Slot& slot = slots[i];
+        if (slot.offset == 0) {
+            slot = {hash, offset};
+            return true;
+        }
+        if (slot.hash == hash && isSameName && isSameName(slot.offset)) {
+            slot.offset = offset;
+            return false;
+        }
+    }
+}
+
+// Table with at most half of its slots used
+std::vector<Slot> CreateSlots(size_t entries) {
+    size_t count = kMinSlots;
+    while (count < entries * 2)
+        count *= 2;
+    return std::vector<Slot>(count);
+}
+
+std::string RecordHeader(std::string_view name, uint64_t dataLength) {
+    std::string header(kRecordMagic, 4);
+    AppendLittleEndian(header, name.size(), 4);
+    AppendLittleEndian(header, dataLength, 8);
+    header.append(name);
+    return header;
+}
+
+std::string IndexBytes(const std::vector<Slot>& slots, uint64_t indexOffset, size_t entries) {
+    std::string index;
+    index.reserve(slots.size() * kSlotSize + kFooterSize);
+    for (const auto& slot : slots) {
+        AppendLittleEndian(index, slot.hash, 8);
+        AppendLittleEndian(index, slot.offset, 8);
+    }
+    AppendLittleEndian(index, indexOffset, 8);
+    AppendLittleEndian(index, slots.size(), 4);
+    AppendLittleEndian(index, entries, 4);
+    index.append(kFooterMagic, 8);
+    return index;
+}
+
+}  // namespace
+
+/** The state of one pack file. All methods must be invoked with the mutex locked. */
+class PackStore::Pack {
+ public:
+    explicit Pack(std::filesystem::path path) : mPath(std::move(path)) {}
+
+    std::mutex mutex;
+
+    bool Write(const std::string& name, const std::vector<std::string_view>& parts) {
+        Refresh();
+        LoadSlots();
+        // The file changes under the mapping, and the index is dropped until it is written back
+        mMapping.reset();
+
+        std::error_code ec;
+        if (!mExists) {
+            const auto parent = mPath.parent_path();
+            if (!parent.empty())
+                std::filesystem::create_directories(parent, ec);
+            std::ofstream create(mPath, std::ios::binary | std::ios::out | std::ios::trunc);
+            create.write(kHeaderMagic, kHeaderSize);
+            create.close();
+            if (!create.good())
+                return false;
+            mExists = true;
+            mDirty = true;
+        } else if (!mDirty) {
+            std::filesystem::resize_file(mPath, mEnd, ec);
+            if (ec)
+                return false;
+            mDirty = true;
+        }
+
+        uint64_t dataLength = 0;
+        for (const auto& part : parts)
+            dataLength += part.size();
+        const std::string header = RecordHeader(name, dataLength);
+
+        std::fstream file(mPath, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(static_cast<std::streamoff>(mEnd));
+        file.write(header.data(), static_cast<std::streamsize>(header.size()));
+        for (const auto& part : parts)
+            file.write(part.data(), static_cast<std::streamsize>(part.size()));
+        file.flush();
+        if (!file.good())
+            return false;
+
+        const auto isSameName = [&file, &name](uint64_t offset) {
+            uint8_t lengths[kRecordHeaderSize];
+            file.seekg(static_cast<std::streamoff>(offset));
+            file.read(reinterpret_cast<char*>(lengths), sizeof(lengths));
+            if (!file.good() || ReadLittleEndian(lengths + 4, 4) != name.size())
+                return false;
+            std::string recordName(name.size(), '\0');
+            file.read(recordName.data(), static_cast<std::streamsize>(recordName.size()));
+            return file.good() && recordName == name;
+        };
+        Insert(HashName(name), mEnd, isSameName);
+        mEnd += header.size() + dataLength;
+        return true;
+    }
+
+    bool Read(const std::string& name, std::string& data) {
+        if (!Map())
+            return false;
+        const uint64_t offset = Find(name);
+        if (offset == 0)
+            return false;
+        std::string_view recordName;
+        std::string_view payload;
+        ParseRecord(offset, recordName, payload);
+        data.assign(payload);
+        return true;
+    }
+
+    std::vector<std::string> List() {
+        std::vector<std::string> names;
+        if (!Map())
+            return names;
+        ForEachRecord([&names](uint64_t /*offset*/, std::string_view name, std::string_view /*payload*/) {
+            names.emplace_back(name);
+        });
+        std::sort(names.begin(), names.end());
+        return names;
+    }
+
+    Compaction Compact() {
+        Compaction compaction;
+        if (!Map())
+            return compaction;
+
+        // Live records in the order they were written
+        std::vector<uint64_t> offsets;
+        ForEachRecord([&offsets](uint64_t offset, std::string_view, std::string_view) { offsets.push_back(offset); });
+        std::sort(offsets.begin(), offsets.end());
+
+        auto temporaryPath = mPath;
+        temporaryPath += ".compact";
+        std::vector<Slot> slots = CreateSlots(offsets.size());
+        {
+            std::ofstream output(temporaryPath, std::ios::binary | std::ios::out | std::ios::trunc);
+            output.write(kHeaderMagic, kHeaderSize);
+            uint64_t end = kHeaderSize;
+            for (const uint64_t offset : offsets) {
+                std::string_view name;
+                std::string_view payload;
+                ParseRecord(offset, name, payload);
+                const std::string header = RecordHeader(name, payload.size());
+                output.write(header.data(), static_cast<std::streamsize>(header.size()));
+                output.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+                InsertSlot(slots, HashName(name), end, nullptr);
+                end += header.size() + payload.size();
+            }
+            const std::string index = IndexBytes(slots, end, offsets.size());
+            output.write(index.data(), static_cast<std::streamsize>(index.size()));
+            output.close();
+            if (!output.good()) {
+                std::error_code ec;
+                std::filesystem::remove(temporaryPath, ec);
+                throw AddonError(UXP_ADDON_IO_ERROR, "Unable to write " + temporaryPath.string());
+            }
+        }
+
+        const uint64_t previousSize = mMapping->GetSize();
+        // Windows can't replace a mapped file
+        mMapping.reset();
+        std::error_code ec;
+        const uint64_t size = std::filesystem::file_size(temporaryPath, ec);
+        std::filesystem::rename(temporaryPath, mPath, ec);
+        if (ec) {
+            std::filesystem::remove(temporaryPath, ec);
+            throw AddonError(UXP_ADDON_IO_ERROR, "Unable to replace " + mPath.string());
+        }
+
+        mLoaded = false;
+        compaction.entries = static_cast<uint32_t>(offsets.size());
+        compaction.reclaimedBytes = previousSize > size ? previousSize - size : 0;
+        return compaction;
+    }
+
+    // Write back the index dropped by the writes
+    void Flush() {
+        if (!mLoaded || !mDirty)
+            return;
+        mMapping.reset();
+        const std::string index = IndexBytes(mSlots, mEnd, mEntries);
+        {
+            std::fstream file(mPath, std::ios::binary | std::ios::in | std::ios::out);
+            file.seekp(static_cast<std::streamoff>(mEnd));
+            file.write(index.data(), static_cast<std::streamsize>(index.size()));
+            file.close();
+            if (!file.good())
+                throw AddonError(UXP_ADDON_IO_ERROR, "Unable to write the index of " + mPath.string());
+        }
+        // Bytes of a failed write past the records
+        std::error_code ec;
+        if (std::filesystem::file_size(mPath, ec) > mEnd + index.size())
+            std::filesystem::resize_file(mPath, mEnd + index.size(), ec);
+
+        mDirty = false;
+        mIndexOffset = mEnd;
+        mSlotCount = mSlots.size();
+        mStamp = ReadStamp();
+    }
+
+    const std::filesystem::path& GetPath() const { return mPath; }
+
+    // Size of the file after the last write or compaction
+    uint64_t GetFileSize() const { return mDirty ? mEnd : mIndexOffset + mSlotCount * kSlotSize + kFooterSize; }
+
+    // Unmap the pack, it is loaded again when used
+    void Release() {
+        mMapping.reset();
+        mLoaded = false;
+    }
+
+ private:
+    void Load() {
+        if (mLoaded)
+            return;
+        mMapping.reset();
+        mSlots.clear();
+        mSlotsLoaded = false;
+        mDirty = false;
+
+        mStamp = ReadStamp();
+        mExists = mStamp.exists;
+        if (!mExists) {
+            mEnd = kHeaderSize;
+            mEntries = 0;
+            mSlots = CreateSlots(0);
+            mSlotsLoaded = true;
+            mLoaded = true;
+            return;
+        }
+
+        mMapping = std::make_unique<MappedFile>(mPath.string());
+        const uint8_t* data = mMapping->GetData();
+        const uint64_t size = mMapping->GetSize();
+        if (size < kHeaderSize || std::memcmp(data, kHeaderMagic, kHeaderSize) != 0)
+            throw AddonError(UXP_ADDON_IO_ERROR, mPath.string() + " is not a pack");
+
+        if (!ReadFooter(data, size))
+            Recover(data, size);
+        mLoaded = true;
+    }
+
+    bool ReadFooter(const uint8_t* data, uint64_t size) {
+        if (size < kHeaderSize + kFooterSize || std::memcmp(data + size - 8, kFooterMagic, 8) != 0)
+            return false;
+        const uint8_t* footer = data + size - kFooterSize;
+        const uint64_t indexOffset = ReadLittleEndian(footer, 8);
+        const uint64_t slotCount = ReadLittleEndian(footer + 8, 4);
+        const uint64_t entries = ReadLittleEndian(footer + 12, 4);
+        if (slotCount == 0 || (slotCount & (slotCount - 1)) != 0 || entries >= slotCount)
+            return false;
+        if (indexOffset < kHeaderSize || indexOffset > size - kFooterSize ||
+            size - kFooterSize - indexOffset != slotCount * kSlotSize)
+            return false;
+
+        mEnd = indexOffset;
+        mIndexOffset = indexOffset;
+        mSlotCount = slotCount;
+        mEntries = entries;
+        return true;
+    }
+
+    // Rebuild the index from the records, up to the first incomplete one
+    void Recover(const uint8_t* data, uint64_t size) {
+        mSlots = CreateSlots(0);
+        mSlotsLoaded = true;
+        mEntries = 0;
+        uint64_t offset = kHeaderSize;
+        while (offset + kRecordHeaderSize <= size && std::memcmp(data + offset, kRecordMagic, 4) == 0) {
+            const uint64_t nameLength = ReadLittleEndian(data + offset + 4, 4);
+            const uint64_t dataLength = ReadLittleEndian(data + offset + 8, 8);
+            const uint64_t available = size - offset - kRecordHeaderSize;
+            if (nameLength > available || dataLength > available - nameLength)
+                break;
+            const std::string_view name(reinterpret_cast<const char*>(data + offset + kRecordHeaderSize), nameLength);
+            Insert(HashName(name), offset, [data, name](uint64_t other) {
+                return ReadLittleEndian(data + other + 4, 4) == name.size() &&
+                       std::memcmp(data + other + kRecordHeaderSize, name.data(), name.size()) == 0;
+            });
+            offset += kRecordHeaderSize + nameLength + dataLength;
+        }
+        mEnd = offset;
+        mDirty = true;
+    }
+
+    // Copy the index of the mapping for the writes
+    void LoadSlots() {
+        if (mSlotsLoaded)
+            return;
+        const uint8_t* index = mMapping->GetData() + mIndexOffset;
+        mSlots.resize(mSlotCount);
+        for (size_t i = 0; i < mSlots.size(); ++i) {
+            mSlots[i].hash = ReadLittleEndian(index + i * kSlotSize, 8);
+            mSlots[i].offset = ReadLittleEndian(index + i * kSlotSize + 8, 8);
+        }
+        mSlotsLoaded = true;
+    }
+
+    bool Insert(uint64_t hash, uint64_t offset, const std::function<bool(uint64_t)>& isSameName) {
+        if ((mEntries + 1) * 2 > mSlots.size()) {
+            auto slots = CreateSlots(mEntries + 1);
+            for (const auto& slot : mSlots) {
+                if (slot.offset != 0)
+                    InsertSlot(slots, slot.hash, slot.offset, nullptr);
+            }
+            mSlots = std::move(slots);
+        }
+        const bool added = InsertSlot(mSlots, hash, offset, isSameName);
+        if (added)
+            ++mEntries;
+        return added;
+    }
+
+    // Size and modification time of the file, with a single system call per read
+    struct Stamp {
+        bool exists{false};
+        uint64_t size{0};
+        int64_t writeTime{0};
+
+        bool operator==(const Stamp& other) const {
+            return exists == other.exists && size == other.size && writeTime == other.writeTime;
+        }
+    };
+
+    Stamp ReadStamp() const {
+        Stamp stamp;
+#ifdef _WIN32
+        WIN32_FILE_ATTRIBUTE_DATA attributes;
+        if (GetFileAttributesExW(mPath.c_str(), GetFileExInfoStandard, &attributes)) {
+            stamp.exists = true;
+            stamp.size = (uint64_t(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+            stamp.writeTime = (int64_t(attributes.ftLastWriteTime.dwHighDateTime) << 32) |
+                              attributes.ftLastWriteTime.dwLowDateTime;
+        }
+#else
+        struct stat status;
+        if (stat(mPath.c_str(), &status) == 0) {
+            stamp.exists = true;
+            stamp.size = static_cast<uint64_t>(status.st_size);
+#ifdef __APPLE__
+            stamp.writeTime = int64_t(status.st_mtimespec.tv_sec) * 1000000000 + status.st_mtimespec.tv_nsec;
+#else
+            stamp.writeTime = int64_t(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+#endif
+        }
+#endif
+        return stamp;
+    }
+
+    // Load the pack again if another process replaced it, before its pages are touched
+    void Refresh() {
+        if (mLoaded && !mDirty && !(ReadStamp() == mStamp))
+            mLoaded = false;
+        Load();
+    }
+
+    // Map the pack with an up to date index. Returns false if there is no pack.
+    bool Map() {
+        Refresh();
+        if (!mExists)
+            return false;
+        Flush();
+        if (!mMapping)
+            mMapping = std::make_unique<MappedFile>(mPath.string());
+        if (mMapping->GetSize() != mIndexOffset + mSlotCount * kSlotSize + kFooterSize)
+            throw AddonError(UXP_ADDON_IO_ERROR, mPath.string() + " was changed by another process");
+        return true;
+    }
+
+    // Offset of the record of name, 0 if there is none
+    uint64_t Find(std::string_view name) const {
+        const uint8_t* index = mMapping->GetData() + mIndexOffset;
+        const uint64_t hash = HashName(name);
+        const uint64_t mask = mSlotCount - 1;
+        for (uint64_t i = hash & mask, probes = 0; probes < mSlotCount; i = (i + 1) & mask, ++probes) {
+            const uint64_t offset = ReadLittleEndian(index + i * kSlotSize + 8, 8);
+            if (offset == 0)
+                return 0;
+            if (ReadLittleEndian(index + i * kSlotSize, 8) != hash)
+                continue;
+            std::string_view recordName;
+            std::string_view payload;
+            ParseRecord(offset, recordName, payload);
+            if (recordName == name)
+                return offset;
+        }
+        return 0;
+    }
+
+    void ForEachRecord(const std::function<void(uint64_t, std::string_view, std::string_view)>& visit) const {
+        const uint8_t* index = mMapping->GetData() + mIndexOffset;
+        for (uint64_t i = 0; i < mSlotCount; ++i) {
+            const uint64_t offset = ReadLittleEndian(index + i * kSlotSize + 8, 8);
+            if (offset == 0)
+                continue;
+            std::string_view name;
+            std::string_view payload;
+            ParseRecord(offset, name, payload);
+            visit(offset, name, payload);
+        }
+    }
+
+    void ParseRecord(uint64_t offset, std::string_view& name, std::string_view& payload) const {
+        const uint8_t* data = mMapping->GetData();
+        if (offset < kHeaderSize || offset > mIndexOffset || mIndexOffset - offset < kRecordHeaderSize ||
+            std::memcmp(data + offset, kRecordMagic, 4) != 0)
+            throw AddonError(UXP_ADDON_IO_ERROR, "Damaged index in " + mPath.string());
+        const uint64_t nameLength = ReadLittleEndian(data + offset + 4, 4);
+        const uint64_t dataLength = ReadLittleEndian(data + offset + 8, 8);
+        const uint64_t available = mIndexOffset - offset - kRecordHeaderSize;
+        if (nameLength > available || dataLength > available - nameLength)
+            throw AddonError(UXP_ADDON_IO_ERROR, "Damaged record in " + mPath.string());
+        const char* record = reinterpret_cast<const char*>(data + offset + kRecordHeaderSize);
+        name = std::string_view(record, nameLength);
+        payload = std::string_view(record + nameLength, dataLength);
+    }
+
+    const std::filesystem::path mPath;
+    bool mLoaded{false};
+    bool mExists{false};
+    // The index was dropped by a write: the file ends with the records
+    bool mDirty{false};
+    // End of the records
+    uint64_t mEnd{kHeaderSize};
+    size_t mEntries{0};
+    // Index of the file, when it isn't dirty
+    uint64_t mIndexOffset{0};
+    uint64_t mSlotCount{0};
+    // Copy of the index for the writes
+    std::vector<Slot> mSlots;
+    bool mSlotsLoaded{false};
+    // The file when it was loaded or its index written
+    Stamp mStamp;
+    std::unique_ptr<MappedFile> mMapping;
+};
+
+PackStore::PackStore() = default;
+
+PackStore::~PackStore() = default;
+
+PackStore& PackStore::Instance() {
+    static PackStore instance;
+    return instance;
+}
+
+std::shared_ptr<PackStore::Pack> PackStore::Get(const std::string& directory) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto& alias = mAliases[directory];
+    if (!alias) {
+        // Spellings of the same directory share its pack
+        const auto path = std::filesystem::path(directory).lexically_normal();
+        auto& pack = mPacks[path.string()];
+        if (!pack)
+            pack = std::make_shared<Pack>(path / kFileName);
+        alias = pack;
+    }
+    return alias;
+}
+
+bool PackStore::Write(const std::string& directory, const std::string& name, const std::vector<std::string_view>& parts) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "packWrite");
+    for (const auto& part : parts)
+        metrics.AddBytesOut(part.size());
+
+    bool success = false;
+    try {
+        auto pack = Get(directory);
+        std::lock_guard<std::mutex> lock(pack->mutex);
+        success = pack->Write(name, parts);
+        if (success)
+            StorageManager::Instance().RecordWrite(pack->GetPath().string(), pack->GetFileSize());
+    } catch (const std::exception&) {
+    }
+    if (!success)
+        metrics.Fail();
+    return success;
+}
+
+bool PackStore::Read(const std::string& directory, const std::string& name, std::string& data) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "packRead");
+    try {
+        auto pack = Get(directory);
+        std::lock_guard<std::mutex> lock(pack->mutex);
+        const bool found = pack->Read(name, data);
+        metrics.AddBytesOut(data.size());
+        return found;
+    } catch (...) {
+        metrics.Fail();
+        throw;
+    }
+}
+
+std::vector<std::string> PackStore::List(const std::string& directory) {
+    auto pack = Get(directory);
+    std::lock_guard<std::mutex> lock(pack->mutex);
+    return pack->List();
+}
+
+PackStore::Compaction PackStore::Compact(const std::string& directory) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "packCompact");
+    try {
+        auto pack = Get(directory);
+        std::lock_guard<std::mutex> lock(pack->mutex);
+        const auto compaction = pack->Compact();
+        std::error_code ec;
+        const uint64_t size = std::filesystem::file_size(pack->GetPath(), ec);
+        if (!ec)
+            StorageManager::Instance().RecordWrite(pack->GetPath().string(), size);
+        return compaction;
+    } catch (...) {
+        metrics.Fail();
+        throw;
+    }
+}
+
+void PackStore::Close() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto& entry : mPacks) {
+        std::lock_guard<std::mutex> packLock(entry.second->mutex);
+        try {
+            entry.second->Flush();
+        } catch (const std::exception&) {
+        }
+        entry.second->Release();
+    }
+    mPacks.clear();
+    mAliases.clear();
+}
@@ -0,0 +1,86 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/** Stores the small files of a directory (sidecars, thumbnails) in a single pack file
+ instead of one file each, so that scans and backups handle one file per directory.
+
+ A pack is append-only: a header, one record per written file (a later record for the
+ same name replaces the earlier one), then a trailing index. The index is an open
+ addressing hash table of the name hashes and record offsets, so a lookup probes the
+ memory mapped pack without reading the rest of the index.
+     header   "UXPPACK1"
+     record   "UXPR", name length (u32), data length (u64), name, data
+     index    slot count * { name hash (u64), record offset (u64), 0 for an empty slot }
+     footer   index offset (u64), slot count (u32), entry count (u32), "UXPINDEX"
+ Integers are little-endian.
+
+ Writes overwrite the index with the new record and only rewrite the index when the pack
+ is next read, listed or compacted, or when the addon is terminated. If the addon
+ doesn't get there, the records are scanned to rebuild the index the next time the
+ pack is opened. Replaced records stay in the pack until it is compacted.
+ Packs are kept mapped between reads; the size and modification time of the file are
+ checked first, so that a pack replaced by another process is loaded again.
+*/
+
+class PackStore {
+ public:
+    // Name of the pack file in each directory
+    static constexpr const char* kFileName = "files.uxppack";
+
+    struct Compaction {
+        uint32_t entries{0};
+        uint64_t reclaimedBytes{0};
+    };
+
+    static PackStore& Instance();
+
+    // Add the concatenation of parts to the pack of directory under name, replacing
+    // an earlier entry. Returns false if the pack can't be written.
+    bool Write(const std::string& directory, const std::string& name, const std::vector<std::string_view>& parts);
+
+    // Copy the data of an entry. Returns false if there is no pack or no such entry.
+    // Throws an AddonError with the IO_ERR code if the pack is damaged.
+    bool Read(const std::string& directory, const std::string& name, std::string& data);
+
+    // Names of the entries of the pack of directory, sorted
+    std::vector<std::string> List(const std::string& directory);
+
+    // Rewrite the pack without the replaced records
+    Compaction Compact(const std::string& directory);
+
+    // Write the pending indexes and release the packs. Invoked when the addon is terminated.
+    void Close();
+
+    PackStore(const PackStore&) = delete;
+    PackStore& operator=(const PackStore&) = delete;
+
+ private:
+    class Pack;
+
+    PackStore();
+    ~PackStore();
+
+    std::shared_ptr<Pack> Get(const std::string& directory);
+
+    std::mutex mMutex;
+    // By normalized path, and by the paths they were requested with
+    std::map<std::string, std::shared_ptr<Pack>> mPacks;
+    std::map<std::string, std::shared_ptr<Pack>> mAliases;
+};
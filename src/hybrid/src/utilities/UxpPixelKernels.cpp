@@ -0,0 +1,851 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpPixelKernels.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define UXP_PIXEL_KERNELS_NEON 1
+#include <arm_neon.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#define UXP_PIXEL_KERNELS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// AVX2 functions are compiled for AVX2 whatever the target of the rest of the addon, and
+// only invoked when the CPU has it
+#if defined(UXP_PIXEL_KERNELS_X86) && (defined(__GNUC__) || defined(__clang__))
+#define UXP_AVX2 __attribute__((target("avx2")))
+#else
+#define UXP_AVX2
+#endif
+
+namespace {
+
+// round(value / 255) for value up to 255 * 255
+inline uint8_t Divide255(unsigned value) {
+    value += 128;
+    return static_cast<uint8_t>((value + (value >> 8)) >> 8);
+}
+
+inline uint8_t Unpremultiply(uint8_t value, uint8_t alpha) {
+    const auto result = static_cast<int>(float(value) * 255.0f / float(alpha) + 0.5f);
+    return static_cast<uint8_t>(std::min(result, 255));
+}
+
+inline uint8_t Paeth(int a, int b, int c) {
+    const int pa = std::abs(b - c);
+    const int pb = std::abs(a - c);
+    const int pc = std::abs(a + b - 2 * c);
+    return static_cast<uint8_t>(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+}
+
+// @{ Portable kernels, also used for the pixels past the last full vector
+void PremultiplyPortable(uint8_t* rgba, size_t pixels) {
+    for (size_t index = 0; index < pixels; ++index, rgba += 4) {
+        const unsigned alpha = rgba[3];
+        rgba[0] = Divide255(rgba[0] * alpha);
+        rgba[1] = Divide255(rgba[1] * alpha);
+        rgba[2] = Divide255(rgba[2] * alpha);
+    }
+}
+
+void UnpremultiplyPortable(uint8_t* rgba, size_t pixels) {
+    for (size_t index = 0; index < pixels; ++index, rgba += 4) {
+        const uint8_t alpha = rgba[3];
+        for (int channel = 0; channel < 3; ++channel)
+            rgba[channel] = alpha == 0 ? 0 : Unpremultiply(rgba[channel], alpha);
+    }
+}
+
+void OverPortable(uint8_t* rgba, const uint8_t* background, size_t pixels) {
+    for (size_t index = 0; index < pixels; ++index, rgba += 4, background += 4) {
+        const unsigned transparency = 255 - rgba[3];
+        for (int channel = 0; channel < 4; ++channel)
+            rgba[channel] = static_cast<uint8_t>(std::min<unsigned>(255, rgba[channel] + Divide255(background[channel] * transparency)));
+    }
+}
+
+void MultiplyAlphaPortable(uint8_t* rgba, const uint8_t* mask, size_t pixels) {
+    for (size_t index = 0; index < pixels; ++index)
+        rgba[index * 4 + 3] = Divide255(rgba[index * 4 + 3] * unsigned(mask[index]));
+}
+
+void ThresholdPortable(uint8_t* values, size_t count, uint8_t level) {
+    for (size_t index = 0; index < count; ++index)
+        values[index] = values[index] >= level ? 255 : 0;
+}
+
+void MaximumPortable(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t count) {
+    for (size_t index = 0; index < count; ++index)
+        out[index] = std::max(a[index], b[index]);
+}
+
+void MinimumPortable(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t count) {
+    for (size_t index = 0; index < count; ++index)
+        out[index] = std::min(a[index], b[index]);
+}
+
+void SubtractPortable(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t count) {
+    for (size_t index = 0; index < count; ++index)
+        out[index] = static_cast<uint8_t>(a[index] - b[index]);
+}
+
+void PaethPortable(uint8_t* out, const uint8_t* row, const uint8_t* left, const uint8_t* up, const uint8_t* corner, size_t count) {
+    for (size_t index = 0; index < count; ++index)
+        out[index] = static_cast<uint8_t>(row[index] - Paeth(left[index], up[index], corner[index]));
+}
+
+uint64_t SumMagnitudesPortable(const uint8_t* values, size_t count) {
+    uint64_t sum = 0;
+    for (size_t index = 0; index < count; ++index)
+        sum += std::min<unsigned>(values[index], 256 - values[index]);
+    return sum;
+}
+
+void AccumulatePortable(uint16_t* sums, const uint8_t* add, const uint8_t* remove, size_t count) {
+    for (size_t index = 0; index < count; ++index)
+        sums[index] = static_cast<uint16_t>(sums[index] + add[index] - remove[index]);
+}
+
+void ScalePortable(uint8_t* out, const uint16_t* sums, uint16_t reciprocal, size_t count) {
+    for (size_t index = 0; index < count; ++index)
+        out[index] = static_cast<uint8_t>((uint32_t(sums[index]) * reciprocal) >> 16);
+}
+void DifferencePortable(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t pixels) {
+    for (size_t index = 0; index < pixels; ++index, a += 4, b += 4) {
+        uint8_t largest = 0;
+        for (int channel = 0; channel < 4; ++channel)
+            largest = std::max(largest, static_cast<uint8_t>(std::abs(a[channel] - b[channel])));
+        out[index] = largest;
+    }
+}
+// @}
+
+constexpr PixelKernels kPortable = {"portable",
+                                    PremultiplyPortable,
+                                    UnpremultiplyPortable,
+                                    OverPortable,
+                                    MultiplyAlphaPortable,
+                                    ThresholdPortable,
+                                    MaximumPortable,
+                                    MinimumPortable,
+                                    SubtractPortable,
+                                    PaethPortable,
+                                    SumMagnitudesPortable,
+                                    AccumulatePortable,
+                                    ScalePortable,
+                                    DifferencePortable};
+
+#ifdef UXP_PIXEL_KERNELS_X86
+
+// @{ SSE2: 4 RGBA pixels or 16 values per step
+// The 16-bit products of 2 pixels by their multipliers, divided by 255
+inline __m128i Divide255(__m128i products) {
+    const __m128i rounded = _mm_add_epi16(products, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(rounded, _mm_srli_epi16(rounded, 8)), 8);
+}
+
+// The alpha of 2 pixels widened to 16 bits, in the lanes of their 4 components
+inline __m128i BroadcastAlpha(__m128i pixels) {
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+void PremultiplySse2(uint8_t* rgba, size_t pixels) {
+    const __m128i zero = _mm_setzero_si128();
+    // The alpha lanes are multiplied by 255, which leaves them unchanged
+    const __m128i colors = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+    const __m128i opaque = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+    size_t index = 0;
+    for (; index + 4 <= pixels; index += 4) {
+        const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + index * 4));
+        __m128i low = _mm_unpacklo_epi8(packed, zero);
+        __m128i high = _mm_unpackhi_epi8(packed, zero);
+        low = Divide255(_mm_mullo_epi16(low, _mm_or_si128(_mm_and_si128(BroadcastAlpha(low), colors), opaque)));
+        high = Divide255(_mm_mullo_epi16(high, _mm_or_si128(_mm_and_si128(BroadcastAlpha(high), colors), opaque)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + index * 4), _mm_packus_epi16(low, high));
+    }
+    PremultiplyPortable(rgba + index * 4, pixels - index);
+}
+
+// A pixel widened to 32 bits, divided by its alpha
+inline __m128i UnpremultiplyPixel(__m128i pixel) {
+    const __m128i alpha = _mm_shuffle_epi32(pixel, _MM_SHUFFLE(3, 3, 3, 3));
+    const __m128 divided = _mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(pixel), _mm_set1_ps(255.0f)), _mm_cvtepi32_ps(alpha));
+    __m128i result = _mm_cvttps_epi32(_mm_add_ps(divided, _mm_set1_ps(0.5f)));
+    result = _mm_andnot_si128(_mm_cmpeq_epi32(alpha, _mm_setzero_si128()), result);
+    const __m128i alphaLane = _mm_set_epi32(-1, 0, 0, 0);
+    return _mm_or_si128(_mm_andnot_si128(alphaLane, result), _mm_and_si128(alphaLane, pixel));
+}
+
+void UnpremultiplySse2(uint8_t* rgba, size_t pixels) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t index = 0;
+    for (; index + 4 <= pixels; index += 4) {
+        const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + index * 4));
+        const __m128i low = _mm_unpacklo_epi8(packed, zero);
+        const __m128i high = _mm_unpackhi_epi8(packed, zero);
+        const __m128i first = _mm_packs_epi32(UnpremultiplyPixel(_mm_unpacklo_epi16(low, zero)),
+                                              UnpremultiplyPixel(_mm_unpackhi_epi16(low, zero)));
+        const __m128i second = _mm_packs_epi32(UnpremultiplyPixel(_mm_unpacklo_epi16(high, zero)),
+                                               UnpremultiplyPixel(_mm_unpackhi_epi16(high, zero)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + index * 4), _mm_packus_epi16(first, second));
+    }
+    UnpremultiplyPortable(rgba + index * 4, pixels - index);
+}
+
+void OverSse2(uint8_t* rgba, const uint8_t* background, size_t pixels) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i opaque = _mm_set1_epi16(255);
+    size_t index = 0;
+    for (; index + 4 <= pixels; index += 4) {
+        const __m128i front = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + index * 4));
+        const __m128i back = _mm_loadu_si128(reinterpret_cast<const __m128i*>(background + index * 4));
+        const __m128i low = _mm_sub_epi16(opaque, BroadcastAlpha(_mm_unpacklo_epi8(front, zero)));
+        const __m128i high = _mm_sub_epi16(opaque, BroadcastAlpha(_mm_unpackhi_epi8(front, zero)));
+        const __m128i behind = _mm_packus_epi16(Divide255(_mm_mullo_epi16(_mm_unpacklo_epi8(back, zero), low)),
+                                                Divide255(_mm_mullo_epi16(_mm_unpackhi_epi8(back, zero), high)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + index * 4), _mm_adds_epu8(front, behind));
+    }
+    OverPortable(rgba + index * 4, background + index * 4, pixels - index);
+}
+
+void MultiplyAlphaSse2(uint8_t* rgba, const uint8_t* mask, size_t pixels) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphas = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    const __m128i colors = _mm_set_epi16(0, 255, 255, 255, 0, 255, 255, 255);
+    size_t index = 0;
+    for (; index + 4 <= pixels; index += 4) {
+        int32_t values;
+        std::memcpy(&values, mask + index, 4);
+        // Each mask value in the 4 lanes of its pixel
+        __m128i spread = _mm_unpacklo_epi8(_mm_cvtsi32_si128(values), zero);
+        spread = _mm_unpacklo_epi16(spread, spread);
+        const __m128i first = _mm_or_si128(_mm_and_si128(_mm_unpacklo_epi32(spread, spread), alphas), colors);
+        const __m128i second = _mm_or_si128(_mm_and_si128(_mm_unpackhi_epi32(spread, spread), alphas), colors);
+        const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + index * 4));
+        const __m128i low = Divide255(_mm_mullo_epi16(_mm_unpacklo_epi8(packed, zero), first));
+        const __m128i high = Divide255(_mm_mullo_epi16(_mm_unpackhi_epi8(packed, zero), second));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + index * 4), _mm_packus_epi16(low, high));
+    }
+    MultiplyAlphaPortable(rgba + index * 4, mask + index, pixels - index);
+}
+
+void ThresholdSse2(uint8_t* values, size_t count, uint8_t level) {
+    const __m128i levels = _mm_set1_epi8(static_cast<char>(level));
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16) {
+        const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + index));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values + index), _mm_cmpeq_epi8(_mm_max_epu8(value, levels), value));
+    }
+    ThresholdPortable(values + index, count - index, level);
+}
+
+void MaximumSse2(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t count) {
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16) {
+        const __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + index));
+        const __m128i right = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + index));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + index), _mm_max_epu8(left, right));
+    }
+    MaximumPortable(out + index, a + index, b + index, count - index);
+}
+
+void MinimumSse2(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t count) {
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16) {
+        const __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + index));
+        const __m128i right = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + index));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + index), _mm_min_epu8(left, right));
+    }
+    MinimumPortable(out + index, a + index, b + index, count - index);
+}
+
+void SubtractSse2(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t count) {
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16) {
+        const __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + index));
+        const __m128i right = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + index));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + index), _mm_sub_epi8(left, right));
+    }
+    SubtractPortable(out + index, a + index, b + index, count - index);
+}
+
+inline __m128i Absolute16(__m128i value) {
+    return _mm_max_epi16(value, _mm_sub_epi16(_mm_setzero_si128(), value));
+}
+
+inline __m128i Select(__m128i condition, __m128i yes, __m128i no) {
+    return _mm_or_si128(_mm_and_si128(condition, yes), _mm_andnot_si128(condition, no));
+}
+
+// The Paeth predictors of 8 values widened to 16 bits
+inline __m128i PaethSse2(__m128i a, __m128i b, __m128i c) {
+    const __m128i fromB = _mm_sub_epi16(b, c);
+    const __m128i fromA = _mm_sub_epi16(a, c);
+    const __m128i pa = Absolute16(fromB);
+    const __m128i pb = Absolute16(fromA);
+    const __m128i pc = Absolute16(_mm_add_epi16(fromA, fromB));
+    const __m128i useA = _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc)), _mm_set1_epi16(-1));
+    const __m128i useB = _mm_andnot_si128(_mm_cmpgt_epi16(pb, pc), _mm_set1_epi16(-1));
+    return Select(useA, a, Select(useB, b, c));
+}
+
+void PaethSse2(uint8_t* out, const uint8_t* row, const uint8_t* left, const uint8_t* up, const uint8_t* corner, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(left + index));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(up + index));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(corner + index));
+        const __m128i low = PaethSse2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+        const __m128i high = PaethSse2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+        const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + index));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + index), _mm_sub_epi8(value, _mm_packus_epi16(low, high)));
+    }
+    PaethPortable(out + index, row + index, left + index, up + index, corner + index, count - index);
+}
+
+uint64_t SumMagnitudesSse2(const uint8_t* values, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sums = zero;
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16) {
+        const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + index));
+        const __m128i magnitude = _mm_min_epu8(value, _mm_sub_epi8(zero, value));
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(magnitude, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sums);
+    return lanes[0] + lanes[1] + SumMagnitudesPortable(values + index, count - index);
+}
+
+void AccumulateSse2(uint16_t* sums, const uint8_t* add, const uint8_t* remove, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16) {
+        const __m128i added = _mm_loadu_si128(reinterpret_cast<const __m128i*>(add + index));
+        const __m128i removed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(remove + index));
+        auto* low = reinterpret_cast<__m128i*>(sums + index);
+        auto* high = reinterpret_cast<__m128i*>(sums + index + 8);
+        const __m128i lowDelta = _mm_sub_epi16(_mm_unpacklo_epi8(added, zero), _mm_unpacklo_epi8(removed, zero));
+        const __m128i highDelta = _mm_sub_epi16(_mm_unpackhi_epi8(added, zero), _mm_unpackhi_epi8(removed, zero));
+        _mm_storeu_si128(low, _mm_add_epi16(_mm_loadu_si128(low), lowDelta));
+        _mm_storeu_si128(high, _mm_add_epi16(_mm_loadu_si128(high), highDelta));
+    }
+    AccumulatePortable(sums + index, add + index, remove + index, count - index);
+}
+
+void ScaleSse2(uint8_t* out, const uint16_t* sums, uint16_t reciprocal, size_t count) {
+    const __m128i factor = _mm_set1_epi16(static_cast<short>(reciprocal));
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16) {
+        const __m128i low = _mm_mulhi_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + index)), factor);
+        const __m128i high = _mm_mulhi_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + index + 8)), factor);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + index), _mm_packus_epi16(low, high));
+    }
+    ScalePortable(out + index, sums + index, reciprocal, count - index);
+}
+// The largest difference between the components of 4 pixels, in the low byte of their lane
+inline __m128i PixelDifferenceSse2(const uint8_t* a, const uint8_t* b) {
+    const __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+    const __m128i right = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+    __m128i difference = _mm_or_si128(_mm_subs_epu8(left, right), _mm_subs_epu8(right, left));
+    difference = _mm_max_epu8(difference, _mm_srli_epi32(difference, 8));
+    difference = _mm_max_epu8(difference, _mm_srli_epi32(difference, 16));
+    return _mm_and_si128(difference, _mm_set1_epi32(0xff));
+}
+
+void DifferenceSse2(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t pixels) {
+    size_t index = 0;
+    for (; index + 16 <= pixels; index += 16) {
+        const __m128i first = _mm_packs_epi32(PixelDifferenceSse2(a + index * 4, b + index * 4),
+                                              PixelDifferenceSse2(a + index * 4 + 16, b + index * 4 + 16));
+        const __m128i second = _mm_packs_epi32(PixelDifferenceSse2(a + index * 4 + 32, b + index * 4 + 32),
+                                               PixelDifferenceSse2(a + index * 4 + 48, b + index * 4 + 48));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + index), _mm_packus_epi16(first, second));
+    }
+    DifferencePortable(out + index, a + index * 4, b + index * 4, pixels - index);
+}
+// @}
+
+constexpr PixelKernels kSse2 = {"sse2",
+                                PremultiplySse2,
+                                UnpremultiplySse2,
+                                OverSse2,
+                                MultiplyAlphaSse2,
+                                ThresholdSse2,
+                                MaximumSse2,
+                                MinimumSse2,
+                                SubtractSse2,
+                                PaethSse2,
+                                SumMagnitudesSse2,
+                                AccumulateSse2,
+                                ScaleSse2,
+                                DifferenceSse2};
+
+// @{ AVX2: 8 RGBA pixels or 32 values per step. Unpacking and packing work within each
+// 128-bit half, which keeps the pixels in place when they are done in pairs.
+UXP_AVX2 inline __m256i Divide255(__m256i products) {
+    const __m256i rounded = _mm256_add_epi16(products, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(rounded, _mm256_srli_epi16(rounded, 8)), 8);
+}
+
+UXP_AVX2 inline __m256i BroadcastAlpha(__m256i pixels) {
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+UXP_AVX2 void PremultiplyAvx2(uint8_t* rgba, size_t pixels) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i colors = _mm256_set_epi16(0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1);
+    const __m256i opaque = _mm256_set_epi16(255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0);
+    size_t index = 0;
+    for (; index + 8 <= pixels; index += 8) {
+        const __m256i packed = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rgba + index * 4));
+        __m256i low = _mm256_unpacklo_epi8(packed, zero);
+        __m256i high = _mm256_unpackhi_epi8(packed, zero);
+        low = Divide255(_mm256_mullo_epi16(low, _mm256_or_si256(_mm256_and_si256(BroadcastAlpha(low), colors), opaque)));
+        high = Divide255(_mm256_mullo_epi16(high, _mm256_or_si256(_mm256_and_si256(BroadcastAlpha(high), colors), opaque)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + index * 4), _mm256_packus_epi16(low, high));
+    }
+    PremultiplySse2(rgba + index * 4, pixels - index);
+}
+
+// 2 pixels widened to 32 bits, divided by their alpha
+UXP_AVX2 inline __m256i UnpremultiplyPixels(__m256i pixels) {
+    const __m256i alpha = _mm256_shuffle_epi32(pixels, _MM_SHUFFLE(3, 3, 3, 3));
+    const __m256 divided =
+        _mm256_div_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(pixels), _mm256_set1_ps(255.0f)), _mm256_cvtepi32_ps(alpha));
+    __m256i result = _mm256_cvttps_epi32(_mm256_add_ps(divided, _mm256_set1_ps(0.5f)));
+    result = _mm256_andnot_si256(_mm256_cmpeq_epi32(alpha, _mm256_setzero_si256()), result);
+    return _mm256_blend_epi32(result, pixels, 0x88);
+}
+
+UXP_AVX2 void UnpremultiplyAvx2(uint8_t* rgba, size_t pixels) {
+    size_t index = 0;
+    for (; index + 4 <= pixels; index += 4) {
+        const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + index * 4));
+        const __m256i first = UnpremultiplyPixels(_mm256_cvtepu8_epi32(packed));
+        const __m256i second = UnpremultiplyPixels(_mm256_cvtepu8_epi32(_mm_srli_si128(packed, 8)));
+        const __m128i low = _mm_packs_epi32(_mm256_castsi256_si128(first), _mm256_extracti128_si256(first, 1));
+        const __m128i high = _mm_packs_epi32(_mm256_castsi256_si128(second), _mm256_extracti128_si256(second, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + index * 4), _mm_packus_epi16(low, high));
+    }
+    UnpremultiplyPortable(rgba + index * 4, pixels - index);
+}
+
+UXP_AVX2 void OverAvx2(uint8_t* rgba, const uint8_t* background, size_t pixels) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i opaque = _mm256_set1_epi16(255);
+    size_t index = 0;
+    for (; index + 8 <= pixels; index += 8) {
+        const __m256i front = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rgba + index * 4));
+        const __m256i back = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(background + index * 4));
+        const __m256i low = _mm256_sub_epi16(opaque, BroadcastAlpha(_mm256_unpacklo_epi8(front, zero)));
+        const __m256i high = _mm256_sub_epi16(opaque, BroadcastAlpha(_mm256_unpackhi_epi8(front, zero)));
+        const __m256i behind = _mm256_packus_epi16(Divide255(_mm256_mullo_epi16(_mm256_unpacklo_epi8(back, zero), low)),
+                                                   Divide255(_mm256_mullo_epi16(_mm256_unpackhi_epi8(back, zero), high)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + index * 4), _mm256_adds_epu8(front, behind));
+    }
+    OverSse2(rgba + index * 4, background + index * 4, pixels - index);
+}
+
+UXP_AVX2 void MultiplyAlphaAvx2(uint8_t* rgba, const uint8_t* mask, size_t pixels) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alphas = _mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0);
+    const __m256i colors = _mm256_set_epi16(0, 255, 255, 255, 0, 255, 255, 255, 0, 255, 255, 255, 0, 255, 255, 255);
+    size_t index = 0;
+    for (; index + 8 <= pixels; index += 8) {
+        // Each mask value in the 4 lanes of its pixel: pixels 0, 1, 4, 5 in the low halves
+        // of the unpacked pixels, 2, 3, 6, 7 in the high halves
+        const __m128i values = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(mask + index)));
+        const __m128i first = _mm_unpacklo_epi16(values, values);
+        const __m128i second = _mm_unpackhi_epi16(values, values);
+        const __m256i lowSpread = _mm256_set_m128i(_mm_unpacklo_epi32(second, second), _mm_unpacklo_epi32(first, first));
+        const __m256i highSpread = _mm256_set_m128i(_mm_unpackhi_epi32(second, second), _mm_unpackhi_epi32(first, first));
+        const __m256i packed = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rgba + index * 4));
+        const __m256i low = Divide255(_mm256_mullo_epi16(_mm256_unpacklo_epi8(packed, zero),
+                                                         _mm256_or_si256(_mm256_and_si256(lowSpread, alphas), colors)));
+        const __m256i high = Divide255(_mm256_mullo_epi16(_mm256_unpackhi_epi8(packed, zero),
+                                                          _mm256_or_si256(_mm256_and_si256(highSpread, alphas), colors)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + index * 4), _mm256_packus_epi16(low, high));
+    }
+    MultiplyAlphaSse2(rgba + index * 4, mask + index, pixels - index);
+}
+
+UXP_AVX2 void ThresholdAvx2(uint8_t* values, size_t count, uint8_t level) {
+    const __m256i levels = _mm256_set1_epi8(static_cast<char>(level));
+    size_t index = 0;
+    for (; index + 32 <= count; index += 32) {
+        const __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + index));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(values + index), _mm256_cmpeq_epi8(_mm256_max_epu8(value, levels), value));
+    }
+    ThresholdSse2(values + index, count - index, level);
+}
+
+UXP_AVX2 void MaximumAvx2(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t count) {
+    size_t index = 0;
+    for (; index + 32 <= count; index += 32) {
+        const __m256i left = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + index));
+        const __m256i right = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + index));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + index), _mm256_max_epu8(left, right));
+    }
+    MaximumSse2(out + index, a + index, b + index, count - index);
+}
+
+UXP_AVX2 void MinimumAvx2(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t count) {
+    size_t index = 0;
+    for (; index + 32 <= count; index += 32) {
+        const __m256i left = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + index));
+        const __m256i right = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + index));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + index), _mm256_min_epu8(left, right));
+    }
+    MinimumSse2(out + index, a + index, b + index, count - index);
+}
+
+UXP_AVX2 void SubtractAvx2(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t count) {
+    size_t index = 0;
+    for (; index + 32 <= count; index += 32) {
+        const __m256i left = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + index));
+        const __m256i right = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + index));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + index), _mm256_sub_epi8(left, right));
+    }
+    SubtractSse2(out + index, a + index, b + index, count - index);
+}
+
+// The Paeth predictors of 16 values widened to 16 bits
+UXP_AVX2 inline __m256i PaethAvx2(__m256i a, __m256i b, __m256i c) {
+    const __m256i fromB = _mm256_sub_epi16(b, c);
+    const __m256i fromA = _mm256_sub_epi16(a, c);
+    const __m256i pa = _mm256_abs_epi16(fromB);
+    const __m256i pb = _mm256_abs_epi16(fromA);
+    const __m256i pc = _mm256_abs_epi16(_mm256_add_epi16(fromA, fromB));
+    const __m256i notA = _mm256_or_si256(_mm256_cmpgt_epi16(pa, pb), _mm256_cmpgt_epi16(pa, pc));
+    const __m256i notB = _mm256_cmpgt_epi16(pb, pc);
+    return _mm256_blendv_epi8(a, _mm256_blendv_epi8(b, c, notB), notA);
+}
+
+UXP_AVX2 void PaethAvx2(uint8_t* out, const uint8_t* row, const uint8_t* left, const uint8_t* up, const uint8_t* corner, size_t count) {
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16) {
+        const __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(left + index)));
+        const __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(up + index)));
+        const __m256i c = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(corner + index)));
+        const __m256i predictor = PaethAvx2(a, b, c);
+        const __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(predictor), _mm256_extracti128_si256(predictor, 1));
+        const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + index));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + index), _mm_sub_epi8(value, packed));
+    }
+    PaethPortable(out + index, row + index, left + index, up + index, corner + index, count - index);
+}
+
+UXP_AVX2 uint64_t SumMagnitudesAvx2(const uint8_t* values, size_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sums = zero;
+    size_t index = 0;
+    for (; index + 32 <= count; index += 32) {
+        const __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + index));
+        const __m256i magnitude = _mm256_min_epu8(value, _mm256_sub_epi8(zero, value));
+        sums = _mm256_add_epi64(sums, _mm256_sad_epu8(magnitude, zero));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), sums);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + SumMagnitudesSse2(values + index, count - index);
+}
+
+UXP_AVX2 void AccumulateAvx2(uint16_t* sums, const uint8_t* add, const uint8_t* remove, size_t count) {
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16) {
+        const __m256i added = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(add + index)));
+        const __m256i removed = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(remove + index)));
+        auto* target = reinterpret_cast<__m256i*>(sums + index);
+        _mm256_storeu_si256(target, _mm256_add_epi16(_mm256_loadu_si256(target), _mm256_sub_epi16(added, removed)));
+    }
+    AccumulatePortable(sums + index, add + index, remove + index, count - index);
+}
+
+UXP_AVX2 void ScaleAvx2(uint8_t* out, const uint16_t* sums, uint16_t reciprocal, size_t count) {
+    const __m256i factor = _mm256_set1_epi16(static_cast<short>(reciprocal));
+    size_t index = 0;
+    for (; index + 32 <= count; index += 32) {
+        const __m256i low = _mm256_mulhi_epu16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(sums + index)), factor);
+        const __m256i high = _mm256_mulhi_epu16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(sums + index + 16)), factor);
+        // packus interleaves the 128-bit halves of low and high, the permutation restores their order
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + index), packed);
+    }
+    ScaleSse2(out + index, sums + index, reciprocal, count - index);
+}
+UXP_AVX2 inline __m256i PixelDifferenceAvx2(const uint8_t* a, const uint8_t* b) {
+    const __m256i left = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+    const __m256i right = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+    __m256i difference = _mm256_or_si256(_mm256_subs_epu8(left, right), _mm256_subs_epu8(right, left));
+    difference = _mm256_max_epu8(difference, _mm256_srli_epi32(difference, 8));
+    difference = _mm256_max_epu8(difference, _mm256_srli_epi32(difference, 16));
+    return _mm256_and_si256(difference, _mm256_set1_epi32(0xff));
+}
+
+UXP_AVX2 void DifferenceAvx2(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t pixels) {
+    // Packing leaves the groups of 4 pixels in the order of the 128-bit halves they came from
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t index = 0;
+    for (; index + 32 <= pixels; index += 32) {
+        const __m256i first = _mm256_packs_epi32(PixelDifferenceAvx2(a + index * 4, b + index * 4),
+                                                 PixelDifferenceAvx2(a + index * 4 + 32, b + index * 4 + 32));
+        const __m256i second = _mm256_packs_epi32(PixelDifferenceAvx2(a + index * 4 + 64, b + index * 4 + 64),
+                                                  PixelDifferenceAvx2(a + index * 4 + 96, b + index * 4 + 96));
+        const __m256i packed = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(first, second), order);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + index), packed);
+    }
+    DifferenceSse2(out + index, a + index * 4, b + index * 4, pixels - index);
+}
+// @}
+
+constexpr PixelKernels kAvx2 = {"avx2",
+                                PremultiplyAvx2,
+                                UnpremultiplyAvx2,
+                                OverAvx2,
+                                MultiplyAlphaAvx2,
+                                ThresholdAvx2,
+                                MaximumAvx2,
+                                MinimumAvx2,
+                                SubtractAvx2,
+                                PaethAvx2,
+                                SumMagnitudesAvx2,
+                                AccumulateAvx2,
+                                ScaleAvx2,
+                                DifferenceAvx2};
+
+bool HasAvx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    // AVX state saved by the OS (OSXSAVE, XCR0)
+    if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif  // UXP_PIXEL_KERNELS_X86
+
+#ifdef UXP_PIXEL_KERNELS_NEON
+
+// @{ NEON: 16 RGBA pixels (deinterleaved by vld4q) or 16 values per step
+// round(products / 255) narrowed to 8 bits: (p + ((p + 128) >> 8) + 128) >> 8
+inline uint8x8_t Divide255(uint16x8_t products) {
+    return vraddhn_u16(products, vrshrq_n_u16(products, 8));
+}
+
+inline uint8x16_t Multiply(uint8x16_t a, uint8x16_t b) {
+    return vcombine_u8(Divide255(vmull_u8(vget_low_u8(a), vget_low_u8(b))), Divide255(vmull_high_u8(a, b)));
+}
+
+void PremultiplyNeon(uint8_t* rgba, size_t pixels) {
+    size_t index = 0;
+    for (; index + 16 <= pixels; index += 16) {
+        uint8x16x4_t packed = vld4q_u8(rgba + index * 4);
+        packed.val[0] = Multiply(packed.val[0], packed.val[3]);
+        packed.val[1] = Multiply(packed.val[1], packed.val[3]);
+        packed.val[2] = Multiply(packed.val[2], packed.val[3]);
+        vst4q_u8(rgba + index * 4, packed);
+    }
+    PremultiplyPortable(rgba + index * 4, pixels - index);
+}
+
+void OverNeon(uint8_t* rgba, const uint8_t* background, size_t pixels) {
+    size_t index = 0;
+    for (; index + 16 <= pixels; index += 16) {
+        uint8x16x4_t front = vld4q_u8(rgba + index * 4);
+        const uint8x16x4_t back = vld4q_u8(background + index * 4);
+        const uint8x16_t transparency = vmvnq_u8(front.val[3]);
+        for (int channel = 0; channel < 4; ++channel)
+            front.val[channel] = vqaddq_u8(front.val[channel], Multiply(back.val[channel], transparency));
+        vst4q_u8(rgba + index * 4, front);
+    }
+    OverPortable(rgba + index * 4, background + index * 4, pixels - index);
+}
+
+void MultiplyAlphaNeon(uint8_t* rgba, const uint8_t* mask, size_t pixels) {
+    size_t index = 0;
+    for (; index + 16 <= pixels; index += 16) {
+        uint8x16x4_t packed = vld4q_u8(rgba + index * 4);
+        packed.val[3] = Multiply(packed.val[3], vld1q_u8(mask + index));
+        vst4q_u8(rgba + index * 4, packed);
+    }
+    MultiplyAlphaPortable(rgba + index * 4, mask + index, pixels - index);
+}
+
+void ThresholdNeon(uint8_t* values, size_t count, uint8_t level) {
+    const uint8x16_t levels = vdupq_n_u8(level);
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16)
+        vst1q_u8(values + index, vcgeq_u8(vld1q_u8(values + index), levels));
+    ThresholdPortable(values + index, count - index, level);
+}
+
+void MaximumNeon(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t count) {
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16)
+        vst1q_u8(out + index, vmaxq_u8(vld1q_u8(a + index), vld1q_u8(b + index)));
+    MaximumPortable(out + index, a + index, b + index, count - index);
+}
+
+void MinimumNeon(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t count) {
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16)
+        vst1q_u8(out + index, vminq_u8(vld1q_u8(a + index), vld1q_u8(b + index)));
+    MinimumPortable(out + index, a + index, b + index, count - index);
+}
+
+void SubtractNeon(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t count) {
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16)
+        vst1q_u8(out + index, vsubq_u8(vld1q_u8(a + index), vld1q_u8(b + index)));
+    SubtractPortable(out + index, a + index, b + index, count - index);
+}
+
+// The Paeth predictors of 8 values widened to 16 bits
+inline uint16x8_t PaethNeon(uint16x8_t a, uint16x8_t b, uint16x8_t c) {
+    const uint16x8_t pa = vabdq_u16(b, c);
+    const uint16x8_t pb = vabdq_u16(a, c);
+    const uint16x8_t pc = vreinterpretq_u16_s16(
+        vabsq_s16(vsubq_s16(vreinterpretq_s16_u16(vaddq_u16(a, b)), vreinterpretq_s16_u16(vaddq_u16(c, c)))));
+    const uint16x8_t useA = vandq_u16(vcleq_u16(pa, pb), vcleq_u16(pa, pc));
+    const uint16x8_t useB = vcleq_u16(pb, pc);
+    return vbslq_u16(useA, a, vbslq_u16(useB, b, c));
+}
+
+void PaethNeon(uint8_t* out, const uint8_t* row, const uint8_t* left, const uint8_t* up, const uint8_t* corner, size_t count) {
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16) {
+        const uint8x16_t a = vld1q_u8(left + index);
+        const uint8x16_t b = vld1q_u8(up + index);
+        const uint8x16_t c = vld1q_u8(corner + index);
+        const uint16x8_t low = PaethNeon(vmovl_u8(vget_low_u8(a)), vmovl_u8(vget_low_u8(b)), vmovl_u8(vget_low_u8(c)));
+        const uint16x8_t high = PaethNeon(vmovl_high_u8(a), vmovl_high_u8(b), vmovl_high_u8(c));
+        const uint8x16_t predictor = vcombine_u8(vmovn_u16(low), vmovn_u16(high));
+        vst1q_u8(out + index, vsubq_u8(vld1q_u8(row + index), predictor));
+    }
+    PaethPortable(out + index, row + index, left + index, up + index, corner + index, count - index);
+}
+
+uint64_t SumMagnitudesNeon(const uint8_t* values, size_t count) {
+    uint64_t sum = 0;
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16) {
+        const uint8x16_t value = vld1q_u8(values + index);
+        sum += vaddlvq_u8(vminq_u8(value, vsubq_u8(vdupq_n_u8(0), value)));
+    }
+    return sum + SumMagnitudesPortable(values + index, count - index);
+}
+
+void AccumulateNeon(uint16_t* sums, const uint8_t* add, const uint8_t* remove, size_t count) {
+    size_t index = 0;
+    for (; index + 16 <= count; index += 16) {
+        const uint8x16_t added = vld1q_u8(add + index);
+        const uint8x16_t removed = vld1q_u8(remove + index);
+        vst1q_u16(sums + index, vaddq_u16(vld1q_u16(sums + index), vsubl_u8(vget_low_u8(added), vget_low_u8(removed))));
+        vst1q_u16(sums + index + 8, vaddq_u16(vld1q_u16(sums + index + 8), vsubl_high_u8(added, removed)));
+    }
+    AccumulatePortable(sums + index, add + index, remove + index, count - index);
+}
+
+void ScaleNeon(uint8_t* out, const uint16_t* sums, uint16_t reciprocal, size_t count) {
+    size_t index = 0;
+    for (; index + 8 <= count; index += 8) {
+        const uint16x8_t value = vld1q_u16(sums + index);
+        const uint16x4_t low = vshrn_n_u32(vmull_n_u16(vget_low_u16(value), reciprocal), 16);
+        const uint16x4_t high = vshrn_n_u32(vmull_high_n_u16(value, reciprocal), 16);
+        vst1_u8(out + index, vmovn_u16(vcombine_u16(low, high)));
+    }
+    ScalePortable(out + index, sums + index, reciprocal, count - index);
+}
+void DifferenceNeon(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t pixels) {
+    size_t index = 0;
+    for (; index + 16 <= pixels; index += 16) {
+        const uint8x16x4_t left = vld4q_u8(a + index * 4);
+        const uint8x16x4_t right = vld4q_u8(b + index * 4);
+        uint8x16_t largest = vabdq_u8(left.val[0], right.val[0]);
+        for (int channel = 1; channel < 4; ++channel)
+            largest = vmaxq_u8(largest, vabdq_u8(left.val[channel], right.val[channel]));
+        vst1q_u8(out + index, largest);
+    }
+    DifferencePortable(out + index, a + index * 4, b + index * 4, pixels - index);
+}
+// @}
+
+// Unpremultiplying divides in floating point, which the compiler vectorizes as well
+constexpr PixelKernels kNeon = {"neon",
+                                PremultiplyNeon,
+                                UnpremultiplyPortable,
+                                OverNeon,
+                                MultiplyAlphaNeon,
+                                ThresholdNeon,
+                                MaximumNeon,
+                                MinimumNeon,
+                                SubtractNeon,
+                                PaethNeon,
+                                SumMagnitudesNeon,
+                                AccumulateNeon,
+                                ScaleNeon,
+                                DifferenceNeon};
+
+#endif  // UXP_PIXEL_KERNELS_NEON
+
+const PixelKernels& SelectPixelKernels() {
+    const char* name = std::getenv("UXP_ADDON_PIXEL_KERNELS");
+    if (name != nullptr) {
+        const PixelKernels* kernels = FindPixelKernels(name);
+        if (kernels != nullptr)
+            return *kernels;
+    }
+#if defined(UXP_PIXEL_KERNELS_X86)
+    return HasAvx2() ? kAvx2 : kSse2;
+#elif defined(UXP_PIXEL_KERNELS_NEON)
+    return kNeon;
+#else
+    return kPortable;
+#endif
+}
+
+}  // namespace
+
+const PixelKernels& GetPixelKernels() {
+    static const PixelKernels& kernels = SelectPixelKernels();
+    return kernels;
+}
+
+const PixelKernels* FindPixelKernels(const char* name) {
+    if (std::strcmp(name, kPortable.name) == 0)
+        return &kPortable;
+#if defined(UXP_PIXEL_KERNELS_X86)
+    if (std::strcmp(name, kSse2.name) == 0)
+        return &kSse2;
+    if (std::strcmp(name, kAvx2.name) == 0 && HasAvx2())
+        return &kAvx2;
+#elif defined(UXP_PIXEL_KERNELS_NEON)
+    if (std::strcmp(name, kNeon.name) == 0)
+        return &kNeon;
+#endif
+    return nullptr;
+}
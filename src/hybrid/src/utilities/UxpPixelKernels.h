@@ -0,0 +1,66 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/** Kernels over rows of 8-bit pixels, for masks, compositing, differences and PNG encoding.
+
+ They are vectorized with SSE2 or AVX2 on x86 (AVX2 when the CPU has it) and with NEON on
+ ARM, and written portably for other CPUs. Every set gives the same results to the bit, so
+ that masks and composites don't depend on the machine. RGBA pixels are 4 bytes in that
+ order; premultiplied pixels have their color components multiplied by alpha / 255,
+ rounded.
+ Setting UXP_ADDON_PIXEL_KERNELS=portable (or sse2) in the environment selects that set
+ instead, to compare them.
+*/
+
+struct PixelKernels {
+    // "avx2", "sse2", "neon" or "portable"
+    const char* name;
+
+    // Multiply the color of rgba pixels by their alpha
+    void (*premultiply)(uint8_t* rgba, size_t pixels);
+    // Divide the color of premultiplied rgba pixels by their alpha; transparent pixels
+    // become 0
+    void (*unpremultiply)(uint8_t* rgba, size_t pixels);
+    // rgba = rgba over background, both premultiplied
+    void (*over)(uint8_t* rgba, const uint8_t* background, size_t pixels);
+    // Multiply the alpha of rgba pixels by a mask value per pixel
+    void (*multiplyAlpha)(uint8_t* rgba, const uint8_t* mask, size_t pixels);
+
+    // values = 255 where they are at least level, 0 elsewhere
+    void (*threshold)(uint8_t* values, size_t count, uint8_t level);
+    // out = max(a, b) or min(a, b); out may be a or b
+    void (*maximum)(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t count);
+    void (*minimum)(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t count);
+    // out = a - b, modulo 256 (PNG filters Sub and Up)
+    void (*subtract)(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t count);
+    // out = row - the Paeth predictor of left, up and corner (PNG filter Paeth)
+    void (*paeth)(uint8_t* out, const uint8_t* row, const uint8_t* left, const uint8_t* up, const uint8_t* corner, size_t count);
+    // Sum of the magnitudes of values read as signed bytes
+    uint64_t (*sumMagnitudes)(const uint8_t* values, size_t count);
+
+    // sums += add - remove, the running sums of a box filter
+    void (*accumulate)(uint16_t* sums, const uint8_t* add, const uint8_t* remove, size_t count);
+    // out = (sums * reciprocal) >> 16, which must be at most 255
+    void (*scale)(uint8_t* out, const uint16_t* sums, uint16_t reciprocal, size_t count);
+
+    // out = the largest difference between the components of each pair of rgba pixels
+    void (*difference)(uint8_t* out, const uint8_t* a, const uint8_t* b, size_t pixels);
+};
+
+// The fastest set of kernels of the CPU, or the one selected by UXP_ADDON_PIXEL_KERNELS
+const PixelKernels& GetPixelKernels();
+
+// The named set of kernels, or nullptr if the CPU can't run it
+const PixelKernels* FindPixelKernels(const char* name);
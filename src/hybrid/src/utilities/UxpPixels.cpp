@@ -0,0 +1,1965 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpPixels.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <queue>
+
+#include "UxpAddon.h"
+#include "UxpFiles.h"
+#include "UxpMetrics.h"
+#include "UxpPixelKernels.h"
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+
+// Larger images are rejected rather than allocated, as their header may be corrupt
+constexpr uint64_t kMaxPixels = uint64_t(1) << 28;
+
+uint32_t BigEndian16(const uint8_t* p) {
+    return (uint32_t(p[0]) << 8) | p[1];
+}
+
+uint32_t BigEndian32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+uint8_t Clamp(int value) {
+    return static_cast<uint8_t>(std::clamp(value, 0, 255));
+}
+
+bool Allocate(Bitmap& bitmap, uint32_t width, uint32_t height) {
+    if (width == 0 || height == 0 || uint64_t(width) * height > kMaxPixels)
+        return false;
+    bitmap.width = width;
+    bitmap.height = height;
+    bitmap.pixels.assign(size_t(width) * height * 4, 255);
+    return true;
+}
+
+// Deflate length and distance codes (RFC 1951, 3.2.5)
+constexpr uint16_t kLengthBase[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                      31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr uint8_t kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                      2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr uint16_t kDistanceBase[30] = {1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+                                        33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+                                        1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+constexpr uint8_t kDistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                        6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+/** Decompression of zlib streams (RFC 1950, 1951), for the IDAT chunks of PNG files */
+class Inflater {
+ public:
+    Inflater(const uint8_t* data, size_t size) : mData(data), mSize(size) {}
+
+    // Decompress the stream into out, failing past size bytes or if the stream is corrupt.
+    // Returns the number of bytes written in written.
+    bool Inflate(uint8_t* out, size_t size, size_t& written) {
+        mOut = out;
+        mLimit = size;
+        mWritten = 0;
+        // Deflate without a preset dictionary
+        if (mSize < 2 || (mData[0] & 0x0f) != 8 || ((mData[0] << 8) | mData[1]) % 31 != 0 || (mData[1] & 0x20) != 0)
+            return false;
+        mPosition = 2;
+
+        uint32_t last = 0;
+        while (last == 0) {
+            uint32_t type = 0;
+            if (!Take(1, last) || !Take(2, type))
+                return false;
+            if (type == 0) {
+                if (!Stored())
+                    return false;
+                continue;
+            }
+
+            Huffman literals;
+            Huffman distances;
+            if (type == 1) {
+                FixedTables(literals, distances);
+            } else if (type != 2 || !DynamicTables(literals, distances)) {
+                return false;
+            }
+            if (!Codes(literals, distances))
+                return false;
+        }
+        written = mWritten;
+        return true;
+    }
+
+ private:
+    static constexpr unsigned kFastBits = 10;
+
+    struct Huffman {
+        // By the next kFastBits bits: symbol << 4 | length, 0 for longer codes
+        std::array<uint16_t, 1 << kFastBits> fast{};
+        // Number of codes of each length, and the symbols ordered by code
+        std::array<uint16_t, 16> counts{};
+        std::array<uint16_t, 320> symbols{};
+    };
+
+    void Refill() {
+        while (mCount <= 56 && mPosition < mSize) {
+            mBits |= uint64_t(mData[mPosition++]) << mCount;
+            mCount += 8;
+        }
+    }
+
+    bool Take(unsigned count, uint32_t& value) {
+        Refill();
+        if (mCount < count)
+            return false;
+        value = static_cast<uint32_t>(mBits & ((uint64_t(1) << count) - 1));
+        mBits >>= count;
+        mCount -= count;
+        return true;
+    }
+
+    static bool Build(Huffman& table, const uint8_t* lengths, unsigned count) {
+        for (unsigned symbol = 0; symbol < count; ++symbol)
+            ++table.counts[lengths[symbol]];
+        table.counts[0] = 0;
+
+        // Over-subscribed codes are invalid; incomplete ones are allowed (a single distance)
+        int left = 1;
+        for (unsigned length = 1; length < 16; ++length) {
+            left = (left << 1) - table.counts[length];
+            if (left < 0)
+                return false;
+        }
+
+        std::array<uint16_t, 16> offsets{};
+        for (unsigned length = 1; length < 15; ++length)
+            offsets[length + 1] = offsets[length] + table.counts[length];
+        std::array<uint32_t, 16> codes{};
+        uint32_t code = 0;
+        for (unsigned length = 1; length < 16; ++length) {
+            code = (code + table.counts[length - 1]) << 1;
+            codes[length] = code;
+        }
+        for (unsigned symbol = 0; symbol < count; ++symbol) {
+            const unsigned length = lengths[symbol];
+            if (length == 0)
+                continue;
+            table.symbols[offsets[length]++] = static_cast<uint16_t>(symbol);
+            const uint32_t value = codes[length]++;
+            if (length > kFastBits)
+                continue;
+
+            // The stream holds the codes from their most significant bit
+            uint32_t reversed = 0;
+            for (unsigned bit = 0; bit < length; ++bit)
+                reversed |= ((value >> bit) & 1) << (length - 1 - bit);
+            for (uint32_t index = reversed; index < table.fast.size(); index += 1u << length)
+                table.fast[index] = static_cast<uint16_t>(symbol << 4 | length);
+        }
+        return true;
+    }
+
+    int Decode(const Huffman& table) {
+        Refill();
+        const uint16_t entry = table.fast[mBits & ((1u << kFastBits) - 1)];
+        if (entry != 0) {
+            const unsigned length = entry & 15;
+            if (length > mCount)
+                return -1;
+            mBits >>= length;
+            mCount -= length;
+            return entry >> 4;
+        }
+
+        // Canonical decoding, one bit at a time
+        int code = 0;
+        int first = 0;
+        int index = 0;
+        for (unsigned length = 1; length < 16 && length <= mCount; ++length) {
+            code |= static_cast<int>((mBits >> (length - 1)) & 1);
+            const int count = table.counts[length];
+            if (code - count < first) {
+                mBits >>= length;
+                mCount -= length;
+                return table.symbols[index + (code - first)];
+            }
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+
+    bool Stored() {
+        // Aligned on a byte
+        uint32_t ignored = 0;
+        uint32_t length = 0;
+        uint32_t complement = 0;
+        if (!Take(mCount & 7, ignored) || !Take(16, length) || !Take(16, complement) || (length ^ 0xffff) != complement ||
+            length > mLimit - mWritten)
+            return false;
+        for (uint32_t byte = 0; byte < length; ++byte) {
+            uint32_t value = 0;
+            if (!Take(8, value))
+                return false;
+            mOut[mWritten++] = static_cast<uint8_t>(value);
+        }
+        return true;
+    }
+
+    static void FixedTables(Huffman& literals, Huffman& distances) {
+        uint8_t lengths[288];
+        std::fill(lengths, lengths + 144, 8);
+        std::fill(lengths + 144, lengths + 256, 9);
+        std::fill(lengths + 256, lengths + 280, 7);
+        std::fill(lengths + 280, lengths + 288, 8);
+        Build(literals, lengths, 288);
+        std::fill(lengths, lengths + 30, 5);
+        Build(distances, lengths, 30);
+    }
+
+    bool DynamicTables(Huffman& literals, Huffman& distances) {
+        static constexpr uint8_t kOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+        uint32_t literalCount = 0;
+        uint32_t distanceCount = 0;
+        uint32_t lengthCount = 0;
+        if (!Take(5, literalCount) || !Take(5, distanceCount) || !Take(4, lengthCount))
+            return false;
+        literalCount += 257;
+        distanceCount += 1;
+        lengthCount += 4;
+        if (literalCount > 286 || distanceCount > 30)
+            return false;
+
+        uint8_t lengths[320] = {};
+        for (uint32_t index = 0; index < lengthCount; ++index) {
+            uint32_t length = 0;
+            if (!Take(3, length))
+                return false;
+            lengths[kOrder[index]] = static_cast<uint8_t>(length);
+        }
+        Huffman lengthTable;
+        if (!Build(lengthTable, lengths, 19))
+            return false;
+
+        // Literal and distance lengths form one sequence, repeats may cross from one to the other
+        std::memset(lengths, 0, sizeof(lengths));
+        for (uint32_t index = 0; index < literalCount + distanceCount;) {
+            const int symbol = Decode(lengthTable);
+            if (symbol < 0)
+                return false;
+            if (symbol < 16) {
+                lengths[index++] = static_cast<uint8_t>(symbol);
+                continue;
+            }
+            uint32_t repeat = 0;
+            uint8_t value = 0;
+            if (symbol == 16) {
+                if (index == 0 || !Take(2, repeat))
+                    return false;
+                value = lengths[index - 1];
+                repeat += 3;
+            } else if (symbol == 17) {
+                if (!Take(3, repeat))
+                    return false;
+                repeat += 3;
+            } else {
+                if (!Take(7, repeat))
+                    return false;
+                repeat += 11;
+            }
+            if (index + repeat > literalCount + distanceCount)
+                return false;
+            std::fill(lengths + index, lengths + index + repeat, value);
+            index += repeat;
+        }
+        return lengths[256] != 0 && Build(literals, lengths, literalCount) &&
+               Build(distances, lengths + literalCount, distanceCount);
+    }
+
+    bool Codes(const Huffman& literals, const Huffman& distances) {
+        for (;;) {
+            int symbol = Decode(literals);
+            if (symbol < 0)
+                return false;
+            if (symbol < 256) {
+                if (mWritten == mLimit)
+                    return false;
+                mOut[mWritten++] = static_cast<uint8_t>(symbol);
+                continue;
+            }
+            if (symbol == 256)
+                return true;
+
+            symbol -= 257;
+            uint32_t length = 0;
+            uint32_t distance = 0;
+            if (symbol >= 29 || !Take(kLengthExtra[symbol], length))
+                return false;
+            length += kLengthBase[symbol];
+            symbol = Decode(distances);
+            if (symbol < 0 || symbol >= 30 || !Take(kDistanceExtra[symbol], distance))
+                return false;
+            distance += kDistanceBase[symbol];
+            if (distance > mWritten || length > mLimit - mWritten)
+                return false;
+
+            // Copies may overlap what they write
+            const uint8_t* from = mOut + mWritten - distance;
+            uint8_t* to = mOut + mWritten;
+            for (uint32_t index = 0; index < length; ++index)
+                to[index] = from[index];
+            mWritten += length;
+        }
+    }
+
+    const uint8_t* mData;
+    size_t mSize;
+    size_t mPosition{0};
+    uint64_t mBits{0};
+    unsigned mCount{0};
+    uint8_t* mOut{nullptr};
+    size_t mLimit{0};
+    size_t mWritten{0};
+};
+
+/** Compression of zlib streams (RFC 1950, 1951), for the IDAT chunks of PNG files:
+ greedy LZ77 matches found through hash chains, coded with a dynamic Huffman code per
+ block of symbols.
+*/
+class Deflater {
+ public:
+    std::string Deflate(const uint8_t* data, size_t size) {
+        mOut.clear();
+        mBits = 0;
+        mCount = 0;
+        mOut.push_back(0x78);
+        mOut.push_back(0x01);
+
+        std::vector<int32_t> heads(kHashSize, -1);
+        std::vector<int32_t> previous(kWindow, -1);
+        const auto hash = [data](size_t position) {
+            uint32_t value;
+            std::memcpy(&value, data + position, 4);
+            return (value * 2654435761u) >> (32 - kHashBits);
+        };
+        const auto insert = [&](size_t position) {
+            const uint32_t key = hash(position);
+            previous[position & (kWindow - 1)] = heads[key];
+            heads[key] = static_cast<int32_t>(position);
+        };
+
+        for (size_t position = 0; position < size;) {
+            size_t length = 0;
+            size_t distance = 0;
+            if (position + 4 <= size) {
+                const size_t limit = std::min<size_t>(kMaxMatch, size - position);
+                int32_t candidate = heads[hash(position)];
+                for (int depth = 0; depth < kMaxChain && candidate >= 0; ++depth) {
+                    const size_t offset = position - candidate;
+                    if (offset > kWindow - 1)
+                        break;
+                    const size_t matched = MatchLength(data + candidate, data + position, limit);
+                    if (matched > length) {
+                        length = matched;
+                        distance = offset;
+                        if (matched >= std::min(kGoodMatch, limit))
+                            break;
+                    }
+                    candidate = previous[candidate & (kWindow - 1)];
+                }
+                insert(position);
+            }
+
+            if (length >= 4) {
+                AddMatch(length, distance);
+                // The positions inside long matches aren't worth indexing
+                const size_t end = position + length;
+                if (length <= 32) {
+                    for (++position; position < end && position + 4 <= size; ++position)
+                        insert(position);
+                }
+                position = end;
+            } else {
+                AddLiteral(data[position++]);
+            }
+            if (mSymbols.size() >= kBlockSymbols)
+                FlushBlock(false);
+        }
+        FlushBlock(true);
+        if (mCount > 0)
+            mOut.push_back(static_cast<char>(mBits & 0xff));
+
+        uint32_t a = 1;
+        uint32_t b = 0;
+        for (size_t offset = 0; offset < size;) {
+            const size_t end = std::min(size, offset + 5552);
+            for (; offset < end; ++offset) {
+                a += data[offset];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        const uint32_t adler = (b << 16) | a;
+        for (int shift = 24; shift >= 0; shift -= 8)
+            mOut.push_back(static_cast<char>((adler >> shift) & 0xff));
+        return std::move(mOut);
+    }
+
+ private:
+    static constexpr unsigned kHashBits = 15;
+    static constexpr size_t kHashSize = size_t(1) << kHashBits;
+    static constexpr size_t kWindow = 32768;
+    static constexpr size_t kMaxMatch = 258;
+    static constexpr int kMaxChain = 8;
+    // A match this long ends the search
+    static constexpr size_t kGoodMatch = 64;
+    static constexpr size_t kBlockSymbols = 1 << 16;
+
+    // A literal, or a match of length (bits 0-8) at distance (bits 9-24)
+    struct Symbol {
+        uint32_t value;
+    };
+
+    static size_t MatchLength(const uint8_t* first, const uint8_t* second, size_t limit) {
+        size_t matched = 0;
+        for (; matched + 8 <= limit; matched += 8) {
+            uint64_t left;
+            uint64_t right;
+            std::memcpy(&left, first + matched, 8);
+            std::memcpy(&right, second + matched, 8);
+            if (left != right) {
+                if constexpr (std::endian::native == std::endian::little)
+                    return matched + std::countr_zero(left ^ right) / 8;
+                else
+                    return matched + std::countl_zero(left ^ right) / 8;
+            }
+        }
+        while (matched < limit && first[matched] == second[matched])
+            ++matched;
+        return matched;
+    }
+
+    static unsigned LengthCode(size_t length) {
+        static const auto kCodes = [] {
+            std::array<uint16_t, 259> codes{};
+            for (unsigned code = 0; code < 29; ++code) {
+                for (unsigned length = kLengthBase[code]; length < kLengthBase[code] + (1u << kLengthExtra[code]) && length <= 258; ++length)
+                    codes[length] = static_cast<uint16_t>(code);
+            }
+            codes[258] = 28;
+            return codes;
+        }();
+        return kCodes[length];
+    }
+
+    static unsigned DistanceCode(size_t distance) {
+        unsigned code = 0;
+        while (code < 29 && kDistanceBase[code + 1] <= distance)
+            ++code;
+        return code;
+    }
+
+    void AddLiteral(uint8_t value) { mSymbols.push_back({value}); }
+
+    void AddMatch(size_t length, size_t distance) {
+        mSymbols.push_back({static_cast<uint32_t>(length | (distance << 9))});
+    }
+
+    void Write(uint32_t value, unsigned count) {
+        mBits |= uint64_t(value) << mCount;
+        mCount += count;
+        while (mCount >= 8) {
+            mOut.push_back(static_cast<char>(mBits & 0xff));
+            mBits >>= 8;
+            mCount -= 8;
+        }
+    }
+
+    // Code lengths of a Huffman code for frequencies, of at most limit bits. At least two
+    // symbols get a code, as some inflaters reject codes of a single symbol.
+    static std::vector<uint8_t> GetLengths(std::vector<uint32_t> frequencies, unsigned limit) {
+        size_t used = 0;
+        for (const uint32_t frequency : frequencies)
+            used += frequency > 0 ? 1 : 0;
+        for (size_t index = 0; used < 2; ++index) {
+            if (frequencies[index] == 0) {
+                frequencies[index] = 1;
+                ++used;
+            }
+        }
+
+        const size_t count = frequencies.size();
+        std::vector<uint8_t> lengths(count, 0);
+        for (;;) {
+            // Leaves, then the internal nodes joined from the two least frequent nodes
+            using Node = std::pair<uint64_t, size_t>;
+            std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+            std::vector<size_t> parents(count, 0);
+            for (size_t index = 0; index < count; ++index) {
+                if (frequencies[index] > 0)
+                    queue.push({frequencies[index], index});
+            }
+            while (queue.size() > 1) {
+                const Node first = queue.top();
+                queue.pop();
+                const Node second = queue.top();
+                queue.pop();
+                parents[first.second] = parents[second.second] = parents.size();
+                parents.push_back(0);
+                queue.push({first.first + second.first, parents.size() - 1});
+            }
+            const size_t root = queue.top().second;
+
+            unsigned longest = 0;
+            for (size_t index = 0; index < count; ++index) {
+                if (frequencies[index] == 0)
+                    continue;
+                unsigned depth = 0;
+                for (size_t node = index; node != root; node = parents[node])
+                    ++depth;
+                lengths[index] = static_cast<uint8_t>(depth);
+                longest = std::max(longest, depth);
+            }
+            if (longest <= limit)
+                return lengths;
+
+            // Flatten the distribution until the code fits
+            for (auto& frequency : frequencies) {
+                if (frequency > 0)
+                    frequency = (frequency + 1) / 2;
+            }
+        }
+    }
+
+    // Canonical codes of lengths, bit-reversed as deflate writes them from their first bit
+    static std::vector<uint16_t> GetCodes(const std::vector<uint8_t>& lengths) {
+        unsigned counts[16] = {};
+        for (const uint8_t length : lengths)
+            ++counts[length];
+        counts[0] = 0;
+        unsigned next[16] = {};
+        for (unsigned bits = 1, code = 0; bits < 16; ++bits) {
+            code = (code + counts[bits - 1]) << 1;
+            next[bits] = code;
+        }
+        std::vector<uint16_t> codes(lengths.size(), 0);
+        for (size_t index = 0; index < lengths.size(); ++index) {
+            const unsigned length = lengths[index];
+            if (length == 0)
+                continue;
+            unsigned code = next[length]++;
+            unsigned reversed = 0;
+            for (unsigned bit = 0; bit < length; ++bit, code >>= 1)
+                reversed = (reversed << 1) | (code & 1);
+            codes[index] = static_cast<uint16_t>(reversed);
+        }
+        return codes;
+    }
+
+    void FlushBlock(bool last) {
+        std::vector<uint32_t> literals(286, 0);
+        std::vector<uint32_t> distances(30, 0);
+        for (const Symbol symbol : mSymbols) {
+            if (symbol.value < 256) {
+                ++literals[symbol.value];
+            } else {
+                ++literals[257 + LengthCode(symbol.value & 0x1ff)];
+                ++distances[DistanceCode(symbol.value >> 9)];
+            }
+        }
+        literals[256] = 1;
+
+        const auto literalLengths = GetLengths(literals, 15);
+        const auto distanceLengths = GetLengths(distances, 15);
+        size_t literalCount = 286;
+        while (literalCount > 257 && literalLengths[literalCount - 1] == 0)
+            --literalCount;
+        size_t distanceCount = 30;
+        while (distanceCount > 1 && distanceLengths[distanceCount - 1] == 0)
+            --distanceCount;
+
+        // The code lengths of both codes, run-length coded with the symbols 16 to 18
+        std::vector<uint8_t> all(literalLengths.begin(), literalLengths.begin() + literalCount);
+        all.insert(all.end(), distanceLengths.begin(), distanceLengths.begin() + distanceCount);
+        std::vector<std::pair<uint8_t, uint8_t>> runs;
+        for (size_t index = 0; index < all.size();) {
+            size_t run = 1;
+            while (index + run < all.size() && all[index + run] == all[index])
+                ++run;
+            const uint8_t value = all[index];
+            size_t left = run;
+            if (value == 0) {
+                while (left >= 11) {
+                    const size_t take = std::min<size_t>(left, 138);
+                    runs.push_back({18, static_cast<uint8_t>(take - 11)});
+                    left -= take;
+                }
+                if (left >= 3) {
+                    runs.push_back({17, static_cast<uint8_t>(left - 3)});
+                    left = 0;
+                }
+            } else {
+                runs.push_back({value, 0});
+                --left;
+                while (left >= 3) {
+                    const size_t take = std::min<size_t>(left, 6);
+                    runs.push_back({16, static_cast<uint8_t>(take - 3)});
+                    left -= take;
+                }
+            }
+            for (; left > 0; --left)
+                runs.push_back({value, 0});
+            index += run;
+        }
+
+        std::vector<uint32_t> lengthFrequencies(19, 0);
+        for (const auto& run : runs)
+            ++lengthFrequencies[run.first];
+        const auto lengthLengths = GetLengths(lengthFrequencies, 7);
+        const auto lengthCodes = GetCodes(lengthLengths);
+        static constexpr uint8_t kOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+        size_t lengthCount = 19;
+        while (lengthCount > 4 && lengthLengths[kOrder[lengthCount - 1]] == 0)
+            --lengthCount;
+
+        Write(last ? 1 : 0, 1);
+        Write(2, 2);
+        Write(static_cast<uint32_t>(literalCount - 257), 5);
+        Write(static_cast<uint32_t>(distanceCount - 1), 5);
+        Write(static_cast<uint32_t>(lengthCount - 4), 4);
+        for (size_t index = 0; index < lengthCount; ++index)
+            Write(lengthLengths[kOrder[index]], 3);
+        static constexpr uint8_t kRunExtra[3] = {2, 3, 7};
+        for (const auto& run : runs) {
+            Write(lengthCodes[run.first], lengthLengths[run.first]);
+            if (run.first >= 16)
+                Write(run.second, kRunExtra[run.first - 16]);
+        }
+
+        const auto literalCodes = GetCodes(literalLengths);
+        const auto distanceCodes = GetCodes(distanceLengths);
+        for (const Symbol symbol : mSymbols) {
+            if (symbol.value < 256) {
+                Write(literalCodes[symbol.value], literalLengths[symbol.value]);
+                continue;
+            }
+            const unsigned length = symbol.value & 0x1ff;
+            const unsigned distance = symbol.value >> 9;
+            const unsigned lengthCode = LengthCode(length);
+            Write(literalCodes[257 + lengthCode], literalLengths[257 + lengthCode]);
+            Write(length - kLengthBase[lengthCode], kLengthExtra[lengthCode]);
+            const unsigned distanceCode = DistanceCode(distance);
+            Write(distanceCodes[distanceCode], distanceLengths[distanceCode]);
+            Write(distance - kDistanceBase[distanceCode], kDistanceExtra[distanceCode]);
+        }
+        Write(literalCodes[256], literalLengths[256]);
+        mSymbols.clear();
+    }
+
+    std::string mOut;
+    uint64_t mBits{0};
+    unsigned mCount{0};
+    std::vector<Symbol> mSymbols;
+};
+
+uint8_t Paeth(int a, int b, int c) {
+    const int p = a + b - c;
+    const int pa = std::abs(p - a);
+    const int pb = std::abs(p - b);
+    const int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return static_cast<uint8_t>(a);
+    return static_cast<uint8_t>(pb <= pc ? b : c);
+}
+
+// Undo the filter of a row in place. previous is nullptr for the first row of a pass.
+bool Unfilter(uint8_t type, uint8_t* row, const uint8_t* previous, size_t length, size_t step) {
+    switch (type) {
+        case 0:
+            return true;
+        case 1:
+            for (size_t index = step; index < length; ++index)
+                row[index] = static_cast<uint8_t>(row[index] + row[index - step]);
+            return true;
+        case 2:
+            if (previous != nullptr) {
+                for (size_t index = 0; index < length; ++index)
+                    row[index] = static_cast<uint8_t>(row[index] + previous[index]);
+            }
+            return true;
+        case 3:
+            for (size_t index = 0; index < length; ++index) {
+                const int left = index >= step ? row[index - step] : 0;
+                const int up = previous != nullptr ? previous[index] : 0;
+                row[index] = static_cast<uint8_t>(row[index] + ((left + up) >> 1));
+            }
+            return true;
+        case 4:
+            for (size_t index = 0; index < length; ++index) {
+                const int left = index >= step ? row[index - step] : 0;
+                const int up = previous != nullptr ? previous[index] : 0;
+                const int corner = previous != nullptr && index >= step ? previous[index - step] : 0;
+                row[index] = static_cast<uint8_t>(row[index] + Paeth(left, up, corner));
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool DecodePng(const uint8_t* data, size_t size, Bitmap& bitmap) {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint8_t depth = 0;
+    uint8_t colorType = 0;
+    uint8_t interlace = 0;
+    bool header = false;
+    std::array<uint8_t, 256 * 4> palette{};
+    std::array<uint16_t, 3> key{};
+    bool hasKey = false;
+    std::vector<uint8_t> compressed;
+
+    for (size_t position = 8; position + 12 <= size;) {
+        const uint32_t length = BigEndian32(data + position);
+        if (length > size - position - 12)
+            return false;
+        const uint8_t* type = data + position + 4;
+        const uint8_t* chunk = data + position + 8;
+        position += 12 + size_t(length);
+
+        if (std::memcmp(type, "IHDR", 4) == 0 && length >= 13) {
+            width = BigEndian32(chunk);
+            height = BigEndian32(chunk + 4);
+            depth = chunk[8];
+            colorType = chunk[9];
+            interlace = chunk[12];
+            const bool validDepth = colorType == 0   ? (depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16)
+                                    : colorType == 3 ? (depth == 1 || depth == 2 || depth == 4 || depth == 8)
+                                                     : (depth == 8 || depth == 16);
+            if (!validDepth || (colorType != 0 && colorType != 2 && colorType != 3 && colorType != 4 && colorType != 6) ||
+                chunk[10] != 0 || chunk[11] != 0 || interlace > 1)
+                return false;
+            header = true;
+        } else if (std::memcmp(type, "PLTE", 4) == 0) {
+            for (uint32_t entry = 0; entry < std::min<uint32_t>(length / 3, 256); ++entry) {
+                std::memcpy(&palette[entry * 4], chunk + entry * 3, 3);
+                palette[entry * 4 + 3] = 255;
+            }
+        } else if (std::memcmp(type, "tRNS", 4) == 0) {
+            if (colorType == 3) {
+                for (uint32_t entry = 0; entry < std::min<uint32_t>(length, 256); ++entry)
+                    palette[entry * 4 + 3] = chunk[entry];
+            } else if (colorType == 0 && length >= 2) {
+                key.fill(static_cast<uint16_t>(BigEndian16(chunk)));
+                hasKey = true;
+            } else if (colorType == 2 && length >= 6) {
+                for (size_t channel = 0; channel < 3; ++channel)
+                    key[channel] = static_cast<uint16_t>(BigEndian16(chunk + channel * 2));
+                hasKey = true;
+            }
+        } else if (std::memcmp(type, "IDAT", 4) == 0) {
+            compressed.insert(compressed.end(), chunk, chunk + length);
+        } else if (std::memcmp(type, "IEND", 4) == 0) {
+            break;
+        }
+    }
+    if (!header || !Allocate(bitmap, width, height))
+        return false;
+
+    // Adam7 passes: first column and row, then steps
+    struct Pass {
+        uint32_t x, y, dx, dy;
+    };
+    static constexpr Pass kInterlaced[7] = {{0, 0, 8, 8}, {4, 0, 8, 8}, {0, 4, 4, 8}, {2, 0, 4, 4},
+                                            {0, 2, 2, 4}, {1, 0, 2, 2}, {0, 1, 1, 2}};
+    static constexpr Pass kProgressive[1] = {{0, 0, 1, 1}};
+    const Pass* passes = interlace != 0 ? kInterlaced : kProgressive;
+    const size_t passCount = interlace != 0 ? 7 : 1;
+
+    const unsigned channels = colorType == 0 ? 1 : colorType == 2 ? 3 : colorType == 3 ? 1 : colorType == 4 ? 2 : 4;
+    const unsigned bitsPerPixel = channels * depth;
+    const size_t step = std::max(1u, bitsPerPixel / 8);
+    const auto passWidth = [width](const Pass& pass) { return width > pass.x ? (width - pass.x + pass.dx - 1) / pass.dx : 0; };
+    const auto passHeight = [height](const Pass& pass) { return height > pass.y ? (height - pass.y + pass.dy - 1) / pass.dy : 0; };
+    const auto rowBytes = [bitsPerPixel](uint32_t columns) { return (uint64_t(columns) * bitsPerPixel + 7) / 8; };
+
+    uint64_t expected = 0;
+    for (size_t pass = 0; pass < passCount; ++pass) {
+        if (passWidth(passes[pass]) != 0)
+            expected += uint64_t(passHeight(passes[pass])) * (1 + rowBytes(passWidth(passes[pass])));
+    }
+    std::vector<uint8_t> raw(static_cast<size_t>(expected));
+    size_t written = 0;
+    Inflater inflater(compressed.data(), compressed.size());
+    if (!inflater.Inflate(raw.data(), raw.size(), written) || written < raw.size())
+        return false;
+
+    const uint32_t maximum = (1u << std::min<unsigned>(depth, 8)) - 1;
+    const auto sample = [depth, maximum](const uint8_t* row, uint32_t index) -> uint32_t {
+        if (depth == 16)
+            return BigEndian16(row + index * 2);
+        if (depth == 8)
+            return row[index];
+        const uint32_t bit = index * depth;
+        return (row[bit / 8] >> (8 - depth - bit % 8)) & maximum;
+    };
+    const auto to8 = [depth, maximum](uint32_t value) -> uint8_t {
+        return static_cast<uint8_t>(depth == 16 ? value >> 8 : value * 255 / maximum);
+    };
+
+    uint8_t* row = raw.data();
+    for (size_t index = 0; index < passCount; ++index) {
+        const Pass& pass = passes[index];
+        const uint32_t columns = passWidth(pass);
+        const uint32_t rows = columns != 0 ? passHeight(pass) : 0;
+        const size_t length = static_cast<size_t>(rowBytes(columns));
+        const uint8_t* previous = nullptr;
+        for (uint32_t y = 0; y < rows; ++y, row += length + 1) {
+            if (!Unfilter(row[0], row + 1, previous, length, step))
+                return false;
+            previous = row + 1;
+
+            uint8_t* out = bitmap.pixels.data() + (size_t(pass.y + y * pass.dy) * width + pass.x) * 4;
+            if (depth == 8 && colorType == 6 && pass.dx == 1) {
+                std::memcpy(out, row + 1, length);
+                continue;
+            }
+            if (depth == 8 && colorType == 2 && pass.dx == 1 && !hasKey) {
+                for (uint32_t x = 0; x < columns; ++x)
+                    std::memcpy(out + x * 4, row + 1 + x * 3, 3);
+                continue;
+            }
+            for (uint32_t x = 0; x < columns; ++x, out += size_t(pass.dx) * 4) {
+                const uint32_t first = x * channels;
+                if (colorType == 3) {
+                    std::memcpy(out, &palette[sample(row + 1, first) * 4], 4);
+                } else if (colorType == 0 || colorType == 4) {
+                    const uint32_t gray = sample(row + 1, first);
+                    out[0] = out[1] = out[2] = to8(gray);
+                    out[3] = colorType == 4 ? to8(sample(row + 1, first + 1)) : (hasKey && gray == key[0] ? 0 : 255);
+                } else {
+                    uint32_t rgb[3];
+                    for (uint32_t channel = 0; channel < 3; ++channel) {
+                        rgb[channel] = sample(row + 1, first + channel);
+                        out[channel] = to8(rgb[channel]);
+                    }
+                    out[3] = colorType == 6                                                   ? to8(sample(row + 1, first + 3))
+                             : hasKey && rgb[0] == key[0] && rgb[1] == key[1] && rgb[2] == key[2] ? 0
+                                                                                                  : 255;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Natural index of the coefficients in zigzag order, then padding for corrupt runs
+constexpr uint8_t kZigzag[64 + 16] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,
+    6,  7,  14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45, 38, 31,
+    39, 46, 53, 60, 61, 54, 47, 55, 62, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63};
+
+/** Baseline and progressive JPEG decoding (ITU T.81). All the coefficients of the image
+ are kept until the last scan, then dequantized and transformed block by block.
+*/
+class JpegDecoder {
+ public:
+    JpegDecoder(const uint8_t* data, size_t size) : mData(data), mSize(size) {}
+
+    bool Decode(Bitmap& bitmap, uint32_t minSize) {
+        mMinSize = minSize;
+        bool scanned = false;
+        for (size_t position = 2; position + 4 <= mSize;) {
+            // Markers may be preceded by fill bytes
+            if (mData[position] != 0xff || mData[position + 1] == 0xff) {
+                ++position;
+                continue;
+            }
+            const uint8_t marker = mData[position + 1];
+            position += 2;
+            if (marker == 0xd9)
+                break;
+            if ((marker >= 0xd0 && marker <= 0xd7) || marker == 0x01)
+                continue;
+
+            const size_t length = BigEndian16(mData + position);
+            if (length < 2 || position + length > mSize)
+                return false;
+            const uint8_t* segment = mData + position + 2;
+            const size_t segmentLength = length - 2;
+            position += length;
+
+            switch (marker) {
+                case 0xc0:
+                case 0xc1:
+                case 0xc2:
+                    if (mFrame || !Frame(segment, segmentLength, marker == 0xc2))
+                        return false;
+                    break;
+                case 0xc4:
+                    if (!HuffmanTables(segment, segmentLength))
+                        return false;
+                    break;
+                case 0xdb:
+                    if (!QuantizationTables(segment, segmentLength))
+                        return false;
+                    break;
+                case 0xdd:
+                    if (segmentLength < 2)
+                        return false;
+                    mRestartInterval = BigEndian16(segment);
+                    break;
+                case 0xee:
+                    // Adobe: a transform of 0 means that 3 components are RGB
+                    if (segmentLength >= 12 && std::memcmp(segment, "Adobe", 5) == 0)
+                        mAdobeTransform = segment[11];
+                    break;
+                case 0xda:
+                    if (!mFrame || !Scan(segment, segmentLength, position))
+                        return false;
+                    scanned = true;
+                    break;
+                default:
+                    // Other coding processes (lossless, arithmetic, hierarchical)
+                    if (marker >= 0xc3 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc)
+                        return false;
+                    break;
+            }
+        }
+        return scanned && Output(bitmap);
+    }
+
+ private:
+    struct Huffman {
+        bool defined{false};
+        // By the next 9 bits: length << 8 | symbol, 0 for longer codes
+        std::array<uint16_t, 512> fast{};
+        std::array<int32_t, 18> maxCode{};
+        std::array<int32_t, 17> offset{};
+        std::array<uint8_t, 256> symbols{};
+    };
+
+    struct Component {
+        uint8_t id{0};
+        uint32_t h{1};
+        uint32_t v{1};
+        uint8_t quantization{0};
+        // Blocks allocated (whole MCUs), and covering the image
+        uint32_t blocksWide{0};
+        uint32_t blocksHigh{0};
+        uint32_t usedWide{0};
+        uint32_t usedHigh{0};
+        std::vector<int16_t> coefficients;
+        int dcPrediction{0};
+        uint8_t dcTable{0};
+        uint8_t acTable{0};
+    };
+
+    bool Frame(const uint8_t* segment, size_t length, bool progressive) {
+        if (length < 6 || segment[0] != 8)
+            return false;
+        mHeight = BigEndian16(segment + 1);
+        mWidth = BigEndian16(segment + 3);
+        const size_t count = segment[5];
+        if ((count != 1 && count != 3) || length < 6 + count * 3 || mWidth == 0 || mHeight == 0 ||
+            uint64_t(mWidth) * mHeight > kMaxPixels)
+            return false;
+
+        mProgressive = progressive;
+        mComponents.resize(count);
+        for (size_t index = 0; index < count; ++index) {
+            auto& component = mComponents[index];
+            component.id = segment[6 + index * 3];
+            component.h = segment[7 + index * 3] >> 4;
+            component.v = segment[7 + index * 3] & 15;
+            component.quantization = segment[8 + index * 3];
+            if (component.h == 0 || component.h > 4 || component.v == 0 || component.v > 4 || component.quantization > 3)
+                return false;
+            mMaxH = std::max(mMaxH, component.h);
+            mMaxV = std::max(mMaxV, component.v);
+        }
+        mMcusWide = (mWidth + 8 * mMaxH - 1) / (8 * mMaxH);
+        mMcusHigh = (mHeight + 8 * mMaxV - 1) / (8 * mMaxV);
+        for (auto& component : mComponents) {
+            component.blocksWide = mMcusWide * component.h;
+            component.blocksHigh = mMcusHigh * component.v;
+            component.usedWide = ((mWidth * component.h + mMaxH - 1) / mMaxH + 7) / 8;
+            component.usedHigh = ((mHeight * component.v + mMaxV - 1) / mMaxV + 7) / 8;
+            component.coefficients.assign(size_t(component.blocksWide) * component.blocksHigh * 64, 0);
+        }
+
+        // Hashes and placeholders are computed from the DC coefficients, at 1/8
+        mDcOnly = mMinSize != 0 && (mWidth + 7) / 8 >= mMinSize && (mHeight + 7) / 8 >= mMinSize;
+        mFrame = true;
+        return true;
+    }
+
+    bool QuantizationTables(const uint8_t* segment, size_t length) {
+        for (size_t position = 0; position < length;) {
+            const unsigned precision = segment[position] >> 4;
+            const unsigned id = segment[position] & 15;
+            const size_t size = precision != 0 ? 128 : 64;
+            if (id > 3 || position + 1 + size > length)
+                return false;
+            for (size_t index = 0; index < 64; ++index) {
+                mQuantization[id][kZigzag[index]] = static_cast<uint16_t>(
+                    precision != 0 ? BigEndian16(segment + position + 1 + index * 2) : segment[position + 1 + index]);
+            }
+            position += 1 + size;
+        }
+        return true;
+    }
+
+    bool HuffmanTables(const uint8_t* segment, size_t length) {
+        for (size_t position = 0; position + 17 <= length;) {
+            const unsigned type = segment[position] >> 4;
+            const unsigned id = segment[position] & 15;
+            if (type > 1 || id > 3)
+                return false;
+            Huffman& table = mHuffman[type][id];
+            table = Huffman();
+
+            size_t total = 0;
+            for (size_t index = 1; index <= 16; ++index)
+                total += segment[position + index];
+            if (total > 256 || position + 17 + total > length)
+                return false;
+            std::memcpy(table.symbols.data(), segment + position + 17, total);
+
+            int32_t code = 0;
+            int32_t symbol = 0;
+            for (unsigned bits = 1; bits <= 16; ++bits) {
+                const int32_t count = segment[position + bits];
+                // Over-subscribed codes would fill past the end of the fast table
+                if (code + count > (1 << bits) || symbol + count > static_cast<int32_t>(total))
+                    return false;
+                table.offset[bits] = symbol - code;
+                for (int32_t index = 0; index < count; ++index, ++code, ++symbol) {
+                    if (bits <= 9) {
+                        const uint32_t first = uint32_t(code) << (9 - bits);
+                        for (uint32_t fill = 0; fill < (1u << (9 - bits)); ++fill)
+                            table.fast[first + fill] = static_cast<uint16_t>(bits << 8 | table.symbols[symbol]);
+                    }
+                }
+                table.maxCode[bits] = count != 0 ? code - 1 : -1;
+                code <<= 1;
+            }
+            table.defined = true;
+            position += 17 + total;
+        }
+        return true;
+    }
+
+    // @{ Entropy-coded data, most significant bit first. Markers end the data: zeros are
+    // read past them.
+    void Refill() {
+        while (mCount <= 56) {
+            uint64_t byte = 0;
+            if (mPosition < mSize && !mMarker) {
+                byte = mData[mPosition];
+                if (byte == 0xff) {
+                    const uint8_t next = mPosition + 1 < mSize ? mData[mPosition + 1] : 0xd9;
+                    if (next == 0x00)
+                        mPosition += 2;
+                    else
+                        mMarker = true;
+                    byte = next == 0x00 ? 0xff : 0;
+                } else {
+                    ++mPosition;
+                }
+            }
+            mBits |= byte << (56 - mCount);
+            mCount += 8;
+        }
+    }
+
+    int Bits(unsigned count) {
+        if (count == 0)
+            return 0;
+        Refill();
+        const int value = static_cast<int>(mBits >> (64 - count));
+        mBits <<= count;
+        mCount -= count;
+        return value;
+    }
+
+    int Receive(unsigned count) {
+        const int value = Bits(count);
+        return count == 0 || value >= (1 << (count - 1)) ? value : value - (1 << count) + 1;
+    }
+
+    int DecodeSymbol(const Huffman& table) {
+        Refill();
+        const uint16_t entry = table.fast[mBits >> (64 - 9)];
+        if (entry != 0) {
+            mBits <<= entry >> 8;
+            mCount -= entry >> 8;
+            return entry & 255;
+        }
+        const uint32_t code = static_cast<uint32_t>(mBits >> (64 - 16));
+        for (unsigned bits = 10; bits <= 16; ++bits) {
+            const int32_t prefix = static_cast<int32_t>(code >> (16 - bits));
+            if (prefix <= table.maxCode[bits]) {
+                mBits <<= bits;
+                mCount -= bits;
+                return table.symbols[static_cast<size_t>(table.offset[bits] + prefix) & 255];
+            }
+        }
+        return -1;
+    }
+
+    void ResetBits() {
+        mBits = 0;
+        mCount = 0;
+        mMarker = false;
+    }
+    // @}
+
+    // The position of the next marker other than a restart, from the current position
+    size_t NextMarker(size_t position) const {
+        while (position + 1 < mSize &&
+               !(mData[position] == 0xff && mData[position + 1] != 0 && (mData[position + 1] < 0xd0 || mData[position + 1] > 0xd7)))
+            ++position;
+        return position;
+    }
+
+    bool Scan(const uint8_t* segment, size_t length, size_t& position) {
+        if (length < 1)
+            return false;
+        const size_t count = segment[0];
+        if (count == 0 || count > mComponents.size() || length < 4 + count * 2)
+            return false;
+        std::vector<Component*> components;
+        for (size_t index = 0; index < count; ++index) {
+            const uint8_t id = segment[1 + index * 2];
+            const auto found = std::find_if(mComponents.begin(), mComponents.end(),
+                                            [id](const Component& component) { return component.id == id; });
+            if (found == mComponents.end())
+                return false;
+            found->dcTable = segment[2 + index * 2] >> 4;
+            found->acTable = segment[2 + index * 2] & 15;
+            if (found->dcTable > 3 || found->acTable > 3)
+                return false;
+            components.push_back(&*found);
+        }
+        mStart = segment[1 + count * 2];
+        mEnd = segment[2 + count * 2];
+        mHigh = segment[3 + count * 2] >> 4;
+        mLow = segment[3 + count * 2] & 15;
+        if (mProgressive) {
+            if (mEnd > 63 || mStart > mEnd || (mStart == 0 && mEnd != 0) || (mStart > 0 && count != 1) || mLow > 13)
+                return false;
+        } else if (mStart != 0 || mEnd != 63 || mHigh != 0 || mLow != 0) {
+            return false;
+        }
+
+        // The other coefficients of progressive images aren't needed at 1/8
+        if (mDcOnly && mProgressive && mStart > 0) {
+            position = NextMarker(position);
+            return true;
+        }
+        for (Component* component : components) {
+            if ((mStart == 0 && mHigh == 0 && !mHuffman[0][component->dcTable].defined) ||
+                (mEnd > 0 && !mHuffman[1][component->acTable].defined))
+                return false;
+            component->dcPrediction = 0;
+        }
+
+        mPosition = position;
+        ResetBits();
+        mEobRun = 0;
+        const bool single = components.size() == 1;
+        const size_t units = single ? size_t(components[0]->usedWide) * components[0]->usedHigh : size_t(mMcusWide) * mMcusHigh;
+        for (size_t unit = 0; unit < units; ++unit) {
+            if (mRestartInterval != 0 && unit != 0 && unit % mRestartInterval == 0) {
+                // Expect RSTn, then start again
+                mPosition = NextMarkerOrRestart(mPosition);
+                if (mPosition + 1 < mSize && mData[mPosition] == 0xff && mData[mPosition + 1] >= 0xd0 && mData[mPosition + 1] <= 0xd7)
+                    mPosition += 2;
+                ResetBits();
+                mEobRun = 0;
+                for (Component* component : components)
+                    component->dcPrediction = 0;
+            }
+
+            if (single) {
+                Component& component = *components[0];
+                const size_t x = unit % component.usedWide;
+                const size_t y = unit / component.usedWide;
+                if (!Block(component, &component.coefficients[(y * component.blocksWide + x) * 64]))
+                    return false;
+                continue;
+            }
+            const size_t mcuX = unit % mMcusWide;
+            const size_t mcuY = unit / mMcusWide;
+            for (Component* component : components) {
+                for (uint32_t v = 0; v < component->v; ++v) {
+                    for (uint32_t h = 0; h < component->h; ++h) {
+                        const size_t x = mcuX * component->h + h;
+                        const size_t y = mcuY * component->v + v;
+                        if (!Block(*component, &component->coefficients[(y * component->blocksWide + x) * 64]))
+                            return false;
+                    }
+                }
+            }
+        }
+        position = NextMarker(mPosition);
+        return true;
+    }
+
+    size_t NextMarkerOrRestart(size_t position) const {
+        while (position + 1 < mSize && !(mData[position] == 0xff && mData[position + 1] != 0))
+            ++position;
+        return position;
+    }
+
+    bool Block(Component& component, int16_t* block) {
+        if (!mProgressive)
+            return BaselineBlock(component, block);
+        if (mStart == 0)
+            return DcBlock(component, block);
+        return mHigh == 0 ? AcFirstBlock(component, block) : AcRefineBlock(component, block);
+    }
+
+    bool BaselineBlock(Component& component, int16_t* block) {
+        const int size = DecodeSymbol(mHuffman[0][component.dcTable]);
+        if (size < 0 || size > 16)
+            return false;
+        component.dcPrediction += Receive(static_cast<unsigned>(size));
+        block[0] = static_cast<int16_t>(component.dcPrediction);
+
+        const Huffman& table = mHuffman[1][component.acTable];
+        for (unsigned index = 1; index < 64;) {
+            const int symbol = DecodeSymbol(table);
+            if (symbol < 0)
+                return false;
+            const unsigned run = static_cast<unsigned>(symbol) >> 4;
+            const unsigned bits = static_cast<unsigned>(symbol) & 15;
+            if (bits == 0) {
+                if (run != 15)
+                    break;
+                index += 16;
+                continue;
+            }
+            index += run;
+            block[kZigzag[std::min(index, 79u)]] = static_cast<int16_t>(Receive(bits));
+            ++index;
+        }
+        return true;
+    }
+
+    bool DcBlock(Component& component, int16_t* block) {
+        if (mHigh != 0) {
+            if (Bits(1) != 0)
+                block[0] = static_cast<int16_t>(block[0] | (1 << mLow));
+            return true;
+        }
+        const int size = DecodeSymbol(mHuffman[0][component.dcTable]);
+        if (size < 0 || size > 16)
+            return false;
+        component.dcPrediction += Receive(static_cast<unsigned>(size));
+        block[0] = static_cast<int16_t>(component.dcPrediction * (1 << mLow));
+        return true;
+    }
+
+    bool AcFirstBlock(Component& component, int16_t* block) {
+        if (mEobRun > 0) {
+            --mEobRun;
+            return true;
+        }
+        const Huffman& table = mHuffman[1][component.acTable];
+        for (unsigned index = mStart; index <= mEnd;) {
+            const int symbol = DecodeSymbol(table);
+            if (symbol < 0)
+                return false;
+            const unsigned run = static_cast<unsigned>(symbol) >> 4;
+            const unsigned bits = static_cast<unsigned>(symbol) & 15;
+            if (bits == 0) {
+                if (run < 15) {
+                    mEobRun = (1u << run) - 1 + static_cast<unsigned>(Bits(run));
+                    break;
+                }
+                index += 16;
+                continue;
+            }
+            index += run;
+            block[kZigzag[std::min(index, 79u)]] = static_cast<int16_t>(Receive(bits) * (1 << mLow));
+            ++index;
+        }
+        return true;
+    }
+
+    bool AcRefineBlock(Component& component, int16_t* block) {
+        const int bit = 1 << mLow;
+        const auto refine = [this, bit](int16_t& coefficient) {
+            if (Bits(1) != 0 && (coefficient & bit) == 0)
+                coefficient = static_cast<int16_t>(coefficient + (coefficient >= 0 ? bit : -bit));
+        };
+
+        unsigned index = mStart;
+        if (mEobRun == 0) {
+            const Huffman& table = mHuffman[1][component.acTable];
+            while (index <= mEnd) {
+                const int symbol = DecodeSymbol(table);
+                if (symbol < 0)
+                    return false;
+                int run = symbol >> 4;
+                int value = 0;
+                if ((symbol & 15) == 0) {
+                    if (run < 15) {
+                        mEobRun = (1u << run) + static_cast<unsigned>(Bits(static_cast<unsigned>(run)));
+                        break;
+                    }
+                    // 16 zeros, refining the coefficients met on the way
+                } else {
+                    if ((symbol & 15) != 1)
+                        return false;
+                    value = Bits(1) != 0 ? bit : -bit;
+                }
+
+                // Skip run zero coefficients, then place the new one
+                while (index <= mEnd) {
+                    int16_t& coefficient = block[kZigzag[index++]];
+                    if (coefficient != 0) {
+                        refine(coefficient);
+                    } else if (run == 0) {
+                        coefficient = static_cast<int16_t>(value);
+                        break;
+                    } else {
+                        --run;
+                    }
+                }
+            }
+        }
+        if (mEobRun > 0) {
+            // The rest of the band only refines the known coefficients
+            for (; index <= mEnd; ++index) {
+                int16_t& coefficient = block[kZigzag[index]];
+                if (coefficient != 0)
+                    refine(coefficient);
+            }
+            --mEobRun;
+        }
+        return true;
+    }
+
+    // Inverse DCT of a dequantized block into 8x8 samples. Most coefficients are zero: their
+    // products are skipped, and the loops over x are vectorized.
+    static void InverseDct(const float* input, uint8_t* output, size_t stride) {
+        // By frequency then position: the weight of frequency u at x
+        static const auto kTable = [] {
+            std::array<float, 64> table{};
+            for (int u = 0; u < 8; ++u) {
+                for (int x = 0; x < 8; ++x)
+                    table[u * 8 + x] = static_cast<float>((u == 0 ? std::sqrt(0.125) : 0.5) * std::cos((2 * x + 1) * u * kPi / 16));
+            }
+            return table;
+        }();
+
+        float rows[64] = {};
+        bool used[8] = {};
+        for (int v = 0; v < 8; ++v) {
+            for (int u = 0; u < 8; ++u) {
+                const float coefficient = input[v * 8 + u];
+                if (coefficient == 0)
+                    continue;
+                used[v] = true;
+                for (int x = 0; x < 8; ++x)
+                    rows[v * 8 + x] += coefficient * kTable[u * 8 + x];
+            }
+        }
+        for (int y = 0; y < 8; ++y) {
+            float sums[8];
+            for (int x = 0; x < 8; ++x)
+                sums[x] = 128.5f;
+            for (int v = 0; v < 8; ++v) {
+                if (!used[v])
+                    continue;
+                const float weight = kTable[v * 8 + y];
+                for (int x = 0; x < 8; ++x)
+                    sums[x] += weight * rows[v * 8 + x];
+            }
+            for (int x = 0; x < 8; ++x)
+                output[y * stride + x] = Clamp(static_cast<int>(std::floor(sums[x])));
+        }
+    }
+
+    // The samples of a component: one per pixel, or one per block at 1/8
+    std::vector<uint8_t> Plane(const Component& component, size_t& stride) const {
+        const uint16_t* quantization = mQuantization[component.quantization].data();
+        std::vector<uint8_t> plane;
+        if (mDcOnly) {
+            stride = component.blocksWide;
+            plane.resize(stride * component.blocksHigh);
+            for (size_t block = 0; block < plane.size(); ++block) {
+                const int dc = component.coefficients[block * 64] * quantization[0];
+                plane[block] = Clamp(static_cast<int>(std::lround(dc / 8.0 + 128)));
+            }
+            return plane;
+        }
+
+        stride = size_t(component.blocksWide) * 8;
+        plane.resize(stride * component.blocksHigh * 8);
+        float input[64];
+        for (size_t y = 0; y < component.usedHigh; ++y) {
+            for (size_t x = 0; x < component.usedWide; ++x) {
+                const int16_t* block = &component.coefficients[(y * component.blocksWide + x) * 64];
+                uint8_t* output = &plane[y * 8 * stride + x * 8];
+                bool flat = true;
+                for (size_t index = 1; index < 64 && flat; ++index)
+                    flat = block[index] == 0;
+                if (flat) {
+                    const uint8_t value = Clamp(static_cast<int>(std::lround(block[0] * quantization[0] / 8.0 + 128)));
+                    for (size_t row = 0; row < 8; ++row)
+                        std::memset(output + row * stride, value, 8);
+                    continue;
+                }
+                for (size_t index = 0; index < 64; ++index)
+                    input[index] = static_cast<float>(block[index] * quantization[index]);
+                InverseDct(input, output, stride);
+            }
+        }
+        return plane;
+    }
+
+    bool Output(Bitmap& bitmap) {
+        const uint32_t scale = mDcOnly ? 8 : 1;
+        if (!Allocate(bitmap, (mWidth + scale - 1) / scale, (mHeight + scale - 1) / scale))
+            return false;
+
+        std::vector<std::vector<uint8_t>> planes;
+        std::vector<size_t> strides(mComponents.size());
+        for (size_t index = 0; index < mComponents.size(); ++index)
+            planes.push_back(Plane(mComponents[index], strides[index]));
+
+        const bool rgb = mComponents.size() == 3 && (mAdobeTransform == 0 || (mComponents[0].id == 'R' &&
+                                                                                mComponents[1].id == 'G' && mComponents[2].id == 'B'));
+        std::vector<uint32_t> columns(bitmap.width * mComponents.size());
+        for (size_t index = 0; index < mComponents.size(); ++index) {
+            for (uint32_t x = 0; x < bitmap.width; ++x)
+                columns[index * bitmap.width + x] = x * mComponents[index].h / mMaxH;
+        }
+
+        uint8_t* out = bitmap.pixels.data();
+        for (uint32_t y = 0; y < bitmap.height; ++y) {
+            const uint8_t* rows[3] = {};
+            for (size_t index = 0; index < mComponents.size(); ++index)
+                rows[index] = planes[index].data() + size_t(y * mComponents[index].v / mMaxV) * strides[index];
+            for (uint32_t x = 0; x < bitmap.width; ++x, out += 4) {
+                const int luma = rows[0][columns[x]];
+                if (mComponents.size() == 1) {
+                    out[0] = out[1] = out[2] = static_cast<uint8_t>(luma);
+                    continue;
+                }
+                const int cb = rows[1][columns[bitmap.width + x]];
+                const int cr = rows[2][columns[2 * bitmap.width + x]];
+                if (rgb) {
+                    out[0] = static_cast<uint8_t>(luma);
+                    out[1] = static_cast<uint8_t>(cb);
+                    out[2] = static_cast<uint8_t>(cr);
+                    continue;
+                }
+                // BT.601 full range, in 16.16 fixed point
+                const int y16 = (luma << 16) + (1 << 15);
+                out[0] = Clamp((y16 + 91881 * (cr - 128)) >> 16);
+                out[1] = Clamp((y16 - 22554 * (cb - 128) - 46802 * (cr - 128)) >> 16);
+                out[2] = Clamp((y16 + 116130 * (cb - 128)) >> 16);
+            }
+        }
+        return true;
+    }
+
+    const uint8_t* mData;
+    size_t mSize;
+    uint32_t mMinSize{0};
+
+    std::array<std::array<uint16_t, 64>, 4> mQuantization{};
+    std::array<std::array<Huffman, 4>, 2> mHuffman;
+    uint32_t mRestartInterval{0};
+    int mAdobeTransform{-1};
+
+    bool mFrame{false};
+    bool mProgressive{false};
+    bool mDcOnly{false};
+    uint32_t mWidth{0};
+    uint32_t mHeight{0};
+    uint32_t mMaxH{1};
+    uint32_t mMaxV{1};
+    uint32_t mMcusWide{0};
+    uint32_t mMcusHigh{0};
+    std::vector<Component> mComponents;
+
+    // The scan being decoded
+    unsigned mStart{0};
+    unsigned mEnd{0};
+    unsigned mHigh{0};
+    unsigned mLow{0};
+    unsigned mEobRun{0};
+    size_t mPosition{0};
+    uint64_t mBits{0};
+    unsigned mCount{0};
+    bool mMarker{false};
+};
+
+/** Baseline JPEG encoding (ITU T.81) with the example tables of its annex K: YCbCr with
+ chroma subsampled by 2 both ways, the quantization tables scaled by quality as libjpeg
+ does, and the typical Huffman tables, so that the image is encoded in a single pass.
+*/
+class JpegEncoder {
+ public:
+    explicit JpegEncoder(unsigned quality) {
+        static constexpr uint8_t kLuminance[64] = {
+            16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,  58,  60,  55,  14, 13, 16, 24, 40,  57,
+            69, 56, 14, 17, 22,  29,  51,  87,  80, 62, 18, 22, 37,  56,  68,  109, 103, 77, 24, 35, 55, 64,
+            81, 104, 113, 92, 49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99};
+        static constexpr uint8_t kChrominance[64] = {
+            17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56, 99, 99, 99,
+            99, 99, 47, 66, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+            99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99};
+        quality = std::clamp(quality, 1u, 100u);
+        const unsigned scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+        for (int index = 0; index < 64; ++index) {
+            mQuantization[0][index] = static_cast<uint8_t>(std::clamp((kLuminance[index] * scale + 50) / 100, 1u, 255u));
+            mQuantization[1][index] = static_cast<uint8_t>(std::clamp((kChrominance[index] * scale + 50) / 100, 1u, 255u));
+            for (int table = 0; table < 2; ++table)
+                mReciprocals[table][index] = 1.0f / mQuantization[table][index];
+        }
+    }
+
+    std::string Encode(const uint8_t* rgba, uint32_t width, uint32_t height) {
+        WriteHeaders(width, height);
+
+        // Minimum coded units of 16x16 pixels: 4 blocks of luma, then one of each chroma
+        float luma[4][64], chroma[2][64];
+        int predictions[3] = {};
+        for (uint32_t top = 0; top < height; top += 16) {
+            for (uint32_t left = 0; left < width; left += 16) {
+                std::fill(&chroma[0][0], &chroma[0][0] + 128, -128.0f);
+                for (uint32_t y = 0; y < 16; ++y) {
+                    // Past the edges, the last row and column are repeated
+                    const uint8_t* row = rgba + size_t(std::min(top + y, height - 1)) * width * 4;
+                    for (uint32_t x = 0; x < 16; ++x) {
+                        const uint8_t* pixel = row + size_t(std::min(left + x, width - 1)) * 4;
+                        const float r = pixel[0], g = pixel[1], b = pixel[2];
+                        luma[(y / 8) * 2 + x / 8][(y % 8) * 8 + x % 8] = 0.299f * r + 0.587f * g + 0.114f * b - 128;
+                        const int sample = (y / 2) * 8 + x / 2;
+                        chroma[0][sample] += 0.25f * (-0.168736f * r - 0.331264f * g + 0.5f * b + 128);
+                        chroma[1][sample] += 0.25f * (0.5f * r - 0.418688f * g - 0.081312f * b + 128);
+                    }
+                }
+                for (int block = 0; block < 4; ++block)
+                    EncodeBlock(luma[block], 0, predictions[0]);
+                EncodeBlock(chroma[0], 1, predictions[1]);
+                EncodeBlock(chroma[1], 1, predictions[2]);
+            }
+        }
+
+        // Pad the last byte with 1 bits
+        WriteBits(0x7f, 7);
+        mOut += "\xff\xd9";
+        return std::move(mOut);
+    }
+
+ private:
+    struct HuffmanTable {
+        uint8_t counts[16];
+        const uint8_t* symbols;
+        uint16_t codes[256];
+        uint8_t lengths[256];
+    };
+
+    // The typical tables of annex K.3, by luminance then chrominance
+    static const HuffmanTable* GetHuffmanTables(bool ac) {
+        static constexpr uint8_t kDcSymbols[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+        static constexpr uint8_t kAcLuminance[162] = {
+            0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71,
+            0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72,
+            0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37,
+            0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+            0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83,
+            0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3,
+            0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+            0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+            0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+        static constexpr uint8_t kAcChrominance[162] = {
+            0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22,
+            0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1,
+            0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36,
+            0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+            0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a,
+            0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a,
+            0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba,
+            0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+            0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+        static const auto kTables = [] {
+            std::array<HuffmanTable, 4> tables = {{{{0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0}, kDcSymbols, {}, {}},
+                                                   {{0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0}, kDcSymbols, {}, {}},
+                                                   {{0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d}, kAcLuminance, {}, {}},
+                                                   {{0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77}, kAcChrominance, {}, {}}}};
+            // Canonical codes: consecutive within a length, doubled from one length to the next
+            for (auto& table : tables) {
+                unsigned code = 0;
+                size_t symbol = 0;
+                for (unsigned length = 1; length <= 16; ++length, code <<= 1) {
+                    for (unsigned count = 0; count < table.counts[length - 1]; ++count, ++code, ++symbol) {
+                        table.codes[table.symbols[symbol]] = static_cast<uint16_t>(code);
+                        table.lengths[table.symbols[symbol]] = static_cast<uint8_t>(length);
+                    }
+                }
+            }
+            return tables;
+        }();
+        return kTables.data() + (ac ? 2 : 0);
+    }
+
+    static size_t GetSymbolCount(const HuffmanTable& table) {
+        size_t count = 0;
+        for (uint8_t length : table.counts)
+            count += length;
+        return count;
+    }
+
+    void WriteMarker(uint8_t marker, size_t length) {
+        mOut += '\xff';
+        mOut += static_cast<char>(marker);
+        mOut += static_cast<char>((length + 2) >> 8);
+        mOut += static_cast<char>((length + 2) & 0xff);
+    }
+
+    void WriteHeaders(uint32_t width, uint32_t height) {
+        mOut += "\xff\xd8";
+        WriteMarker(0xe0, 14);
+        mOut.append("JFIF\0\x01\x01\0\0\x01\0\x01\0\0", 14);
+
+        WriteMarker(0xdb, 2 * 65);
+        for (int table = 0; table < 2; ++table) {
+            mOut += static_cast<char>(table);
+            for (int index = 0; index < 64; ++index)
+                mOut += static_cast<char>(mQuantization[table][kZigzag[index]]);
+        }
+
+        WriteMarker(0xc0, 15);
+        mOut += '\x08';
+        mOut += static_cast<char>(height >> 8);
+        mOut += static_cast<char>(height & 0xff);
+        mOut += static_cast<char>(width >> 8);
+        mOut += static_cast<char>(width & 0xff);
+        // Y sampled 2x2 with table 0, Cb and Cr 1x1 with table 1
+        mOut.append("\x03\x01\x22\x00\x02\x11\x01\x03\x11\x01", 10);
+
+        size_t length = 0;
+        for (bool ac : {false, true}) {
+            for (int table = 0; table < 2; ++table)
+                length += 17 + GetSymbolCount(GetHuffmanTables(ac)[table]);
+        }
+        WriteMarker(0xc4, length);
+        for (bool ac : {false, true}) {
+            for (int table = 0; table < 2; ++table) {
+                const HuffmanTable& huffman = GetHuffmanTables(ac)[table];
+                mOut += static_cast<char>((ac ? 0x10 : 0) | table);
+                mOut.append(reinterpret_cast<const char*>(huffman.counts), 16);
+                mOut.append(reinterpret_cast<const char*>(huffman.symbols), GetSymbolCount(huffman));
+            }
+        }
+
+        WriteMarker(0xda, 10);
+        mOut.append("\x03\x01\x00\x02\x11\x03\x11\x00\x3f\x00", 10);
+    }
+
+    // Bytes of 0xff in the entropy-coded data are followed by a 0
+    void WriteBits(uint32_t bits, unsigned count) {
+        mBits = (mBits << count) | (bits & ((1u << count) - 1));
+        mBitCount += count;
+        while (mBitCount >= 8) {
+            mBitCount -= 8;
+            const auto byte = static_cast<uint8_t>(mBits >> mBitCount);
+            mOut += static_cast<char>(byte);
+            if (byte == 0xff)
+                mOut += '\0';
+        }
+        mBits &= (1u << mBitCount) - 1;
+    }
+
+    // The Huffman code of (run << 4 | size of value), then size bits of value (minus 1
+    // when it is negative)
+    void WriteValue(const HuffmanTable& table, unsigned run, int value) {
+        const unsigned magnitude = static_cast<unsigned>(std::abs(value));
+        const unsigned size = magnitude == 0 ? 0 : std::bit_width(magnitude);
+        const unsigned symbol = (run << 4) | size;
+        WriteBits(table.codes[symbol], table.lengths[symbol]);
+        if (size > 0)
+            WriteBits(static_cast<uint32_t>(value < 0 ? value - 1 : value), size);
+    }
+
+    // Forward DCT of 8x8 samples centered on 0, then quantized and coded in zigzag order
+    void EncodeBlock(const float* samples, int table, int& prediction) {
+        // By position then frequency: the weight of position x in frequency u
+        static const auto kTable = [] {
+            std::array<float, 64> weights{};
+            for (int x = 0; x < 8; ++x) {
+                for (int u = 0; u < 8; ++u)
+                    weights[x * 8 + u] = static_cast<float>((u == 0 ? std::sqrt(0.125) : 0.5) * std::cos((2 * x + 1) * u * kPi / 16));
+            }
+            return weights;
+        }();
+
+        float rows[64] = {};
+        for (int y = 0; y < 8; ++y) {
+            for (int x = 0; x < 8; ++x) {
+                const float sample = samples[y * 8 + x];
+                for (int u = 0; u < 8; ++u)
+                    rows[y * 8 + u] += sample * kTable[x * 8 + u];
+            }
+        }
+        int coefficients[64];
+        for (int v = 0; v < 8; ++v) {
+            float sums[8] = {};
+            for (int y = 0; y < 8; ++y) {
+                const float weight = kTable[y * 8 + v];
+                for (int u = 0; u < 8; ++u)
+                    sums[u] += weight * rows[y * 8 + u];
+            }
+            // Rounded half away from zero, without the function call of lround
+            for (int u = 0; u < 8; ++u) {
+                const float quantized = sums[u] * mReciprocals[table][v * 8 + u];
+                coefficients[v * 8 + u] = static_cast<int>(quantized + (quantized < 0 ? -0.5f : 0.5f));
+            }
+        }
+
+        WriteValue(GetHuffmanTables(false)[table], 0, coefficients[0] - prediction);
+        prediction = coefficients[0];
+        const HuffmanTable& ac = GetHuffmanTables(true)[table];
+        unsigned run = 0;
+        for (int index = 1; index < 64; ++index) {
+            const int coefficient = coefficients[kZigzag[index]];
+            if (coefficient == 0) {
+                ++run;
+                continue;
+            }
+            // Runs of 16 zeros, then the run of the value
+            for (; run >= 16; run -= 16)
+                WriteBits(ac.codes[0xf0], ac.lengths[0xf0]);
+            WriteValue(ac, run, coefficient);
+            run = 0;
+        }
+        // End of block
+        if (run > 0)
+            WriteBits(ac.codes[0], ac.lengths[0]);
+    }
+
+    uint8_t mQuantization[2][64];
+    float mReciprocals[2][64];
+    std::string mOut;
+    uint32_t mBits{0};
+    unsigned mBitCount{0};
+};
+
+uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+    static const auto kTable = [] {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t index = 0; index < 256; ++index) {
+            uint32_t value = index;
+            for (int bit = 0; bit < 8; ++bit)
+                value = value & 1 ? 0xedb88320 ^ (value >> 1) : value >> 1;
+            table[index] = value;
+        }
+        return table;
+    }();
+    crc = ~crc;
+    for (size_t index = 0; index < size; ++index)
+        crc = kTable[(crc ^ data[index]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+void AppendBigEndian32(std::string& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(static_cast<char>((value >> shift) & 0xff));
+}
+
+void AppendPngChunk(std::string& out, const char* type, const std::string& payload) {
+    AppendBigEndian32(out, static_cast<uint32_t>(payload.size()));
+    const size_t start = out.size();
+    out.append(type, 4);
+    out += payload;
+    const auto* body = reinterpret_cast<const uint8_t*>(out.data() + start);
+    AppendBigEndian32(out, Crc32(body, out.size() - start));
+}
+
+// Source pixels covered by each pixel of a resized axis, and their weights (summing to 1)
+struct Coverage {
+    uint32_t first{0};
+    std::vector<float> weights;
+};
+
+std::vector<Coverage> GetCoverage(uint32_t source, uint32_t target) {
+    std::vector<Coverage> coverage(target);
+    const double scale = double(source) / target;
+    for (uint32_t index = 0; index < target; ++index) {
+        const double start = index * scale;
+        const double end = std::min<double>(source, (index + 1) * scale);
+        auto& pixel = coverage[index];
+        pixel.first = std::min(static_cast<uint32_t>(start), source - 1);
+        const uint32_t last = std::max(pixel.first + 1, std::min(static_cast<uint32_t>(std::ceil(end)), source));
+        double total = 0;
+        for (uint32_t covered = pixel.first; covered < last; ++covered) {
+            const double weight = std::max(0.0, std::min<double>(end, covered + 1) - std::max<double>(start, covered));
+            pixel.weights.push_back(static_cast<float>(weight));
+            total += weight;
+        }
+        for (auto& weight : pixel.weights)
+            weight = total > 0 ? static_cast<float>(weight / total) : 1.0f / pixel.weights.size();
+    }
+    return coverage;
+}
+
+}  // namespace
+
+bool DecodeImage(const uint8_t* data, size_t size, Bitmap& bitmap, uint32_t minSize) {
+    static constexpr uint8_t kPngSignature[8] = {0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a};
+    if (size >= 8 && std::memcmp(data, kPngSignature, 8) == 0)
+        return DecodePng(data, size, bitmap);
+    if (size >= 4 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff)
+        return JpegDecoder(data, size).Decode(bitmap, minSize);
+    return false;
+}
+
+bool DecodeImageFile(const std::string& path, Bitmap& bitmap, uint32_t minSize) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "imageDecode");
+    try {
+        MappedFile file(path);
+        metrics.AddBytesIn(file.GetSize());
+        if (file.GetData() != nullptr && DecodeImage(file.GetData(), file.GetSize(), bitmap, minSize))
+            return true;
+    } catch (const AddonError&) {
+    }
+    metrics.Fail();
+    return false;
+}
+
+Bitmap ResizeBitmap(const Bitmap& source, uint32_t width, uint32_t height) {
+    Bitmap target;
+    if (width == 0 || height == 0 || source.width == 0 || source.height == 0)
+        return target;
+    target.width = width;
+    target.height = height;
+    target.pixels.resize(size_t(width) * height * 4);
+
+    // Columns first, premultiplied by alpha, then rows
+    const auto columns = GetCoverage(source.width, width);
+    const auto rows = GetCoverage(source.height, height);
+    std::vector<float> horizontal(size_t(width) * source.height * 4);
+    for (uint32_t y = 0; y < source.height; ++y) {
+        const uint8_t* in = source.pixels.data() + size_t(y) * source.width * 4;
+        float* out = horizontal.data() + size_t(y) * width * 4;
+        for (uint32_t x = 0; x < width; ++x, out += 4) {
+            const auto& column = columns[x];
+            for (size_t index = 0; index < column.weights.size(); ++index) {
+                const uint8_t* pixel = in + (column.first + index) * 4;
+                const float alpha = column.weights[index] * pixel[3];
+                out[0] += alpha * pixel[0];
+                out[1] += alpha * pixel[1];
+                out[2] += alpha * pixel[2];
+                out[3] += alpha;
+            }
+        }
+    }
+
+    uint8_t* out = target.pixels.data();
+    for (uint32_t y = 0; y < height; ++y) {
+        const auto& row = rows[y];
+        for (uint32_t x = 0; x < width; ++x, out += 4) {
+            float sums[4] = {};
+            for (size_t index = 0; index < row.weights.size(); ++index) {
+                const float* pixel = horizontal.data() + ((row.first + index) * size_t(width) + x) * 4;
+                for (int channel = 0; channel < 4; ++channel)
+                    sums[channel] += row.weights[index] * pixel[channel];
+            }
+            for (int channel = 0; channel < 3; ++channel)
+                out[channel] = sums[3] > 0 ? Clamp(static_cast<int>(std::lround(sums[channel] / sums[3]))) : 0;
+            out[3] = Clamp(static_cast<int>(std::lround(sums[3])));
+        }
+    }
+    return target;
+}
+
+std::string EncodePng(const uint8_t* pixels, uint32_t width, uint32_t height, unsigned channels) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "imageEncode");
+    static constexpr uint8_t kColorTypes[5] = {0, 0, 4, 2, 6};
+    const size_t stride = size_t(width) * channels;
+    const PixelKernels& kernels = GetPixelKernels();
+
+    // Each row takes the filter whose output has the smallest sum of magnitudes, which
+    // tends to compress best
+    std::vector<uint8_t> filtered;
+    filtered.reserve((stride + 1) * height);
+    std::vector<uint8_t> candidates[4];
+    for (auto& candidate : candidates)
+        candidate.resize(stride);
+    const std::vector<uint8_t> zeros(stride, 0);
+    for (uint32_t y = 0; y < height; ++y) {
+        const uint8_t* row = pixels + y * stride;
+        const uint8_t* up = y > 0 ? row - stride : zeros.data();
+        const size_t left = std::min<size_t>(channels, stride);
+        uint8_t* sub = candidates[1].data();
+        uint8_t* above = candidates[2].data();
+        uint8_t* paeth = candidates[3].data();
+        kernels.subtract(above, row, up, stride);
+        // The first pixel has no left neighbor: Sub keeps it, Paeth predicts it from above
+        std::copy(row, row + left, sub);
+        std::copy(above, above + left, paeth);
+        kernels.subtract(sub + left, row + left, row, stride - left);
+        kernels.paeth(paeth + left, row + left, row, up + left, up, stride - left);
+
+        uint64_t best = UINT64_MAX;
+        size_t chosen = 0;
+        for (size_t filter = 0; filter < 4; ++filter) {
+            const uint64_t sum = kernels.sumMagnitudes(filter == 0 ? row : candidates[filter].data(), stride);
+            if (sum < best) {
+                best = sum;
+                chosen = filter;
+            }
+        }
+        // The filter types are None (0), Sub (1), Up (2) and Paeth (4)
+        const uint8_t* out = chosen == 0 ? row : candidates[chosen].data();
+        filtered.push_back(static_cast<uint8_t>(chosen == 3 ? 4 : chosen));
+        filtered.insert(filtered.end(), out, out + stride);
+    }
+    metrics.AddBytesIn(stride * height);
+
+    std::string header;
+    AppendBigEndian32(header, width);
+    AppendBigEndian32(header, height);
+    header += static_cast<char>(8);
+    header += static_cast<char>(kColorTypes[channels]);
+    header.append(3, '\0');
+
+    std::string png("\x89PNG\r\n\x1a\n", 8);
+    AppendPngChunk(png, "IHDR", header);
+    AppendPngChunk(png, "IDAT", Deflater().Deflate(filtered.data(), filtered.size()));
+    AppendPngChunk(png, "IEND", std::string());
+    metrics.AddBytesOut(png.size());
+    return png;
+}
+
+std::string EncodeJpeg(const uint8_t* rgba, uint32_t width, uint32_t height, unsigned quality) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "imageEncode");
+    metrics.AddBytesIn(size_t(width) * height * 4);
+    std::string jpeg = JpegEncoder(quality).Encode(rgba, width, height);
+    metrics.AddBytesOut(jpeg.size());
+    return jpeg;
+}
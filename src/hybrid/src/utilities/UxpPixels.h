@@ -0,0 +1,56 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** Decodes PNG and JPEG images to 8-bit RGBA pixels, resizes them, and encodes PNG and
+ baseline JPEG files.
+
+ PNG: every color type and bit depth, interlaced or not; 16-bit samples are rounded to
+ 8 bits. JPEG: baseline and progressive Huffman-coded images, grayscale, YCbCr or RGB;
+ subsampled chroma is replicated rather than interpolated. Arithmetic-coded, lossless,
+ 12-bit and CMYK JPEGs aren't supported, nor are WebP and GIF (see ProbeImage for their
+ dimensions).
+ A JPEG can also be decoded at 1/8 of its size from the DC coefficient of each block,
+ skipping the inverse DCT and, for progressive images, the scans of the other
+ coefficients: hashes and placeholders only need that much (see minSize).
+*/
+
+struct Bitmap {
+    uint32_t width{0};
+    uint32_t height{0};
+    // RGBA, not premultiplied, row after row
+    std::vector<uint8_t> pixels;
+};
+
+// Decode an image. With minSize, a smaller bitmap may be returned as long as both of its
+// dimensions are at least minSize. Returns false if the data isn't a supported image or
+// is corrupt.
+bool DecodeImage(const uint8_t* data, size_t size, Bitmap& bitmap, uint32_t minSize = 0);
+
+// Returns false if the file can't be read or isn't a supported image
+bool DecodeImageFile(const std::string& path, Bitmap& bitmap, uint32_t minSize = 0);
+
+// Resample to width x height, averaging the source pixels covered by each pixel (weighted
+// by their alpha, so that transparent pixels don't bleed their color)
+Bitmap ResizeBitmap(const Bitmap& source, uint32_t width, uint32_t height);
+
+// Encode pixels of channels components (1 for gray, 2 gray and alpha, 3 RGB or 4 RGBA)
+// as a PNG file
+std::string EncodePng(const uint8_t* pixels, uint32_t width, uint32_t height, unsigned channels);
+
+// Encode RGBA pixels, alpha ignored, as a baseline JPEG file with chroma subsampled by 2
+// both ways. quality is 1 to 100, as for libjpeg.
+std::string EncodeJpeg(const uint8_t* rgba, uint32_t width, uint32_t height, unsigned quality);
@@ -0,0 +1,166 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+
+#include "UxpPlaceholder.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "UxpPixels.h"
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+
+void AppendBase83(std::string& out, unsigned value, int digits) {
+    static constexpr char kDigits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz#$%*+,-.:;=?@[]^_{|}~";
+    unsigned divisor = 1;
+    for (int digit = 1; digit < digits; ++digit)
+        divisor *= 83;
+    for (; divisor > 0; divisor /= 83)
+        out += kDigits[value / divisor % 83];
+}
+
+double SrgbToLinear(uint8_t value) {
+    static const auto kTable = [] {
+        std::array<double, 256> table{};
+        for (int index = 0; index < 256; ++index) {
+            const double x = index / 255.0;
+            table[index] = x <= 0.04045 ? x / 12.92 : std::pow((x + 0.055) / 1.055, 2.4);
+        }
+        return table;
+    }();
+    return kTable[value];
+}
+
+unsigned LinearToSrgb(double value) {
+    const double x = std::clamp(value, 0.0, 1.0);
+    return static_cast<unsigned>((x <= 0.0031308 ? x * 12.92 : 1.055 * std::pow(x, 1 / 2.4) - 0.055) * 255 + 0.5);
+}
+
+// An AC component, from -maximum to maximum, quantized to 19 levels on a square root scale
+unsigned QuantizeComponent(double value, double maximum) {
+    const double scaled = value / maximum;
+    const double root = std::copysign(std::sqrt(std::abs(scaled)), scaled);
+    return static_cast<unsigned>(std::clamp(std::floor(root * 9 + 9.5), 0.0, 18.0));
+}
+
+void GetDominantColor(const Bitmap& bitmap, uint8_t color[3]) {
+    struct Bin {
+        double weight{0};
+        double sums[3]{0, 0, 0};
+    };
+    std::vector<Bin> bins(512);
+    const size_t count = size_t(bitmap.width) * bitmap.height;
+    for (size_t index = 0; index < count; ++index) {
+        const uint8_t* pixel = &bitmap.pixels[index * 4];
+        Bin& bin = bins[(pixel[0] >> 5) << 6 | (pixel[1] >> 5) << 3 | pixel[2] >> 5];
+        bin.weight += pixel[3];
+        for (int channel = 0; channel < 3; ++channel)
+            bin.sums[channel] += double(pixel[channel]) * pixel[3];
+    }
+    const Bin& dominant = *std::max_element(bins.begin(), bins.end(), [](const Bin& a, const Bin& b) { return a.weight < b.weight; });
+    for (int channel = 0; channel < 3; ++channel)
+        color[channel] = dominant.weight > 0 ? static_cast<uint8_t>(std::lround(dominant.sums[channel] / dominant.weight)) : 0;
+}
+
+}  // namespace
+
+std::string EncodeBlurHash(const Bitmap& bitmap, unsigned componentsX, unsigned componentsY) {
+    const uint32_t width = bitmap.width;
+    const uint32_t height = bitmap.height;
+    std::vector<double> linear(size_t(width) * height * 3);
+    for (size_t index = 0; index < linear.size() / 3; ++index) {
+        for (int channel = 0; channel < 3; ++channel)
+            linear[index * 3 + channel] = SrgbToLinear(bitmap.pixels[index * 4 + channel]);
+    }
+    // cos(pi * frequency * position / size) by frequency then position, for each axis
+    const auto basis = [](unsigned components, uint32_t size) {
+        std::vector<double> table(size_t(components) * size);
+        for (unsigned frequency = 0; frequency < components; ++frequency) {
+            for (uint32_t position = 0; position < size; ++position)
+                table[size_t(frequency) * size + position] = std::cos(kPi * frequency * position / size);
+        }
+        return table;
+    };
+    const std::vector<double> columns = basis(componentsX, width);
+    const std::vector<double> rows = basis(componentsY, height);
+
+    // The DC component, then the AC components row after row
+    std::vector<std::array<double, 3>> factors;
+    for (unsigned j = 0; j < componentsY; ++j) {
+        for (unsigned i = 0; i < componentsX; ++i) {
+            std::array<double, 3> sums{};
+            for (uint32_t y = 0; y < height; ++y) {
+                const double rowWeight = rows[size_t(j) * height + y];
+                for (uint32_t x = 0; x < width; ++x) {
+                    const double weight = rowWeight * columns[size_t(i) * width + x];
+                    const double* pixel = &linear[(size_t(y) * width + x) * 3];
+                    for (int channel = 0; channel < 3; ++channel)
+                        sums[channel] += weight * pixel[channel];
+                }
+            }
+            const double scale = (i == 0 && j == 0 ? 1.0 : 2.0) / (double(width) * height);
+            for (double& sum : sums)
+                sum *= scale;
+            factors.push_back(sums);
+        }
+    }
+
+    std::string hash;
+    AppendBase83(hash, (componentsX - 1) + (componentsY - 1) * 9, 1);
+    double maximum = 1;
+    if (factors.size() > 1) {
+        double largest = 0;
+        for (size_t index = 1; index < factors.size(); ++index) {
+            for (double value : factors[index])
+                largest = std::max(largest, std::abs(value));
+        }
+        const auto quantized = static_cast<unsigned>(std::clamp(std::floor(largest * 166 - 0.5), 0.0, 82.0));
+        maximum = (quantized + 1) / 166.0;
+        AppendBase83(hash, quantized, 1);
+    } else {
+        AppendBase83(hash, 0, 1);
+    }
+    const auto& dc = factors[0];
+    AppendBase83(hash, LinearToSrgb(dc[0]) << 16 | LinearToSrgb(dc[1]) << 8 | LinearToSrgb(dc[2]), 4);
+    for (size_t index = 1; index < factors.size(); ++index) {
+        const auto& ac = factors[index];
+        AppendBase83(hash,
+                     QuantizeComponent(ac[0], maximum) * 19 * 19 + QuantizeComponent(ac[1], maximum) * 19 + QuantizeComponent(ac[2], maximum),
+                     2);
+    }
+    return hash;
+}
+
+Placeholder ComputePlaceholder(const Bitmap& bitmap, unsigned componentsX, unsigned componentsY) {
+    Placeholder placeholder;
+    if (bitmap.width == 0 || bitmap.height == 0)
+        return placeholder;
+    const Bitmap* reduced = &bitmap;
+    Bitmap resized;
+    const uint32_t longer = std::max(bitmap.width, bitmap.height);
+    if (longer > kPlaceholderSize) {
+        const auto width = std::max<uint32_t>(1, static_cast<uint32_t>(uint64_t(bitmap.width) * kPlaceholderSize / longer));
+        const auto height = std::max<uint32_t>(1, static_cast<uint32_t>(uint64_t(bitmap.height) * kPlaceholderSize / longer));
+        resized = ResizeBitmap(bitmap, width, height);
+        reduced = &resized;
+    }
+    if (componentsX == 0 || componentsY == 0) {
+        componentsX = bitmap.width >= bitmap.height ? 4 : 3;
+        componentsY = bitmap.width >= bitmap.height ? 3 : 4;
+    }
+    placeholder.blurHash = EncodeBlurHash(*reduced, componentsX, componentsY);
+    GetDominantColor(*reduced, placeholder.color);
+    return placeholder;
+}
@@ -0,0 +1,44 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+struct Bitmap;
+
+/** Placeholders painted while an image loads (placeholders): a BlurHash and a dominant
+ color, a few dozen bytes per image that can be stored with it.
+
+ Both are computed from a reduction of the image to at most kPlaceholderSize pixels on its
+ longer side, so JPEGs only need to be decoded at 1/8 (see DecodeImage):
+ - BlurHash (https://blurha.sh): the lowest frequencies of the DCT of the linear RGB of the
+   image, quantized to base 83 characters. Decoders draw them back as a blurred image of
+   any size.
+ - The dominant color: the mean of the pixels of the most populated bin of a histogram of
+   8 levels per component, weighted by alpha. Unlike the mean of the image, it is a color
+   that the image has.
+*/
+
+constexpr uint32_t kPlaceholderSize = 64;
+
+struct Placeholder {
+    std::string blurHash;
+    uint8_t color[3]{0, 0, 0};
+};
+
+// componentsX and componentsY (1 to 9) are the frequencies kept along the width and the
+// height; 0 picks 4 along the longer side and 3 along the other
+Placeholder ComputePlaceholder(const Bitmap& bitmap, unsigned componentsX = 0, unsigned componentsY = 0);
+
+// The BlurHash of bitmap, of 4 + 2 * componentsX * componentsY characters
+std::string EncodeBlurHash(const Bitmap& bitmap, unsigned componentsX, unsigned componentsY);
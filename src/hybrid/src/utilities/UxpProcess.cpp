@@ -0,0 +1,998 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpProcess.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <set>
+#include <thread>
+
+#include "UxpAddon.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <crt_externs.h>
+#define environ (*_NSGetEnviron())
+#else
+extern char** environ;
+#endif
+#endif
+
+namespace {
+
+// Granularity at which a waiting process checks its cancellation token
+constexpr int kPollInterval = 50;  // milliseconds
+
+constexpr size_t kReadBufferSize = 64 * 1024;
+
+// The processes that are running, so that Shutdown can kill them
+std::mutex gRunningMutex;
+std::set<Process*> gRunning;
+std::atomic<bool> gStopping{false};
+
+[[noreturn]] void ThrowSpawnError(const std::string& program, const std::string& reason) {
+    throw AddonError(UXP_ADDON_SPAWN_ERROR, "Unable to start " + program + ": " + reason);
+}
+
+// Number of bytes at the end of text that form an incomplete UTF-8 sequence
+size_t IncompleteUtf8Tail(const std::string& text) {
+    for (size_t count = 1; count <= 4 && count <= text.size(); ++count) {
+        const unsigned char c = static_cast<unsigned char>(text[text.size() - count]);
+        if ((c & 0xC0) == 0x80)
+            continue;  // continuation byte
+        const size_t expected = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        return expected > count ? count : 0;
+    }
+    return 0;
+}
+
+#ifdef _WIN32
+
+std::wstring Widen(const std::string& text) {
+    if (text.empty())
+        return std::wstring();
+    const int length = MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), nullptr, 0);
+    std::wstring result(length, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), &result[0], length);
+    return result;
+}
+
+std::string LastErrorMessage() {
+    char* buffer = nullptr;
+    const DWORD length = FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM |
+                                            FORMAT_MESSAGE_IGNORE_INSERTS,
+                                        nullptr, GetLastError(), 0, reinterpret_cast<LPSTR>(&buffer), 0, nullptr);
+    if (buffer == nullptr)
+        return "unknown error";
+    std::string message(buffer, length);
+    LocalFree(buffer);
+    while (!message.empty() && (message.back() == '\n' || message.back() == '\r'))
+        message.pop_back();
+    return message;
+}
+
+// Quote an argument so that CommandLineToArgvW (and the CRT) parse it back unchanged
+void AppendQuoted(std::wstring& commandLine, const std::wstring& arg) {
+    if (!commandLine.empty())
+        commandLine += L' ';
+    if (!arg.empty() && arg.find_first_of(L" \t\n\v\"") == std::wstring::npos) {
+        commandLine += arg;
+        return;
+    }
+
+    commandLine += L'"';
+    for (auto iter = arg.begin();; ++iter) {
+        size_t backslashes = 0;
+        while (iter != arg.end() && *iter == L'\\') {
+            ++iter;
+            ++backslashes;
+        }
+        if (iter == arg.end()) {
+            commandLine.append(backslashes * 2, L'\\');
+            break;
+        }
+        if (*iter == L'"')
+            commandLine.append(backslashes * 2 + 1, L'\\');
+        else
+            commandLine.append(backslashes, L'\\');
+        commandLine += *iter;
+    }
+    commandLine += L'"';
+}
+
+struct CaseInsensitiveLess {
+    bool operator()(const std::wstring& lhs, const std::wstring& rhs) const {
+        return _wcsicmp(lhs.c_str(), rhs.c_str()) < 0;
+    }
+};
+
+// The environment of the host with the given overrides, as a sorted CreateProcess block
+std::wstring BuildEnvironmentBlock(const std::map<std::string, std::string>& overrides) {
+    std::map<std::wstring, std::wstring, CaseInsensitiveLess> variables;
+    wchar_t* strings = GetEnvironmentStringsW();
+    for (const wchar_t* entry = strings; entry != nullptr && *entry != L'\0'; entry += wcslen(entry) + 1) {
+        // Skip the leading '=' of the per-drive variables (=C:=C:\...) when looking for the separator
+        const wchar_t* separator = wcschr(entry + 1, L'=');
+        if (separator != nullptr)
+            variables[std::wstring(entry, separator)] = separator + 1;
+    }
+    if (strings != nullptr)
+        FreeEnvironmentStringsW(strings);
+
+    for (const auto& entry : overrides)
+        variables[Widen(entry.first)] = Widen(entry.second);
+
+    std::wstring block;
+    for (const auto& entry : variables) {
+        block += entry.first;
+        block += L'=';
+        block += entry.second;
+        block += L'\0';
+    }
+    block += L'\0';
+    return block;
+}
+
+#else
+
+void CloseFd(int& fd) {
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+#ifdef __APPLE__
+// There is no pipe2: the pipes are created and made close-on-exec while holding this lock,
+// which the spawns hold too, so that a concurrent spawn can't inherit them in between
+std::mutex gSpawnMutex;
+#endif
+
+void MakePipe(int fds[2]) {
+#ifdef __APPLE__
+    if (pipe(fds) != 0)
+        throw AddonError(UXP_ADDON_SPAWN_ERROR, std::string("Unable to create a pipe: ") + std::strerror(errno));
+    for (int index = 0; index < 2; ++index)
+        fcntl(fds[index], F_SETFD, FD_CLOEXEC);
+#else
+    if (pipe2(fds, O_CLOEXEC) != 0)
+        throw AddonError(UXP_ADDON_SPAWN_ERROR, std::string("Unable to create a pipe: ") + std::strerror(errno));
+#endif
+}
+
+// The environment of the host with the given overrides
+std::vector<std::string> BuildEnvironment(const std::map<std::string, std::string>& overrides) {
+    std::vector<std::string> variables;
+    for (char** entry = environ; entry != nullptr && *entry != nullptr; ++entry) {
+        const char* separator = std::strchr(*entry, '=');
+        if (separator == nullptr || overrides.count(std::string(*entry, separator - *entry)) == 0)
+            variables.emplace_back(*entry);
+    }
+    for (const auto& entry : overrides)
+        variables.push_back(entry.first + "=" + entry.second);
+    return variables;
+}
+
+#endif
+
+}  // namespace
+
+#ifdef _WIN32
+
+Process::Process(const ProcessOptions& options) {
+    if (options.args.empty() || options.args[0].empty())
+        throw AddonError(UXP_ADDON_SPAWN_ERROR, "No program to run");
+
+    std::wstring commandLine;
+    if (!options.commandLine.empty()) {
+        commandLine = Widen(options.commandLine);
+    } else {
+        for (const auto& arg : options.args)
+            AppendQuoted(commandLine, Widen(arg));
+    }
+
+    // Parent ends of the pipes are kept in the members, child ends in childStdio
+    SECURITY_ATTRIBUTES inheritable = {sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+    HANDLE childStdio[3] = {nullptr, nullptr, nullptr};
+    auto closeChildHandles = [&]() {
+        for (HANDLE& handle : childStdio) {
+            if (handle != nullptr && handle != INVALID_HANDLE_VALUE && (&handle != &childStdio[2] || !options.mergeStderr))
+                CloseHandle(handle);
+            handle = nullptr;
+        }
+    };
+    auto openNul = [&](DWORD access) {
+        HANDLE nul = CreateFileW(L"NUL", access, FILE_SHARE_READ | FILE_SHARE_WRITE, &inheritable, OPEN_EXISTING, 0,
+                                 nullptr);
+        return nul == INVALID_HANDLE_VALUE ? nullptr : nul;
+    };
+    // Creates a pipe; the end kept by the parent is made non-inheritable
+    auto makePipe = [&](void*& parentEnd, HANDLE& childEnd, bool childReads) {
+        HANDLE read = nullptr, write = nullptr;
+        if (!CreatePipe(&read, &write, &inheritable, 0))
+            return false;
+        parentEnd = childReads ? write : read;
+        childEnd = childReads ? read : write;
+        SetHandleInformation(static_cast<HANDLE>(parentEnd), HANDLE_FLAG_INHERIT, 0);
+        return true;
+    };
+
+    bool ready = options.pipeStdin ? makePipe(mStdin, childStdio[0], true)
+                                   : (childStdio[0] = openNul(GENERIC_READ)) != nullptr;
+    ready = ready && makePipe(mStdout, childStdio[1], false);
+    if (ready) {
+        if (options.mergeStderr)
+            childStdio[2] = childStdio[1];
+        else if (options.discardStderr)
+            ready = (childStdio[2] = openNul(GENERIC_WRITE)) != nullptr;
+        else
+            ready = makePipe(mStderr, childStdio[2], false);
+    }
+    if (!ready) {
+        const std::string reason = LastErrorMessage();
+        closeChildHandles();
+        ClosePipes();
+        ThrowSpawnError(options.args[0], reason);
+    }
+    // Write waits for room in the pipe itself, so that it can check its token
+    if (mStdin != nullptr) {
+        DWORD mode = PIPE_READMODE_BYTE | PIPE_NOWAIT;
+        SetNamedPipeHandleState(static_cast<HANDLE>(mStdin), &mode, nullptr, nullptr);
+    }
+
+    // Only hand the child its own pipes, not the inheritable handles of concurrent spawns
+    const DWORD inheritedCount = options.mergeStderr ? 2 : 3;
+    SIZE_T attributesSize = 0;
+    InitializeProcThreadAttributeList(nullptr, 1, 0, &attributesSize);
+    std::vector<char> attributesBuffer(attributesSize);
+    auto attributes = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(attributesBuffer.data());
+    if (!InitializeProcThreadAttributeList(attributes, 1, 0, &attributesSize) ||
+        !UpdateProcThreadAttribute(attributes, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, childStdio,
+                                   inheritedCount * sizeof(HANDLE), nullptr, nullptr)) {
+        const std::string reason = LastErrorMessage();
+        closeChildHandles();
+        ClosePipes();
+        ThrowSpawnError(options.args[0], reason);
+    }
+
+    STARTUPINFOEXW startup = {};
+    startup.StartupInfo.cb = sizeof(startup);
+    startup.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+    startup.StartupInfo.hStdInput = childStdio[0];
+    startup.StartupInfo.hStdOutput = childStdio[1];
+    startup.StartupInfo.hStdError = childStdio[2];
+    startup.lpAttributeList = attributes;
+
+    std::wstring environment;
+    if (!options.env.empty())
+        environment = BuildEnvironmentBlock(options.env);
+    const std::wstring cwd = Widen(options.cwd);
+
+    PROCESS_INFORMATION info = {};
+    const DWORD flags = CREATE_NO_WINDOW | CREATE_UNICODE_ENVIRONMENT | CREATE_SUSPENDED | EXTENDED_STARTUPINFO_PRESENT;
+    const BOOL created = CreateProcessW(nullptr, &commandLine[0], nullptr, nullptr, TRUE, flags,
+                                        environment.empty() ? nullptr : &environment[0],
+                                        cwd.empty() ? nullptr : cwd.c_str(), &startup.StartupInfo, &info);
+    const std::string reason = created ? std::string() : LastErrorMessage();
+    DeleteProcThreadAttributeList(attributes);
+    closeChildHandles();
+    if (!created) {
+        ClosePipes();
+        ThrowSpawnError(options.args[0], reason);
+    }
+
+    // The job lets Kill terminate the whole process tree
+    mJob = CreateJobObjectW(nullptr, nullptr);
+    if (mJob != nullptr) {
+        JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits = {};
+        limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+        SetInformationJobObject(mJob, JobObjectExtendedLimitInformation, &limits, sizeof(limits));
+        AssignProcessToJobObject(mJob, info.hProcess);
+    }
+    ResumeThread(info.hThread);
+    CloseHandle(info.hThread);
+    mProcess = info.hProcess;
+    Register(options.args[0]);
+}
+
+Process::~Process() {
+    Unregister();
+    Kill();
+    ClosePipes();
+    if (mJob != nullptr)
+        CloseHandle(mJob);
+    if (mProcess != nullptr)
+        CloseHandle(mProcess);
+}
+
+int Process::Wait(const OutputHandler& onStdout, const OutputHandler& onStderr, const CancellationToken* token) {
+    // Anonymous pipes can't be waited on, each one gets a blocking reader thread
+    std::mutex handlerMutex;
+    std::atomic<int> openPipes{0};
+    std::vector<std::thread> readers;
+    auto startReader = [&](HANDLE pipe, const OutputHandler& handler) {
+        if (pipe == nullptr)
+            return;
+        ++openPipes;
+        readers.emplace_back([&, pipe]() {
+            std::vector<char> buffer(kReadBufferSize);
+            DWORD read = 0;
+            while (ReadFile(pipe, buffer.data(), static_cast<DWORD>(buffer.size()), &read, nullptr) && read > 0) {
+                if (handler != nullptr) {
+                    std::lock_guard<std::mutex> lock(handlerMutex);
+                    handler(buffer.data(), read);
+                }
+            }
+            --openPipes;
+        });
+    };
+    startReader(static_cast<HANDLE>(mStdout), onStdout);
+    startReader(static_cast<HANDLE>(mStderr), onStderr);
+
+    bool cancelled = false;
+    while (!Reap(false) || openPipes > 0) {
+        if (!cancelled && (mAborted || (token != nullptr && token->IsCancelled()))) {
+            // Terminating the job closes the pipes of the whole tree, which ends the readers
+            Kill();
+            cancelled = true;
+        }
+        if (!mExited)
+            WaitForSingleObject(static_cast<HANDLE>(mProcess), kPollInterval);
+        else
+            Sleep(10);
+    }
+    for (auto& reader : readers)
+        reader.join();
+    ClosePipes();
+
+    if (cancelled && token != nullptr)
+        token->ThrowIfCancelled();
+    // Killed by Shutdown: the exit code is not the child's own
+    if (mAborted)
+        throw OperationCancelled(false);
+    return mExitCode;
+}
+
+bool Process::Reap(bool block) {
+    std::lock_guard<std::mutex> lock(mKillMutex);
+    if (mExited)
+        return true;
+    if (WaitForSingleObject(static_cast<HANDLE>(mProcess), block ? INFINITE : 0) != WAIT_OBJECT_0)
+        return false;
+
+    DWORD exitCode = 0;
+    GetExitCodeProcess(static_cast<HANDLE>(mProcess), &exitCode);
+    mExitCode = static_cast<int>(exitCode);
+    mExited = true;
+    return true;
+}
+
+void Process::Kill() {
+    std::lock_guard<std::mutex> lock(mKillMutex);
+    if (mExited || mProcess == nullptr)
+        return;
+    if (mJob == nullptr || !TerminateJobObject(static_cast<HANDLE>(mJob), 1))
+        TerminateProcess(static_cast<HANDLE>(mProcess), 1);
+}
+
+bool Process::Write(const std::string& data, const CancellationToken* token) {
+    if (mStdin == nullptr)
+        return false;
+
+    size_t written = 0;
+    while (written < data.size()) {
+        DWORD count = 0;
+        const DWORD chunk = static_cast<DWORD>(std::min<size_t>(data.size() - written, kReadBufferSize));
+        if (!WriteFile(static_cast<HANDLE>(mStdin), data.data() + written, chunk, &count, nullptr))
+            return false;
+        written += count;
+        if (count == 0) {
+            // The pipe is full: the child isn't reading
+            if (token != nullptr)
+                token->ThrowIfCancelled();
+            if (mAborted)
+                throw OperationCancelled(false);
+            Sleep(1);
+        }
+    }
+    return true;
+}
+
+bool Process::ReadStdout(std::string& output, int timeout) {
+    if (mStdout == nullptr)
+        return false;
+
+    // Anonymous pipes don't support overlapped I/O: poll for available data instead
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    for (;;) {
+        DWORD available = 0;
+        if (!PeekNamedPipe(static_cast<HANDLE>(mStdout), nullptr, 0, nullptr, &available, nullptr))
+            return false;  // broken pipe: the child closed its stdout
+        if (available > 0) {
+            const size_t offset = output.size();
+            output.resize(offset + std::min<size_t>(available, kReadBufferSize));
+            DWORD read = 0;
+            if (!ReadFile(static_cast<HANDLE>(mStdout), &output[offset], static_cast<DWORD>(output.size() - offset),
+                          &read, nullptr)) {
+                output.resize(offset);
+                return false;
+            }
+            output.resize(offset + read);
+            return true;
+        }
+        if (timeout >= 0 && std::chrono::steady_clock::now() >= deadline)
+            return true;
+        Sleep(1);
+    }
+}
+
+void Process::ClosePipes() {
+    for (void** pipe : {&mStdin, &mStdout, &mStderr}) {
+        if (*pipe != nullptr) {
+            CloseHandle(static_cast<HANDLE>(*pipe));
+            *pipe = nullptr;
+        }
+    }
+}
+
+#else
+
+Process::Process(const ProcessOptions& options) {
+    if (options.args.empty() || options.args[0].empty())
+        throw AddonError(UXP_ADDON_SPAWN_ERROR, "No program to run");
+
+    int stdinPipe[2] = {-1, -1};
+    int stdoutPipe[2] = {-1, -1};
+    int stderrPipe[2] = {-1, -1};
+    auto closeChildEnds = [&]() {
+        CloseFd(stdinPipe[0]);
+        CloseFd(stdoutPipe[1]);
+        CloseFd(stderrPipe[1]);
+    };
+#ifdef __APPLE__
+    std::unique_lock<std::mutex> spawnLock(gSpawnMutex);
+#endif
+    try {
+        if (options.pipeStdin)
+            MakePipe(stdinPipe);
+        MakePipe(stdoutPipe);
+        if (!options.mergeStderr && !options.discardStderr)
+            MakePipe(stderrPipe);
+    } catch (...) {
+        closeChildEnds();
+        CloseFd(stdinPipe[1]);
+        CloseFd(stdoutPipe[0]);
+        throw;
+    }
+    mStdin = stdinPipe[1];
+    mStdout = stdoutPipe[0];
+    mStderr = stderrPipe[0];
+#ifdef F_SETNOSIGPIPE
+    if (mStdin != -1)
+        fcntl(mStdin, F_SETNOSIGPIPE, 1);
+#endif
+    // Write waits for room in the pipe itself, so that it can check its token
+    if (mStdin != -1)
+        fcntl(mStdin, F_SETFL, fcntl(mStdin, F_GETFL) | O_NONBLOCK);
+
+    std::vector<char*> argv;
+    for (const auto& arg : options.args)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    std::vector<std::string> environment;
+    std::vector<char*> envp;
+    if (!options.env.empty()) {
+        environment = BuildEnvironment(options.env);
+        for (auto& variable : environment)
+            envp.push_back(&variable[0]);
+        envp.push_back(nullptr);
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (options.pipeStdin)
+        posix_spawn_file_actions_adddup2(&actions, stdinPipe[0], 0);
+    else
+        posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, stdoutPipe[1], 1);
+    if (options.mergeStderr)
+        posix_spawn_file_actions_adddup2(&actions, stdoutPipe[1], 2);
+    else if (options.discardStderr)
+        posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    else
+        posix_spawn_file_actions_adddup2(&actions, stderrPipe[1], 2);
+    int result = 0;
+    if (!options.cwd.empty()) {
+#if defined(__APPLE__) || (defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 29))
+        result = posix_spawn_file_actions_addchdir_np(&actions, options.cwd.c_str());
+#else
+        result = ENOTSUP;
+#endif
+    }
+
+    // Own process group, so that Kill reaches the whole tree. Signals the host ignores
+    // (SIGPIPE in particular) are restored to their defaults for the child.
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    for (int signal : {SIGPIPE, SIGINT, SIGTERM, SIGHUP, SIGQUIT, SIGCHLD})
+        sigaddset(&defaults, signal);
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_setsigdefault(&attributes, &defaults);
+    posix_spawnattr_setsigmask(&attributes, &mask);
+    posix_spawnattr_setpgroup(&attributes, 0);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    if (result == 0) {
+        result = posix_spawnp(&mPid, argv[0], &actions, &attributes, argv.data(),
+                              envp.empty() ? environ : envp.data());
+    }
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&actions);
+#ifdef __APPLE__
+    spawnLock.unlock();
+#endif
+    closeChildEnds();
+
+    if (result != 0) {
+        mPid = -1;
+        ClosePipes();
+        ThrowSpawnError(options.args[0], std::strerror(result));
+    }
+
+    for (int fd : {mStdout, mStderr}) {
+        if (fd != -1)
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    Register(options.args[0]);
+}
+
+Process::~Process() {
+    Unregister();
+    Kill();
+    Reap(true);
+    ClosePipes();
+}
+
+int Process::Wait(const OutputHandler& onStdout, const OutputHandler& onStderr, const CancellationToken* token) {
+    std::vector<char> buffer(kReadBufferSize);
+    auto cancelIfRequested = [&]() {
+        if (mAborted || (token != nullptr && token->IsCancelled())) {
+            Kill();
+            Reap(true);
+            ClosePipes();
+            if (token != nullptr)
+                token->ThrowIfCancelled();
+            throw OperationCancelled(false);
+        }
+    };
+
+    while (mStdout != -1 || mStderr != -1) {
+        cancelIfRequested();
+
+        pollfd fds[2];
+        nfds_t count = 0;
+        for (int fd : {mStdout, mStderr}) {
+            if (fd != -1)
+                fds[count++] = {fd, POLLIN, 0};
+        }
+        if (poll(fds, count, kPollInterval) < 0 && errno != EINTR)
+            throw AddonError("-1", std::string("Unable to read the process output: ") + std::strerror(errno));
+
+        for (nfds_t index = 0; index < count; ++index) {
+            if (fds[index].revents == 0)
+                continue;
+
+            int& fd = fds[index].fd == mStdout ? mStdout : mStderr;
+            const OutputHandler& handler = &fd == &mStdout ? onStdout : onStderr;
+            for (;;) {
+                const ssize_t read = ::read(fd, buffer.data(), buffer.size());
+                if (read > 0) {
+                    if (handler != nullptr)
+                        handler(buffer.data(), static_cast<size_t>(read));
+                    continue;
+                }
+                if (read < 0 && errno == EINTR)
+                    continue;
+                if (read == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                    CloseFd(fd);
+                break;
+            }
+        }
+    }
+
+    // The pipes are closed, but the process may still be running
+    while (!Reap(false)) {
+        cancelIfRequested();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    // Killed by Shutdown: the exit code is not the child's own
+    if (mAborted)
+        throw OperationCancelled(false);
+    return mExitCode;
+}
+
+bool Process::Reap(bool block) {
+    std::lock_guard<std::mutex> lock(mKillMutex);
+    if (mExited || mPid == -1)
+        return true;
+
+    int status = 0;
+    pid_t result = 0;
+    do {
+        result = waitpid(mPid, &status, block ? 0 : WNOHANG);
+    } while (result < 0 && errno == EINTR);
+    if (result == 0)
+        return false;
+
+    if (result < 0)
+        mExitCode = -1;
+    else if (WIFEXITED(status))
+        mExitCode = WEXITSTATUS(status);
+    else if (WIFSIGNALED(status))
+        mExitCode = 128 + WTERMSIG(status);
+    mExited = true;
+    return true;
+}
+
+void Process::Kill() {
+    // Serialized with Reap, so that a reaped (and possibly reused) pid is never signalled
+    std::lock_guard<std::mutex> lock(mKillMutex);
+    if (!mExited && mPid > 0)
+        kill(-mPid, SIGKILL);
+}
+
+bool Process::Write(const std::string& data, const CancellationToken* token) {
+    if (mStdin == -1)
+        return false;
+
+#ifndef F_SETNOSIGPIPE
+    // Writing to a child that exited must not raise SIGPIPE in the host: block it for this
+    // thread and discard the pending signal afterwards
+    sigset_t pipeSignal, previousMask;
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSignal, &previousMask);
+#endif
+
+    size_t written = 0;
+    bool broken = false;
+    bool cancelled = false;
+    while (written < data.size()) {
+        const ssize_t count = ::write(mStdin, data.data() + written, data.size() - written);
+        if (count >= 0) {
+            written += static_cast<size_t>(count);
+            continue;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            broken = true;
+            break;
+        }
+        // The pipe is full: wait until the child reads, unless the token is cancelled
+        if (mAborted || (token != nullptr && token->IsCancelled())) {
+            cancelled = true;
+            break;
+        }
+        pollfd fd = {mStdin, POLLOUT, 0};
+        poll(&fd, 1, kPollInterval);
+    }
+
+#ifndef F_SETNOSIGPIPE
+    if (broken && errno == EPIPE) {
+        const timespec noWait = {0, 0};
+        sigtimedwait(&pipeSignal, nullptr, &noWait);
+    }
+    pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+#endif
+    if (cancelled && token != nullptr)
+        token->ThrowIfCancelled();
+    if (cancelled)
+        throw OperationCancelled(false);
+    return !broken;
+}
+
+bool Process::ReadStdout(std::string& output, int timeout) {
+    if (mStdout == -1)
+        return false;
+
+    pollfd fd = {mStdout, POLLIN, 0};
+    int result = 0;
+    do {
+        result = poll(&fd, 1, timeout);
+    } while (result < 0 && errno == EINTR);
+    if (result <= 0)
+        return result == 0;
+
+    char buffer[16 * 1024];
+    for (;;) {
+        const ssize_t read = ::read(mStdout, buffer, sizeof(buffer));
+        if (read > 0) {
+            output.append(buffer, static_cast<size_t>(read));
+            return true;
+        }
+        if (read < 0 && errno == EINTR)
+            continue;
+        if (read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        CloseFd(mStdout);
+        return false;
+    }
+}
+
+void Process::ClosePipes() {
+    CloseFd(mStdin);
+    CloseFd(mStdout);
+    CloseFd(mStderr);
+}
+
+#endif
+
+void Process::Register(const std::string& program) {
+    {
+        std::lock_guard<std::mutex> lock(gRunningMutex);
+        if (!gStopping) {
+            gRunning.insert(this);
+            return;
+        }
+    }
+    Kill();
+    Reap(true);
+    ClosePipes();
+#ifdef _WIN32
+    CloseHandle(static_cast<HANDLE>(mProcess));
+    if (mJob != nullptr)
+        CloseHandle(static_cast<HANDLE>(mJob));
+#endif
+    ThrowSpawnError(program, "the addon is shutting down");
+}
+
+void Process::Unregister() {
+    std::lock_guard<std::mutex> lock(gRunningMutex);
+    gRunning.erase(this);
+}
+
+void Process::Shutdown() {
+    // Processes are unregistered before they are destroyed, so they outlive Kill
+    std::lock_guard<std::mutex> lock(gRunningMutex);
+    gStopping = true;
+    for (Process* process : gRunning) {
+        process->mAborted = true;
+        process->Kill();
+    }
+}
+
+void Process::Restart() {
+    std::lock_guard<std::mutex> lock(gRunningMutex);
+    gStopping = false;
+}
+
+std::shared_ptr<OutputChannel> OutputChannel::Create(addon_env env, addon_value callback) {
+    addon_valuetype type = addon_undefined;
+    Check(UxpAddonApis.uxp_addon_typeof(env, callback, &type));
+    if (type != addon_function)
+        throw "The output callback must be a function";
+
+    addon_ref ref = nullptr;
+    Check(UxpAddonApis.uxp_addon_create_reference(env, callback, 1, &ref));
+    return std::shared_ptr<OutputChannel>(new OutputChannel(env, ref));
+}
+
+void OutputChannel::Push(const char* data, size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mClosed)
+            return;
+        mPending.append(data, size);
+        if (mScheduled)
+            return;
+        mScheduled = true;
+    }
+
+    auto holder = new std::shared_ptr<OutputChannel>(shared_from_this());
+    UxpAddonApis.uxp_addon_schedule_on_javascript_queue(mEnv, FlushThunk, holder, FlushDestructor);
+}
+
+void OutputChannel::FlushThunk(addon_task_data data) {
+    try {
+        (*reinterpret_cast<std::shared_ptr<OutputChannel>*>(data))->Flush(false);
+    } catch (...) {
+    }
+}
+
+void OutputChannel::FlushDestructor(addon_task_data data) {
+    try {
+        delete reinterpret_cast<std::shared_ptr<OutputChannel>*>(data);
+    } catch (...) {
+    }
+}
+
+void OutputChannel::Flush(bool final) {
+    std::string chunk;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mScheduled = false;
+        const size_t tail = final ? 0 : IncompleteUtf8Tail(mPending);
+        chunk = mPending.substr(0, mPending.size() - tail);
+        mPending.erase(0, chunk.size());
+    }
+    if (chunk.empty() || mCallback == nullptr)
+        return;
+
+    HandlerScope scope(mEnv);
+    addon_value callback = nullptr;
+    Check(UxpAddonApis.uxp_addon_get_reference_value(mEnv, mCallback, &callback));
+    if (callback == nullptr)
+        return;
+
+    addon_value arg = nullptr;
+    Check(UxpAddonApis.uxp_addon_create_string_utf8(mEnv, chunk.data(), chunk.size(), &arg));
+    addon_value global = nullptr;
+    Check(UxpAddonApis.uxp_addon_get_global(mEnv, &global));
+    addon_value ignored = nullptr;
+    if (UxpAddonApis.uxp_addon_call_function(mEnv, global, callback, 1, &arg, &ignored) != addon_ok) {
+        // Don't let an exception of the callback leak into unrelated code
+        bool pending = false;
+        UxpAddonApis.uxp_addon_is_exception_pending(mEnv, &pending);
+        if (pending)
+            UxpAddonApis.uxp_addon_get_and_clear_last_exception(mEnv, &ignored);
+    }
+}
+
+void OutputChannel::Close() {
+    try {
+        Flush(true);
+    } catch (...) {
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mClosed = true;
+    if (mCallback != nullptr) {
+        UxpAddonApis.uxp_addon_delete_reference(mEnv, mCallback);
+        mCallback = nullptr;
+    }
+}
+
+ProcessPool& ProcessPool::Instance() {
+    static ProcessPool instance;
+    return instance;
+}
+
+std::string ProcessPool::Request(const ProcessOptions& options,
+                                 const std::string& delimiter,
+                                 const std::string& request,
+                                 const CancellationToken* token) {
+    std::string key;
+    for (const auto& arg : options.args)
+        key += arg + '\0';
+    key += '\0' + options.cwd + '\0';
+    for (const auto& variable : options.env)
+        key += variable.first + '=' + variable.second + '\0';
+
+    // A pooled process may have exited while it was idle: retry once with a new one
+    for (int attempt = 0;; ++attempt) {
+        bool reused = false;
+        std::unique_ptr<Worker> worker = Acquire(key, options, reused);
+        try {
+            if (!worker->process->Write(request, token)) {
+                if (reused && attempt == 0) {
+                    Discard(std::move(worker));
+                    continue;
+                }
+                throw AddonError("-1", "The worker process closed its input");
+            }
+
+            std::string response;
+            while (!TakeResponse(*worker, delimiter, response)) {
+                if (token != nullptr)
+                    token->ThrowIfCancelled();
+                if (worker->buffer.size() > kMaxResponse)
+                    throw AddonError("-1", "The worker process response exceeds " + std::to_string(kMaxResponse >> 20) + " MB");
+                if (!worker->process->ReadStdout(worker->buffer, kPollInterval))
+                    throw AddonError("-1", "The worker process exited before responding");
+            }
+            Release(key, std::move(worker));
+            return response;
+        } catch (...) {
+            // The state of the process is unknown, don't return it to the pool
+            Discard(std::move(worker));
+            throw;
+        }
+    }
+}
+
+void ProcessPool::Shutdown() {
+    std::map<std::string, std::vector<std::unique_ptr<Worker>>> idle;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        std::swap(idle, mIdle);
+        // Their requests fail and they aren't returned to the pool
+        for (Process* process : mBusy)
+            process->Kill();
+    }
+    // Idle workers are killed as they are destroyed
+}
+
+std::unique_ptr<ProcessPool::Worker> ProcessPool::Acquire(const std::string& key,
+                                                          const ProcessOptions& options,
+                                                          bool& reused) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto iter = mIdle.find(key);
+        if (iter != mIdle.end() && !iter->second.empty()) {
+            auto worker = std::move(iter->second.back());
+            iter->second.pop_back();
+            mBusy.insert(worker->process.get());
+            reused = true;
+            return worker;
+        }
+    }
+
+    ProcessOptions workerOptions = options;
+    workerOptions.pipeStdin = true;
+    workerOptions.mergeStderr = false;
+    workerOptions.discardStderr = true;  // nobody would drain it
+    auto worker = std::make_unique<Worker>();
+    worker->process = std::make_unique<Process>(workerOptions);
+    reused = false;
+    std::lock_guard<std::mutex> lock(mMutex);
+    mBusy.insert(worker->process.get());
+    return worker;
+}
+
+void ProcessPool::Release(const std::string& key, std::unique_ptr<Worker> worker) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mBusy.erase(worker->process.get());
+    auto& idle = mIdle[key];
+    if (idle.size() < kMaxIdle)
+        idle.push_back(std::move(worker));
+}
+
+void ProcessPool::Discard(std::unique_ptr<Worker> worker) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mBusy.erase(worker->process.get());
+    // The process is killed as the worker is destroyed
+}
+
+bool ProcessPool::TakeResponse(Worker& worker, const std::string& delimiter, std::string& response) {
+    std::string& buffer = worker.buffer;
+    size_t lineStart = worker.scanned;
+    for (size_t lineEnd = buffer.find('\n', lineStart); lineEnd != std::string::npos;
+         lineStart = lineEnd + 1, lineEnd = buffer.find('\n', lineStart)) {
+        size_t length = lineEnd - lineStart;
+        if (length > 0 && buffer[lineEnd - 1] == '\r')
+            --length;
+        if (length == delimiter.size() && buffer.compare(lineStart, length, delimiter) == 0) {
+            response = buffer.substr(0, lineStart);
+            buffer.erase(0, lineEnd + 1);
+            worker.scanned = 0;
+            return true;
+        }
+    }
+    worker.scanned = lineStart;
+    return false;
+}
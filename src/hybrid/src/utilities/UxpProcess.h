@@ -0,0 +1,209 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../api/UxpAddonTypes.h"
+#include "UxpCancellation.h"
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+/** Error code of the errors thrown when a process can't be started */
+#define UXP_ADDON_SPAWN_ERROR "SPAWN_ERR"
+
+struct ProcessOptions {
+    // Program and arguments. The program is looked up on the PATH if it has no directory.
+    std::vector<std::string> args;
+    // Working directory; the current directory of the host if empty
+    std::string cwd;
+    // Variables added to (or replacing those of) the environment of the host
+    std::map<std::string, std::string> env;
+    // Give the child a stdin pipe (see Process::Write); otherwise stdin is the null device
+    bool pipeStdin{false};
+    // Send stderr to the stdout pipe
+    bool mergeStderr{false};
+    // Send stderr to the null device
+    bool discardStderr{false};
+#ifdef _WIN32
+    // Command line passed to CreateProcess as is, instead of one built from args
+    std::string commandLine;
+#endif
+};
+
+/** A child process with piped stdout/stderr, started with posix_spawn on macOS/Linux
+ and CreateProcess on Windows. No shell is involved: the arguments are passed as is.
+ The child runs in its own process group
+ (job object on Windows), so Kill also terminates the processes it started.
+ The Process object is used by a single thread; Kill can be invoked from any thread.
+ Running processes are registered, so that the addon can kill them when it is terminated.
+*/
+
+class Process {
+ public:
+    using OutputHandler = std::function<void(const char* data, size_t size)>;
+
+    // Start the process. Throws an AddonError with the SPAWN_ERR code on failure.
+    explicit Process(const ProcessOptions& options);
+
+    // Kills the process if it is still running
+    ~Process();
+
+    // Read stdout/stderr until the process exited and closed its pipes, and return the
+    // exit code. The exit code of a process terminated by a signal is 128 + signal.
+    // When the token is cancelled or expires, the process is killed and OperationCancelled
+    // is thrown.
+    int Wait(const OutputHandler& onStdout, const OutputHandler& onStderr, const CancellationToken* token);
+
+    // @{ Request/response exchanges with a long-lived child (ProcessOptions::pipeStdin).
+    // Write blocks until all data is written; it returns false if the child closed its stdin.
+    // When the token is cancelled or expires while the child doesn't read, OperationCancelled
+    // is thrown; the process is left running.
+    bool Write(const std::string& data, const CancellationToken* token = nullptr);
+    // Append the stdout data that arrives within timeout milliseconds (-1 waits indefinitely)
+    // to output. Returns false at the end of the stream.
+    bool ReadStdout(std::string& output, int timeout);
+    // @}
+
+    void Kill();
+
+    // Kill the running processes, whose Wait then throws OperationCancelled, and fail the
+    // processes started until Restart with SPAWN_ERR. Invoked when the addon is terminated,
+    // before the threads that wait for them are joined.
+    static void Shutdown();
+    static void Restart();
+
+    Process(const Process&) = delete;
+    Process& operator=(const Process&) = delete;
+
+ private:
+    bool Reap(bool block);
+    void ClosePipes();
+    // Add the process to the running ones; kills it and throws if the addon is shutting down
+    void Register(const std::string& program);
+    void Unregister();
+
+#ifdef _WIN32
+    // HANDLEs
+    void* mProcess{nullptr};
+    void* mJob{nullptr};
+    void* mStdin{nullptr};
+    void* mStdout{nullptr};
+    void* mStderr{nullptr};
+#else
+    pid_t mPid{-1};
+    int mStdin{-1};
+    int mStdout{-1};
+    int mStderr{-1};
+#endif
+    std::mutex mKillMutex;
+    bool mExited{false};
+    int mExitCode{-1};
+    std::atomic<bool> mAborted{false};  // killed by Shutdown
+};
+
+/** Keeps long-lived child processes that serve requests over stdin/stdout, so that
+ repeated invocations of the same tool don't pay for process creation and startup
+ each time. A request is written as is to the stdin of an idle process, and the
+ response is everything it prints up to a line equal to the delimiter.
+ Idle processes are kept per program, arguments, cwd and environment. A process that
+ fails or is cancelled during a request is killed instead of returning to the pool.
+ The stderr of pooled processes is discarded.
+*/
+
+class ProcessPool {
+ public:
+    static ProcessPool& Instance();
+
+    // Blocks until the response arrived. Throws OperationCancelled when the token is
+    // cancelled or expires, and an AddonError when the process fails.
+    std::string Request(const ProcessOptions& options,
+                        const std::string& delimiter,
+                        const std::string& request,
+                        const CancellationToken* token);
+
+    // Kill all processes, including those serving a request, whose Request then fails.
+    // Invoked when the addon is terminated, before the worker threads are joined.
+    void Shutdown();
+
+    ProcessPool(const ProcessPool&) = delete;
+    ProcessPool& operator=(const ProcessPool&) = delete;
+
+ private:
+    static constexpr size_t kMaxIdle = 8;  // per key
+    // A response is buffered whole: a worker that never prints the delimiter fails
+    static constexpr size_t kMaxResponse = 64 << 20;
+
+    struct Worker {
+        std::unique_ptr<Process> process;
+        std::string buffer;  // stdout received but not consumed yet
+        size_t scanned{0};   // part of buffer known not to contain the delimiter line
+    };
+
+    ProcessPool() {}
+
+    std::unique_ptr<Worker> Acquire(const std::string& key, const ProcessOptions& options, bool& reused);
+    void Release(const std::string& key, std::unique_ptr<Worker> worker);
+    // Kill a worker that failed or was cancelled during a request
+    void Discard(std::unique_ptr<Worker> worker);
+    static bool TakeResponse(Worker& worker, const std::string& delimiter, std::string& response);
+
+    std::mutex mMutex;
+    std::map<std::string, std::vector<std::unique_ptr<Worker>>> mIdle;
+    // Processes of the workers that serve a request
+    std::set<Process*> mBusy;
+};
+
+/** Streams output chunks to a JavaScript callback, in order and without loss.
+ Chunks pushed from any thread are appended to a buffer, and at most one flush is
+ queued on the JavaScript thread at a time; the callback receives everything that
+ accumulated since the previous flush as one string. Incomplete UTF-8 sequences at the
+ end of the buffer are held back until the rest of the character arrives.
+*/
+
+class OutputChannel : public std::enable_shared_from_this<OutputChannel> {
+ public:
+    // This method must be invoked on the JavaScript thread
+    static std::shared_ptr<OutputChannel> Create(addon_env env, addon_value callback);
+
+    // Can be invoked on any thread
+    void Push(const char* data, size_t size);
+
+    // Deliver the remaining output and release the callback.
+    // This method must be invoked on the JavaScript thread.
+    void Close();
+
+    OutputChannel(const OutputChannel&) = delete;
+    OutputChannel& operator=(const OutputChannel&) = delete;
+
+ private:
+    OutputChannel(addon_env env, addon_ref callback) : mEnv(env), mCallback(callback) {}
+
+    static void FlushThunk(addon_task_data data);
+    static void FlushDestructor(addon_task_data data);
+    void Flush(bool final);
+
+    const addon_env mEnv;
+    addon_ref mCallback{nullptr};
+    std::mutex mMutex;
+    std::string mPending;
+    bool mScheduled{false};
+    bool mClosed{false};
+};
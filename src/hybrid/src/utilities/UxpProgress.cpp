@@ -0,0 +1,233 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpProgress.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "UxpAddon.h"
+
+/** Collects the channels to deliver and delivers them once per frame */
+class FrameDispatcher {
+ public:
+    static FrameDispatcher& Instance() {
+        static FrameDispatcher instance;
+        return instance;
+    }
+
+    void MarkDirty(std::shared_ptr<FrameChannel> channel);
+    void Shutdown();
+
+ private:
+    using Batch = std::vector<std::shared_ptr<FrameChannel>>;
+
+    static constexpr std::chrono::milliseconds kFrameInterval{16};
+
+    ~FrameDispatcher() {
+        try {
+            Shutdown();
+        } catch (...) {
+        }
+    }
+
+    void Run();
+    static void FlushThunk(addon_task_data data);
+    static void FlushDestructor(addon_task_data data);
+
+    std::mutex mMutex;
+    std::condition_variable mWakeup;
+    Batch mDirty;
+    std::thread mThread;
+    bool mStopping{false};
+};
+
+void FrameDispatcher::MarkDirty(std::shared_ptr<FrameChannel> channel) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mStopping)
+            return;
+        if (!mThread.joinable())
+            mThread = std::thread([this]() { Run(); });
+        mDirty.push_back(std::move(channel));
+    }
+    mWakeup.notify_one();
+}
+
+void FrameDispatcher::Shutdown() {
+    std::thread thread;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+        std::swap(thread, mThread);
+        mDirty.clear();
+    }
+    mWakeup.notify_all();
+    if (thread.joinable())
+        thread.join();
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStopping = false;
+}
+
+void FrameDispatcher::Run() {
+    auto lastFlush = std::chrono::steady_clock::now() - kFrameInterval;
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (;;) {
+        mWakeup.wait(lock, [this]() { return mStopping || !mDirty.empty(); });
+        if (mStopping)
+            return;
+
+        // Let the updates of the current frame accumulate
+        const auto nextFlush = lastFlush + kFrameInterval;
+        if (std::chrono::steady_clock::now() < nextFlush) {
+            mWakeup.wait_until(lock, nextFlush, [this]() { return mStopping; });
+            if (mStopping)
+                return;
+        }
+
+        Batch batch;
+        std::swap(batch, mDirty);
+        lastFlush = std::chrono::steady_clock::now();
+        lock.unlock();
+
+        // One JavaScript callback per environment and frame
+        std::map<addon_env, Batch> byEnv;
+        for (auto& channel : batch)
+            byEnv[channel->mEnv].push_back(std::move(channel));
+        for (auto& entry : byEnv) {
+            Batch* data = new Batch(std::move(entry.second));
+            UxpAddonApis.uxp_addon_schedule_on_javascript_queue(entry.first, FlushThunk, data, FlushDestructor);
+        }
+
+        lock.lock();
+    }
+}
+
+void FrameDispatcher::FlushThunk(addon_task_data data) {
+    try {
+        for (auto& channel : *reinterpret_cast<Batch*>(data))
+            channel->Deliver();
+    } catch (...) {
+    }
+}
+
+void FrameDispatcher::FlushDestructor(addon_task_data data) {
+    try {
+        delete reinterpret_cast<Batch*>(data);
+    } catch (...) {
+    }
+}
+
+void FrameChannel::ScheduleDelivery(std::shared_ptr<FrameChannel> channel) {
+    FrameDispatcher::Instance().MarkDirty(std::move(channel));
+}
+
+std::shared_ptr<ProgressChannel> ProgressChannel::Create(addon_env env, addon_value callback) {
+    addon_valuetype type = addon_undefined;
+    Check(UxpAddonApis.uxp_addon_typeof(env, callback, &type));
+    if (type != addon_function)
+        throw "The progress callback must be a function";
+
+    addon_ref ref = nullptr;
+    Check(UxpAddonApis.uxp_addon_create_reference(env, callback, 1, &ref));
+    return std::shared_ptr<ProgressChannel>(new ProgressChannel(env, ref));
+}
+
+namespace {
+
+struct ReleasedCallback {
+    addon_env env;
+    addon_ref callback;
+};
+
+void ReleaseCallback(addon_task_data data) {
+    try {
+        auto released = reinterpret_cast<ReleasedCallback*>(data);
+        UxpAddonApis.uxp_addon_delete_reference(released->env, released->callback);
+    } catch (...) {
+    }
+}
+
+void DeleteReleasedCallback(addon_task_data data) {
+    try {
+        delete reinterpret_cast<ReleasedCallback*>(data);
+    } catch (...) {
+    }
+}
+
+}  // namespace
+
+ProgressChannel::~ProgressChannel() {
+    // Not closed: the export failed before a task took the channel over. The reference can
+    // only be released on the JavaScript thread, see Close.
+    if (mCallback != nullptr) {
+        UxpAddonApis.uxp_addon_schedule_on_javascript_queue(mEnv, ReleaseCallback, new ReleasedCallback{mEnv, mCallback},
+                                                            DeleteReleasedCallback);
+    }
+}
+
+void ProgressChannel::Publish(double completed, double total) {
+    mCompleted.store(completed, std::memory_order_relaxed);
+    mTotal.store(total, std::memory_order_relaxed);
+    if (!mDirty.exchange(true, std::memory_order_acq_rel))
+        ScheduleDelivery(shared_from_this());
+}
+
+void ProgressChannel::Deliver() {
+    // Clear the flag first so that updates published from now on schedule another flush
+    if (mClosed || !mDirty.exchange(false, std::memory_order_acq_rel))
+        return;
+
+    HandlerScope scope(mEnv);
+    addon_value callback = nullptr;
+    Check(UxpAddonApis.uxp_addon_get_reference_value(mEnv, mCallback, &callback));
+    if (callback == nullptr)
+        return;
+
+    addon_value args[2] = {nullptr, nullptr};
+    Check(UxpAddonApis.uxp_addon_create_double(mEnv, mCompleted.load(std::memory_order_relaxed), &args[0]));
+    Check(UxpAddonApis.uxp_addon_create_double(mEnv, mTotal.load(std::memory_order_relaxed), &args[1]));
+
+    addon_value global = nullptr;
+    Check(UxpAddonApis.uxp_addon_get_global(mEnv, &global));
+    addon_value ignored = nullptr;
+    if (UxpAddonApis.uxp_addon_call_function(mEnv, global, callback, 2, args, &ignored) != addon_ok) {
+        // Don't let an exception of the progress callback leak into unrelated code
+        bool pending = false;
+        UxpAddonApis.uxp_addon_is_exception_pending(mEnv, &pending);
+        if (pending)
+            UxpAddonApis.uxp_addon_get_and_clear_last_exception(mEnv, &ignored);
+    }
+}
+
+void ProgressChannel::Close() {
+    if (mClosed)
+        return;
+
+    try {
+        Deliver();
+    } catch (...) {
+    }
+    mClosed = true;
+    if (mCallback != nullptr) {
+        UxpAddonApis.uxp_addon_delete_reference(mEnv, mCallback);
+        mCallback = nullptr;
+    }
+}
+
+void ProgressChannel::Shutdown() {
+    FrameDispatcher::Instance().Shutdown();
+}
@@ -0,0 +1,85 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "../api/UxpAddonTypes.h"
+
+/** A FrameChannel is delivered on the JavaScript thread by a shared dispatcher, at most
+ once per frame, with a single JavaScript queue callback for all the channels of an
+ environment that asked for a delivery during the frame.
+*/
+
+class FrameChannel {
+ public:
+    virtual ~FrameChannel() = default;
+
+    FrameChannel(const FrameChannel&) = delete;
+    FrameChannel& operator=(const FrameChannel&) = delete;
+
+ protected:
+    explicit FrameChannel(addon_env env) : mEnv(env) {}
+
+    // Have Deliver invoked with the next frame. Can be invoked on any thread.
+    static void ScheduleDelivery(std::shared_ptr<FrameChannel> channel);
+
+    // Invoked on the JavaScript thread
+    virtual void Deliver() = 0;
+
+    const addon_env mEnv;
+
+ private:
+    friend class FrameDispatcher;
+};
+
+/** A ProgressChannel streams the progress of a native job to a JavaScript callback,
+ which is invoked as callback(completed, total).
+ Publish can be called from any thread and as often as needed: it only stores the
+ latest values into an atomic slot. Channels with new values are flushed as frame
+ channels, so JavaScript only ever sees the most recent values.
+ Completed and total are published independently; a reader may observe the new
+ completed value with the previous total, which is harmless for progress display.
+*/
+
+class ProgressChannel : public FrameChannel, public std::enable_shared_from_this<ProgressChannel> {
+ public:
+    // Create a channel for the given JavaScript function.
+    // This method must be invoked on the JavaScript thread.
+    static std::shared_ptr<ProgressChannel> Create(addon_env env, addon_value callback);
+
+    ~ProgressChannel();
+
+    // Can be invoked on any thread
+    void Publish(double completed, double total);
+    void Publish(double completed) { Publish(completed, mTotal.load(std::memory_order_relaxed)); }
+
+    // Deliver the pending values (if any) and release the callback. Later updates are ignored.
+    // A channel that is destroyed without being closed releases the callback with the next
+    // turn of the JavaScript queue.
+    // This method must be invoked on the JavaScript thread.
+    void Close();
+
+    // Stop the dispatcher thread of all frame channels; invoked when the addon is terminated
+    static void Shutdown();
+
+ private:
+    ProgressChannel(addon_env env, addon_ref callback) : FrameChannel(env), mCallback(callback) {}
+
+    void Deliver() override;
+
+    addon_ref mCallback{nullptr};
+    std::atomic<double> mCompleted{0.0};
+    std::atomic<double> mTotal{0.0};
+    std::atomic<bool> mDirty{false};
+    bool mClosed{false};
+};
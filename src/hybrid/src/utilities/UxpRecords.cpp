@@ -0,0 +1,212 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpRecords.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "UxpAddon.h"
+
+namespace {
+
+// The ArrayBuffer owns a reference to the channel, which owns the memory
+void DeleteBufferHolder(addon_env /*env*/, void* /*data*/, void* hint) {
+    try {
+        delete reinterpret_cast<std::shared_ptr<RecordChannel>*>(hint);
+    } catch (...) {
+    }
+}
+
+}  // namespace
+
+RecordChannel::RecordChannel(addon_env env, addon_ref callback, size_t capacity)
+    : FrameChannel(env), mCallback(callback), mCapacity(capacity), mRing(new uint8_t[capacity]()) {}
+
+std::shared_ptr<RecordChannel> RecordChannel::Create(addon_env env, addon_value callback, size_t capacity) {
+    addon_valuetype type = addon_undefined;
+    Check(UxpAddonApis.uxp_addon_typeof(env, callback, &type));
+    if (type != addon_function)
+        throw "The records callback must be a function";
+
+    size_t rounded = kMinCapacity;
+    while (rounded < std::min(capacity, kMaxCapacity))
+        rounded *= 2;
+
+    addon_ref ref = nullptr;
+    Check(UxpAddonApis.uxp_addon_create_reference(env, callback, 1, &ref));
+    return std::shared_ptr<RecordChannel>(new RecordChannel(env, ref, rounded));
+}
+
+addon_value RecordChannel::CreateBuffer() {
+    auto holder = new std::shared_ptr<RecordChannel>(shared_from_this());
+    addon_value buffer = nullptr;
+    if (UxpAddonApis.uxp_addon_create_external_arraybuffer(mEnv, mRing.get(), mCapacity, DeleteBufferHolder, holder,
+                                                           &buffer) != addon_ok) {
+        delete holder;
+        throw "Unable to create the records buffer";
+    }
+    return buffer;
+}
+
+bool RecordChannel::Push(uint8_t type, const void* data, size_t size, bool wait) {
+    const size_t length = 4 + ((size + 3) & ~size_t(3));
+    if (size > kMaxPayloadSize || length > mCapacity)
+        throw "The record is larger than the channel";
+
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        uint64_t start = 0;
+        for (;;) {
+            if (mClosed)
+                return false;
+            const uint64_t write = mWrite.load(std::memory_order_relaxed);
+            const size_t tail = mCapacity - write % mCapacity;
+            start = tail < length ? write + tail : write;
+            if (start + length - mRead.load(std::memory_order_acquire) <= mCapacity) {
+                if (start != write)
+                    mSkip.store(write, std::memory_order_relaxed);
+                break;
+            }
+            if (!wait) {
+                mDropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            // Rather than for the next frame
+            if (!mFlushing) {
+                mFlushing = true;
+                auto holder = new std::shared_ptr<RecordChannel>(shared_from_this());
+                UxpAddonApis.uxp_addon_schedule_on_javascript_queue(mEnv, FlushThunk, holder, FlushDestructor);
+            }
+            mDrained.wait(lock);
+        }
+
+        uint8_t* record = mRing.get() + start % mCapacity;
+        const uint32_t header = static_cast<uint32_t>(size) | (uint32_t(type) << 24);
+        record[0] = static_cast<uint8_t>(header);
+        record[1] = static_cast<uint8_t>(header >> 8);
+        record[2] = static_cast<uint8_t>(header >> 16);
+        record[3] = static_cast<uint8_t>(header >> 24);
+        if (size > 0)
+            std::memcpy(record + 4, data, size);
+        std::memset(record + 4 + size, 0, length - 4 - size);
+        mWrite.store(start + length, std::memory_order_release);
+
+        if (mScheduled)
+            return true;
+        mScheduled = true;
+    }
+
+    ScheduleDelivery(shared_from_this());
+    return true;
+}
+
+void RecordChannel::Deliver() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mScheduled = false;
+    }
+    Flush();
+}
+
+void RecordChannel::FlushThunk(addon_task_data data) {
+    try {
+        (*reinterpret_cast<std::shared_ptr<RecordChannel>*>(data))->Flush();
+    } catch (...) {
+    }
+}
+
+void RecordChannel::FlushDestructor(addon_task_data data) {
+    try {
+        delete reinterpret_cast<std::shared_ptr<RecordChannel>*>(data);
+    } catch (...) {
+    }
+}
+
+void RecordChannel::Flush() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFlushing = false;
+    }
+
+    // The records up to end are complete; a skip within them was published before end
+    uint64_t begin = mRead.load(std::memory_order_relaxed);
+    const uint64_t end = mWrite.load(std::memory_order_acquire);
+    const uint64_t skip = mSkip.load(std::memory_order_relaxed);
+    const auto dropped = static_cast<double>(mDropped.exchange(0, std::memory_order_relaxed));
+    if (begin == end && dropped == 0)
+        return;
+
+    try {
+        if (skip >= begin && skip < end) {
+            if (skip > begin)
+                Invoke(begin, skip, 0);
+            begin = skip + (mCapacity - skip % mCapacity);
+        }
+        Invoke(begin, end, dropped);
+    } catch (...) {
+    }
+
+    // Hand the space back to the producers, even if the callback failed
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRead.store(end, std::memory_order_release);
+    }
+    mDrained.notify_all();
+}
+
+void RecordChannel::Invoke(uint64_t begin, uint64_t end, double dropped) {
+    if (mCallback == nullptr)
+        return;
+
+    HandlerScope scope(mEnv);
+    addon_value callback = nullptr;
+    Check(UxpAddonApis.uxp_addon_get_reference_value(mEnv, mCallback, &callback));
+    if (callback == nullptr)
+        return;
+
+    addon_value args[3] = {nullptr, nullptr, nullptr};
+    Check(UxpAddonApis.uxp_addon_create_double(mEnv, static_cast<double>(begin % mCapacity), &args[0]));
+    Check(UxpAddonApis.uxp_addon_create_double(mEnv, static_cast<double>(end - begin), &args[1]));
+    Check(UxpAddonApis.uxp_addon_create_double(mEnv, dropped, &args[2]));
+
+    addon_value global = nullptr;
+    Check(UxpAddonApis.uxp_addon_get_global(mEnv, &global));
+    addon_value ignored = nullptr;
+    if (UxpAddonApis.uxp_addon_call_function(mEnv, global, callback, 3, args, &ignored) != addon_ok) {
+        // Don't let an exception of the callback leak into unrelated code
+        bool pending = false;
+        UxpAddonApis.uxp_addon_is_exception_pending(mEnv, &pending);
+        if (pending)
+            UxpAddonApis.uxp_addon_get_and_clear_last_exception(mEnv, &ignored);
+    }
+}
+
+void RecordChannel::Close() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mClosed)
+            return;
+        mClosed = true;
+    }
+    mDrained.notify_all();
+
+    // No record is written anymore: deliver the last ones
+    Flush();
+    if (mCallback != nullptr) {
+        UxpAddonApis.uxp_addon_delete_reference(mEnv, mCallback);
+        mCallback = nullptr;
+    }
+}
+
+bool RecordChannel::IsClosed() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mClosed;
+}
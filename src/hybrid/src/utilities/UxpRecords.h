@@ -0,0 +1,96 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "../api/UxpAddonShared.h"
+#include "UxpProgress.h"
+
+/** A RecordChannel streams small binary records from native threads to JavaScript
+ through a ring buffer that JavaScript reads in place, as an external ArrayBuffer.
+ Each record is a 32-bit little-endian header, the payload size in the low 24 bits and
+ the record type in the high 8 bits, followed by the payload, padded to 4 bytes. A record
+ never wraps around the end of the ring: when it doesn't fit before the end, it starts
+ over at offset 0.
+ Records pushed from any thread are copied into the ring, which is flushed as a frame
+ channel, or at once when a producer waits for space. The flush invokes callback(offset,
+ length, dropped) with the records that accumulated since the previous flush, then hands
+ their space back to the producers; JavaScript must not keep views on it past the callback.
+ When the records wrap around, the flush invokes the callback twice, once per contiguous
+ span. dropped counts the records that were discarded because the ring was full.
+ Producers are serialized by a mutex, so one ring serves all the worker lanes of a batch.
+*/
+
+class RecordChannel : public FrameChannel, public std::enable_shared_from_this<RecordChannel> {
+ public:
+    static constexpr size_t kDefaultCapacity = 1 << 20;
+    static constexpr size_t kMinCapacity = 1 << 12;
+    static constexpr size_t kMaxCapacity = 1 << 28;
+    static constexpr size_t kMaxPayloadSize = (1 << 24) - 1;
+
+    // Create a channel for the given JavaScript function. The capacity is rounded up to a
+    // power of 2 within the limits above.
+    // This method must be invoked on the JavaScript thread.
+    static std::shared_ptr<RecordChannel> Create(addon_env env, addon_value callback, size_t capacity = kDefaultCapacity);
+
+    size_t GetCapacity() const { return mCapacity; }
+
+    // The ring as an ArrayBuffer over the same memory, which stays valid as long as the
+    // ArrayBuffer is referenced.
+    // This method must be invoked on the JavaScript thread.
+    addon_value CreateBuffer();
+
+    // Append a record. When the ring is full, waits until JavaScript drained it if wait is
+    // set, and drops the record otherwise. Returns false if the record was dropped or the
+    // channel is closed.
+    // Can be invoked on any thread but the JavaScript thread when wait is set.
+    bool Push(uint8_t type, const void* data, size_t size, bool wait = true);
+
+    // Deliver the pending records, release the callback and the waiting producers. Later
+    // records are dropped.
+    // This method must be invoked on the JavaScript thread.
+    void Close();
+
+    bool IsClosed();
+
+ private:
+    RecordChannel(addon_env env, addon_ref callback, size_t capacity);
+
+    void Deliver() override;
+    static void FlushThunk(addon_task_data data);
+    static void FlushDestructor(addon_task_data data);
+    void Flush();
+    void Invoke(uint64_t begin, uint64_t end, double dropped);
+
+    addon_ref mCallback{nullptr};
+    const size_t mCapacity;
+    const std::unique_ptr<uint8_t[]> mRing;
+
+    // Byte counters that only grow: records are at counter % capacity. Written under
+    // mMutex; the flush reads mWrite without it.
+    std::atomic<uint64_t> mWrite{0};
+    std::atomic<uint64_t> mRead{0};
+    // Where a record last started over at offset 0, leaving the end of the ring unused
+    std::atomic<uint64_t> mSkip{UINT64_MAX};
+    std::atomic<uint64_t> mDropped{0};
+
+    std::mutex mMutex;
+    std::condition_variable mDrained;
+    bool mScheduled{false};  // with the next frame
+    bool mFlushing{false};   // at once, for a waiting producer
+    bool mClosed{false};
+};
@@ -0,0 +1,273 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpSimilarity.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <filesystem>
+#include <map>
+#include <numeric>
+
+#include "UxpMetrics.h"
+#include "UxpPixels.h"
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+
+// Past this many bits, parts of the hashes are too short to tell them apart and every pair
+// is compared
+constexpr unsigned kMaxIndexedThreshold = 16;
+
+// Luma of a reduction of the image, over white where it is transparent
+std::vector<float> GetLuma(const Bitmap& bitmap, uint32_t width, uint32_t height) {
+    const Bitmap reduced = ResizeBitmap(bitmap, width, height);
+    std::vector<float> luma(size_t(width) * height);
+    for (size_t index = 0; index < luma.size(); ++index) {
+        const uint8_t* pixel = &reduced.pixels[index * 4];
+        const float alpha = pixel[3] / 255.0f;
+        const float value = 0.299f * pixel[0] + 0.587f * pixel[1] + 0.114f * pixel[2];
+        luma[index] = value * alpha + 255.0f * (1 - alpha);
+    }
+    return luma;
+}
+
+uint64_t DifferenceHash(const Bitmap& bitmap) {
+    const auto luma = GetLuma(bitmap, 9, 8);
+    uint64_t hash = 0;
+    for (size_t y = 0; y < 8; ++y) {
+        for (size_t x = 0; x < 8; ++x)
+            hash = hash << 1 | (luma[y * 9 + x] > luma[y * 9 + x + 1] ? 1 : 0);
+    }
+    return hash;
+}
+
+uint64_t DctHash(const Bitmap& bitmap) {
+    constexpr size_t kSize = 32;
+    constexpr size_t kKept = 8;
+
+    // The weights of the kept frequencies at each position
+    static const auto kCosines = [] {
+        std::array<float, kSize * kKept> cosines{};
+        for (size_t x = 0; x < kSize; ++x) {
+            for (size_t u = 0; u < kKept; ++u)
+                cosines[x * kKept + u] = static_cast<float>(std::cos((2 * x + 1) * u * kPi / (2 * kSize)));
+        }
+        return cosines;
+    }();
+
+    // Only the 8x8 lowest frequencies of the DCT are computed: first along the rows, then
+    // along the columns. The inner loops run over the 8 frequencies and are vectorized.
+    const auto luma = GetLuma(bitmap, kSize, kSize);
+    std::array<float, kSize * kKept> rows{};
+    for (size_t y = 0; y < kSize; ++y) {
+        for (size_t x = 0; x < kSize; ++x) {
+            const float value = luma[y * kSize + x];
+            for (size_t u = 0; u < kKept; ++u)
+                rows[y * kKept + u] += value * kCosines[x * kKept + u];
+        }
+    }
+    std::array<float, kKept * kKept> frequencies{};
+    for (size_t y = 0; y < kSize; ++y) {
+        for (size_t v = 0; v < kKept; ++v) {
+            const float weight = kCosines[y * kKept + v];
+            for (size_t u = 0; u < kKept; ++u)
+                frequencies[v * kKept + u] += weight * rows[y * kKept + u];
+        }
+    }
+
+    // The DC term is the mean brightness, left out of the median
+    std::array<float, kKept * kKept - 1> sorted;
+    std::copy(frequencies.begin() + 1, frequencies.end(), sorted.begin());
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+    const float median = sorted[sorted.size() / 2];
+    uint64_t hash = 0;
+    for (const float frequency : frequencies)
+        hash = hash << 1 | (frequency > median ? 1 : 0);
+    return hash;
+}
+
+size_t FindRoot(std::vector<size_t>& parents, size_t index) {
+    while (parents[index] != index) {
+        parents[index] = parents[parents[index]];
+        index = parents[index];
+    }
+    return index;
+}
+
+bool GetStamp(const std::string& path, uint64_t& size, int64_t& modified) {
+    std::error_code ec;
+    const std::filesystem::path file(path);
+    size = std::filesystem::file_size(file, ec);
+    if (ec)
+        return false;
+    modified = std::filesystem::last_write_time(file, ec).time_since_epoch().count();
+    return !ec;
+}
+
+}  // namespace
+
+PerceptualHash ComputePerceptualHash(const Bitmap& bitmap) {
+    PerceptualHash hash;
+    hash.dhash = DifferenceHash(bitmap);
+    hash.phash = DctHash(bitmap);
+    return hash;
+}
+
+std::vector<std::vector<size_t>> GroupHashes(const std::vector<uint64_t>& hashes, unsigned threshold) {
+    // Equal hashes (copies of a file) are compared once
+    std::vector<size_t> order(hashes.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&hashes](size_t left, size_t right) { return hashes[left] < hashes[right]; });
+    std::vector<uint64_t> unique;
+    std::vector<size_t> uniqueOf(hashes.size());
+    for (const size_t index : order) {
+        if (unique.empty() || unique.back() != hashes[index])
+            unique.push_back(hashes[index]);
+        uniqueOf[index] = unique.size() - 1;
+    }
+
+    std::vector<size_t> parents(unique.size());
+    std::iota(parents.begin(), parents.end(), 0);
+    const auto join = [&](size_t left, size_t right) {
+        if (static_cast<unsigned>(std::popcount(unique[left] ^ unique[right])) <= threshold)
+            parents[FindRoot(parents, left)] = FindRoot(parents, right);
+    };
+    if (threshold >= kMaxIndexedThreshold) {
+        for (size_t left = 0; left < unique.size(); ++left) {
+            for (size_t right = left + 1; right < unique.size(); ++right)
+                join(left, right);
+        }
+    } else {
+        // Hashes within threshold bits of each other are equal on at least one of
+        // threshold + 1 parts of their bits, so only hashes that share a part are compared
+        const unsigned parts = threshold + 1;
+        std::vector<std::pair<uint64_t, size_t>> keys(unique.size());
+        for (unsigned part = 0; part < parts; ++part) {
+            const unsigned first = 64 * part / parts;
+            const unsigned bits = 64 * (part + 1) / parts - first;
+            const uint64_t mask = bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+            for (size_t index = 0; index < unique.size(); ++index)
+                keys[index] = {(unique[index] >> first) & mask, index};
+            std::sort(keys.begin(), keys.end());
+            for (size_t begin = 0, end = 0; begin < keys.size(); begin = end) {
+                while (end < keys.size() && keys[end].first == keys[begin].first)
+                    ++end;
+                for (size_t left = begin; left < end; ++left) {
+                    for (size_t right = left + 1; right < end; ++right)
+                        join(keys[left].second, keys[right].second);
+                }
+            }
+        }
+    }
+
+    std::map<size_t, std::vector<size_t>> groups;
+    for (size_t index = 0; index < hashes.size(); ++index)
+        groups[FindRoot(parents, uniqueOf[index])].push_back(index);
+    std::vector<std::vector<size_t>> result;
+    for (auto& group : groups) {
+        if (group.second.size() >= 2)
+            result.push_back(std::move(group.second));
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+HashIndex& HashIndex::Instance() {
+    static HashIndex instance;
+    return instance;
+}
+
+bool HashIndex::Get(const std::string& path, PerceptualHash& hash) {
+    Entry entry;
+    if (!GetStamp(path, entry.size, entry.modified))
+        return false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const auto found = mEntries.find(path);
+        if (found != mEntries.end() && found->second.size == entry.size && found->second.modified == entry.modified) {
+            hash = found->second.hash;
+            return true;
+        }
+    }
+
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "perceptualHash");
+    Bitmap bitmap;
+    if (!DecodeImageFile(path, bitmap, 32)) {
+        metrics.Fail();
+        return false;
+    }
+    entry.hash = ComputePerceptualHash(bitmap);
+    hash = entry.hash;
+    std::lock_guard<std::mutex> lock(mMutex);
+    mEntries[path] = entry;
+    return true;
+}
+
+std::vector<std::vector<std::string>> HashIndex::FindNearDuplicates(unsigned threshold, const std::vector<std::string>& paths) {
+    std::vector<std::string> files;
+    std::vector<uint64_t> hashes;
+    if (paths.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for (const auto& entry : mEntries) {
+                files.push_back(entry.first);
+                hashes.push_back(entry.second.hash.phash);
+            }
+        }
+
+        // Files deleted since they were hashed
+        std::vector<std::string> gone;
+        size_t kept = 0;
+        for (size_t index = 0; index < files.size(); ++index) {
+            std::error_code ec;
+            if (!std::filesystem::exists(std::filesystem::path(files[index]), ec)) {
+                gone.push_back(std::move(files[index]));
+                continue;
+            }
+            files[kept] = std::move(files[index]);
+            hashes[kept++] = hashes[index];
+        }
+        files.resize(kept);
+        hashes.resize(kept);
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (const auto& path : gone)
+            mEntries.erase(path);
+    } else {
+        for (const auto& path : paths) {
+            PerceptualHash hash;
+            if (Get(path, hash)) {
+                files.push_back(path);
+                hashes.push_back(hash.phash);
+            }
+        }
+    }
+
+    std::vector<std::vector<std::string>> groups;
+    for (const auto& group : GroupHashes(hashes, threshold)) {
+        std::vector<std::string> names;
+        for (const size_t index : group)
+            names.push_back(files[index]);
+        std::sort(names.begin(), names.end());
+        names.erase(std::unique(names.begin(), names.end()), names.end());
+        if (names.size() >= 2)
+            groups.push_back(std::move(names));
+    }
+    std::sort(groups.begin(), groups.end());
+    return groups;
+}
+
+void HashIndex::Clear() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mEntries.clear();
+}
@@ -0,0 +1,81 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Bitmap;
+
+/** Perceptual hashes of images, and their grouping into near-duplicates
+ (perceptualHash, findNearDuplicates).
+
+ Both hashes are 64 bits computed from the luma of a reduction of the image, and are
+ compared by the number of bits that differ (Hamming distance):
+ - dHash: whether each pixel of a 9x8 reduction is brighter than its right neighbor.
+ - pHash: whether each of the 8x8 lowest frequencies of the DCT of a 32x32 reduction is
+   above their median.
+ Rescaled, recompressed or lightly corrected versions of an image stay within a few bits
+ of it, unrelated images differ by about 32. JPEGs are decoded at 1/8 (see DecodeImage).
+*/
+
+struct PerceptualHash {
+    uint64_t dhash{0};
+    uint64_t phash{0};
+};
+
+PerceptualHash ComputePerceptualHash(const Bitmap& bitmap);
+
+// Groups of at least 2 indexes of hashes that are within threshold bits of another hash of
+// the group (single linkage). Indexes are sorted in their group. Candidate pairs are found
+// by splitting the hashes into threshold + 1 parts: hashes that close are equal on at
+// least one part (multi-index hashing), which prunes far more than a BK-tree does at the
+// distances of 64-bit hashes.
+std::vector<std::vector<size_t>> GroupHashes(const std::vector<uint64_t>& hashes, unsigned threshold);
+
+/** The hashes of the library, by path. A file is hashed again when its size or
+ modification time changed, so a library is decoded once per session.
+*/
+
+class HashIndex {
+ public:
+    static HashIndex& Instance();
+
+    // The hashes of an image file. Returns false if it isn't a supported image.
+    bool Get(const std::string& path, PerceptualHash& hash);
+
+    // Groups of files whose pHash differ by at most threshold bits, among paths (hashed when
+    // needed), or among all the indexed files that still exist when paths is empty. Paths
+    // are sorted in their group, and groups by their first path.
+    std::vector<std::vector<std::string>> FindNearDuplicates(unsigned threshold, const std::vector<std::string>& paths);
+
+    // Forget the hashes. Invoked when the addon is terminated.
+    void Clear();
+
+    HashIndex(const HashIndex&) = delete;
+    HashIndex& operator=(const HashIndex&) = delete;
+
+ private:
+    struct Entry {
+        uint64_t size{0};
+        int64_t modified{0};
+        PerceptualHash hash;
+    };
+
+    HashIndex() {}
+
+    std::mutex mMutex;
+    std::unordered_map<std::string, Entry> mEntries;
+};
@@ -0,0 +1,410 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpStorage.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+#include "UxpAddon.h"
+#include "UxpFiles.h"
+#include "UxpMetrics.h"
+#include "UxpPack.h"
+#include "UxpTrace.h"
+
+namespace {
+
+constexpr const char* kSidecarSuffix = ".json";
+constexpr const char* kThumbnailSuffix = "_thumbnail.jpg";
+
+bool EndsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::string Lowercase(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return text;
+}
+
+// Sidecars, packs and the files of the manager are kept; thumbnails go with their media
+bool IsEvictable(const std::string& key) {
+    const std::string name = Lowercase(std::filesystem::path(key).filename().string());
+    return !EndsWith(name, kSidecarSuffix) && !EndsWith(name, kThumbnailSuffix) && name != PackStore::kFileName &&
+           name != StorageManager::kPinsFileName;
+}
+
+// The thumbnail written next to a video, see thumbnailGenerator.ts
+std::string ThumbnailKey(const std::string& key) {
+    const std::filesystem::path path(key);
+    const std::string extension = Lowercase(path.extension().string());
+    if (extension != ".mp4" && extension != ".mov" && extension != ".avi" && extension != ".webm")
+        return std::string();
+    return (path.parent_path() / (path.stem().string() + kThumbnailSuffix)).generic_string();
+}
+
+// Add the evicted fields to the JSON object of a sidecar
+bool MarkEvicted(std::string& sidecar) {
+    if (sidecar.find("\"evicted\"") != std::string::npos)
+        return false;
+    const size_t end = sidecar.find_last_of('}');
+    if (end == std::string::npos || end == 0)
+        return false;
+    // After the last member, or the opening brace of an empty object
+    const size_t last = sidecar.find_last_not_of(" \t\r\n", end - 1);
+    if (last == std::string::npos)
+        return false;
+    const bool empty = sidecar[last] == '{';
+
+    const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch());
+    sidecar.insert(last + 1, std::string(empty ? "" : ",") + "\"evicted\":true,\"evictedAt\":" + std::to_string(now.count()));
+    return true;
+}
+
+}  // namespace
+
+StorageManager::StorageManager() = default;
+
+StorageManager::~StorageManager() {
+    Stop();
+}
+
+StorageManager& StorageManager::Instance() {
+    static StorageManager instance;
+    return instance;
+}
+
+void StorageManager::Configure(const std::string& root, uint64_t quotaBytes, Policy policy) {
+    std::error_code ec;
+    const auto rootPath = std::filesystem::absolute(std::filesystem::path(root), ec).lexically_normal();
+    if (ec)
+        throw AddonError(UXP_ADDON_IO_ERROR, "Unable to resolve " + root);
+
+    // Pins are read before the scan so that nothing pinned is evicted in between
+    std::map<std::string, std::set<std::string>> pins;
+    {
+        std::ifstream input(rootPath / kPinsFileName);
+        std::string line;
+        while (std::getline(input, line)) {
+            const size_t tab = line.find('\t');
+            if (tab != std::string::npos && tab + 1 < line.size())
+                pins[line.substr(tab + 1)].insert(line.substr(0, tab));
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    ++mGeneration;
+    mRoot = rootPath;
+    mCanonicalRoot = std::filesystem::weakly_canonical(rootPath, ec);
+    if (ec)
+        mCanonicalRoot = rootPath;
+    mQuota = quotaBytes;
+    mPolicy = policy;
+    mEntries.clear();
+    mUsed = 0;
+    mPins = std::move(pins);
+    mEvictedFiles = 0;
+    mEvictedBytes = 0;
+    mScanPending = true;
+    mEvictionPending = true;
+
+    if (!mThread.joinable()) {
+        mStopping = false;
+        mThread = std::thread([this]() { Run(); });
+    }
+    mWake.notify_all();
+}
+
+bool StorageManager::GetKey(const std::string& path, std::string& key) const {
+    if (mRoot.empty())
+        return false;
+    std::error_code ec;
+    const auto absolute = std::filesystem::absolute(std::filesystem::path(path), ec).lexically_normal();
+    if (ec)
+        return false;
+    // Paths that went through a symbolic link of the root (the media server resolves them)
+    for (const auto* root : {&mRoot, &mCanonicalRoot}) {
+        const auto relative = absolute.lexically_relative(*root);
+        if (relative.empty() || relative == "." || *relative.begin() == "..")
+            continue;
+        key = relative.generic_string();
+        return true;
+    }
+    return false;
+}
+
+void StorageManager::Forget(const std::string& key) {
+    const auto entry = mEntries.find(key);
+    if (entry == mEntries.end())
+        return;
+    mUsed -= entry->second.size;
+    mEntries.erase(entry);
+}
+
+void StorageManager::RecordWrite(const std::string& path, uint64_t size) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::string key;
+    if (!GetKey(path, key))
+        return;
+
+    auto& entry = mEntries[key];
+    mUsed = mUsed - entry.size + size;
+    entry.size = size;
+    entry.written = Time::clock::now();
+    entry.used = entry.written;
+    if (mQuota > 0 && mUsed > mQuota) {
+        mEvictionPending = true;
+        mWake.notify_all();
+    }
+}
+
+void StorageManager::RecordRename(const std::string& from, const std::string& to) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::string fromKey;
+    std::string toKey;
+    const bool fromRoot = GetKey(from, fromKey);
+    const bool toRoot = GetKey(to, toKey);
+    if (!fromRoot || !toRoot) {
+        if (fromRoot)
+            Forget(fromKey);
+        return;
+    }
+
+    const auto entry = mEntries.find(fromKey);
+    if (entry == mEntries.end())
+        return;
+    const Entry moved = entry->second;
+    mEntries.erase(entry);
+    Forget(toKey);
+    mEntries[toKey] = moved;
+}
+
+void StorageManager::RecordAccess(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::string key;
+    if (!GetKey(path, key))
+        return;
+    const auto entry = mEntries.find(key);
+    if (entry != mEntries.end())
+        entry->second.used = Time::clock::now();
+}
+
+size_t StorageManager::Pin(const std::vector<std::string>& paths, const std::string& reason, bool pinned) {
+    if (reason.empty() || reason.find_first_of("\t\r\n") != std::string::npos)
+        throw "pin reasons must be a single word";
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (mRoot.empty())
+        throw "configureStorage must be invoked first";
+    size_t count = 0;
+    for (const auto& path : paths) {
+        std::string key;
+        if (!GetKey(path, key))
+            continue;
+        ++count;
+        if (pinned) {
+            mPins[key].insert(reason);
+        } else {
+            const auto pin = mPins.find(key);
+            if (pin != mPins.end() && pin->second.erase(reason) > 0 && pin->second.empty())
+                mPins.erase(pin);
+        }
+    }
+    if (!pinned) {
+        mEvictionPending = true;
+        mWake.notify_all();
+    }
+
+    std::string contents;
+    for (const auto& pin : mPins) {
+        for (const auto& pinReason : pin.second)
+            contents += pinReason + "\t" + pin.first + "\n";
+    }
+    const auto pinsPath = (mRoot / kPinsFileName).string();
+    // The write is accounted like the others
+    lock.unlock();
+    if (!WriteFileParts(pinsPath, {contents}))
+        throw AddonError(UXP_ADDON_IO_ERROR, "Unable to write " + pinsPath);
+    return count;
+}
+
+StorageManager::Usage StorageManager::GetUsage() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    Usage usage;
+    usage.root = mRoot.string();
+    usage.usedBytes = mUsed;
+    usage.quotaBytes = mQuota;
+    usage.files = mEntries.size();
+    usage.pinnedFiles = mPins.size();
+    usage.evictedFiles = mEvictedFiles;
+    usage.evictedBytes = mEvictedBytes;
+    usage.scanning = mScanPending || mScanning;
+    return usage;
+}
+
+void StorageManager::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+        ++mGeneration;
+        mWake.notify_all();
+    }
+    if (mThread.joinable())
+        mThread.join();
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mRoot.clear();
+    mCanonicalRoot.clear();
+    mQuota = 0;
+    mEntries.clear();
+    mUsed = 0;
+    mPins.clear();
+    mScanPending = false;
+    mEvictionPending = false;
+}
+
+void StorageManager::Run() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (!mStopping) {
+        if (mScanPending) {
+            mScanPending = false;
+            mScanning = true;
+            const auto root = mRoot;
+            const uint64_t generation = mGeneration;
+            lock.unlock();
+            auto found = Scan(root, generation);
+            lock.lock();
+            mScanning = false;
+            if (generation != mGeneration)
+                continue;
+            // Files written during the scan are already up to date
+            for (auto& file : found) {
+                if (mEntries.try_emplace(file.first, file.second).second)
+                    mUsed += file.second.size;
+            }
+            mEvictionPending = true;
+            continue;
+        }
+        if (mEvictionPending) {
+            mEvictionPending = false;
+            if (mQuota > 0 && mUsed > mQuota)
+                Evict(lock);
+            continue;
+        }
+        mWake.wait(lock);
+    }
+}
+
+std::vector<std::pair<std::string, StorageManager::Entry>> StorageManager::Scan(const std::filesystem::path& root,
+                                                                               uint64_t generation) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "storageScan");
+    UXP_ADDON_TRACE_SCOPE("storage", "scan");
+    std::vector<std::pair<std::string, Entry>> found;
+    std::error_code ec;
+    std::filesystem::recursive_directory_iterator iterator(root, std::filesystem::directory_options::skip_permission_denied, ec);
+    for (; !ec && iterator != std::filesystem::recursive_directory_iterator(); iterator.increment(ec)) {
+        if (mStopping || generation != mGeneration)
+            return {};
+        std::error_code entryError;
+        if (!iterator->is_regular_file(entryError))
+            continue;
+        Entry entry;
+        entry.size = iterator->file_size(entryError);
+        entry.written = iterator->last_write_time(entryError);
+        entry.used = entry.written;
+        if (!entryError)
+            found.emplace_back(iterator->path().lexically_relative(root).generic_string(), entry);
+    }
+    return found;
+}
+
+void StorageManager::Evict(std::unique_lock<std::mutex>& lock) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "storageEvict");
+    UXP_ADDON_TRACE_SCOPE("storage", "evict");
+    const uint64_t target = mQuota / 10 * 9;
+    const uint64_t generation = mGeneration;
+    const auto root = mRoot;
+
+    std::vector<std::pair<Time, std::string>> candidates;
+    for (const auto& entry : mEntries) {
+        if (IsEvictable(entry.first) && mPins.find(entry.first) == mPins.end())
+            candidates.emplace_back(mPolicy == Policy::lru ? entry.second.used : entry.second.written, entry.first);
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    for (const auto& candidate : candidates) {
+        if (mUsed <= target || mStopping || generation != mGeneration)
+            break;
+        // Written or pinned since the candidates were listed
+        const auto entry = mEntries.find(candidate.second);
+        const Time time = entry == mEntries.end() ? Time() : mPolicy == Policy::lru ? entry->second.used : entry->second.written;
+        if (entry == mEntries.end() || time != candidate.first || mPins.count(candidate.second) > 0)
+            continue;
+
+        lock.unlock();
+        const uint64_t freed = EvictFile(root, candidate.second);
+        lock.lock();
+        if (generation != mGeneration)
+            break;
+        if (freed > 0) {
+            ++mEvictedFiles;
+            mEvictedBytes += freed;
+            metrics.AddBytesOut(freed);
+        }
+    }
+}
+
+// Delete a media file and its thumbnail, then mark its sidecar. Invoked without the mutex;
+// returns the number of bytes deleted.
+uint64_t StorageManager::EvictFile(const std::filesystem::path& root, const std::string& key) {
+    uint64_t freed = 0;
+    const std::string thumbnail = ThumbnailKey(key);
+    for (const auto* file : {&key, &thumbnail}) {
+        if (file->empty())
+            continue;
+        const auto path = root / std::filesystem::path(*file);
+        std::error_code ec;
+        const uint64_t size = std::filesystem::file_size(path, ec);
+        const bool removed = !ec && std::filesystem::remove(path, ec);
+        if (removed)
+            freed += size;
+        // Also forgets the files that were already gone
+        if (removed || !std::filesystem::exists(path, ec)) {
+            std::lock_guard<std::mutex> lock(mMutex);
+            Forget(*file);
+        }
+    }
+    if (freed == 0)
+        return 0;
+
+    const auto sidecar = root / std::filesystem::path(key + kSidecarSuffix);
+    std::error_code ec;
+    std::string contents;
+    if (std::filesystem::exists(sidecar, ec)) {
+        std::ifstream input(sidecar, std::ios::binary);
+        std::ostringstream stream;
+        stream << input.rdbuf();
+        contents = stream.str();
+        if (MarkEvicted(contents))
+            WriteFileParts(sidecar.string(), {contents});
+    } else {
+        try {
+            const auto directory = sidecar.parent_path().string();
+            const auto name = sidecar.filename().string();
+            if (PackStore::Instance().Read(directory, name, contents) && MarkEvicted(contents))
+                WriteFileContents(sidecar.string(), contents, WriteOptions{false, false, true});
+        } catch (const std::exception&) {
+        }
+    }
+    return freed;
+}
@@ -0,0 +1,124 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/** Keeps the size of a storage folder (the Generations folder) under a byte quota.
+
+ The files under the root are counted once by a scan on a background thread, then
+ every write of the addon (writeFile, writeFiles, packs, faststart) updates the running
+ totals, so the usage is known without walking the tree again. Files deleted by other
+ applications are only noticed by the next scan (see Configure).
+
+ When the usage goes past the quota, the background thread evicts media files down to
+ 90% of the quota, least recently used first (a write, or a request of the media server)
+ or oldest first. A media file is evicted with its video thumbnail (<name>_thumbnail.jpg);
+ its sidecar (<file>.json, also when it is in a pack) is kept and marked with
+ "evicted": true and "evictedAt" in milliseconds since the epoch. Sidecars and packs are
+ never evicted, nor are the pinned files: pins have a reason ("pinned" by the user,
+ "imported" into a Premiere Pro project, ...) and are saved under the root.
+*/
+
+class StorageManager {
+ public:
+    enum class Policy { lru, age };
+
+    struct Usage {
+        std::string root;  // empty until configured
+        uint64_t usedBytes{0};
+        uint64_t quotaBytes{0};  // 0 when there is no quota
+        uint64_t files{0};
+        uint64_t pinnedFiles{0};
+        uint64_t evictedFiles{0};
+        uint64_t evictedBytes{0};
+        bool scanning{false};
+    };
+
+    // Name of the file of the pins, under the root
+    static constexpr const char* kPinsFileName = ".uxpstorage-pins";
+
+    static StorageManager& Instance();
+
+    // Account the files under root, evicting down to the quota (0 to only account them).
+    // Starts a new scan, also when the root didn't change.
+    void Configure(const std::string& root, uint64_t quotaBytes, Policy policy);
+
+    // @{ Invoked by the file operations, for any path: other paths than those under
+    // the root are ignored
+    void RecordWrite(const std::string& path, uint64_t size);
+    void RecordRename(const std::string& from, const std::string& to);
+    void RecordAccess(const std::string& path);
+    // @}
+
+    // Pin or unpin files for a reason. Returns the number of paths under the root.
+    size_t Pin(const std::vector<std::string>& paths, const std::string& reason, bool pinned);
+
+    Usage GetUsage();
+
+    // Stop the background thread. Invoked when the addon is terminated.
+    void Stop();
+
+    StorageManager(const StorageManager&) = delete;
+    StorageManager& operator=(const StorageManager&) = delete;
+
+ private:
+    using Time = std::filesystem::file_time_type;
+
+    struct Entry {
+        uint64_t size{0};
+        Time written;
+        Time used;
+    };
+
+    StorageManager();
+    ~StorageManager();
+
+    // Path relative to the root, false for paths outside of it. Requires the mutex.
+    bool GetKey(const std::string& path, std::string& key) const;
+    void Forget(const std::string& key);
+
+    void Run();
+    std::vector<std::pair<std::string, Entry>> Scan(const std::filesystem::path& root, uint64_t generation);
+    void Evict(std::unique_lock<std::mutex>& lock);
+    uint64_t EvictFile(const std::filesystem::path& root, const std::string& key);
+
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::thread mThread;
+    std::atomic<bool> mStopping{false};
+    // Incremented by Configure, to abandon the work for the previous root
+    std::atomic<uint64_t> mGeneration{0};
+
+    std::filesystem::path mRoot;
+    std::filesystem::path mCanonicalRoot;
+    uint64_t mQuota{0};
+    Policy mPolicy{Policy::lru};
+    bool mScanPending{false};
+    bool mScanning{false};
+    bool mEvictionPending{false};
+
+    std::unordered_map<std::string, Entry> mEntries;
+    uint64_t mUsed{0};
+    std::map<std::string, std::set<std::string>> mPins;
+    uint64_t mEvictedFiles{0};
+    uint64_t mEvictedBytes{0};
+};
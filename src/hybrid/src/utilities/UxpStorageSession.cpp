@@ -0,0 +1,382 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpStorageSession.h"
+
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include "UxpAddon.h"
+#include "UxpFiles.h"
+#include "UxpMetrics.h"
+#include "UxpStorage.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Normalize a path relative to the root ("a//b/./c" is "a/b/c") and split it into its
+// folder and name. Throws for paths that could leave the root.
+void SplitPath(const std::string& relative, std::string& directory, std::string& name) {
+    std::string normalized;
+    size_t last = 0;
+    size_t start = 0;
+    for (size_t end = 0; end <= relative.size(); ++end) {
+#ifdef _WIN32
+        const bool separator = end == relative.size() || relative[end] == '/' || relative[end] == '\\';
+#else
+        const bool separator = end == relative.size() || relative[end] == '/';
+#endif
+        if (!separator)
+            continue;
+
+        const std::string_view component(relative.data() + start, end - start);
+        if (end == 0 && end < relative.size())
+            throw "Storage paths must be relative to the root";
+        if (component == "..")
+            throw "Storage paths can't leave the root";
+#ifdef _WIN32
+        if (component.find(':') != std::string_view::npos)
+            throw "Storage paths must be relative to the root";
+#endif
+        if (!component.empty() && component != ".") {
+            last = normalized.size();
+            if (!normalized.empty())
+                normalized += '/';
+            normalized += component;
+        }
+        start = end + 1;
+    }
+    if (normalized.empty())
+        throw "Storage paths must name a file or folder";
+
+    directory = normalized.substr(0, last);
+    name = normalized.substr(last == 0 ? 0 : last + 1);
+}
+
+AddonError ClosedError() {
+    return AddonError(UXP_ADDON_IO_ERROR, "The storage session is closed");
+}
+
+}  // namespace
+
+#ifdef _WIN32
+
+// Folders are only remembered: Windows has no equivalent of openat
+class StorageSession::Directory {};
+
+#else
+
+class StorageSession::Directory {
+ public:
+    explicit Directory(int fd) : mFd(fd) {}
+    ~Directory() { close(mFd); }
+
+    int GetFd() const { return mFd; }
+
+    // A folder deleted since it was opened has no link left
+    bool IsRemoved() const {
+        struct stat status;
+        return fstat(mFd, &status) != 0 || status.st_nlink == 0;
+    }
+
+ private:
+    const int mFd;
+};
+
+#endif
+
+std::shared_ptr<StorageSession> StorageSession::Open(const std::string& root) {
+    std::error_code ec;
+    const auto absolute = std::filesystem::absolute(std::filesystem::path(root), ec).lexically_normal();
+    if (ec || root.empty())
+        throw AddonError(UXP_ADDON_IO_ERROR, "Unable to open the storage folder " + root);
+
+    // Drop the trailing separator of "/root/" that lexically_normal keeps
+    std::string path = absolute.string();
+    if (path.size() > 1 && !absolute.has_filename())
+        path = absolute.parent_path().string();
+
+    std::shared_ptr<StorageSession> session(new StorageSession(std::move(path)));
+    if (session->GetDirectory("", true) == nullptr)
+        throw AddonError(UXP_ADDON_IO_ERROR, "Unable to open the storage folder " + root);
+    return session;
+}
+
+StorageSession::~StorageSession() {
+    Close();
+}
+
+std::string StorageSession::GetPath(const std::string& relative) const {
+    std::string directory;
+    std::string name;
+    SplitPath(relative, directory, name);
+    return (std::filesystem::path(mRoot) / directory / name).string();
+}
+
+void StorageSession::Close() {
+    std::unordered_map<std::string, std::shared_ptr<Directory>> directories;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mClosed = true;
+        std::swap(directories, mDirectories);
+    }
+}
+
+std::shared_ptr<StorageSession::Directory> StorageSession::GetDirectory(const std::string& directory, bool create) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mClosed)
+        throw ClosedError();
+    return OpenDirectory(directory, create);
+}
+
+#ifdef _WIN32
+
+std::shared_ptr<StorageSession::Directory> StorageSession::OpenDirectory(const std::string& directory, bool create) {
+    const auto cached = mDirectories.find(directory);
+    if (cached != mDirectories.end())
+        return cached->second;
+
+    const auto path = std::filesystem::path(mRoot) / directory;
+    std::error_code ec;
+    if (create)
+        std::filesystem::create_directories(path, ec);
+    if (!std::filesystem::is_directory(path, ec))
+        return nullptr;
+    auto opened = std::make_shared<Directory>();
+    mDirectories.emplace(directory, opened);
+    return opened;
+}
+
+bool StorageSession::ForgetRemoved() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    const bool cached = !mDirectories.empty();
+    mDirectories.clear();
+    return cached;
+}
+
+bool StorageSession::EnsureDirectory(const std::string& relative) {
+    std::string directory;
+    std::string name;
+    SplitPath(relative, directory, name);
+    const std::string path = directory.empty() ? name : directory + "/" + name;
+    if (GetDirectory(path, true) != nullptr)
+        return true;
+    // Another application may have deleted it since it was remembered
+    return ForgetRemoved() && GetDirectory(path, true) != nullptr;
+}
+
+bool StorageSession::Write(const std::string& relative, const std::vector<std::string_view>& parts) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "sessionWrite");
+    std::string directory;
+    std::string name;
+    SplitPath(relative, directory, name);
+    uint64_t size = 0;
+    for (const auto& part : parts)
+        size += part.size();
+    metrics.AddBytesOut(size);
+
+    const auto path = std::filesystem::path(mRoot) / directory / name;
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (GetDirectory(directory, true) != nullptr) {
+            std::ofstream output(path, std::ios::binary | std::ios::out);
+            if (output.is_open()) {
+                for (const auto& part : parts)
+                    output.write(part.data(), static_cast<std::streamsize>(part.size()));
+                output.close();
+                if (!output.good())
+                    break;
+                StorageManager::Instance().RecordWrite(path.string(), size);
+                return true;
+            }
+        }
+        if (!ForgetRemoved())
+            break;
+    }
+    metrics.Fail();
+    return false;
+}
+
+bool StorageSession::Read(const std::string& relative, std::string& data) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "sessionRead");
+    std::string directory;
+    std::string name;
+    SplitPath(relative, directory, name);
+    if (GetDirectory(directory, false) == nullptr)
+        return false;
+
+    const auto path = std::filesystem::path(mRoot) / directory / name;
+    std::ifstream input(path, std::ios::binary);
+    if (!input.is_open())
+        return false;
+    data.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    if (input.bad()) {
+        metrics.Fail();
+        throw AddonError(UXP_ADDON_IO_ERROR, "Unable to read " + path.string());
+    }
+    metrics.AddBytesIn(data.size());
+    StorageManager::Instance().RecordAccess(path.string());
+    return true;
+}
+
+#else
+
+std::shared_ptr<StorageSession::Directory> StorageSession::OpenDirectory(const std::string& directory, bool create) {
+    const auto cached = mDirectories.find(directory);
+    if (cached != mDirectories.end())
+        return cached->second;
+
+    int fd = -1;
+    if (directory.empty()) {
+        std::error_code ec;
+        if (create)
+            std::filesystem::create_directories(std::filesystem::path(mRoot), ec);
+        fd = open(mRoot.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    } else {
+        const size_t slash = directory.rfind('/');
+        const auto parent = OpenDirectory(slash == std::string::npos ? std::string() : directory.substr(0, slash), create);
+        if (parent == nullptr)
+            return nullptr;
+
+        const char* name = directory.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+        fd = openat(parent->GetFd(), name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0 && errno == ENOENT && create && (mkdirat(parent->GetFd(), name, 0777) == 0 || errno == EEXIST))
+            fd = openat(parent->GetFd(), name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    if (fd < 0)
+        return nullptr;
+
+    auto opened = std::make_shared<Directory>(fd);
+    mDirectories.emplace(directory, opened);
+    return opened;
+}
+
+bool StorageSession::ForgetRemoved() {
+    std::vector<std::shared_ptr<Directory>> removed;
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto iter = mDirectories.begin(); iter != mDirectories.end();) {
+        if (iter->second->IsRemoved()) {
+            removed.push_back(std::move(iter->second));
+            iter = mDirectories.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+    return !removed.empty();
+}
+
+bool StorageSession::EnsureDirectory(const std::string& relative) {
+    std::string directory;
+    std::string name;
+    SplitPath(relative, directory, name);
+    const std::string path = directory.empty() ? name : directory + "/" + name;
+    if (GetDirectory(path, true) != nullptr)
+        return true;
+    // Another application may have deleted one of its parents since it was opened
+    return ForgetRemoved() && GetDirectory(path, true) != nullptr;
+}
+
+bool StorageSession::Write(const std::string& relative, const std::vector<std::string_view>& parts) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "sessionWrite");
+    std::string directory;
+    std::string name;
+    SplitPath(relative, directory, name);
+    uint64_t size = 0;
+    for (const auto& part : parts)
+        size += part.size();
+    metrics.AddBytesOut(size);
+
+    int fd = -1;
+    for (int attempt = 0; attempt < 2 && fd < 0; ++attempt) {
+        const auto parent = GetDirectory(directory, true);
+        if (parent != nullptr)
+            fd = openat(parent->GetFd(), name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0 && !ForgetRemoved())
+            break;
+    }
+    if (fd < 0) {
+        metrics.Fail();
+        return false;
+    }
+
+    bool success = true;
+    for (const auto& part : parts) {
+        for (size_t written = 0; success && written < part.size();) {
+            const ssize_t count = write(fd, part.data() + written, part.size() - written);
+            if (count < 0 && errno == EINTR)
+                continue;
+            success = count > 0;
+            if (success)
+                written += static_cast<size_t>(count);
+        }
+    }
+    success = close(fd) == 0 && success;
+    if (!success) {
+        metrics.Fail();
+        return false;
+    }
+    StorageManager::Instance().RecordWrite(mRoot + "/" + (directory.empty() ? name : directory + "/" + name), size);
+    return true;
+}
+
+bool StorageSession::Read(const std::string& relative, std::string& data) {
+    UXP_ADDON_METRICS_SCOPE(metrics, operations, "sessionRead");
+    std::string directory;
+    std::string name;
+    SplitPath(relative, directory, name);
+
+    int fd = -1;
+    for (int attempt = 0; attempt < 2 && fd < 0; ++attempt) {
+        const auto parent = GetDirectory(directory, false);
+        if (parent != nullptr)
+            fd = openat(parent->GetFd(), name.c_str(), O_RDONLY | O_CLOEXEC);
+        // The folder may have been replaced since it was opened
+        if (fd < 0 && !ForgetRemoved())
+            break;
+    }
+    if (fd < 0)
+        return false;
+
+    const std::string path = mRoot + "/" + (directory.empty() ? name : directory + "/" + name);
+    struct stat status;
+    if (fstat(fd, &status) != 0 || !S_ISREG(status.st_mode)) {
+        close(fd);
+        metrics.Fail();
+        throw AddonError(UXP_ADDON_IO_ERROR, path + " is not a regular file");
+    }
+    data.resize(static_cast<size_t>(status.st_size));
+    size_t size = 0;
+    while (size < data.size()) {
+        const ssize_t count = read(fd, &data[size], data.size() - size);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0) {
+            close(fd);
+            metrics.Fail();
+            throw AddonError(UXP_ADDON_IO_ERROR, "Unable to read " + path);
+        }
+        if (count == 0)
+            break;
+        size += static_cast<size_t>(count);
+    }
+    close(fd);
+    data.resize(size);
+    metrics.AddBytesIn(size);
+    StorageManager::Instance().RecordAccess(path);
+    return true;
+}
+
+#endif
@@ -0,0 +1,81 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/** A storage folder opened once for many saves (see openStorage).
+
+ Paths are relative to the root, with '/' separators, and can't leave it. The session
+ keeps the root and every subfolder it used open, and creates, writes and reads files
+ relative to those descriptors (openat, mkdirat), so that a save in a known dated folder
+ doesn't walk or stat the path again. A subfolder deleted by another application is
+ noticed by the failing call, which opens it again once.
+ On Windows the session only remembers the folders it created, and uses full paths.
+
+ Sessions are safe to use from any thread. Operations in flight when the session is
+ closed complete; later ones throw.
+*/
+
+class StorageSession {
+ public:
+    // Creates the root if needed. Throws an AddonError with the IO_ERR code if it can't be opened.
+    static std::shared_ptr<StorageSession> Open(const std::string& root);
+
+    ~StorageSession();
+
+    // The absolute path of the root
+    const std::string& GetRoot() const { return mRoot; }
+
+    // The full path of a file or folder of the session
+    std::string GetPath(const std::string& relative) const;
+
+    // Create a folder and its parents. Returns false if it can't be created.
+    bool EnsureDirectory(const std::string& relative);
+
+    // Write the concatenation of parts, creating the parent folders. Returns false if the
+    // file can't be written.
+    bool Write(const std::string& relative, const std::vector<std::string_view>& parts);
+
+    // Copy the contents of a file. Returns false if there is no such file.
+    // Throws an AddonError with the IO_ERR code if it can't be read.
+    bool Read(const std::string& relative, std::string& data);
+
+    // Release the descriptors
+    void Close();
+
+    StorageSession(const StorageSession&) = delete;
+    StorageSession& operator=(const StorageSession&) = delete;
+
+ private:
+    class Directory;
+
+    explicit StorageSession(std::string root) : mRoot(std::move(root)) {}
+
+    // The folder of a relative path, opened or created (nullptr if it can't be).
+    // Throws if the session is closed.
+    std::shared_ptr<Directory> GetDirectory(const std::string& directory, bool create);
+    // Requires the mutex
+    std::shared_ptr<Directory> OpenDirectory(const std::string& directory, bool create);
+    // Drop the folders deleted since they were opened. Returns whether there were any.
+    bool ForgetRemoved();
+
+    const std::string mRoot;
+    std::mutex mMutex;
+    bool mClosed{false};
+    // By path relative to the root, "" for the root
+    std::unordered_map<std::string, std::shared_ptr<Directory>> mDirectories;
+};
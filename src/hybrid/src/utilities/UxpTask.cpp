@@ -1,103 +1,492 @@
-/************************************************************************
- * Copyright 2022 Adobe
- * All Rights Reserved.
- *
- * NOTICE: Adobe permits you to use, modify, and distribute this file in
- * accordance with the terms of the Adobe license agreement accompanying
- * it.
- *************************************************************************
- */
-
-#include "UxpTask.h"
-
-#include "UxpAddon.h"
-
-struct TaskWrapper {
-    static void MainThreadThunk(addon_task_data data);
-    static void ScriptingThreadThunk(addon_task_data data);
-    std::shared_ptr<Task> task;
-};
-
-void TaskWrapperDestructor(addon_task_data data) {
-    try {
-        delete reinterpret_cast<TaskWrapper*>(data);
-    } catch (...) {
-    }
-}
-
-void TaskWrapper::MainThreadThunk(addon_task_data data) {
-    try {
-        reinterpret_cast<TaskWrapper*>(data)->task->InvokeMainThreadHandler();
-    } catch (...) {
-    }
-}
-
-void TaskWrapper::ScriptingThreadThunk(addon_task_data data) {
-    try {
-        reinterpret_cast<TaskWrapper*>(data)->task->InvokeScriptingThreadHandler();
-    } catch (...) {
-    }
-}
-
-std::shared_ptr<Task> Task::Create() {
-    return std::shared_ptr<Task>(new Task);
-}
-
-addon_value Task::ScheduleOnMainThread(addon_env env, const Handler& handler) {
-    if (mDeferred != nullptr)
-        throw "Tasks can only be used to schedule one operation";
-
-    this->mHandler = handler;
-
-    addon_value promise = nullptr;
-    Check(UxpAddonApis.uxp_addon_create_promise(env, &mDeferred, &promise));
-
-    TaskWrapper* wrapper = new TaskWrapper;
-    wrapper->task = shared_from_this();
-
-    mEnv = env;
-
-    UxpAddonApis.uxp_addon_schedule_on_main_queue(env, TaskWrapper::MainThreadThunk, wrapper, TaskWrapperDestructor);
-
-    return promise;
-}
-
-void Task::ScheduleOnScriptingThread(const ResultHandler& resultHandler) {
-    mResultHandler = resultHandler;
-
-    TaskWrapper* wrapper = new TaskWrapper;
-    wrapper->task = shared_from_this();
-
-    UxpAddonApis.uxp_addon_schedule_on_javascript_queue(
-        mEnv, TaskWrapper::ScriptingThreadThunk, wrapper, TaskWrapperDestructor);
-}
-
-void Task::InvokeMainThreadHandler() {
-    Handler tmpHandler;
-    std::swap(tmpHandler, mHandler);
-    if (tmpHandler != nullptr)
-        tmpHandler(*this);
-}
-
-void Task::InvokeScriptingThreadHandler() {
-    ResultHandler tmpHandler;
-    std::swap(tmpHandler, mResultHandler);
-
-    addon_deferred tmpDeferred = nullptr;
-    std::swap(tmpDeferred, mDeferred);
-
-    if (tmpHandler != nullptr)
-        tmpHandler(*this, mEnv, tmpDeferred);
-}
-
-void Task::SetResult(Value&& value, bool isError) {
-    mResult = std::make_unique<Value>(std::move(value));
-    mIsError = isError;
-}
-
-const Value& Task::GetResult(bool& isError) const {
-    isError = mIsError;
-    if (mResult.get() == nullptr)
-        throw "No result was set";
-    return *mResult;
-}
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpTask.h"
+
+#include <algorithm>
+#include <exception>
+#include <limits>
+#include <mutex>
+
+#include "UxpAddon.h"
+#include "UxpMetrics.h"
+#include "UxpTrace.h"
+#include "UxpWorkerPool.h"
+
+namespace {
+
+// Time that stages and completions wait in the queues
+const metrics::MetricId kMainQueueMetric = metrics::Register(metrics::Category::queues, "main");
+const metrics::MetricId kScriptQueueMetric = metrics::Register(metrics::Category::queues, "script");
+const metrics::MetricId kWorkerQueueMetric = metrics::Register(metrics::Category::queues, "worker");
+
+}  // namespace
+
+struct TaskWrapper {
+    static void MainThreadThunk(addon_task_data data);
+    static void ScriptingThreadThunk(addon_task_data data);
+    static void WorkerThreadThunk(addon_task_data data);
+    static void DroppedThunk(addon_task_data data);
+    std::shared_ptr<Task> task;
+
+    // Index of the stage to invoke, or kCompletion for the result handler
+    static constexpr size_t kCompletion = std::numeric_limits<size_t>::max();
+    size_t stage{kCompletion};
+
+    QueueStamp queued;
+    uint64_t flow{0};  // trace arrow from the schedule to the invocation
+};
+
+void TaskWrapperDestructor(addon_task_data data) {
+    try {
+        delete reinterpret_cast<TaskWrapper*>(data);
+    } catch (...) {
+    }
+}
+
+void TaskWrapper::MainThreadThunk(addon_task_data data) {
+    try {
+        TaskWrapper* wrapper = reinterpret_cast<TaskWrapper*>(data);
+        wrapper->queued.Record(kMainQueueMetric);
+        trace::SetThreadName("host main");
+        UXP_ADDON_TRACE_SCOPE("task", "main stage");
+        trace::FlowEnd("task", "hop", wrapper->flow);
+        wrapper->task->InvokeStage(wrapper->stage);
+    } catch (...) {
+    }
+}
+
+void TaskWrapper::ScriptingThreadThunk(addon_task_data data) {
+    try {
+        TaskWrapper* wrapper = reinterpret_cast<TaskWrapper*>(data);
+        wrapper->queued.Record(kScriptQueueMetric);
+        trace::SetThreadName("javascript");
+        UXP_ADDON_TRACE_SCOPE("task", wrapper->stage == kCompletion ? "completion" : "script stage");
+        trace::FlowEnd("task", "hop", wrapper->flow);
+        if (wrapper->stage == kCompletion)
+            wrapper->task->InvokeScriptingThreadHandler();
+        else
+            wrapper->task->InvokeStage(wrapper->stage);
+    } catch (...) {
+    }
+}
+
+void TaskWrapper::WorkerThreadThunk(addon_task_data data) {
+    try {
+        TaskWrapper* wrapper = reinterpret_cast<TaskWrapper*>(data);
+        wrapper->queued.Record(kWorkerQueueMetric);
+        UXP_ADDON_TRACE_SCOPE("task", "worker stage");
+        trace::FlowEnd("task", "hop", wrapper->flow);
+        wrapper->task->InvokeStage(wrapper->stage);
+    } catch (...) {
+    }
+}
+
+void TaskWrapper::DroppedThunk(addon_task_data data) {
+    try {
+        // The pool shut down before the stage started: reject rather than leave the promise pending
+        TaskWrapper* wrapper = reinterpret_cast<TaskWrapper*>(data);
+        const OperationCancelled cancelled(false);
+        wrapper->task->SetError(cancelled.GetCode(), cancelled.what());
+        wrapper->task->Finish();
+    } catch (...) {
+    }
+}
+
+std::shared_ptr<Task> Task::Create() {
+    return std::shared_ptr<Task>(new Task);
+}
+
+std::shared_ptr<Task> Task::WhenAll(std::vector<std::shared_ptr<Task>> tasks) {
+    auto join = Create();
+    join->mJoinMode = JoinMode::all;
+    join->mSubTasks = std::move(tasks);
+    return join;
+}
+
+std::shared_ptr<Task> Task::WhenAny(std::vector<std::shared_ptr<Task>> tasks) {
+    if (tasks.empty())
+        throw "WhenAny requires at least one task";
+
+    auto join = Create();
+    join->mJoinMode = JoinMode::any;
+    join->mSubTasks = std::move(tasks);
+    return join;
+}
+
+std::shared_ptr<Task> Task::WhenAllLanes(size_t count,
+                                         size_t lanes,
+                                         size_t chunk,
+                                         const RangeHandler& handler,
+                                         std::shared_ptr<CancellationToken> token,
+                                         std::shared_ptr<ProgressChannel> progress) {
+    chunk = std::max<size_t>(chunk, 1);
+    return WhenAllLanes([count](Task&) { return count; }, std::min(lanes, (count + chunk - 1) / chunk), chunk, handler,
+                        std::move(token), std::move(progress));
+}
+
+std::shared_ptr<Task> Task::WhenAllLanes(const CountHandler& prepare,
+                                         size_t lanes,
+                                         size_t chunk,
+                                         const RangeHandler& handler,
+                                         std::shared_ptr<CancellationToken> token,
+                                         std::shared_ptr<ProgressChannel> progress) {
+    struct Items {
+        std::once_flag prepared;
+        size_t count{0};
+        std::exception_ptr error;
+        std::atomic<size_t> next{0};
+    };
+
+    chunk = std::max<size_t>(chunk, 1);
+    auto items = std::make_shared<Items>();
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        auto task = Create();
+        task->Then(Lane::worker, [prepare, chunk, handler, items](Task& task) {
+            // Every lane fails with the error of prepare, which only runs once
+            std::call_once(items->prepared, [&] {
+                try {
+                    items->count = prepare(task);
+                } catch (...) {
+                    items->error = std::current_exception();
+                }
+            });
+            if (items->error != nullptr)
+                std::rethrow_exception(items->error);
+
+            const size_t count = items->count;
+            for (size_t begin = items->next.fetch_add(chunk); begin < count; begin = items->next.fetch_add(chunk)) {
+                task.ThrowIfCancelled();
+                handler(task, begin, std::min(begin + chunk, count));
+            }
+        });
+        tasks.push_back(task);
+    }
+
+    auto join = WhenAll(std::move(tasks));
+    join->SetCancellationToken(std::move(token));
+    join->SetProgressChannel(std::move(progress), false);
+    return join;
+}
+
+addon_value Task::ScheduleOnMainThread(addon_env env, const Handler& handler) {
+    Then(Lane::main, handler);
+    return Start(env);
+}
+
+Task& Task::Then(Lane lane, const Handler& handler) {
+    if (mStarted)
+        throw "Stages can only be added before the task is started";
+
+    mStages.push_back({lane, handler});
+    return *this;
+}
+
+Task& Task::SetCancellationToken(std::shared_ptr<CancellationToken> token) {
+    if (mStarted)
+        throw "The cancellation token can only be set before the task is started";
+
+    mToken = std::move(token);
+    return *this;
+}
+
+Task& Task::SetTimeout(std::chrono::milliseconds timeout) {
+    if (mToken == nullptr)
+        SetCancellationToken(CancellationToken::Create());
+
+    mToken->SetTimeout(timeout);
+    return *this;
+}
+
+Task& Task::SetProgressChannel(std::shared_ptr<ProgressChannel> channel, bool countSubTasks) {
+    if (mStarted)
+        throw "The progress channel can only be set before the task is started";
+
+    mProgress = std::move(channel);
+    mCountSubTasks = countSubTasks;
+    return *this;
+}
+
+addon_value Task::Start(addon_env env) {
+    if (mStarted || mDeferred != nullptr)
+        throw "Tasks can only be started once";
+
+    addon_value promise = nullptr;
+    Check(UxpAddonApis.uxp_addon_create_promise(env, &mDeferred, &promise));
+
+    if (mToken != nullptr)
+        Check(UxpAddonApis.uxp_addon_set_named_property(env, promise, "signal", mToken->CreateHandle(env)));
+
+    Run(env);
+    return promise;
+}
+
+void Task::Run(addon_env env) {
+    if (mStarted)
+        throw "Tasks can only be started once";
+
+    mStarted = true;
+    mEnv = env;
+
+    if (mJoinMode == JoinMode::none || mSubTasks.empty()) {
+        if (mJoinMode == JoinMode::all)
+            SetResult(Value(Value::Kind::list), false);
+        Advance(0);
+        return;
+    }
+
+    mPending = mSubTasks.size();
+    mSubTaskCount = mSubTasks.size();
+    auto self = shared_from_this();
+    // The last sub-task may complete (and clear mSubTasks) before this loop ends
+    const auto subTasks = mSubTasks;
+    // The sub-tasks get tokens of their own, so that the first one to complete (WhenAny)
+    // or to fail (WhenAll) can cancel the others without cancelling the join
+    for (const auto& subTask : subTasks)
+        subTask->mToken = CancellationToken::Create(subTask->mToken != nullptr ? subTask->mToken : mToken);
+    for (size_t index = 0; index < subTasks.size(); ++index) {
+        const auto& subTask = subTasks[index];
+        subTask->mOnComplete = [self, index](Task& completed) { self->OnSubTaskComplete(index, completed); };
+        subTask->Run(env);
+    }
+}
+
+void Task::OnSubTaskComplete(size_t index, Task& subTask) {
+    if (mJoinMode == JoinMode::any) {
+        if (mSettled.exchange(true))
+            return;
+
+        if (subTask.mIsError) {
+            AdoptError(subTask);
+        } else {
+            Value result(Value::Kind::map);
+            result.GetMap().emplace("index", Value(static_cast<double>(index)));
+            bool isError = false;
+            result.GetMap().emplace("value", subTask.HasResult() ? subTask.TakeResult(isError) : Value());
+            SetResult(std::move(result), false);
+        }
+        for (size_t other = 0; other < mSubTasks.size(); ++other) {
+            if (other != index)
+                mSubTasks[other]->mToken->Cancel();
+        }
+        Advance(0);
+        return;
+    }
+
+    // The first failure rejects the join right away and cancels the other sub-tasks. This
+    // completion isn't counted yet, so mSubTasks can't be cleared during the loop.
+    const bool failed = subTask.mIsError && !mSettled.exchange(true);
+    if (failed) {
+        AdoptError(subTask);
+        for (size_t other = 0; other < mSubTasks.size(); ++other) {
+            if (other != index)
+                mSubTasks[other]->mToken->Cancel();
+        }
+    }
+
+    const size_t pending = mPending.fetch_sub(1) - 1;
+    if (mCountSubTasks)
+        ReportProgress(static_cast<double>(mSubTaskCount - pending), static_cast<double>(mSubTaskCount));
+    if (failed) {
+        if (pending == 0)
+            mSubTasks.clear();
+        Advance(0);
+        return;
+    }
+    if (pending != 0)
+        return;
+
+    // The join was rejected by a failed sub-task, this is the last one to complete
+    if (mSettled.exchange(true)) {
+        mSubTasks.clear();
+        return;
+    }
+
+    // All sub-tasks are done, collect their results in order
+    Value results(Value::Kind::list);
+    for (auto& completed : mSubTasks) {
+        if (completed->mIsError) {
+            AdoptError(*completed);
+            break;
+        }
+        bool isError = false;
+        results.GetList().emplace_back(completed->HasResult() ? completed->TakeResult(isError) : Value());
+    }
+    if (!mIsError)
+        SetResult(std::move(results), false);
+
+    mSubTasks.clear();
+    Advance(0);
+}
+
+void Task::Advance(size_t stageIndex) {
+    if (mIsError || stageIndex >= mStages.size())
+        Finish();
+    else
+        Dispatch(stageIndex);
+}
+
+void Task::Dispatch(size_t stageIndex) {
+    UXP_ADDON_TRACE_SCOPE("task", "schedule stage");
+    TaskWrapper* wrapper = new TaskWrapper;
+    wrapper->task = shared_from_this();
+    wrapper->stage = stageIndex;
+    wrapper->flow = trace::NewFlowId();
+    trace::FlowBegin("task", "hop", wrapper->flow);
+
+    switch (mStages[stageIndex].lane) {
+    case Lane::main:
+        UxpAddonApis.uxp_addon_schedule_on_main_queue(
+            mEnv, TaskWrapper::MainThreadThunk, wrapper, TaskWrapperDestructor);
+        break;
+    case Lane::script:
+        UxpAddonApis.uxp_addon_schedule_on_javascript_queue(
+            mEnv, TaskWrapper::ScriptingThreadThunk, wrapper, TaskWrapperDestructor);
+        break;
+    case Lane::worker: {
+        std::shared_ptr<TaskWrapper> owned(wrapper, TaskWrapperDestructor);
+        try {
+            WorkerPool::Instance().Schedule([owned]() { TaskWrapper::WorkerThreadThunk(owned.get()); },
+                                            [owned]() { TaskWrapper::DroppedThunk(owned.get()); });
+        } catch (...) {
+            // The pool is shutting down: settle the promise rather than leaving it pending
+            SetError(GetExceptionCode(), GetExceptionMessage());
+            Finish();
+        }
+    } break;
+    }
+}
+
+void Task::Finish() {
+    if (mOnComplete != nullptr) {
+        // Sub-task of a join: hand the result to the joined task
+        Handler onComplete;
+        std::swap(onComplete, mOnComplete);
+        onComplete(*this);
+        return;
+    }
+
+    ScheduleCompletion([](Task& task, addon_env env, addon_deferred deferred) { task.Resolve(env, deferred); });
+}
+
+void Task::AdoptError(Task& other) {
+    mIsError = true;
+    mErrorCode = other.mErrorCode;
+    mErrorMessage = other.mErrorMessage;
+    mResult = std::move(other.mResult);
+}
+
+void Task::ScheduleOnScriptingThread(const ResultHandler& resultHandler) {
+    ScheduleCompletion(resultHandler);
+}
+
+void Task::ScheduleCompletion(const ResultHandler& resultHandler) {
+    mCompleting = true;
+    mResultHandler = resultHandler;
+
+    UXP_ADDON_TRACE_SCOPE("task", "schedule completion");
+    TaskWrapper* wrapper = new TaskWrapper;
+    wrapper->task = shared_from_this();
+    wrapper->flow = trace::NewFlowId();
+    trace::FlowBegin("task", "hop", wrapper->flow);
+
+    UxpAddonApis.uxp_addon_schedule_on_javascript_queue(
+        mEnv, TaskWrapper::ScriptingThreadThunk, wrapper, TaskWrapperDestructor);
+}
+
+void Task::Resolve(addon_env env, addon_deferred deferred) {
+    if (deferred == nullptr)
+        return;
+
+    HandlerScope scope(env);
+    addon_value resultValue = nullptr;
+    if (mIsError && !mErrorCode.empty())
+        resultValue = CreateError(env, mErrorCode, mErrorMessage);
+    else if (mResult != nullptr)
+        resultValue = mResult->Convert(env);
+    else
+        Check(UxpAddonApis.uxp_addon_get_undefined(env, &resultValue));
+
+    if (mIsError)
+        Check(UxpAddonApis.uxp_addon_reject_deferred(env, deferred, resultValue));
+    else
+        Check(UxpAddonApis.uxp_addon_resolve_deferred(env, deferred, resultValue));
+}
+
+void Task::InvokeStage(size_t stageIndex) {
+    Handler tmpHandler;
+    std::swap(tmpHandler, mStages[stageIndex].handler);
+
+    try {
+        // Drop the stage if the task was cancelled while it was queued
+        ThrowIfCancelled();
+
+        if (tmpHandler != nullptr) {
+            if (mStages[stageIndex].lane == Lane::script) {
+                HandlerScope scope(mEnv);
+                tmpHandler(*this);
+            } else {
+                tmpHandler(*this);
+            }
+        }
+    } catch (...) {
+        SetError(GetExceptionCode(), GetExceptionMessage());
+    }
+
+    // The handler completed the task by itself
+    if (mCompleting)
+        return;
+
+    Advance(stageIndex + 1);
+}
+
+void Task::InvokeScriptingThreadHandler() {
+    ResultHandler tmpHandler;
+    std::swap(tmpHandler, mResultHandler);
+
+    addon_deferred tmpDeferred = nullptr;
+    std::swap(tmpDeferred, mDeferred);
+
+    // Deliver the last progress update before JavaScript sees the completion
+    if (mProgress != nullptr)
+        mProgress->Close();
+
+    if (tmpHandler != nullptr)
+        tmpHandler(*this, mEnv, tmpDeferred);
+}
+
+void Task::SetResult(Value&& value, bool isError) {
+    mResult = std::make_unique<Value>(std::move(value));
+    mIsError = isError;
+}
+
+void Task::SetError(const std::string& code, const std::string& message) {
+    mResult.reset();
+    mIsError = true;
+    mErrorCode = code;
+    mErrorMessage = message;
+}
+
+const Value& Task::GetResult(bool& isError) const {
+    isError = mIsError;
+    if (mResult.get() == nullptr)
+        throw "No result was set";
+    return *mResult;
+}
+
+Value Task::TakeResult(bool& isError) {
+    isError = mIsError;
+    if (mResult.get() == nullptr)
+        throw "No result was set";
+    Value result(std::move(*mResult));
+    mResult.reset();
+    return result;
+}
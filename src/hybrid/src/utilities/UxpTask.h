@@ -1,57 +1,189 @@
-/************************************************************************
- * Copyright 2022 Adobe
- * All Rights Reserved.
- *
- * NOTICE: Adobe permits you to use, modify, and distribute this file in
- * accordance with the terms of the Adobe license agreement accompanying
- * it.
- *************************************************************************
- */
-
-#pragma once
-
-#include <functional>
-#include <memory>
-
-#include "../api/UxpAddonShared.h"
-#include "../api/UxpAddonTypes.h"
-#include "UxpValue.h"
-
-/** The Task class can be used to implement tasks that are asynchonous in nature.
- An example of such a task is something that needs to invoke APIs on the main thread.
- The general flow of a Task is that the scripting thread creates the task and an
- assocated deferred value. This value is returned to JavaScript and becomes and awaitable
- promise.
- When the task is complete, then it must schedule a promise resolution on the scripting thread.
-*/
-
-class Task : public std::enable_shared_from_this<Task> {
- public:
-    static std::shared_ptr<Task> Create();
-
-    using Handler = std::function<void(Task&)>;
-    addon_value ScheduleOnMainThread(addon_env env, const Handler& handler);
-
-    using ResultHandler = std::function<void(Task&, addon_env env, addon_deferred deferred)>;
-    void ScheduleOnScriptingThread(const ResultHandler& resultHandler);
-
-    void SetResult(Value&& value, bool isError);
-    const Value& GetResult(bool& isError) const;
-
- protected:
-    Task() {}
-
- private:
-    friend struct TaskWrapper;
-    void InvokeMainThreadHandler();
-    void InvokeScriptingThreadHandler();
-
-    Handler mHandler;
-    ResultHandler mResultHandler;
-    addon_deferred mDeferred{nullptr};
-    std::unique_ptr<Value> mResult;
-    bool mIsError{false};
-
-    // Cached script environment
-    addon_env mEnv{nullptr};
-};
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../api/UxpAddonShared.h"
+#include "../api/UxpAddonTypes.h"
+#include "UxpCancellation.h"
+#include "UxpProgress.h"
+#include "UxpValue.h"
+
+/** The Task class can be used to implement tasks that are asynchonous in nature.
+ An example of such a task is something that needs to invoke APIs on the main thread.
+ The general flow of a Task is that the scripting thread creates the task and an
+ assocated deferred value. This value is returned to JavaScript and becomes and awaitable
+ promise.
+ When the task is complete, then it must schedule a promise resolution on the scripting thread.
+
+ A task can also be built as a pipeline of stages, each running on a given lane:
+     task->Then(Task::Lane::worker, decode).Then(Task::Lane::main, import).Then(Task::Lane::worker, index);
+     return task->Start(env);
+ Stages run one after another; each stage passes its output to the next one through
+ SetResult/GetResult. Once the last stage has run, the promise is resolved with the
+ current result (or rejected if the result is an error). A stage that throws rejects
+ the promise and skips the remaining stages.
+ WhenAll/WhenAny join several tasks into one; the joined task runs its own stages
+ once its sub-tasks completed.
+
+ A task can be given a CancellationToken and/or a timeout. Stages that have not started
+ when the token is cancelled (or the deadline passed) are dropped and the promise is
+ rejected with an ABORT_ERR/TIMEOUT_ERR error. Running stages should poll IsCancelled or
+ call ThrowIfCancelled. The promise of a cancellable task carries a "signal" property
+ through which JavaScript can cancel it: promise.signal.cancel().
+ Sub-tasks of a join run with tokens of their own that follow the token they had, or the
+ join's, so that the join can cancel them without being cancelled itself.
+
+ A task can also stream its progress to a JavaScript callback through a ProgressChannel.
+ Stages call ReportProgress as often as they like; the updates are coalesced to at most
+ one callback per frame. A WhenAll join reports (completed sub-tasks, sub-task count) by
+ itself, unless its sub-tasks publish finer progress to the channel (countSubTasks false).
+ The pending progress is delivered before the promise completes.
+*/
+
+class Task : public std::enable_shared_from_this<Task> {
+ public:
+    enum class Lane { main, worker, script };
+
+    static std::shared_ptr<Task> Create();
+
+    // The result of the joined task is the list of the sub-task results.
+    // Rejects with the error of the first sub-task that failed, as soon as it failed; the
+    // other sub-tasks are then cancelled.
+    static std::shared_ptr<Task> WhenAll(std::vector<std::shared_ptr<Task>> tasks);
+
+    // The result of the joined task is { index, value } of the first sub-task that completed.
+    // Rejects if that sub-task failed. The other sub-tasks are then cancelled.
+    static std::shared_ptr<Task> WhenAny(std::vector<std::shared_ptr<Task>> tasks);
+
+    // A WhenAll join of up to lanes worker sub-tasks over count items: each lane takes the
+    // next chunk of items, handler(task, begin, end), until they are exhausted, and checks
+    // for cancellation before each chunk. The join gets the token and the progress channel;
+    // the handler publishes the progress (countSubTasks false). Not started.
+    using RangeHandler = std::function<void(Task&, size_t begin, size_t end)>;
+    static std::shared_ptr<Task> WhenAllLanes(size_t count,
+                                              size_t lanes,
+                                              size_t chunk,
+                                              const RangeHandler& handler,
+                                              std::shared_ptr<CancellationToken> token = nullptr,
+                                              std::shared_ptr<ProgressChannel> progress = nullptr);
+
+    // The same over the count of items that prepare returns: the first lane to start runs it
+    // (to list the items off the JavaScript thread) while the others wait. All the lanes are
+    // started, since the count is not known yet.
+    using CountHandler = std::function<size_t(Task&)>;
+    static std::shared_ptr<Task> WhenAllLanes(const CountHandler& prepare,
+                                              size_t lanes,
+                                              size_t chunk,
+                                              const RangeHandler& handler,
+                                              std::shared_ptr<CancellationToken> token = nullptr,
+                                              std::shared_ptr<ProgressChannel> progress = nullptr);
+
+    using Handler = std::function<void(Task&)>;
+    addon_value ScheduleOnMainThread(addon_env env, const Handler& handler);
+
+    // Append a stage to the pipeline. Only valid before the task is started.
+    Task& Then(Lane lane, const Handler& handler);
+
+    // Run the pipeline and return the promise that completes with it.
+    // This method must be invoked on the JavaScript thread.
+    addon_value Start(addon_env env);
+
+    // Complete the task with a custom result handler. Remaining stages are skipped.
+    using ResultHandler = std::function<void(Task&, addon_env env, addon_deferred deferred)>;
+    void ScheduleOnScriptingThread(const ResultHandler& resultHandler);
+
+    void SetResult(Value&& value, bool isError);
+    const Value& GetResult(bool& isError) const;
+    Value TakeResult(bool& isError);
+    bool HasResult() const { return mResult != nullptr; }
+
+    // Reject the task with an Error object carrying the given code and message
+    void SetError(const std::string& code, const std::string& message);
+
+    addon_env GetEnv() const { return mEnv; }
+
+    // @{ Cancellation. Only valid before the task is started.
+    Task& SetCancellationToken(std::shared_ptr<CancellationToken> token);
+    // Creates a token if the task doesn't have one yet
+    Task& SetTimeout(std::chrono::milliseconds timeout);
+    // @}
+
+    // Only valid before the task is started
+    Task& SetProgressChannel(std::shared_ptr<ProgressChannel> channel, bool countSubTasks = true);
+
+    // Can be invoked on any thread; ignored if the task has no progress channel
+    void ReportProgress(double completed, double total) {
+        if (mProgress != nullptr)
+            mProgress->Publish(completed, total);
+    }
+
+    const std::shared_ptr<CancellationToken>& GetCancellationToken() const { return mToken; }
+    bool IsCancelled() const { return mToken != nullptr && mToken->IsCancelled(); }
+    void ThrowIfCancelled() const {
+        if (mToken != nullptr)
+            mToken->ThrowIfCancelled();
+    }
+
+ protected:
+    Task() {}
+
+ private:
+    friend struct TaskWrapper;
+
+    enum class JoinMode { none, all, any };
+
+    struct Stage {
+        Lane lane;
+        Handler handler;
+    };
+
+    void Run(addon_env env);
+    void Advance(size_t stageIndex);
+    void Dispatch(size_t stageIndex);
+    void Finish();
+    void AdoptError(Task& other);
+    void OnSubTaskComplete(size_t index, Task& subTask);
+    void ScheduleCompletion(const ResultHandler& resultHandler);
+    void Resolve(addon_env env, addon_deferred deferred);
+
+    void InvokeStage(size_t stageIndex);
+    void InvokeScriptingThreadHandler();
+
+    std::vector<Stage> mStages;
+    Handler mOnComplete;
+    ResultHandler mResultHandler;
+    addon_deferred mDeferred{nullptr};
+    std::unique_ptr<Value> mResult;
+    bool mIsError{false};
+    std::string mErrorCode;
+    std::string mErrorMessage;
+    bool mStarted{false};
+    bool mCompleting{false};
+    std::shared_ptr<CancellationToken> mToken;
+    std::shared_ptr<ProgressChannel> mProgress;
+    bool mCountSubTasks{true};
+
+    // Sub-tasks of a WhenAll/WhenAny join
+    JoinMode mJoinMode{JoinMode::none};
+    std::vector<std::shared_ptr<Task>> mSubTasks;
+    std::atomic<size_t> mPending{0};
+    size_t mSubTaskCount{0};
+    std::atomic<bool> mSettled{false};
+
+    // Cached script environment
+    addon_env mEnv{nullptr};
+};
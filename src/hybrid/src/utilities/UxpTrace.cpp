@@ -0,0 +1,228 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpTrace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace trace {
+
+namespace detail {
+std::atomic<bool> gEnabled{false};
+}  // namespace detail
+
+namespace {
+
+constexpr size_t kDefaultCapacity = 32768;
+
+struct Event {
+    const char* category;
+    const char* name;
+    int64_t start;
+    int64_t duration;
+    uint64_t id;
+    char phase;  // 'X' span, 's' flow begin, 'f' flow end
+};
+
+// Ring buffer of one thread. The lock is only contended while a trace is collected.
+struct Buffer {
+    std::mutex mutex;
+    std::vector<Event> events;
+    size_t next{0};
+    size_t count{0};
+    size_t dropped{0};
+    uint64_t generation{0};
+    const char* threadName{nullptr};
+    uint32_t threadId{0};
+};
+
+// Buffers are never released: threads may record until the very end of the process
+struct Registry {
+    std::mutex mutex;
+    std::vector<Buffer*> buffers;
+    uint32_t nextThreadId{1};
+    std::atomic<size_t> capacity{kDefaultCapacity};
+    std::atomic<uint64_t> generation{0};
+    std::atomic<int64_t> origin{0};
+    std::atomic<uint64_t> nextFlowId{1};
+};
+
+Registry& GetRegistry() {
+    static Registry* registry = new Registry;
+    return *registry;
+}
+
+thread_local const char* tThreadName = nullptr;
+
+Buffer& GetBuffer() {
+    thread_local Buffer* buffer = []() {
+        Buffer* created = new Buffer;
+        Registry& registry = GetRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        created->threadId = registry.nextThreadId++;
+        registry.buffers.push_back(created);
+        return created;
+    }();
+    return *buffer;
+}
+
+void Push(const Event& event) {
+    Registry& registry = GetRegistry();
+    Buffer& buffer = GetBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+
+    // The first event of a new trace recycles the buffer of the previous one
+    const uint64_t generation = registry.generation.load(std::memory_order_acquire);
+    if (buffer.generation != generation) {
+        buffer.events.assign(registry.capacity.load(std::memory_order_relaxed), Event{});
+        buffer.next = 0;
+        buffer.count = 0;
+        buffer.dropped = 0;
+        buffer.generation = generation;
+    }
+    if (tThreadName != nullptr)
+        buffer.threadName = tThreadName;
+
+    buffer.events[buffer.next] = event;
+    buffer.next = (buffer.next + 1) % buffer.events.size();
+    if (buffer.count < buffer.events.size())
+        ++buffer.count;
+    else
+        ++buffer.dropped;
+}
+
+void AppendEscaped(std::string& json, const char* text) {
+    for (const char* c = text; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\')
+            json += '\\';
+        if (static_cast<unsigned char>(*c) >= 0x20)
+            json += *c;
+    }
+}
+
+void AppendMicroseconds(std::string& json, int64_t nanoseconds) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.3f", nanoseconds / 1000.0);
+    json += text;
+}
+
+}  // namespace
+
+int64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void Start(size_t capacity) {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.capacity.store(capacity > 0 ? capacity : kDefaultCapacity, std::memory_order_relaxed);
+    registry.origin.store(Now(), std::memory_order_relaxed);
+    registry.generation.fetch_add(1, std::memory_order_release);
+    detail::gEnabled.store(true, std::memory_order_release);
+}
+
+Summary Stop(const std::string& path) {
+    detail::gEnabled.store(false, std::memory_order_release);
+
+    Registry& registry = GetRegistry();
+    std::vector<Buffer*> buffers;
+    {
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        buffers = registry.buffers;
+    }
+    const uint64_t generation = registry.generation.load(std::memory_order_acquire);
+    const int64_t origin = registry.origin.load(std::memory_order_relaxed);
+
+    Summary summary;
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (Buffer* buffer : buffers) {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        if (buffer->generation != generation || buffer->count == 0)
+            continue;
+
+        const std::string threadId = std::to_string(buffer->threadId);
+        json += first ? "\n" : ",\n";
+        first = false;
+        json += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + threadId + ",\"args\":{\"name\":\"";
+        if (buffer->threadName != nullptr)
+            AppendEscaped(json, buffer->threadName);
+        else
+            json += "thread " + threadId;
+        json += "\"}}";
+
+        summary.dropped += buffer->dropped;
+        const size_t size = buffer->events.size();
+        const size_t oldest = (buffer->next + size - buffer->count) % size;
+        for (size_t index = 0; index < buffer->count; ++index) {
+            const Event& event = buffer->events[(oldest + index) % size];
+            if (event.start < origin)
+                continue;
+
+            json += ",\n{\"name\":\"";
+            AppendEscaped(json, event.name);
+            json += "\",\"cat\":\"";
+            AppendEscaped(json, event.category);
+            json += "\",\"ph\":\"";
+            json += event.phase;
+            json += "\",\"pid\":1,\"tid\":" + threadId + ",\"ts\":";
+            AppendMicroseconds(json, event.start - origin);
+            if (event.phase == 'X') {
+                json += ",\"dur\":";
+                AppendMicroseconds(json, event.duration);
+            } else {
+                json += ",\"id\":" + std::to_string(event.id);
+                if (event.phase == 'f')
+                    json += ",\"bp\":\"e\"";
+            }
+            json += "}";
+            ++summary.events;
+        }
+    }
+    json += "\n]}\n";
+
+    std::ofstream output(path, std::ios::binary | std::ios::out);
+    output.write(json.data(), static_cast<std::streamsize>(json.size()));
+    output.close();
+    if (!output.good())
+        throw "Unable to write the trace file";
+    return summary;
+}
+
+void SetThreadName(const char* name) {
+    tThreadName = name;
+}
+
+uint64_t NewFlowId() {
+    if (!IsEnabled())
+        return 0;
+    return GetRegistry().nextFlowId.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FlowBegin(const char* category, const char* name, uint64_t id) {
+    if (id != 0 && IsEnabled())
+        Push({category, name, Now(), 0, id, 's'});
+}
+
+void FlowEnd(const char* category, const char* name, uint64_t id) {
+    if (id != 0 && IsEnabled())
+        Push({category, name, Now(), 0, id, 'f'});
+}
+
+void RecordSpan(const char* category, const char* name, int64_t start, int64_t end) {
+    Push({category, name, start, end - start, 0, 'X'});
+}
+
+}  // namespace trace
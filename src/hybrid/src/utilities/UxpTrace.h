@@ -0,0 +1,101 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/** Trace recorder producing Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+
+ While a trace is running, spans (exports, queued stages) and flow arrows (from the
+ point where a task is scheduled to the handler that runs it) are appended to a ring
+ buffer of the thread that records them. When a buffer is full its oldest events are
+ overwritten. Stop collects the buffers of all threads and writes the JSON file.
+
+ Names and categories must be string literals (or otherwise outlive the trace):
+ only the pointers are recorded.
+
+     addon_value WriteFile(addon_env env, addon_callback_info info) {
+         UXP_ADDON_TRACE_SCOPE("export", "writeFile");
+         ...
+     }
+
+ When no trace is running, recording costs one relaxed atomic load.
+*/
+
+namespace trace {
+
+namespace detail {
+extern std::atomic<bool> gEnabled;
+}  // namespace detail
+
+inline bool IsEnabled() {
+    return detail::gEnabled.load(std::memory_order_relaxed);
+}
+
+// Start a new trace, discarding the events of a previous one.
+// capacity is the number of events kept per thread.
+void Start(size_t capacity);
+
+struct Summary {
+    size_t events{0};   // events written to the file
+    size_t dropped{0};  // events overwritten because a buffer was full
+};
+
+// Stop the trace and write it to path. Throws if the file can't be written.
+Summary Stop(const std::string& path);
+
+// Name of the calling thread in the trace. name must be a string literal.
+void SetThreadName(const char* name);
+
+// Return a new id connecting a FlowBegin to its FlowEnd; 0 when no trace is running
+uint64_t NewFlowId();
+
+// @{ Flow arrows. FlowEnd binds to the enclosing span, so it must follow a TraceSpan.
+void FlowBegin(const char* category, const char* name, uint64_t id);
+void FlowEnd(const char* category, const char* name, uint64_t id);
+// @}
+
+// Complete span, see TraceSpan
+void RecordSpan(const char* category, const char* name, int64_t start, int64_t end);
+
+// Monotonic time in nanoseconds
+int64_t Now();
+
+}  // namespace trace
+
+/** Records a span from its construction to its destruction */
+class TraceSpan {
+ public:
+    TraceSpan(const char* category, const char* name)
+        : mCategory(category), mName(name), mStart(trace::IsEnabled() ? trace::Now() : -1) {}
+
+    ~TraceSpan() {
+        if (mStart >= 0 && trace::IsEnabled())
+            trace::RecordSpan(mCategory, mName, mStart, trace::Now());
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+ private:
+    const char* const mCategory;
+    const char* const mName;
+    const int64_t mStart;
+};
+
+#define UXP_ADDON_TRACE_CONCAT2(a, b) a##b
+#define UXP_ADDON_TRACE_CONCAT(a, b) UXP_ADDON_TRACE_CONCAT2(a, b)
+
+// Trace the enclosing scope as a span
+#define UXP_ADDON_TRACE_SCOPE(category, name) TraceSpan UXP_ADDON_TRACE_CONCAT(traceSpan, __LINE__)(category, name)
@@ -0,0 +1,129 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#include "UxpWorkerPool.h"
+
+#include <algorithm>
+
+#include "UxpTrace.h"
+
+WorkerPool& WorkerPool::Instance() {
+    static WorkerPool instance;
+    return instance;
+}
+
+WorkerPool::WorkerPool() {
+    // Leave one core for the host and the scripting thread
+    const unsigned int cores = std::thread::hardware_concurrency();
+    mThreadCount = std::max(2u, cores > 1 ? cores - 1 : 1u);
+}
+
+WorkerPool::~WorkerPool() {
+    try {
+        Shutdown();
+    } catch (...) {
+    }
+}
+
+void WorkerPool::Schedule(Job job, Job drop) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mStopping)
+            throw "Worker pool is shutting down";
+        if (mThreads.empty())
+            StartLocked();
+        mJobs.push_back({std::move(job), std::move(drop)});
+    }
+    mWakeup.notify_one();
+}
+
+void WorkerPool::ScheduleDedicated(Job job) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mStopping)
+        throw "Worker pool is shutting down";
+
+    // Join the threads whose job finished since the last call
+    auto finished = std::partition(mDedicated.begin(), mDedicated.end(),
+                                   [](const auto& dedicated) { return !dedicated.second->load(); });
+    for (auto iter = finished; iter != mDedicated.end(); ++iter)
+        iter->first.join();
+    mDedicated.erase(finished, mDedicated.end());
+
+    auto done = std::make_shared<std::atomic<bool>>(false);
+    std::thread thread([job = std::move(job), done]() {
+        trace::SetThreadName("dedicated worker");
+        try {
+            job();
+        } catch (...) {
+        }
+        done->store(true);
+    });
+    mDedicated.emplace_back(std::move(thread), std::move(done));
+}
+
+void WorkerPool::StartLocked() {
+    mThreads.reserve(mThreadCount);
+    for (size_t index = 0; index < mThreadCount; ++index)
+        mThreads.emplace_back([this]() { Run(); });
+}
+
+void WorkerPool::Shutdown() {
+    std::vector<std::thread> threads;
+    std::deque<Queued> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+        std::swap(threads, mThreads);
+        std::swap(dropped, mJobs);
+        for (auto& dedicated : mDedicated)
+            threads.push_back(std::move(dedicated.first));
+        mDedicated.clear();
+    }
+    mWakeup.notify_all();
+
+    for (auto& thread : threads) {
+        if (thread.joinable())
+            thread.join();
+    }
+
+    // Still stopping: the jobs that the drop handlers schedule fail right away
+    for (auto& queued : dropped) {
+        try {
+            if (queued.drop != nullptr)
+                queued.drop();
+        } catch (...) {
+        }
+    }
+    dropped.clear();
+
+    // Allow the pool to be restarted if the addon is loaded again
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStopping = false;
+}
+
+void WorkerPool::Run() {
+    trace::SetThreadName("worker");
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWakeup.wait(lock, [this]() { return mStopping || !mJobs.empty(); });
+            if (mStopping)
+                return;
+            job = std::move(mJobs.front().job);
+            mJobs.pop_front();
+        }
+
+        try {
+            job();
+        } catch (...) {
+        }
+    }
+}
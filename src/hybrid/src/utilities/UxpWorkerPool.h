@@ -0,0 +1,71 @@
+/************************************************************************
+ * Copyright 2022 Adobe
+ * All Rights Reserved.
+ *
+ * NOTICE: Adobe permits you to use, modify, and distribute this file in
+ * accordance with the terms of the Adobe license agreement accompanying
+ * it.
+ *************************************************************************
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** The WorkerPool runs jobs on a small set of addon owned background threads.
+ The host only provides the main queue and the JavaScript queue; anything that
+ should neither block the host UI nor the scripting thread (file I/O, decoding,
+ hashing) is scheduled here instead.
+ The threads are started lazily on first use and joined when the addon is terminated.
+*/
+
+class WorkerPool {
+ public:
+    using Job = std::function<void()>;
+
+    static WorkerPool& Instance();
+
+    // drop is invoked instead of job if the pool shuts down before the job started, so that
+    // the job can still settle its promise
+    void Schedule(Job job, Job drop = nullptr);
+
+    // Run job on a thread of its own rather than on the pool, for jobs that block for an
+    // unbounded time (waiting for a spawned process). Shutdown joins these threads too.
+    void ScheduleDedicated(Job job);
+
+    // Joins all worker threads. Jobs that have not started yet are dropped: their drop
+    // handlers are invoked on the calling thread once the threads are joined.
+    void Shutdown();
+
+    size_t GetThreadCount() const { return mThreadCount; }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+ private:
+    WorkerPool();
+    ~WorkerPool();
+
+    void StartLocked();
+    void Run();
+
+    std::mutex mMutex;
+    std::condition_variable mWakeup;
+    struct Queued {
+        Job job;
+        Job drop;
+    };
+    std::deque<Queued> mJobs;
+    std::vector<std::thread> mThreads;
+    // Threads of ScheduleDedicated, with whether their job has finished
+    std::vector<std::pair<std::thread, std::shared_ptr<std::atomic<bool>>>> mDedicated;
+    size_t mThreadCount{0};
+    bool mStopping{false};
+};
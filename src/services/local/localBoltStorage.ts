@@ -163,9 +163,12 @@ export interface LocalSaveResult {
   thumbnailUrl?: string
 }
 
+// Shared by all instances: the base path is resolved and the storage session opened once
+let cachedBasePath: Promise<{ path: string; separator: string }> | null = null
+let storageSession: { path: string; session: any | null } | null = null
+
 class LocalBoltStorage {
   private addon: any | null
-  private cachedBasePath: Promise<{ path: string; separator: string }> | null = null
 
   constructor() {
     this.addon = getBoltAddon()
@@ -190,21 +193,29 @@ class LocalBoltStorage {
     )
 
     const directory = joinPath(separator, basePath, dateFolder)
-    console.log('[BoltStorage] Creating directory:', {
-      basePath,
-      dateFolder,
-      directory,
-      separator,
-      optionsSubfolder: options.subfolder
-    })
-    this.ensureDirectory(addon, directory)
+    // The session creates the dated folder with the first file written into it
+    const session = this.getStorageSession(addon, basePath)
+    if (!session) {
+      console.log('[BoltStorage] Creating directory:', {
+        basePath,
+        dateFolder,
+        directory,
+        separator,
+        optionsSubfolder: options.subfolder
+      })
+      this.ensureDirectory(addon, directory)
+    }
 
     const filePath = joinPath(separator, directory, safeFilename)
+    const writeFile = (name: string, data: string, base64: boolean) =>
+      session
+        ? session.writeFile(joinPath('/', dateFolder, name), data, base64)
+        : addon.writeFile?.(joinPath(separator, directory, name), data, base64)
 
     const arrayBuffer = await options.blob.arrayBuffer()
     const base64Payload = arrayBufferToBase64(arrayBuffer)
 
-    const writeSuccess = addon.writeFile?.(filePath, base64Payload, true)
+    const writeSuccess = writeFile(safeFilename, base64Payload, true)
     if (writeSuccess === false) {
       throw new Error(`[BoltStorage] Failed to write binary file: ${filePath}`)
     }
@@ -228,7 +239,7 @@ class LocalBoltStorage {
     }
 
     const metadataPath = joinPath(separator, directory, `${safeFilename}.json`)
-    addon.writeFile?.(metadataPath, JSON.stringify(metadataPayload, null, 2), false)
+    writeFile(`${safeFilename}.json`, JSON.stringify(metadataPayload, null, 2), false)
 
     return {
       filePath,
@@ -255,6 +266,28 @@ class LocalBoltStorage {
     return this.addon
   }
 
+  // A session of the addon for the base path, or null if the addon doesn't have openStorage
+  private getStorageSession(addon: any, basePath: string): any | null {
+    if (storageSession?.path !== basePath) {
+      let session: any | null = null
+      try {
+        // Native exports return an Error object rather than throwing
+        const result = addon.openStorage?.(basePath)
+        if (typeof result?.writeFile === 'function') {
+          session = result
+        } else if (result != null) {
+          console.warn('[BoltStorage] Unable to open a storage session:', result)
+        }
+      } catch (error) {
+        console.warn('[BoltStorage] Unable to open a storage session:', error)
+      }
+      storageSession?.session?.close?.()
+      storageSession = { path: basePath, session }
+    }
+
+    return storageSession.session
+  }
+
   private ensureDirectory(addon: any, path: string): void {
     const result = addon.ensureDirectory?.(path)
     if (result === false) {
@@ -263,8 +296,8 @@ class LocalBoltStorage {
   }
 
   private async resolveBasePath(addon: any): Promise<{ path: string; separator: string }> {
-    if (!this.cachedBasePath) {
-      this.cachedBasePath = (async () => {
+    if (!cachedBasePath) {
+      cachedBasePath = (async () => {
         let basePath: string | undefined
         try {
           basePath = addon.getDefaultStoragePath?.()
@@ -306,7 +339,7 @@ class LocalBoltStorage {
       })()
     }
 
-    return this.cachedBasePath
+    return cachedBasePath
   }
 
   private getFallbackBasePath(): string {